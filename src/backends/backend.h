@@ -1,11 +1,26 @@
 #pragma once
 
+#include "core/calibration.h"
+#include "core/telemetry.h"
+
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
 
+struct DepthFilterOptions;
+class DepthPyramid;
+struct BackgroundOptions;
+struct BlobSet;
+struct BlobTrackingOptions;
+struct ForegroundMask;
+struct PlaneDetectionOptions;
+struct PlaneSet;
+
 enum class KinectGeneration {
   kV1,
   kV2,
@@ -31,6 +46,7 @@ struct PreviewResult {
   std::string detail;
   std::uint64_t color_frames = 0;
   std::uint64_t depth_frames = 0;
+  TelemetrySnapshot telemetry;
 };
 
 struct DeviceInfo {
@@ -45,13 +61,161 @@ enum class StreamKind {
     kDepth = 2,
 };
 
+// How color reaches FrameData. Kinect v2 sends each color frame as a JPEG:
+// kDecoded delivers it as full-resolution RGB, kJpeg hands the bitstream
+// over untouched in FrameData::color_jpeg (for consumers that only record or
+// forward it), and kHalf/kQuarter decode it straight to 1/2 or 1/4 size in
+// the DCT domain, for previews. Each consumer subscribes to the mode it needs
+// (KinectDevice::subscribeColor). Devices with uncompressed color support
+// kDecoded only.
+enum class ColorCaptureMode {
+    kDecoded = 0,
+    kJpeg = 1,
+    kHalf = 2,
+    kQuarter = 3,
+};
+
+constexpr std::size_t kColorCaptureModeCount = 4;
+
+inline unsigned ColorCaptureBit(ColorCaptureMode mode) {
+    return 1u << static_cast<unsigned>(mode);
+}
+
+// Size divisor of a decoded mode (1, 2 or 4); 0 for kJpeg.
+inline int ColorCaptureScale(ColorCaptureMode mode) {
+    switch (mode) {
+        case ColorCaptureMode::kDecoded:
+            return 1;
+        case ColorCaptureMode::kJpeg:
+            return 0;
+        case ColorCaptureMode::kHalf:
+            return 2;
+        case ColorCaptureMode::kQuarter:
+            return 4;
+    }
+    return 1;
+}
+
+// What a device delivers for the modes its consumers subscribed to, as
+// ColorCaptureBit()s: the JPEG if any consumer wants it, and one decoded
+// plane at the finest scale any consumer wants. Without subscribers color is
+// decoded in full, as before there were modes.
+struct ColorCapturePlan {
+    bool jpeg = false;
+    // Divisor of the decoded plane (1, 2 or 4); 0 for none.
+    int decode_scale = 1;
+};
+
+inline ColorCapturePlan PlanColorCapture(unsigned subscriptions) {
+    ColorCapturePlan plan;
+    plan.jpeg = (subscriptions & ColorCaptureBit(ColorCaptureMode::kJpeg)) != 0;
+    plan.decode_scale = 0;
+    for (ColorCaptureMode mode : {ColorCaptureMode::kDecoded, ColorCaptureMode::kHalf, ColorCaptureMode::kQuarter}) {
+        if ((subscriptions & ColorCaptureBit(mode)) != 0) {
+            plan.decode_scale = ColorCaptureScale(mode);
+            break;
+        }
+    }
+    if (!plan.jpeg && plan.decode_scale == 0) {
+        plan.decode_scale = 1;
+    }
+    return plan;
+}
+
+// Which libfreenect2 packet pipeline decodes Kinect v2 depth (and, unless a
+// ColorCaptureMode skips it, color). kDefault is libfreenect2's own choice:
+// OpenGL, then OpenCL or CUDA, then CPU, as it was built. kCpu is its
+// single-threaded CPU pipeline. kCpuThreaded hands raw depth packets to
+// kinect_core, which runs the same computation over a thread pool
+// (processing/tof_depth_decoder.h), for hosts without a usable GPU; it is
+// only offered with the KINECT_EXPERIMENTAL_V2_CPU_THREADED build option.
+enum class V2PacketPipeline {
+    kDefault = 0,
+    kCpu = 1,
+    kCpuThreaded = 2,
+    kOpenGl = 3,
+    kOpenCl = 4,
+    kCuda = 5,
+};
+
+inline const char *V2PacketPipelineLabel(V2PacketPipeline pipeline) {
+    switch (pipeline) {
+        case V2PacketPipeline::kDefault:
+            return "default";
+        case V2PacketPipeline::kCpu:
+            return "cpu";
+        case V2PacketPipeline::kCpuThreaded:
+            return "cpu-threaded";
+        case V2PacketPipeline::kOpenGl:
+            return "opengl";
+        case V2PacketPipeline::kOpenCl:
+            return "opencl";
+        case V2PacketPipeline::kCuda:
+            return "cuda";
+    }
+    return "unknown";
+}
+
 struct FrameData {
     std::vector<uint8_t> rgb;
+    // Set when a consumer subscribed to ColorCaptureMode::kJpeg: the color
+    // frame as the device compressed it, alongside |rgb| or, when no
+    // consumer wants a decoded plane, instead of it.
+    std::vector<uint8_t> color_jpeg;
     std::vector<uint16_t> depth;
     std::vector<uint8_t> ir;
+    // Size of the selected stream's plane.
     int width = 0;
     int height = 0;
+    // Per-plane sizes; on Kinect v2 color and depth/IR differ.
+    int color_width = 0;
+    int color_height = 0;
+    // |color_jpeg| once decoded; |rgb| may be a scaled decode of it.
+    int color_jpeg_width = 0;
+    int color_jpeg_height = 0;
+    int depth_width = 0;
+    int depth_height = 0;
+    int ir_width = 0;
+    int ir_height = 0;
     uint32_t timestamp = 0;
+    // Device timestamp of |depth|. On Kinect v1, |timestamp| is that of
+    // whichever stream arrived last, and its depth and color counters are
+    // not one sequence, so clock mapping follows this one.
+    uint32_t depth_timestamp = 0;
+    // Filled when registration is enabled (processing/registration.h), from
+    // the most recent color+depth pair: color sampled at each depth pixel
+    // (RGB24, depth_width x depth_height, black where occluded or outside the
+    // color view) and depth seen from the color camera.
+    std::vector<uint8_t> registered_rgb;
+    std::vector<uint16_t> registered_depth;
+    int registered_depth_width = 0;
+    int registered_depth_height = 0;
+    // Set when the depth pyramid is enabled (processing/depth_pyramid.h):
+    // mean/min/max levels of the frame's depth (even when the depth plane
+    // itself is not delivered) for previews and coarse range queries.
+    // Shared, so copying a frame does not copy the levels.
+    std::shared_ptr<const DepthPyramid> depth_pyramid;
+    // Set when plane detection is enabled (processing/plane_detection.h):
+    // plane equations, the floor and a per-pixel label mask of the frame's
+    // depth, shared like the pyramid.
+    std::shared_ptr<const PlaneSet> planes;
+    // Set when background subtraction is enabled
+    // (processing/background_model.h): the pixels in front of the learned
+    // background and the boxes around them.
+    std::shared_ptr<const ForegroundMask> foreground;
+    // Set when blob tracking is enabled (processing/blob_tracker.h): the
+    // foreground's connected regions with 3D centroids, extents and ids
+    // that persist across frames.
+    std::shared_ptr<const BlobSet> blobs;
+};
+
+// Microphone-array samples, interleaved by channel.
+struct AudioChunk {
+    std::vector<int32_t> samples;
+    int channels = 0;
+    int sample_rate = 0;
+    // Index of the first frame (one sample per channel) since the stream began.
+    uint64_t first_frame = 0;
 };
 
 class KinectDevice {
@@ -79,11 +243,68 @@ public:
     virtual void setNearMode(bool) {}
     virtual void setManualExposureUs(int) {}
     virtual void setIrBrightness(int) {}
+    // Each consumer subscribes to the color it needs and unsubscribes when
+    // done; frames carry what all subscribers need (PlanColorCapture), so a
+    // recorder on kJpeg and a preview on kHalf are served side by side. A
+    // decoded plane may be finer than a consumer asked for, while another
+    // wants more. Returns false for modes the device cannot deliver. Safe
+    // from any thread; Kinect v2 picks its decode pipeline in start(), so
+    // there a change applies from the next start().
+    bool subscribeColor(ColorCaptureMode mode) {
+        if (!supportsColorCaptureMode(mode)) {
+            return false;
+        }
+        color_subscribers_[static_cast<std::size_t>(mode)].fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    void unsubscribeColor(ColorCaptureMode mode) {
+        std::atomic<int> &count = color_subscribers_[static_cast<std::size_t>(mode)];
+        int current = count.load(std::memory_order_relaxed);
+        while (current > 0 && !count.compare_exchange_weak(current, current - 1, std::memory_order_relaxed)) {
+        }
+    }
+    // The subscribed modes, as ColorCaptureBit()s.
+    unsigned colorSubscriptions() const {
+        unsigned bits = 0;
+        for (std::size_t i = 0; i < kColorCaptureModeCount; ++i) {
+            if (color_subscribers_[i].load(std::memory_order_relaxed) > 0) {
+                bits |= ColorCaptureBit(static_cast<ColorCaptureMode>(i));
+            }
+        }
+        return bits;
+    }
 
     // Audio controls
     virtual bool setAudioEnabled(bool) { return false; }
     virtual bool audioEnabled() const { return false; }
     virtual float audioLevel() const { return 0.0f; }
+    // Drains microphone samples captured since the previous call.
+    virtual bool getAudio(AudioChunk&) { return false; }
+
+    // Depth/color registration, run off the capture thread. Returns false
+    // when the device cannot deliver both planes.
+    virtual bool setRegistrationEnabled(bool) { return false; }
+    virtual bool registrationEnabled() const { return false; }
+
+    // Depth denoising (processing/depth_filter.h) applied to the depth plane
+    // before delivery, so every consumer sees the filtered frame. Returns
+    // false when the device has no depth stream.
+    virtual bool setDepthFilter(const DepthFilterOptions&) { return false; }
+    virtual bool depthFilterEnabled() const { return false; }
+    // Builds FrameData::depth_pyramid for every depth frame.
+    virtual bool setDepthPyramidEnabled(bool) { return false; }
+    virtual bool depthPyramidEnabled() const { return false; }
+    // Fills FrameData::planes for every depth frame, after the depth filter.
+    virtual bool setPlaneDetection(const PlaneDetectionOptions&) { return false; }
+    virtual bool planeDetectionEnabled() const { return false; }
+    // Fills FrameData::foreground for every depth frame, after the depth
+    // filter. Assumes a fixed camera; re-enabling relearns the background.
+    virtual bool setBackgroundSubtraction(const BackgroundOptions&) { return false; }
+    virtual bool backgroundSubtractionEnabled() const { return false; }
+    // Fills FrameData::blobs from FrameData::foreground, so it needs
+    // background subtraction enabled as well.
+    virtual bool setBlobTracking(const BlobTrackingOptions&) { return false; }
+    virtual bool blobTrackingEnabled() const { return false; }
 
     // Capability flags
     virtual bool supportsMotor() const { return false; }
@@ -91,6 +312,21 @@ public:
     virtual bool supportsAudioInput() const { return false; }
     virtual bool supportsDepth() const { return true; }
     virtual bool supportsIr() const { return false; }
+    virtual bool supportsColorCaptureMode(ColorCaptureMode mode) const { return mode == ColorCaptureMode::kDecoded; }
+
+    // Depth/color camera models. Read from the device once per serial where
+    // the driver exposes them; invalid intrinsics when unknown.
+    virtual DeviceCalibration calibration() const { return {}; }
+
+    // Capture statistics (rolling fps, jitter, latency, drops, stage timing).
+    // Safe to read from any thread while the device is streaming.
+    TelemetrySnapshot telemetrySnapshot() const { return telemetry_.snapshot(); }
+
+protected:
+    DeviceTelemetry telemetry_;
+
+private:
+    std::array<std::atomic<int>, kColorCaptureModeCount> color_subscribers_{};
 };
 
 class KinectBackend {
@@ -115,4 +351,5 @@ class KinectBackend {
 };
 
 std::unique_ptr<KinectBackend> CreateKinectV1Backend();
-std::unique_ptr<KinectBackend> CreateKinectV2Backend();
+// Devices opened by the v2 backend decode through |pipeline|.
+std::unique_ptr<KinectBackend> CreateKinectV2Backend(V2PacketPipeline pipeline = V2PacketPipeline::kDefault);
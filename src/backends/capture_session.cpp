@@ -0,0 +1,397 @@
+#include "backends/capture_session.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <utility>
+
+namespace {
+
+// Recent frames whose lower envelope sets the clock offset: about four
+// seconds at 30 fps, short enough to follow drift between the clocks.
+constexpr std::size_t kClockWindow = 128;
+// The tick length comes from the most promptly delivered frame of each
+// block of frames, over up to a minute at 30 fps, so that a short baseline
+// does not limit it.
+constexpr std::size_t kBlockFrames = 15;
+constexpr std::size_t kMaxBlocks = 120;
+constexpr std::size_t kMinFitBlocks = 4;
+// A fitted tick further than this from the nominal one is a disturbed fit
+// (a burst of late deliveries), not a real clock.
+constexpr double kMaxTickError = 0.01;
+
+// libfreenect2: "Unit: roughly or exactly 0.1 millisecond".
+constexpr double kV2TickNs = 100000.0;
+
+// Slope of the lower envelope of host time over ticks: the line under
+// every sample closest to them on average, i.e. the lower convex hull edge
+// above the mean tick. Delivery delays only push samples up, so unlike a
+// least-squares line it is set by the prompt frames alone. 0 when the
+// samples do not span any ticks.
+template <typename Sample>
+double EnvelopeSlope(std::vector<Sample> samples) {
+  if (samples.size() < 2) {
+    return 0.0;
+  }
+  std::sort(samples.begin(), samples.end(), [](const Sample &a, const Sample &b) { return a.ticks < b.ticks; });
+  // Relative to the first sample, to keep the cross products small.
+  const Sample origin = samples.front();
+  double mean_ticks = 0.0;
+  for (Sample &s : samples) {
+    s.ticks -= origin.ticks;
+    s.host_ns -= origin.host_ns;
+    mean_ticks += s.ticks;
+  }
+  mean_ticks /= static_cast<double>(samples.size());
+
+  std::vector<Sample> hull;
+  hull.reserve(samples.size());
+  for (const Sample &s : samples) {
+    while (hull.size() >= 2) {
+      const Sample &a = hull[hull.size() - 2];
+      const Sample &b = hull.back();
+      if ((b.ticks - a.ticks) * (s.host_ns - a.host_ns) - (b.host_ns - a.host_ns) * (s.ticks - a.ticks) > 0.0) {
+        break;
+      }
+      hull.pop_back();
+    }
+    hull.push_back(s);
+  }
+  for (std::size_t i = 0; i + 1 < hull.size(); ++i) {
+    const double dx = hull[i + 1].ticks - hull[i].ticks;
+    if (hull[i + 1].ticks >= mean_ticks || i + 2 == hull.size()) {
+      return dx > 0.0 ? (hull[i + 1].host_ns - hull[i].host_ns) / dx : 0.0;
+    }
+  }
+  return 0.0;
+}
+
+std::uint64_t Distance(std::uint64_t a, std::uint64_t b) {
+  return a > b ? a - b : b - a;
+}
+
+}  // namespace
+
+DeviceClockMapper::DeviceClockMapper(double nominal_tick_ns)
+    : nominal_tick_ns_(nominal_tick_ns), tick_ns_(nominal_tick_ns) {
+  window_.reserve(kClockWindow);
+  blocks_.reserve(kMaxBlocks);
+}
+
+void DeviceClockMapper::reset() {
+  tick_ns_ = nominal_tick_ns_;
+  offset_ns_ = 0.0;
+  frames_ = 0;
+  last_timestamp_ = 0;
+  ticks_ = 0;
+  base_host_ns_ = 0;
+  window_.clear();
+  window_next_ = 0;
+  blocks_.clear();
+  blocks_next_ = 0;
+  block_frames_ = 0;
+}
+
+std::uint64_t DeviceClockMapper::map(std::uint32_t device_timestamp, std::uint64_t arrival_ns) {
+  if (frames_ > 0) {
+    // Unsigned subtraction handles 32-bit counter wrap; a step backwards
+    // means the device restarted its counter.
+    const std::uint32_t step = device_timestamp - last_timestamp_;
+    if (step > static_cast<std::uint32_t>(std::numeric_limits<std::int32_t>::max()) || arrival_ns < base_host_ns_) {
+      reset();
+    } else {
+      ticks_ += step;
+    }
+  }
+  if (frames_ == 0) {
+    base_host_ns_ = arrival_ns;
+  }
+  last_timestamp_ = device_timestamp;
+  ++frames_;
+
+  const Sample sample{static_cast<double>(ticks_), static_cast<double>(arrival_ns - base_host_ns_)};
+  if (window_.size() < kClockWindow) {
+    window_.push_back(sample);
+  } else {
+    window_[window_next_] = sample;
+    window_next_ = (window_next_ + 1) % kClockWindow;
+  }
+  // Lowest residual is the least latency, for the current tick estimate.
+  if (block_frames_ == 0 || sample.host_ns - tick_ns_ * sample.ticks <
+                                block_best_.host_ns - tick_ns_ * block_best_.ticks) {
+    block_best_ = sample;
+  }
+  if (++block_frames_ == kBlockFrames) {
+    if (blocks_.size() < kMaxBlocks) {
+      blocks_.push_back(block_best_);
+    } else {
+      blocks_[blocks_next_] = block_best_;
+      blocks_next_ = (blocks_next_ + 1) % kMaxBlocks;
+    }
+    block_frames_ = 0;
+  }
+  fit();
+  if (tick_ns_ <= 0.0) {
+    return arrival_ns;
+  }
+  const double mapped = offset_ns_ + tick_ns_ * sample.ticks;
+  return base_host_ns_ + static_cast<std::uint64_t>(std::llround(std::max(0.0, mapped)));
+}
+
+void DeviceClockMapper::fit() {
+  double slope = 0.0;
+  if (blocks_.size() >= kMinFitBlocks) {
+    slope = EnvelopeSlope(blocks_);
+  } else if (nominal_tick_ns_ <= 0.0) {
+    // Until there are blocks, a first estimate from every frame so far.
+    slope = EnvelopeSlope(window_);
+  }
+  if (slope > 0.0 && (nominal_tick_ns_ <= 0.0 || std::abs(slope / nominal_tick_ns_ - 1.0) <= kMaxTickError)) {
+    tick_ns_ = slope;
+  }
+  if (tick_ns_ <= 0.0) {
+    return;
+  }
+  double offset = std::numeric_limits<double>::max();
+  for (const Sample &s : window_) {
+    offset = std::min(offset, s.host_ns - tick_ns_ * s.ticks);
+  }
+  offset_ns_ = offset;
+}
+
+FrameAggregator::FrameAggregator(int devices, const FrameAggregatorOptions &options)
+    : options_(options), pending_(static_cast<std::size_t>(std::max(1, devices))), empty_queues_(pending_.size()) {
+  options_.max_pending = std::max<std::size_t>(1, options_.max_pending);
+  options_.max_ready = std::max<std::size_t>(1, options_.max_ready);
+}
+
+void FrameAggregator::push(CapturedFrame frame) {
+  if (frame.device < 0 || static_cast<std::size_t>(frame.device) >= pending_.size()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::deque<CapturedFrame> &queue = pending_[static_cast<std::size_t>(frame.device)];
+  if (queue.empty()) {
+    --empty_queues_;
+  }
+  queue.push_back(std::move(frame));
+  if (queue.size() > options_.max_pending) {
+    queue.pop_front();
+    ++stats_.unmatched_frames;
+  }
+  match();
+}
+
+void FrameAggregator::match() {
+  const auto tolerance = static_cast<std::uint64_t>(std::max(0.0, options_.tolerance_ms) * 1e6);
+  while (empty_queues_ == 0) {
+    std::uint64_t pivot = 0;
+    for (const std::deque<CapturedFrame> &queue : pending_) {
+      pivot = std::max(pivot, queue.front().host_time_ns);
+    }
+    // Every device's candidate is its pending frame closest to the pivot.
+    std::uint64_t earliest = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t latest = 0;
+    std::size_t earliest_device = 0;
+    for (std::size_t d = 0; d < pending_.size(); ++d) {
+      std::deque<CapturedFrame> &queue = pending_[d];
+      while (queue.size() > 1 &&
+             Distance(queue[1].host_time_ns, pivot) <= Distance(queue.front().host_time_ns, pivot)) {
+        queue.pop_front();
+        ++stats_.unmatched_frames;
+      }
+      const std::uint64_t t = queue.front().host_time_ns;
+      if (t < earliest) {
+        earliest = t;
+        earliest_device = d;
+      }
+      latest = std::max(latest, t);
+    }
+    if (latest - earliest > tolerance) {
+      // Too old for any set to come; its device's next frame may fit.
+      pending_[earliest_device].pop_front();
+      ++stats_.unmatched_frames;
+      empty_queues_ += pending_[earliest_device].empty() ? 1 : 0;
+      continue;
+    }
+
+    FrameSet set;
+    set.frames.reserve(pending_.size());
+    double sum = 0.0;
+    for (std::deque<CapturedFrame> &queue : pending_) {
+      sum += static_cast<double>(queue.front().host_time_ns - earliest);
+      set.frames.push_back(std::move(queue.front()));
+      queue.pop_front();
+      empty_queues_ += queue.empty() ? 1 : 0;
+    }
+    set.host_time_ns = earliest + static_cast<std::uint64_t>(sum / static_cast<double>(pending_.size()));
+    set.spread_ns = latest - earliest;
+
+    const double spread_ms = static_cast<double>(set.spread_ns) * 1e-6;
+    ++stats_.sets;
+    spread_total_ms_ += spread_ms;
+    stats_.mean_spread_ms = spread_total_ms_ / static_cast<double>(stats_.sets);
+    stats_.max_spread_ms = std::max(stats_.max_spread_ms, spread_ms);
+    ready_.push_back(std::move(set));
+    if (ready_.size() > options_.max_ready) {
+      ready_.pop_front();
+      ++stats_.dropped_sets;
+    }
+    ready_cv_.notify_one();
+  }
+}
+
+bool FrameAggregator::pop(FrameSet *set, std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ready_cv_.wait_for(lock, timeout, [this] { return !ready_.empty() || interrupted_; });
+  if (ready_.empty()) {
+    return false;
+  }
+  *set = std::move(ready_.front());
+  ready_.pop_front();
+  return true;
+}
+
+void FrameAggregator::interrupt() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    interrupted_ = true;
+  }
+  ready_cv_.notify_all();
+}
+
+FrameAggregatorStats FrameAggregator::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+CaptureSession::CaptureSession(const CaptureSessionOptions &options) : options_(options) {}
+
+CaptureSession::~CaptureSession() {
+  stop();
+}
+
+bool CaptureSession::addDevice(std::unique_ptr<KinectDevice> device, const std::string &serial,
+                               double nominal_tick_ns) {
+  if (running_ || !device) {
+    return false;
+  }
+  auto slot = std::make_unique<Device>();
+  slot->device = std::move(device);
+  slot->serial = serial;
+  slot->depth_clock = DeviceClockMapper(nominal_tick_ns);
+  slot->clock = DeviceClockMapper(nominal_tick_ns);
+  devices_.push_back(std::move(slot));
+  return true;
+}
+
+bool CaptureSession::start() {
+  if (running_) {
+    return true;
+  }
+  if (devices_.empty()) {
+    std::cerr << "[session] no devices to start\n";
+    return false;
+  }
+  for (std::size_t i = 0; i < devices_.size(); ++i) {
+    if (!devices_[i]->device->start()) {
+      std::cerr << "[session] could not start " << devices_[i]->serial << "\n";
+      for (std::size_t j = 0; j < i; ++j) {
+        devices_[j]->device->stop();
+      }
+      return false;
+    }
+  }
+  aggregator_ = std::make_unique<FrameAggregator>(deviceCount(), options_.aggregator);
+  running_ = true;
+  for (std::size_t i = 0; i < devices_.size(); ++i) {
+    Device &slot = *devices_[i];
+    slot.depth_clock.reset();
+    slot.clock.reset();
+    slot.has_depth = false;
+    slot.frames = 0;
+    slot.core = -1;
+    slot.thread = std::thread(&CaptureSession::captureLoop, this, static_cast<int>(i));
+  }
+  return true;
+}
+
+void CaptureSession::stop() {
+  if (!running_.exchange(false)) {
+    return;
+  }
+  aggregator_->interrupt();
+  for (const std::unique_ptr<Device> &slot : devices_) {
+    if (slot->thread.joinable()) {
+      slot->thread.join();
+    }
+  }
+  for (const std::unique_ptr<Device> &slot : devices_) {
+    slot->device->stop();
+  }
+}
+
+bool CaptureSession::nextFrameSet(FrameSet *set, std::chrono::milliseconds timeout) {
+  return aggregator_ != nullptr && aggregator_->pop(set, timeout);
+}
+
+void CaptureSession::captureLoop(int index) {
+  KINECT_TRACE_THREAD_NAME("capture-session");
+  Device &slot = *devices_[static_cast<std::size_t>(index)];
+  if (options_.pin_threads && PinCurrentThreadToCore(index)) {
+    const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    slot.core = index % cores;
+  }
+
+  FrameData frame;
+  while (running_) {
+    slot.device->update();
+    if (!slot.device->getFrame(frame)) {
+      continue;
+    }
+    const bool has_depth = !frame.depth.empty();
+    if (has_depth && slot.has_depth && frame.depth_timestamp == slot.last_depth_timestamp) {
+      continue;
+    }
+    KINECT_TRACE_SCOPE("session.push");
+    DeviceClockMapper &clock = has_depth ? slot.depth_clock : slot.clock;
+    CapturedFrame captured;
+    captured.device = index;
+    captured.arrival_ns = TelemetryNowNs();
+    captured.host_time_ns = clock.map(has_depth ? frame.depth_timestamp : frame.timestamp, captured.arrival_ns);
+    slot.has_depth = has_depth;
+    slot.last_depth_timestamp = frame.depth_timestamp;
+    captured.frame = std::move(frame);
+    frame = FrameData{};
+    slot.frames.fetch_add(1, std::memory_order_relaxed);
+    slot.tick_ns.store(clock.tickNs(), std::memory_order_relaxed);
+    aggregator_->push(std::move(captured));
+  }
+}
+
+std::vector<CaptureDeviceStats> CaptureSession::deviceStats() const {
+  std::vector<CaptureDeviceStats> stats;
+  stats.reserve(devices_.size());
+  for (const std::unique_ptr<Device> &slot : devices_) {
+    CaptureDeviceStats device;
+    device.serial = slot->serial;
+    device.core = slot->core.load(std::memory_order_relaxed);
+    device.frames = slot->frames.load(std::memory_order_relaxed);
+    device.tick_ns = slot->tick_ns.load(std::memory_order_relaxed);
+    device.telemetry = slot->device->telemetrySnapshot();
+    stats.push_back(std::move(device));
+  }
+  return stats;
+}
+
+FrameAggregatorStats CaptureSession::aggregatorStats() const {
+  return aggregator_ != nullptr ? aggregator_->stats() : FrameAggregatorStats();
+}
+
+double NominalDeviceTickNs(KinectGeneration generation) {
+  return generation == KinectGeneration::kV2 ? kV2TickNs : 0.0;
+}
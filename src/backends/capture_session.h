@@ -0,0 +1,216 @@
+#pragma once
+
+#include "backends/backend.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Maps one device's 32-bit frame timestamps onto the host clock
+// (TelemetryNowNs), so frames from devices with unrelated counters can be
+// compared. The counter is unwrapped to 64 bits and its tick length fitted
+// against arrival times (starting from |nominal_tick_ns| when known) through
+// the most promptly delivered frames of the last minute or so. The offset
+// follows the lower envelope of recent arrivals: a frame maps to when it
+// would have arrived with the least latency seen, which delivery jitter
+// does not move. A counter that jumps backwards (device restart) restarts
+// the fit. Not thread-safe; one per device.
+class DeviceClockMapper {
+ public:
+  // |nominal_tick_ns| of 0 learns the tick length from the first frames.
+  explicit DeviceClockMapper(double nominal_tick_ns = 0.0);
+
+  // Feeds one frame and returns its host time in nanoseconds.
+  std::uint64_t map(std::uint32_t device_timestamp, std::uint64_t arrival_ns);
+  void reset();
+
+  // Fitted tick length; the nominal one (or 0) until enough frames arrived.
+  double tickNs() const { return tick_ns_; }
+  std::uint64_t frames() const { return frames_; }
+
+ private:
+  struct Sample {
+    double ticks = 0.0;
+    double host_ns = 0.0;
+  };
+
+  void fit();
+
+  double nominal_tick_ns_ = 0.0;
+  double tick_ns_ = 0.0;
+  double offset_ns_ = 0.0;
+  std::uint64_t frames_ = 0;
+  std::uint32_t last_timestamp_ = 0;
+  std::uint64_t ticks_ = 0;
+  std::uint64_t base_host_ns_ = 0;
+  // Recent frames, for the offset.
+  std::vector<Sample> window_;
+  std::size_t window_next_ = 0;
+  // The earliest delivered frame of each completed block, for the tick.
+  std::vector<Sample> blocks_;
+  std::size_t blocks_next_ = 0;
+  Sample block_best_;
+  std::size_t block_frames_ = 0;
+};
+
+// One device's frame with its timestamp mapped to the host clock.
+struct CapturedFrame {
+  int device = 0;
+  std::uint64_t host_time_ns = 0;
+  // When the capture thread received the frame.
+  std::uint64_t arrival_ns = 0;
+  FrameData frame;
+};
+
+// One frame per device, all captured within the aggregator's tolerance.
+struct FrameSet {
+  // Indexed by device.
+  std::vector<CapturedFrame> frames;
+  // Mean host time of the members, and the gap between the earliest and the
+  // latest.
+  std::uint64_t host_time_ns = 0;
+  std::uint64_t spread_ns = 0;
+};
+
+struct FrameAggregatorOptions {
+  // Widest spread of host times inside a set. Half the frame period keeps at
+  // most one candidate per device.
+  double tolerance_ms = 16.0;
+  // Frames waiting per device; beyond it the oldest is dropped, e.g. while
+  // another device stalls.
+  std::size_t max_pending = 8;
+  // Completed sets waiting for the consumer; beyond it the oldest is dropped.
+  std::size_t max_ready = 4;
+};
+
+struct FrameAggregatorStats {
+  std::uint64_t sets = 0;
+  // Frames that never found partners within the tolerance.
+  std::uint64_t unmatched_frames = 0;
+  // Completed sets nobody took in time.
+  std::uint64_t dropped_sets = 0;
+  double mean_spread_ms = 0.0;
+  double max_spread_ms = 0.0;
+};
+
+// Groups frames from several devices into time-aligned sets by host time.
+// Each device's frames must arrive in order; producers on different threads
+// push concurrently and one consumer pops. Around the latest of the oldest
+// pending frames, every device contributes the frame closest to it; the
+// set is emitted when they all fall within the tolerance, otherwise the
+// oldest frame is given up as unmatched. A set needs every device, so a
+// device that stops delivering stops the output until it resumes.
+class FrameAggregator {
+ public:
+  FrameAggregator(int devices, const FrameAggregatorOptions &options);
+
+  void push(CapturedFrame frame);
+  // Waits up to |timeout| for a set; returns false when none is ready.
+  bool pop(FrameSet *set, std::chrono::milliseconds timeout);
+  // Wakes a consumer blocked in pop().
+  void interrupt();
+
+  FrameAggregatorStats stats() const;
+
+ private:
+  void match();
+
+  FrameAggregatorOptions options_;
+  mutable std::mutex mutex_;
+  std::condition_variable ready_cv_;
+  std::vector<std::deque<CapturedFrame>> pending_;
+  // Devices with nothing pending; while any, no set can form and a push
+  // skips matching.
+  std::size_t empty_queues_ = 0;
+  std::deque<FrameSet> ready_;
+  bool interrupted_ = false;
+  FrameAggregatorStats stats_;
+  double spread_total_ms_ = 0.0;
+};
+
+struct CaptureSessionOptions {
+  // Pins capture thread i to hardware thread i (round robin), so devices do
+  // not contend for one core's caches.
+  bool pin_threads = true;
+  FrameAggregatorOptions aggregator;
+};
+
+struct CaptureDeviceStats {
+  std::string serial;
+  // Hardware thread the capture thread is pinned to; -1 when unpinned.
+  int core = -1;
+  std::uint64_t frames = 0;
+  double tick_ns = 0.0;
+  TelemetrySnapshot telemetry;
+};
+
+// Streams several devices together: each device gets its own capture thread
+// that drives update()/getFrame(), maps the frame's timestamp to the host
+// clock and hands it to a shared FrameAggregator, from which the consumer
+// takes time-aligned FrameSets. Frames that carry depth are paced and mapped
+// by their depth timestamp; a Kinect v1 frame whose depth has not changed
+// since the last one (only its color arrived) is not pushed. Devices can
+// come from different backends. Device settings (stream kind, filters, ...)
+// are applied before start().
+class CaptureSession {
+ public:
+  explicit CaptureSession(const CaptureSessionOptions &options = CaptureSessionOptions());
+  ~CaptureSession();
+  CaptureSession(const CaptureSession &) = delete;
+  CaptureSession &operator=(const CaptureSession &) = delete;
+
+  // Adds an opened, not yet started device. |nominal_tick_ns| seeds its
+  // clock mapping (NominalDeviceTickNs, or 0 to learn it). Returns false
+  // once the session runs.
+  bool addDevice(std::unique_ptr<KinectDevice> device, const std::string &serial, double nominal_tick_ns = 0.0);
+
+  // Starts every device, then the capture threads. Returns false, with every
+  // device stopped again, if one fails to start.
+  bool start();
+  void stop();
+  bool running() const { return running_; }
+
+  // Waits up to |timeout| for the next frame set.
+  bool nextFrameSet(FrameSet *set, std::chrono::milliseconds timeout);
+
+  int deviceCount() const { return static_cast<int>(devices_.size()); }
+  KinectDevice &device(int index) { return *devices_[static_cast<std::size_t>(index)]->device; }
+
+  std::vector<CaptureDeviceStats> deviceStats() const;
+  FrameAggregatorStats aggregatorStats() const;
+
+ private:
+  struct Device {
+    std::unique_ptr<KinectDevice> device;
+    std::string serial;
+    // Depth and color counters are mapped apart: on Kinect v1 they are not
+    // one sequence.
+    DeviceClockMapper depth_clock;
+    DeviceClockMapper clock;
+    std::uint32_t last_depth_timestamp = 0;
+    bool has_depth = false;
+    std::thread thread;
+    std::atomic<int> core{-1};
+    std::atomic<std::uint64_t> frames{0};
+    std::atomic<double> tick_ns{0.0};
+  };
+
+  void captureLoop(int index);
+
+  CaptureSessionOptions options_;
+  std::vector<std::unique_ptr<Device>> devices_;
+  std::unique_ptr<FrameAggregator> aggregator_;
+  std::atomic<bool> running_{false};
+};
+
+// Length of a FrameData::timestamp tick, where the driver documents it:
+// libfreenect2 counts 0.1 ms. Kinect v1 counters are left to the fit (0).
+double NominalDeviceTickNs(KinectGeneration generation);
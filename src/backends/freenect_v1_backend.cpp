@@ -1,8 +1,18 @@
 #include "backends/backend.h"
+#include "core/trace.h"
+#include "processing/background_model.h"
+#include "processing/blob_tracker.h"
+#include "processing/camera_model.h"
+#include "processing/depth_filter.h"
+#include "processing/depth_pyramid.h"
+#include "processing/plane_detection.h"
+#include "processing/registration.h"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
@@ -22,6 +32,7 @@
 #if KINECT_HAVE_LIBFREENECT
 #include <libfreenect.h>
 #include <libfreenect_audio.h>
+#include <libfreenect_registration.h>
 #endif
 
 namespace {
@@ -31,6 +42,17 @@ namespace {
 constexpr int kWidth = 640;
 constexpr int kHeight = 480;
 constexpr int kPixelCount = kWidth * kHeight;
+// libfreenect's DEPTH_MAX_METRIC_VALUE: entries in depth_to_rgb_shift.
+constexpr int kShiftTableSize = 10000;
+// The four-microphone array delivers 32-bit samples at 16 kHz.
+constexpr int kAudioChannels = 4;
+constexpr int kAudioSampleRate = 16000;
+// How long update() waits for the event loop to deliver a frame.
+constexpr auto kFrameWait = std::chrono::milliseconds(2);
+// Event loop: per freenect_process_events_timeout() call, and the pause
+// after a failed one.
+constexpr int kEventTimeoutUs = 10000;
+constexpr auto kEventRetryDelay = std::chrono::milliseconds(10);
 
 bool IsSyntheticIndexSerial(const std::string &serial) {
   return serial.rfind("DeviceIndex-", 0) == 0;
@@ -109,10 +131,107 @@ std::string FindFirmwareDirectory() {
   return "";
 }
 
+// The libfreenect context shared by the backend and every device opened
+// from it. libfreenect delivers all of a context's callbacks from whichever
+// thread calls freenect_process_events(), so instead of each device pumping
+// the context from its own update() (where one device's call dispatches the
+// others' frames and several threads contend for libusb's event lock), one
+// thread runs the event loop while any device streams. Devices only wait
+// for their own frames. Shut down with the last owner.
+class FreenectContext {
+ public:
+  FreenectContext() {
+    if (freenect_init(&ctx_, nullptr) < 0) {
+      ctx_ = nullptr;
+    }
+  }
+
+  ~FreenectContext() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      streaming_ = 0;
+      stopEventLoop();
+    }
+    if (ctx_ != nullptr) {
+      freenect_shutdown(ctx_);
+      ctx_ = nullptr;
+    }
+  }
+
+  FreenectContext(const FreenectContext &) = delete;
+  FreenectContext &operator=(const FreenectContext &) = delete;
+
+  freenect_context *get() const { return ctx_; }
+
+  // A device started streaming; the first one starts the event loop.
+  void acquire() {
+    if (ctx_ == nullptr) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (streaming_++ == 0) {
+      stopping_ = false;
+      event_thread_ = std::thread(&FreenectContext::eventLoop, this);
+    }
+  }
+
+  // A device stopped streaming; the last one stops the event loop.
+  void release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (streaming_ == 0 || --streaming_ > 0) {
+      return;
+    }
+    stopEventLoop();
+  }
+
+ private:
+  void eventLoop() {
+    KINECT_TRACE_THREAD_NAME("v1-events");
+    bool reported = false;
+    while (!stopping_) {
+      timeval timeout{};
+      timeout.tv_sec = 0;
+      timeout.tv_usec = kEventTimeoutUs;
+      int rc = 0;
+      {
+        KINECT_TRACE_SCOPE("v1.process_events");
+        rc = freenect_process_events_timeout(ctx_, &timeout);
+      }
+      if (rc < 0) {
+        if (!reported) {
+          std::cerr << "[kinect-v1] freenect_process_events failed (rc=" << rc << ")\n";
+          reported = true;
+        }
+        std::this_thread::sleep_for(kEventRetryDelay);
+      } else {
+        reported = false;
+      }
+    }
+  }
+
+  // Called with |mutex_| held; the loop itself never takes it.
+  void stopEventLoop() {
+    stopping_ = true;
+    if (event_thread_.joinable()) {
+      event_thread_.join();
+    }
+  }
+
+  freenect_context *ctx_ = nullptr;
+  std::mutex mutex_;
+  int streaming_ = 0;
+  std::atomic<bool> stopping_{false};
+  std::thread event_thread_;
+};
+
 class FreenectV1Device final : public KinectDevice {
  public:
-  FreenectV1Device(freenect_context *ctx, int index, std::string serial, bool audio_supported)
-      : ctx_(ctx), index_(index), serial_(std::move(serial)), audio_supported_(audio_supported) {}
+  FreenectV1Device(std::shared_ptr<FreenectContext> context, int index, std::string serial, bool audio_supported)
+      : context_(std::move(context)),
+        ctx_(context_->get()),
+        index_(index),
+        serial_(std::move(serial)),
+        audio_supported_(audio_supported) {}
 
   ~FreenectV1Device() override {
     stop();
@@ -155,6 +274,7 @@ class FreenectV1Device final : public KinectDevice {
     if (audio_supported_) {
       freenect_set_audio_in_callback(dev_, &FreenectV1Device::OnAudioFrame);
     }
+    LoadCalibration();
     return true;
   }
 
@@ -194,6 +314,10 @@ class FreenectV1Device final : public KinectDevice {
     }
 
     running_ = true;
+    context_->acquire();
+    if (registration_enabled_) {
+      StartRegistration();
+    }
 
     if (audio_enabled_) {
       setAudioEnabled(true);
@@ -206,6 +330,7 @@ class FreenectV1Device final : public KinectDevice {
     if (dev_ == nullptr) {
       return false;
     }
+    registration_.stop();
     if (!running_) {
       return true;
     }
@@ -223,6 +348,9 @@ class FreenectV1Device final : public KinectDevice {
       depth_started_ = false;
     }
     running_ = false;
+    context_->release();
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    has_raw_depth_ = false;
     return true;
   }
 
@@ -235,25 +363,49 @@ class FreenectV1Device final : public KinectDevice {
       ApplyVideoMode();
     }
 
-    timeval timeout{};
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 2000;
-    if (freenect_process_events_timeout(ctx_, &timeout) < 0) {
-      return false;
+    // The context's event loop runs the callbacks, which only copy; the
+    // depth chain runs here, on the thread that drives this device.
+    std::uint32_t timestamp = 0;
+    std::uint64_t arrival = 0;
+    {
+      std::unique_lock<std::mutex> lock(frame_mutex_);
+      frame_ready_.wait_for(lock, kFrameWait, [this] { return has_new_frame_ || has_raw_depth_; });
+      if (!has_raw_depth_) {
+        return has_new_frame_;
+      }
+      raw_depth_.swap(depth_work_);
+      has_raw_depth_ = false;
+      timestamp = raw_depth_timestamp_;
+      arrival = raw_depth_arrival_ns_;
     }
-
-    std::lock_guard<std::mutex> lock(frame_mutex_);
-    return has_new_frame_;
+    ProcessDepth(timestamp, arrival);
+    return true;
   }
 
   bool getFrame(FrameData &out_frame) override {
+    KINECT_TRACE_SCOPE("v1.getFrame");
     std::lock_guard<std::mutex> lock(frame_mutex_);
     if (!has_new_frame_) {
       return false;
     }
 
-    out_frame = frame_;
+    {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDelivery));
+      out_frame = frame_;
+    }
     has_new_frame_ = false;
+    if (registration_.running()) {
+      registration_.takeResult(&registered_);
+      AttachRegisteredFrame(registered_, &out_frame);
+    }
+
+    const std::uint64_t now = TelemetryNowNs();
+    for (std::size_t i = 0; i < kTelemetryStreamCount; ++i) {
+      if (pending_arrival_ns_[i] != 0) {
+        telemetry_.stream(static_cast<TelemetryStream>(i)).recordLatency(now - pending_arrival_ns_[i]);
+        pending_arrival_ns_[i] = 0;
+      }
+    }
     return true;
   }
 
@@ -285,6 +437,7 @@ class FreenectV1Device final : public KinectDevice {
     if (dev_ == nullptr) {
       return;
     }
+    mirrored_ = enabled;
     const freenect_flag_value value = enabled ? FREENECT_ON : FREENECT_OFF;
     freenect_set_flag(dev_, FREENECT_MIRROR_DEPTH, value);
     freenect_set_flag(dev_, FREENECT_MIRROR_VIDEO, value);
@@ -357,6 +510,20 @@ class FreenectV1Device final : public KinectDevice {
     return audio_level_;
   }
 
+  bool getAudio(AudioChunk &out_chunk) override {
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    if (pending_audio_.empty()) {
+      return false;
+    }
+    out_chunk.channels = kAudioChannels;
+    out_chunk.sample_rate = kAudioSampleRate;
+    out_chunk.first_frame = pending_audio_first_frame_;
+    out_chunk.samples.swap(pending_audio_);
+    pending_audio_.clear();
+    pending_audio_first_frame_ += out_chunk.samples.size() / kAudioChannels;
+    return true;
+  }
+
   bool supportsMotor() const override {
     return true;
   }
@@ -373,7 +540,123 @@ class FreenectV1Device final : public KinectDevice {
     return true;
   }
 
+  DeviceCalibration calibration() const override {
+    return calibration_;
+  }
+
+  bool setRegistrationEnabled(bool enabled) override {
+    registration_enabled_ = enabled;
+    if (!enabled) {
+      registration_.stop();
+      std::lock_guard<std::mutex> lock(frame_mutex_);
+      registered_ = RegisteredFrame();
+    } else if (running_ && !registration_.running()) {
+      StartRegistration();
+    }
+    return true;
+  }
+
+  bool registrationEnabled() const override {
+    return registration_enabled_;
+  }
+
+  bool setDepthFilter(const DepthFilterOptions &options) override {
+    depth_filter_.setOptions(options);
+    return true;
+  }
+
+  bool depthFilterEnabled() const override {
+    return depth_filter_.enabled();
+  }
+
+  bool setDepthPyramidEnabled(bool enabled) override {
+    depth_pyramid_enabled_ = enabled;
+    return true;
+  }
+
+  bool depthPyramidEnabled() const override {
+    return depth_pyramid_enabled_;
+  }
+
+  bool setPlaneDetection(const PlaneDetectionOptions &options) override {
+    plane_detector_.setOptions(options);
+    return true;
+  }
+
+  bool planeDetectionEnabled() const override {
+    return plane_detector_.enabled();
+  }
+
+  bool setBackgroundSubtraction(const BackgroundOptions &options) override {
+    background_model_.setOptions(options);
+    return true;
+  }
+
+  bool backgroundSubtractionEnabled() const override {
+    return background_model_.enabled();
+  }
+
+  bool setBlobTracking(const BlobTrackingOptions &options) override {
+    blob_tracker_.setOptions(options);
+    return true;
+  }
+
+  bool blobTrackingEnabled() const override {
+    return blob_tracker_.enabled();
+  }
+
  private:
+  // Maps with the device's own registration block rather than the nominal
+  // pinhole pair: the tables are copied once per device and the per-frame
+  // work (libfreenect's freenect_apply_registration) runs on the worker.
+  void StartRegistration() {
+    if (registration_table_ == nullptr) {
+      freenect_registration reg = freenect_copy_registration(dev_);
+      if (reg.registration_table != nullptr && reg.depth_to_rgb_shift != nullptr) {
+        registration_table_ = std::make_shared<const DepthToColorTable>(BuildFreenectDepthToColorTable(
+            kWidth, kHeight, reg.registration_table, reg.depth_to_rgb_shift, kShiftTableSize,
+            static_cast<int>(reg.reg_pad_info.start_lines) * kHeight));
+      }
+      freenect_destroy_registration(&reg);
+    }
+    if (registration_table_ == nullptr || registration_table_->empty()) {
+      std::cerr << "[kinect-v1] registration tables unavailable; using the nominal camera pair\n";
+      registration_.start(calibration_, KinectGeneration::kV1, &telemetry_.stage(TelemetryStage::kRegistration));
+      return;
+    }
+    registration_.start(registration_table_, &telemetry_.stage(TelemetryStage::kRegistration));
+  }
+
+  // libfreenect reads the registration block during open; derive the depth
+  // pinhole from its zero-plane parameters (the same model
+  // freenect_camera_to_world uses). The RGB camera has no stored intrinsics.
+  void LoadCalibration() {
+    depth_rays_.reset();
+    const bool cacheable = !serial_.empty() && !IsSyntheticIndexSerial(serial_);
+    if (cacheable && LookupCalibration(serial_, &calibration_)) {
+      return;
+    }
+    calibration_ = DeviceCalibration{};
+    calibration_.serial = serial_;
+    calibration_.color = NominalColorIntrinsics(KinectGeneration::kV1);
+
+    freenect_registration reg = freenect_copy_registration(dev_);
+    const double pixel_size = reg.zero_plane_info.reference_pixel_size;
+    const double distance = reg.zero_plane_info.reference_distance;
+    if (pixel_size > 0.0 && distance > 0.0) {
+      const float focal = static_cast<float>(distance / (2.0 * pixel_size));
+      calibration_.depth = {kWidth, kHeight, focal, focal, kWidth / 2.0f, kHeight / 2.0f, {}};
+      calibration_.from_device = true;
+    } else {
+      calibration_.depth = NominalDepthIntrinsics(KinectGeneration::kV1, kWidth, kHeight);
+    }
+    freenect_destroy_registration(&reg);
+
+    if (cacheable) {
+      RememberCalibration(calibration_);
+    }
+  }
+
   bool ApplyVideoMode() {
     if (dev_ == nullptr) {
       return false;
@@ -406,57 +689,149 @@ class FreenectV1Device final : public KinectDevice {
     return true;
   }
 
+  // Looked up once per calibration rather than per frame. Only a real
+  // serial's device calibration is persisted to the ray cache.
+  const RayTable &depthRays() {
+    if (depth_rays_ == nullptr) {
+      const bool persist = calibration_.from_device && !serial_.empty() && !IsSyntheticIndexSerial(serial_);
+      depth_rays_ = CachedRayTable(ResolveDepthIntrinsics(calibration_, KinectGeneration::kV1, kWidth, kHeight),
+                                   persist ? serial_ : std::string());
+    }
+    return *depth_rays_;
+  }
+
+  // Filters and analyses the depth frame taken from the callback
+  // (|depth_work_|) outside the frame lock, then publishes it.
+  void ProcessDepth(std::uint32_t timestamp, std::uint64_t arrival) {
+    KINECT_TRACE_SCOPE("v1.process_depth");
+    std::uint16_t *depth = depth_work_.data();
+    if (depth_filter_.enabled()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDepthFilter));
+      depth_filter_.apply(depth, kWidth, kHeight);
+    }
+    std::shared_ptr<const DepthPyramid> depth_pyramid;
+    if (depth_pyramid_enabled_) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDepthPyramid));
+      depth_pyramid = depth_pyramid_.build(depth, kWidth, kHeight);
+    }
+    std::shared_ptr<const PlaneSet> planes;
+    if (plane_detector_.enabled()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kPlaneDetection));
+      planes = plane_detector_.detect(depth, depthRays());
+    }
+    std::shared_ptr<const ForegroundMask> foreground;
+    if (background_model_.enabled()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kForeground));
+      foreground = background_model_.update(depth, kWidth, kHeight);
+    }
+    std::shared_ptr<const BlobSet> blobs;
+    if (blob_tracker_.enabled() && foreground != nullptr) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kBlobTracking));
+      blobs = blob_tracker_.track(*foreground, depth, depthRays());
+    }
+
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    frame_.width = kWidth;
+    frame_.height = kHeight;
+    frame_.depth_width = kWidth;
+    frame_.depth_height = kHeight;
+    frame_.timestamp = timestamp;
+    frame_.depth_timestamp = timestamp;
+    // The previous plane becomes the next work buffer.
+    frame_.depth.swap(depth_work_);
+    frame_.depth_pyramid = std::move(depth_pyramid);
+    frame_.planes = std::move(planes);
+    frame_.foreground = std::move(foreground);
+    frame_.blobs = std::move(blobs);
+    // The tables describe the unmirrored sensor, so mirrored frames are not
+    // registered. The color plane is whatever RGB frame arrived last.
+    if (registration_.running() && !mirrored_ && active_stream_ == StreamKind::kRgb &&
+        frame_.rgb.size() == static_cast<std::size_t>(kPixelCount) * 3) {
+      registration_.submit(frame_.depth, kWidth, kHeight, frame_.rgb, kWidth, kHeight, timestamp);
+    }
+    pending_arrival_ns_[static_cast<std::size_t>(TelemetryStream::kDepth)] = arrival;
+    has_new_frame_ = true;
+  }
+
   static void OnDepthFrame(freenect_device *dev, void *depth, uint32_t timestamp) {
+    KINECT_TRACE_SCOPE("v1.depth_callback");
     auto *self = static_cast<FreenectV1Device *>(freenect_get_user(dev));
     if (self == nullptr || depth == nullptr) {
       return;
     }
 
+    const std::uint64_t arrival = TelemetryNowNs();
+    self->telemetry_.stream(TelemetryStream::kDepth).recordArrival(arrival, timestamp);
+
+    // Runs on the context's shared event thread: only copy the frame out of
+    // libfreenect's buffer and hand it to the device's capture thread.
     std::lock_guard<std::mutex> lock(self->frame_mutex_);
-    self->frame_.width = kWidth;
-    self->frame_.height = kHeight;
-    self->frame_.timestamp = timestamp;
-    self->frame_.depth.resize(kPixelCount);
-    std::memcpy(self->frame_.depth.data(), depth, kPixelCount * sizeof(uint16_t));
-    self->has_new_frame_ = true;
+    {
+      ScopedStageTimer timer(self->telemetry_.stage(TelemetryStage::kDepthConvert));
+      self->raw_depth_.resize(kPixelCount);
+      std::memcpy(self->raw_depth_.data(), depth, kPixelCount * sizeof(uint16_t));
+    }
+    self->raw_depth_timestamp_ = timestamp;
+    self->raw_depth_arrival_ns_ = arrival;
+    self->has_raw_depth_ = true;
+    self->frame_ready_.notify_all();
   }
 
   static void OnVideoFrame(freenect_device *dev, void *video, uint32_t timestamp) {
+    KINECT_TRACE_SCOPE("v1.video_callback");
     auto *self = static_cast<FreenectV1Device *>(freenect_get_user(dev));
     if (self == nullptr || video == nullptr) {
       return;
     }
 
+    const bool is_ir = self->active_stream_ == StreamKind::kIr;
+    const TelemetryStream stream = is_ir ? TelemetryStream::kIr : TelemetryStream::kRgb;
+    const std::uint64_t arrival = TelemetryNowNs();
+    self->telemetry_.stream(stream).recordArrival(arrival, timestamp);
+
     std::lock_guard<std::mutex> lock(self->frame_mutex_);
     self->frame_.width = kWidth;
     self->frame_.height = kHeight;
     self->frame_.timestamp = timestamp;
 
-    if (self->active_stream_ == StreamKind::kIr) {
+    if (is_ir) {
+      ScopedStageTimer timer(self->telemetry_.stage(TelemetryStage::kIrConvert));
+      self->frame_.ir_width = kWidth;
+      self->frame_.ir_height = kHeight;
       self->frame_.ir.resize(kPixelCount);
       std::memcpy(self->frame_.ir.data(), video, kPixelCount);
     } else {
+      ScopedStageTimer timer(self->telemetry_.stage(TelemetryStage::kColorConvert));
+      self->frame_.color_width = kWidth;
+      self->frame_.color_height = kHeight;
       self->frame_.rgb.resize(kPixelCount * 3);
       std::memcpy(self->frame_.rgb.data(), video, kPixelCount * 3);
     }
 
+    self->pending_arrival_ns_[static_cast<std::size_t>(stream)] = arrival;
     self->has_new_frame_ = true;
+    self->frame_ready_.notify_all();
   }
 
   static void OnAudioFrame(
       freenect_device *dev,
       int num_samples,
-      int32_t *,
-      int32_t *,
-      int32_t *,
-      int32_t *,
+      int32_t *mic1,
+      int32_t *mic2,
+      int32_t *mic3,
+      int32_t *mic4,
       int16_t *cancelled,
       void *) {
+    KINECT_TRACE_SCOPE("v1.audio_callback");
     auto *self = static_cast<FreenectV1Device *>(freenect_get_user(dev));
     if (self == nullptr || cancelled == nullptr || num_samples <= 0) {
       return;
     }
 
+    // The audio callback carries no hardware timestamp.
+    self->telemetry_.stream(TelemetryStream::kAudio).recordArrival(TelemetryNowNs(), 0, false);
+    ScopedStageTimer timer(self->telemetry_.stage(TelemetryStage::kAudioConvert));
+
     double energy = 0.0;
     for (int i = 0; i < num_samples; ++i) {
       const double sample = static_cast<double>(cancelled[i]);
@@ -465,8 +840,30 @@ class FreenectV1Device final : public KinectDevice {
     energy /= static_cast<double>(num_samples);
     const double rms = std::sqrt(energy) / 32768.0;
     self->audio_level_ = static_cast<float>(rms);
+
+    if (mic1 == nullptr || mic2 == nullptr || mic3 == nullptr || mic4 == nullptr) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(self->frame_mutex_);
+    const int32_t *mics[kAudioChannels] = {mic1, mic2, mic3, mic4};
+    const std::size_t base = self->pending_audio_.size();
+    self->pending_audio_.resize(base + static_cast<std::size_t>(num_samples) * kAudioChannels);
+    for (int i = 0; i < num_samples; ++i) {
+      for (int ch = 0; ch < kAudioChannels; ++ch) {
+        self->pending_audio_[base + static_cast<std::size_t>(i) * kAudioChannels + ch] = mics[ch][i];
+      }
+    }
+    const std::size_t max_samples = static_cast<std::size_t>(kAudioSampleRate) * kAudioChannels;
+    if (self->pending_audio_.size() > max_samples) {
+      // Nobody is draining; keep the newest second.
+      const std::size_t excess = self->pending_audio_.size() - max_samples;
+      self->pending_audio_.erase(self->pending_audio_.begin(),
+                                 self->pending_audio_.begin() + static_cast<std::ptrdiff_t>(excess));
+      self->pending_audio_first_frame_ += excess / kAudioChannels;
+    }
   }
 
+  std::shared_ptr<FreenectContext> context_;
   freenect_context *ctx_ = nullptr;
   freenect_device *dev_ = nullptr;
   int index_ = 0;
@@ -478,21 +875,47 @@ class FreenectV1Device final : public KinectDevice {
   bool video_started_ = false;
   bool audio_started_ = false;
   bool audio_enabled_ = false;
+  // Set from the caller's thread, read by ProcessDepth() on the update()
+  // thread, like the two flags further down.
+  std::atomic<bool> mirrored_{false};
 
   StreamKind requested_stream_ = StreamKind::kRgb;
   StreamKind active_stream_ = StreamKind::kRgb;
 
   mutable std::mutex frame_mutex_;
+  std::condition_variable frame_ready_;
   FrameData frame_;
   bool has_new_frame_ = false;
+  // The latest depth frame as the callback copied it, waiting for update().
+  std::vector<std::uint16_t> raw_depth_;
+  std::uint32_t raw_depth_timestamp_ = 0;
+  std::uint64_t raw_depth_arrival_ns_ = 0;
+  bool has_raw_depth_ = false;
+  // Owned by the thread calling update().
+  std::vector<std::uint16_t> depth_work_;
+  std::uint64_t pending_arrival_ns_[kTelemetryStreamCount] = {};
+  std::vector<int32_t> pending_audio_;
+  std::uint64_t pending_audio_first_frame_ = 0;
   float audio_level_ = 0.0f;
+  DeviceCalibration calibration_;
+  std::atomic<bool> registration_enabled_{false};
+  std::shared_ptr<const DepthToColorTable> registration_table_;
+  RegistrationWorker registration_;
+  RegisteredFrame registered_;
+  DepthFilterChain depth_filter_;
+  std::atomic<bool> depth_pyramid_enabled_{false};
+  DepthPyramidBuilder depth_pyramid_;
+  PlaneDetector plane_detector_;
+  BackgroundModel background_model_;
+  BlobTracker blob_tracker_;
+  // Depth rays for the planes and blobs stages, see depthRays().
+  std::shared_ptr<const RayTable> depth_rays_;
 };
 
 class FreenectV1Backend final : public KinectBackend {
  public:
-  FreenectV1Backend() {
-    if (freenect_init(&ctx_, nullptr) < 0) {
-      ctx_ = nullptr;
+  FreenectV1Backend() : context_(std::make_shared<FreenectContext>()), ctx_(context_->get()) {
+    if (ctx_ == nullptr) {
       return;
     }
     freenect_set_log_level(ctx_, FREENECT_LOG_WARNING);
@@ -510,13 +933,6 @@ class FreenectV1Backend final : public KinectBackend {
     freenect_select_subdevices(ctx_, selected);
   }
 
-  ~FreenectV1Backend() override {
-    if (ctx_ != nullptr) {
-      freenect_shutdown(ctx_);
-      ctx_ = nullptr;
-    }
-  }
-
   std::string name() const override {
     return "libfreenect (Kinect v1)";
   }
@@ -596,7 +1012,7 @@ class FreenectV1Backend final : public KinectBackend {
     }
 
     auto try_open = [&](int index, const std::string &candidate_serial) -> std::unique_ptr<KinectDevice> {
-      auto device = std::make_unique<FreenectV1Device>(ctx_, index, candidate_serial, has_audio_firmware_);
+      auto device = std::make_unique<FreenectV1Device>(context_, index, candidate_serial, has_audio_firmware_);
       if (!device->open()) {
         return nullptr;
       }
@@ -680,6 +1096,7 @@ class FreenectV1Backend final : public KinectBackend {
       }
     }
     device->stop();
+    result.telemetry = device->telemetrySnapshot();
 
     result.success = (result.color_frames + result.depth_frames) > 0;
     result.detail = result.success ? "Preview captured." : "No frames captured.";
@@ -705,6 +1122,8 @@ class FreenectV1Backend final : public KinectBackend {
     return 0;
   }
 
+  // Devices share it and keep it alive past the backend.
+  std::shared_ptr<FreenectContext> context_;
   freenect_context *ctx_ = nullptr;
   bool has_audio_firmware_ = false;
   std::string firmware_dir_;
@@ -735,7 +1154,7 @@ class FreenectV1Backend final : public KinectBackend {
   }
 
   PreviewResult preview(std::chrono::seconds) override {
-    return {false, "Kinect v1 preview unavailable.", 0, 0};
+    return {false, "Kinect v1 preview unavailable.", 0, 0, {}};
   }
 };
 
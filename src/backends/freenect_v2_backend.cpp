@@ -1,9 +1,20 @@
 #include "backends/backend.h"
+#include "core/jpeg_decoder.h"
+#include "core/trace.h"
+#include "processing/background_model.h"
+#include "processing/blob_tracker.h"
+#include "processing/camera_model.h"
+#include "processing/depth_filter.h"
+#include "processing/depth_pyramid.h"
+#include "processing/plane_detection.h"
+#include "processing/registration.h"
+#include "processing/tof_depth_decoder.h"
 
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
 #include <cstring>
+#include <iostream>
 #include <memory>
 #include <string>
 #include <utility>
@@ -13,17 +24,93 @@
 #include <libfreenect2/frame_listener_impl.h>
 #include <libfreenect2/libfreenect2.hpp>
 #include <libfreenect2/logger.h>
+#include <libfreenect2/packet_pipeline.h>
 #endif
 
 namespace {
 
 #if KINECT_HAVE_LIBFREENECT2
 
+constexpr int kDepthWidth = 512;
+constexpr int kDepthHeight = 424;
+constexpr int kColorWidth = 1920;
+constexpr int kColorHeight = 1080;
+
+// Color from one pipeline and depth from another. libfreenect2 only reaches
+// a pipeline through these getters, so each half is forwarded from a
+// complete pipeline of its own. Used when either half comes from
+// DumpPacketPipeline, which hands the device's data to the listener as Raw
+// frames instead of decoding it: the JPEG for the non-decoded color capture
+// modes, depth packets for V2PacketPipeline::kCpuThreaded. The base class
+// still owns its own (empty) components and frees them.
+class ComposedPacketPipeline final : public libfreenect2::PacketPipeline {
+ public:
+  ComposedPacketPipeline(std::unique_ptr<libfreenect2::PacketPipeline> color,
+                         std::unique_ptr<libfreenect2::PacketPipeline> depth)
+      : color_(std::move(color)), depth_(std::move(depth)) {}
+
+  PacketParser *getRgbPacketParser() const override {
+    return color_->getRgbPacketParser();
+  }
+
+  PacketParser *getIrPacketParser() const override {
+    return depth_->getIrPacketParser();
+  }
+
+  libfreenect2::RgbPacketProcessor *getRgbPacketProcessor() const override {
+    return color_->getRgbPacketProcessor();
+  }
+
+  libfreenect2::DepthPacketProcessor *getDepthPacketProcessor() const override {
+    return depth_->getDepthPacketProcessor();
+  }
+
+ private:
+  std::unique_ptr<libfreenect2::PacketPipeline> color_;
+  std::unique_ptr<libfreenect2::PacketPipeline> depth_;
+};
+
+// libfreenect2 decodes color in full only; the JPEG and the scaled decodes
+// need the device's bitstream.
+bool NeedsRawColor(const ColorCapturePlan &plan) {
+  return plan.jpeg || plan.decode_scale != 1;
+}
+
+// SyncMultiFrameListener that gives Raw frames their own copy of the data.
+// DumpPacketPipeline's Raw frames point into the packet parser's buffer,
+// which the stream thread reuses as soon as the listener returns, while
+// update() only reads frames after waitForNewFrame().
+class RawCopyingFrameListener final : public libfreenect2::SyncMultiFrameListener {
+ public:
+  explicit RawCopyingFrameListener(unsigned int frame_types) : SyncMultiFrameListener(frame_types) {}
+
+  bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame) override {
+    if (frame->format != libfreenect2::Frame::Raw) {
+      return SyncMultiFrameListener::onNewFrame(type, frame);
+    }
+    auto *copy = new libfreenect2::Frame(frame->width, frame->height, frame->bytes_per_pixel);
+    std::memcpy(copy->data, frame->data, frame->width * frame->height * frame->bytes_per_pixel);
+    copy->timestamp = frame->timestamp;
+    copy->sequence = frame->sequence;
+    copy->exposure = frame->exposure;
+    copy->gain = frame->gain;
+    copy->gamma = frame->gamma;
+    copy->status = frame->status;
+    copy->format = frame->format;
+    // Taking |frame| means freeing it; the copy is ours until the base
+    // class takes it.
+    delete frame;
+    if (!SyncMultiFrameListener::onNewFrame(type, copy)) {
+      delete copy;
+    }
+    return true;
+  }
+};
+
 class FreenectV2Device final : public KinectDevice {
  public:
-  FreenectV2Device(libfreenect2::Freenect2 *ctx, std::string serial)
-      : ctx_(ctx), serial_(std::move(serial)), listener_(libfreenect2::Frame::Color | libfreenect2::Frame::Ir |
-                                                         libfreenect2::Frame::Depth) {}
+  FreenectV2Device(libfreenect2::Freenect2 *ctx, std::string serial, V2PacketPipeline pipeline)
+      : ctx_(ctx), serial_(std::move(serial)), pipeline_(pipeline) {}
 
   ~FreenectV2Device() override {
     stop();
@@ -37,12 +124,23 @@ class FreenectV2Device final : public KinectDevice {
     if (ctx_ == nullptr) {
       return false;
     }
-    dev_ = ctx_->openDevice(serial_);
+    raw_color_pipeline_ = NeedsRawColor(PlanColorCapture(colorSubscriptions()));
+    std::unique_ptr<libfreenect2::PacketPipeline> pipeline;
+    if (!createPipeline(&pipeline)) {
+      return false;
+    }
+    // The device owns the pipeline.
+    dev_ = pipeline != nullptr ? ctx_->openDevice(serial_, pipeline.release()) : ctx_->openDevice(serial_);
     if (dev_ == nullptr) {
+      raw_depth_ = nullptr;
       return false;
     }
-    dev_->setColorFrameListener(&listener_);
-    dev_->setIrAndDepthFrameListener(&listener_);
+    // Raw depth packets come as Depth frames only; IR is decoded from them.
+    listener_ = std::make_unique<RawCopyingFrameListener>(
+        libfreenect2::Frame::Color | libfreenect2::Frame::Depth |
+        (raw_depth_ != nullptr ? 0 : libfreenect2::Frame::Ir));
+    dev_->setColorFrameListener(listener_.get());
+    dev_->setIrAndDepthFrameListener(listener_.get());
     return true;
   }
 
@@ -50,10 +148,26 @@ class FreenectV2Device final : public KinectDevice {
     if (dev_ == nullptr || running_) {
       return dev_ != nullptr;
     }
+    // The pipeline is fixed when the device is opened.
+    color_plan_ = PlanColorCapture(colorSubscriptions());
+    if (NeedsRawColor(color_plan_) != raw_color_pipeline_) {
+      dev_->close();
+      dev_ = nullptr;
+      if (!open()) {
+        return false;
+      }
+    }
     if (!dev_->start()) {
       return false;
     }
+    if (raw_depth_ != nullptr && !LoadDepthTables()) {
+      std::cerr << "[v2] depth tables unavailable; depth frames are dropped\n";
+    }
+    LoadCalibration();
     running_ = true;
+    if (registration_enabled_) {
+      registration_.start(calibration_, KinectGeneration::kV2, &telemetry_.stage(TelemetryStage::kRegistration));
+    }
     return true;
   }
 
@@ -61,6 +175,7 @@ class FreenectV2Device final : public KinectDevice {
     if (dev_ == nullptr) {
       return false;
     }
+    registration_.stop();
     if (running_) {
       dev_->stop();
       running_ = false;
@@ -74,11 +189,16 @@ class FreenectV2Device final : public KinectDevice {
     }
 
     libfreenect2::FrameMap frames;
-    if (!listener_.waitForNewFrame(frames, 1)) {
-      return false;
+    {
+      KINECT_TRACE_SCOPE("v2.wait_frames");
+      if (!listener_->waitForNewFrame(frames, 1)) {
+        return false;
+      }
     }
+    const std::uint64_t arrival = TelemetryNowNs();
 
     std::vector<std::uint8_t> rgb_data;
+    std::vector<std::uint8_t> color_jpeg;
     std::vector<std::uint16_t> depth_data;
     std::vector<std::uint8_t> ir_data;
     int rgb_w = 0;
@@ -93,55 +213,155 @@ class FreenectV2Device final : public KinectDevice {
 
     if (frames.count(libfreenect2::Frame::Color) > 0) {
       auto *color = frames[libfreenect2::Frame::Color];
-      rgb_w = color->width;
-      rgb_h = color->height;
       rgb_ts = color->timestamp;
-
-      // libfreenect2 color frame is typically BGRA. Convert to RGB for UI.
-      rgb_data.resize(static_cast<std::size_t>(color->width) * color->height * 3);
-      const std::uint8_t *src = color->data;
-      for (int i = 0; i < color->width * color->height; ++i) {
-        rgb_data[i * 3 + 0] = src[i * 4 + 2];
-        rgb_data[i * 3 + 1] = src[i * 4 + 1];
-        rgb_data[i * 3 + 2] = src[i * 4 + 0];
+      telemetry_.stream(TelemetryStream::kRgb).recordArrival(arrival, rgb_ts);
+
+      if (color->format == libfreenect2::Frame::Raw) {
+        // The device's JPEG, copied out of the packet parser's buffer by
+        // RawCopyingFrameListener.
+        const std::size_t bytes = color->width * color->height * color->bytes_per_pixel;
+        if (color_plan_.jpeg) {
+          color_jpeg.assign(color->data, color->data + bytes);
+        }
+        if (color_plan_.decode_scale > 0) {
+          KINECT_TRACE_SCOPE("v2.color_decode");
+          ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kColorConvert));
+          if (!color_decoder_.decode(color->data, bytes, color_plan_.decode_scale, JpegPixelFormat::kRgb, &rgb_data,
+                                     &rgb_w, &rgb_h)) {
+            if (!color_decode_failed_) {
+              std::cerr << "[v2] color frames stay JPEG: " << color_decoder_.error() << "\n";
+              color_decode_failed_ = true;
+            }
+            rgb_data.clear();
+          }
+        }
+        if (rgb_data.empty()) {
+          rgb_w = color_jpeg.empty() ? 0 : kColorWidth;
+          rgb_h = color_jpeg.empty() ? 0 : kColorHeight;
+        }
+      } else {
+        rgb_w = color->width;
+        rgb_h = color->height;
+        // libfreenect2 color frame is typically BGRA. Convert to RGB for UI.
+        KINECT_TRACE_SCOPE("v2.color_convert");
+        ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kColorConvert));
+        const std::size_t pixels = color->width * color->height;
+        rgb_data.resize(pixels * 3);
+        const std::uint8_t *src = color->data;
+        for (std::size_t i = 0; i < pixels; ++i) {
+          rgb_data[i * 3 + 0] = src[i * 4 + 2];
+          rgb_data[i * 3 + 1] = src[i * 4 + 1];
+          rgb_data[i * 3 + 2] = src[i * 4 + 0];
+        }
       }
     }
 
+    const float *decoded_ir = nullptr;
     if (frames.count(libfreenect2::Frame::Depth) > 0) {
       auto *depth = frames[libfreenect2::Frame::Depth];
       depth_w = depth->width;
       depth_h = depth->height;
       depth_ts = depth->timestamp;
-      depth_data.resize(static_cast<std::size_t>(depth->width) * depth->height);
+      telemetry_.stream(TelemetryStream::kDepth).recordArrival(arrival, depth_ts);
       const float *src = reinterpret_cast<const float *>(depth->data);
-      for (int i = 0; i < depth->width * depth->height; ++i) {
-        const float mm = src[i];
-        depth_data[i] = static_cast<std::uint16_t>(std::max(0.0f, std::min(65535.0f, mm)));
+      if (depth->format == libfreenect2::Frame::Raw) {
+        // A packet from DumpPacketPipeline (kCpuThreaded), copied like the
+        // color JPEG.
+        KINECT_TRACE_SCOPE("v2.depth_decode");
+        ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDepthDecode));
+        decoded_depth_.resize(static_cast<std::size_t>(kDepthWidth) * kDepthHeight);
+        decoded_ir_.resize(decoded_depth_.size());
+        const std::size_t bytes = depth->width * depth->height * depth->bytes_per_pixel;
+        if (depth_decoder_.decode(depth->data, bytes, decoded_depth_.data(), decoded_ir_.data())) {
+          src = decoded_depth_.data();
+          decoded_ir = decoded_ir_.data();
+          depth_w = kDepthWidth;
+          depth_h = kDepthHeight;
+        } else {
+          src = nullptr;
+          depth_w = 0;
+          depth_h = 0;
+        }
       }
+      if (src != nullptr) {
+        KINECT_TRACE_SCOPE("v2.depth_convert");
+        ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDepthConvert));
+        depth_data.resize(static_cast<std::size_t>(depth_w) * depth_h);
+        for (int i = 0; i < depth_w * depth_h; ++i) {
+          const float mm = src[i];
+          depth_data[i] = static_cast<std::uint16_t>(std::max(0.0f, std::min(65535.0f, mm)));
+        }
+      }
+    }
+    if (depth_filter_.enabled() && !depth_data.empty()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDepthFilter));
+      depth_filter_.apply(depth_data.data(), depth_w, depth_h);
+    }
+    std::shared_ptr<const DepthPyramid> depth_pyramid;
+    if (depth_pyramid_enabled_ && !depth_data.empty()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDepthPyramid));
+      depth_pyramid = depth_pyramid_.build(depth_data.data(), depth_w, depth_h);
+    }
+    std::shared_ptr<const PlaneSet> planes;
+    if (plane_detector_.enabled() && !depth_data.empty()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kPlaneDetection));
+      planes = plane_detector_.detect(depth_data.data(), depthRays(depth_w, depth_h));
+    }
+    std::shared_ptr<const ForegroundMask> foreground;
+    if (background_model_.enabled() && !depth_data.empty()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kForeground));
+      foreground = background_model_.update(depth_data.data(), depth_w, depth_h);
+    }
+    std::shared_ptr<const BlobSet> blobs;
+    if (blob_tracker_.enabled() && foreground != nullptr) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kBlobTracking));
+      blobs = blob_tracker_.track(*foreground, depth_data.data(), depthRays(depth_w, depth_h));
     }
 
+    const float *ir_src = nullptr;
     if (frames.count(libfreenect2::Frame::Ir) > 0) {
       auto *ir = frames[libfreenect2::Frame::Ir];
       ir_w = ir->width;
       ir_h = ir->height;
       ir_ts = ir->timestamp;
-      ir_data.resize(static_cast<std::size_t>(ir->width) * ir->height);
-      const float *src = reinterpret_cast<const float *>(ir->data);
-      for (int i = 0; i < ir->width * ir->height; ++i) {
+      ir_src = reinterpret_cast<const float *>(ir->data);
+    } else if (decoded_ir != nullptr) {
+      ir_w = depth_w;
+      ir_h = depth_h;
+      ir_ts = depth_ts;
+      ir_src = decoded_ir;
+    }
+    if (ir_src != nullptr) {
+      telemetry_.stream(TelemetryStream::kIr).recordArrival(arrival, ir_ts);
+      KINECT_TRACE_SCOPE("v2.ir_convert");
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kIrConvert));
+      ir_data.resize(static_cast<std::size_t>(ir_w) * ir_h);
+      const float *src = ir_src;
+      for (int i = 0; i < ir_w * ir_h; ++i) {
         const float v = src[i] / 65535.0f;
         ir_data[i] = static_cast<std::uint8_t>(std::max(0.0f, std::min(255.0f, v * 255.0f)));
       }
     }
 
     FrameData next_frame;
+    next_frame.depth_pyramid = std::move(depth_pyramid);
+    next_frame.planes = std::move(planes);
+    next_frame.foreground = std::move(foreground);
+    next_frame.blobs = std::move(blobs);
     auto assign_rgb = [&]() -> bool {
-      if (rgb_data.empty() || rgb_w <= 0 || rgb_h <= 0) {
+      if ((rgb_data.empty() && color_jpeg.empty()) || rgb_w <= 0 || rgb_h <= 0) {
         return false;
       }
+      next_frame.color_jpeg_width = color_jpeg.empty() ? 0 : kColorWidth;
+      next_frame.color_jpeg_height = color_jpeg.empty() ? 0 : kColorHeight;
       next_frame.rgb = std::move(rgb_data);
+      next_frame.color_jpeg = std::move(color_jpeg);
       next_frame.width = rgb_w;
       next_frame.height = rgb_h;
+      next_frame.color_width = rgb_w;
+      next_frame.color_height = rgb_h;
       next_frame.timestamp = rgb_ts;
+      delivered_stream_ = TelemetryStream::kRgb;
       return true;
     };
     auto assign_depth = [&]() -> bool {
@@ -151,7 +371,11 @@ class FreenectV2Device final : public KinectDevice {
       next_frame.depth = std::move(depth_data);
       next_frame.width = depth_w;
       next_frame.height = depth_h;
+      next_frame.depth_width = depth_w;
+      next_frame.depth_height = depth_h;
       next_frame.timestamp = depth_ts;
+      next_frame.depth_timestamp = depth_ts;
+      delivered_stream_ = TelemetryStream::kDepth;
       return true;
     };
     auto assign_ir = [&]() -> bool {
@@ -161,7 +385,10 @@ class FreenectV2Device final : public KinectDevice {
       next_frame.ir = std::move(ir_data);
       next_frame.width = ir_w;
       next_frame.height = ir_h;
+      next_frame.ir_width = ir_w;
+      next_frame.ir_height = ir_h;
       next_frame.timestamp = ir_ts;
+      delivered_stream_ = TelemetryStream::kIr;
       return true;
     };
 
@@ -177,21 +404,39 @@ class FreenectV2Device final : public KinectDevice {
       assigned = assign_rgb() || assign_ir() || assign_depth();
     }
 
+    if (registration_.running() && depth_w > 0 && rgb_w > 0 && color_plan_.decode_scale > 0) {
+      // Planes that were not delivered move to the worker; only the
+      // delivered one is copied.
+      std::vector<std::uint16_t> depth_plane = depth_data.empty() ? next_frame.depth : std::move(depth_data);
+      std::vector<std::uint8_t> rgb_plane = rgb_data.empty() ? next_frame.rgb : std::move(rgb_data);
+      registration_.submit(std::move(depth_plane), depth_w, depth_h, std::move(rgb_plane), rgb_w, rgb_h, depth_ts);
+    }
+
     if (assigned) {
+      if (registration_.running()) {
+        registration_.takeResult(&registered_);
+        AttachRegisteredFrame(registered_, &next_frame);
+      }
       frame_ = std::move(next_frame);
       has_new_frame_ = true;
+      pending_arrival_ns_ = arrival;
     }
 
-    listener_.release(frames);
+    listener_->release(frames);
     return assigned;
   }
 
   bool getFrame(FrameData &out_frame) override {
+    KINECT_TRACE_SCOPE("v2.getFrame");
     if (!has_new_frame_) {
       return false;
     }
-    out_frame = frame_;
+    {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDelivery));
+      out_frame = frame_;
+    }
     has_new_frame_ = false;
+    telemetry_.stream(delivered_stream_).recordLatency(TelemetryNowNs() - pending_arrival_ns_);
     return true;
   }
 
@@ -203,6 +448,10 @@ class FreenectV2Device final : public KinectDevice {
     return true;
   }
 
+  DeviceCalibration calibration() const override {
+    return calibration_;
+  }
+
   void setStreamKind(StreamKind kind) override {
     selected_stream_ = kind;
   }
@@ -211,24 +460,242 @@ class FreenectV2Device final : public KinectDevice {
     return selected_stream_;
   }
 
+  bool setRegistrationEnabled(bool enabled) override {
+    registration_enabled_ = enabled;
+    if (!enabled) {
+      registration_.stop();
+      registered_ = RegisteredFrame();
+    } else if (running_ && !registration_.running()) {
+      registration_.start(calibration_, KinectGeneration::kV2, &telemetry_.stage(TelemetryStage::kRegistration));
+    }
+    return true;
+  }
+
+  bool registrationEnabled() const override {
+    return registration_enabled_;
+  }
+
+  bool setDepthFilter(const DepthFilterOptions &options) override {
+    depth_filter_.setOptions(options);
+    return true;
+  }
+
+  bool depthFilterEnabled() const override {
+    return depth_filter_.enabled();
+  }
+
+  bool setDepthPyramidEnabled(bool enabled) override {
+    depth_pyramid_enabled_ = enabled;
+    return true;
+  }
+
+  bool depthPyramidEnabled() const override {
+    return depth_pyramid_enabled_;
+  }
+
+  bool setPlaneDetection(const PlaneDetectionOptions &options) override {
+    plane_detector_.setOptions(options);
+    return true;
+  }
+
+  bool planeDetectionEnabled() const override {
+    return plane_detector_.enabled();
+  }
+
+  bool setBackgroundSubtraction(const BackgroundOptions &options) override {
+    background_model_.setOptions(options);
+    return true;
+  }
+
+  bool backgroundSubtractionEnabled() const override {
+    return background_model_.enabled();
+  }
+
+  bool setBlobTracking(const BlobTrackingOptions &options) override {
+    blob_tracker_.setOptions(options);
+    return true;
+  }
+
+  bool blobTrackingEnabled() const override {
+    return blob_tracker_.enabled();
+  }
+
+  // The scaled decodes need TurboJPEG; the JPEG is the device's own.
+  bool supportsColorCaptureMode(ColorCaptureMode mode) const override {
+    return (mode != ColorCaptureMode::kHalf && mode != ColorCaptureMode::kQuarter) || JpegEncoderAvailable();
+  }
+
   void setTilt(int) override {}
   void setLed(int) override {}
 
  private:
+  // Builds the pipeline for |pipeline_| and the color capture mode into
+  // |out|, or leaves it empty for libfreenect2's default. False if
+  // libfreenect2 was built without the requested one.
+  bool createPipeline(std::unique_ptr<libfreenect2::PacketPipeline> *out) {
+    raw_depth_ = nullptr;
+    std::unique_ptr<libfreenect2::PacketPipeline> depth;
+    const char *missing = nullptr;
+    switch (pipeline_) {
+      case V2PacketPipeline::kDefault:
+        break;
+      case V2PacketPipeline::kCpu:
+        depth = std::make_unique<libfreenect2::CpuPacketPipeline>();
+        break;
+      case V2PacketPipeline::kCpuThreaded: {
+#if KINECT_WITH_V2_CPU_THREADED
+        auto dump = std::make_unique<libfreenect2::DumpPacketPipeline>();
+        raw_depth_ = dump.get();
+        depth = std::move(dump);
+        break;
+#else
+        std::cerr << "[v2] cpu-threaded is experimental; configure with -DKINECT_EXPERIMENTAL_V2_CPU_THREADED=ON\n";
+        return false;
+#endif
+      }
+      case V2PacketPipeline::kOpenGl:
+#ifdef LIBFREENECT2_WITH_OPENGL_SUPPORT
+        depth = std::make_unique<libfreenect2::OpenGLPacketPipeline>();
+#else
+        missing = "OpenGL";
+#endif
+        break;
+      case V2PacketPipeline::kOpenCl:
+#ifdef LIBFREENECT2_WITH_OPENCL_SUPPORT
+        depth = std::make_unique<libfreenect2::OpenCLPacketPipeline>();
+#else
+        missing = "OpenCL";
+#endif
+        break;
+      case V2PacketPipeline::kCuda:
+#ifdef LIBFREENECT2_WITH_CUDA_SUPPORT
+        depth = std::make_unique<libfreenect2::CudaPacketPipeline>();
+#else
+        missing = "CUDA";
+#endif
+        break;
+    }
+    if (missing != nullptr) {
+      std::cerr << "[v2] libfreenect2 was built without " << missing << " support\n";
+      return false;
+    }
+    if (!raw_color_pipeline_ && raw_depth_ == nullptr) {
+      *out = std::move(depth);
+      return true;
+    }
+    if (depth == nullptr) {
+      depth = std::make_unique<libfreenect2::CpuPacketPipeline>();
+    }
+    // Decoded color takes the default color processor from a CPU pipeline,
+    // whose depth half goes unused.
+    std::unique_ptr<libfreenect2::PacketPipeline> color;
+    if (raw_color_pipeline_) {
+      color = std::make_unique<libfreenect2::DumpPacketPipeline>();
+    } else {
+      color = std::make_unique<libfreenect2::CpuPacketPipeline>();
+    }
+    *out = std::make_unique<ComposedPacketPipeline>(std::move(color), std::move(depth));
+    return true;
+  }
+
+  // DumpPacketPipeline keeps the tables libfreenect2 computes for its depth
+  // processor when the device starts.
+  bool LoadDepthTables() {
+    std::size_t p0_bytes = 0;
+    std::size_t x_entries = 0;
+    std::size_t z_entries = 0;
+    std::size_t lut_entries = 0;
+    const unsigned char *p0 = raw_depth_->getDepthP0Tables(&p0_bytes);
+    const float *x_table = raw_depth_->getDepthXTable(&x_entries);
+    const float *z_table = raw_depth_->getDepthZTable(&z_entries);
+    const short *lut = raw_depth_->getDepthLookupTable(&lut_entries);
+    const std::size_t pixels = static_cast<std::size_t>(kDepthWidth) * kDepthHeight;
+    if (x_entries < pixels || z_entries < pixels) {
+      return false;
+    }
+    return depth_decoder_.setTables(p0, p0_bytes, x_table, z_table, reinterpret_cast<const std::int16_t *>(lut),
+                                    lut_entries);
+  }
+
+  // Looked up once per calibration rather than per frame; a device
+  // calibration is also persisted to the ray cache.
+  const RayTable &depthRays(int width, int height) {
+    if (depth_rays_ == nullptr || depth_rays_->width() != width || depth_rays_->height() != height) {
+      depth_rays_ = CachedRayTable(ResolveDepthIntrinsics(calibration_, KinectGeneration::kV2, width, height),
+                                   calibration_.from_device ? calibration_.serial : std::string());
+    }
+    return *depth_rays_;
+  }
+
+  // The factory parameters are only readable once the device has started.
+  void LoadCalibration() {
+    depth_rays_.reset();
+    if (calibration_.from_device || LookupCalibration(serial_, &calibration_)) {
+      return;
+    }
+    const libfreenect2::Freenect2Device::IrCameraParams ir = dev_->getIrCameraParams();
+    const libfreenect2::Freenect2Device::ColorCameraParams color = dev_->getColorCameraParams();
+    calibration_.serial = serial_;
+    if (ir.fx > 0.0f && ir.fy > 0.0f) {
+      calibration_.depth = {kDepthWidth, kDepthHeight, ir.fx, ir.fy, ir.cx, ir.cy, {ir.k1, ir.k2, ir.k3, ir.p1, ir.p2}};
+      calibration_.color = {kColorWidth, kColorHeight, color.fx, color.fy, color.cx, color.cy, {}};
+      DepthToColorModel &mapping = calibration_.depth_to_color;
+      mapping.has_polynomial = color.shift_d != 0.0f;
+      mapping.shift_d = color.shift_d;
+      mapping.shift_m = color.shift_m;
+      const float mx[10] = {color.mx_x3y0, color.mx_x0y3, color.mx_x2y1, color.mx_x1y2, color.mx_x2y0,
+                            color.mx_x0y2, color.mx_x1y1, color.mx_x1y0, color.mx_x0y1, color.mx_x0y0};
+      const float my[10] = {color.my_x3y0, color.my_x0y3, color.my_x2y1, color.my_x1y2, color.my_x2y0,
+                            color.my_x0y2, color.my_x1y1, color.my_x1y0, color.my_x0y1, color.my_x0y0};
+      std::copy(mx, mx + 10, mapping.mx);
+      std::copy(my, my + 10, mapping.my);
+      calibration_.from_device = true;
+      RememberCalibration(calibration_);
+    } else {
+      calibration_.depth = NominalDepthIntrinsics(KinectGeneration::kV2, kDepthWidth, kDepthHeight);
+      calibration_.color = NominalColorIntrinsics(KinectGeneration::kV2);
+    }
+  }
+
   libfreenect2::Freenect2 *ctx_ = nullptr;
   std::string serial_;
+  V2PacketPipeline pipeline_ = V2PacketPipeline::kDefault;
   libfreenect2::Freenect2Device *dev_ = nullptr;
-  libfreenect2::SyncMultiFrameListener listener_;
+  std::unique_ptr<libfreenect2::SyncMultiFrameListener> listener_;
+  // The depth half of a kCpuThreaded pipeline, owned by |dev_|.
+  libfreenect2::DumpPacketPipeline *raw_depth_ = nullptr;
+  TofDepthDecoder depth_decoder_;
+  std::vector<float> decoded_depth_;
+  std::vector<float> decoded_ir_;
 
   FrameData frame_;
   bool has_new_frame_ = false;
+  std::uint64_t pending_arrival_ns_ = 0;
+  TelemetryStream delivered_stream_ = TelemetryStream::kRgb;
   bool running_ = false;
   StreamKind selected_stream_ = StreamKind::kRgb;
+  // What the color subscribers wanted at start().
+  ColorCapturePlan color_plan_;
+  bool raw_color_pipeline_ = false;
+  JpegDecoder color_decoder_;
+  bool color_decode_failed_ = false;
+  DeviceCalibration calibration_;
+  bool registration_enabled_ = false;
+  RegistrationWorker registration_;
+  RegisteredFrame registered_;
+  DepthFilterChain depth_filter_;
+  bool depth_pyramid_enabled_ = false;
+  DepthPyramidBuilder depth_pyramid_;
+  PlaneDetector plane_detector_;
+  BackgroundModel background_model_;
+  BlobTracker blob_tracker_;
+  // Depth rays for the planes and blobs stages, see depthRays().
+  std::shared_ptr<const RayTable> depth_rays_;
 };
 
 class FreenectV2Backend final : public KinectBackend {
  public:
-  FreenectV2Backend() {
+  explicit FreenectV2Backend(V2PacketPipeline pipeline) : pipeline_(pipeline) {
     libfreenect2::setGlobalLogger(libfreenect2::createConsoleLogger(libfreenect2::Logger::Warning));
   }
 
@@ -245,7 +712,11 @@ class FreenectV2Backend final : public KinectBackend {
     if (count <= 0) {
       return {false, "No Kinect v2 devices found."};
     }
-    return {true, std::to_string(count) + " Kinect v2 device(s) detected."};
+    std::string detail = std::to_string(count) + " Kinect v2 device(s) detected.";
+    if (pipeline_ != V2PacketPipeline::kDefault) {
+      detail += std::string(" Packet pipeline: ") + V2PacketPipelineLabel(pipeline_) + ".";
+    }
+    return {true, detail};
   }
 
   std::vector<DeviceInfo> listDevices() override {
@@ -265,7 +736,7 @@ class FreenectV2Backend final : public KinectBackend {
     if (serial.empty()) {
       return nullptr;
     }
-    auto device = std::make_unique<FreenectV2Device>(&ctx_, serial);
+    auto device = std::make_unique<FreenectV2Device>(&ctx_, serial, pipeline_);
     if (!device->open()) {
       return nullptr;
     }
@@ -299,12 +770,14 @@ class FreenectV2Backend final : public KinectBackend {
       }
     }
     device->stop();
+    result.telemetry = device->telemetrySnapshot();
     result.success = (result.color_frames + result.depth_frames) > 0;
     result.detail = result.success ? "Preview captured." : "No frames captured.";
     return result;
   }
 
  private:
+  V2PacketPipeline pipeline_;
   libfreenect2::Freenect2 ctx_;
 };
 
@@ -312,6 +785,8 @@ class FreenectV2Backend final : public KinectBackend {
 
 class FreenectV2Backend final : public KinectBackend {
  public:
+  explicit FreenectV2Backend(V2PacketPipeline) {}
+
   std::string name() const override {
     return "libfreenect2 (Kinect v2)";
   }
@@ -333,7 +808,7 @@ class FreenectV2Backend final : public KinectBackend {
   }
 
   PreviewResult preview(std::chrono::seconds) override {
-    return {false, "Kinect v2 preview unavailable.", 0, 0};
+    return {false, "Kinect v2 preview unavailable.", 0, 0, {}};
   }
 };
 
@@ -341,6 +816,6 @@ class FreenectV2Backend final : public KinectBackend {
 
 }  // namespace
 
-std::unique_ptr<KinectBackend> CreateKinectV2Backend() {
-  return std::make_unique<FreenectV2Backend>();
+std::unique_ptr<KinectBackend> CreateKinectV2Backend(V2PacketPipeline pipeline) {
+  return std::make_unique<FreenectV2Backend>(pipeline);
 }
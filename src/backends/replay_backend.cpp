@@ -0,0 +1,533 @@
+#include "backends/replay_backend.h"
+#include "core/jpeg_decoder.h"
+#include "core/recording.h"
+#include "core/trace.h"
+#include "processing/background_model.h"
+#include "processing/blob_tracker.h"
+#include "processing/camera_model.h"
+#include "processing/depth_filter.h"
+#include "processing/depth_pyramid.h"
+#include "processing/plane_detection.h"
+#include "processing/registration.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+class ReplayDevice final : public KinectDevice {
+ public:
+  ReplayDevice(std::string path, ReplayOptions options) : path_(std::move(path)), options_(options) {}
+
+  ~ReplayDevice() override {
+    stop();
+  }
+
+  bool open() {
+    if (!reader_.open(path_)) {
+      std::cerr << "[replay] " << reader_.error() << "\n";
+      return false;
+    }
+    return true;
+  }
+
+  bool start() override {
+    if (running_) {
+      return true;
+    }
+    if (!reader_.rewind()) {
+      return false;
+    }
+    running_ = true;
+    finished_ = false;
+    have_base_ = false;
+    have_loop_ts_ = false;
+    loop_ts_offset_ = 0;
+    if (registration_enabled_) {
+      startRegistration();
+    }
+    return true;
+  }
+
+  bool stop() override {
+    registration_.stop();
+    running_ = false;
+    return true;
+  }
+
+  bool finished() const {
+    return finished_;
+  }
+
+  bool update() override {
+    if (!running_ || finished_) {
+      return false;
+    }
+
+    for (;;) {
+      RecordKind kind = RecordKind::kFrame;
+      std::uint64_t host_ns = 0;
+      bool ok = false;
+      {
+        KINECT_TRACE_SCOPE("replay.read");
+        ok = reader_.next(&kind, &host_ns, &next_frame_, &next_audio_);
+      }
+      if (!ok) {
+        if (!reader_.error().empty()) {
+          std::cerr << "[replay] " << reader_.error() << "\n";
+          finished_ = true;
+          return false;
+        }
+        if (!options_.loop || !reader_.rewind()) {
+          finished_ = true;
+          return false;
+        }
+        // Restart pacing from the top of the file and keep device timestamps
+        // advancing so looped playback does not read as a counter jump.
+        have_base_ = false;
+        if (have_loop_ts_) {
+          loop_ts_offset_ += last_raw_ts_ - first_raw_ts_ + last_ts_delta_;
+          have_loop_ts_ = false;
+        }
+        continue;
+      }
+
+      pace(host_ns);
+
+      if (kind == RecordKind::kAudio) {
+        telemetry_.stream(TelemetryStream::kAudio).recordArrival(TelemetryNowNs(), 0, false);
+        std::lock_guard<std::mutex> lock(frame_mutex_);
+        if (pending_audio_.samples.empty()) {
+          pending_audio_.channels = next_audio_.channels;
+          pending_audio_.sample_rate = next_audio_.sample_rate;
+          pending_audio_.first_frame = next_audio_.first_frame;
+        }
+        pending_audio_.samples.insert(pending_audio_.samples.end(), next_audio_.samples.begin(),
+                                      next_audio_.samples.end());
+        continue;
+      }
+
+      deliver();
+      return true;
+    }
+  }
+
+  bool getFrame(FrameData &out_frame) override {
+    KINECT_TRACE_SCOPE("replay.getFrame");
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    if (!has_new_frame_) {
+      return false;
+    }
+    {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDelivery));
+      out_frame = frame_;
+    }
+    has_new_frame_ = false;
+    const std::uint64_t latency = TelemetryNowNs() - pending_arrival_ns_;
+    for (std::size_t i = 0; i < kTelemetryStreamCount; ++i) {
+      if (pending_streams_[i]) {
+        telemetry_.stream(static_cast<TelemetryStream>(i)).recordLatency(latency);
+      }
+    }
+    return true;
+  }
+
+  bool getAudio(AudioChunk &out_chunk) override {
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    if (pending_audio_.samples.empty()) {
+      return false;
+    }
+    out_chunk = std::move(pending_audio_);
+    pending_audio_ = AudioChunk{};
+    return true;
+  }
+
+  void setTilt(int) override {}
+  void setLed(int) override {}
+
+  // Applies to recordings with JPEG color; raw color is replayed as is.
+  bool supportsColorCaptureMode(ColorCaptureMode) const override {
+    return true;
+  }
+
+  void setStreamKind(StreamKind kind) override {
+    selected_stream_ = kind;
+  }
+
+  StreamKind streamKind() const override {
+    return selected_stream_;
+  }
+
+  bool setAudioEnabled(bool) override {
+    return true;
+  }
+
+  bool audioEnabled() const override {
+    return true;
+  }
+
+  bool supportsAudioInput() const override {
+    return true;
+  }
+
+  bool supportsIr() const override {
+    return true;
+  }
+
+  // A recorded calibration is a replayed value, whatever device it came from.
+  DeviceCalibration calibration() const override {
+    DeviceCalibration calibration = reader_.header().calibration;
+    calibration.from_device = false;
+    return calibration;
+  }
+
+  bool setRegistrationEnabled(bool enabled) override {
+    registration_enabled_ = enabled;
+    if (!enabled) {
+      registration_.stop();
+      registered_ = RegisteredFrame();
+    } else if (running_ && !registration_.running()) {
+      startRegistration();
+    }
+    return true;
+  }
+
+  bool registrationEnabled() const override {
+    return registration_enabled_;
+  }
+
+  bool setDepthFilter(const DepthFilterOptions &options) override {
+    depth_filter_.setOptions(options);
+    return true;
+  }
+
+  bool depthFilterEnabled() const override {
+    return depth_filter_.enabled();
+  }
+
+  bool setDepthPyramidEnabled(bool enabled) override {
+    depth_pyramid_enabled_ = enabled;
+    return true;
+  }
+
+  bool depthPyramidEnabled() const override {
+    return depth_pyramid_enabled_;
+  }
+
+  bool setPlaneDetection(const PlaneDetectionOptions &options) override {
+    plane_detector_.setOptions(options);
+    return true;
+  }
+
+  bool planeDetectionEnabled() const override {
+    return plane_detector_.enabled();
+  }
+
+  bool setBackgroundSubtraction(const BackgroundOptions &options) override {
+    background_model_.setOptions(options);
+    return true;
+  }
+
+  bool backgroundSubtractionEnabled() const override {
+    return background_model_.enabled();
+  }
+
+  bool setBlobTracking(const BlobTrackingOptions &options) override {
+    blob_tracker_.setOptions(options);
+    return true;
+  }
+
+  bool blobTrackingEnabled() const override {
+    return blob_tracker_.enabled();
+  }
+
+ private:
+  void startRegistration() {
+    registration_.start(calibration(), reader_.header().generation, &telemetry_.stage(TelemetryStage::kRegistration));
+  }
+
+  // Looked up once per recording rather than per frame, and never persisted:
+  // the ray cache holds live devices only.
+  const RayTable &depthRays() {
+    if (depth_rays_ == nullptr || depth_rays_->width() != next_frame_.depth_width ||
+        depth_rays_->height() != next_frame_.depth_height) {
+      const RecordingHeader &header = reader_.header();
+      depth_rays_ = CachedRayTable(ResolveDepthIntrinsics(header.calibration, header.generation,
+                                                          next_frame_.depth_width, next_frame_.depth_height));
+    }
+    return *depth_rays_;
+  }
+
+  // Sleeps until the record's original offset, scaled by the replay speed.
+  void pace(std::uint64_t host_ns) {
+    if (!have_base_) {
+      base_host_ns_ = host_ns;
+      base_time_ = std::chrono::steady_clock::now();
+      have_base_ = true;
+      return;
+    }
+    if (options_.speed <= 0.0 || host_ns < base_host_ns_) {
+      return;
+    }
+    const double offset_ns = static_cast<double>(host_ns - base_host_ns_) / options_.speed;
+    std::this_thread::sleep_until(base_time_ + std::chrono::nanoseconds(static_cast<std::int64_t>(offset_ns)));
+  }
+
+  // Recorded JPEG color for the decoded capture modes, scaled in the DCT
+  // domain for kHalf/kQuarter, and kept alongside for kJpeg subscribers.
+  // Without a decoder the JPEG is delivered as is.
+  void decodeColor(const ColorCapturePlan &plan) {
+    KINECT_TRACE_SCOPE("replay.color_decode");
+    ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kColorConvert));
+    int width = 0;
+    int height = 0;
+    if (!color_decoder_.decode(next_frame_.color_jpeg.data(), next_frame_.color_jpeg.size(),
+                               plan.decode_scale, JpegPixelFormat::kRgb, &next_frame_.rgb, &width, &height)) {
+      if (!color_decode_failed_) {
+        std::cerr << "[replay] color frames stay JPEG: " << color_decoder_.error() << "\n";
+        color_decode_failed_ = true;
+      }
+      next_frame_.rgb.clear();
+      return;
+    }
+    next_frame_.color_width = width;
+    next_frame_.color_height = height;
+    if (!plan.jpeg) {
+      next_frame_.color_jpeg.clear();
+      next_frame_.color_jpeg_width = 0;
+      next_frame_.color_jpeg_height = 0;
+    }
+  }
+
+  void deliver() {
+    const std::uint32_t raw_ts = next_frame_.timestamp;
+    if (!have_loop_ts_) {
+      first_raw_ts_ = raw_ts;
+      have_loop_ts_ = true;
+    } else if (raw_ts != last_raw_ts_) {
+      last_ts_delta_ = raw_ts - last_raw_ts_;
+    }
+    last_raw_ts_ = raw_ts;
+    next_frame_.timestamp = raw_ts + loop_ts_offset_;
+    next_frame_.depth_timestamp = next_frame_.depth.empty() ? 0 : next_frame_.timestamp;
+    const ColorCapturePlan plan = PlanColorCapture(colorSubscriptions());
+    if (!next_frame_.color_jpeg.empty() && plan.decode_scale > 0) {
+      decodeColor(plan);
+    }
+
+    const std::uint64_t arrival = TelemetryNowNs();
+    bool streams[kTelemetryStreamCount] = {};
+    streams[static_cast<std::size_t>(TelemetryStream::kRgb)] =
+        !next_frame_.rgb.empty() || !next_frame_.color_jpeg.empty();
+    streams[static_cast<std::size_t>(TelemetryStream::kDepth)] = !next_frame_.depth.empty();
+    streams[static_cast<std::size_t>(TelemetryStream::kIr)] = !next_frame_.ir.empty();
+    for (std::size_t i = 0; i < kTelemetryStreamCount; ++i) {
+      if (streams[i]) {
+        telemetry_.stream(static_cast<TelemetryStream>(i)).recordArrival(arrival, next_frame_.timestamp);
+      }
+    }
+
+    // Report the selected plane's size when the recording has it.
+    if (selected_stream_ == StreamKind::kDepth && !next_frame_.depth.empty()) {
+      next_frame_.width = next_frame_.depth_width;
+      next_frame_.height = next_frame_.depth_height;
+    } else if (selected_stream_ == StreamKind::kIr && !next_frame_.ir.empty()) {
+      next_frame_.width = next_frame_.ir_width;
+      next_frame_.height = next_frame_.ir_height;
+    } else if (selected_stream_ == StreamKind::kRgb && streams[static_cast<std::size_t>(TelemetryStream::kRgb)]) {
+      next_frame_.width = next_frame_.color_width;
+      next_frame_.height = next_frame_.color_height;
+    }
+
+    if (depth_filter_.enabled() && !next_frame_.depth.empty()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDepthFilter));
+      depth_filter_.apply(next_frame_.depth.data(), next_frame_.depth_width, next_frame_.depth_height);
+    }
+    if (depth_pyramid_enabled_ && !next_frame_.depth.empty()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDepthPyramid));
+      next_frame_.depth_pyramid =
+          depth_pyramid_.build(next_frame_.depth.data(), next_frame_.depth_width, next_frame_.depth_height);
+    } else {
+      next_frame_.depth_pyramid.reset();
+    }
+    if (plane_detector_.enabled() && !next_frame_.depth.empty()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kPlaneDetection));
+      next_frame_.planes = plane_detector_.detect(next_frame_.depth.data(), depthRays());
+    } else {
+      next_frame_.planes.reset();
+    }
+    if (background_model_.enabled() && !next_frame_.depth.empty()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kForeground));
+      next_frame_.foreground =
+          background_model_.update(next_frame_.depth.data(), next_frame_.depth_width, next_frame_.depth_height);
+    } else {
+      next_frame_.foreground.reset();
+    }
+    if (blob_tracker_.enabled() && next_frame_.foreground != nullptr) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kBlobTracking));
+      next_frame_.blobs = blob_tracker_.track(*next_frame_.foreground, next_frame_.depth.data(), depthRays());
+    } else {
+      next_frame_.blobs.reset();
+    }
+
+    if (registration_.running()) {
+      if (!next_frame_.depth.empty() && !next_frame_.rgb.empty()) {
+        registration_.submit(next_frame_.depth, next_frame_.depth_width, next_frame_.depth_height, next_frame_.rgb,
+                             next_frame_.color_width, next_frame_.color_height, next_frame_.timestamp);
+      }
+      registration_.takeResult(&registered_);
+      AttachRegisteredFrame(registered_, &next_frame_);
+    }
+
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    // Swap so the reader keeps reusing the previous frame's buffers.
+    std::swap(frame_, next_frame_);
+    std::copy(std::begin(streams), std::end(streams), std::begin(pending_streams_));
+    pending_arrival_ns_ = arrival;
+    has_new_frame_ = true;
+  }
+
+  std::string path_;
+  ReplayOptions options_;
+  RecordingReader reader_;
+  bool running_ = false;
+  bool finished_ = false;
+  StreamKind selected_stream_ = StreamKind::kRgb;
+  JpegDecoder color_decoder_;
+  bool color_decode_failed_ = false;
+
+  bool have_base_ = false;
+  std::uint64_t base_host_ns_ = 0;
+  std::chrono::steady_clock::time_point base_time_;
+
+  bool have_loop_ts_ = false;
+  std::uint32_t first_raw_ts_ = 0;
+  std::uint32_t last_raw_ts_ = 0;
+  std::uint32_t last_ts_delta_ = 0;
+  std::uint32_t loop_ts_offset_ = 0;
+
+  FrameData next_frame_;
+  AudioChunk next_audio_;
+
+  bool registration_enabled_ = false;
+  RegistrationWorker registration_;
+  RegisteredFrame registered_;
+  DepthFilterChain depth_filter_;
+  bool depth_pyramid_enabled_ = false;
+  DepthPyramidBuilder depth_pyramid_;
+  PlaneDetector plane_detector_;
+  BackgroundModel background_model_;
+  BlobTracker blob_tracker_;
+  // Depth rays for the planes and blobs stages, see depthRays().
+  std::shared_ptr<const RayTable> depth_rays_;
+
+  std::mutex frame_mutex_;
+  FrameData frame_;
+  bool has_new_frame_ = false;
+  std::uint64_t pending_arrival_ns_ = 0;
+  bool pending_streams_[kTelemetryStreamCount] = {};
+  AudioChunk pending_audio_;
+};
+
+class ReplayBackend final : public KinectBackend {
+ public:
+  ReplayBackend(std::string path, ReplayOptions options) : path_(std::move(path)), options_(options) {
+    RecordingReader reader;
+    if (reader.open(path_)) {
+      header_ = reader.header();
+      valid_ = true;
+    } else {
+      error_ = reader.error();
+    }
+  }
+
+  std::string name() const override {
+    return "replay (" + path_ + ")";
+  }
+
+  KinectGeneration generation() const override {
+    return header_.generation;
+  }
+
+  ProbeResult probe() override {
+    if (!valid_) {
+      return {false, error_};
+    }
+    return {true, std::string(KinectGenerationLabel(header_.generation)) + " recording, serial " + header_.serial +
+                      "."};
+  }
+
+  std::vector<DeviceInfo> listDevices() override {
+    if (!valid_) {
+      return {};
+    }
+    DeviceInfo info;
+    info.generation = header_.generation;
+    info.serial = header_.serial;
+    info.name = std::string("Replay ") + KinectGenerationLabel(header_.generation);
+    return {info};
+  }
+
+  std::unique_ptr<KinectDevice> openDevice(const std::string &serial) override {
+    if (!valid_ || (!serial.empty() && serial != header_.serial)) {
+      return nullptr;
+    }
+    auto device = std::make_unique<ReplayDevice>(path_, options_);
+    if (!device->open()) {
+      return nullptr;
+    }
+    return device;
+  }
+
+  PreviewResult preview(std::chrono::seconds duration) override {
+    PreviewResult result;
+    auto device = openDevice(header_.serial);
+    if (!device || !device->start()) {
+      result.detail = valid_ ? "Could not start replay." : error_;
+      return result;
+    }
+    auto *replay = static_cast<ReplayDevice *>(device.get());
+    const auto end = std::chrono::steady_clock::now() + duration;
+    AudioChunk audio;
+    while (std::chrono::steady_clock::now() < end && !replay->finished()) {
+      if (device->update()) {
+        FrameData frame;
+        if (device->getFrame(frame)) {
+          if (!frame.rgb.empty() || !frame.color_jpeg.empty()) {
+            ++result.color_frames;
+          }
+          if (!frame.depth.empty()) {
+            ++result.depth_frames;
+          }
+        }
+      }
+      device->getAudio(audio);
+    }
+    device->stop();
+    result.telemetry = device->telemetrySnapshot();
+    result.success = (result.color_frames + result.depth_frames) > 0;
+    result.detail = replay->finished() ? "Replayed to end of recording." : "Replay stopped at preview limit.";
+    return result;
+  }
+
+ private:
+  std::string path_;
+  ReplayOptions options_;
+  RecordingHeader header_;
+  bool valid_ = false;
+  std::string error_;
+};
+
+}  // namespace
+
+std::unique_ptr<KinectBackend> CreateReplayBackend(const std::string &path, const ReplayOptions &options) {
+  return std::make_unique<ReplayBackend>(path, options);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "backends/backend.h"
+
+#include <memory>
+#include <string>
+
+// Plays a .krec session recording (see core/recording.h) back through the
+// regular KinectDevice interface.
+struct ReplayOptions {
+  // Playback rate relative to the original pacing; 0 replays as fast as
+  // update() is called.
+  double speed = 1.0;
+  // Restart from the first record at end of file (soak runs).
+  bool loop = false;
+};
+
+std::unique_ptr<KinectBackend> CreateReplayBackend(const std::string &path, const ReplayOptions &options);
@@ -0,0 +1,751 @@
+#include "backends/synthetic_backend.h"
+#include "backends/synthetic_scene.h"
+#include "core/jpeg_encoder.h"
+#include "core/trace.h"
+#include "processing/background_model.h"
+#include "processing/blob_tracker.h"
+#include "processing/camera_model.h"
+#include "processing/depth_filter.h"
+#include "processing/depth_pyramid.h"
+#include "processing/plane_detection.h"
+#include "processing/registration.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr int kAudioChannels = 4;
+constexpr int kAudioSampleRate = 16000;
+constexpr std::size_t kMaxPendingAudioFrames = kAudioSampleRate;  // 1 s
+// Device clock ticks per frame; only the ratio matters to consumers.
+constexpr std::uint32_t kTicksPerFrame = 1000;
+
+// The v2 color camera compresses at about this quality, 4:2:2.
+constexpr int kJpegQuality = 90;
+
+// |camera| as seen through an image |divisor| times smaller.
+SyntheticCamera DownscaledCamera(const SyntheticCamera &camera, int divisor) {
+  SyntheticCamera scaled = camera;
+  scaled.width = (camera.width + divisor - 1) / divisor;
+  scaled.height = (camera.height + divisor - 1) / divisor;
+  const float s = 1.0f / static_cast<float>(divisor);
+  scaled.fx *= s;
+  scaled.fy *= s;
+  scaled.cx = (camera.cx + 0.5f) * s - 0.5f;
+  scaled.cy = (camera.cy + 0.5f) * s - 0.5f;
+  return scaled;
+}
+
+// A device's timestamp counter: where it starts and how far it advances per
+// frame period, off nominal by the device's skew.
+struct SyntheticClock {
+  std::uint32_t origin = 0;
+  double ticks_per_frame = kTicksPerFrame;
+};
+
+SyntheticClock DeviceClock(const SyntheticConfig &config, int index) {
+  std::mt19937 rng(config.seed * 104729u + static_cast<std::uint32_t>(index) * 31u + 17u);
+  SyntheticClock clock;
+  clock.origin = static_cast<std::uint32_t>(rng());
+  std::uniform_real_distribution<double> skew(-1.0, 1.0);
+  clock.ticks_per_frame = kTicksPerFrame * (1.0 + config.clock_skew_ppm * 1e-6 * skew(rng));
+  return clock;
+}
+
+std::string SyntheticSerial(int index) {
+  char serial[32];
+  std::snprintf(serial, sizeof(serial), "SYNTH-%04d", index);
+  return serial;
+}
+
+class SyntheticDevice final : public KinectDevice {
+ public:
+  SyntheticDevice(const SyntheticConfig &config, int index)
+      : config_(config),
+        index_(index),
+        scene_(static_cast<double>(index) * 0.77),
+        depth_camera_(SyntheticDepthCamera(config.profile)),
+        color_camera_(SyntheticColorCamera(config.profile)),
+        rng_(config.seed * 7919u + static_cast<std::uint32_t>(index)),
+        clock_(DeviceClock(config, index)),
+        registration_enabled_(config.registration),
+        depth_pyramid_enabled_(config.depth_pyramid) {
+    scene_.setDepthNoise(config.depth_noise);
+    if (config.depth_filter) {
+      DepthFilterOptions options;
+      options.enabled = true;
+      depth_filter_.setOptions(options);
+    }
+    if (config.plane_detection) {
+      PlaneDetectionOptions options;
+      options.enabled = true;
+      plane_detector_.setOptions(options);
+    }
+    if (config.background_subtraction || config.blob_tracking) {
+      BackgroundOptions options;
+      options.enabled = true;
+      background_model_.setOptions(options);
+    }
+    if (config.blob_tracking) {
+      BlobTrackingOptions options;
+      options.enabled = true;
+      blob_tracker_.setOptions(options);
+    }
+    if (config_.fps > 0.0) {
+      interval_ = std::chrono::nanoseconds(static_cast<std::int64_t>(1e9 / config_.fps));
+    }
+  }
+
+  ~SyntheticDevice() override {
+    stop();
+  }
+
+  bool start() override {
+    if (running_) {
+      return true;
+    }
+    running_ = true;
+    JpegEncoderOptions options;
+    options.quality = kJpegQuality;
+    options.subsampling = JpegSubsampling::k422;
+    options.threads = 1;
+    jpeg_encoder_.setOptions(options);
+    start_time_ = std::chrono::steady_clock::now();
+    next_deadline_ = start_time_;
+    audio_frames_generated_ = 0;
+    if (registration_enabled_) {
+      startRegistration();
+    }
+    return true;
+  }
+
+  bool stop() override {
+    registration_.stop();
+    running_ = false;
+    return true;
+  }
+
+  bool update() override {
+    if (!running_) {
+      return false;
+    }
+
+    // Frame periods since start() at which this frame is "captured"; its
+    // timestamp follows that instant, not the delivery, as on hardware.
+    double capture_periods = static_cast<double>(frame_index_);
+    if (interval_.count() > 0) {
+      next_deadline_ += interval_;
+      capture_periods = std::chrono::duration<double>(next_deadline_ - start_time_) / interval_;
+      auto deadline = next_deadline_;
+      if (config_.jitter_ms > 0.0) {
+        std::uniform_real_distribution<double> jitter(-config_.jitter_ms, config_.jitter_ms);
+        deadline += std::chrono::microseconds(static_cast<std::int64_t>(jitter(rng_) * 1000.0));
+      }
+      std::this_thread::sleep_until(deadline);
+      // After a long stall, resynchronise instead of bursting to catch up.
+      const auto now = std::chrono::steady_clock::now();
+      if (now - next_deadline_ > interval_ * 4) {
+        next_deadline_ = now;
+      }
+    }
+
+    if (audio_enabled_) {
+      generateAudio();
+    }
+
+    const std::uint64_t frame_index = frame_index_++;
+    // Truncating to 32 bits wraps the counter as hardware does.
+    const std::uint32_t device_ts =
+        clock_.origin + static_cast<std::uint32_t>(std::llround(capture_periods * clock_.ticks_per_frame));
+    if (config_.drop_rate > 0.0) {
+      std::uniform_real_distribution<double> coin(0.0, 1.0);
+      if (coin(rng_) < config_.drop_rate) {
+        KINECT_TRACE_INSTANT("synthetic.drop");
+        return false;
+      }
+    }
+
+    const bool want_ir = selected_stream_ == StreamKind::kIr;
+    const TelemetryStream video_stream = want_ir ? TelemetryStream::kIr : TelemetryStream::kRgb;
+
+    // Fixed-rate streams advance scene time by the nominal period so frames
+    // are reproducible; uncapped streams use 30 fps scene time.
+    const double scene_fps = config_.fps > 0.0 ? config_.fps : 30.0;
+    const double scene_time = static_cast<double>(frame_index) / scene_fps;
+
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    const std::size_t depth_pixels = static_cast<std::size_t>(depth_camera_.width) * depth_camera_.height;
+    {
+      KINECT_TRACE_SCOPE("synthetic.render_depth");
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDepthConvert));
+      frame_.depth.resize(depth_pixels);
+      scene_.renderDepth(depth_camera_, scene_time, SyntheticPose{}, frame_index, frame_.depth.data());
+    }
+    frame_.depth_width = depth_camera_.width;
+    frame_.depth_height = depth_camera_.height;
+    if (depth_filter_.enabled()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDepthFilter));
+      depth_filter_.apply(frame_.depth.data(), frame_.depth_width, frame_.depth_height);
+    }
+    if (depth_pyramid_enabled_) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDepthPyramid));
+      frame_.depth_pyramid = depth_pyramid_.build(frame_.depth.data(), frame_.depth_width, frame_.depth_height);
+    } else {
+      frame_.depth_pyramid.reset();
+    }
+    if (plane_detector_.enabled()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kPlaneDetection));
+      frame_.planes = plane_detector_.detect(frame_.depth.data(), depthRays());
+    } else {
+      frame_.planes.reset();
+    }
+    if (background_model_.enabled()) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kForeground));
+      frame_.foreground = background_model_.update(frame_.depth.data(), depth_camera_.width, depth_camera_.height);
+    } else {
+      frame_.foreground.reset();
+    }
+    if (blob_tracker_.enabled() && frame_.foreground != nullptr) {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kBlobTracking));
+      frame_.blobs = blob_tracker_.track(*frame_.foreground, frame_.depth.data(), depthRays());
+    } else {
+      frame_.blobs.reset();
+    }
+
+    if (want_ir) {
+      KINECT_TRACE_SCOPE("synthetic.render_ir");
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kIrConvert));
+      frame_.ir.resize(depth_pixels);
+      SyntheticIrFromDepth(frame_.depth.data(), static_cast<int>(depth_pixels), frame_.ir.data());
+      frame_.ir_width = depth_camera_.width;
+      frame_.ir_height = depth_camera_.height;
+      frame_.rgb.clear();
+      frame_.color_jpeg.clear();
+      frame_.color_width = 0;
+      frame_.color_height = 0;
+    } else {
+      KINECT_TRACE_SCOPE("synthetic.render_color");
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kColorConvert));
+      // The decoded plane renders at its decoded size, as a scaled decode
+      // would deliver; the JPEG compresses the full frame as the camera does.
+      const ColorCapturePlan plan = PlanColorCapture(colorSubscriptions());
+      const int scale = std::max(1, plan.decode_scale);
+      const SyntheticCamera camera = scale > 1 ? DownscaledCamera(color_camera_, scale) : color_camera_;
+      frame_.rgb.resize(static_cast<std::size_t>(camera.width) * camera.height * 3);
+      scene_.renderColor(camera, scene_time, frame_.rgb.data());
+      frame_.color_width = camera.width;
+      frame_.color_height = camera.height;
+      frame_.color_jpeg.clear();
+      frame_.color_jpeg_width = 0;
+      frame_.color_jpeg_height = 0;
+      if (plan.jpeg) {
+        const std::uint8_t *full = frame_.rgb.data();
+        if (scale > 1) {
+          full_rgb_.resize(static_cast<std::size_t>(color_camera_.width) * color_camera_.height * 3);
+          scene_.renderColor(color_camera_, scene_time, full_rgb_.data());
+          full = full_rgb_.data();
+        }
+        if (jpeg_encoder_.encode(full, color_camera_.width, color_camera_.height,
+                                 static_cast<std::size_t>(color_camera_.width) * 3, JpegPixelFormat::kRgb,
+                                 &frame_.color_jpeg)) {
+          frame_.color_jpeg_width = color_camera_.width;
+          frame_.color_jpeg_height = color_camera_.height;
+        } else {
+          frame_.color_jpeg.clear();
+        }
+        if (plan.decode_scale == 0) {
+          frame_.rgb.clear();
+        }
+      }
+      frame_.ir.clear();
+      frame_.ir_width = 0;
+      frame_.ir_height = 0;
+    }
+
+    if (selected_stream_ == StreamKind::kDepth) {
+      frame_.width = frame_.depth_width;
+      frame_.height = frame_.depth_height;
+    } else if (want_ir) {
+      frame_.width = frame_.ir_width;
+      frame_.height = frame_.ir_height;
+    } else {
+      frame_.width = frame_.color_width;
+      frame_.height = frame_.color_height;
+    }
+    frame_.timestamp = device_ts;
+    frame_.depth_timestamp = device_ts;
+
+    if (registration_.running()) {
+      if (!want_ir && !frame_.rgb.empty()) {
+        registration_.submit(frame_.depth, frame_.depth_width, frame_.depth_height, frame_.rgb, frame_.color_width,
+                             frame_.color_height, device_ts);
+      }
+      registration_.takeResult(&registered_);
+      AttachRegisteredFrame(registered_, &frame_);
+    }
+
+    // Rendering stands in for the sensor and USB transfer, so the frame
+    // "arrives" once it is complete.
+    const std::uint64_t arrival = TelemetryNowNs();
+    telemetry_.stream(TelemetryStream::kDepth).recordArrival(arrival, device_ts);
+    telemetry_.stream(video_stream).recordArrival(arrival, device_ts);
+    pending_arrival_ns_ = arrival;
+    pending_video_stream_ = video_stream;
+    has_new_frame_ = true;
+    return true;
+  }
+
+  bool getFrame(FrameData &out_frame) override {
+    KINECT_TRACE_SCOPE("synthetic.getFrame");
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    if (!has_new_frame_) {
+      return false;
+    }
+    {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kDelivery));
+      out_frame = frame_;
+    }
+    has_new_frame_ = false;
+    const std::uint64_t latency = TelemetryNowNs() - pending_arrival_ns_;
+    telemetry_.stream(TelemetryStream::kDepth).recordLatency(latency);
+    telemetry_.stream(pending_video_stream_).recordLatency(latency);
+    return true;
+  }
+
+  bool getAudio(AudioChunk &out_chunk) override {
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    if (pending_audio_.empty()) {
+      return false;
+    }
+    out_chunk.channels = kAudioChannels;
+    out_chunk.sample_rate = kAudioSampleRate;
+    out_chunk.first_frame = pending_audio_first_frame_;
+    out_chunk.samples.swap(pending_audio_);
+    pending_audio_.clear();
+    pending_audio_first_frame_ += out_chunk.samples.size() / kAudioChannels;
+    return true;
+  }
+
+  void setTilt(int) override {}
+  void setLed(int) override {}
+
+  // Like the hardware, only the v2 profile sends JPEG color.
+  bool supportsColorCaptureMode(ColorCaptureMode mode) const override {
+    return mode == ColorCaptureMode::kDecoded ||
+           (config_.profile == KinectGeneration::kV2 && (mode != ColorCaptureMode::kJpeg || JpegEncoderAvailable()));
+  }
+
+  void setStreamKind(StreamKind kind) override {
+    selected_stream_ = kind;
+  }
+
+  StreamKind streamKind() const override {
+    return selected_stream_;
+  }
+
+  bool setAudioEnabled(bool enabled) override {
+    audio_enabled_ = enabled && config_.audio;
+    return audio_enabled_;
+  }
+
+  bool audioEnabled() const override {
+    return audio_enabled_;
+  }
+
+  float audioLevel() const override {
+    return audio_level_;
+  }
+
+  bool supportsAudioInput() const override {
+    return config_.audio;
+  }
+
+  bool setRegistrationEnabled(bool enabled) override {
+    registration_enabled_ = enabled;
+    if (!enabled) {
+      registration_.stop();
+      std::lock_guard<std::mutex> lock(frame_mutex_);
+      registered_ = RegisteredFrame();
+      AttachRegisteredFrame(registered_, &frame_);
+    } else if (running_ && !registration_.running()) {
+      startRegistration();
+    }
+    return true;
+  }
+
+  bool registrationEnabled() const override {
+    return registration_enabled_;
+  }
+
+  bool setDepthFilter(const DepthFilterOptions &options) override {
+    depth_filter_.setOptions(options);
+    return true;
+  }
+
+  bool depthFilterEnabled() const override {
+    return depth_filter_.enabled();
+  }
+
+  bool setDepthPyramidEnabled(bool enabled) override {
+    depth_pyramid_enabled_ = enabled;
+    return true;
+  }
+
+  bool depthPyramidEnabled() const override {
+    return depth_pyramid_enabled_;
+  }
+
+  bool setPlaneDetection(const PlaneDetectionOptions &options) override {
+    plane_detector_.setOptions(options);
+    return true;
+  }
+
+  bool planeDetectionEnabled() const override {
+    return plane_detector_.enabled();
+  }
+
+  bool setBackgroundSubtraction(const BackgroundOptions &options) override {
+    background_model_.setOptions(options);
+    return true;
+  }
+
+  bool backgroundSubtractionEnabled() const override {
+    return background_model_.enabled();
+  }
+
+  bool setBlobTracking(const BlobTrackingOptions &options) override {
+    blob_tracker_.setOptions(options);
+    return true;
+  }
+
+  bool blobTrackingEnabled() const override {
+    return blob_tracker_.enabled();
+  }
+
+  bool supportsDepth() const override {
+    return true;
+  }
+
+  bool supportsIr() const override {
+    return true;
+  }
+
+  // The scene is rendered through these exact cameras, so they double as
+  // ground-truth calibration.
+  DeviceCalibration calibration() const override {
+    DeviceCalibration calibration;
+    calibration.serial = SyntheticSerial(index_);
+    calibration.depth = depth_camera_;
+    calibration.color = color_camera_;
+    return calibration;
+  }
+
+ private:
+  // Looked up once rather than per frame. No serial: synthetic rays are
+  // cheap and never persisted.
+  const RayTable &depthRays() {
+    if (depth_rays_ == nullptr) {
+      depth_rays_ = CachedRayTable(depth_camera_);
+    }
+    return *depth_rays_;
+  }
+
+  void startRegistration() {
+    registration_.start(calibration(), config_.profile, &telemetry_.stage(TelemetryStage::kRegistration));
+  }
+
+  // Emits every audio frame due since start() as a tone whose arrival delay
+  // differs per microphone, i.e. a source sweeping across the array.
+  void generateAudio() {
+    KINECT_TRACE_SCOPE("synthetic.generate_audio");
+    const auto elapsed = std::chrono::steady_clock::now() - start_time_;
+    const auto due = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() * kAudioSampleRate / 1000000);
+    if (due <= audio_frames_generated_) {
+      return;
+    }
+
+    const std::uint64_t count = due - audio_frames_generated_;
+    std::vector<std::int32_t> block(static_cast<std::size_t>(count) * kAudioChannels);
+    double energy = 0.0;
+    {
+      ScopedStageTimer timer(telemetry_.stage(TelemetryStage::kAudioConvert));
+      std::normal_distribution<double> hiss(0.0, 0.01);
+      constexpr double kTone = 440.0;
+      constexpr double kTwoPi = 6.283185307179586;
+      for (std::uint64_t i = 0; i < count; ++i) {
+        const double t = static_cast<double>(audio_frames_generated_ + i) / kAudioSampleRate;
+        const double angle = std::sin(t * 0.5 + index_);
+        for (int ch = 0; ch < kAudioChannels; ++ch) {
+          // ~0.2 ms max inter-mic delay, as on the Kinect's 4-mic array.
+          const double delay = angle * 0.0002 * (ch - 1.5) / 1.5;
+          const double value = 0.25 * std::sin(kTwoPi * kTone * (t - delay)) + hiss(rng_);
+          energy += value * value;
+          block[static_cast<std::size_t>(i) * kAudioChannels + ch] =
+              static_cast<std::int32_t>(std::max(-1.0, std::min(1.0, value)) * 2147483647.0);
+        }
+      }
+    }
+    telemetry_.stream(TelemetryStream::kAudio).recordArrival(TelemetryNowNs(), 0, false);
+    audio_level_ = static_cast<float>(std::sqrt(energy / static_cast<double>(block.size())));
+    audio_frames_generated_ = due;
+
+    std::lock_guard<std::mutex> lock(frame_mutex_);
+    pending_audio_.insert(pending_audio_.end(), block.begin(), block.end());
+    const std::size_t max_samples = kMaxPendingAudioFrames * kAudioChannels;
+    if (pending_audio_.size() > max_samples) {
+      // Nobody is draining; keep the newest second.
+      const std::size_t excess = pending_audio_.size() - max_samples;
+      pending_audio_.erase(pending_audio_.begin(), pending_audio_.begin() + static_cast<std::ptrdiff_t>(excess));
+      pending_audio_first_frame_ += excess / kAudioChannels;
+    }
+  }
+
+  SyntheticConfig config_;
+  int index_ = 0;
+  SyntheticScene scene_;
+  SyntheticCamera depth_camera_;
+  SyntheticCamera color_camera_;
+  JpegEncoder jpeg_encoder_;
+  // The full frame to compress when the decoded plane is scaled.
+  std::vector<std::uint8_t> full_rgb_;
+  std::mt19937 rng_;
+  SyntheticClock clock_;
+  bool registration_enabled_ = false;
+  RegistrationWorker registration_;
+  RegisteredFrame registered_;
+  DepthFilterChain depth_filter_;
+  bool depth_pyramid_enabled_ = false;
+  DepthPyramidBuilder depth_pyramid_;
+  PlaneDetector plane_detector_;
+  BackgroundModel background_model_;
+  BlobTracker blob_tracker_;
+  // Depth rays for the planes and blobs stages, see depthRays().
+  std::shared_ptr<const RayTable> depth_rays_;
+
+  bool running_ = false;
+  bool audio_enabled_ = false;
+  float audio_level_ = 0.0f;
+  StreamKind selected_stream_ = StreamKind::kRgb;
+
+  std::chrono::nanoseconds interval_{0};
+  std::chrono::steady_clock::time_point start_time_;
+  std::chrono::steady_clock::time_point next_deadline_;
+  std::uint64_t frame_index_ = 0;
+  std::uint64_t audio_frames_generated_ = 0;
+
+  mutable std::mutex frame_mutex_;
+  FrameData frame_;
+  bool has_new_frame_ = false;
+  std::uint64_t pending_arrival_ns_ = 0;
+  TelemetryStream pending_video_stream_ = TelemetryStream::kRgb;
+  std::vector<std::int32_t> pending_audio_;
+  std::uint64_t pending_audio_first_frame_ = 0;
+};
+
+class SyntheticBackend final : public KinectBackend {
+ public:
+  explicit SyntheticBackend(SyntheticConfig config) : config_(std::move(config)) {}
+
+  std::string name() const override {
+    return config_.profile == KinectGeneration::kV2 ? "synthetic (Kinect v2 profile)" : "synthetic (Kinect v1 profile)";
+  }
+
+  KinectGeneration generation() const override {
+    return config_.profile;
+  }
+
+  ProbeResult probe() override {
+    std::ostringstream detail;
+    detail << config_.device_count << " synthetic device(s), ";
+    if (config_.fps > 0.0) {
+      detail << config_.fps << " fps";
+    } else {
+      detail << "uncapped";
+    }
+    if (config_.jitter_ms > 0.0) {
+      detail << ", jitter +/-" << config_.jitter_ms << " ms";
+    }
+    if (config_.drop_rate > 0.0) {
+      detail << ", drop rate " << config_.drop_rate;
+    }
+    if (config_.clock_skew_ppm > 0.0) {
+      detail << ", clock skew +/-" << config_.clock_skew_ppm << " ppm";
+    }
+    detail << ".";
+    return {config_.device_count > 0, detail.str()};
+  }
+
+  std::vector<DeviceInfo> listDevices() override {
+    std::vector<DeviceInfo> devices;
+    for (int i = 0; i < config_.device_count; ++i) {
+      DeviceInfo info;
+      info.generation = config_.profile;
+      info.serial = SyntheticSerial(i);
+      info.name = std::string("Synthetic ") + KinectGenerationLabel(config_.profile);
+      devices.push_back(std::move(info));
+    }
+    return devices;
+  }
+
+  std::unique_ptr<KinectDevice> openDevice(const std::string &serial) override {
+    for (int i = 0; i < config_.device_count; ++i) {
+      if (serial == SyntheticSerial(i)) {
+        return std::make_unique<SyntheticDevice>(config_, i);
+      }
+    }
+    return nullptr;
+  }
+
+  PreviewResult preview(std::chrono::seconds duration) override {
+    PreviewResult result;
+    const auto devices = listDevices();
+    if (devices.empty()) {
+      result.detail = "No synthetic devices configured.";
+      return result;
+    }
+    auto device = openDevice(devices[0].serial);
+    if (!device || !device->start()) {
+      result.detail = "Could not start synthetic preview.";
+      return result;
+    }
+    device->setAudioEnabled(true);
+    const auto end = std::chrono::steady_clock::now() + duration;
+    AudioChunk audio;
+    while (std::chrono::steady_clock::now() < end) {
+      if (device->update()) {
+        FrameData frame;
+        if (device->getFrame(frame)) {
+          if (!frame.rgb.empty()) {
+            ++result.color_frames;
+          }
+          if (!frame.depth.empty()) {
+            ++result.depth_frames;
+          }
+        }
+      }
+      device->getAudio(audio);
+    }
+    device->stop();
+    result.telemetry = device->telemetrySnapshot();
+    result.success = (result.color_frames + result.depth_frames) > 0;
+    result.detail = result.success ? "Preview captured." : "No frames captured.";
+    return result;
+  }
+
+ private:
+  SyntheticConfig config_;
+};
+
+bool ParseDouble(const std::string &text, double *value) {
+  char *end = nullptr;
+  const double parsed = std::strtod(text.c_str(), &end);
+  if (end == text.c_str() || *end != '\0' || !std::isfinite(parsed)) {
+    return false;
+  }
+  *value = parsed;
+  return true;
+}
+
+}  // namespace
+
+bool ParseSyntheticConfig(const std::string &spec, SyntheticConfig *config, std::string *error) {
+  std::stringstream items(spec);
+  std::string item;
+  while (std::getline(items, item, ',')) {
+    if (item.empty()) {
+      continue;
+    }
+    const std::size_t eq = item.find('=');
+    const std::string key = item.substr(0, eq);
+    const std::string value = eq == std::string::npos ? "" : item.substr(eq + 1);
+    double number = 0.0;
+
+    if (key == "profile") {
+      if (value == "v1") {
+        config->profile = KinectGeneration::kV1;
+      } else if (value == "v2") {
+        config->profile = KinectGeneration::kV2;
+      } else {
+        *error = "profile must be v1 or v2";
+        return false;
+      }
+      continue;
+    }
+    if (!ParseDouble(value, &number)) {
+      *error = "invalid value for '" + key + "'";
+      return false;
+    }
+    if (key == "devices" && number >= 1.0) {
+      config->device_count = static_cast<int>(number);
+    } else if (key == "fps" && number >= 0.0) {
+      config->fps = number;
+    } else if (key == "jitter" && number >= 0.0) {
+      config->jitter_ms = number;
+    } else if (key == "drop" && number >= 0.0 && number < 1.0) {
+      config->drop_rate = number;
+    } else if (key == "skew" && number >= 0.0) {
+      config->clock_skew_ppm = number;
+    } else if (key == "audio") {
+      config->audio = number != 0.0;
+    } else if (key == "noise" && number >= 0.0) {
+      config->depth_noise = static_cast<float>(number);
+    } else if (key == "seed") {
+      config->seed = static_cast<std::uint32_t>(number);
+    } else if (key == "register") {
+      config->registration = number != 0.0;
+    } else if (key == "filter") {
+      config->depth_filter = number != 0.0;
+    } else if (key == "pyramid") {
+      config->depth_pyramid = number != 0.0;
+    } else if (key == "planes") {
+      config->plane_detection = number != 0.0;
+    } else if (key == "foreground") {
+      config->background_subtraction = number != 0.0;
+    } else if (key == "blobs") {
+      config->blob_tracking = number != 0.0;
+    } else {
+      *error = "unknown or out-of-range option '" + item + "'";
+      return false;
+    }
+  }
+  return true;
+}
+
+double SyntheticDeviceTickNs(const SyntheticConfig &config, int index) {
+  if (config.fps <= 0.0) {
+    return 0.0;
+  }
+  return 1e9 / config.fps / DeviceClock(config, index).ticks_per_frame;
+}
+
+std::unique_ptr<KinectBackend> CreateSyntheticBackend(const SyntheticConfig &config) {
+  return std::make_unique<SyntheticBackend>(config);
+}
+
+std::unique_ptr<KinectBackend> CreateSyntheticBackendFromEnvironment() {
+  const char *spec = std::getenv("KINECT_SYNTHETIC");
+  if (spec == nullptr) {
+    return nullptr;
+  }
+  SyntheticConfig config;
+  std::string error;
+  if (!ParseSyntheticConfig(spec, &config, &error)) {
+    std::cerr << "[synthetic] Ignoring KINECT_SYNTHETIC: " << error << "\n";
+    return nullptr;
+  }
+  return CreateSyntheticBackend(config);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "backends/backend.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Load-generator backend: fabricates virtual Kinects that stream a moving
+// synthetic scene through the regular KinectDevice interface, so the whole
+// pipeline can be exercised and benchmarked without hardware.
+struct SyntheticConfig {
+  int device_count = 1;
+  // kV1: 640x480 color/depth/IR. kV2: 1920x1080 color, 512x424 depth/IR.
+  KinectGeneration profile = KinectGeneration::kV1;
+  // Target frame rate; 0 produces frames as fast as update() is called.
+  double fps = 30.0;
+  // Uniform +/- delivery jitter around each frame deadline.
+  double jitter_ms = 0.0;
+  // Probability that a frame is lost (its device timestamp is still consumed,
+  // so telemetry reports it as dropped).
+  double drop_rate = 0.0;
+  // Each device's timestamp counter starts at its own origin and runs fast or
+  // slow by up to this many parts per million, like independent hardware
+  // clocks.
+  double clock_skew_ppm = 0.0;
+  bool audio = true;
+  float depth_noise = 1.0f;
+  std::uint32_t seed = 1;
+  // Start devices with depth/color registration enabled.
+  bool registration = false;
+  // Start devices with the default depth filter chain enabled.
+  bool depth_filter = false;
+  // Attach a depth pyramid to every frame.
+  bool depth_pyramid = false;
+  // Attach detected planes to every frame.
+  bool plane_detection = false;
+  // Attach a foreground mask against a learned background to every frame.
+  bool background_subtraction = false;
+  // Attach tracked foreground blobs to every frame; implies
+  // background_subtraction.
+  bool blob_tracking = false;
+};
+
+// Parses "key=value,..." with keys devices, profile (v1|v2), fps, jitter
+// (ms), drop, skew (ppm), audio (0|1), noise, seed, register (0|1), filter
+// (0|1), pyramid (0|1), planes (0|1), foreground (0|1) and blobs (0|1). An
+// empty spec keeps the defaults.
+bool ParseSyntheticConfig(const std::string &spec, SyntheticConfig *config, std::string *error);
+
+// Length in nanoseconds of one FrameData::timestamp tick of synthetic device
+// |index|, skew included: the ground truth for host-clock mapping. 0 for
+// uncapped streams, whose timestamps count frames rather than time.
+double SyntheticDeviceTickNs(const SyntheticConfig &config, int index);
+
+std::unique_ptr<KinectBackend> CreateSyntheticBackend(const SyntheticConfig &config);
+
+// Returns a synthetic backend configured from $KINECT_SYNTHETIC, or nullptr
+// when the variable is unset. Lets app layers run without hardware.
+std::unique_ptr<KinectBackend> CreateSyntheticBackendFromEnvironment();
@@ -0,0 +1,237 @@
+#include "backends/synthetic_scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+constexpr float kBackWallZ = 3500.0f;
+constexpr float kFloorY = 900.0f;
+constexpr float kSideWallX = -1800.0f;
+constexpr float kMaxRangeMm = 8000.0f;
+constexpr double kTwoPi = 6.283185307179586;
+
+struct Vec3 {
+  float x, y, z;
+};
+
+inline float Dot(const Vec3 &a, const Vec3 &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// Returns the nearest positive ray parameter for a sphere, or +inf.
+inline float HitSphere(const Vec3 &o, const Vec3 &d, const Vec3 &c, float r) {
+  const Vec3 oc{o.x - c.x, o.y - c.y, o.z - c.z};
+  const float a = Dot(d, d);
+  const float b = 2.0f * Dot(d, oc);
+  const float k = Dot(oc, oc) - r * r;
+  const float disc = b * b - 4.0f * a * k;
+  if (disc < 0.0f) {
+    return std::numeric_limits<float>::infinity();
+  }
+  const float t = (-b - std::sqrt(disc)) / (2.0f * a);
+  return t > 0.0f ? t : std::numeric_limits<float>::infinity();
+}
+
+// Slab test against an axis-aligned box.
+inline float HitBox(const Vec3 &o, const Vec3 &d, const Vec3 &lo, const Vec3 &hi) {
+  float t_near = 0.0f;
+  float t_far = std::numeric_limits<float>::infinity();
+  const float origin[3] = {o.x, o.y, o.z};
+  const float dir[3] = {d.x, d.y, d.z};
+  const float min_v[3] = {lo.x, lo.y, lo.z};
+  const float max_v[3] = {hi.x, hi.y, hi.z};
+  for (int axis = 0; axis < 3; ++axis) {
+    if (std::fabs(dir[axis]) < 1e-9f) {
+      if (origin[axis] < min_v[axis] || origin[axis] > max_v[axis]) {
+        return std::numeric_limits<float>::infinity();
+      }
+      continue;
+    }
+    float t0 = (min_v[axis] - origin[axis]) / dir[axis];
+    float t1 = (max_v[axis] - origin[axis]) / dir[axis];
+    if (t0 > t1) {
+      std::swap(t0, t1);
+    }
+    t_near = std::max(t_near, t0);
+    t_far = std::min(t_far, t1);
+    if (t_near > t_far) {
+      return std::numeric_limits<float>::infinity();
+    }
+  }
+  return t_near > 0.0f ? t_near : std::numeric_limits<float>::infinity();
+}
+
+// Ray parameter where o + t*d meets the plane axis == value, or +inf.
+inline float HitPlane(float origin, float dir, float value) {
+  if (std::fabs(dir) < 1e-9f) {
+    return std::numeric_limits<float>::infinity();
+  }
+  const float t = (value - origin) / dir;
+  return t > 0.0f ? t : std::numeric_limits<float>::infinity();
+}
+
+// Cheap stateless hash -> [-1, 1), so noise is reproducible per pixel/frame.
+inline float HashNoise(std::uint32_t x, std::uint32_t y, std::uint64_t frame) {
+  std::uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u ^ static_cast<std::uint32_t>(frame) * 0xcb1ab31fu;
+  h ^= h >> 13;
+  h *= 0x5bd1e995u;
+  h ^= h >> 15;
+  return static_cast<float>(h & 0xffffu) / 32768.0f - 1.0f;
+}
+
+}  // namespace
+
+SyntheticCamera SyntheticDepthCamera(KinectGeneration generation) {
+  if (generation == KinectGeneration::kV2) {
+    return {512, 424, 365.0f, 365.0f, 256.0f, 212.0f, {}};
+  }
+  return {640, 480, 580.0f, 580.0f, 320.0f, 240.0f, {}};
+}
+
+SyntheticCamera SyntheticColorCamera(KinectGeneration generation) {
+  if (generation == KinectGeneration::kV2) {
+    return {1920, 1080, 1081.0f, 1081.0f, 960.0f, 540.0f, {}};
+  }
+  return {640, 480, 525.0f, 525.0f, 320.0f, 240.0f, {}};
+}
+
+SyntheticScene::Objects SyntheticScene::objectsAt(double time_s) const {
+  const double w = kTwoPi / 6.0;  // one sweep every six seconds
+  const double t = time_s + phase_;
+  Objects o{};
+  o.sphere_x = static_cast<float>(700.0 * std::sin(w * t));
+  o.sphere_y = 150.0f;
+  o.sphere_z = static_cast<float>(2100.0 + 500.0 * std::cos(0.7 * w * t));
+  o.sphere_r = 320.0f;
+
+  const float box_z = static_cast<float>(2700.0 + 400.0 * std::sin(0.5 * w * t));
+  o.box_min_x = -1300.0f;
+  o.box_max_x = -700.0f;
+  o.box_min_y = 300.0f;
+  o.box_max_y = kFloorY;
+  o.box_min_z = box_z - 300.0f;
+  o.box_max_z = box_z + 300.0f;
+  return o;
+}
+
+void SyntheticScene::objectCenters(double time_s, float sphere[3], float box[3]) const {
+  const Objects o = objectsAt(time_s);
+  sphere[0] = o.sphere_x;
+  sphere[1] = o.sphere_y;
+  sphere[2] = o.sphere_z;
+  box[0] = 0.5f * (o.box_min_x + o.box_max_x);
+  box[1] = 0.5f * (o.box_min_y + o.box_max_y);
+  box[2] = 0.5f * (o.box_min_z + o.box_max_z);
+}
+
+void SyntheticScene::renderDepth(const SyntheticCamera &camera, double time_s, const SyntheticPose &pose,
+                                 std::uint64_t frame_index, std::uint16_t *out) const {
+  const Objects objects = objectsAt(time_s);
+  const Vec3 origin{pose.tx, pose.ty, pose.tz};
+  const Vec3 sphere{objects.sphere_x, objects.sphere_y, objects.sphere_z};
+  const Vec3 box_lo{objects.box_min_x, objects.box_min_y, objects.box_min_z};
+  const Vec3 box_hi{objects.box_max_x, objects.box_max_y, objects.box_max_z};
+  const float cos_yaw = std::cos(pose.yaw);
+  const float sin_yaw = std::sin(pose.yaw);
+  const float inv_fx = 1.0f / camera.fx;
+  const float inv_fy = 1.0f / camera.fy;
+  // sigma(z) ~= 1.4e-6 * z^2 mm; the hash is uniform, so scale by sqrt(3).
+  const float noise_k = depth_noise_ * 1.4e-6f * 1.732f;
+
+  for (int v = 0; v < camera.height; ++v) {
+    const float ray_y = (static_cast<float>(v) - camera.cy) * inv_fy;
+    std::uint16_t *row = out + static_cast<std::size_t>(v) * camera.width;
+    for (int u = 0; u < camera.width; ++u) {
+      const float ray_x = (static_cast<float>(u) - camera.cx) * inv_fx;
+      // Camera-frame ray (x, y, 1) rotated into the scene; t is then the
+      // camera-frame z of the hit.
+      const Vec3 dir{cos_yaw * ray_x + sin_yaw, ray_y, -sin_yaw * ray_x + cos_yaw};
+
+      float t = HitPlane(origin.z, dir.z, kBackWallZ);
+      t = std::min(t, HitPlane(origin.y, dir.y, kFloorY));
+      t = std::min(t, HitPlane(origin.x, dir.x, kSideWallX));
+      if (objects_visible_) {
+        t = std::min(t, HitSphere(origin, dir, sphere, objects.sphere_r));
+        t = std::min(t, HitBox(origin, dir, box_lo, box_hi));
+      }
+
+      if (!(t < kMaxRangeMm)) {
+        row[u] = 0;
+        continue;
+      }
+      if (noise_k > 0.0f) {
+        t += noise_k * t * t * HashNoise(static_cast<std::uint32_t>(u), static_cast<std::uint32_t>(v), frame_index);
+      }
+      row[u] = static_cast<std::uint16_t>(std::max(0.0f, std::min(65535.0f, t + 0.5f)));
+    }
+  }
+}
+
+void SyntheticScene::renderColor(const SyntheticCamera &camera, double time_s, std::uint8_t *out) const {
+  const Objects objects = objectsAt(time_s);
+  const std::size_t row_bytes = static_cast<std::size_t>(camera.width) * 3;
+  const int scroll = static_cast<int>(time_s * 60.0);
+  const int cell = std::max(8, camera.width / 32);
+  const int horizon = static_cast<int>(camera.cy + camera.fy * kFloorY / kBackWallZ);
+
+  // The background only changes at checker and horizon boundaries, so each
+  // band is drawn once and copied down.
+  for (int v = 0; v < camera.height; ++v) {
+    std::uint8_t *row = out + static_cast<std::size_t>(v) * row_bytes;
+    if (v > 0 && v % cell != 0 && v != horizon) {
+      std::memcpy(row, row - row_bytes, row_bytes);
+      continue;
+    }
+    const bool floor = v >= horizon;
+    const int band = v / cell;
+    for (int u = 0; u < camera.width; ++u) {
+      const bool check = (((u + scroll) / cell) + band) & 1;
+      row[u * 3 + 0] = floor ? (check ? 90 : 60) : (check ? 200 : 170);
+      row[u * 3 + 1] = floor ? (check ? 80 : 55) : (check ? 205 : 180);
+      row[u * 3 + 2] = floor ? (check ? 70 : 45) : (check ? 150 : 120);
+    }
+  }
+
+  if (!objects_visible_) {
+    return;
+  }
+  // Sphere as a disc, shaded by the normal's z component (light at camera).
+  const float disc_x = camera.cx + camera.fx * objects.sphere_x / objects.sphere_z;
+  const float disc_y = camera.cy + camera.fy * objects.sphere_y / objects.sphere_z;
+  const float disc_r = camera.fx * objects.sphere_r / objects.sphere_z;
+  const float disc_r2 = disc_r * disc_r;
+  const int v0 = std::max(0, static_cast<int>(disc_y - disc_r));
+  const int v1 = std::min(camera.height - 1, static_cast<int>(disc_y + disc_r) + 1);
+  const int u0 = std::max(0, static_cast<int>(disc_x - disc_r));
+  const int u1 = std::min(camera.width - 1, static_cast<int>(disc_x + disc_r) + 1);
+  for (int v = v0; v <= v1; ++v) {
+    std::uint8_t *row = out + static_cast<std::size_t>(v) * row_bytes;
+    const float dy = static_cast<float>(v) - disc_y;
+    for (int u = u0; u <= u1; ++u) {
+      const float dx = static_cast<float>(u) - disc_x;
+      const float d2 = dx * dx + dy * dy;
+      if (d2 >= disc_r2) {
+        continue;
+      }
+      const float shade = 0.4f + 0.6f * std::sqrt(1.0f - d2 / disc_r2);
+      row[u * 3 + 0] = static_cast<std::uint8_t>(230.0f * shade);
+      row[u * 3 + 1] = static_cast<std::uint8_t>(90.0f * shade);
+      row[u * 3 + 2] = static_cast<std::uint8_t>(40.0f * shade);
+    }
+  }
+}
+
+void SyntheticIrFromDepth(const std::uint16_t *depth, int count, std::uint8_t *out) {
+  for (int i = 0; i < count; ++i) {
+    const std::uint16_t d = depth[i];
+    if (d == 0) {
+      out[i] = 0;
+      continue;
+    }
+    const float falloff = 1.0f - std::min(1.0f, static_cast<float>(d) / kMaxRangeMm);
+    out[i] = static_cast<std::uint8_t>(30.0f + 225.0f * falloff * falloff);
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "backends/backend.h"
+
+#include <cstdint>
+
+// Analytic test scene used by the synthetic backend: a room (floor, back and
+// side wall) with a sphere and a box moving through it. Depth is ray cast per
+// pixel, so frames are exact for a known camera and pose, which also makes the
+// scene usable as ground truth for registration and tracking code.
+//
+// Scene coordinates are millimetres in the camera frame at the identity pose:
+// +x right, +y down, +z forward.
+
+// Rendering ignores lens distortion: synthetic cameras are ideal pinholes.
+using SyntheticCamera = CameraIntrinsics;
+
+// Nominal pinhole models for the synthetic v1 (640x480) and v2 (512x424 depth,
+// 1920x1080 color) profiles.
+SyntheticCamera SyntheticDepthCamera(KinectGeneration generation);
+SyntheticCamera SyntheticColorCamera(KinectGeneration generation);
+
+// Camera pose in scene coordinates: translation in mm plus yaw (radians,
+// about +y).
+struct SyntheticPose {
+  float tx = 0.0f;
+  float ty = 0.0f;
+  float tz = 0.0f;
+  float yaw = 0.0f;
+};
+
+class SyntheticScene {
+ public:
+  // |phase| offsets the object motion so several virtual devices differ.
+  explicit SyntheticScene(double phase = 0.0) : phase_(phase) {}
+
+  // Kinect-like axial noise; 1.0 approximates the v1 sensor (sigma grows with
+  // z^2), 0 renders exact depth.
+  void setDepthNoise(float scale) { depth_noise_ = scale; }
+  // Hides the sphere and the box, leaving the empty room (ground truth for
+  // background models).
+  void setObjectsVisible(bool visible) { objects_visible_ = visible; }
+  // Centres of the sphere and the box at |time_s| in scene millimetres
+  // (ground truth for trackers).
+  void objectCenters(double time_s, float sphere[3], float box[3]) const;
+
+  // Writes camera-frame z in millimetres (0 = no return) for every pixel.
+  void renderDepth(const SyntheticCamera &camera, double time_s, const SyntheticPose &pose,
+                   std::uint64_t frame_index, std::uint16_t *out) const;
+
+  // Writes packed RGB24: a scrolling checkerboard room with the sphere drawn
+  // as a shaded disc. Cheap enough for 1080p at high frame rates.
+  void renderColor(const SyntheticCamera &camera, double time_s, std::uint8_t *out) const;
+
+ private:
+  struct Objects {
+    float sphere_x, sphere_y, sphere_z, sphere_r;
+    float box_min_x, box_min_y, box_min_z;
+    float box_max_x, box_max_y, box_max_z;
+  };
+  Objects objectsAt(double time_s) const;
+
+  double phase_ = 0.0;
+  float depth_noise_ = 0.0f;
+  bool objects_visible_ = true;
+};
+
+// Derives an 8-bit IR image from depth: brighter when closer, dark holes where
+// there is no return.
+void SyntheticIrFromDepth(const std::uint16_t *depth, int count, std::uint8_t *out);
@@ -0,0 +1,118 @@
+#include "bench/bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+struct BenchSuite {
+  const char *name;
+  const char *description;
+  bool (*run)(const BenchOptions &options);
+};
+
+const BenchSuite kSuites[] = {
+    {"pointcloud", "ray-table back-projection and PLY export vs. the per-pixel ASCII writer", BenchPointCloud},
+    {"registration", "depth-to-color registration through lookup tables vs. per-pixel projection",
+     BenchRegistration},
+    {"depthfilter", "median, spatial, temporal and hole-fill depth denoising stages", BenchDepthFilter},
+    {"pyramid", "depth pyramid build and range queries vs. rescanning full-resolution depth", BenchDepthPyramid},
+    {"normals", "integral-image surface normals (gradient and covariance) on organized clouds", BenchNormals},
+    {"voxel", "voxel-grid downsampling and multi-frame accumulation vs. std::unordered_map", BenchVoxelGrid},
+    {"icp", "point-to-plane ICP odometry on synthetic handheld trajectories", BenchIcp},
+    {"tsdf", "TSDF fusion, raycasting and marching cubes over a handheld sweep", BenchTsdf},
+    {"mesh", "organized-grid meshing of a single depth frame to PLY and OBJ", BenchOrganizedMesh},
+    {"planes", "RANSAC plane and floor detection with label masks and a temporal prior", BenchPlaneDetection},
+    {"background", "per-pixel depth background model, foreground mask cleanup and boxes", BenchBackground},
+    {"blobs", "connected components of the foreground with 3D moments and tracked ids", BenchBlobs},
+    {"compositing", "depth-keyed background replacement with a guided-filter matte, 720p", BenchBackgroundRemoval},
+    {"depthcodec", "lossless RVL depth coding, key and delta frames, on replayed depth (--bench-input)",
+     BenchDepthCodec},
+    {"jpeg", "TurboJPEG 1080p color encoding (whole frames vs. slices) and per-mode capture decode cost", BenchJpeg},
+    {"tofdepth", "Kinect v2 depth packet decoding (phase unwrapping, filters) on one thread vs. a thread pool",
+     BenchTofDepth},
+    {"multidevice", "synthetic devices captured together: clock mapping and time-aligned frame sets",
+     BenchMultiDevice},
+    {"trace", "frame time of the depth chain with trace points recording vs. idle", BenchTrace},
+};
+
+}  // namespace
+
+BenchTiming TimeIterations(int iterations, const std::function<void()> &body) {
+  BenchTiming timing;
+  timing.iterations = std::max(1, iterations);
+  body();
+
+  std::vector<double> samples;
+  samples.reserve(static_cast<std::size_t>(timing.iterations));
+  for (int i = 0; i < timing.iterations; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    body();
+    samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  double total = 0.0;
+  for (double sample : samples) {
+    total += sample;
+  }
+  timing.mean_ms = total / static_cast<double>(samples.size());
+  std::sort(samples.begin(), samples.end());
+  timing.min_ms = samples.front();
+  timing.p50_ms = samples[samples.size() / 2];
+  return timing;
+}
+
+void PrintBenchLine(const std::string &label, const BenchTiming &timing, const std::string &detail) {
+  char line[256];
+  std::snprintf(line, sizeof(line), "  %-40s mean %8.3f ms  min %8.3f ms  p50 %8.3f ms  (n=%d)", label.c_str(),
+                timing.mean_ms, timing.min_ms, timing.p50_ms, timing.iterations);
+  std::cout << line;
+  if (!detail.empty()) {
+    std::cout << "  " << detail;
+  }
+  std::cout << "\n";
+}
+
+std::string BenchScratchDirectory() {
+  std::error_code error;
+  std::filesystem::path dir = std::filesystem::temp_directory_path(error);
+  if (error) {
+    dir = ".";
+  }
+  dir /= "mackinect-bench";
+  std::filesystem::create_directories(dir, error);
+  return dir.string();
+}
+
+void ListBenchmarks(std::ostream &out) {
+  for (const BenchSuite &suite : kSuites) {
+    out << "  " << suite.name << "  " << suite.description << "\n";
+  }
+}
+
+bool RunBenchmarks(const std::string &name, const BenchOptions &options) {
+  if (name == "list") {
+    ListBenchmarks(std::cout);
+    return true;
+  }
+  bool matched = false;
+  bool ok = true;
+  for (const BenchSuite &suite : kSuites) {
+    if (name != "all" && name != suite.name) {
+      continue;
+    }
+    matched = true;
+    std::cout << "[bench] " << suite.name << "\n";
+    ok = suite.run(options) && ok;
+  }
+  if (!matched) {
+    std::cerr << "Unknown benchmark: " << name << "\nAvailable benchmarks:\n";
+    ListBenchmarks(std::cerr);
+    return false;
+  }
+  return ok;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+
+// Micro-benchmarks for the processing kernels, run from the CLI with
+// `--bench <name>`. Each suite renders its own synthetic input, so results
+// are comparable across machines without a Kinect attached.
+
+struct BenchOptions {
+  // 0 lets each suite pick an iteration count that runs for about a second.
+  int iterations = 0;
+  // Recording (.krec) for suites that can run on captured data instead.
+  std::string input;
+};
+
+struct BenchTiming {
+  int iterations = 0;
+  double mean_ms = 0.0;
+  double min_ms = 0.0;
+  double p50_ms = 0.0;
+};
+
+// Runs |body| once to warm caches, then |iterations| timed times.
+BenchTiming TimeIterations(int iterations, const std::function<void()> &body);
+
+// Prints "  <label>  mean/min/p50 ms" plus an optional detail column.
+void PrintBenchLine(const std::string &label, const BenchTiming &timing, const std::string &detail = std::string());
+
+// Directory for files written by I/O benchmarks (created on demand).
+std::string BenchScratchDirectory();
+
+void ListBenchmarks(std::ostream &out);
+
+// Runs every suite whose name matches |name| ("all" runs everything, "list"
+// prints the suites).
+// Returns false if no suite matched or one failed.
+bool RunBenchmarks(const std::string &name, const BenchOptions &options);
+
+// Suites (bench_*.cpp).
+bool BenchPointCloud(const BenchOptions &options);
+bool BenchRegistration(const BenchOptions &options);
+bool BenchDepthFilter(const BenchOptions &options);
+bool BenchDepthPyramid(const BenchOptions &options);
+bool BenchNormals(const BenchOptions &options);
+bool BenchVoxelGrid(const BenchOptions &options);
+bool BenchIcp(const BenchOptions &options);
+bool BenchTsdf(const BenchOptions &options);
+bool BenchOrganizedMesh(const BenchOptions &options);
+bool BenchPlaneDetection(const BenchOptions &options);
+bool BenchBackground(const BenchOptions &options);
+bool BenchBlobs(const BenchOptions &options);
+bool BenchBackgroundRemoval(const BenchOptions &options);
+bool BenchDepthCodec(const BenchOptions &options);
+bool BenchJpeg(const BenchOptions &options);
+bool BenchTofDepth(const BenchOptions &options);
+bool BenchMultiDevice(const BenchOptions &options);
+bool BenchTrace(const BenchOptions &options);
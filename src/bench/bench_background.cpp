@@ -0,0 +1,151 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/background_model.h"
+
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int kTrainingFrames = 60;
+constexpr int kSequenceFrames = 120;
+// Someone standing still for ten seconds must stay foreground.
+constexpr int kStillFrames = 300;
+constexpr double kFrameRate = 30.0;
+// Object pixels at least this far in front of the empty room are foreground.
+constexpr int kTruthMarginMm = 20;
+constexpr double kMinRecall = 0.9;
+constexpr double kMinPrecision = 0.95;
+constexpr double kMinStillRecall = 0.8;
+constexpr double kMinBoxCoverage = 0.95;
+// "Under 1 ms per frame on 512x424".
+constexpr double kBudgetMs = 1.0;
+
+struct MaskScore {
+  double recall = 0.0;
+  double precision = 0.0;
+  double box_coverage = 0.0;
+};
+
+MaskScore ScoreMask(const ForegroundMask &mask, const std::uint16_t *room, const std::uint16_t *objects) {
+  std::size_t expected = 0;
+  std::size_t flagged = 0;
+  std::size_t agreed = 0;
+  for (int y = 0; y < mask.height; ++y) {
+    for (int x = 0; x < mask.width; ++x) {
+      const std::size_t i = static_cast<std::size_t>(y) * mask.width + x;
+      const bool truth = objects[i] != 0 && (room[i] == 0 || objects[i] + kTruthMarginMm < room[i]);
+      const bool got = mask.test(x, y);
+      expected += truth ? 1 : 0;
+      flagged += got ? 1 : 0;
+      agreed += truth && got ? 1 : 0;
+    }
+  }
+  std::size_t boxed = 0;
+  for (const ForegroundBox &box : mask.boxes) {
+    boxed += box.pixels;
+  }
+  MaskScore score;
+  score.recall = expected > 0 ? static_cast<double>(agreed) / static_cast<double>(expected) : 1.0;
+  score.precision = flagged > 0 ? static_cast<double>(agreed) / static_cast<double>(flagged) : 1.0;
+  score.box_coverage = mask.pixels > 0 ? static_cast<double>(boxed) / static_cast<double>(mask.pixels) : 1.0;
+  return score;
+}
+
+}  // namespace
+
+bool BenchBackground(const BenchOptions &options) {
+  const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+  bool ok = true;
+
+  for (KinectGeneration generation : {KinectGeneration::kV1, KinectGeneration::kV2}) {
+    const SyntheticCamera camera = SyntheticDepthCamera(generation);
+    const std::size_t pixels = static_cast<std::size_t>(camera.width) * camera.height;
+    SyntheticScene scene;
+    scene.setDepthNoise(1.0f);
+    SyntheticScene truth;
+    std::vector<std::uint16_t> room(pixels);
+    truth.setObjectsVisible(false);
+    truth.renderDepth(camera, 0.0, SyntheticPose{}, 0, room.data());
+    truth.setObjectsVisible(true);
+
+    // The empty room to learn from, then the objects moving through it.
+    std::vector<std::vector<std::uint16_t>> training;
+    scene.setObjectsVisible(false);
+    for (int f = 0; f < kTrainingFrames; ++f) {
+      training.emplace_back(pixels);
+      scene.renderDepth(camera, 0.0, SyntheticPose{}, static_cast<std::uint64_t>(f), training.back().data());
+    }
+    scene.setObjectsVisible(true);
+    std::vector<std::vector<std::uint16_t>> frames;
+    for (int f = 0; f < kSequenceFrames; ++f) {
+      frames.emplace_back(pixels);
+      scene.renderDepth(camera, f / kFrameRate, SyntheticPose{}, static_cast<std::uint64_t>(kTrainingFrames + f),
+                        frames.back().data());
+    }
+    std::cout << " " << camera.width << "x" << camera.height << ", " << kTrainingFrames << " training frames\n";
+
+    std::vector<int> thread_counts = {1};
+    if (hardware > 1) {
+      thread_counts.push_back(0);
+    }
+    for (int threads : thread_counts) {
+      BackgroundOptions background_options;
+      background_options.threads = threads;
+      BackgroundModel model;
+      model.setOptions(background_options);
+      for (const std::vector<std::uint16_t> &frame : training) {
+        model.update(frame.data(), camera.width, camera.height);
+      }
+      int frame = 0;
+      std::size_t boxes = 0;
+      std::shared_ptr<const ForegroundMask> mask;
+      const int iterations = options.iterations > 0 ? std::min(options.iterations, kSequenceFrames - 1)
+                                                    : kSequenceFrames - 1;
+      const BenchTiming timing = TimeIterations(iterations, [&] {
+        mask.reset();
+        mask = model.update(frames[static_cast<std::size_t>(frame)].data(), camera.width, camera.height);
+        boxes += mask->boxes.size();
+        ++frame;
+      });
+      char label[64];
+      std::snprintf(label, sizeof(label), "model + mask + boxes, %s", threads == 1 ? "1 thread" : "thread pool");
+      char detail[96];
+      std::snprintf(detail, sizeof(detail), "%.1f boxes per frame", static_cast<double>(boxes) / frame);
+      PrintBenchLine(label, timing, detail);
+      if (threads != 1) {
+        continue;
+      }
+      if (generation == KinectGeneration::kV2 && timing.mean_ms > kBudgetMs) {
+        std::cout << "  over the " << kBudgetMs << " ms budget\n";
+      }
+
+      std::vector<std::uint16_t> objects(pixels);
+      truth.renderDepth(camera, (frame - 1) / kFrameRate, SyntheticPose{}, 0, objects.data());
+      const MaskScore score = ScoreMask(*mask, room.data(), objects.data());
+      std::printf("  moving objects: recall %.3f, precision %.3f, %.1f%% of the mask boxed\n", score.recall,
+                  score.precision, score.box_coverage * 100.0);
+      if (score.recall < kMinRecall || score.precision < kMinPrecision || score.box_coverage < kMinBoxCoverage) {
+        ok = false;
+      }
+
+      // The objects stop; the slowed foreground rate keeps them out of the
+      // background.
+      const double still_time = (frame - 1) / kFrameRate;
+      std::vector<std::uint16_t> still(pixels);
+      for (int f = 0; f < kStillFrames; ++f) {
+        scene.renderDepth(camera, still_time, SyntheticPose{}, static_cast<std::uint64_t>(1000 + f), still.data());
+        mask = model.update(still.data(), camera.width, camera.height);
+      }
+      const MaskScore still_score = ScoreMask(*mask, room.data(), objects.data());
+      std::printf("  after %d still frames: recall %.3f, precision %.3f\n", kStillFrames, still_score.recall,
+                  still_score.precision);
+      if (still_score.recall < kMinStillRecall || still_score.precision < kMinPrecision) {
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,230 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/background_removal.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int kFrames = 20;
+constexpr double kFrameRate = 30.0;
+// The sphere swings closest to the camera around here; the box and the
+// walls, and the floor at the bottom of the frame, stay beyond the cut.
+constexpr double kStartTime = 3.8;
+constexpr std::uint16_t kCutMm = 1700;
+// Registered depth is color size / 2 on 720p output (v2 registers at a
+// third of 1080p).
+constexpr int kDepthDivisor = 2;
+// Pixels this close to the true silhouette may be feathered: a guided
+// filter window (radius 2 at scale 4) plus a guide pixel of mask
+// quantisation.
+constexpr int kEdgeMargin = 12;
+constexpr int kMaxChannelError = 2;
+constexpr double kMinCorrect = 0.995;
+// "Under 4 ms at 720p".
+constexpr double kBudgetMs = 4.0;
+constexpr int kBudgetRounds = 5;
+
+SyntheticCamera ScaledCamera(const SyntheticCamera &camera, int divisor_num, int divisor_den) {
+  SyntheticCamera scaled = camera;
+  scaled.width = camera.width * divisor_num / divisor_den;
+  scaled.height = camera.height * divisor_num / divisor_den;
+  const float s = static_cast<float>(divisor_num) / static_cast<float>(divisor_den);
+  scaled.fx *= s;
+  scaled.fy *= s;
+  scaled.cx = (camera.cx + 0.5f) * s - 0.5f;
+  scaled.cy = (camera.cy + 0.5f) * s - 0.5f;
+  return scaled;
+}
+
+// Pixels within |margin| of a pixel whose truth differs, by separable
+// dilation of the truth's edges.
+std::vector<std::uint8_t> NearEdge(const std::vector<std::uint8_t> &truth, int width, int height, int margin) {
+  std::vector<std::uint8_t> edge(truth.size(), 0);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const std::size_t i = static_cast<std::size_t>(y) * width + x;
+      const bool differs = (x + 1 < width && truth[i + 1] != truth[i]) ||
+                           (y + 1 < height && truth[i + static_cast<std::size_t>(width)] != truth[i]);
+      edge[i] = differs ? 1 : 0;
+    }
+  }
+  std::vector<std::uint8_t> rows(truth.size(), 0);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      for (int d = -margin; d <= margin && rows[static_cast<std::size_t>(y) * width + x] == 0; ++d) {
+        const int sx = x + d;
+        rows[static_cast<std::size_t>(y) * width + x] =
+            sx >= 0 && sx < width && edge[static_cast<std::size_t>(y) * width + sx] != 0 ? 1 : 0;
+      }
+    }
+  }
+  std::vector<std::uint8_t> near(truth.size(), 0);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      for (int d = -margin; d <= margin && near[static_cast<std::size_t>(y) * width + x] == 0; ++d) {
+        const int sy = y + d;
+        near[static_cast<std::size_t>(y) * width + x] =
+            sy >= 0 && sy < height && rows[static_cast<std::size_t>(sy) * width + x] != 0 ? 1 : 0;
+      }
+    }
+  }
+  return near;
+}
+
+struct Frame {
+  std::vector<std::uint8_t> bgra;
+  std::vector<std::uint16_t> depth;
+  std::vector<std::uint8_t> truth;
+};
+
+// Share of the pixels away from the silhouette that came out as the source
+// (foreground) or the replacement (background).
+double CorrectShare(const Frame &frame, const std::uint8_t *out, const std::vector<std::uint8_t> &near,
+                    const std::uint8_t *replacement_rgb, const std::vector<std::uint8_t> &image) {
+  std::size_t checked = 0;
+  std::size_t correct = 0;
+  for (std::size_t i = 0; i < frame.truth.size(); ++i) {
+    if (near[i] != 0) {
+      continue;
+    }
+    ++checked;
+    bool ok = true;
+    for (int c = 0; c < 3; ++c) {
+      int expected = frame.bgra[i * 4 + c];
+      if (frame.truth[i] == 0) {
+        expected = image.empty() ? replacement_rgb[2 - c] : image[i * 3 + 2 - c];
+      }
+      ok = ok && std::abs(out[i * 4 + c] - expected) <= kMaxChannelError;
+    }
+    correct += ok ? 1 : 0;
+  }
+  return checked > 0 ? static_cast<double>(correct) / static_cast<double>(checked) : 1.0;
+}
+
+}  // namespace
+
+bool BenchBackgroundRemoval(const BenchOptions &options) {
+  const int iterations = options.iterations > 0 ? std::min(options.iterations, kFrames - 1) : kFrames - 1;
+  const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+  bool ok = true;
+
+  // 720p color from the v2 color camera, and depth seen from the same
+  // camera at registration resolution.
+  const SyntheticCamera color_camera = ScaledCamera(SyntheticColorCamera(KinectGeneration::kV2), 2, 3);
+  const SyntheticCamera depth_camera = ScaledCamera(color_camera, 1, kDepthDivisor);
+  const std::size_t pixels = static_cast<std::size_t>(color_camera.width) * color_camera.height;
+  SyntheticScene scene;
+  SyntheticScene noisy;
+  noisy.setDepthNoise(1.0f);
+  std::vector<Frame> frames(kFrames);
+  std::vector<std::uint8_t> rgb(pixels * 3);
+  std::vector<std::uint16_t> clean(pixels);
+  for (int f = 0; f < kFrames; ++f) {
+    const double time = kStartTime + f / kFrameRate;
+    Frame &frame = frames[static_cast<std::size_t>(f)];
+    scene.renderColor(color_camera, time, rgb.data());
+    frame.bgra.resize(pixels * 4);
+    for (std::size_t i = 0; i < pixels; ++i) {
+      frame.bgra[i * 4 + 0] = rgb[i * 3 + 2];
+      frame.bgra[i * 4 + 1] = rgb[i * 3 + 1];
+      frame.bgra[i * 4 + 2] = rgb[i * 3 + 0];
+      frame.bgra[i * 4 + 3] = 255;
+    }
+    frame.depth.resize(static_cast<std::size_t>(depth_camera.width) * depth_camera.height);
+    noisy.renderDepth(depth_camera, time, SyntheticPose{}, static_cast<std::uint64_t>(f), frame.depth.data());
+    scene.renderDepth(color_camera, time, SyntheticPose{}, 0, clean.data());
+    frame.truth.resize(pixels);
+    for (std::size_t i = 0; i < pixels; ++i) {
+      frame.truth[i] = clean[i] != 0 && clean[i] <= kCutMm ? 1 : 0;
+    }
+  }
+  std::cout << " " << color_camera.width << "x" << color_camera.height << " BGRA, " << depth_camera.width << "x"
+            << depth_camera.height << " registered depth\n";
+
+  // A replacement image: a horizontal ramp.
+  std::vector<std::uint8_t> image(pixels * 3);
+  for (int y = 0; y < color_camera.height; ++y) {
+    for (int x = 0; x < color_camera.width; ++x) {
+      std::uint8_t *p = image.data() + (static_cast<std::size_t>(y) * color_camera.width + x) * 3;
+      p[0] = static_cast<std::uint8_t>(x * 255 / color_camera.width);
+      p[1] = static_cast<std::uint8_t>(y * 255 / color_camera.height);
+      p[2] = 96;
+    }
+  }
+
+  std::vector<int> thread_counts = {1};
+  if (hardware > 1) {
+    thread_counts.push_back(0);
+  }
+  for (bool use_image : {false, true}) {
+    for (int threads : thread_counts) {
+      BackgroundRemovalOptions removal_options;
+      removal_options.enabled = true;
+      removal_options.max_depth_mm = kCutMm;
+      removal_options.threads = threads;
+      BackgroundRemover remover;
+      remover.setOptions(removal_options);
+      if (use_image) {
+        remover.setReplacementImage(image.data(), color_camera.width, color_camera.height);
+      }
+      // Compositing is in place, so every timed call gets its own copy.
+      std::vector<std::vector<std::uint8_t>> outputs(frames.size());
+      const auto time_round = [&] {
+        for (std::size_t f = 0; f < frames.size(); ++f) {
+          outputs[f] = frames[f].bgra;
+        }
+        int frame = 0;
+        return TimeIterations(iterations, [&] {
+          const std::size_t f = static_cast<std::size_t>(frame);
+          remover.apply(outputs[f].data(), color_camera.width, color_camera.height,
+                        static_cast<std::size_t>(color_camera.width) * 4, frames[f].depth.data(), depth_camera.width,
+                        depth_camera.height);
+          ++frame;
+        });
+      };
+      const BenchTiming timing = time_round();
+      char label[64];
+      std::snprintf(label, sizeof(label), "%s, %s", use_image ? "over image" : "over color",
+                    threads == 1 ? "1 thread" : "thread pool");
+      PrintBenchLine(label, timing, "");
+      if (threads != 1) {
+        continue;
+      }
+      double best = timing.p50_ms;
+      double worst_p50 = timing.p50_ms;
+      for (int round = 1; round < kBudgetRounds; ++round) {
+        const double p50 = time_round().p50_ms;
+        best = std::min(best, p50);
+        worst_p50 = std::max(worst_p50, p50);
+      }
+      std::printf("  p50 %.3f-%.3f ms over %d rounds, best %s the %.1f ms budget\n", best, worst_p50, kBudgetRounds,
+                  best <= kBudgetMs ? "within" : "over", kBudgetMs);
+
+      // Accuracy on a few frames, outside the timed loop.
+      double worst = 1.0;
+      std::vector<std::uint8_t> out;
+      for (int f = 0; f < kFrames; f += 5) {
+        const Frame &source = frames[static_cast<std::size_t>(f)];
+        out = source.bgra;
+        remover.apply(out.data(), color_camera.width, color_camera.height,
+                      static_cast<std::size_t>(color_camera.width) * 4, source.depth.data(), depth_camera.width,
+                      depth_camera.height);
+        const std::vector<std::uint8_t> near = NearEdge(source.truth, color_camera.width, color_camera.height,
+                                                        kEdgeMargin);
+        worst = std::min(worst, CorrectShare(source, out.data(), near, removal_options.fill_rgb,
+                                             use_image ? image : std::vector<std::uint8_t>()));
+      }
+      std::printf("  %.2f%% of the pixels away from the silhouette kept or replaced correctly\n", worst * 100.0);
+      if (worst < kMinCorrect) {
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,191 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/background_model.h"
+#include "processing/blob_tracker.h"
+#include "processing/camera_model.h"
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int kTrainingFrames = 60;
+// Five seconds: the sphere sweeps most of the way across the room.
+constexpr int kSequenceFrames = 150;
+constexpr double kFrameRate = 30.0;
+// Slack around a blob's extent when deciding which object it is, metres.
+constexpr float kExtentToleranceM = 0.05f;
+constexpr double kMaxSphereErrorM = 0.02;
+constexpr double kMinFoundFraction = 0.9;
+
+struct ObjectTrack {
+  const char *name;
+  std::size_t found = 0;
+  std::size_t merged = 0;
+  std::size_t id_changes = 0;
+  std::uint32_t id = 0;
+  double max_error = 0.0;
+};
+
+// Distance of |center| from the camera ray through |centroid|: a blob sees
+// only the near side of its object, so the centroid sits on the object's
+// ray but in front of its centre.
+double OffRayDistance(const float centroid[3], const float center[3]) {
+  const double length = std::sqrt(centroid[0] * centroid[0] + centroid[1] * centroid[1] + centroid[2] * centroid[2]);
+  double along = 0.0;
+  for (int k = 0; k < 3; ++k) {
+    along += centroid[k] / length * center[k];
+  }
+  double off2 = 0.0;
+  for (int k = 0; k < 3; ++k) {
+    const double d = center[k] - along * centroid[k] / length;
+    off2 += d * d;
+  }
+  return std::sqrt(off2);
+}
+
+bool Contains(const Blob &blob, const float center[3]) {
+  return center[0] >= blob.min[0] - kExtentToleranceM && center[0] <= blob.max[0] + kExtentToleranceM &&
+         center[1] >= blob.min[1] - kExtentToleranceM && center[1] <= blob.max[1] + kExtentToleranceM;
+}
+
+// Follows one object through a frame's blobs: the blob whose extent holds
+// its centre, unless that blob holds the other object too.
+void Follow(const BlobSet &set, const float center[3], const float other[3], ObjectTrack *object) {
+  for (const Blob &blob : set.blobs) {
+    if (!Contains(blob, center)) {
+      continue;
+    }
+    if (Contains(blob, other)) {
+      ++object->merged;
+      return;
+    }
+    ++object->found;
+    object->id_changes += object->id != 0 && blob.id != object->id ? 1 : 0;
+    object->id = blob.id;
+    object->max_error = std::max(object->max_error, OffRayDistance(blob.centroid, center));
+    return;
+  }
+}
+
+bool LabelsAgree(const BlobSet &set) {
+  if (set.labels.empty()) {
+    return set.blobs.empty();
+  }
+  std::vector<std::size_t> counts(set.blobs.size() + 1, 0);
+  for (std::uint16_t label : set.labels) {
+    if (label > set.blobs.size()) {
+      return false;
+    }
+    ++counts[label];
+  }
+  for (std::size_t b = 0; b < set.blobs.size(); ++b) {
+    if (counts[b + 1] != set.blobs[b].pixels) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+bool BenchBlobs(const BenchOptions &options) {
+  const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+  bool ok = true;
+
+  for (KinectGeneration generation : {KinectGeneration::kV1, KinectGeneration::kV2}) {
+    const SyntheticCamera camera = SyntheticDepthCamera(generation);
+    const std::size_t pixels = static_cast<std::size_t>(camera.width) * camera.height;
+    const RayTable rays = BuildRayTable(camera);
+    SyntheticScene scene;
+    scene.setDepthNoise(1.0f);
+
+    // Foreground masks of the objects moving through a learned empty room.
+    BackgroundOptions background_options;
+    background_options.threads = 1;
+    BackgroundModel model;
+    model.setOptions(background_options);
+    std::vector<std::uint16_t> depth(pixels);
+    scene.setObjectsVisible(false);
+    for (int f = 0; f < kTrainingFrames; ++f) {
+      scene.renderDepth(camera, 0.0, SyntheticPose{}, static_cast<std::uint64_t>(f), depth.data());
+      model.update(depth.data(), camera.width, camera.height);
+    }
+    scene.setObjectsVisible(true);
+    std::vector<std::vector<std::uint16_t>> frames;
+    std::vector<ForegroundMask> masks;
+    for (int f = 0; f < kSequenceFrames; ++f) {
+      frames.emplace_back(pixels);
+      scene.renderDepth(camera, f / kFrameRate, SyntheticPose{}, static_cast<std::uint64_t>(kTrainingFrames + f),
+                        frames.back().data());
+      masks.push_back(*model.update(frames.back().data(), camera.width, camera.height));
+    }
+    std::cout << " " << camera.width << "x" << camera.height << ", " << kSequenceFrames << " frames\n";
+
+    std::vector<int> thread_counts = {1};
+    if (hardware > 1) {
+      thread_counts.push_back(0);
+    }
+    for (int threads : thread_counts) {
+      BlobTrackingOptions track_options;
+      track_options.threads = threads;
+      BlobTracker tracker;
+      tracker.setOptions(track_options);
+      ObjectTrack sphere{"sphere"};
+      ObjectTrack box{"box"};
+      std::size_t blobs = 0;
+      std::size_t runs = 0;
+      bool labels_agree = true;
+      int frame = 0;
+      const int iterations = options.iterations > 0 ? std::min(options.iterations, kSequenceFrames - 1)
+                                                    : kSequenceFrames - 1;
+      // TimeIterations() runs the body once more as a warm-up.
+      const BenchTiming timing = TimeIterations(iterations, [&] {
+        const std::size_t f = static_cast<std::size_t>(frame);
+        std::shared_ptr<const BlobSet> set = tracker.track(masks[f], frames[f].data(), rays);
+        blobs += set->blobs.size();
+        runs += tracker.stats().runs;
+        float sphere_center[3];
+        float box_center[3];
+        scene.objectCenters(frame / kFrameRate, sphere_center, box_center);
+        for (int k = 0; k < 3; ++k) {
+          sphere_center[k] *= 0.001f;
+          box_center[k] *= 0.001f;
+        }
+        Follow(*set, sphere_center, box_center, &sphere);
+        Follow(*set, box_center, sphere_center, &box);
+        labels_agree = labels_agree && LabelsAgree(*set);
+        ++frame;
+      });
+      char label[64];
+      std::snprintf(label, sizeof(label), "components + tracking, %s", threads == 1 ? "1 thread" : "thread pool");
+      char detail[96];
+      std::snprintf(detail, sizeof(detail), "%.1f blobs, %.0f runs per frame", static_cast<double>(blobs) / frame,
+                    static_cast<double>(runs) / frame);
+      PrintBenchLine(label, timing, detail);
+      if (threads != 1) {
+        continue;
+      }
+      for (const ObjectTrack *object : {&sphere, &box}) {
+        const std::size_t separate = static_cast<std::size_t>(frame) - object->merged;
+        const double found = separate > 0 ? static_cast<double>(object->found) / static_cast<double>(separate) : 1.0;
+        std::printf("  %s: found in %.1f%% of %zu separate frames, %zu id changes, centroid up to %.3f m off its ray\n",
+                    object->name, found * 100.0, separate, object->id_changes, object->max_error);
+        if (found < kMinFoundFraction || object->id_changes > 0) {
+          ok = false;
+        }
+      }
+      if (sphere.max_error > kMaxSphereErrorM) {
+        ok = false;
+      }
+      if (!labels_agree) {
+        std::cerr << "  label image disagrees with the blob pixel counts\n";
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,196 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "core/depth_codec.h"
+#include "core/recording.h"
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Three seconds of capture: long enough for several key frame intervals.
+constexpr int kSequenceFrames = 90;
+constexpr double kFrameRate = 30.0;
+// Frames taken from a --bench-input recording.
+constexpr int kMaxInputFrames = 300;
+
+struct DepthSequence {
+  std::string name;
+  int width = 0;
+  int height = 0;
+  std::vector<std::vector<std::uint16_t>> frames;
+};
+
+// Records |sequence| with raw depth and reads it back, so the codec runs on
+// frames that went through a .krec file like any replay.
+bool RoundTripRecording(DepthSequence *sequence) {
+  const std::string path = BenchScratchDirectory() + "/depth_codec.krec";
+  RecordingHeader header;
+  header.serial = "bench";
+  RecordingOptions recording;
+  recording.compress_depth = false;
+  RecordingWriter writer;
+  if (!writer.open(path, header, recording)) {
+    return false;
+  }
+  for (std::size_t f = 0; f < sequence->frames.size(); ++f) {
+    FrameData frame;
+    frame.depth = sequence->frames[f];
+    frame.depth_width = sequence->width;
+    frame.depth_height = sequence->height;
+    frame.width = sequence->width;
+    frame.height = sequence->height;
+    if (!writer.writeFrame(std::move(frame), static_cast<std::uint64_t>(f) * 33333333u)) {
+      return false;
+    }
+  }
+  if (!writer.close()) {
+    return false;
+  }
+  sequence->frames.clear();
+  RecordingReader reader;
+  if (!reader.open(path)) {
+    return false;
+  }
+  RecordKind kind = RecordKind::kFrame;
+  std::uint64_t host_ns = 0;
+  FrameData frame;
+  AudioChunk audio;
+  while (reader.next(&kind, &host_ns, &frame, &audio)) {
+    if (kind == RecordKind::kFrame && !frame.depth.empty()) {
+      sequence->frames.push_back(frame.depth);
+    }
+  }
+  std::remove(path.c_str());
+  return !sequence->frames.empty();
+}
+
+DepthSequence SyntheticSequence(KinectGeneration generation, float noise) {
+  const SyntheticCamera camera = SyntheticDepthCamera(generation);
+  DepthSequence sequence;
+  char name[64];
+  std::snprintf(name, sizeof(name), "%dx%d, %s", camera.width, camera.height, noise > 0.0f ? "noisy" : "noise-free");
+  sequence.name = name;
+  sequence.width = camera.width;
+  sequence.height = camera.height;
+  SyntheticScene scene;
+  scene.setDepthNoise(noise);
+  for (int f = 0; f < kSequenceFrames; ++f) {
+    sequence.frames.emplace_back(static_cast<std::size_t>(camera.width) * camera.height);
+    scene.renderDepth(camera, f / kFrameRate, SyntheticPose{}, static_cast<std::uint64_t>(f),
+                      sequence.frames.back().data());
+  }
+  return sequence;
+}
+
+bool LoadInput(const std::string &path, DepthSequence *sequence) {
+  RecordingReader reader;
+  if (!reader.open(path)) {
+    std::cerr << "  " << reader.error() << "\n";
+    return false;
+  }
+  RecordKind kind = RecordKind::kFrame;
+  std::uint64_t host_ns = 0;
+  FrameData frame;
+  AudioChunk audio;
+  while (static_cast<int>(sequence->frames.size()) < kMaxInputFrames &&
+         reader.next(&kind, &host_ns, &frame, &audio)) {
+    if (kind != RecordKind::kFrame || frame.depth.empty()) {
+      continue;
+    }
+    if (sequence->frames.empty()) {
+      sequence->width = frame.depth_width;
+      sequence->height = frame.depth_height;
+    } else if (frame.depth_width != sequence->width || frame.depth_height != sequence->height) {
+      break;
+    }
+    sequence->frames.push_back(frame.depth);
+  }
+  sequence->name = path;
+  return !sequence->frames.empty();
+}
+
+bool RunSequence(const DepthSequence &sequence, const BenchOptions &options) {
+  const std::size_t pixels = static_cast<std::size_t>(sequence.width) * sequence.height;
+  const int count = static_cast<int>(sequence.frames.size());
+  std::cout << " " << sequence.name << ", " << count << " frames\n";
+  if (count < 2) {
+    return false;
+  }
+  // TimeIterations() runs the body once more as a warm-up, and delta frames
+  // must be decoded in order, so one pass covers the sequence exactly once.
+  const int iterations = options.iterations > 0 ? std::min(options.iterations, count - 1) : count - 1;
+  bool ok = true;
+
+  for (bool temporal : {false, true}) {
+    DepthCodecOptions codec_options;
+    codec_options.temporal = temporal;
+    DepthEncoder encoder;
+    encoder.setOptions(codec_options);
+    std::vector<std::vector<std::uint8_t>> encoded(static_cast<std::size_t>(count));
+    std::size_t encoded_bytes = 0;
+    int frame = 0;
+    const BenchTiming encode_timing = TimeIterations(iterations, [&] {
+      const std::size_t f = static_cast<std::size_t>(frame);
+      encoder.encode(sequence.frames[f].data(), pixels, &encoded[f]);
+      encoded_bytes += encoded[f].size();
+      ++frame;
+    });
+    const double ratio =
+        static_cast<double>(pixels * sizeof(std::uint16_t) * static_cast<std::size_t>(frame)) / encoded_bytes;
+    char label[64];
+    std::snprintf(label, sizeof(label), "encode, %s", temporal ? "temporal" : "key frames");
+    char detail[96];
+    std::snprintf(detail, sizeof(detail), "%.0f fps, %.2f:1, %.1f KiB/frame", 1000.0 / encode_timing.mean_ms, ratio,
+                  static_cast<double>(encoded_bytes) / frame / 1024.0);
+    PrintBenchLine(label, encode_timing, detail);
+
+    DepthDecoder decoder;
+    std::vector<std::uint16_t> decoded(pixels);
+    bool lossless = true;
+    frame = 0;
+    const BenchTiming decode_timing = TimeIterations(iterations, [&] {
+      const std::size_t f = static_cast<std::size_t>(frame);
+      lossless = decoder.decode(encoded[f].data(), encoded[f].size(), decoded.data(), pixels) &&
+                 decoded == sequence.frames[f] && lossless;
+      ++frame;
+    });
+    std::snprintf(label, sizeof(label), "decode, %s", temporal ? "temporal" : "key frames");
+    std::snprintf(detail, sizeof(detail), "%.0f fps%s", 1000.0 / decode_timing.mean_ms,
+                  lossless ? "" : ", MISMATCH");
+    PrintBenchLine(label, decode_timing, detail);
+    ok = ok && lossless;
+  }
+  return ok;
+}
+
+}  // namespace
+
+bool BenchDepthCodec(const BenchOptions &options) {
+  std::vector<DepthSequence> sequences;
+  if (!options.input.empty()) {
+    DepthSequence sequence;
+    if (!LoadInput(options.input, &sequence)) {
+      std::cerr << "  no depth frames in " << options.input << "\n";
+      return false;
+    }
+    sequences.push_back(std::move(sequence));
+  } else {
+    sequences.push_back(SyntheticSequence(KinectGeneration::kV1, 1.0f));
+    sequences.push_back(SyntheticSequence(KinectGeneration::kV2, 1.0f));
+    sequences.push_back(SyntheticSequence(KinectGeneration::kV2, 0.0f));
+    for (DepthSequence &sequence : sequences) {
+      if (!RoundTripRecording(&sequence)) {
+        std::cerr << "  could not record and replay " << sequence.name << "\n";
+        return false;
+      }
+    }
+  }
+  bool ok = true;
+  for (const DepthSequence &sequence : sequences) {
+    ok = RunSequence(sequence, options) && ok;
+  }
+  return ok;
+}
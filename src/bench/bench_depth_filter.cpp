@@ -0,0 +1,258 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/depth_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int kSequenceFrames = 8;
+// The chain's budget at 512x424 on one core.
+constexpr double kBudgetMs = 3.0;
+
+// Cheap per-pixel hash in [0, 1) so dropouts and speckle are reproducible.
+float Hash01(std::uint32_t x, std::uint32_t y, std::uint32_t frame) {
+  std::uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u ^ frame * 0xcb1ab31fu;
+  h ^= h >> 13;
+  h *= 0x5bd1e995u;
+  h ^= h >> 15;
+  return static_cast<float>(h & 0xFFFFFFu) / 16777216.0f;
+}
+
+// Adds what the sensor adds on top of axial noise: missing returns and
+// isolated wild pixels.
+void AddDropoutsAndSpeckle(int width, int height, std::uint32_t frame, std::vector<std::uint16_t> *depth) {
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      const float r = Hash01(static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y), frame);
+      std::uint16_t &d = (*depth)[static_cast<std::size_t>(y) * width + x];
+      if (r < 0.02f) {
+        d = 0;
+      } else if (r < 0.025f && d != 0) {
+        d = static_cast<std::uint16_t>(500 + r * 100000.0f);
+      }
+    }
+  }
+}
+
+// Plain per-pixel versions of the median and spatial stages, the way they
+// would be written without processing/simd.h, to time the four-lane kernels
+// against and to check they produce the same depth.
+void ReferenceMedian(const std::vector<float> &in, int width, int height, std::vector<float> *out) {
+  *out = in;
+  for (int y = 1; y < height - 1; ++y) {
+    for (int x = 1; x < width - 1; ++x) {
+      float values[9];
+      int n = 0;
+      for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+          values[n++] = in[static_cast<std::size_t>(y + dy) * width + x + dx];
+        }
+      }
+      std::nth_element(values, values + 4, values + 9);
+      (*out)[static_cast<std::size_t>(y) * width + x] = values[4];
+    }
+  }
+}
+
+float ReferenceStep(float cur, float prev, float alpha, float delta) {
+  return cur > 0.0f && prev > 0.0f && std::fabs(cur - prev) < delta ? prev + alpha * (cur - prev) : cur;
+}
+
+void ReferenceSpatial(std::vector<float> *plane, int width, int height, float alpha, float delta) {
+  float *data = plane->data();
+  for (int y = 0; y < height; ++y) {
+    float *row = data + static_cast<std::size_t>(y) * width;
+    for (int x = 1; x < width; ++x) {
+      row[x] = ReferenceStep(row[x], row[x - 1], alpha, delta);
+    }
+    for (int x = width - 2; x >= 0; --x) {
+      row[x] = ReferenceStep(row[x], row[x + 1], alpha, delta);
+    }
+  }
+  for (int y = 1; y < height; ++y) {
+    float *row = data + static_cast<std::size_t>(y) * width;
+    for (int x = 0; x < width; ++x) {
+      row[x] = ReferenceStep(row[x], row[x - width], alpha, delta);
+    }
+  }
+  for (int y = height - 2; y >= 0; --y) {
+    float *row = data + static_cast<std::size_t>(y) * width;
+    for (int x = 0; x < width; ++x) {
+      row[x] = ReferenceStep(row[x], row[x + width], alpha, delta);
+    }
+  }
+}
+
+struct Quality {
+  double rms_mm = 0.0;
+  double missing = 0.0;
+};
+
+// Error against the noiseless render, over pixels the truth has a return for.
+Quality Measure(const std::vector<std::uint16_t> &truth, const std::vector<std::uint16_t> &depth) {
+  double sum = 0.0;
+  std::size_t compared = 0;
+  std::size_t missing = 0;
+  std::size_t valid = 0;
+  for (std::size_t i = 0; i < truth.size(); ++i) {
+    if (truth[i] == 0) {
+      continue;
+    }
+    ++valid;
+    if (depth[i] == 0) {
+      ++missing;
+      continue;
+    }
+    const double e = static_cast<double>(depth[i]) - truth[i];
+    sum += e * e;
+    ++compared;
+  }
+  Quality quality;
+  quality.rms_mm = compared > 0 ? std::sqrt(sum / static_cast<double>(compared)) : 0.0;
+  quality.missing = valid > 0 ? static_cast<double>(missing) / static_cast<double>(valid) : 0.0;
+  return quality;
+}
+
+bool RunResolution(KinectGeneration generation, const BenchOptions &options) {
+  const SyntheticCamera camera = SyntheticDepthCamera(generation);
+  const std::size_t pixels = static_cast<std::size_t>(camera.width) * camera.height;
+
+  SyntheticScene exact;
+  std::vector<std::uint16_t> truth(pixels);
+  exact.renderDepth(camera, 0.5, SyntheticPose{}, 0, truth.data());
+
+  // A static scene keeps the truth valid for every frame, so the temporal
+  // stage is measured at its best case; motion is covered by its delta test.
+  SyntheticScene noisy;
+  noisy.setDepthNoise(1.0f);
+  std::vector<std::vector<std::uint16_t>> frames(kSequenceFrames, std::vector<std::uint16_t>(pixels));
+  for (int f = 0; f < kSequenceFrames; ++f) {
+    noisy.renderDepth(camera, 0.5, SyntheticPose{}, static_cast<std::uint64_t>(f), frames[f].data());
+    AddDropoutsAndSpeckle(camera.width, camera.height, static_cast<std::uint32_t>(f), &frames[f]);
+  }
+
+  const int iterations = options.iterations > 0 ? options.iterations : 200;
+  std::vector<std::uint16_t> work(pixels);
+  auto time_chain = [&](const DepthFilterOptions &filter_options) {
+    DepthFilterChain chain;
+    chain.setOptions(filter_options);
+    int frame = 0;
+    return TimeIterations(iterations, [&] {
+      work = frames[frame++ % kSequenceFrames];
+      chain.apply(work.data(), camera.width, camera.height);
+    });
+  };
+
+  DepthFilterOptions single;
+  single.enabled = true;
+  single.threads = 1;
+  single.median = single.spatial = single.temporal = single.hole_fill = false;
+  std::cout << " " << camera.width << "x" << camera.height << " depth\n";
+  const BenchTiming copy_only = time_chain(single);
+  PrintBenchLine("frame copy (included below)", copy_only);
+  const char *labels[kDepthFilterStageCount] = {"median 3x3 (4-lane)", "spatial domain transform (4-lane)",
+                                                "temporal + persistence (4-lane)", "hole fill"};
+  DepthFilterOptions stage_options[kDepthFilterStageCount];
+  for (std::size_t stage = 0; stage < kDepthFilterStageCount; ++stage) {
+    DepthFilterOptions &one = stage_options[stage];
+    one = single;
+    one.median = stage == static_cast<std::size_t>(DepthFilterStage::kMedian);
+    one.spatial = stage == static_cast<std::size_t>(DepthFilterStage::kSpatial);
+    one.temporal = stage == static_cast<std::size_t>(DepthFilterStage::kTemporal);
+    one.hole_fill = stage == static_cast<std::size_t>(DepthFilterStage::kHoleFill);
+    PrintBenchLine(labels[stage], time_chain(one));
+  }
+
+  // The same conversions around each reference stage as around the chain's,
+  // so the lines compare directly.
+  std::vector<float> plane(pixels);
+  std::vector<float> scratch(pixels);
+  auto run_reference = [&](DepthFilterStage stage, const std::vector<std::uint16_t> &frame) {
+    for (std::size_t i = 0; i < pixels; ++i) {
+      plane[i] = static_cast<float>(frame[i]);
+    }
+    if (stage == DepthFilterStage::kMedian) {
+      ReferenceMedian(plane, camera.width, camera.height, &scratch);
+      plane.swap(scratch);
+    } else {
+      ReferenceSpatial(&plane, camera.width, camera.height, single.spatial_alpha, single.spatial_delta_mm);
+    }
+    for (std::size_t i = 0; i < pixels; ++i) {
+      work[i] = static_cast<std::uint16_t>(std::min(65535.0f, plane[i] + 0.5f));
+    }
+  };
+  bool matches = true;
+  for (DepthFilterStage stage : {DepthFilterStage::kMedian, DepthFilterStage::kSpatial}) {
+    int frame = 0;
+    const BenchTiming reference =
+        TimeIterations(iterations, [&] { run_reference(stage, frames[frame++ % kSequenceFrames]); });
+    const std::vector<std::uint16_t> expected = work;
+    DepthFilterChain chain;
+    chain.setOptions(stage_options[static_cast<std::size_t>(stage)]);
+    work = frames[(frame - 1) % kSequenceFrames];
+    chain.apply(work.data(), camera.width, camera.height);
+    int max_diff = 0;
+    for (std::size_t i = 0; i < pixels; ++i) {
+      max_diff = std::max(max_diff, std::abs(static_cast<int>(work[i]) - static_cast<int>(expected[i])));
+    }
+    // Fused multiply-add on some targets may round the spatial blend apart.
+    matches = matches && max_diff <= 1;
+    char detail[64];
+    std::snprintf(detail, sizeof(detail), "max diff vs 4-lane %d mm", max_diff);
+    PrintBenchLine(std::string(DepthFilterStageLabel(stage)) + ", scalar reference", reference, detail);
+  }
+  if (!matches) {
+    std::cerr << "  four-lane stages differ from the scalar reference\n";
+    return false;
+  }
+
+  DepthFilterOptions full;
+  full.enabled = true;
+  full.threads = 1;
+  const BenchTiming one_thread = time_chain(full);
+  char budget[64];
+  std::snprintf(budget, sizeof(budget), "budget %.1f ms", kBudgetMs);
+  PrintBenchLine("full chain, 1 thread", one_thread, budget);
+  const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+  if (hardware > 1) {
+    full.threads = 0;
+    char threads[32];
+    std::snprintf(threads, sizeof(threads), "%d threads", hardware);
+    PrintBenchLine("full chain, thread pool", time_chain(full), threads);
+  }
+
+  // Quality after the chain has seen the whole sequence.
+  full.threads = 1;
+  DepthFilterChain chain;
+  chain.setOptions(full);
+  for (int f = 0; f < kSequenceFrames; ++f) {
+    work = frames[f];
+    chain.apply(work.data(), camera.width, camera.height);
+  }
+  const Quality before = Measure(truth, frames[kSequenceFrames - 1]);
+  const Quality after = Measure(truth, work);
+  char summary[160];
+  std::snprintf(summary, sizeof(summary), "  rms error %.1f -> %.1f mm, missing %.2f%% -> %.2f%%\n", before.rms_mm,
+                after.rms_mm, before.missing * 100.0, after.missing * 100.0);
+  std::cout << summary;
+  if (after.rms_mm >= before.rms_mm || after.missing >= before.missing) {
+    std::cerr << "  depth filter did not reduce error or holes\n";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool BenchDepthFilter(const BenchOptions &options) {
+  const bool v2 = RunResolution(KinectGeneration::kV2, options);
+  const bool v1 = RunResolution(KinectGeneration::kV1, options);
+  return v2 && v1;
+}
@@ -0,0 +1,132 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/depth_pyramid.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+// What a consumer does without the pyramid: one 2x2 reduction per level from
+// the full-resolution plane, scalar, with the same valid-only rules.
+std::vector<std::uint16_t> ReferenceMinLevel(const std::vector<std::uint16_t> &depth, int width, int height,
+                                             int level, int *out_width, int *out_height) {
+  const int step = 1 << level;
+  const int w = (width + step - 1) / step;
+  const int h = (height + step - 1) / step;
+  std::vector<std::uint16_t> out(static_cast<std::size_t>(w) * h, 0);
+  for (int y = 0; y < h; ++y) {
+    for (int x = 0; x < w; ++x) {
+      std::uint16_t low = 0xFFFF;
+      for (int v = y * step; v < std::min(height, (y + 1) * step); ++v) {
+        for (int u = x * step; u < std::min(width, (x + 1) * step); ++u) {
+          const std::uint16_t d = depth[static_cast<std::size_t>(v) * width + u];
+          if (d != 0) {
+            low = std::min(low, d);
+          }
+        }
+      }
+      out[static_cast<std::size_t>(y) * w + x] = low == 0xFFFF ? 0 : low;
+    }
+  }
+  *out_width = w;
+  *out_height = h;
+  return out;
+}
+
+bool RunResolution(KinectGeneration generation, const BenchOptions &options) {
+  const SyntheticCamera camera = SyntheticDepthCamera(generation);
+  const std::size_t pixels = static_cast<std::size_t>(camera.width) * camera.height;
+  SyntheticScene scene;
+  scene.setDepthNoise(1.0f);
+  std::vector<std::uint16_t> depth(pixels);
+  scene.renderDepth(camera, 0.5, SyntheticPose{}, 0, depth.data());
+
+  const int iterations = options.iterations > 0 ? options.iterations : 500;
+  const int slow_iterations = options.iterations > 0 ? options.iterations : 50;
+
+  DepthPyramid pyramid;
+  const BenchTiming build = TimeIterations(iterations, [&] { pyramid.build(depth.data(), camera.width, camera.height); });
+
+  DepthPyramidBuilder builder;
+  std::shared_ptr<const DepthPyramid> held;
+  const BenchTiming pooled = TimeIterations(iterations, [&] {
+    held = builder.build(depth.data(), camera.width, camera.height);
+  });
+
+  // A consumer that wants the min at 1/4 scale scans the full plane.
+  const int coarse = std::min(2, pyramid.levels() - 1);
+  int ref_w = 0;
+  int ref_h = 0;
+  std::vector<std::uint16_t> reference;
+  const BenchTiming rederive = TimeIterations(slow_iterations, [&] {
+    reference = ReferenceMinLevel(depth, camera.width, camera.height, coarse, &ref_w, &ref_h);
+  });
+
+  // Region statistics: the pyramid's bound vs. scanning the pixels.
+  const int x0 = camera.width / 4;
+  const int y0 = camera.height / 4;
+  const int x1 = camera.width * 3 / 4;
+  const int y1 = camera.height * 3 / 4;
+  DepthRange bound;
+  const BenchTiming query = TimeIterations(iterations, [&] { bound = pyramid.range(x0, y0, x1, y1); });
+  std::uint16_t exact_min = 0xFFFF;
+  std::uint16_t exact_max = 0;
+  const BenchTiming scan = TimeIterations(slow_iterations, [&] {
+    exact_min = 0xFFFF;
+    exact_max = 0;
+    for (int y = y0; y < y1; ++y) {
+      for (int x = x0; x < x1; ++x) {
+        const std::uint16_t d = depth[static_cast<std::size_t>(y) * camera.width + x];
+        if (d != 0) {
+          exact_min = std::min(exact_min, d);
+          exact_max = std::max(exact_max, d);
+        }
+      }
+    }
+  });
+
+  const DepthPyramidLevel &level = pyramid.level(coarse);
+  bool ok = level.width() == ref_w && level.height() == ref_h &&
+            std::equal(reference.begin(), reference.end(), level.min());
+  for (int y = 0; ok && y < level.height(); ++y) {
+    for (int x = 0; x < level.width(); ++x) {
+      if (level.valid(x, y) != (level.min()[static_cast<std::size_t>(y) * level.width() + x] != 0)) {
+        ok = false;
+        break;
+      }
+    }
+  }
+  if (!ok) {
+    std::cerr << "  pyramid level " << coarse << " min/validity differs from the per-pixel reference\n";
+  }
+  if (!bound.any_valid || bound.min_mm > exact_min || bound.max_mm < exact_max) {
+    std::cerr << "  range bound [" << bound.min_mm << ", " << bound.max_mm << "] does not contain [" << exact_min
+              << ", " << exact_max << "]\n";
+    ok = false;
+  }
+
+  char levels[64];
+  std::snprintf(levels, sizeof(levels), "%d levels down to %dx%d", pyramid.levels(),
+                pyramid.level(pyramid.levels() - 1).width(), pyramid.level(pyramid.levels() - 1).height());
+  char bounds[64];
+  std::snprintf(bounds, sizeof(bounds), "[%u, %u] vs exact [%u, %u]", bound.min_mm, bound.max_mm, exact_min,
+                exact_max);
+  std::cout << " " << camera.width << "x" << camera.height << " depth\n";
+  PrintBenchLine("build (simd 2x2 mean/min/max/mask)", build, levels);
+  PrintBenchLine("build through pooled builder", pooled);
+  PrintBenchLine("re-derive one min level (scalar)", rederive);
+  PrintBenchLine("range query (pyramid bound)", query, bounds);
+  PrintBenchLine("range scan (full-res pixels)", scan);
+  return ok;
+}
+
+}  // namespace
+
+bool BenchDepthPyramid(const BenchOptions &options) {
+  const bool v2 = RunResolution(KinectGeneration::kV2, options);
+  const bool v1 = RunResolution(KinectGeneration::kV1, options);
+  return v2 && v1;
+}
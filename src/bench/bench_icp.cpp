@@ -0,0 +1,155 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/icp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int kFrames = 90;
+constexpr double kFrameRate = 30.0;
+constexpr double kBudgetMs = 1000.0 / kFrameRate;
+constexpr double kPi = 3.14159265358979;
+// Accuracy a handheld scan needs to fuse cleanly.
+constexpr double kMaxTranslationRmsMm = 15.0;
+constexpr double kMaxRotationDeg = 1.5;
+
+// A slow handheld sweep: sideways and forward with some bob and yaw, up to
+// about 20 mm and 1 degree between frames.
+SyntheticPose PoseAt(int frame) {
+  const double t = frame / kFrameRate;
+  const double phase = 2.0 * kPi * t / 3.0;
+  SyntheticPose pose;
+  pose.tx = static_cast<float>(200.0 * std::sin(phase));
+  pose.ty = static_cast<float>(-40.0 * std::sin(2.0 * phase));
+  pose.tz = static_cast<float>(250.0 * (1.0 - std::cos(phase)));
+  pose.yaw = static_cast<float>(0.2 * std::sin(phase));
+  return pose;
+}
+
+// Camera to scene in metres, as renderDepth places the camera.
+RigidTransform SceneFromCamera(const SyntheticPose &pose) {
+  RigidTransform transform;
+  const float c = std::cos(pose.yaw);
+  const float s = std::sin(pose.yaw);
+  const float r[9] = {c, 0.0f, s, 0.0f, 1.0f, 0.0f, -s, 0.0f, c};
+  std::copy(r, r + 9, transform.r);
+  transform.t[0] = pose.tx * 0.001f;
+  transform.t[1] = pose.ty * 0.001f;
+  transform.t[2] = pose.tz * 0.001f;
+  return transform;
+}
+
+struct TrajectoryError {
+  double translation_rms_mm = 0.0;
+  double final_drift_mm = 0.0;
+  double max_rotation_deg = 0.0;
+  int lost = 0;
+  double iterations = 0.0;
+};
+
+struct Sequence {
+  SyntheticCamera camera;
+  std::vector<std::vector<std::uint16_t>> depth;
+  std::vector<RigidTransform> truth;
+};
+
+Sequence RenderSequence(KinectGeneration generation) {
+  Sequence sequence;
+  sequence.camera = SyntheticDepthCamera(generation);
+  const std::size_t pixels = static_cast<std::size_t>(sequence.camera.width) * sequence.camera.height;
+  // The objects stand still so the whole scene is ground truth.
+  SyntheticScene scene;
+  scene.setDepthNoise(1.0f);
+  const RigidTransform origin = InverseTransform(SceneFromCamera(PoseAt(0)));
+  for (int f = 0; f < kFrames; ++f) {
+    sequence.depth.emplace_back(pixels);
+    scene.renderDepth(sequence.camera, 0.0, PoseAt(f), static_cast<std::uint64_t>(f), sequence.depth.back().data());
+    sequence.truth.push_back(ComposeTransforms(origin, SceneFromCamera(PoseAt(f))));
+  }
+  return sequence;
+}
+
+TrajectoryError Track(const Sequence &sequence, IcpOdometry *odometry) {
+  TrajectoryError error;
+  odometry->reset();
+  double sum_sq = 0.0;
+  for (int f = 0; f < kFrames; ++f) {
+    const IcpResult result = odometry->track(sequence.depth[static_cast<std::size_t>(f)].data(), sequence.camera);
+    error.lost += result.tracked ? 0 : 1;
+    error.iterations += result.iterations;
+    const RigidTransform &truth = sequence.truth[static_cast<std::size_t>(f)];
+    const RigidTransform &pose = odometry->pose();
+    double distance_sq = 0.0;
+    for (int axis = 0; axis < 3; ++axis) {
+      const double d = (pose.t[axis] - truth.t[axis]) * 1000.0;
+      distance_sq += d * d;
+    }
+    sum_sq += distance_sq;
+    error.final_drift_mm = std::sqrt(distance_sq);
+    const double rotation = RotationAngle(ComposeTransforms(InverseTransform(truth), pose)) * 180.0 / kPi;
+    error.max_rotation_deg = std::max(error.max_rotation_deg, rotation);
+  }
+  error.translation_rms_mm = std::sqrt(sum_sq / kFrames);
+  error.iterations /= kFrames - 1;
+  return error;
+}
+
+}  // namespace
+
+bool BenchIcp(const BenchOptions &options) {
+  const int iterations = options.iterations > 0 ? options.iterations : 3;
+  const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+  bool ok = true;
+
+  for (KinectGeneration generation : {KinectGeneration::kV1, KinectGeneration::kV2}) {
+    const Sequence sequence = RenderSequence(generation);
+    std::cout << " " << sequence.camera.width << "x" << sequence.camera.height << ", " << kFrames
+              << "-frame handheld sweep\n";
+
+    // Half resolution (the default) on one thread and on the pool, then the
+    // full-resolution variant for comparison.
+    struct Variant {
+      int finest_level;
+      int threads;
+    };
+    std::vector<Variant> variants = {{1, 1}};
+    if (hardware > 1) {
+      variants.push_back({1, 0});
+    }
+    variants.push_back({0, 1});
+    for (const Variant &variant : variants) {
+      IcpOptions icp_options;
+      icp_options.finest_level = variant.finest_level;
+      icp_options.threads = variant.threads;
+      IcpOdometry odometry;
+      odometry.setOptions(icp_options);
+      TrajectoryError error;
+      const BenchTiming timing = TimeIterations(iterations, [&] { error = Track(sequence, &odometry); });
+      BenchTiming per_frame = timing;
+      per_frame.mean_ms /= kFrames;
+      per_frame.min_ms /= kFrames;
+      per_frame.p50_ms /= kFrames;
+      char label[64];
+      std::snprintf(label, sizeof(label), "icp levels %d..%d, %s", icp_options.levels - 1, variant.finest_level,
+                    variant.threads == 1 ? "1 thread" : "thread pool");
+      char detail[128];
+      std::snprintf(detail, sizeof(detail), "%s budget, %.1f iters, ATE %.1f mm, drift %.1f mm, rot %.2f deg",
+                    per_frame.mean_ms <= kBudgetMs ? "within" : "over", error.iterations,
+                    error.translation_rms_mm, error.final_drift_mm, error.max_rotation_deg);
+      PrintBenchLine(label, per_frame, detail);
+      if (error.lost > 0 || error.translation_rms_mm > kMaxTranslationRmsMm ||
+          error.max_rotation_deg > kMaxRotationDeg) {
+        std::cerr << "  icp lost " << error.lost << " frames, ATE " << error.translation_rms_mm << " mm, rotation "
+                  << error.max_rotation_deg << " deg\n";
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,249 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "core/jpeg_decoder.h"
+#include "core/jpeg_encoder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#if KINECT_HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+namespace {
+
+constexpr int kFrames = 10;
+constexpr double kFrameRate = 30.0;
+// Kinect v2 color as the camera sends it.
+constexpr int kDeviceQuality = 90;
+// The DAL camera's output.
+constexpr int kPreviewWidth = 640;
+constexpr int kPreviewHeight = 480;
+
+struct ColorFrame {
+  std::vector<std::uint8_t> rgb;
+  std::vector<std::uint8_t> bgra;
+};
+
+// Decodes |jpeg| to RGB24; empty on failure.
+std::vector<std::uint8_t> DecodeRgb(const std::vector<std::uint8_t> &jpeg, int width, int height) {
+  std::vector<std::uint8_t> rgb;
+#if KINECT_HAVE_TURBOJPEG
+  tjhandle handle = tjInitDecompress();
+  if (handle == nullptr) {
+    return rgb;
+  }
+  rgb.resize(static_cast<std::size_t>(width) * height * 3);
+  if (tjDecompress2(handle, jpeg.data(), static_cast<unsigned long>(jpeg.size()), rgb.data(), width, 0, height,
+                    TJPF_RGB, 0) != 0) {
+    rgb.clear();
+  }
+  tjDestroy(handle);
+#else
+  (void)jpeg;
+  (void)width;
+  (void)height;
+#endif
+  return rgb;
+}
+
+// Nearest-neighbour RGB24 to BGRA at preview size, as the DAL camera fills
+// its buffers.
+void ScaleToPreview(const std::vector<std::uint8_t> &rgb, int width, int height, std::vector<std::uint8_t> *bgra) {
+  bgra->resize(static_cast<std::size_t>(kPreviewWidth) * kPreviewHeight * 4);
+  for (int y = 0; y < kPreviewHeight; ++y) {
+    const int sy = y * height / kPreviewHeight;
+    std::uint8_t *row = bgra->data() + static_cast<std::size_t>(y) * kPreviewWidth * 4;
+    for (int x = 0; x < kPreviewWidth; ++x) {
+      const std::size_t si = (static_cast<std::size_t>(sy) * width + static_cast<std::size_t>(x * width / kPreviewWidth)) * 3;
+      row[x * 4 + 0] = rgb[si + 2];
+      row[x * 4 + 1] = rgb[si + 1];
+      row[x * 4 + 2] = rgb[si + 0];
+      row[x * 4 + 3] = 255;
+    }
+  }
+}
+
+// What each color capture mode costs a consumer per device frame, from the
+// JPEG to the plane it is handed (and on to a 640x480 preview).
+bool BenchCaptureModes(const std::vector<ColorFrame> &frames, int width, int height, int iterations) {
+  JpegEncoderOptions device_options;
+  device_options.quality = kDeviceQuality;
+  device_options.subsampling = JpegSubsampling::k422;
+  device_options.slices = 1;
+  device_options.threads = 1;
+  JpegEncoder device;
+  device.setOptions(device_options);
+  std::vector<std::vector<std::uint8_t>> jpegs(frames.size());
+  std::size_t jpeg_bytes = 0;
+  for (std::size_t f = 0; f < frames.size(); ++f) {
+    if (!device.encode(frames[f].rgb.data(), width, height, static_cast<std::size_t>(width) * 3,
+                       JpegPixelFormat::kRgb, &jpegs[f])) {
+      std::cerr << "  " << device.error() << "\n";
+      return false;
+    }
+    jpeg_bytes += jpegs[f].size();
+  }
+  std::cout << " capture modes on " << width << "x" << height << " synthetic 4:2:2 JPEG, "
+            << jpeg_bytes / frames.size() / 1024 << " KiB/frame (not the device's own bitstream)\n";
+
+  const std::size_t pixels = static_cast<std::size_t>(width) * height;
+  JpegDecoder decoder;
+  std::vector<std::uint8_t> bgra;
+  std::vector<std::uint8_t> rgb;
+  std::vector<std::uint8_t> preview;
+  int decoded_width = 0;
+  int decoded_height = 0;
+  bool ok = true;
+  double full_ms = 0.0;
+  for (int scale : {1, 2, 4, 0}) {
+    for (bool to_preview : {false, true}) {
+      if (scale == 0 && to_preview) {
+        continue;
+      }
+      int frame = 0;
+      const BenchTiming timing = TimeIterations(iterations, [&] {
+        const std::vector<std::uint8_t> &jpeg = jpegs[static_cast<std::size_t>(frame % kFrames)];
+        ++frame;
+        if (scale == 0) {
+          rgb.assign(jpeg.begin(), jpeg.end());
+          return;
+        }
+        if (scale == 1) {
+          // libfreenect2 decodes to BGRX and the backend converts to RGB.
+          ok = decoder.decode(jpeg.data(), jpeg.size(), 1, JpegPixelFormat::kBgra, &bgra, &decoded_width,
+                              &decoded_height) &&
+               ok;
+          rgb.resize(pixels * 3);
+          for (std::size_t i = 0; i < pixels; ++i) {
+            rgb[i * 3 + 0] = bgra[i * 4 + 2];
+            rgb[i * 3 + 1] = bgra[i * 4 + 1];
+            rgb[i * 3 + 2] = bgra[i * 4 + 0];
+          }
+        } else {
+          ok = decoder.decode(jpeg.data(), jpeg.size(), scale, JpegPixelFormat::kRgb, &rgb, &decoded_width,
+                              &decoded_height) &&
+               ok;
+        }
+        if (to_preview) {
+          ScaleToPreview(rgb, decoded_width, decoded_height, &preview);
+        }
+      });
+      const char *mode = scale == 0 ? "jpeg (pass through)" : scale == 1 ? "decoded" : scale == 2 ? "half" : "quarter";
+      char label[64];
+      std::snprintf(label, sizeof(label), "%s%s", mode, to_preview ? " + 640x480" : "");
+      char detail[96] = "";
+      if (scale == 1) {
+        if (!to_preview) {
+          full_ms = timing.mean_ms;
+        }
+      } else if (!to_preview) {
+        std::snprintf(detail, sizeof(detail), "%.0f%% less CPU than decoded", 100.0 * (1.0 - timing.mean_ms / full_ms));
+      }
+      PrintBenchLine(label, timing, detail);
+    }
+  }
+  if (!ok) {
+    std::cerr << "  " << decoder.error() << "\n";
+  }
+  return ok;
+}
+
+}  // namespace
+
+bool BenchJpeg(const BenchOptions &options) {
+  if (!JpegEncoderAvailable()) {
+    std::cout << "  built without TurboJPEG; skipped\n";
+    return true;
+  }
+  const int iterations = options.iterations > 0 ? std::min(options.iterations, kFrames - 1) : kFrames - 1;
+  const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+
+  const SyntheticCamera camera = SyntheticColorCamera(KinectGeneration::kV2);
+  const std::size_t pixels = static_cast<std::size_t>(camera.width) * camera.height;
+  SyntheticScene scene;
+  std::vector<ColorFrame> frames(kFrames);
+  for (int f = 0; f < kFrames; ++f) {
+    ColorFrame &frame = frames[static_cast<std::size_t>(f)];
+    frame.rgb.resize(pixels * 3);
+    scene.renderColor(camera, f / kFrameRate, frame.rgb.data());
+    frame.bgra.resize(pixels * 4);
+    for (std::size_t i = 0; i < pixels; ++i) {
+      frame.bgra[i * 4 + 0] = frame.rgb[i * 3 + 2];
+      frame.bgra[i * 4 + 1] = frame.rgb[i * 3 + 1];
+      frame.bgra[i * 4 + 2] = frame.rgb[i * 3 + 0];
+      frame.bgra[i * 4 + 3] = 255;
+    }
+  }
+  std::cout << " " << camera.width << "x" << camera.height << " color, quality " << JpegEncoderOptions().quality
+            << ", 4:2:0\n";
+
+  struct Case {
+    const char *label;
+    JpegPixelFormat format;
+    int slices;
+    int threads;
+  };
+  std::vector<Case> cases = {
+      {"RGB, 1 slice", JpegPixelFormat::kRgb, 1, 1},
+      {"BGRA, 1 slice", JpegPixelFormat::kBgra, 1, 1},
+      {"BGRA, 4 slices, 1 thread", JpegPixelFormat::kBgra, 4, 1},
+  };
+  if (hardware > 1) {
+    cases.push_back({"BGRA, sliced, thread pool", JpegPixelFormat::kBgra, 0, 0});
+  }
+
+  bool ok = true;
+  std::vector<std::uint8_t> reference;
+  for (const Case &c : cases) {
+    JpegEncoderOptions encoder_options;
+    encoder_options.slices = c.slices;
+    encoder_options.threads = c.threads;
+    JpegEncoder encoder;
+    encoder.setOptions(encoder_options);
+    const bool rgb = c.format == JpegPixelFormat::kRgb;
+    const std::size_t stride = static_cast<std::size_t>(camera.width) * (rgb ? 3 : 4);
+    std::vector<std::uint8_t> jpeg;
+    std::size_t encoded_bytes = 0;
+    int encoded = 0;
+    bool encoded_ok = true;
+    int frame = 0;
+    const BenchTiming timing = TimeIterations(iterations, [&] {
+      const ColorFrame &source = frames[static_cast<std::size_t>(frame % kFrames)];
+      encoded_ok = encoder.encode(rgb ? source.rgb.data() : source.bgra.data(), camera.width, camera.height, stride,
+                                  c.format, &jpeg) &&
+                   encoded_ok;
+      encoded_bytes += jpeg.size();
+      ++encoded;
+      ++frame;
+    });
+    if (!encoded_ok) {
+      std::cerr << "  " << c.label << ": " << encoder.error() << "\n";
+      ok = false;
+      continue;
+    }
+    char detail[128];
+    std::snprintf(detail, sizeof(detail), "%.0f fps, %.0f KiB/frame, %.1f:1 vs RGB24, %d slice%s",
+                  1000.0 / timing.mean_ms, static_cast<double>(encoded_bytes) / encoded / 1024.0,
+                  static_cast<double>(pixels * 3 * static_cast<std::size_t>(encoded)) / encoded_bytes,
+                  encoder.lastSlices(), encoder.lastSlices() == 1 ? "" : "s");
+    PrintBenchLine(c.label, timing, detail);
+
+    // The last frame, decoded: every case codes the same coefficients, so
+    // splicing must not change a pixel.
+    const std::vector<std::uint8_t> decoded = DecodeRgb(jpeg, camera.width, camera.height);
+    if (decoded.empty()) {
+      std::cout << "  " << c.label << ": output does not decode\n";
+      ok = false;
+    } else if (reference.empty()) {
+      reference = decoded;
+    } else if (decoded != reference) {
+      std::cout << "  " << c.label << ": decodes differently from the single slice\n";
+      ok = false;
+    }
+  }
+  return BenchCaptureModes(frames, camera.width, camera.height, iterations) && ok;
+}
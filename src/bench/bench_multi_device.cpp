@@ -0,0 +1,205 @@
+#include "backends/capture_session.h"
+#include "backends/synthetic_backend.h"
+#include "bench/bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr double kFrameRate = 30.0;
+constexpr auto kCaptureTime = std::chrono::seconds(5);
+// Every device delivers +/- 2 ms off its deadline, loses 1% of its frames
+// and counts on a clock up to 100 ppm off nominal from its own origin.
+constexpr double kJitterMs = 2.0;
+constexpr double kDropRate = 0.01;
+constexpr double kSkewPpm = 100.0;
+// Above this share of every core, the capture threads (which render the
+// synthetic frames) are what limits the session.
+constexpr double kSaturatedLoad = 0.9;
+// Frames per device pushed straight into an aggregator.
+constexpr int kAggregatorFrames = 3000;
+
+double Percentile(std::vector<double> values, double fraction) {
+  if (values.empty()) {
+    return 0.0;
+  }
+  std::sort(values.begin(), values.end());
+  const std::size_t index = static_cast<std::size_t>(fraction * static_cast<double>(values.size() - 1));
+  return values[index];
+}
+
+struct SessionResult {
+  BenchTiming set_interval;
+  double sets_per_second = 0.0;
+  // Of the slowest device.
+  double device_fps = 0.0;
+  std::vector<double> spread_ms;
+  std::vector<double> arrival_spread_ms;
+  double worst_tick_error_ppm = 0.0;
+  // Process CPU time over wall time and cores.
+  double cpu_load = 0.0;
+  FrameAggregatorStats stats;
+};
+
+// Streams |devices| synthetic Kinect v1s through a CaptureSession and
+// collects every frame set it emits.
+bool RunSession(int devices, SessionResult *result) {
+  SyntheticConfig config;
+  config.device_count = devices;
+  config.fps = kFrameRate;
+  config.jitter_ms = kJitterMs;
+  config.drop_rate = kDropRate;
+  config.clock_skew_ppm = kSkewPpm;
+  config.audio = false;
+  std::unique_ptr<KinectBackend> backend = CreateSyntheticBackend(config);
+
+  CaptureSession session;
+  const std::vector<DeviceInfo> infos = backend->listDevices();
+  for (const DeviceInfo &info : infos) {
+    // No nominal tick: the mapping learns each clock as it would a v1's.
+    session.addDevice(backend->openDevice(info.serial), info.serial);
+  }
+  if (session.deviceCount() != devices || !session.start()) {
+    return false;
+  }
+
+  std::vector<double> intervals;
+  std::uint64_t previous_ns = 0;
+  const std::clock_t cpu_begin = std::clock();
+  const auto begin = std::chrono::steady_clock::now();
+  FrameSet set;
+  while (std::chrono::steady_clock::now() - begin < kCaptureTime) {
+    if (!session.nextFrameSet(&set, std::chrono::milliseconds(100))) {
+      continue;
+    }
+    const std::uint64_t now = TelemetryNowNs();
+    if (previous_ns != 0) {
+      intervals.push_back(static_cast<double>(now - previous_ns) * 1e-6);
+    }
+    previous_ns = now;
+    std::uint64_t first_arrival = set.frames.front().arrival_ns;
+    std::uint64_t last_arrival = first_arrival;
+    for (const CapturedFrame &frame : set.frames) {
+      first_arrival = std::min(first_arrival, frame.arrival_ns);
+      last_arrival = std::max(last_arrival, frame.arrival_ns);
+    }
+    result->spread_ms.push_back(static_cast<double>(set.spread_ns) * 1e-6);
+    result->arrival_spread_ms.push_back(static_cast<double>(last_arrival - first_arrival) * 1e-6);
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  const double cpu_seconds = static_cast<double>(std::clock() - cpu_begin) / CLOCKS_PER_SEC;
+  session.stop();
+  const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  result->cpu_load = cpu_seconds / (seconds * cores);
+
+  result->stats = session.aggregatorStats();
+  result->sets_per_second = static_cast<double>(result->spread_ms.size()) / seconds;
+  const std::vector<CaptureDeviceStats> device_stats = session.deviceStats();
+  result->device_fps = kFrameRate;
+  for (int i = 0; i < devices; ++i) {
+    const CaptureDeviceStats &stats = device_stats[static_cast<std::size_t>(i)];
+    result->device_fps = std::min(result->device_fps, static_cast<double>(stats.frames) / seconds);
+    const double truth = SyntheticDeviceTickNs(config, i);
+    result->worst_tick_error_ppm = std::max(result->worst_tick_error_ppm, std::abs(stats.tick_ns / truth - 1.0) * 1e6);
+  }
+  if (!intervals.empty()) {
+    double total = 0.0;
+    for (double interval : intervals) {
+      total += interval;
+    }
+    result->set_interval.iterations = static_cast<int>(intervals.size());
+    result->set_interval.mean_ms = total / static_cast<double>(intervals.size());
+    result->set_interval.min_ms = *std::min_element(intervals.begin(), intervals.end());
+    result->set_interval.p50_ms = Percentile(intervals, 0.5);
+  }
+  return true;
+}
+
+// Pushes frames straight into an aggregator, as |devices| capture threads
+// would at 30 fps with the session's jitter, to time matching on its own.
+void BenchAggregator(int devices, const char *label) {
+  FrameAggregator aggregator(devices, FrameAggregatorOptions());
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<double> jitter(-kJitterMs * 1e6, kJitterMs * 1e6);
+  const double period_ns = 1e9 / kFrameRate;
+  std::vector<CapturedFrame> frames;
+  frames.reserve(static_cast<std::size_t>(devices) * kAggregatorFrames);
+  for (int i = 0; i < kAggregatorFrames; ++i) {
+    for (int d = 0; d < devices; ++d) {
+      CapturedFrame frame;
+      frame.device = d;
+      frame.host_time_ns = static_cast<std::uint64_t>(1e9 + i * period_ns + jitter(rng));
+      frames.push_back(std::move(frame));
+    }
+  }
+  FrameSet set;
+  const auto begin = std::chrono::steady_clock::now();
+  for (CapturedFrame &frame : frames) {
+    aggregator.push(std::move(frame));
+  }
+  const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+  const FrameAggregatorStats stats = aggregator.stats();
+  const double ns_per_push = ns / static_cast<double>(frames.size());
+  std::printf("  %-40s %.0f ns/push (%.0f sets/s possible), %llu of %d sets, %llu unmatched\n", label, ns_per_push,
+              1e9 / (ns_per_push * devices), static_cast<unsigned long long>(stats.sets), kAggregatorFrames,
+              static_cast<unsigned long long>(stats.unmatched_frames));
+}
+
+}  // namespace
+
+bool BenchMultiDevice(const BenchOptions &) {
+  std::cout << " synthetic Kinect v1s at " << kFrameRate << " fps, jitter +/-" << kJitterMs << " ms, drop "
+            << kDropRate << ", clock skew +/-" << kSkewPpm << " ppm, "
+            << std::chrono::duration_cast<std::chrono::seconds>(kCaptureTime).count()
+            << " s each; timing is the interval between frame sets\n";
+
+  bool ok = true;
+  const FrameAggregatorOptions defaults;
+  for (int devices : {2, 4, 8}) {
+    char label[64];
+    std::snprintf(label, sizeof(label), "%d devices, matching alone", devices);
+    BenchAggregator(devices, label);
+    std::snprintf(label, sizeof(label), "%d devices", devices);
+    SessionResult result;
+    if (!RunSession(devices, &result)) {
+      std::cerr << "  " << label << ": session did not start\n";
+      ok = false;
+      continue;
+    }
+    // Not a failure: on a host with too few cores for the devices'
+    // rendering, frames arrive late and spread out, and sets fall apart.
+    const bool saturated = result.cpu_load > kSaturatedLoad;
+    if (result.spread_ms.empty()) {
+      std::cout << "  " << label << ": no frame sets, slowest device at " << result.device_fps << " fps, CPU "
+                << static_cast<int>(result.cpu_load * 100.0) << "%\n";
+      continue;
+    }
+    char detail[256];
+    std::snprintf(detail, sizeof(detail),
+                  "%.1f sets/s (devices >= %.1f fps), spread p50 %.2f / p99 %.2f ms (arrival %.2f / %.2f ms), "
+                  "tick fit within %.0f ppm, %llu unmatched, CPU %.0f%%",
+                  result.sets_per_second, result.device_fps, Percentile(result.spread_ms, 0.5),
+                  Percentile(result.spread_ms, 0.99), Percentile(result.arrival_spread_ms, 0.5), Percentile(result.arrival_spread_ms, 0.99),
+                  result.worst_tick_error_ppm, static_cast<unsigned long long>(result.stats.unmatched_frames),
+                  result.cpu_load * 100.0);
+    PrintBenchLine(label, result.set_interval, detail);
+    if (saturated) {
+      std::cout << "  " << label << ": capture threads saturate the host's " << std::thread::hardware_concurrency()
+                << " core(s); the set rate is limited by rendering, not by matching\n";
+    }
+    if (result.stats.max_spread_ms > defaults.tolerance_ms) {
+      std::cout << "  " << label << ": a set spans more than the tolerance\n";
+      ok = false;
+    }
+  }
+  return ok;
+}
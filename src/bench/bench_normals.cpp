@@ -0,0 +1,241 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/normals.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Camera rate for both sensors.
+constexpr double kBudgetMs = 1000.0 / 30.0;
+
+// Planes of the synthetic room, as seen from the identity pose (mm).
+constexpr float kFloorY = 900.0f;
+constexpr float kBackWallZ = 3500.0f;
+constexpr float kSideWallX = -1800.0f;
+constexpr float kOnPlaneMm = 2.0f;
+
+// Direct window sums per pixel, no integral image: what the estimator replaces.
+// Returns the covariance (xx xy xz yy yz zz) of the (2r + 1)^2 window.
+bool DirectCovariance(const OrganizedPointCloud &cloud, int u, int v, int r, double cov[6]) {
+  double sum[3] = {};
+  double n = 0.0;
+  const int x0 = std::max(0, u - r);
+  const int x1 = std::min(cloud.width, u + r + 1);
+  const int y0 = std::max(0, v - r);
+  const int y1 = std::min(cloud.height, v + r + 1);
+  for (int y = y0; y < y1; ++y) {
+    for (int x = x0; x < x1; ++x) {
+      const std::size_t i = static_cast<std::size_t>(y) * cloud.width + x;
+      if (cloud.z[i] > 0.0f) {
+        sum[0] += cloud.x[i];
+        sum[1] += cloud.y[i];
+        sum[2] += cloud.z[i];
+        n += 1.0;
+      }
+    }
+  }
+  if (n < 3.0) {
+    return false;
+  }
+  const double mean[3] = {sum[0] / n, sum[1] / n, sum[2] / n};
+  std::fill(cov, cov + 6, 0.0);
+  for (int y = y0; y < y1; ++y) {
+    for (int x = x0; x < x1; ++x) {
+      const std::size_t i = static_cast<std::size_t>(y) * cloud.width + x;
+      if (cloud.z[i] <= 0.0f) {
+        continue;
+      }
+      const double dx = cloud.x[i] - mean[0];
+      const double dy = cloud.y[i] - mean[1];
+      const double dz = cloud.z[i] - mean[2];
+      cov[0] += dx * dx;
+      cov[1] += dx * dy;
+      cov[2] += dx * dz;
+      cov[3] += dy * dy;
+      cov[4] += dy * dz;
+      cov[5] += dz * dz;
+    }
+  }
+  for (int k = 0; k < 6; ++k) {
+    cov[k] /= n;
+  }
+  return true;
+}
+
+// Every estimated normal must be the covariance's smallest eigenvector: its
+// Rayleigh quotient equals the reported smallest eigenvalue, which no axis
+// direction undercuts. Returns the worst relative error.
+double CheckAgainstDirect(const OrganizedPointCloud &cloud, const NormalMap &map, int r) {
+  double worst = 0.0;
+  for (int v = 0; v < cloud.height; v += 3) {
+    for (int u = 0; u < cloud.width; u += 3) {
+      const std::size_t i = static_cast<std::size_t>(v) * cloud.width + u;
+      double cov[6];
+      if (!map.valid(i) || !DirectCovariance(cloud, u, v, r, cov)) {
+        continue;
+      }
+      const double *c = cov;
+      const float *n = map.normals.data() + i * 3;
+      const double cn[3] = {c[0] * n[0] + c[1] * n[1] + c[2] * n[2], c[1] * n[0] + c[3] * n[1] + c[4] * n[2],
+                            c[2] * n[0] + c[4] * n[1] + c[5] * n[2]};
+      const double rayleigh = n[0] * cn[0] + n[1] * cn[1] + n[2] * cn[2];
+      const double trace = c[0] + c[3] + c[5];
+      const double smallest = map.curvature[i] * trace;
+      const double lowest_axis = std::min(c[0], std::min(c[3], c[5]));
+      const double error = std::max(std::fabs(rayleigh - smallest), std::max(0.0, smallest - lowest_axis)) / trace;
+      worst = std::max(worst, error);
+    }
+  }
+  return worst;
+}
+
+struct PlaneScore {
+  double aligned = 0.0;  // fraction of on-plane normals within ~11 degrees
+  double mean_error_deg = 0.0;
+  double coverage = 0.0;  // fraction of on-plane pixels that got a normal
+};
+
+// Scores normals on the room's floor and walls, which the noiseless render
+// identifies exactly.
+PlaneScore ScorePlanes(const OrganizedPointCloud &truth, const NormalMap &map) {
+  std::size_t on_plane = 0;
+  std::size_t estimated = 0;
+  std::size_t aligned = 0;
+  double error_sum = 0.0;
+  for (std::size_t i = 0; i < truth.size(); ++i) {
+    if (!truth.valid(i)) {
+      continue;
+    }
+    float expected[3] = {0.0f, 0.0f, 0.0f};
+    if (std::fabs(truth.y[i] - kFloorY) < kOnPlaneMm) {
+      expected[1] = -1.0f;
+    } else if (std::fabs(truth.z[i] - kBackWallZ) < kOnPlaneMm) {
+      expected[2] = -1.0f;
+    } else if (std::fabs(truth.x[i] - kSideWallX) < kOnPlaneMm) {
+      expected[0] = 1.0f;
+    } else {
+      continue;
+    }
+    ++on_plane;
+    if (!map.valid(i)) {
+      continue;
+    }
+    ++estimated;
+    const float *n = map.normals.data() + i * 3;
+    const float dot = n[0] * expected[0] + n[1] * expected[1] + n[2] * expected[2];
+    aligned += dot > 0.98f ? 1 : 0;
+    error_sum += std::acos(std::min(1.0f, std::max(-1.0f, dot))) * 57.29577951308232;
+  }
+  PlaneScore score;
+  if (estimated > 0) {
+    score.aligned = static_cast<double>(aligned) / static_cast<double>(estimated);
+    score.mean_error_deg = error_sum / static_cast<double>(estimated);
+  }
+  if (on_plane > 0) {
+    score.coverage = static_cast<double>(estimated) / static_cast<double>(on_plane);
+  }
+  return score;
+}
+
+bool RunResolution(KinectGeneration generation, const BenchOptions &options) {
+  const SyntheticCamera camera = SyntheticDepthCamera(generation);
+  const std::size_t pixels = static_cast<std::size_t>(camera.width) * camera.height;
+  const RayTable rays = BuildRayTable(camera);
+  PointCloudOptions cloud_options;
+  cloud_options.units_per_mm = 1.0f;
+
+  SyntheticScene exact;
+  std::vector<std::uint16_t> exact_depth(pixels);
+  exact.renderDepth(camera, 0.5, SyntheticPose{}, 0, exact_depth.data());
+  OrganizedPointCloud truth;
+  BackProjectOrganized(exact_depth.data(), rays, cloud_options, &truth);
+
+  SyntheticScene noisy;
+  noisy.setDepthNoise(1.0f);
+  std::vector<std::uint16_t> depth(pixels);
+  noisy.renderDepth(camera, 0.5, SyntheticPose{}, 0, depth.data());
+  OrganizedPointCloud cloud;
+
+  const int iterations = options.iterations > 0 ? options.iterations : 50;
+  const int slow_iterations = options.iterations > 0 ? options.iterations : 3;
+  std::cout << " " << camera.width << "x" << camera.height << " depth\n";
+  PrintBenchLine("back-project organized (simd)", TimeIterations(iterations, [&] {
+                   BackProjectOrganized(depth.data(), rays, cloud_options, &cloud);
+                 }));
+
+  NormalMap map;
+  NormalEstimator estimator;
+  NormalOptions normal_options;
+  normal_options.threads = 1;
+  const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+  char budget[64];
+  std::snprintf(budget, sizeof(budget), "budget %.1f ms", kBudgetMs);
+  char threads[32];
+  std::snprintf(threads, sizeof(threads), "%d threads", hardware);
+
+  bool ok = true;
+  const NormalMethod methods[] = {NormalMethod::kAverage3DGradient, NormalMethod::kCovariance};
+  for (NormalMethod method : methods) {
+    normal_options.method = method;
+    normal_options.threads = 1;
+    estimator.setOptions(normal_options);
+    const std::string label = NormalMethodLabel(method);
+    PrintBenchLine(label + ", 1 thread", TimeIterations(iterations, [&] { estimator.compute(cloud, &map); }), budget);
+    if (hardware > 1) {
+      normal_options.threads = 0;
+      estimator.setOptions(normal_options);
+      PrintBenchLine(label + ", thread pool", TimeIterations(iterations, [&] { estimator.compute(cloud, &map); }),
+                     threads);
+      normal_options.threads = 1;
+      estimator.setOptions(normal_options);
+    }
+
+    estimator.compute(truth, &map);
+    const PlaneScore clean = ScorePlanes(truth, map);
+    estimator.compute(cloud, &map);
+    const PlaneScore rough = ScorePlanes(truth, map);
+    char summary[200];
+    std::snprintf(summary, sizeof(summary),
+                  "  planes: exact depth %.1f%% aligned, %.2f deg mean, %.0f%% covered; noisy %.2f deg mean\n",
+                  clean.aligned * 100.0, clean.mean_error_deg, clean.coverage * 100.0, rough.mean_error_deg);
+    std::cout << summary;
+    if (clean.aligned < 0.95 || clean.coverage < 0.8) {
+      std::cerr << "  " << label << " normals do not match the room's planes\n";
+      ok = false;
+    }
+  }
+
+  // The covariance path against direct per-pixel window sums.
+  double cov[6];
+  const int r = normal_options.window_radius;
+  PrintBenchLine("direct window covariance (no integral)", TimeIterations(slow_iterations, [&] {
+                   for (int v = 0; v < camera.height; ++v) {
+                     for (int u = 0; u < camera.width; ++u) {
+                       DirectCovariance(cloud, u, v, r, cov);
+                     }
+                   }
+                 }));
+  const double worst = CheckAgainstDirect(cloud, map, r);
+  char check[64];
+  std::snprintf(check, sizeof(check), "  eigen check vs direct covariance: worst %.2e\n", worst);
+  std::cout << check;
+  if (!(worst < 1e-3)) {
+    std::cerr << "  covariance normals disagree with the direct window covariance\n";
+    ok = false;
+  }
+  return ok;
+}
+
+}  // namespace
+
+bool BenchNormals(const BenchOptions &options) {
+  const bool v1 = RunResolution(KinectGeneration::kV1, options);
+  const bool v2 = RunResolution(KinectGeneration::kV2, options);
+  return v1 && v2;
+}
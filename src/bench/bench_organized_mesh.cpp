@@ -0,0 +1,175 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/camera_model.h"
+#include "processing/organized_mesh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// "A few milliseconds" for a 640x480 frame.
+constexpr double kBudgetMs = 5.0;
+constexpr int kBudgetRounds = 5;
+// Decimated and full meshes of the same frame must cover the same surface.
+constexpr double kMaxAreaDifference = 0.01;
+
+struct MeshCheck {
+  double area = 0.0;
+  // Edges with one triangle (holes, silhouettes, the image border); cracks
+  // between decimated and full-resolution triangles would add to them.
+  std::size_t boundary_edges = 0;
+  std::size_t non_manifold_edges = 0;
+  // Triangles facing away from the camera at the origin.
+  std::size_t back_facing = 0;
+};
+
+MeshCheck CheckMesh(const TriangleMesh &mesh) {
+  MeshCheck check;
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> edges;
+  edges.reserve(mesh.indices.size());
+  for (std::size_t t = 0; t < mesh.triangleCount(); ++t) {
+    const std::uint32_t *tri = mesh.indices.data() + t * 3;
+    const float *p0 = mesh.vertices.data() + tri[0] * 3;
+    const float *p1 = mesh.vertices.data() + tri[1] * 3;
+    const float *p2 = mesh.vertices.data() + tri[2] * 3;
+    const double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    const double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    const double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+    check.area += 0.5 * std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    check.back_facing += n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2] > 0.0 ? 1 : 0;
+    for (int k = 0; k < 3; ++k) {
+      const std::uint32_t a = tri[k];
+      const std::uint32_t b = tri[(k + 1) % 3];
+      edges.emplace_back(std::min(a, b), std::max(a, b));
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  for (std::size_t i = 0; i < edges.size();) {
+    std::size_t j = i;
+    while (j < edges.size() && edges[j] == edges[i]) {
+      ++j;
+    }
+    check.boundary_edges += j - i == 1 ? 1 : 0;
+    check.non_manifold_edges += j - i > 2 ? 1 : 0;
+    i = j;
+  }
+  return check;
+}
+
+long FileSize(const std::string &path) {
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return -1;
+  }
+  std::fseek(file, 0, SEEK_END);
+  const long size = std::ftell(file);
+  std::fclose(file);
+  return size;
+}
+
+}  // namespace
+
+bool BenchOrganizedMesh(const BenchOptions &options) {
+  const int iterations = options.iterations > 0 ? options.iterations : 50;
+  const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+  bool ok = true;
+
+  for (KinectGeneration generation : {KinectGeneration::kV1, KinectGeneration::kV2}) {
+    const CameraIntrinsics camera = SyntheticDepthCamera(generation);
+    const std::size_t pixels = static_cast<std::size_t>(camera.width) * camera.height;
+    SyntheticScene scene;
+    std::vector<std::uint8_t> rgb(pixels * 3);
+    scene.renderColor(camera, 0.5, rgb.data());
+    // Geometry is checked on a noise-free frame, where the full grid's area
+    // is the true surface area rather than inflated by per-pixel noise.
+    std::vector<std::uint16_t> clean(pixels);
+    scene.renderDepth(camera, 0.5, SyntheticPose{}, 0, clean.data());
+    std::vector<std::uint16_t> depth(pixels);
+    scene.setDepthNoise(1.0f);
+    scene.renderDepth(camera, 0.5, SyntheticPose{}, 0, depth.data());
+    const RayTable rays = BuildRayTable(camera);
+    std::cout << " " << camera.width << "x" << camera.height << " frame\n";
+
+    std::vector<int> thread_counts = {1};
+    if (hardware > 1) {
+      thread_counts.push_back(0);
+    }
+    MeshCheck full;
+    for (int tile : {0, 8}) {
+      for (int threads : thread_counts) {
+        OrganizedMeshOptions mesh_options;
+        mesh_options.planar_tile = tile;
+        mesh_options.threads = threads;
+        OrganizedMesher mesher(mesh_options);
+        TriangleMesh mesh;
+        const BenchTiming timing =
+            TimeIterations(iterations, [&] { mesher.build(depth.data(), rays, rgb.data(), &mesh); });
+        const OrganizedMeshStats stats = mesher.stats();
+        char label[64];
+        std::snprintf(label, sizeof(label), "mesh %s, %s", tile > 0 ? "planar 8x8 tiles" : "full grid",
+                      threads == 1 ? "1 thread" : "thread pool");
+        char detail[128];
+        std::snprintf(detail, sizeof(detail), "%zu vertices, %zu triangles, %zu planar tiles", stats.vertices,
+                      stats.triangles, stats.planar_tiles);
+        PrintBenchLine(label, timing, detail);
+        if (threads != 1) {
+          continue;
+        }
+
+        TriangleMesh clean_mesh;
+        mesher.build(clean.data(), rays, nullptr, &clean_mesh);
+        const MeshCheck check = CheckMesh(clean_mesh);
+        if (tile == 0) {
+          full = check;
+        }
+        if (check.non_manifold_edges > 0 || check.back_facing > 0 ||
+            (tile > 0 && (check.boundary_edges > full.boundary_edges ||
+                          std::fabs(check.area - full.area) > kMaxAreaDifference * full.area))) {
+          std::cerr << "  tile " << tile << ": " << check.non_manifold_edges << " non-manifold edges, "
+                    << check.back_facing << " back-facing triangles, " << check.boundary_edges
+                    << " boundary edges (full grid " << full.boundary_edges << "), area " << check.area << " m^2 (full "
+                    << full.area << ")\n";
+          ok = false;
+        }
+        // Checked on the best median of a few rounds: a mean lets one
+        // preempted iteration, or one busy stretch of a shared host, decide
+        // the result.
+        if (generation == KinectGeneration::kV1 && tile == 0) {
+          double best = timing.p50_ms;
+          double worst = timing.p50_ms;
+          for (int round = 1; round < kBudgetRounds; ++round) {
+            const double p50 =
+                TimeIterations(iterations, [&] { mesher.build(depth.data(), rays, rgb.data(), &mesh); }).p50_ms;
+            best = std::min(best, p50);
+            worst = std::max(worst, p50);
+          }
+          std::printf("  p50 %.3f-%.3f ms over %d rounds, best %s the %.1f ms budget\n", best, worst, kBudgetRounds,
+                      best <= kBudgetMs ? "within" : "over", kBudgetMs);
+        }
+
+        // Streaming writers straight from the depth frame.
+        const std::string dir = BenchScratchDirectory();
+        for (MeshFileFormat format : {MeshFileFormat::kBinaryPly, MeshFileFormat::kObj}) {
+          const bool ply = format == MeshFileFormat::kBinaryPly;
+          const std::string path = dir + (ply ? "/organized_mesh.ply" : "/organized_mesh.obj");
+          const BenchTiming write = TimeIterations(std::max(1, iterations / 5), [&] {
+            ok = mesher.write(path, format, depth.data(), rays, rgb.data()) && ok;
+          });
+          std::snprintf(label, sizeof(label), "  + write %s", ply ? "binary ply" : "obj");
+          std::snprintf(detail, sizeof(detail), "%.1f MiB",
+                        static_cast<double>(FileSize(path)) / (1024.0 * 1024.0));
+          PrintBenchLine(label, write, detail);
+          std::remove(path.c_str());
+        }
+      }
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,208 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/camera_model.h"
+#include "processing/plane_detection.h"
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int kSequenceFrames = 60;
+constexpr double kFrameRate = 30.0;
+// The synthetic room (synthetic_scene.cpp) in metres: floor, back wall and
+// side wall as n . p + d = 0 with n facing the camera.
+struct TruePlane {
+  const char *name;
+  float normal[3];
+  float distance;
+};
+constexpr TruePlane kRoom[] = {
+    {"floor", {0.0f, -1.0f, 0.0f}, 0.9f},
+    {"back wall", {0.0f, 0.0f, -1.0f}, 3.5f},
+    {"side wall", {1.0f, 0.0f, 0.0f}, 1.8f},
+};
+constexpr int kFloor = 0;
+// Pixels within this distance of a true plane belong to it.
+constexpr float kTruthToleranceM = 0.002f;
+// Planes covering less of the frame may legitimately be missed.
+constexpr double kMinCheckedFraction = 0.08;
+constexpr float kMaxAngleDeg = 2.0f;
+constexpr float kMaxOffsetM = 0.02f;
+constexpr double kMinLabelAgreement = 0.9;
+constexpr double kPi = 3.14159265358979;
+
+struct Truth {
+  std::vector<int> labels;  // kRoom index, -1 elsewhere
+  std::size_t pixels[3] = {0, 0, 0};
+  std::size_t valid = 0;
+};
+
+Truth RoomTruth(const std::uint16_t *clean, const RayTable &rays) {
+  Truth truth;
+  truth.labels.assign(rays.size(), -1);
+  for (std::size_t i = 0; i < rays.size(); ++i) {
+    if (clean[i] == 0) {
+      continue;
+    }
+    ++truth.valid;
+    const float z = clean[i] * 0.001f;
+    const float p[3] = {rays.x()[i] * z, rays.y()[i] * z, z};
+    for (int k = 0; k < 3; ++k) {
+      const TruePlane &plane = kRoom[k];
+      const float distance = plane.normal[0] * p[0] + plane.normal[1] * p[1] + plane.normal[2] * p[2] + plane.distance;
+      if (std::fabs(distance) < kTruthToleranceM) {
+        truth.labels[i] = k;
+        ++truth.pixels[k];
+        break;
+      }
+    }
+  }
+  return truth;
+}
+
+// Index of the detected plane matching |plane|, -1 if none.
+int MatchPlane(const PlaneSet &set, const TruePlane &plane) {
+  const float min_cos = static_cast<float>(std::cos(kMaxAngleDeg * kPi / 180.0));
+  for (std::size_t k = 0; k < set.planes.size(); ++k) {
+    const DetectedPlane &found = set.planes[k];
+    const float cos_angle =
+        found.normal[0] * plane.normal[0] + found.normal[1] * plane.normal[1] + found.normal[2] * plane.normal[2];
+    if (cos_angle >= min_cos && std::fabs(found.distance - plane.distance) < kMaxOffsetM) {
+      return static_cast<int>(k);
+    }
+  }
+  return -1;
+}
+
+bool CheckPlanes(const PlaneSet &set, const Truth &truth) {
+  bool ok = true;
+  for (int k = 0; k < 3; ++k) {
+    const double share = static_cast<double>(truth.pixels[k]) / static_cast<double>(truth.valid);
+    if (share < kMinCheckedFraction) {
+      continue;
+    }
+    const int match = MatchPlane(set, kRoom[k]);
+    if (match < 0) {
+      std::cerr << "  " << kRoom[k].name << " (" << share * 100.0 << "% of the frame) not found\n";
+      ok = false;
+      continue;
+    }
+    if (k == kFloor && set.floor != match) {
+      std::cerr << "  floor is plane " << set.floor << ", expected " << match << "\n";
+      ok = false;
+    }
+    if (set.labels.empty()) {
+      continue;
+    }
+    // Recall and precision of the label mask against the true pixels.
+    std::size_t labelled = 0;
+    std::size_t agreed = 0;
+    for (std::size_t i = 0; i < truth.labels.size(); ++i) {
+      const bool expected = truth.labels[i] == k;
+      const bool got = set.labels[i] == match + 1;
+      labelled += got ? 1 : 0;
+      agreed += expected && got ? 1 : 0;
+    }
+    const double recall = static_cast<double>(agreed) / static_cast<double>(truth.pixels[k]);
+    const double precision = labelled > 0 ? static_cast<double>(agreed) / static_cast<double>(labelled) : 0.0;
+    if (recall < kMinLabelAgreement || precision < kMinLabelAgreement) {
+      std::cerr << "  " << kRoom[k].name << " labels: recall " << recall << ", precision " << precision << "\n";
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+}  // namespace
+
+bool BenchPlaneDetection(const BenchOptions &options) {
+  const int iterations = options.iterations > 0 ? options.iterations : 30;
+  const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+  bool ok = true;
+
+  for (KinectGeneration generation : {KinectGeneration::kV1, KinectGeneration::kV2}) {
+    const SyntheticCamera camera = SyntheticDepthCamera(generation);
+    const std::size_t pixels = static_cast<std::size_t>(camera.width) * camera.height;
+    const RayTable rays = BuildRayTable(camera);
+    SyntheticScene scene;
+    std::vector<std::uint16_t> clean(pixels);
+    scene.renderDepth(camera, 0.5, SyntheticPose{}, 0, clean.data());
+    scene.setDepthNoise(1.0f);
+    std::vector<std::uint16_t> depth(pixels);
+    scene.renderDepth(camera, 0.5, SyntheticPose{}, 0, depth.data());
+    const Truth truth = RoomTruth(clean.data(), rays);
+    std::cout << " " << camera.width << "x" << camera.height << " frame\n";
+
+    // Single frames, no prior: the full random search every time.
+    std::vector<int> thread_counts = {1};
+    if (hardware > 1) {
+      thread_counts.push_back(0);
+    }
+    for (int threads : thread_counts) {
+      PlaneDetectionOptions detect_options;
+      detect_options.temporal_prior = false;
+      detect_options.threads = threads;
+      PlaneDetector detector;
+      detector.setOptions(detect_options);
+      std::shared_ptr<const PlaneSet> set;
+      const BenchTiming timing = TimeIterations(iterations, [&] {
+        set.reset();
+        set = detector.detect(depth.data(), rays);
+      });
+      const PlaneDetectionStats &stats = detector.stats();
+      char label[64];
+      std::snprintf(label, sizeof(label), "ransac + labels, %s", threads == 1 ? "1 thread" : "thread pool");
+      char detail[128];
+      std::snprintf(detail, sizeof(detail), "%zu planes, %zu hypotheses, %.2f M point tests", set->planes.size(),
+                    stats.hypotheses, static_cast<double>(stats.point_tests) / 1e6);
+      PrintBenchLine(label, timing, detail);
+      if (threads == 1) {
+        ok = CheckPlanes(*set, truth) && ok;
+      }
+    }
+
+    // A moving scene with the temporal prior: the room's planes are carried
+    // over and keep their ids, so only the leftover points are searched.
+    {
+      PlaneDetector detector;
+      PlaneDetectionOptions detect_options;
+      detector.setOptions(detect_options);
+      std::vector<std::vector<std::uint16_t>> frames;
+      for (int f = 0; f < kSequenceFrames; ++f) {
+        frames.emplace_back(pixels);
+        scene.renderDepth(camera, 0.5 + f / kFrameRate, SyntheticPose{}, static_cast<std::uint64_t>(f),
+                          frames.back().data());
+      }
+      std::uint32_t floor_id = 0;
+      std::size_t id_changes = 0;
+      std::size_t kept = 0;
+      std::size_t point_tests = 0;
+      int frame = 0;
+      // TimeIterations() runs the body once more as a warm-up.
+      const BenchTiming timing = TimeIterations(kSequenceFrames - 1, [&] {
+        std::shared_ptr<const PlaneSet> set = detector.detect(frames[static_cast<std::size_t>(frame)].data(), rays);
+        ++frame;
+        kept += detector.stats().priors_kept;
+        point_tests += detector.stats().point_tests;
+        const DetectedPlane *floor = set->floorPlane();
+        const std::uint32_t id = floor != nullptr ? floor->id : 0;
+        id_changes += frame > 1 && id != floor_id ? 1 : 0;
+        floor_id = id;
+      });
+      char detail[128];
+      std::snprintf(detail, sizeof(detail), "%.1f planes kept per frame, %.2f M point tests",
+                    static_cast<double>(kept) / kSequenceFrames,
+                    static_cast<double>(point_tests) / kSequenceFrames / 1e6);
+      PrintBenchLine("ransac + labels, temporal prior", timing, detail);
+      if (floor_id == 0 || id_changes > 0) {
+        std::cerr << "  floor id changed " << id_changes << " times over " << kSequenceFrames << " frames\n";
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,190 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/camera_model.h"
+#include "processing/point_cloud.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+#if defined(__GNUC__)
+#define KINECT_BENCH_NOINLINE __attribute__((noinline))
+#else
+#define KINECT_BENCH_NOINLINE
+#endif
+
+// Stand-in for freenect_camera_to_world: an out-of-line double-precision call
+// per pixel, as in the original control-center export.
+KINECT_BENCH_NOINLINE void LegacyCameraToWorld(const CameraIntrinsics &camera, int x, int y, int depth, double *wx,
+                                                double *wy) {
+  *wx = (static_cast<double>(x) - camera.cx) * static_cast<double>(depth) / camera.fx;
+  *wy = (static_cast<double>(y) - camera.cy) * static_cast<double>(depth) / camera.fy;
+}
+
+// The pre-existing writer: count pass, then ASCII doubles through ofstream.
+std::size_t LegacyAsciiPly(const std::string &path, const CameraIntrinsics &camera,
+                           const std::vector<std::uint16_t> &depth, const std::vector<std::uint8_t> &rgb) {
+  std::size_t valid_points = 0;
+  for (std::uint16_t d : depth) {
+    if (d >= 350 && d <= 6000) {
+      ++valid_points;
+    }
+  }
+
+  std::ofstream out(path);
+  out << "ply\nformat ascii 1.0\nelement vertex " << valid_points
+      << "\nproperty float x\nproperty float y\nproperty float z\n"
+         "property uchar red\nproperty uchar green\nproperty uchar blue\nend_header\n";
+  for (int y = 0; y < camera.height; ++y) {
+    for (int x = 0; x < camera.width; ++x) {
+      const std::size_t index = static_cast<std::size_t>(y) * camera.width + x;
+      const std::uint16_t d = depth[index];
+      if (d < 350 || d > 6000) {
+        continue;
+      }
+      double wx = 0.0;
+      double wy = 0.0;
+      LegacyCameraToWorld(camera, x, y, d, &wx, &wy);
+      out << wx << " " << wy << " " << d << " " << static_cast<int>(rgb[index * 3 + 0]) << " "
+          << static_cast<int>(rgb[index * 3 + 1]) << " " << static_cast<int>(rgb[index * 3 + 2]) << "\n";
+    }
+  }
+  return valid_points;
+}
+
+long FileSize(const std::string &path) {
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return -1;
+  }
+  std::fseek(file, 0, SEEK_END);
+  const long size = std::ftell(file);
+  std::fclose(file);
+  return size;
+}
+
+std::string SizeDetail(const std::string &path) {
+  char text[64];
+  std::snprintf(text, sizeof(text), "%.1f MiB", static_cast<double>(FileSize(path)) / (1024.0 * 1024.0));
+  return text;
+}
+
+bool RunResolution(KinectGeneration generation, const BenchOptions &options) {
+  const CameraIntrinsics camera = SyntheticDepthCamera(generation);
+  const std::size_t pixels = static_cast<std::size_t>(camera.width) * camera.height;
+
+  SyntheticScene scene;
+  scene.setDepthNoise(1.0f);
+  std::vector<std::uint16_t> depth(pixels);
+  std::vector<std::uint8_t> rgb(pixels * 3);
+  scene.renderDepth(camera, 0.5, SyntheticPose{}, 0, depth.data());
+  scene.renderColor(camera, 0.5, rgb.data());
+
+  const std::string dir = BenchScratchDirectory();
+  const std::string legacy_path = dir + "/legacy.ply";
+  const std::string binary_path = dir + "/binary.ply";
+  const std::string ascii_path = dir + "/ascii.ply";
+  const int io_iterations = options.iterations > 0 ? options.iterations : 5;
+  const int kernel_iterations = options.iterations > 0 ? options.iterations : 200;
+
+  std::size_t legacy_points = 0;
+  const BenchTiming legacy =
+      TimeIterations(io_iterations, [&] { legacy_points = LegacyAsciiPly(legacy_path, camera, depth, rgb); });
+
+  const BenchTiming table_build = TimeIterations(kernel_iterations / 10, [&] { BuildRayTable(camera); });
+  const std::shared_ptr<const RayTable> rays = CachedRayTable(camera);
+
+  PointCloud cloud;
+  PointCloudOptions cloud_options;
+  cloud_options.units_per_mm = 1.0f;
+  const BenchTiming project = TimeIterations(
+      kernel_iterations, [&] { BackProjectDepth(depth.data(), *rays, rgb.data(), nullptr, cloud_options, &cloud); });
+
+  bool ok = true;
+  const BenchTiming binary = TimeIterations(io_iterations, [&] {
+    BackProjectDepth(depth.data(), *rays, rgb.data(), nullptr, cloud_options, &cloud);
+    ok = WritePointCloudPly(binary_path, cloud, PlyFormat::kBinaryLittleEndian) && ok;
+  });
+  const BenchTiming ascii_single = TimeIterations(io_iterations, [&] {
+    BackProjectDepth(depth.data(), *rays, rgb.data(), nullptr, cloud_options, &cloud);
+    ok = WritePointCloudPly(ascii_path, cloud, PlyFormat::kAscii, 1) && ok;
+  });
+  const BenchTiming ascii = TimeIterations(io_iterations, [&] {
+    BackProjectDepth(depth.data(), *rays, rgb.data(), nullptr, cloud_options, &cloud);
+    ok = WritePointCloudPly(ascii_path, cloud, PlyFormat::kAscii) && ok;
+  });
+
+  std::cout << " " << camera.width << "x" << camera.height << " (" << cloud.size() << " of " << pixels
+            << " pixels valid)\n";
+  if (legacy_points != cloud.size()) {
+    std::cerr << "  point count mismatch: legacy " << legacy_points << ", new " << cloud.size() << "\n";
+    ok = false;
+  }
+  PrintBenchLine("legacy ascii (ofstream, per-pixel call)", legacy, SizeDetail(legacy_path));
+  PrintBenchLine("ray table build (once per mode)", table_build);
+  PrintBenchLine("back-project (ray table, simd)", project);
+  PrintBenchLine("back-project + binary ply", binary, SizeDetail(binary_path));
+  PrintBenchLine("back-project + ascii ply (1 thread)", ascii_single, SizeDetail(ascii_path));
+  PrintBenchLine("back-project + ascii ply (all cores)", ascii);
+  char speedup[96];
+  std::snprintf(speedup, sizeof(speedup), "  speedup vs legacy: binary %.1fx, ascii %.1fx\n",
+                legacy.mean_ms / binary.mean_ms, legacy.mean_ms / ascii.mean_ms);
+  std::cout << speedup;
+
+  std::remove(legacy_path.c_str());
+  std::remove(binary_path.c_str());
+  std::remove(ascii_path.c_str());
+  return ok;
+}
+
+// Cold start with a calibrated (distorted) v2 depth camera: undistorting
+// every pixel versus mapping the cached table.
+bool RunRayCache(const BenchOptions &options) {
+  CameraIntrinsics camera = NominalDepthIntrinsics(KinectGeneration::kV2, 512, 424);
+  camera.distortion = {0.0905f, -0.2687f, 0.0946f, 0.0f, 0.0f};
+  const std::string path = BenchScratchDirectory() + "/bench-depth.rays";
+  const int iterations = options.iterations > 0 ? options.iterations : 20;
+
+  const BenchTiming build = TimeIterations(iterations, [&] { BuildRayTable(camera); });
+  const RayTable built = BuildRayTable(camera);
+  if (!SaveRayTableFile(path, camera, built)) {
+    std::cerr << "  could not write " << path << "\n";
+    return false;
+  }
+
+  bool ok = true;
+  volatile float sink = 0.0f;
+  const BenchTiming map = TimeIterations(iterations, [&] {
+    const std::shared_ptr<const RayTable> table = MapRayTableFile(path, camera);
+    if (table == nullptr) {
+      ok = false;
+      return;
+    }
+    // Touch every page so the timing includes faulting the planes in.
+    float sum = 0.0f;
+    for (std::size_t i = 0; i < table->size(); i += 1024) {
+      sum += table->x()[i] + table->y()[i];
+    }
+    sink = sum;
+  });
+  (void)sink;
+
+  std::cout << " ray table cache, 512x424 with lens distortion\n";
+  PrintBenchLine("build (undistort per pixel)", build);
+  PrintBenchLine("map cached file", map);
+  std::remove(path.c_str());
+  return ok;
+}
+
+}  // namespace
+
+bool BenchPointCloud(const BenchOptions &options) {
+  const bool v1 = RunResolution(KinectGeneration::kV1, options);
+  const bool v2 = RunResolution(KinectGeneration::kV2, options);
+  const bool cache = RunRayCache(options);
+  return v1 && v2 && cache;
+}
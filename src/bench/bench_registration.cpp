@@ -0,0 +1,203 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/camera_model.h"
+#include "processing/registration.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Roughly the Kinect v2 depth-to-color baseline; enough parallax for the
+// z-buffer to reject pixels behind the moving sphere and box.
+constexpr float kBenchBaselineMm = 52.0f;
+
+// What registration costs without precomputed tables: every pixel re-derives
+// its ray and column per frame, scalar, with the same z-buffer test.
+void ReferenceRegistration(const CameraIntrinsics &depth_camera, const CameraIntrinsics &color_camera,
+                           float baseline_mm, const std::uint16_t *depth, const std::uint8_t *rgb,
+                           const RegistrationOptions &options, std::vector<std::uint16_t> *zbuffer,
+                           std::vector<std::uint8_t> *out) {
+  const int divisor = std::max(1, color_camera.width / depth_camera.width);
+  const int grid_w = (color_camera.width + divisor - 1) / divisor;
+  const int grid_h = (color_camera.height + divisor - 1) / divisor;
+  zbuffer->assign(static_cast<std::size_t>(grid_w) * grid_h, 0xFFFF);
+  out->assign(static_cast<std::size_t>(depth_camera.width) * depth_camera.height * 3, 0);
+
+  auto project = [&](int u, int v, int d, int *column, int *row) {
+    const double x = (u - depth_camera.cx) / depth_camera.fx;
+    const double y = (v - depth_camera.cy) / depth_camera.fy;
+    *column = static_cast<int>((x + baseline_mm / d) * color_camera.fx + color_camera.cx + 0.5);
+    *row = static_cast<int>(y * color_camera.fy + color_camera.cy + 0.5);
+    return *column >= 0 && *column < color_camera.width && *row >= 0 && *row < color_camera.height;
+  };
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int v = 0; v < depth_camera.height; ++v) {
+      for (int u = 0; u < depth_camera.width; ++u) {
+        const std::size_t index = static_cast<std::size_t>(v) * depth_camera.width + u;
+        const int d = depth[index];
+        int column = 0;
+        int row = 0;
+        if (d < options.min_depth_mm || d > options.max_depth_mm || !project(u, v, d, &column, &row)) {
+          continue;
+        }
+        std::uint16_t &z = (*zbuffer)[static_cast<std::size_t>(row / divisor) * grid_w + column / divisor];
+        if (pass == 0) {
+          z = std::min<std::uint16_t>(z, static_cast<std::uint16_t>(d));
+        } else if (d <= z + options.occlusion_tolerance_mm) {
+          std::memcpy(out->data() + index * 3, rgb + (static_cast<std::size_t>(row) * color_camera.width + column) * 3,
+                      3);
+        }
+      }
+    }
+  }
+}
+
+std::size_t ColoredPixels(const std::vector<std::uint8_t> &rgb) {
+  std::size_t colored = 0;
+  for (std::size_t i = 0; i + 2 < rgb.size(); i += 3) {
+    colored += (rgb[i] | rgb[i + 1] | rgb[i + 2]) != 0 ? 1 : 0;
+  }
+  return colored;
+}
+
+bool RunResolution(KinectGeneration generation, const BenchOptions &options) {
+  DeviceCalibration calibration;
+  calibration.depth = SyntheticDepthCamera(generation);
+  calibration.color = SyntheticColorCamera(generation);
+  calibration.depth_to_color.baseline_mm = kBenchBaselineMm;
+  const CameraIntrinsics &depth_camera = calibration.depth;
+  const CameraIntrinsics &color_camera = calibration.color;
+  const std::size_t depth_pixels = static_cast<std::size_t>(depth_camera.width) * depth_camera.height;
+
+  SyntheticScene scene;
+  scene.setDepthNoise(1.0f);
+  std::vector<std::uint16_t> depth(depth_pixels);
+  std::vector<std::uint8_t> rgb(static_cast<std::size_t>(color_camera.width) * color_camera.height * 3);
+  scene.renderDepth(depth_camera, 0.5, SyntheticPose{}, 0, depth.data());
+  scene.renderColor(color_camera, 0.5, rgb.data());
+
+  const int kernel_iterations = options.iterations > 0 ? options.iterations : 200;
+  const int slow_iterations = options.iterations > 0 ? options.iterations : 20;
+
+  const std::shared_ptr<const RayTable> rays = CachedRayTable(depth_camera);
+  const BenchTiming build = TimeIterations(slow_iterations, [&] {
+    BuildDepthToColorTable(*rays, depth_camera, color_camera, calibration.depth_to_color);
+  });
+  const DepthToColorTable table =
+      BuildDepthToColorTable(*rays, depth_camera, color_camera, calibration.depth_to_color);
+
+  RegistrationOptions registration_options;
+  RegisteredFrame registered;
+  const BenchTiming simd = TimeIterations(
+      kernel_iterations, [&] { RegisterDepthColor(table, depth.data(), rgb.data(), registration_options, &registered); });
+
+  std::vector<std::uint16_t> reference_zbuffer;
+  std::vector<std::uint8_t> reference_rgb;
+  const BenchTiming reference = TimeIterations(slow_iterations, [&] {
+    ReferenceRegistration(depth_camera, color_camera, kBenchBaselineMm, depth.data(), rgb.data(),
+                          registration_options, &reference_zbuffer, &reference_rgb);
+  });
+
+  // Capture-side cost and end-to-end latency through the worker thread.
+  RegistrationWorker worker;
+  worker.start(calibration, generation, nullptr, registration_options);
+  RegisteredFrame delivered;
+  const BenchTiming handoff = TimeIterations(kernel_iterations, [&] {
+    worker.submit(depth, depth_camera.width, depth_camera.height, rgb, color_camera.width, color_camera.height, 0);
+  });
+  worker.takeResult(&delivered);
+  const BenchTiming round_trip = TimeIterations(slow_iterations, [&] {
+    worker.submit(depth, depth_camera.width, depth_camera.height, rgb, color_camera.width, color_camera.height, 0);
+    while (!worker.takeResult(&delivered)) {
+      std::this_thread::yield();
+    }
+  });
+  worker.stop();
+
+  const std::size_t colored = ColoredPixels(registered.rgb);
+  const std::size_t reference_colored = ColoredPixels(reference_rgb);
+  std::cout << " " << depth_camera.width << "x" << depth_camera.height << " depth -> " << color_camera.width << "x"
+            << color_camera.height << " color (" << colored << " of " << depth_pixels << " depth pixels colored)\n";
+  bool ok = true;
+  // Float vs double rounding may move a handful of pixels across a column
+  // or z-buffer cell boundary.
+  const std::size_t difference = colored > reference_colored ? colored - reference_colored : reference_colored - colored;
+  if (difference > depth_pixels / 100 || delivered.rgb != registered.rgb) {
+    std::cerr << "  registration mismatch: table " << colored << ", reference " << reference_colored
+              << " colored pixels\n";
+    ok = false;
+  }
+  char aligned[64];
+  std::snprintf(aligned, sizeof(aligned), "%dx%d color-aligned depth", registered.depth_width,
+                registered.depth_height);
+  PrintBenchLine("per-pixel reference (no table, scalar)", reference);
+  PrintBenchLine("table build (once per device)", build);
+  PrintBenchLine("register (table, simd + z-buffer)", simd, aligned);
+  PrintBenchLine("worker submit (copies both planes)", handoff);
+  PrintBenchLine("worker round trip", round_trip);
+  char summary[128];
+  std::snprintf(summary, sizeof(summary), "  %.0f frames/s registered, %.1fx vs reference\n", 1000.0 / simd.mean_ms,
+                reference.mean_ms / simd.mean_ms);
+  std::cout << summary;
+  return ok;
+}
+
+// libfreenect-format tables for the synthetic v1 pair: per-pixel color x in
+// 1/256 pixel and row, plus the per-millimetre shift. Times the shift-LUT
+// path FreenectV1Device uses against the same scene.
+bool RunFreenectTables(const BenchOptions &options) {
+  const CameraIntrinsics depth_camera = SyntheticDepthCamera(KinectGeneration::kV1);
+  const CameraIntrinsics color_camera = SyntheticColorCamera(KinectGeneration::kV1);
+  const std::size_t depth_pixels = static_cast<std::size_t>(depth_camera.width) * depth_camera.height;
+  constexpr int kShiftCount = 10000;
+
+  std::vector<std::int32_t> registration(depth_pixels * 2);
+  const std::shared_ptr<const RayTable> rays = CachedRayTable(depth_camera);
+  for (std::size_t i = 0; i < depth_pixels; ++i) {
+    const double column = rays->x()[i] * color_camera.fx + color_camera.cx + 0.5;
+    registration[i * 2] = static_cast<std::int32_t>(column * 256.0);
+    registration[i * 2 + 1] = static_cast<std::int32_t>(rays->y()[i] * color_camera.fy + color_camera.cy + 0.5);
+  }
+  std::vector<std::int32_t> shift(kShiftCount, 0);
+  for (int mm = 1; mm < kShiftCount; ++mm) {
+    shift[mm] = static_cast<std::int32_t>(kBenchBaselineMm * color_camera.fx / mm * 256.0f);
+  }
+  const DepthToColorTable table = BuildFreenectDepthToColorTable(
+      depth_camera.width, depth_camera.height, reinterpret_cast<const std::int32_t(*)[2]>(registration.data()),
+      shift.data(), kShiftCount, 0);
+
+  SyntheticScene scene;
+  scene.setDepthNoise(1.0f);
+  std::vector<std::uint16_t> depth(depth_pixels);
+  std::vector<std::uint8_t> rgb(static_cast<std::size_t>(color_camera.width) * color_camera.height * 3);
+  scene.renderDepth(depth_camera, 0.5, SyntheticPose{}, 0, depth.data());
+  scene.renderColor(color_camera, 0.5, rgb.data());
+
+  RegistrationOptions registration_options;
+  RegisteredFrame registered;
+  const int iterations = options.iterations > 0 ? options.iterations : 200;
+  const BenchTiming timing = TimeIterations(
+      iterations, [&] { RegisterDepthColor(table, depth.data(), rgb.data(), registration_options, &registered); });
+  const std::size_t colored = ColoredPixels(registered.rgb);
+  char detail[64];
+  std::snprintf(detail, sizeof(detail), "%zu of %zu colored", colored, depth_pixels);
+  PrintBenchLine("register (libfreenect tables, shift LUT)", timing, detail);
+  if (colored < depth_pixels / 2) {
+    std::cerr << "  libfreenect-table registration colored only " << colored << " pixels\n";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool BenchRegistration(const BenchOptions &options) {
+  const bool v1 = RunResolution(KinectGeneration::kV1, options) && RunFreenectTables(options);
+  const bool v2 = RunResolution(KinectGeneration::kV2, options);
+  return v1 && v2;
+}
@@ -0,0 +1,345 @@
+#include "backends/backend.h"
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/tof_depth_decoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int kFrames = 6;
+constexpr double kFrameRate = 30.0;
+constexpr double kTwoPi = 6.28318530717958647692;
+// libfreenect2's phase-to-depth scale (DepthPacketProcessor parameters).
+constexpr float kUnambiguousDistance = 2083.333f;
+constexpr float kXTableScale = 8192.0f;
+// The decoder's default range.
+constexpr float kMinDepthMm = 500.0f;
+constexpr float kMaxDepthMm = 4500.0f;
+// Per pipeline in the device comparison.
+constexpr auto kDeviceCaptureTime = std::chrono::seconds(5);
+
+// The device's 11-bit to 16-bit sample table, as libfreenect2 builds it.
+std::vector<std::int16_t> DeviceLut() {
+  std::vector<std::int16_t> lut(kTofLutEntries);
+  std::int16_t y = 0;
+  for (int x = 0; x < 1024; ++x) {
+    const int increment = 1 << (x / 128 - (x >= 128 ? 1 : 0));
+    lut[static_cast<std::size_t>(x)] = y;
+    lut[static_cast<std::size_t>(1024 + x)] = static_cast<std::int16_t>(-y);
+    y = static_cast<std::int16_t>(y + increment);
+  }
+  lut[1024] = 32767;
+  return lut;
+}
+
+// Synthetic Kinect v2 depth packets for a rendered depth image: per pixel,
+// the nine correlation samples whose three phasors (80, 16, 120 MHz) decode
+// back to the rendered depth, at an amplitude that falls with distance.
+class PacketSynthesizer {
+ public:
+  explicit PacketSynthesizer(const SyntheticCamera &camera) : lut_(DeviceLut()) {
+    // Nearest 11-bit code for every sample value the table spans.
+    const int range = lut_[1023];
+    codes_.resize(static_cast<std::size_t>(2 * range + 1));
+    for (int value = -range; value <= range; ++value) {
+      int best = 0;
+      for (int code = 0; code < static_cast<int>(kTofLutEntries); ++code) {
+        if (code != 1024 && std::abs(lut_[static_cast<std::size_t>(code)] - value) <
+                                std::abs(lut_[static_cast<std::size_t>(best)] - value)) {
+          best = code;
+        }
+      }
+      codes_[static_cast<std::size_t>(value + range)] = static_cast<std::uint16_t>(best);
+    }
+    // Packets and tables run bottom-up relative to the delivered frames.
+    x_table_.resize(static_cast<std::size_t>(kTofWidth) * kTofHeight);
+    z_table_.resize(x_table_.size());
+    for (int y = 0; y < kTofHeight; ++y) {
+      const float yu = (kTofHeight - 1 - y + 0.5f - camera.cy) / camera.fy;
+      for (int x = 0; x < kTofWidth; ++x) {
+        const float xu = (x + 0.5f - camera.cx) / camera.fx;
+        const std::size_t i = static_cast<std::size_t>(y) * kTofWidth + x;
+        x_table_[i] = kXTableScale * xu;
+        z_table_[i] = kUnambiguousDistance / std::sqrt(xu * xu + yu * yu + 1.0f);
+      }
+    }
+    // Zero phase offsets.
+    p0_tables_.assign(kTofP0TablesBytes, 0);
+  }
+
+  bool load(TofDepthDecoder *decoder) const {
+    return decoder->setTables(p0_tables_.data(), p0_tables_.size(), x_table_.data(), z_table_.data(), lut_.data(),
+                              lut_.size());
+  }
+
+  void synthesize(const std::uint16_t *depth, const std::uint8_t *ir, std::vector<std::uint8_t> *packet) const {
+    packet->assign(kTofPacketBytes, 0);
+    const int range = lut_[1023];
+    for (int y = 0; y < kTofHeight; ++y) {
+      const int image_row = kTofHeight - 1 - y;
+      for (int x = 1; x < kTofWidth - 1; ++x) {
+        const std::size_t image_index = static_cast<std::size_t>(image_row) * kTofWidth + x;
+        const float z = depth[image_index];
+        if (z <= 0.0f) {
+          continue;  // all-zero samples: no amplitude, no depth
+        }
+        const double phase = Phase(z, static_cast<std::size_t>(y) * kTofWidth + x);
+        const double amplitude = 100.0 + 10.0 * ir[image_index];
+        // Unwrapped phase units of 80, 16 and 120 MHz over the joint range.
+        const double cycles[3] = {5.0 * phase / 4.5, phase / 4.5, 7.5 * phase / 4.5};
+        for (int k = 0; k < 3; ++k) {
+          const double theta = kTwoPi * (cycles[k] - std::floor(cycles[k]));
+          for (int i = 0; i < 3; ++i) {
+            const int value = static_cast<int>(std::lround(amplitude * std::cos(theta + kTwoPi * i / 3.0)));
+            const int clamped = std::min(range, std::max(-range, value));
+            Put(packet, k * 3 + i, x, y, codes_[static_cast<std::size_t>(clamped + range)]);
+          }
+        }
+      }
+    }
+  }
+
+ private:
+  // The combined phase the decoder maps to |z|, its depth fit included.
+  double Phase(float z, std::size_t i) const {
+    double phase = z / z_table_[i];
+    for (int iteration = 0; iteration < 3; ++iteration) {
+      const double linear = z_table_[i] * phase;
+      const double max_depth = phase * kUnambiguousDistance * 2.0;
+      const double x_scale = x_table_[i] * 90.0 / (max_depth * max_depth * 8192.0);
+      phase *= z / (linear / (1.0 - linear * x_scale));
+    }
+    return phase;
+  }
+
+  static void Put(std::vector<std::uint8_t> *packet, int sub, int x, int y, std::uint16_t code) {
+    const int row = y < kTofHeight / 2 ? y + kTofHeight / 2 : kTofHeight - 1 - y;
+    std::uint8_t *bytes = packet->data() + kTofSubImageBytes * sub + static_cast<std::size_t>(row) * kTofWidth * 11 / 8;
+    const int bit = ((x >> 2) + ((x & 3) << 7)) * 11;
+    for (int b = 0; b < 11; ++b) {
+      if ((code >> b) & 1) {
+        // Little-endian u16 words.
+        const int position = bit + b;
+        bytes[(position >> 4) * 2 + ((position & 15) >> 3)] |= static_cast<std::uint8_t>(1u << (position & 7));
+      }
+    }
+  }
+
+  std::vector<std::int16_t> lut_;
+  std::vector<std::uint16_t> codes_;
+  std::vector<float> x_table_;
+  std::vector<float> z_table_;
+  std::vector<std::uint8_t> p0_tables_;
+};
+
+struct Accuracy {
+  double rms_mm = 0.0;
+  double decoded = 0.0;
+};
+
+// Against the render, over pixels inside the decoder's range.
+Accuracy Measure(const std::vector<std::uint16_t> &truth, const std::vector<float> &depth) {
+  double sum = 0.0;
+  std::size_t valid = 0;
+  std::size_t decoded = 0;
+  for (std::size_t i = 0; i < truth.size(); ++i) {
+    if (truth[i] < kMinDepthMm || truth[i] > kMaxDepthMm) {
+      continue;
+    }
+    ++valid;
+    if (depth[i] <= 0.0f) {
+      continue;
+    }
+    const double e = static_cast<double>(depth[i]) - truth[i];
+    sum += e * e;
+    ++decoded;
+  }
+  Accuracy accuracy;
+  accuracy.rms_mm = decoded > 0 ? std::sqrt(sum / static_cast<double>(decoded)) : 0.0;
+  accuracy.decoded = valid > 0 ? static_cast<double>(decoded) / static_cast<double>(valid) : 0.0;
+  return accuracy;
+}
+
+struct PipelineRun {
+  std::uint64_t frames = 0;
+  double fps = 0.0;
+  // Process CPU time (every thread, libfreenect2's included) per depth frame.
+  double cpu_ms_per_frame = 0.0;
+  // The depth_decode stage; only timed when the decoder runs in the backend.
+  double decode_ms = 0.0;
+};
+
+// Streams depth from |serial| through |pipeline| for kDeviceCaptureTime.
+bool RunDevicePipeline(V2PacketPipeline pipeline, const std::string &serial, PipelineRun *run) {
+  std::unique_ptr<KinectBackend> backend = CreateKinectV2Backend(pipeline);
+  std::unique_ptr<KinectDevice> device = backend != nullptr ? backend->openDevice(serial) : nullptr;
+  if (device == nullptr) {
+    return false;
+  }
+  device->setStreamKind(StreamKind::kDepth);
+  if (!device->start()) {
+    return false;
+  }
+  FrameData frame;
+  const std::clock_t cpu_begin = std::clock();
+  const auto begin = std::chrono::steady_clock::now();
+  while (std::chrono::steady_clock::now() - begin < kDeviceCaptureTime) {
+    if (device->update() && device->getFrame(frame) && !frame.depth.empty()) {
+      ++run->frames;
+    }
+  }
+  const double cpu_ms = 1000.0 * static_cast<double>(std::clock() - cpu_begin) / CLOCKS_PER_SEC;
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  run->decode_ms = device->telemetrySnapshot().stage(TelemetryStage::kDepthDecode).avg_ms;
+  device->stop();
+  run->fps = static_cast<double>(run->frames) / seconds;
+  run->cpu_ms_per_frame = run->frames > 0 ? cpu_ms / static_cast<double>(run->frames) : 0.0;
+  return run->frames > 0;
+}
+
+// libfreenect2's stock CpuPacketPipeline decodes on its own depth thread,
+// fed from USB, and its depth processor is not public API. So it is only
+// compared on an attached Kinect v2: each pipeline streams depth, and the
+// comparison is frame rate and process CPU time per frame. Color is decoded
+// the same way in both runs. Without libfreenect2 or a device it is skipped.
+void CompareWithStockPipeline() {
+#if !KINECT_WITH_V2_CPU_THREADED
+  std::cout << "  stock CpuPacketPipeline: not compared (cpu-threaded needs "
+               "-DKINECT_EXPERIMENTAL_V2_CPU_THREADED=ON)\n";
+  return;
+#endif
+  std::unique_ptr<KinectBackend> backend = CreateKinectV2Backend();
+  const std::vector<DeviceInfo> devices = backend != nullptr ? backend->listDevices() : std::vector<DeviceInfo>();
+  if (devices.empty()) {
+    std::cout << "  stock CpuPacketPipeline: not compared (needs libfreenect2 and an attached Kinect v2)\n";
+    return;
+  }
+  const std::string serial = devices.front().serial;
+  backend.reset();
+  for (V2PacketPipeline pipeline : {V2PacketPipeline::kCpu, V2PacketPipeline::kCpuThreaded}) {
+    PipelineRun run;
+    const char *label = pipeline == V2PacketPipeline::kCpu ? "stock CpuPacketPipeline" : "cpu-threaded";
+    if (!RunDevicePipeline(pipeline, serial, &run)) {
+      std::cout << "  device, " << label << ": no depth frames\n";
+      continue;
+    }
+    char line[160];
+    const int n = std::snprintf(line, sizeof(line), "  device, %-24s %.1f fps, %.1f ms CPU per frame", label, run.fps,
+                                run.cpu_ms_per_frame);
+    if (run.decode_ms > 0.0) {
+      std::snprintf(line + n, sizeof(line) - static_cast<std::size_t>(n), ", decode %.1f ms", run.decode_ms);
+    }
+    std::cout << line << "\n";
+  }
+}
+
+}  // namespace
+
+bool BenchTofDepth(const BenchOptions &options) {
+  const int iterations = options.iterations > 0 ? std::min(options.iterations, kFrames - 1) : kFrames - 1;
+  const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+  const SyntheticCamera camera = SyntheticDepthCamera(KinectGeneration::kV2);
+  if (camera.width != kTofWidth || camera.height != kTofHeight) {
+    std::cerr << "  unexpected v2 depth camera size\n";
+    return false;
+  }
+
+  const PacketSynthesizer synthesizer(camera);
+  SyntheticScene scene;
+  const std::size_t pixels = static_cast<std::size_t>(kTofWidth) * kTofHeight;
+  std::vector<std::vector<std::uint16_t>> truth(kFrames, std::vector<std::uint16_t>(pixels));
+  std::vector<std::vector<std::uint8_t>> packets(kFrames);
+  std::vector<std::uint8_t> ir8(pixels);
+  for (int f = 0; f < kFrames; ++f) {
+    std::vector<std::uint16_t> &depth = truth[static_cast<std::size_t>(f)];
+    scene.renderDepth(camera, f / kFrameRate, SyntheticPose{}, static_cast<std::uint64_t>(f), depth.data());
+    SyntheticIrFromDepth(depth.data(), static_cast<int>(pixels), ir8.data());
+    synthesizer.synthesize(depth.data(), ir8.data(), &packets[static_cast<std::size_t>(f)]);
+  }
+  std::cout << " " << kTofWidth << "x" << kTofHeight << " depth packets, "
+            << kTofPacketBytes / 1024 << " KiB each; 1 thread does the per-packet work of libfreenect2's "
+            << "CpuPacketPipeline\n";
+
+  struct Case {
+    const char *label;
+    int threads;
+    bool filters;
+  };
+  std::vector<Case> cases = {
+      {"1 thread", 1, true},
+      {"1 thread, no filters", 1, false},
+  };
+  if (hardware > 1) {
+    cases.push_back({"thread pool", 0, true});
+    cases.push_back({"thread pool, no filters", 0, false});
+  }
+
+  bool ok = true;
+  std::vector<float> depth(pixels);
+  std::vector<float> ir(pixels);
+  double single_ms = 0.0;
+  for (const Case &c : cases) {
+    TofDepthOptions decoder_options;
+    decoder_options.threads = c.threads;
+    decoder_options.bilateral_filter = c.filters;
+    decoder_options.edge_aware_filter = c.filters;
+    TofDepthDecoder decoder;
+    decoder.setOptions(decoder_options);
+    if (!synthesizer.load(&decoder)) {
+      std::cerr << "  " << c.label << ": tables rejected\n";
+      return false;
+    }
+    bool decoded_ok = true;
+    int frame = 0;
+    const BenchTiming timing = TimeIterations(iterations, [&] {
+      const std::vector<std::uint8_t> &packet = packets[static_cast<std::size_t>(frame % kFrames)];
+      decoded_ok = decoder.decode(packet.data(), packet.size(), depth.data(), ir.data()) && decoded_ok;
+      ++frame;
+    });
+    if (!decoded_ok) {
+      std::cerr << "  " << c.label << ": decode failed\n";
+      ok = false;
+      continue;
+    }
+    const Accuracy accuracy = Measure(truth[static_cast<std::size_t>((frame - 1) % kFrames)], depth);
+    char detail[128];
+    const int n = std::snprintf(detail, sizeof(detail), "%.0f fps, rms %.1f mm, %.1f%% decoded", 1000.0 / timing.mean_ms,
+                                accuracy.rms_mm, 100.0 * accuracy.decoded);
+    if (c.threads == 1 && c.filters) {
+      single_ms = timing.mean_ms;
+    } else if (c.filters && single_ms > 0.0) {
+      std::snprintf(detail + n, sizeof(detail) - static_cast<std::size_t>(n), ", %.1fx", single_ms / timing.mean_ms);
+    }
+    PrintBenchLine(c.label, timing, detail);
+  }
+
+  // Splitting rows across threads must not change a pixel.
+  std::vector<float> reference_depth(pixels);
+  std::vector<float> reference_ir(pixels);
+  for (int threads : {1, 4}) {
+    TofDepthOptions decoder_options;
+    decoder_options.threads = threads;
+    TofDepthDecoder decoder;
+    decoder.setOptions(decoder_options);
+    synthesizer.load(&decoder);
+    float *out_depth = threads == 1 ? reference_depth.data() : depth.data();
+    float *out_ir = threads == 1 ? reference_ir.data() : ir.data();
+    decoder.decode(packets.front().data(), packets.front().size(), out_depth, out_ir);
+  }
+  if (depth != reference_depth || ir != reference_ir) {
+    std::cout << "  4 threads decode differently from 1\n";
+    ok = false;
+  }
+
+  CompareWithStockPipeline();
+  return ok;
+}
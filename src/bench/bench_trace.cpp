@@ -0,0 +1,124 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "core/trace.h"
+#include "processing/background_model.h"
+#include "processing/blob_tracker.h"
+#include "processing/camera_model.h"
+#include "processing/depth_filter.h"
+#include "processing/depth_pyramid.h"
+#include "processing/plane_detection.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace {
+
+constexpr int kSequenceFrames = 30;
+constexpr double kFrameRate = 30.0;
+// Traced and untraced runs alternate, so drift in clock speed or background
+// load hits both; each side keeps its fastest round.
+constexpr int kRounds = 5;
+
+// The depth chain a synthetic device runs per frame, with every stage on.
+class DepthChain {
+ public:
+  explicit DepthChain(const SyntheticCamera &camera) : camera_(camera), rays_(CachedRayTable(camera)) {
+    DepthFilterOptions filter;
+    filter.enabled = true;
+    filter_.setOptions(filter);
+    PlaneDetectionOptions planes;
+    planes.enabled = true;
+    planes_.setOptions(planes);
+    BackgroundOptions background;
+    background.enabled = true;
+    background_.setOptions(background);
+    BlobTrackingOptions blobs;
+    blobs.enabled = true;
+    blobs_.setOptions(blobs);
+    work_.resize(static_cast<std::size_t>(camera.width) * camera.height);
+  }
+
+  void run(const std::vector<std::uint16_t> &depth) {
+    std::copy(depth.begin(), depth.end(), work_.begin());
+    filter_.apply(work_.data(), camera_.width, camera_.height);
+    pyramid_.build(work_.data(), camera_.width, camera_.height);
+    planes_.detect(work_.data(), *rays_);
+    const std::shared_ptr<const ForegroundMask> foreground =
+        background_.update(work_.data(), camera_.width, camera_.height);
+    if (foreground != nullptr) {
+      blobs_.track(*foreground, work_.data(), *rays_);
+    }
+  }
+
+ private:
+  SyntheticCamera camera_;
+  std::shared_ptr<const RayTable> rays_;
+  DepthFilterChain filter_;
+  DepthPyramidBuilder pyramid_;
+  PlaneDetector planes_;
+  BackgroundModel background_;
+  BlobTracker blobs_;
+  std::vector<std::uint16_t> work_;
+};
+
+}  // namespace
+
+bool BenchTrace(const BenchOptions &options) {
+  const SyntheticCamera camera = SyntheticDepthCamera(KinectGeneration::kV2);
+  const std::size_t pixels = static_cast<std::size_t>(camera.width) * camera.height;
+  SyntheticScene scene;
+  scene.setDepthNoise(1.0f);
+  std::vector<std::vector<std::uint16_t>> frames(kSequenceFrames, std::vector<std::uint16_t>(pixels));
+  for (int i = 0; i < kSequenceFrames; ++i) {
+    scene.renderDepth(camera, i / kFrameRate, SyntheticPose{}, static_cast<std::uint64_t>(i),
+                      frames[static_cast<std::size_t>(i)].data());
+  }
+  std::cout << " depth chain (filter, pyramid, planes, background, blobs) on " << camera.width << "x"
+            << camera.height << ", tracing off vs on, best of " << kRounds << " alternating rounds\n";
+
+  const bool was_tracing = TraceIsEnabled();
+  DepthChain chain(camera);
+  int next = 0;
+  auto body = [&]() {
+    chain.run(frames[static_cast<std::size_t>(next)]);
+    next = (next + 1) % kSequenceFrames;
+  };
+  const int iterations = options.iterations > 0 ? options.iterations : kSequenceFrames;
+
+  BenchTiming untraced;
+  BenchTiming traced;
+  std::uint64_t traced_events = 0;
+  int traced_frames = 0;
+  for (int round = 0; round < kRounds; ++round) {
+    TraceStop();
+    const BenchTiming off = TimeIterations(iterations, body);
+    TraceStart();
+    const std::uint64_t before = TraceCollectStats().events;
+    const BenchTiming on = TimeIterations(iterations, body);
+    traced_events += TraceCollectStats().events - before;
+    // TimeIterations runs one untimed warm-up call.
+    traced_frames += iterations + 1;
+    if (round == 0 || off.mean_ms < untraced.mean_ms) {
+      untraced = off;
+    }
+    if (round == 0 || on.mean_ms < traced.mean_ms) {
+      traced = on;
+    }
+  }
+  if (!was_tracing) {
+    TraceStop();
+  }
+
+  const double events_per_frame = static_cast<double>(traced_events) / traced_frames;
+  const double estimate_ms = events_per_frame * TraceCollectStats().ns_per_event * 1e-6;
+  PrintBenchLine("untraced", untraced);
+  char detail[160];
+  std::snprintf(detail, sizeof(detail), "measured %+.3f ms (%+.2f%%), %.0f events/frame, estimated %.4f ms",
+                traced.mean_ms - untraced.mean_ms, 100.0 * (traced.mean_ms / untraced.mean_ms - 1.0),
+                events_per_frame, estimate_ms);
+  PrintBenchLine("traced", traced, detail);
+  return true;
+}
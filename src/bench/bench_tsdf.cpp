@@ -0,0 +1,207 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/tsdf.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr int kFrames = 90;
+constexpr int kLongFrames = 300;
+constexpr double kFrameRate = 30.0;
+constexpr double kPi = 3.14159265358979;
+// A fused surface should sit well inside one voxel of the truth.
+constexpr double kMaxRaycastErrorMm = 10.0;
+constexpr double kMinRaycastCoverage = 0.8;
+// Revisiting the same surfaces must not keep allocating.
+constexpr double kMaxRevisitGrowth = 1.25;
+
+// The handheld sweep from the icp suite, a 3 s loop.
+SyntheticPose PoseAt(int frame) {
+  const double t = frame / kFrameRate;
+  const double phase = 2.0 * kPi * t / 3.0;
+  SyntheticPose pose;
+  pose.tx = static_cast<float>(200.0 * std::sin(phase));
+  pose.ty = static_cast<float>(-40.0 * std::sin(2.0 * phase));
+  pose.tz = static_cast<float>(250.0 * (1.0 - std::cos(phase)));
+  pose.yaw = static_cast<float>(0.2 * std::sin(phase));
+  return pose;
+}
+
+RigidTransform SceneFromCamera(const SyntheticPose &pose) {
+  RigidTransform transform;
+  const float c = std::cos(pose.yaw);
+  const float s = std::sin(pose.yaw);
+  const float r[9] = {c, 0.0f, s, 0.0f, 1.0f, 0.0f, -s, 0.0f, c};
+  std::copy(r, r + 9, transform.r);
+  transform.t[0] = pose.tx * 0.001f;
+  transform.t[1] = pose.ty * 0.001f;
+  transform.t[2] = pose.tz * 0.001f;
+  return transform;
+}
+
+// Edges shared by more than two triangles; zero for a manifold mesh.
+std::size_t NonManifoldEdges(const TriangleMesh &mesh) {
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> edges;
+  edges.reserve(mesh.indices.size());
+  for (std::size_t t = 0; t < mesh.triangleCount(); ++t) {
+    const std::uint32_t *tri = mesh.indices.data() + t * 3;
+    for (int k = 0; k < 3; ++k) {
+      const std::uint32_t a = tri[k];
+      const std::uint32_t b = tri[(k + 1) % 3];
+      edges.emplace_back(std::min(a, b), std::max(a, b));
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  std::size_t bad = 0;
+  for (std::size_t i = 0; i < edges.size();) {
+    std::size_t j = i;
+    while (j < edges.size() && edges[j] == edges[i]) {
+      ++j;
+    }
+    bad += j - i > 2 ? 1 : 0;
+    i = j;
+  }
+  return bad;
+}
+
+double Mib(std::size_t bytes) {
+  return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+}  // namespace
+
+bool BenchTsdf(const BenchOptions &options) {
+  const int iterations = options.iterations > 0 ? options.iterations : 3;
+  const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+  const SyntheticCamera camera = SyntheticDepthCamera(KinectGeneration::kV1);
+  const std::size_t pixels = static_cast<std::size_t>(camera.width) * camera.height;
+  bool ok = true;
+
+  SyntheticScene scene;
+  scene.setDepthNoise(1.0f);
+  std::vector<std::vector<std::uint16_t>> frames;
+  for (int f = 0; f < kFrames; ++f) {
+    frames.emplace_back(pixels);
+    scene.renderDepth(camera, 0.0, PoseAt(f), static_cast<std::uint64_t>(f), frames.back().data());
+  }
+  std::cout << " " << camera.width << "x" << camera.height << ", " << kFrames
+            << "-frame handheld sweep, ground-truth poses\n";
+
+  // Integration throughput, one thread and the pool.
+  std::vector<int> thread_counts = {1};
+  if (hardware > 1) {
+    thread_counts.push_back(0);
+  }
+  TsdfOptions tsdf_options;
+  TsdfVolume volume(tsdf_options);
+  for (int threads : thread_counts) {
+    tsdf_options.threads = threads;
+    volume.setOptions(tsdf_options);
+    std::size_t voxels = 0;
+    const BenchTiming timing = TimeIterations(iterations, [&] {
+      volume.clear();
+      voxels = 0;
+      for (int f = 0; f < kFrames; ++f) {
+        const TsdfIntegrateStats stats =
+            volume.integrate(frames[static_cast<std::size_t>(f)].data(), camera, SceneFromCamera(PoseAt(f)));
+        voxels += stats.blocks * 512;
+      }
+    });
+    BenchTiming per_frame = timing;
+    per_frame.mean_ms /= kFrames;
+    per_frame.min_ms /= kFrames;
+    per_frame.p50_ms /= kFrames;
+    char label[64];
+    std::snprintf(label, sizeof(label), "integrate %g mm voxels, %s", tsdf_options.voxel_size * 1000.0,
+                  threads == 1 ? "1 thread" : "thread pool");
+    char detail[96];
+    std::snprintf(detail, sizeof(detail), "%.0f Mvoxel/s, %zu blocks, %.1f MiB",
+                  static_cast<double>(voxels) / (timing.mean_ms * 1000.0), volume.blockCount(),
+                  Mib(volume.memoryBytes()));
+    PrintBenchLine(label, per_frame, detail);
+  }
+
+  // Raycast a pose from the middle of the sweep against a noise-free render.
+  {
+    const SyntheticPose pose = PoseAt(kFrames / 2 + 7);
+    SyntheticScene clean;
+    clean.setDepthNoise(0.0f);
+    std::vector<std::uint16_t> truth(pixels);
+    clean.renderDepth(camera, 0.0, pose, 0, truth.data());
+    std::vector<std::uint16_t> predicted(pixels);
+    NormalMap normals;
+    const BenchTiming timing = TimeIterations(
+        iterations, [&] { volume.raycast(camera, SceneFromCamera(pose), predicted.data(), &normals); });
+    double error_sum = 0.0;
+    std::size_t matched = 0;
+    std::size_t expected = 0;
+    for (std::size_t i = 0; i < pixels; ++i) {
+      if (truth[i] < tsdf_options.min_depth_mm || truth[i] > tsdf_options.max_depth_mm) {
+        continue;
+      }
+      ++expected;
+      if (predicted[i] != 0) {
+        error_sum += std::abs(static_cast<double>(predicted[i]) - truth[i]);
+        ++matched;
+      }
+    }
+    const double error = matched > 0 ? error_sum / static_cast<double>(matched) : 0.0;
+    const double coverage = expected > 0 ? static_cast<double>(matched) / static_cast<double>(expected) : 0.0;
+    char detail[96];
+    std::snprintf(detail, sizeof(detail), "mean error %.2f mm, coverage %.1f%%", error, coverage * 100.0);
+    PrintBenchLine("raycast depth + normals", timing, detail);
+    if (error > kMaxRaycastErrorMm || coverage < kMinRaycastCoverage) {
+      std::cerr << "  raycast error " << error << " mm, coverage " << coverage << "\n";
+      ok = false;
+    }
+  }
+
+  // Marching cubes and the binary PLY.
+  {
+    TriangleMesh mesh;
+    const BenchTiming extract = TimeIterations(iterations, [&] { volume.extractMesh(&mesh); });
+    char detail[96];
+    std::snprintf(detail, sizeof(detail), "%zu vertices, %zu triangles", mesh.vertexCount(), mesh.triangleCount());
+    PrintBenchLine("marching cubes", extract, detail);
+    const std::string path = BenchScratchDirectory() + "/tsdf_mesh.ply";
+    const BenchTiming write = TimeIterations(iterations, [&] { ok = WriteMeshPly(path, mesh) && ok; });
+    PrintBenchLine("mesh binary ply", write);
+    std::remove(path.c_str());
+    const std::size_t bad = NonManifoldEdges(mesh);
+    if (mesh.triangleCount() == 0 || bad > 0) {
+      std::cerr << "  mesh has " << mesh.triangleCount() << " triangles, " << bad << " non-manifold edges\n";
+      ok = false;
+    }
+  }
+
+  // Memory over a long sequence: the loop revisits the same surfaces, so
+  // blocks should stop growing once the first pass has covered them.
+  {
+    TsdfVolume long_volume;
+    std::vector<std::uint16_t> depth(pixels);
+    std::size_t first_loop = 0;
+    for (int f = 0; f < kLongFrames; ++f) {
+      scene.renderDepth(camera, 0.0, PoseAt(f), static_cast<std::uint64_t>(f), depth.data());
+      long_volume.integrate(depth.data(), camera, SceneFromCamera(PoseAt(f)));
+      if (f + 1 == kFrames) {
+        first_loop = long_volume.blockCount();
+      }
+      if ((f + 1) % 100 == 0 || f + 1 == kFrames) {
+        std::printf("  after %3d frames: %zu blocks, %.1f MiB\n", f + 1, long_volume.blockCount(),
+                    Mib(long_volume.memoryBytes()));
+      }
+    }
+    if (static_cast<double>(long_volume.blockCount()) > kMaxRevisitGrowth * static_cast<double>(first_loop)) {
+      std::cerr << "  blocks grew from " << first_loop << " to " << long_volume.blockCount() << " on revisits\n";
+      ok = false;
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,203 @@
+#include "backends/synthetic_scene.h"
+#include "bench/bench.h"
+#include "processing/depth_filter.h"
+#include "processing/voxel_grid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr int kSequenceFrames = 30;
+// Binary PLY vertex: float x/y/z plus three colour bytes.
+constexpr double kPlyVertexBytes = 15.0;
+// Floor of the synthetic room, in metres.
+constexpr float kFloorY = 0.9f;
+constexpr float kFloorBand = 0.03f;
+
+struct Accumulator {
+  double x = 0.0;
+  double y = 0.0;
+  double z = 0.0;
+  std::uint32_t count = 0;
+  std::uint32_t color[3] = {0, 0, 0};
+};
+
+// What the export would do with a standard container: one node per voxel in
+// a chained hash map, keyed by the packed cell, summing position and colour.
+std::size_t HashMapDownsample(const PointCloud &cloud, float size, double *centroid_sum) {
+  std::unordered_map<std::uint64_t, Accumulator> voxels;
+  const float inv = 1.0f / size;
+  for (std::size_t p = 0; p < cloud.size(); ++p) {
+    const float *point = cloud.xyz.data() + p * 3;
+    const auto cell = [&](int axis) {
+      return static_cast<std::uint64_t>(static_cast<std::int64_t>(std::floor(point[axis] * inv)) + (1 << 20)) &
+             0x1fffff;
+    };
+    Accumulator &voxel = voxels[cell(0) | cell(1) << 21 | cell(2) << 42];
+    voxel.x += point[0];
+    voxel.y += point[1];
+    voxel.z += point[2];
+    ++voxel.count;
+    for (int c = 0; c < 3; ++c) {
+      voxel.color[c] += cloud.rgb[p * 3 + c];
+    }
+  }
+  *centroid_sum = 0.0;
+  for (const auto &entry : voxels) {
+    const Accumulator &voxel = entry.second;
+    *centroid_sum += (voxel.x + voxel.y + voxel.z) / voxel.count;
+  }
+  return voxels.size();
+}
+
+double CentroidSum(const PointCloud &cloud) {
+  double sum = 0.0;
+  for (float value : cloud.xyz) {
+    sum += value;
+  }
+  return sum;
+}
+
+// RMS distance of floor points from the floor plane: downsampling should
+// average the sensor noise away rather than add error.
+double FloorRms(const PointCloud &cloud) {
+  double sum = 0.0;
+  std::size_t count = 0;
+  for (std::size_t p = 0; p < cloud.size(); ++p) {
+    const double e = cloud.xyz[p * 3 + 1] - kFloorY;
+    if (std::fabs(e) < kFloorBand) {
+      sum += e * e;
+      ++count;
+    }
+  }
+  return count > 0 ? std::sqrt(sum / static_cast<double>(count)) : 0.0;
+}
+
+}  // namespace
+
+bool BenchVoxelGrid(const BenchOptions &options) {
+  const SyntheticCamera camera = SyntheticDepthCamera(KinectGeneration::kV1);
+  const std::size_t pixels = static_cast<std::size_t>(camera.width) * camera.height;
+  const RayTable rays = BuildRayTable(camera);
+  SyntheticScene scene;
+  scene.setDepthNoise(1.0f);
+  std::vector<std::uint16_t> depth(pixels);
+  std::vector<std::uint8_t> rgb(pixels * 3);
+  // Frames go through the depth filter first, as a capture with filter=1
+  // does: raw axial noise would scatter one surface over several voxels.
+  DepthFilterOptions filter_options;
+  filter_options.enabled = true;
+  DepthFilterChain filter;
+  filter.setOptions(filter_options);
+  std::vector<PointCloud> frames(kSequenceFrames);
+  for (int f = 0; f < kSequenceFrames; ++f) {
+    const double time_s = f / 30.0;
+    scene.renderDepth(camera, time_s, SyntheticPose{}, static_cast<std::uint64_t>(f), depth.data());
+    filter.apply(depth.data(), camera.width, camera.height);
+    scene.renderColor(camera, time_s, rgb.data());
+    BackProjectDepth(depth.data(), rays, rgb.data(), nullptr, PointCloudOptions{}, &frames[f]);
+  }
+  const PointCloud &cloud = frames.back();
+
+  const int iterations = options.iterations > 0 ? options.iterations : 50;
+  const int slow_iterations = options.iterations > 0 ? options.iterations : 10;
+  const int hardware = static_cast<int>(std::thread::hardware_concurrency());
+  std::cout << " " << camera.width << "x" << camera.height << " frame, " << cloud.size() << " points\n";
+
+  bool ok = true;
+  PointCloud reduced;
+  const float sizes[] = {0.01f, 0.02f, 0.04f};
+  for (float size : sizes) {
+    VoxelGridOptions grid_options;
+    grid_options.voxel_size = size;
+    grid_options.threads = 1;
+    VoxelGrid grid(grid_options);
+    const BenchTiming one = TimeIterations(iterations, [&] {
+      grid.clear();
+      grid.insert(cloud);
+    });
+    grid.extract(&reduced);
+    char detail[96];
+    std::snprintf(detail, sizeof(detail), "%zu voxels, %.1fx smaller (%.2f -> %.2f MiB)", reduced.size(),
+                  static_cast<double>(cloud.size()) / std::max<std::size_t>(1, reduced.size()),
+                  cloud.size() * kPlyVertexBytes / (1024.0 * 1024.0),
+                  reduced.size() * kPlyVertexBytes / (1024.0 * 1024.0));
+    char label[64];
+    std::snprintf(label, sizeof(label), "voxel grid %.0f mm, 1 thread", size * 1000.0f);
+    PrintBenchLine(label, one, detail);
+    if (hardware > 1) {
+      grid_options.threads = 0;
+      grid.setOptions(grid_options);
+      char threads[32];
+      std::snprintf(threads, sizeof(threads), "%d threads", hardware);
+      std::snprintf(label, sizeof(label), "voxel grid %.0f mm, thread pool", size * 1000.0f);
+      PrintBenchLine(label, TimeIterations(iterations, [&] {
+                       grid.clear();
+                       grid.insert(cloud);
+                     }),
+                     threads);
+    }
+
+    double reference_sum = 0.0;
+    std::size_t reference_voxels = 0;
+    std::snprintf(label, sizeof(label), "std::unordered_map %.0f mm", size * 1000.0f);
+    PrintBenchLine(label, TimeIterations(slow_iterations, [&] {
+                     reference_voxels = HashMapDownsample(cloud, size, &reference_sum);
+                   }));
+    const double sum = CentroidSum(reduced);
+    if (reference_voxels != reduced.size() || std::fabs(sum - reference_sum) > 1e-4 * std::fabs(reference_sum) + 1e-2) {
+      std::cerr << "  voxel grid disagrees with the hash-map reference (" << reduced.size() << " vs "
+                << reference_voxels << " voxels)\n";
+      ok = false;
+    }
+  }
+
+  // Geometry at the default size.
+  const VoxelGridOptions defaults;
+  VoxelDownsample(cloud, defaults, &reduced);
+  const double before = FloorRms(cloud);
+  const double after = FloorRms(reduced);
+  char floor[96];
+  std::snprintf(floor, sizeof(floor), "  floor plane rms %.1f mm -> %.1f mm at %.0f mm voxels\n", before * 1000.0,
+                after * 1000.0, defaults.voxel_size * 1000.0f);
+  std::cout << floor;
+  if (after > before) {
+    std::cerr << "  downsampling moved the floor\n";
+    ok = false;
+  }
+
+  // Incremental accumulation over a second of frames.
+  VoxelGrid accumulated;
+  const BenchTiming sequence = TimeIterations(std::max(1, slow_iterations / 5), [&] {
+    accumulated.clear();
+    for (const PointCloud &frame : frames) {
+      accumulated.insert(frame);
+    }
+  });
+  char totals[96];
+  std::snprintf(totals, sizeof(totals), "%zu voxels from %d frames (%.2f ms/frame)", accumulated.voxelCount(),
+                kSequenceFrames, sequence.mean_ms / kSequenceFrames);
+  char label[64];
+  std::snprintf(label, sizeof(label), "accumulate %d frames at %.0f mm", kSequenceFrames, defaults.voxel_size * 1000.0f);
+  PrintBenchLine(label, sequence, totals);
+
+  // The memory bound holds and drops, rather than grows, when exceeded.
+  VoxelGridOptions bounded_options;
+  bounded_options.max_voxels = 8192;
+  VoxelGrid bounded(bounded_options);
+  for (const PointCloud &frame : frames) {
+    bounded.insert(frame);
+  }
+  if (bounded.voxelCount() > bounded_options.max_voxels || bounded.droppedCount() == 0) {
+    std::cerr << "  bounded grid holds " << bounded.voxelCount() << " voxels, dropped " << bounded.droppedCount()
+              << "\n";
+    ok = false;
+  }
+  return ok;
+}
@@ -6,6 +6,9 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, copy, readonly) NSData *rgbData;
 @property (nonatomic, copy, readonly) NSData *depthData;
 @property (nonatomic, copy, readonly) NSData *irData;
+// Color sampled at each depth pixel (RGB24, depth size) while registration is
+// enabled; empty otherwise.
+@property (nonatomic, copy) NSData *registeredRgbData;
 @property (nonatomic, readonly) NSInteger width;
 @property (nonatomic, readonly) NSInteger height;
 @property (nonatomic, readonly) NSTimeInterval timestamp;
@@ -61,10 +64,56 @@ NS_ASSUME_NONNULL_BEGIN
 - (BOOL)audioEnabled;
 - (float)audioLevel;
 
+// Depth/color registration (runs on a device worker thread).
+- (BOOL)setRegistrationEnabled:(BOOL)enabled;
+- (BOOL)registrationEnabled;
+
+// Depth denoising (median, spatial, temporal, hole fill) before delivery.
+- (BOOL)setDepthFilterEnabled:(BOOL)enabled;
+- (BOOL)depthFilterEnabled;
+
 // Status/capabilities
 - (NSDictionary *)deviceCapabilities;
+// Camera models: @{"serial", "fromDevice", "depth": @{"width", "height", "fx",
+// "fy", "cx", "cy", "k1", "k2", "k3", "p1", "p2"}, "color": @{...}}. The
+// camera entries are omitted while unknown.
+- (NSDictionary *)deviceCalibration;
+// Capture telemetry: @{"streams": @{"rgb": @{"fps", "jitterMs", ...}}, "stages": @{...}}
+- (NSDictionary *)deviceTelemetry;
+
+// Pipeline tracing (Chrome trace-event JSON)
+- (void)setTracingEnabled:(BOOL)enabled;
+- (BOOL)writeTraceToPath:(NSString *)path;
+- (void)traceInstant:(NSString *)name;
 - (NSString *)lastError;
 
+// Point-cloud export (binary little-endian PLY, metres). rgb (RGB24) and ir
+// (8-bit) are used only when they are exactly depth sized (e.g. a frame's
+// registeredRgbData); pass empty data to skip them.
+// calibration is a -deviceCalibration snapshot (nil = nominal intrinsics);
+// its ray tables are cached on disk per serial. Returns the number of points
+// written, or -1 on failure. Thread-safe.
++ (NSInteger)writePointCloudPLYToPath:(NSString *)path
+                                depth:(NSData *)depth
+                                  rgb:(NSData *)rgb
+                                   ir:(NSData *)ir
+                                width:(NSInteger)width
+                               height:(NSInteger)height
+                           generation:(NSInteger)generation
+                          calibration:(nullable NSDictionary *)calibration;
+
+// Organized-grid surface of a depth frame (binary little-endian PLY, metres,
+// vertex colours from a depth-sized rgb). Same depth, rgb and calibration
+// rules as the point-cloud export. Returns the number of triangles written,
+// or -1 on failure. Thread-safe.
++ (NSInteger)writeMeshPLYToPath:(NSString *)path
+                          depth:(NSData *)depth
+                            rgb:(NSData *)rgb
+                          width:(NSInteger)width
+                         height:(NSInteger)height
+                     generation:(NSInteger)generation
+                    calibration:(nullable NSDictionary *)calibration;
+
 @end
 
 NS_ASSUME_NONNULL_END
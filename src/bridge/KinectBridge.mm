@@ -1,11 +1,75 @@
 #import "KinectBridge.h"
 
 #include "../backends/backend.h"
+#include "../backends/synthetic_backend.h"
+#include "../core/trace.h"
+#include "../processing/depth_filter.h"
+#include "../processing/organized_mesh.h"
+#include "../processing/point_cloud.h"
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+namespace {
+
+NSDictionary *IntrinsicsDictionary(const CameraIntrinsics &intrinsics) {
+  return @{
+    @"width": @(intrinsics.width),
+    @"height": @(intrinsics.height),
+    @"fx": @(intrinsics.fx),
+    @"fy": @(intrinsics.fy),
+    @"cx": @(intrinsics.cx),
+    @"cy": @(intrinsics.cy),
+    @"k1": @(intrinsics.distortion.k1),
+    @"k2": @(intrinsics.distortion.k2),
+    @"k3": @(intrinsics.distortion.k3),
+    @"p1": @(intrinsics.distortion.p1),
+    @"p2": @(intrinsics.distortion.p2)
+  };
+}
+
+CameraIntrinsics IntrinsicsFromDictionary(NSDictionary *dictionary) {
+  CameraIntrinsics intrinsics;
+  if (![dictionary isKindOfClass:[NSDictionary class]]) {
+    return intrinsics;
+  }
+  intrinsics.width = [dictionary[@"width"] intValue];
+  intrinsics.height = [dictionary[@"height"] intValue];
+  intrinsics.fx = [dictionary[@"fx"] floatValue];
+  intrinsics.fy = [dictionary[@"fy"] floatValue];
+  intrinsics.cx = [dictionary[@"cx"] floatValue];
+  intrinsics.cy = [dictionary[@"cy"] floatValue];
+  intrinsics.distortion.k1 = [dictionary[@"k1"] floatValue];
+  intrinsics.distortion.k2 = [dictionary[@"k2"] floatValue];
+  intrinsics.distortion.k3 = [dictionary[@"k3"] floatValue];
+  intrinsics.distortion.p1 = [dictionary[@"p1"] floatValue];
+  intrinsics.distortion.p2 = [dictionary[@"p2"] floatValue];
+  return intrinsics;
+}
+
+// Ray table for exporting a depth frame: the device's intrinsics from a
+// -deviceCalibration snapshot, else nominal ones; device tables are cached
+// on disk per serial.
+std::shared_ptr<const RayTable> ExportRays(NSInteger width, NSInteger height, NSInteger generation,
+                                           NSDictionary *calibration) {
+  const KinectGeneration kind = generation == 2 ? KinectGeneration::kV2 : KinectGeneration::kV1;
+  DeviceCalibration device;
+  if (calibration != nil) {
+    NSString *serial = calibration[@"serial"];
+    device.serial = [serial isKindOfClass:[NSString class]] ? std::string([serial UTF8String]) : std::string();
+    device.depth = IntrinsicsFromDictionary(calibration[@"depth"]);
+    device.from_device = [calibration[@"fromDevice"] boolValue];
+  }
+  const CameraIntrinsics intrinsics =
+      ResolveDepthIntrinsics(device, kind, static_cast<int>(width), static_cast<int>(height));
+  // Only a live device's own tables are worth persisting.
+  return CachedRayTable(intrinsics, device.from_device && intrinsics == device.depth ? device.serial : std::string());
+}
+
+}  // namespace
+
 @implementation KinectFrame
 
 - (instancetype)initWithRgb:(NSData *)rgb
@@ -22,6 +86,7 @@
     _width = width;
     _height = height;
     _timestamp = timestamp;
+    _registeredRgbData = [NSData data];
   }
   return self;
 }
@@ -67,7 +132,10 @@
   _streaming = NO;
 
   _selectedGeneration = backendType;
-  if (backendType == 2) {
+  if (auto synthetic = CreateSyntheticBackendFromEnvironment()) {
+    // KINECT_SYNTHETIC replaces both hardware backends.
+    _backend = std::move(synthetic);
+  } else if (backendType == 2) {
     _backend = CreateKinectV2Backend();
   } else {
     _backend = CreateKinectV1Backend();
@@ -87,6 +155,20 @@
 - (NSArray<NSDictionary *> *)discoverDevices {
   NSMutableArray<NSDictionary *> *result = [NSMutableArray array];
 
+  if (auto synthetic = CreateSyntheticBackendFromEnvironment()) {
+    const NSInteger generation = synthetic->generation() == KinectGeneration::kV2 ? 2 : 1;
+    for (const auto &dev : synthetic->listDevices()) {
+      NSString *serial = [NSString stringWithUTF8String:dev.serial.c_str()];
+      NSString *name = [NSString stringWithUTF8String:dev.name.c_str()];
+      [result addObject:@{
+        @"generation": @(generation),
+        @"serial": serial ?: @"",
+        @"name": name ?: @"Synthetic Kinect"
+      }];
+    }
+    return result;
+  }
+
   {
     auto backend = CreateKinectV1Backend();
     if (backend) {
@@ -197,23 +279,29 @@
     return nil;
   }
 
+  KINECT_TRACE_SCOPE("bridge.pollFrame");
   _device->update();
   if (!_device->getFrame(_frame)) {
     return nil;
   }
 
+  KINECT_TRACE_SCOPE("bridge.nsdata_copy");
   NSData *rgb = _frame.rgb.empty() ? [NSData data] : [NSData dataWithBytes:_frame.rgb.data() length:_frame.rgb.size()];
   NSData *depth = _frame.depth.empty() ? [NSData data]
                                        : [NSData dataWithBytes:_frame.depth.data()
                                                       length:_frame.depth.size() * sizeof(uint16_t)];
   NSData *ir = _frame.ir.empty() ? [NSData data] : [NSData dataWithBytes:_frame.ir.data() length:_frame.ir.size()];
 
-  return [[KinectFrame alloc] initWithRgb:rgb
-                                    depth:depth
-                                       ir:ir
-                                    width:_frame.width
-                                   height:_frame.height
-                                timestamp:(NSTimeInterval)_frame.timestamp / 1000.0];
+  KinectFrame *frame = [[KinectFrame alloc] initWithRgb:rgb
+                                                  depth:depth
+                                                     ir:ir
+                                                  width:_frame.width
+                                                 height:_frame.height
+                                              timestamp:(NSTimeInterval)_frame.timestamp / 1000.0];
+  if (!_frame.registered_rgb.empty()) {
+    frame.registeredRgbData = [NSData dataWithBytes:_frame.registered_rgb.data() length:_frame.registered_rgb.size()];
+  }
+  return frame;
 }
 
 - (BOOL)isStreaming {
@@ -300,6 +388,36 @@
   return _device->audioLevel();
 }
 
+- (BOOL)setRegistrationEnabled:(BOOL)enabled {
+  if (!_device) {
+    return NO;
+  }
+  return _device->setRegistrationEnabled(enabled);
+}
+
+- (BOOL)registrationEnabled {
+  if (!_device) {
+    return NO;
+  }
+  return _device->registrationEnabled();
+}
+
+- (BOOL)setDepthFilterEnabled:(BOOL)enabled {
+  if (!_device) {
+    return NO;
+  }
+  DepthFilterOptions options;
+  options.enabled = enabled;
+  return _device->setDepthFilter(options);
+}
+
+- (BOOL)depthFilterEnabled {
+  if (!_device) {
+    return NO;
+  }
+  return _device->depthFilterEnabled();
+}
+
 - (NSDictionary *)deviceCapabilities {
   if (!_device) {
     return @{
@@ -320,8 +438,146 @@
   };
 }
 
+- (NSDictionary *)deviceCalibration {
+  if (!_device) {
+    return @{};
+  }
+  const DeviceCalibration calibration = _device->calibration();
+  NSMutableDictionary *result = [NSMutableDictionary dictionary];
+  result[@"serial"] = [NSString stringWithUTF8String:calibration.serial.c_str()];
+  result[@"fromDevice"] = @(calibration.from_device);
+  if (calibration.depth.valid()) {
+    result[@"depth"] = IntrinsicsDictionary(calibration.depth);
+  }
+  if (calibration.color.valid()) {
+    result[@"color"] = IntrinsicsDictionary(calibration.color);
+  }
+  return result;
+}
+
+- (NSDictionary *)deviceTelemetry {
+  if (!_device) {
+    return @{@"streams": @{}, @"stages": @{}};
+  }
+
+  const TelemetrySnapshot snapshot = _device->telemetrySnapshot();
+  NSMutableDictionary *streams = [NSMutableDictionary dictionary];
+  for (std::size_t i = 0; i < kTelemetryStreamCount; ++i) {
+    const auto stream = static_cast<TelemetryStream>(i);
+    const StreamSnapshot &stats = snapshot.stream(stream);
+    streams[[NSString stringWithUTF8String:TelemetryStreamLabel(stream)]] = @{
+      @"fps": @(stats.fps),
+      @"jitterMs": @(stats.jitter_ms),
+      @"latencyP50Ms": @(stats.latency_p50_ms),
+      @"latencyP99Ms": @(stats.latency_p99_ms),
+      @"dropped": @(stats.dropped),
+      @"frames": @(stats.frames)
+    };
+  }
+
+  NSMutableDictionary *stages = [NSMutableDictionary dictionary];
+  for (std::size_t i = 0; i < kTelemetryStageCount; ++i) {
+    const auto stage = static_cast<TelemetryStage>(i);
+    const StageSnapshot &stats = snapshot.stage(stage);
+    stages[[NSString stringWithUTF8String:TelemetryStageLabel(stage)]] = @{
+      @"avgMs": @(stats.avg_ms),
+      @"recentMs": @(stats.recent_ms),
+      @"maxMs": @(stats.max_ms),
+      @"samples": @(stats.samples)
+    };
+  }
+
+  return @{@"streams": streams, @"stages": stages};
+}
+
+- (void)setTracingEnabled:(BOOL)enabled {
+  if (enabled) {
+    TraceStart();
+  } else {
+    TraceStop();
+  }
+}
+
+- (BOOL)writeTraceToPath:(NSString *)path {
+  return TraceWriteChromeJson([path UTF8String]) ? YES : NO;
+}
+
+- (void)traceInstant:(NSString *)name {
+  if (!TraceIsEnabled()) {
+    return;
+  }
+  // Names must outlive the dump; Swift marker names are a small fixed set.
+  static std::mutex names_mutex;
+  static std::vector<std::unique_ptr<std::string>> names;
+  const std::string value = [name UTF8String];
+  const char *stable = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(names_mutex);
+    for (const auto &existing : names) {
+      if (*existing == value) {
+        stable = existing->c_str();
+        break;
+      }
+    }
+    if (stable == nullptr) {
+      names.push_back(std::make_unique<std::string>(value));
+      stable = names.back()->c_str();
+    }
+  }
+  TraceInstant(stable);
+}
+
 - (NSString *)lastError {
   return _lastError ?: @"";
 }
 
++ (NSInteger)writePointCloudPLYToPath:(NSString *)path
+                                depth:(NSData *)depth
+                                  rgb:(NSData *)rgb
+                                   ir:(NSData *)ir
+                                width:(NSInteger)width
+                               height:(NSInteger)height
+                           generation:(NSInteger)generation
+                          calibration:(nullable NSDictionary *)calibration {
+  const std::size_t pixels = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+  if (pixels == 0 || depth.length < pixels * sizeof(uint16_t)) {
+    return -1;
+  }
+
+  const std::shared_ptr<const RayTable> rays = ExportRays(width, height, generation, calibration);
+  // A full-resolution color plane (1920x1080 on v2) is not in depth layout.
+  const uint8_t *rgb_bytes = rgb.length == pixels * 3 ? static_cast<const uint8_t *>(rgb.bytes) : nullptr;
+  const uint8_t *ir_bytes = ir.length >= pixels ? static_cast<const uint8_t *>(ir.bytes) : nullptr;
+
+  PointCloud cloud;
+  BackProjectDepth(static_cast<const uint16_t *>(depth.bytes), *rays, rgb_bytes, ir_bytes, PointCloudOptions{},
+                   &cloud);
+  if (!WritePointCloudPly([path UTF8String], cloud, PlyFormat::kBinaryLittleEndian)) {
+    return -1;
+  }
+  return static_cast<NSInteger>(cloud.size());
+}
+
++ (NSInteger)writeMeshPLYToPath:(NSString *)path
+                          depth:(NSData *)depth
+                            rgb:(NSData *)rgb
+                          width:(NSInteger)width
+                         height:(NSInteger)height
+                     generation:(NSInteger)generation
+                    calibration:(nullable NSDictionary *)calibration {
+  const std::size_t pixels = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+  if (pixels == 0 || depth.length < pixels * sizeof(uint16_t)) {
+    return -1;
+  }
+  const std::shared_ptr<const RayTable> rays = ExportRays(width, height, generation, calibration);
+  const uint8_t *rgb_bytes = rgb.length == pixels * 3 ? static_cast<const uint8_t *>(rgb.bytes) : nullptr;
+
+  OrganizedMesher mesher;
+  if (!mesher.write([path UTF8String], MeshFileFormat::kBinaryPly, static_cast<const uint16_t *>(depth.bytes), *rays,
+                    rgb_bytes)) {
+    return -1;
+  }
+  return static_cast<NSInteger>(mesher.stats().triangles);
+}
+
 @end
@@ -2,6 +2,12 @@
 #include <libfreenect_audio.h>
 #include <libfreenect_registration.h>
 
+#include "core/telemetry.h"
+#include "core/trace.h"
+#include "processing/organized_mesh.h"
+#include "processing/point_cloud.h"
+#include "processing/voxel_grid.h"
+
 #include <algorithm>
 #include <cassert>
 #include <chrono>
@@ -61,8 +67,9 @@ uint8_t *g_rgb_front = nullptr;
 
 int g_got_rgb = 0;
 int g_got_depth = 0;
-std::uint64_t g_rgb_frames = 0;
-std::uint64_t g_depth_frames = 0;
+std::uint64_t g_rgb_arrival_ns = 0;
+std::uint64_t g_depth_arrival_ns = 0;
+DeviceTelemetry g_telemetry;
 
 GLuint g_gl_depth_tex = 0;
 GLuint g_gl_rgb_tex = 0;
@@ -176,6 +183,7 @@ void PrintHelp() {
             << "  -/=: decrease/increase IR brightness\n"
             << "  a: start/stop microphone recording (WAV)\n"
             << "  c: capture color+depth+point cloud\n"
+            << "  t: start/stop a Chrome trace (captures/trace-*.json)\n"
             << "  h: print this help\n\n";
 }
 
@@ -395,6 +403,7 @@ void DepthToFalseColor(uint16_t mm, uint8_t *rgb) {
 }
 
 bool SaveColorPpm(const std::string &path, const std::vector<uint8_t> &rgb) {
+  KINECT_TRACE_SCOPE("capture.save_color_ppm");
   std::ofstream out(path, std::ios::binary);
   if (!out.is_open()) {
     return false;
@@ -405,76 +414,85 @@ bool SaveColorPpm(const std::string &path, const std::vector<uint8_t> &rgb) {
 }
 
 bool SaveDepthPgm16(const std::string &path, const std::vector<uint16_t> &depth) {
+  KINECT_TRACE_SCOPE("capture.save_depth_pgm");
   std::ofstream out(path, std::ios::binary);
   if (!out.is_open()) {
     return false;
   }
   out << "P5\n" << kFrameWidth << " " << kFrameHeight << "\n65535\n";
-  for (uint16_t value : depth) {
-    const char hi = static_cast<char>((value >> 8) & 0xff);
-    const char lo = static_cast<char>(value & 0xff);
-    out.put(hi);
-    out.put(lo);
+  // PGM samples are big-endian; swap into one buffer and write it at once.
+  std::vector<char> bytes(depth.size() * 2);
+  for (std::size_t i = 0; i < depth.size(); ++i) {
+    bytes[i * 2 + 0] = static_cast<char>((depth[i] >> 8) & 0xff);
+    bytes[i * 2 + 1] = static_cast<char>(depth[i] & 0xff);
   }
+  out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
   return out.good();
 }
 
+// freenect_camera_to_world is linear in depth, so sample it once per pixel
+// at 1 m and reuse the rays for every capture. Requires g_dev.
+const RayTable &CaptureRays() {
+  static const RayTable rays = BuildRayTable(kFrameWidth, kFrameHeight, [](int u, int v, float *rx, float *ry) {
+    double wx = 0.0;
+    double wy = 0.0;
+    freenect_camera_to_world(g_dev, u, v, 1000, &wx, &wy);
+    *rx = static_cast<float>(wx / 1000.0);
+    *ry = static_cast<float>(wy / 1000.0);
+  });
+  return rays;
+}
+
+// Writes the full-resolution scan to |path| and, when |voxel_path| is not
+// empty, a 20 mm voxel-downsampled copy whose point count goes to
+// |voxel_points|.
 std::size_t SavePointCloudPly(
     const std::string &path,
     const std::vector<uint16_t> &depth,
-    const std::vector<uint8_t> &rgb) {
+    const std::vector<uint8_t> &rgb,
+    const std::string &voxel_path,
+    std::size_t *voxel_points) {
+  KINECT_TRACE_SCOPE("capture.save_point_cloud");
   if (g_dev == nullptr) {
     return 0;
   }
+  const RayTable &rays = CaptureRays();
 
-  std::size_t valid_points = 0;
-  for (std::size_t i = 0; i < depth.size(); ++i) {
-    const uint16_t d = depth[i];
-    if (d >= 350 && d <= 6000) {
-      ++valid_points;
-    }
+  PointCloudOptions options;
+  options.units_per_mm = 1.0f;
+  PointCloud cloud;
+  BackProjectDepth(depth.data(), rays, rgb.data(), nullptr, options, &cloud);
+  if (!WritePointCloudPly(path, cloud, PlyFormat::kBinaryLittleEndian)) {
+    return 0;
   }
+  if (!voxel_path.empty()) {
+    VoxelGridOptions voxel_options;
+    voxel_options.voxel_size = 20.0f;
+    PointCloud reduced;
+    VoxelDownsample(cloud, voxel_options, &reduced);
+    *voxel_points = WritePointCloudPly(voxel_path, reduced, PlyFormat::kBinaryLittleEndian) ? reduced.size() : 0;
+  }
+  return cloud.size();
+}
 
-  std::ofstream out(path);
-  if (!out.is_open()) {
+// Writes the frame's organized-grid surface (millimetres, vertex colours)
+// and returns its triangle count.
+std::size_t SaveMeshPly(const std::string &path, const std::vector<uint16_t> &depth, const std::vector<uint8_t> &rgb) {
+  KINECT_TRACE_SCOPE("capture.save_mesh");
+  if (g_dev == nullptr) {
     return 0;
   }
-
-  out << "ply\n";
-  out << "format ascii 1.0\n";
-  out << "element vertex " << valid_points << "\n";
-  out << "property float x\n";
-  out << "property float y\n";
-  out << "property float z\n";
-  out << "property uchar red\n";
-  out << "property uchar green\n";
-  out << "property uchar blue\n";
-  out << "end_header\n";
-
-  for (int y = 0; y < kFrameHeight; ++y) {
-    for (int x = 0; x < kFrameWidth; ++x) {
-      const std::size_t index = static_cast<std::size_t>(y) * kFrameWidth + x;
-      const uint16_t d = depth[index];
-      if (d < 350 || d > 6000) {
-        continue;
-      }
-
-      double wx = 0.0;
-      double wy = 0.0;
-      freenect_camera_to_world(g_dev, x, y, d, &wx, &wy);
-
-      const uint8_t r = rgb[index * 3 + 0];
-      const uint8_t g = rgb[index * 3 + 1];
-      const uint8_t b = rgb[index * 3 + 2];
-      out << wx << " " << wy << " " << d << " " << static_cast<int>(r) << " " << static_cast<int>(g) << " "
-          << static_cast<int>(b) << "\n";
-    }
+  OrganizedMeshOptions options;
+  options.units_per_mm = 1.0f;
+  OrganizedMesher mesher(options);
+  if (!mesher.write(path, MeshFileFormat::kBinaryPly, depth.data(), CaptureRays(), rgb.data())) {
+    return 0;
   }
-
-  return valid_points;
+  return mesher.stats().triangles;
 }
 
 void CaptureFrameBundle() {
+  KINECT_TRACE_SCOPE("capture.bundle");
   std::vector<uint8_t> rgb(static_cast<std::size_t>(kFrameRgbBytes));
   std::vector<uint16_t> depth(static_cast<std::size_t>(kFramePixels));
 
@@ -494,11 +512,32 @@ void CaptureFrameBundle() {
 
   const bool color_ok = SaveColorPpm(dir + "/color.ppm", rgb);
   const bool depth_ok = SaveDepthPgm16(dir + "/depth_mm.pgm", depth);
-  const std::size_t points = SavePointCloudPly(dir + "/scan.ply", depth, rgb);
+  std::size_t voxel_points = 0;
+  const std::size_t points = SavePointCloudPly(dir + "/scan.ply", depth, rgb, dir + "/scan_voxel.ply", &voxel_points);
+  const std::size_t triangles = SaveMeshPly(dir + "/scan_mesh.ply", depth, rgb);
 
   std::ostringstream msg;
   msg << "Capture saved to " << dir << " (color=" << (color_ok ? "ok" : "fail")
-      << ", depth=" << (depth_ok ? "ok" : "fail") << ", points=" << points << ")";
+      << ", depth=" << (depth_ok ? "ok" : "fail") << ", points=" << points << ", voxels=" << voxel_points << ", triangles=" << triangles << ")";
+  SetStatus(msg.str());
+}
+
+void ToggleTrace() {
+  if (!TraceIsEnabled()) {
+    TraceStart();
+    SetStatus("Tracing started. Press t again to write the trace.");
+    return;
+  }
+
+  mkdir("captures", 0755);
+  const std::string path = "captures/trace-" + TimestampNow() + ".json";
+  const TraceStats stats = TraceCollectStats();
+  if (!TraceWriteChromeJson(path)) {
+    SetStatus("Could not write trace to " + path);
+    return;
+  }
+  std::ostringstream msg;
+  msg << "Trace saved to " << path << " (" << stats.events << " events, " << stats.threads << " threads)";
   SetStatus(msg.str());
 }
 
@@ -528,15 +567,19 @@ void DrawGLScene() {
   while (!g_got_depth && !g_got_rgb) {
     pthread_cond_wait(&g_frame_cond, &g_frame_mutex);
   }
+  KINECT_TRACE_SCOPE("cc.draw_scene");
 
+  const std::uint64_t now = TelemetryNowNs();
   if (g_got_depth) {
     std::swap(g_depth_mm_front, g_depth_mm_mid);
     std::swap(g_depth_rgb_front, g_depth_rgb_mid);
     g_got_depth = 0;
+    g_telemetry.stream(TelemetryStream::kDepth).recordLatency(now - g_depth_arrival_ns);
   }
   if (g_got_rgb) {
     std::swap(g_rgb_front, g_rgb_mid);
     g_got_rgb = 0;
+    g_telemetry.stream(TelemetryStream::kRgb).recordLatency(now - g_rgb_arrival_ns);
   }
   pthread_mutex_unlock(&g_frame_mutex);
 
@@ -555,7 +598,7 @@ void DrawGLScene() {
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, kFrameWidth, kFrameHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, g_depth_rgb_front);
 
   const int margin = 10;
-  const int info_height = 150;
+  const int info_height = 166;
   const int available_height = std::max(200, g_window_height - info_height - 2 * margin);
   int panel_width = (g_window_width - 3 * margin) / 2;
   int panel_height = panel_width * 3 / 4;
@@ -583,13 +626,27 @@ void DrawGLScene() {
   DrawText(10.0f, y, "Kinect Control Center (v1)   ESC: quit   h: help");
   y -= 16.0f;
 
+  const TelemetrySnapshot telemetry = g_telemetry.snapshot();
+  const StreamSnapshot &rgb_stats = telemetry.stream(TelemetryStream::kRgb);
+  const StreamSnapshot &depth_stats = telemetry.stream(TelemetryStream::kDepth);
+
   std::ostringstream line2;
   line2 << "tilt=" << g_freenect_angle << "deg  led=" << static_cast<int>(g_led_mode)
         << "  video=" << VideoFormatLabel(g_current_video_format) << "  depth=" << DepthFormatLabel(g_current_depth_format)
-        << "  fps(rgb/depth)=" << g_rgb_frames << "/" << g_depth_frames;
+        << "  fps(rgb/depth)=" << std::fixed << std::setprecision(1) << rgb_stats.fps << "/" << depth_stats.fps;
   DrawText(10.0f, y, line2.str());
   y -= 16.0f;
 
+  std::ostringstream line_perf;
+  line_perf << std::fixed << std::setprecision(2) << "jitter(rgb/depth)=" << rgb_stats.jitter_ms << "/"
+            << depth_stats.jitter_ms << "ms  latency p50/p99(rgb)=" << rgb_stats.latency_p50_ms << "/"
+            << rgb_stats.latency_p99_ms << "ms  (depth)=" << depth_stats.latency_p50_ms << "/"
+            << depth_stats.latency_p99_ms << "ms  dropped(rgb/depth)=" << rgb_stats.dropped << "/"
+            << depth_stats.dropped << "  depth_colorize="
+            << telemetry.stage(TelemetryStage::kDepthConvert).recent_ms << "ms";
+  DrawText(10.0f, y, line_perf.str());
+  y -= 16.0f;
+
   std::ostringstream line3;
   line3 << "auto_exp=" << OnOffLabel(g_auto_exposure) << "  auto_wb=" << OnOffLabel(g_auto_white_balance)
         << "  mirror=" << OnOffLabel(g_mirror)
@@ -759,6 +816,10 @@ void keyPressed(unsigned char key, int, int) {
     CaptureFrameBundle();
     return;
   }
+  if (key == 't' || key == 'T') {
+    ToggleTrace();
+    return;
+  }
 
   if (key == '0') {
     g_led_mode = LED_OFF;
@@ -798,21 +859,31 @@ void keyPressed(unsigned char key, int, int) {
   }
 }
 
-void depth_cb(freenect_device *, void *v_depth, uint32_t) {
+void depth_cb(freenect_device *, void *v_depth, uint32_t timestamp) {
+  KINECT_TRACE_SCOPE("cc.depth_callback");
   const auto *depth = static_cast<uint16_t *>(v_depth);
+  const std::uint64_t arrival = TelemetryNowNs();
+  g_telemetry.stream(TelemetryStream::kDepth).recordArrival(arrival, timestamp);
 
   pthread_mutex_lock(&g_frame_mutex);
-  std::memcpy(g_depth_mm_mid, depth, static_cast<std::size_t>(kFramePixels) * sizeof(uint16_t));
-  for (int i = 0; i < kFramePixels; ++i) {
-    DepthToFalseColor(g_depth_mm_mid[i], g_depth_rgb_mid + i * 3);
+  {
+    ScopedStageTimer timer(g_telemetry.stage(TelemetryStage::kDepthConvert));
+    std::memcpy(g_depth_mm_mid, depth, static_cast<std::size_t>(kFramePixels) * sizeof(uint16_t));
+    for (int i = 0; i < kFramePixels; ++i) {
+      DepthToFalseColor(g_depth_mm_mid[i], g_depth_rgb_mid + i * 3);
+    }
   }
   g_got_depth = 1;
-  ++g_depth_frames;
+  g_depth_arrival_ns = arrival;
   pthread_cond_signal(&g_frame_cond);
   pthread_mutex_unlock(&g_frame_mutex);
 }
 
-void rgb_cb(freenect_device *, void *rgb, uint32_t) {
+void rgb_cb(freenect_device *, void *rgb, uint32_t timestamp) {
+  KINECT_TRACE_SCOPE("cc.video_callback");
+  const std::uint64_t arrival = TelemetryNowNs();
+  g_telemetry.stream(TelemetryStream::kRgb).recordArrival(arrival, timestamp);
+
   pthread_mutex_lock(&g_frame_mutex);
 
   if (g_current_video_format == FREENECT_VIDEO_RGB || g_current_video_format == FREENECT_VIDEO_YUV_RGB) {
@@ -825,7 +896,7 @@ void rgb_cb(freenect_device *, void *rgb, uint32_t) {
   }
 
   g_got_rgb = 1;
-  ++g_rgb_frames;
+  g_rgb_arrival_ns = arrival;
   pthread_cond_signal(&g_frame_cond);
   pthread_mutex_unlock(&g_frame_mutex);
 }
@@ -839,6 +910,7 @@ void audio_in_cb(
     int32_t *mic4,
     int16_t *cancelled,
     void *) {
+  g_telemetry.stream(TelemetryStream::kAudio).recordArrival(TelemetryNowNs(), 0, false);
   std::lock_guard<std::mutex> lock(g_audio_mutex);
 
   if (cancelled != nullptr && num_samples > 0) {
@@ -853,6 +925,7 @@ void audio_in_cb(
     return;
   }
 
+  KINECT_TRACE_SCOPE("capture.write_wav");
   auto write_i32 = [&](WavSink *sink, int32_t *samples) {
     if (sink->file != nullptr && samples != nullptr) {
       std::fwrite(samples, sizeof(int32_t), static_cast<std::size_t>(num_samples), sink->file);
@@ -874,6 +947,7 @@ void audio_in_cb(
 }
 
 void *freenect_threadfunc(void *) {
+  KINECT_TRACE_THREAD_NAME("freenect-events");
   freenect_set_tilt_degs(g_dev, g_freenect_angle);
   freenect_set_led(g_dev, g_led_mode);
 
@@ -0,0 +1,55 @@
+#include "core/calibration.h"
+
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct CalibrationRegistry {
+  std::mutex mutex;
+  std::vector<DeviceCalibration> entries;
+};
+
+CalibrationRegistry &GlobalCalibrationRegistry() {
+  static CalibrationRegistry registry;
+  return registry;
+}
+
+}  // namespace
+
+bool operator==(const CameraIntrinsics &a, const CameraIntrinsics &b) {
+  return a.width == b.width && a.height == b.height && a.fx == b.fx && a.fy == b.fy && a.cx == b.cx &&
+         a.cy == b.cy && a.distortion.k1 == b.distortion.k1 && a.distortion.k2 == b.distortion.k2 &&
+         a.distortion.k3 == b.distortion.k3 && a.distortion.p1 == b.distortion.p1 &&
+         a.distortion.p2 == b.distortion.p2;
+}
+
+bool LookupCalibration(const std::string &serial, DeviceCalibration *calibration) {
+  if (serial.empty()) {
+    return false;
+  }
+  CalibrationRegistry &registry = GlobalCalibrationRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (const DeviceCalibration &entry : registry.entries) {
+    if (entry.serial == serial) {
+      *calibration = entry;
+      return true;
+    }
+  }
+  return false;
+}
+
+void RememberCalibration(const DeviceCalibration &calibration) {
+  if (calibration.serial.empty()) {
+    return;
+  }
+  CalibrationRegistry &registry = GlobalCalibrationRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (DeviceCalibration &entry : registry.entries) {
+    if (entry.serial == calibration.serial) {
+      entry = calibration;
+      return;
+    }
+  }
+  registry.entries.push_back(calibration);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+
+// Brown-Conrady lens distortion in normalised image coordinates (libfreenect2
+// convention: radial k1..k3, tangential p1, p2).
+struct LensDistortion {
+  float k1 = 0.0f;
+  float k2 = 0.0f;
+  float k3 = 0.0f;
+  float p1 = 0.0f;
+  float p2 = 0.0f;
+
+  bool isZero() const { return k1 == 0.0f && k2 == 0.0f && k3 == 0.0f && p1 == 0.0f && p2 == 0.0f; }
+};
+
+// Pinhole model of one depth (or color) stream in pixels.
+struct CameraIntrinsics {
+  int width = 0;
+  int height = 0;
+  float fx = 0.0f;
+  float fy = 0.0f;
+  float cx = 0.0f;
+  float cy = 0.0f;
+  LensDistortion distortion;
+
+  bool valid() const { return width > 0 && height > 0 && fx > 0.0f && fy > 0.0f; }
+};
+
+bool operator==(const CameraIntrinsics &a, const CameraIntrinsics &b);
+inline bool operator!=(const CameraIntrinsics &a, const CameraIntrinsics &b) {
+  return !(a == b);
+}
+
+// How a depth pixel lands in the color image. Kinect v2 factory data holds a
+// cubic polynomial over undistorted depth coordinates (libfreenect2
+// ColorCameraParams mx_*/my_* terms, highest order first: x3y0, x0y3, x2y1,
+// x1y2, x2y0, x0y2, x1y1, x1y0, x0y1, x0y0). Without one the cameras are
+// treated as a rectified pair |baseline_mm| apart along +x.
+struct DepthToColorModel {
+  bool has_polynomial = false;
+  float shift_d = 0.0f;
+  float shift_m = 0.0f;
+  float mx[10] = {};
+  float my[10] = {};
+  float baseline_mm = 0.0f;
+};
+
+// Per-device camera models. Invalid intrinsics mean "unknown"; consumers fall
+// back to the nominal model for the generation (processing/camera_model.h).
+struct DeviceCalibration {
+  std::string serial;
+  CameraIntrinsics depth;
+  CameraIntrinsics color;
+  DepthToColorModel depth_to_color;
+  // True when read from the device, false for nominal, synthetic or replayed
+  // values. Only device calibrations are persisted to the ray cache.
+  bool from_device = false;
+};
+
+// Process-wide registry so each serial's calibration is read from USB once,
+// however many times the device is reopened. Thread-safe.
+bool LookupCalibration(const std::string &serial, DeviceCalibration *calibration);
+void RememberCalibration(const DeviceCalibration &calibration);
@@ -0,0 +1,296 @@
+#include "core/depth_codec.h"
+
+#include "core/trace.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr std::size_t kHeaderBytes = 8;
+constexpr std::uint64_t kLaneOnes = 0x0001000100010001ull;
+constexpr std::uint64_t kLaneHighBits = 0x8000800080008000ull;
+
+inline std::uint64_t Load64(const std::uint16_t *p) {
+  std::uint64_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// True if any of the four 16-bit lanes of |w| is zero.
+inline bool HasZeroLane(std::uint64_t w) {
+  return ((w - kLaneOnes) & ~w & kLaneHighBits) != 0;
+}
+
+inline std::uint32_t ZigZag(std::int32_t value) {
+  return (static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31);
+}
+
+inline std::int32_t UnZigZag(std::uint32_t value) {
+  return static_cast<std::int32_t>(value >> 1) ^ -static_cast<std::int32_t>(value & 1u);
+}
+
+// Variable-length codes, three bits per nibble, low bits first; bit 3 says
+// another nibble follows. Nibbles fill u32 words from the bottom.
+class NibbleWriter {
+ public:
+  explicit NibbleWriter(std::uint8_t *out) : out_(out) {}
+
+  void put(std::uint32_t value) {
+    for (;;) {
+      std::uint32_t nibble = value & 7u;
+      value >>= 3;
+      if (value != 0) {
+        nibble |= 8u;
+      }
+      bits_ |= static_cast<std::uint64_t>(nibble) << count_;
+      count_ += 4;
+      if (count_ >= 32) {
+        flushWord();
+      }
+      if (value == 0) {
+        return;
+      }
+    }
+  }
+
+  // Writes the partial last word; returns the end of the stream.
+  std::uint8_t *finish() {
+    if (count_ > 0) {
+      flushWord();
+    }
+    return out_;
+  }
+
+ private:
+  void flushWord() {
+    const std::uint32_t word = static_cast<std::uint32_t>(bits_);
+    std::memcpy(out_, &word, sizeof(word));
+    out_ += sizeof(word);
+    bits_ >>= 32;
+    count_ = count_ > 32 ? count_ - 32 : 0;
+  }
+
+  std::uint8_t *out_;
+  std::uint64_t bits_ = 0;
+  int count_ = 0;
+};
+
+class NibbleReader {
+ public:
+  NibbleReader(const std::uint8_t *in, const std::uint8_t *end) : in_(in), end_(end) {}
+
+  bool get(std::uint32_t *value) {
+    std::uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 3) {
+      if (count_ == 0) {
+        if (end_ - in_ < 4) {
+          return false;
+        }
+        std::uint32_t word;
+        std::memcpy(&word, in_, sizeof(word));
+        in_ += sizeof(word);
+        bits_ = word;
+        count_ = 32;
+      }
+      const std::uint32_t nibble = bits_ & 15u;
+      bits_ >>= 4;
+      count_ -= 4;
+      result |= (nibble & 7u) << shift;
+      if ((nibble & 8u) == 0) {
+        *value = result;
+        return true;
+      }
+    }
+    return false;  // longer than any value the encoder writes
+  }
+
+ private:
+  const std::uint8_t *in_;
+  const std::uint8_t *end_;
+  std::uint32_t bits_ = 0;
+  int count_ = 0;
+};
+
+// (invalid run, valid run, valid values as zigzagged steps) until the end.
+void EncodeKey(const std::uint16_t *depth, std::size_t pixels, NibbleWriter *writer) {
+  std::size_t i = 0;
+  std::int32_t last = 0;
+  while (i < pixels) {
+    const std::size_t zeros_begin = i;
+    while (i + 4 <= pixels && Load64(depth + i) == 0) {
+      i += 4;
+    }
+    while (i < pixels && depth[i] == 0) {
+      ++i;
+    }
+    const std::size_t valid_begin = i;
+    while (i + 4 <= pixels && !HasZeroLane(Load64(depth + i))) {
+      i += 4;
+    }
+    while (i < pixels && depth[i] != 0) {
+      ++i;
+    }
+    writer->put(static_cast<std::uint32_t>(valid_begin - zeros_begin));
+    writer->put(static_cast<std::uint32_t>(i - valid_begin));
+    for (std::size_t k = valid_begin; k < i; ++k) {
+      const std::int32_t value = depth[k];
+      writer->put(ZigZag(value - last));
+      last = value;
+    }
+  }
+}
+
+// (unchanged run, changed run, changes as zigzag - 1) until the end.
+void EncodeDelta(const std::uint16_t *depth, const std::uint16_t *previous, std::size_t pixels,
+                 NibbleWriter *writer) {
+  std::size_t i = 0;
+  while (i < pixels) {
+    const std::size_t same_begin = i;
+    while (i + 4 <= pixels && Load64(depth + i) == Load64(previous + i)) {
+      i += 4;
+    }
+    while (i < pixels && depth[i] == previous[i]) {
+      ++i;
+    }
+    const std::size_t changed_begin = i;
+    while (i + 4 <= pixels && !HasZeroLane(Load64(depth + i) ^ Load64(previous + i))) {
+      i += 4;
+    }
+    while (i < pixels && depth[i] != previous[i]) {
+      ++i;
+    }
+    writer->put(static_cast<std::uint32_t>(changed_begin - same_begin));
+    writer->put(static_cast<std::uint32_t>(i - changed_begin));
+    for (std::size_t k = changed_begin; k < i; ++k) {
+      writer->put(ZigZag(static_cast<std::int32_t>(depth[k]) - previous[k]) - 1u);
+    }
+  }
+}
+
+bool DecodeKey(NibbleReader *reader, std::uint16_t *depth, std::size_t pixels) {
+  std::size_t i = 0;
+  std::int32_t last = 0;
+  while (i < pixels) {
+    std::uint32_t zeros = 0;
+    std::uint32_t valid = 0;
+    if (!reader->get(&zeros) || !reader->get(&valid) || zeros > pixels - i || valid > pixels - i - zeros) {
+      return false;
+    }
+    std::fill(depth + i, depth + i + zeros, static_cast<std::uint16_t>(0));
+    i += zeros;
+    for (const std::size_t end = i + valid; i < end; ++i) {
+      std::uint32_t code = 0;
+      if (!reader->get(&code)) {
+        return false;
+      }
+      last += UnZigZag(code);
+      depth[i] = static_cast<std::uint16_t>(last);
+    }
+  }
+  return true;
+}
+
+bool DecodeDelta(NibbleReader *reader, const std::uint16_t *previous, std::uint16_t *depth, std::size_t pixels) {
+  std::size_t i = 0;
+  while (i < pixels) {
+    std::uint32_t same = 0;
+    std::uint32_t changed = 0;
+    if (!reader->get(&same) || !reader->get(&changed) || same > pixels - i || changed > pixels - i - same) {
+      return false;
+    }
+    std::memcpy(depth + i, previous + i, same * sizeof(std::uint16_t));
+    i += same;
+    for (const std::size_t end = i + changed; i < end; ++i) {
+      std::uint32_t code = 0;
+      if (!reader->get(&code)) {
+        return false;
+      }
+      depth[i] = static_cast<std::uint16_t>(previous[i] + UnZigZag(code + 1u));
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+std::size_t MaxEncodedDepthBytes(std::size_t pixels) {
+  // A value takes at most six nibbles and its share of the run lengths at
+  // most two, plus the closing run pair and a partial word.
+  return kHeaderBytes + pixels * 4 + 16;
+}
+
+bool EncodedDepthFrameType(const std::uint8_t *data, std::size_t bytes, DepthFrameType *type) {
+  if (bytes < kHeaderBytes || data[0] > static_cast<std::uint8_t>(DepthFrameType::kDelta)) {
+    return false;
+  }
+  *type = static_cast<DepthFrameType>(data[0]);
+  return true;
+}
+
+void DepthEncoder::setOptions(const DepthCodecOptions &options) {
+  options_ = options;
+  reset();
+}
+
+void DepthEncoder::reset() {
+  previous_.clear();
+  since_key_ = 0;
+}
+
+DepthFrameType DepthEncoder::encode(const std::uint16_t *depth, std::size_t pixels, std::vector<std::uint8_t> *out) {
+  KINECT_TRACE_SCOPE("depth_codec.encode");
+  const bool key = !options_.temporal || previous_.size() != pixels ||
+                   since_key_ + 1 >= std::max(1, options_.keyframe_interval);
+  const DepthFrameType type = key ? DepthFrameType::kKey : DepthFrameType::kDelta;
+  since_key_ = key ? 0 : since_key_ + 1;
+
+  out->resize(MaxEncodedDepthBytes(pixels));
+  std::uint8_t *data = out->data();
+  const std::uint32_t count = static_cast<std::uint32_t>(pixels);
+  std::memset(data, 0, kHeaderBytes);
+  data[0] = static_cast<std::uint8_t>(type);
+  std::memcpy(data + 4, &count, sizeof(count));
+  NibbleWriter writer(data + kHeaderBytes);
+  if (key) {
+    EncodeKey(depth, pixels, &writer);
+  } else {
+    EncodeDelta(depth, previous_.data(), pixels, &writer);
+  }
+  out->resize(static_cast<std::size_t>(writer.finish() - data));
+
+  if (options_.temporal) {
+    previous_.assign(depth, depth + pixels);
+  }
+  return type;
+}
+
+void DepthDecoder::reset() {
+  previous_.clear();
+}
+
+bool DepthDecoder::decode(const std::uint8_t *data, std::size_t bytes, std::uint16_t *depth, std::size_t pixels) {
+  KINECT_TRACE_SCOPE("depth_codec.decode");
+  DepthFrameType type = DepthFrameType::kKey;
+  std::uint32_t count = 0;
+  if (!EncodedDepthFrameType(data, bytes, &type)) {
+    return false;
+  }
+  std::memcpy(&count, data + 4, sizeof(count));
+  if (count != pixels) {
+    return false;
+  }
+  NibbleReader reader(data + kHeaderBytes, data + bytes);
+  bool ok = false;
+  if (type == DepthFrameType::kKey) {
+    ok = DecodeKey(&reader, depth, pixels);
+  } else if (previous_.size() == pixels) {
+    ok = DecodeDelta(&reader, previous_.data(), depth, pixels);
+  }
+  if (!ok) {
+    previous_.clear();
+    return false;
+  }
+  previous_.assign(depth, depth + pixels);
+  return true;
+}
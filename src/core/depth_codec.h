@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lossless depth compression after RVL (Wilson, "Fast Lossless Depth Image
+// Compression", 2017). A key frame alternates runs of invalid (zero) and
+// valid pixels; valid values are coded as zigzagged differences from the
+// previous valid value. A delta frame codes the change from the previous
+// frame the same way, with unchanged pixels taking the place of invalid ones,
+// so a still scene collapses to a handful of runs. Every number is a
+// variable-length code of 3-bit groups with a continuation bit, one nibble
+// each; runs are found eight bytes at a time.
+//
+// Stream (little-endian): u8 frame type (0 key, 1 delta), u8[3] reserved,
+// u32 pixel count, then the nibbles packed low-first into u32 words.
+
+enum class DepthFrameType : std::uint8_t {
+  kKey = 0,
+  kDelta = 1,
+};
+
+struct DepthCodecOptions {
+  // Code frames as changes from the previous one, with a key frame every
+  // |keyframe_interval| frames so readers can start or resynchronise there.
+  bool temporal = false;
+  int keyframe_interval = 30;
+};
+
+// Upper bound on the encoded size of |pixels| depth values.
+std::size_t MaxEncodedDepthBytes(std::size_t pixels);
+
+// Reads the frame type of an encoded stream; false if it is too short.
+bool EncodedDepthFrameType(const std::uint8_t *data, std::size_t bytes, DepthFrameType *type);
+
+// Stateful because delta frames need the previous frame. Not thread-safe;
+// one encoder per stream.
+class DepthEncoder {
+ public:
+  void setOptions(const DepthCodecOptions &options);
+  const DepthCodecOptions &options() const { return options_; }
+
+  // Replaces |out| with the encoded frame and returns its type. The first
+  // frame, a frame of a new size and every key frame interval are key
+  // frames.
+  DepthFrameType encode(const std::uint16_t *depth, std::size_t pixels, std::vector<std::uint8_t> *out);
+
+  // Makes the next frame a key frame.
+  void reset();
+
+ private:
+  DepthCodecOptions options_;
+  std::vector<std::uint16_t> previous_;
+  int since_key_ = 0;
+};
+
+class DepthDecoder {
+ public:
+  // Decodes |bytes| of stream into |pixels| values. Returns false on a
+  // malformed or truncated stream, a pixel count other than |pixels|, or a
+  // delta frame without the frame it builds on; |depth| is then undefined.
+  bool decode(const std::uint8_t *data, std::size_t bytes, std::uint16_t *depth, std::size_t pixels);
+
+  // Forgets the previous frame (e.g. after a seek).
+  void reset();
+
+ private:
+  std::vector<std::uint16_t> previous_;
+};
@@ -0,0 +1,63 @@
+#include "core/jpeg_decoder.h"
+
+#include "core/trace.h"
+
+#if KINECT_HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+JpegDecoder::~JpegDecoder() {
+#if KINECT_HAVE_TURBOJPEG
+  if (handle_ != nullptr) {
+    tjDestroy(handle_);
+  }
+#endif
+}
+
+bool JpegDecoder::decode(const std::uint8_t *jpeg, std::size_t bytes, int scale, JpegPixelFormat format,
+                         std::vector<std::uint8_t> *out, int *width, int *height) {
+  KINECT_TRACE_SCOPE("jpeg.decode");
+  if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+    error_ = "scale must be 1, 2, 4 or 8";
+    return false;
+  }
+#if KINECT_HAVE_TURBOJPEG
+  if (handle_ == nullptr) {
+    handle_ = tjInitDecompress();
+    if (handle_ == nullptr) {
+      error_ = "tjInitDecompress failed";
+      return false;
+    }
+  }
+  const unsigned long size = static_cast<unsigned long>(bytes);
+  int full_width = 0;
+  int full_height = 0;
+  int subsampling = 0;
+  int colorspace = 0;
+  if (tjDecompressHeader3(handle_, jpeg, size, &full_width, &full_height, &subsampling, &colorspace) != 0) {
+    error_ = tjGetErrorStr2(handle_);
+    return false;
+  }
+  const tjscalingfactor factor = {1, scale};
+  const int scaled_width = TJSCALED(full_width, factor);
+  const int scaled_height = TJSCALED(full_height, factor);
+  const int pixel_format = format == JpegPixelFormat::kRgb ? TJPF_RGB : TJPF_BGRA;
+  out->resize(static_cast<std::size_t>(scaled_width) * scaled_height * tjPixelSize[pixel_format]);
+  if (tjDecompress2(handle_, jpeg, size, out->data(), scaled_width, 0, scaled_height, pixel_format, 0) != 0) {
+    error_ = tjGetErrorStr2(handle_);
+    return false;
+  }
+  *width = scaled_width;
+  *height = scaled_height;
+  return true;
+#else
+  (void)jpeg;
+  (void)bytes;
+  (void)format;
+  (void)out;
+  (void)width;
+  (void)height;
+  error_ = "built without TurboJPEG";
+  return false;
+#endif
+}
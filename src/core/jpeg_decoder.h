@@ -0,0 +1,36 @@
+#pragma once
+
+#include "core/jpeg_encoder.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// TurboJPEG decompression with one long-lived handle, for color that arrives
+// or was recorded as JPEG. A |scale| of 2, 4 or 8 decodes straight to that
+// fraction of the size: the IDCT produces fewer samples per block, so
+// entropy decoding is the only full-resolution work, and nothing is decoded
+// just to be thrown away by a later resize. Needs the same build support as
+// JpegEncoder (JpegEncoderAvailable()). Not thread-safe; one decoder per
+// stream.
+class JpegDecoder {
+ public:
+  JpegDecoder() = default;
+  ~JpegDecoder();
+  JpegDecoder(const JpegDecoder &) = delete;
+  JpegDecoder &operator=(const JpegDecoder &) = delete;
+
+  // Replaces |out| with the image downscaled by |scale| (1, 2, 4 or 8, sizes
+  // rounded up) as |format| pixels, tightly packed, and sets its size.
+  // Returns false, with the reason in error(), on a malformed stream or
+  // without TurboJPEG.
+  bool decode(const std::uint8_t *jpeg, std::size_t bytes, int scale, JpegPixelFormat format,
+              std::vector<std::uint8_t> *out, int *width, int *height);
+
+  const std::string &error() const { return error_; }
+
+ private:
+  void *handle_ = nullptr;
+  std::string error_;
+};
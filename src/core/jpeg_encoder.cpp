@@ -0,0 +1,271 @@
+#include "core/jpeg_encoder.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if KINECT_HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+namespace {
+
+// MCU size per JpegSubsampling (4:4:4, 4:2:2, 4:2:0), as TurboJPEG's
+// tjMCUWidth/tjMCUHeight.
+constexpr int kMcuWidth[] = {8, 16, 16};
+constexpr int kMcuHeight[] = {8, 8, 16};
+// DRI holds the restart interval, in MCUs, as a u16.
+constexpr int kMaxRestartInterval = 0xffff;
+
+constexpr std::uint8_t kMarker = 0xff;
+constexpr std::uint8_t kSof0 = 0xc0;
+constexpr std::uint8_t kSof1 = 0xc1;
+constexpr std::uint8_t kDht = 0xc4;
+constexpr std::uint8_t kJpg = 0xc8;
+constexpr std::uint8_t kDac = 0xcc;
+constexpr std::uint8_t kSof15 = 0xcf;
+constexpr std::uint8_t kRst0 = 0xd0;
+constexpr std::uint8_t kSoi = 0xd8;
+constexpr std::uint8_t kEoi = 0xd9;
+constexpr std::uint8_t kSos = 0xda;
+constexpr std::uint8_t kDri = 0xdd;
+constexpr std::size_t kDriBytes = 6;
+
+// Where a single-scan JPEG's pieces are: the SOF height field, the SOS
+// segment and the entropy-coded data between it and EOI.
+struct JpegLayout {
+  std::size_t height_offset = 0;
+  std::size_t sos_begin = 0;
+  std::size_t scan_begin = 0;
+  std::size_t scan_end = 0;
+};
+
+bool ParseLayout(const std::uint8_t *data, std::size_t size, JpegLayout *layout) {
+  if (size < 4 || data[0] != kMarker || data[1] != kSoi || data[size - 2] != kMarker || data[size - 1] != kEoi) {
+    return false;
+  }
+  bool have_sof = false;
+  std::size_t pos = 2;
+  while (pos + 4 <= size) {
+    if (data[pos] != kMarker) {
+      return false;
+    }
+    const std::uint8_t marker = data[pos + 1];
+    const std::size_t length = static_cast<std::size_t>(data[pos + 2]) << 8 | data[pos + 3];
+    if (length < 2 || pos + 2 + length > size) {
+      return false;
+    }
+    if (marker == kSof0 || marker == kSof1) {
+      // Length, precision, then the height.
+      layout->height_offset = pos + 5;
+      have_sof = true;
+    } else if (marker > kSof1 && marker <= kSof15 && marker != kDht && marker != kJpg && marker != kDac) {
+      return false;  // progressive, lossless or arithmetic coded
+    } else if (marker == kSos) {
+      layout->sos_begin = pos;
+      layout->scan_begin = pos + 2 + length;
+      layout->scan_end = size - 2;
+      return have_sof;
+    }
+    pos += 2 + length;
+  }
+  return false;
+}
+
+}  // namespace
+
+struct JpegEncoder::Slice {
+  ~Slice() {
+#if KINECT_HAVE_TURBOJPEG
+    if (handle != nullptr) {
+      tjDestroy(handle);
+    }
+#endif
+  }
+
+  void *handle = nullptr;
+  std::vector<std::uint8_t> buffer;
+  std::size_t size = 0;
+  JpegLayout layout;
+  std::string error;
+};
+
+bool JpegEncoderAvailable() {
+#if KINECT_HAVE_TURBOJPEG
+  return true;
+#else
+  return false;
+#endif
+}
+
+JpegEncoder::JpegEncoder() = default;
+
+JpegEncoder::~JpegEncoder() = default;
+
+void JpegEncoder::setOptions(const JpegEncoderOptions &options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  options_ = options;
+  options_.quality = std::min(std::max(options_.quality, 1), 100);
+}
+
+JpegEncoderOptions JpegEncoder::options() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return options_;
+}
+
+bool JpegEncoder::compressSlice(Slice *slice, const std::uint8_t *pixels, int width, int height, std::size_t stride,
+                                JpegPixelFormat format, const JpegEncoderOptions &options) {
+#if KINECT_HAVE_TURBOJPEG
+  if (slice->handle == nullptr) {
+    slice->handle = tjInitCompress();
+    if (slice->handle == nullptr) {
+      slice->error = "tjInitCompress failed";
+      return false;
+    }
+  }
+  int subsampling = TJSAMP_420;
+  if (options.subsampling == JpegSubsampling::k444) {
+    subsampling = TJSAMP_444;
+  } else if (options.subsampling == JpegSubsampling::k422) {
+    subsampling = TJSAMP_422;
+  }
+  const unsigned long capacity = tjBufSize(width, height, subsampling);
+  if (slice->buffer.size() < capacity) {
+    slice->buffer.resize(capacity);
+  }
+  unsigned char *data = slice->buffer.data();
+  unsigned long size = capacity;
+  const int flags = TJFLAG_NOREALLOC | (options.fast_dct ? TJFLAG_FASTDCT : 0);
+  if (tjCompress2(slice->handle, pixels, width, static_cast<int>(stride), height,
+                  format == JpegPixelFormat::kRgb ? TJPF_RGB : TJPF_BGRA, &data, &size, subsampling, options.quality,
+                  flags) != 0) {
+    slice->error = tjGetErrorStr2(slice->handle);
+    return false;
+  }
+  slice->size = size;
+  return true;
+#else
+  (void)pixels;
+  (void)width;
+  (void)height;
+  (void)stride;
+  (void)format;
+  (void)options;
+  slice->error = "built without TurboJPEG";
+  return false;
+#endif
+}
+
+bool JpegEncoder::splice(int height, int restart_interval, std::vector<std::uint8_t> *out) {
+  const int count = last_slices_;
+  std::size_t total = 0;
+  for (int s = 0; s < count; ++s) {
+    Slice &slice = *slices_[static_cast<std::size_t>(s)];
+    if (!ParseLayout(slice.buffer.data(), slice.size, &slice.layout)) {
+      error_ = "unexpected JPEG layout from the compressor";
+      return false;
+    }
+    total += slice.layout.scan_end - slice.layout.scan_begin + 2;
+  }
+  const Slice &first = *slices_.front();
+  total += first.layout.scan_begin + kDriBytes;
+  out->resize(total);
+
+  std::uint8_t *dst = out->data();
+  std::memcpy(dst, first.buffer.data(), first.layout.sos_begin);
+  dst[first.layout.height_offset] = static_cast<std::uint8_t>(height >> 8);
+  dst[first.layout.height_offset + 1] = static_cast<std::uint8_t>(height);
+  dst += first.layout.sos_begin;
+  const std::uint8_t dri[kDriBytes] = {kMarker, kDri, 0, 4, static_cast<std::uint8_t>(restart_interval >> 8),
+                                       static_cast<std::uint8_t>(restart_interval)};
+  std::memcpy(dst, dri, kDriBytes);
+  dst += kDriBytes;
+  std::memcpy(dst, first.buffer.data() + first.layout.sos_begin, first.layout.scan_begin - first.layout.sos_begin);
+  dst += first.layout.scan_begin - first.layout.sos_begin;
+  for (int s = 0; s < count; ++s) {
+    const Slice &slice = *slices_[static_cast<std::size_t>(s)];
+    if (s > 0) {
+      *dst++ = kMarker;
+      *dst++ = static_cast<std::uint8_t>(kRst0 + (s - 1) % 8);
+    }
+    const std::size_t bytes = slice.layout.scan_end - slice.layout.scan_begin;
+    std::memcpy(dst, slice.buffer.data() + slice.layout.scan_begin, bytes);
+    dst += bytes;
+  }
+  *dst++ = kMarker;
+  *dst++ = kEoi;
+  return true;
+}
+
+bool JpegEncoder::encode(const std::uint8_t *pixels, int width, int height, std::size_t stride, JpegPixelFormat format,
+                         std::vector<std::uint8_t> *out) {
+  KINECT_TRACE_SCOPE("jpeg.encode");
+  const JpegEncoderOptions options = this->options();
+  const std::size_t pixel_bytes = format == JpegPixelFormat::kRgb ? 3 : 4;
+  if (pixels == nullptr || width <= 0 || height <= 0 || stride < static_cast<std::size_t>(width) * pixel_bytes) {
+    error_ = "invalid image";
+    return false;
+  }
+  if (!JpegEncoderAvailable()) {
+    error_ = "built without TurboJPEG";
+    return false;
+  }
+  max_threads_ = options.threads;
+
+  // Bands of whole MCU rows, so no band's chroma or edge padding depends on
+  // its neighbours and the spliced image decodes exactly like a single
+  // encode with the same restart interval.
+  const int mcu_width = kMcuWidth[static_cast<int>(options.subsampling)];
+  const int mcu_height = kMcuHeight[static_cast<int>(options.subsampling)];
+  const int mcu_columns = (width + mcu_width - 1) / mcu_width;
+  const int mcu_rows = (height + mcu_height - 1) / mcu_height;
+  int requested = options.slices;
+  if (requested <= 0) {
+    requested = static_cast<std::size_t>(width) * height >= kJpegMinSlicedPixels
+                    ? SharedThreadPool().threadsFor(max_threads_)
+                    : 1;
+  }
+  int band_mcu_rows = (mcu_rows + std::min(requested, mcu_rows) - 1) / std::min(requested, mcu_rows);
+  band_mcu_rows = std::min(band_mcu_rows, std::max(1, kMaxRestartInterval / mcu_columns));
+  int count = (mcu_rows + band_mcu_rows - 1) / band_mcu_rows;
+  if (mcu_columns > kMaxRestartInterval) {
+    count = 1;
+  }
+  const int band_rows = band_mcu_rows * mcu_height;
+
+  while (slices_.size() < static_cast<std::size_t>(count)) {
+    slices_.push_back(std::make_unique<Slice>());
+  }
+  last_slices_ = count;
+
+  if (count == 1) {
+    Slice &slice = *slices_.front();
+    if (!compressSlice(&slice, pixels, width, height, stride, format, options)) {
+      error_ = slice.error;
+      return false;
+    }
+    out->assign(slice.buffer.data(), slice.buffer.data() + slice.size);
+    return true;
+  }
+
+  bool ok = true;
+  SharedThreadPool().parallelFor(count, 1, max_threads_, [&](int begin, int end) {
+    for (int s = begin; s < end; ++s) {
+      const int y = s * band_rows;
+      const int rows = std::min(band_rows, height - y);
+      Slice *slice = slices_[static_cast<std::size_t>(s)].get();
+      slice->error.clear();
+      compressSlice(slice, pixels + static_cast<std::size_t>(y) * stride, width, rows, stride, format, options);
+    }
+  });
+  for (int s = 0; s < count; ++s) {
+    const Slice &slice = *slices_[static_cast<std::size_t>(s)];
+    if (!slice.error.empty()) {
+      error_ = slice.error;
+      ok = false;
+    }
+  }
+  return ok && splice(height, mcu_columns * band_mcu_rows, out);
+}
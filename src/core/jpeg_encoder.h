@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class JpegPixelFormat {
+  kRgb,   // RGB24, FrameData::rgb
+  kBgra,  // 32-bit BGRA/BGRX, the v2 color frame and CoreVideo buffers
+};
+
+enum class JpegSubsampling {
+  k444,
+  k422,
+  k420,
+};
+
+struct JpegEncoderOptions {
+  int quality = 85;
+  JpegSubsampling subsampling = JpegSubsampling::k420;
+  // Faster, slightly less accurate integer DCT.
+  bool fast_dct = true;
+  // Horizontal slices compressed in parallel and joined with restart
+  // markers; 0 picks one per thread for frames of at least kJpegMinSlicedPixels.
+  int slices = 0;
+  // Shared pool threads to use, including the caller; 0 uses all of them.
+  int threads = 0;
+};
+
+// Smaller frames encode in one piece under automatic slicing.
+constexpr std::size_t kJpegMinSlicedPixels = 640 * 480;
+
+// True when the build found TurboJPEG (libjpeg-turbo); without it encode()
+// always fails.
+bool JpegEncoderAvailable();
+
+// Baseline JPEG encoding through TurboJPEG, for MJPEG recording and
+// streaming sinks. Pixels are read in place from the caller's plane, any row
+// stride, with no conversion copy. A large frame is cut into bands of whole
+// MCU rows that are compressed in parallel, each by its own long-lived
+// compressor handle into a preallocated buffer; the bands' entropy-coded data
+// is then spliced behind the first band's headers (height patched, DRI
+// added) separated by RSTn markers, which gives one standard JPEG that any
+// decoder reads. Not thread-safe apart from setOptions(); one encoder per
+// stream.
+class JpegEncoder {
+ public:
+  JpegEncoder();
+  ~JpegEncoder();
+  JpegEncoder(const JpegEncoder &) = delete;
+  JpegEncoder &operator=(const JpegEncoder &) = delete;
+
+  void setOptions(const JpegEncoderOptions &options);
+  JpegEncoderOptions options() const;
+
+  // Replaces |out| with the JPEG of |pixels| (width x height, |stride| bytes
+  // per row). Returns false, with the reason in error(), if TurboJPEG is
+  // missing or fails.
+  bool encode(const std::uint8_t *pixels, int width, int height, std::size_t stride, JpegPixelFormat format,
+              std::vector<std::uint8_t> *out);
+
+  // Slices the last frame was cut into.
+  int lastSlices() const { return last_slices_; }
+  const std::string &error() const { return error_; }
+
+ private:
+  struct Slice;
+
+  bool compressSlice(Slice *slice, const std::uint8_t *pixels, int width, int height, std::size_t stride,
+                     JpegPixelFormat format, const JpegEncoderOptions &options);
+  bool splice(int height, int restart_interval, std::vector<std::uint8_t> *out);
+
+  mutable std::mutex mutex_;
+  JpegEncoderOptions options_;
+
+  std::vector<std::unique_ptr<Slice>> slices_;
+  int last_slices_ = 0;
+  std::string error_;
+
+  // options.threads of the call in progress.
+  int max_threads_ = 0;
+};
@@ -0,0 +1,536 @@
+#include "core/recording.h"
+#include "core/trace.h"
+
+#include <cstring>
+#include <utility>
+
+namespace {
+
+constexpr char kMagic[4] = {'K', 'R', 'E', 'C'};
+constexpr std::size_t kMaxQueuedRecords = 32;
+constexpr std::size_t kWriteBufferBytes = 4 << 20;
+// Sanity limit for a single plane: 8K RGB.
+constexpr std::uint32_t kMaxPlaneBytes = 7680u * 4320u * 3u;
+constexpr std::uint32_t kMaxAudioSamples = 1u << 24;
+
+struct RecordHeaderBytes {
+  std::uint8_t kind;
+  std::uint8_t reserved[3];
+  std::uint32_t payload_bytes;
+  std::uint64_t host_ns;
+};
+static_assert(sizeof(RecordHeaderBytes) == 16, "record header must be packed");
+
+struct FrameFieldsBytes {
+  std::uint32_t device_ts;
+  std::int32_t width;
+  std::int32_t height;
+  std::int32_t color_width;
+  std::int32_t color_height;
+  std::int32_t depth_width;
+  std::int32_t depth_height;
+  std::int32_t ir_width;
+  std::int32_t ir_height;
+};
+static_assert(sizeof(FrameFieldsBytes) == 36, "frame fields must be packed");
+
+struct PlaneHeaderBytes {
+  std::uint8_t codec;
+  std::uint8_t reserved[3];
+  std::uint32_t bytes;
+};
+static_assert(sizeof(PlaneHeaderBytes) == 8, "plane header must be packed");
+
+struct AudioFieldsBytes {
+  std::uint16_t channels;
+  std::uint16_t reserved;
+  std::uint32_t sample_rate;
+  std::uint64_t first_frame;
+  std::uint32_t sample_count;
+  std::uint32_t padding;
+};
+static_assert(sizeof(AudioFieldsBytes) == 24, "audio fields must be packed");
+
+struct IntrinsicsBytes {
+  std::int32_t width;
+  std::int32_t height;
+  float fx, fy, cx, cy;
+  float k1, k2, k3, p1, p2;
+};
+static_assert(sizeof(IntrinsicsBytes) == 44, "intrinsics must be packed");
+
+struct CalibrationBytes {
+  std::uint32_t flags;
+  std::uint32_t reserved;
+  IntrinsicsBytes depth;
+  IntrinsicsBytes color;
+};
+static_assert(sizeof(CalibrationBytes) == 96, "calibration must be packed");
+
+// Optional tail of the calibration record; files written before it existed
+// carry only CalibrationBytes.
+struct DepthToColorBytes {
+  std::uint32_t flags;
+  float baseline_mm;
+  float shift_d, shift_m;
+  float mx[10];
+  float my[10];
+};
+static_assert(sizeof(DepthToColorBytes) == 96, "depth-to-color model must be packed");
+
+constexpr std::uint32_t kCalibrationFromDevice = 1u;
+constexpr std::uint32_t kDepthToColorPolynomial = 1u;
+
+IntrinsicsBytes PackIntrinsics(const CameraIntrinsics &in) {
+  return {in.width,         in.height,        in.fx,         in.fy,         in.cx, in.cy,
+          in.distortion.k1, in.distortion.k2, in.distortion.k3, in.distortion.p1, in.distortion.p2};
+}
+
+CameraIntrinsics UnpackIntrinsics(const IntrinsicsBytes &in) {
+  return {in.width, in.height, in.fx, in.fy, in.cx, in.cy, {in.k1, in.k2, in.k3, in.p1, in.p2}};
+}
+
+DepthToColorBytes PackDepthToColor(const DepthToColorModel &in) {
+  DepthToColorBytes out{};
+  out.flags = in.has_polynomial ? kDepthToColorPolynomial : 0u;
+  out.baseline_mm = in.baseline_mm;
+  out.shift_d = in.shift_d;
+  out.shift_m = in.shift_m;
+  std::memcpy(out.mx, in.mx, sizeof(out.mx));
+  std::memcpy(out.my, in.my, sizeof(out.my));
+  return out;
+}
+
+DepthToColorModel UnpackDepthToColor(const DepthToColorBytes &in) {
+  DepthToColorModel out;
+  out.has_polynomial = (in.flags & kDepthToColorPolynomial) != 0;
+  out.baseline_mm = in.baseline_mm;
+  out.shift_d = in.shift_d;
+  out.shift_m = in.shift_m;
+  std::memcpy(out.mx, in.mx, sizeof(out.mx));
+  std::memcpy(out.my, in.my, sizeof(out.my));
+  return out;
+}
+
+std::size_t PlaneSize(int width, int height, std::size_t bytes_per_pixel) {
+  if (width <= 0 || height <= 0) {
+    return 0;
+  }
+  return static_cast<std::size_t>(width) * static_cast<std::size_t>(height) * bytes_per_pixel;
+}
+
+}  // namespace
+
+RecordingWriter::~RecordingWriter() {
+  close();
+}
+
+bool RecordingWriter::open(const std::string &path, const RecordingHeader &header,
+                           const RecordingOptions &options) {
+  close();
+  file_ = std::fopen(path.c_str(), "wb");
+  if (file_ == nullptr) {
+    return false;
+  }
+  std::setvbuf(file_, nullptr, _IOFBF, kWriteBufferBytes);
+
+  failed_ = false;
+  closing_ = false;
+  have_origin_ = false;
+  frames_written_ = 0;
+  bytes_written_ = 0;
+  raw_depth_bytes_ = 0;
+  encoded_depth_bytes_ = 0;
+  compress_depth_ = options.compress_depth;
+  depth_encoder_.setOptions(options.depth_codec);
+
+  const std::uint32_t version = kRecordingVersion;
+  const std::uint32_t generation = header.generation == KinectGeneration::kV2 ? 2 : 1;
+  const auto serial_len = static_cast<std::uint32_t>(header.serial.size());
+  if (!writeBytes(kMagic, sizeof(kMagic)) || !writeBytes(&version, sizeof(version)) ||
+      !writeBytes(&generation, sizeof(generation)) || !writeBytes(&serial_len, sizeof(serial_len)) ||
+      !writeBytes(header.serial.data(), header.serial.size())) {
+    std::fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+
+  const DeviceCalibration &calibration = header.calibration;
+  if (calibration.depth.valid() || calibration.color.valid()) {
+    RecordHeaderBytes record{};
+    record.kind = static_cast<std::uint8_t>(RecordKind::kCalibration);
+    record.payload_bytes = sizeof(CalibrationBytes) + sizeof(DepthToColorBytes);
+    CalibrationBytes fields{};
+    fields.flags = calibration.from_device ? kCalibrationFromDevice : 0u;
+    fields.depth = PackIntrinsics(calibration.depth);
+    fields.color = PackIntrinsics(calibration.color);
+    const DepthToColorBytes mapping = PackDepthToColor(calibration.depth_to_color);
+    if (!writeBytes(&record, sizeof(record)) || !writeBytes(&fields, sizeof(fields)) ||
+        !writeBytes(&mapping, sizeof(mapping))) {
+      std::fclose(file_);
+      file_ = nullptr;
+      return false;
+    }
+  }
+
+  thread_ = std::thread(&RecordingWriter::writerLoop, this);
+  return true;
+}
+
+bool RecordingWriter::writeFrame(FrameData frame, std::uint64_t host_ns) {
+  PendingRecord record;
+  record.kind = RecordKind::kFrame;
+  record.host_ns = host_ns;
+  record.frame = std::move(frame);
+  return enqueue(std::move(record));
+}
+
+bool RecordingWriter::writeAudio(AudioChunk chunk, std::uint64_t host_ns) {
+  PendingRecord record;
+  record.kind = RecordKind::kAudio;
+  record.host_ns = host_ns;
+  record.audio = std::move(chunk);
+  return enqueue(std::move(record));
+}
+
+bool RecordingWriter::enqueue(PendingRecord record) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (file_ == nullptr || closing_ || failed_) {
+    return false;
+  }
+  if (!have_origin_) {
+    origin_ns_ = record.host_ns;
+    have_origin_ = true;
+  }
+  record.host_ns = record.host_ns >= origin_ns_ ? record.host_ns - origin_ns_ : 0;
+  cv_.wait(lock, [this]() { return queue_.size() < kMaxQueuedRecords || failed_; });
+  if (failed_) {
+    return false;
+  }
+  queue_.push_back(std::move(record));
+  cv_.notify_all();
+  return true;
+}
+
+void RecordingWriter::writerLoop() {
+  KINECT_TRACE_THREAD_NAME("recording-writer");
+  for (;;) {
+    PendingRecord record;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return !queue_.empty() || closing_; });
+      if (queue_.empty()) {
+        return;
+      }
+      record = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    cv_.notify_all();
+
+    KINECT_TRACE_SCOPE("recording.write");
+    if (!writeRecord(record)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      failed_ = true;
+      queue_.clear();
+      cv_.notify_all();
+      return;
+    }
+  }
+}
+
+bool RecordingWriter::writeRecord(const PendingRecord &record) {
+  RecordHeaderBytes header{};
+  header.kind = static_cast<std::uint8_t>(record.kind);
+  header.host_ns = record.host_ns;
+
+  if (record.kind == RecordKind::kAudio) {
+    const AudioChunk &audio = record.audio;
+    AudioFieldsBytes fields{};
+    fields.channels = static_cast<std::uint16_t>(audio.channels);
+    fields.sample_rate = static_cast<std::uint32_t>(audio.sample_rate);
+    fields.first_frame = audio.first_frame;
+    fields.sample_count = static_cast<std::uint32_t>(audio.samples.size());
+    const std::size_t sample_bytes = audio.samples.size() * sizeof(std::int32_t);
+    header.payload_bytes = static_cast<std::uint32_t>(sizeof(fields) + sample_bytes);
+    return writeBytes(&header, sizeof(header)) && writeBytes(&fields, sizeof(fields)) &&
+           writeBytes(audio.samples.data(), sample_bytes);
+  }
+
+  const FrameData &frame = record.frame;
+  FrameFieldsBytes fields{};
+  fields.device_ts = frame.timestamp;
+  fields.width = frame.width;
+  fields.height = frame.height;
+  // A frame carrying the device's JPEG records it, at the JPEG's size, in
+  // place of any decoded plane.
+  const bool color_jpeg = !frame.color_jpeg.empty();
+  fields.color_width = color_jpeg && frame.color_jpeg_width > 0 ? frame.color_jpeg_width : frame.color_width;
+  fields.color_height = color_jpeg && frame.color_jpeg_height > 0 ? frame.color_jpeg_height : frame.color_height;
+  fields.depth_width = frame.depth_width;
+  fields.depth_height = frame.depth_height;
+  fields.ir_width = frame.ir_width;
+  fields.ir_height = frame.ir_height;
+
+  const std::vector<std::uint8_t> &color = color_jpeg ? frame.color_jpeg : frame.rgb;
+  const std::size_t rgb_bytes = color.size();
+  const std::size_t raw_depth_bytes = frame.depth.size() * sizeof(std::uint16_t);
+  const std::size_t ir_bytes = frame.ir.size();
+  PlaneCodec depth_codec = PlaneCodec::kRaw;
+  const void *depth_data = frame.depth.data();
+  std::size_t depth_bytes = raw_depth_bytes;
+  if (compress_depth_ && !frame.depth.empty()) {
+    depth_encoder_.encode(frame.depth.data(), frame.depth.size(), &encoded_depth_);
+    depth_codec = PlaneCodec::kRvl;
+    depth_data = encoded_depth_.data();
+    depth_bytes = encoded_depth_.size();
+  }
+  raw_depth_bytes_.fetch_add(raw_depth_bytes, std::memory_order_relaxed);
+  encoded_depth_bytes_.fetch_add(depth_bytes, std::memory_order_relaxed);
+  header.payload_bytes =
+      static_cast<std::uint32_t>(sizeof(fields) + 3 * sizeof(PlaneHeaderBytes) + rgb_bytes + depth_bytes + ir_bytes);
+
+  auto write_plane = [this](PlaneCodec codec, const void *data, std::size_t bytes) {
+    PlaneHeaderBytes plane{};
+    plane.codec = static_cast<std::uint8_t>(codec);
+    plane.bytes = static_cast<std::uint32_t>(bytes);
+    return writeBytes(&plane, sizeof(plane)) && writeBytes(data, bytes);
+  };
+  const bool ok = writeBytes(&header, sizeof(header)) && writeBytes(&fields, sizeof(fields)) &&
+                  write_plane(color_jpeg ? PlaneCodec::kJpeg : PlaneCodec::kRaw, color.data(), rgb_bytes) &&
+                  write_plane(depth_codec, depth_data, depth_bytes) &&
+                  write_plane(PlaneCodec::kRaw, frame.ir.data(), ir_bytes);
+  if (ok) {
+    frames_written_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return ok;
+}
+
+bool RecordingWriter::writeBytes(const void *data, std::size_t size) {
+  if (size == 0) {
+    return true;
+  }
+  if (std::fwrite(data, 1, size, file_) != size) {
+    return false;
+  }
+  bytes_written_.fetch_add(size, std::memory_order_relaxed);
+  return true;
+}
+
+bool RecordingWriter::close() {
+  if (file_ == nullptr) {
+    return !failed_;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closing_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  const bool closed = std::fclose(file_) == 0;
+  file_ = nullptr;
+  return closed && !failed_;
+}
+
+RecordingReader::~RecordingReader() {
+  close();
+}
+
+bool RecordingReader::open(const std::string &path) {
+  close();
+  error_.clear();
+  file_ = std::fopen(path.c_str(), "rb");
+  if (file_ == nullptr) {
+    error_ = "cannot open " + path;
+    return false;
+  }
+
+  char magic[4] = {};
+  std::uint32_t version = 0;
+  std::uint32_t generation = 0;
+  std::uint32_t serial_len = 0;
+  if (!readBytes(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+    error_ = "not a .krec recording";
+    close();
+    return false;
+  }
+  if (!readBytes(&version, sizeof(version)) || version < 1 || version > kRecordingVersion) {
+    error_ = "unsupported recording version";
+    close();
+    return false;
+  }
+  if (!readBytes(&generation, sizeof(generation)) || !readBytes(&serial_len, sizeof(serial_len)) ||
+      serial_len > 256) {
+    error_ = "corrupt recording header";
+    close();
+    return false;
+  }
+  header_.generation = generation == 2 ? KinectGeneration::kV2 : KinectGeneration::kV1;
+  header_.serial.assign(serial_len, '\0');
+  if (!readBytes(header_.serial.data(), serial_len)) {
+    error_ = "corrupt recording header";
+    close();
+    return false;
+  }
+  first_record_offset_ = std::ftell(file_);
+  readCalibration();
+  depth_decoder_.reset();
+  return true;
+}
+
+void RecordingReader::readCalibration() {
+  header_.calibration = DeviceCalibration{};
+  header_.calibration.serial = header_.serial;
+
+  RecordHeaderBytes record{};
+  CalibrationBytes fields{};
+  DepthToColorBytes mapping{};
+  if (readBytes(&record, sizeof(record)) && record.kind == static_cast<std::uint8_t>(RecordKind::kCalibration) &&
+      (record.payload_bytes == sizeof(fields) || record.payload_bytes == sizeof(fields) + sizeof(mapping)) &&
+      readBytes(&fields, sizeof(fields)) &&
+      (record.payload_bytes == sizeof(fields) || readBytes(&mapping, sizeof(mapping)))) {
+    header_.calibration.depth = UnpackIntrinsics(fields.depth);
+    header_.calibration.color = UnpackIntrinsics(fields.color);
+    if (record.payload_bytes > sizeof(fields)) {
+      header_.calibration.depth_to_color = UnpackDepthToColor(mapping);
+    }
+    header_.calibration.from_device = (fields.flags & kCalibrationFromDevice) != 0;
+    first_record_offset_ = std::ftell(file_);
+    return;
+  }
+  std::fseek(file_, first_record_offset_, SEEK_SET);
+}
+
+void RecordingReader::close() {
+  if (file_ != nullptr) {
+    std::fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+bool RecordingReader::rewind() {
+  depth_decoder_.reset();
+  return file_ != nullptr && std::fseek(file_, first_record_offset_, SEEK_SET) == 0;
+}
+
+bool RecordingReader::readBytes(void *data, std::size_t size) {
+  return size == 0 || std::fread(data, 1, size, file_) == size;
+}
+
+bool RecordingReader::readPlane(std::vector<std::uint8_t> *plane, std::size_t expected_bytes) {
+  PlaneHeaderBytes header{};
+  if (!readBytes(&header, sizeof(header)) || header.codec != static_cast<std::uint8_t>(PlaneCodec::kRaw) ||
+      header.bytes > kMaxPlaneBytes || (header.bytes != 0 && header.bytes != expected_bytes)) {
+    return false;
+  }
+  plane->resize(header.bytes);
+  return readBytes(plane->data(), header.bytes);
+}
+
+bool RecordingReader::readColorPlane(FrameData *frame, std::size_t expected_bytes) {
+  PlaneHeaderBytes header{};
+  if (!readBytes(&header, sizeof(header)) || header.bytes > kMaxPlaneBytes) {
+    return false;
+  }
+  std::vector<std::uint8_t> *plane = &frame->rgb;
+  if (header.codec == static_cast<std::uint8_t>(PlaneCodec::kJpeg)) {
+    frame->rgb.clear();
+    plane = &frame->color_jpeg;
+    frame->color_jpeg_width = frame->color_width;
+    frame->color_jpeg_height = frame->color_height;
+  } else if (header.codec == static_cast<std::uint8_t>(PlaneCodec::kRaw) &&
+             (header.bytes == 0 || header.bytes == expected_bytes)) {
+    frame->color_jpeg.clear();
+    frame->color_jpeg_width = 0;
+    frame->color_jpeg_height = 0;
+  } else {
+    return false;
+  }
+  plane->resize(header.bytes);
+  return readBytes(plane->data(), header.bytes);
+}
+
+bool RecordingReader::readDepthPlane(std::vector<std::uint16_t> *plane, std::size_t expected_bytes) {
+  PlaneHeaderBytes header{};
+  if (!readBytes(&header, sizeof(header)) || header.bytes > kMaxPlaneBytes) {
+    return false;
+  }
+  if (header.codec == static_cast<std::uint8_t>(PlaneCodec::kRaw)) {
+    if (header.bytes != 0 && header.bytes != expected_bytes) {
+      return false;
+    }
+    plane->resize(header.bytes / sizeof(std::uint16_t));
+    return readBytes(plane->data(), header.bytes);
+  }
+  const std::size_t pixels = expected_bytes / sizeof(std::uint16_t);
+  if (header.codec != static_cast<std::uint8_t>(PlaneCodec::kRvl) || header.bytes > MaxEncodedDepthBytes(pixels)) {
+    return false;
+  }
+  encoded_depth_.resize(header.bytes);
+  plane->resize(pixels);
+  return readBytes(encoded_depth_.data(), header.bytes) &&
+         depth_decoder_.decode(encoded_depth_.data(), encoded_depth_.size(), plane->data(), pixels);
+}
+
+bool RecordingReader::next(RecordKind *kind, std::uint64_t *host_ns, FrameData *frame, AudioChunk *audio) {
+  if (file_ == nullptr) {
+    return false;
+  }
+  RecordHeaderBytes header{};
+  if (!readBytes(&header, sizeof(header))) {
+    return false;  // clean end of file
+  }
+  *host_ns = header.host_ns;
+
+  if (header.kind == static_cast<std::uint8_t>(RecordKind::kAudio)) {
+    AudioFieldsBytes fields{};
+    if (!readBytes(&fields, sizeof(fields)) || fields.sample_count > kMaxAudioSamples) {
+      error_ = "corrupt audio record";
+      return false;
+    }
+    audio->channels = fields.channels;
+    audio->sample_rate = static_cast<int>(fields.sample_rate);
+    audio->first_frame = fields.first_frame;
+    audio->samples.resize(fields.sample_count);
+    if (!readBytes(audio->samples.data(), fields.sample_count * sizeof(std::int32_t))) {
+      error_ = "truncated audio record";
+      return false;
+    }
+    *kind = RecordKind::kAudio;
+    return true;
+  }
+
+  if (header.kind != static_cast<std::uint8_t>(RecordKind::kFrame)) {
+    // Unknown record from a newer writer: skip it.
+    if (std::fseek(file_, static_cast<long>(header.payload_bytes), SEEK_CUR) != 0) {
+      error_ = "truncated record";
+      return false;
+    }
+    return next(kind, host_ns, frame, audio);
+  }
+
+  FrameFieldsBytes fields{};
+  if (!readBytes(&fields, sizeof(fields))) {
+    error_ = "truncated frame record";
+    return false;
+  }
+  frame->timestamp = fields.device_ts;
+  frame->width = fields.width;
+  frame->height = fields.height;
+  frame->color_width = fields.color_width;
+  frame->color_height = fields.color_height;
+  frame->depth_width = fields.depth_width;
+  frame->depth_height = fields.depth_height;
+  frame->ir_width = fields.ir_width;
+  frame->ir_height = fields.ir_height;
+
+  if (!readColorPlane(frame, PlaneSize(fields.color_width, fields.color_height, 3)) ||
+      !readDepthPlane(&frame->depth, PlaneSize(fields.depth_width, fields.depth_height, sizeof(std::uint16_t))) ||
+      !readPlane(&frame->ir, PlaneSize(fields.ir_width, fields.ir_height, 1))) {
+    error_ = "corrupt frame plane";
+    return false;
+  }
+  *kind = RecordKind::kFrame;
+  return true;
+}
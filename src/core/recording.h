@@ -0,0 +1,164 @@
+#pragma once
+
+#include "backends/backend.h"
+#include "core/depth_codec.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streaming session recording (.krec): every frame plane, microphone audio,
+// device timestamps and host arrival times, in capture order.
+//
+// Layout (little-endian):
+//   file header   "KREC", u32 version, u32 generation (1|2), u32 serial_len, serial
+//   record        u8 kind, u8[3] reserved, u32 payload_bytes, u64 host_ns
+//   frame payload u32 device_ts, i32 width, height, color_w, color_h, depth_w,
+//                 depth_h, ir_w, ir_h, then rgb/depth/ir planes, each as
+//                 u8 codec, u8[3] reserved, u32 bytes, data; depth planes
+//                 may be RVL coded (version 2, see core/depth_codec.h) and
+//                 color planes the device's JPEG (version 3)
+//   audio payload u16 channels, u16 reserved, u32 sample_rate, u64 first_frame,
+//                 u32 sample_count, u32 reserved, i32 samples[sample_count]
+//   calibration   u32 flags (bit 0: from device), u32 reserved, then depth and
+//   payload       color as i32 width, height, f32 fx, fy, cx, cy, k1, k2, k3,
+//                 p1, p2, then (newer files) the depth-to-color model as
+//                 u32 flags (bit 0: polynomial), f32 baseline_mm, shift_d,
+//                 shift_m, mx[10], my[10]; optional, only as the first record
+//
+// host_ns is relative to the first record, so replay can reproduce the
+// original pacing.
+
+// Version 2 added RVL depth planes and version 3 JPEG color planes; older
+// files are still read.
+constexpr std::uint32_t kRecordingVersion = 3;
+
+enum class RecordKind : std::uint8_t {
+  kFrame = 1,
+  kAudio = 2,
+  kCalibration = 3,
+};
+
+enum class PlaneCodec : std::uint8_t {
+  kRaw = 0,
+  kRvl = 1,
+  kJpeg = 2,
+};
+
+struct RecordingHeader {
+  KinectGeneration generation = KinectGeneration::kV1;
+  std::string serial;
+  // Written when either camera is valid, so replays keep the device model.
+  DeviceCalibration calibration;
+};
+
+struct RecordingOptions {
+  // Lossless RVL depth, about a quarter of the raw size; the writer thread
+  // pays for it, not the capture loop.
+  bool compress_depth = true;
+  DepthCodecOptions depth_codec;
+};
+
+// Writes on a background thread so capture loops only pay for a copy. Queued
+// records are bounded; when the disk falls behind, write calls block rather
+// than drop data.
+class RecordingWriter {
+ public:
+  RecordingWriter() = default;
+  ~RecordingWriter();
+
+  RecordingWriter(const RecordingWriter &) = delete;
+  RecordingWriter &operator=(const RecordingWriter &) = delete;
+
+  bool open(const std::string &path, const RecordingHeader &header,
+            const RecordingOptions &options = RecordingOptions());
+  bool isOpen() const { return file_ != nullptr; }
+
+  // |host_ns| is any monotonic clock (e.g. TelemetryNowNs()); it is rebased
+  // on the first record.
+  bool writeFrame(FrameData frame, std::uint64_t host_ns);
+  bool writeAudio(AudioChunk chunk, std::uint64_t host_ns);
+
+  // Flushes pending records and closes the file. Returns false if any write
+  // failed.
+  bool close();
+
+  std::uint64_t framesWritten() const { return frames_written_.load(std::memory_order_relaxed); }
+  std::uint64_t bytesWritten() const { return bytes_written_.load(std::memory_order_relaxed); }
+  // Depth plane bytes before and after coding.
+  std::uint64_t rawDepthBytes() const { return raw_depth_bytes_.load(std::memory_order_relaxed); }
+  std::uint64_t encodedDepthBytes() const { return encoded_depth_bytes_.load(std::memory_order_relaxed); }
+
+ private:
+  struct PendingRecord {
+    RecordKind kind = RecordKind::kFrame;
+    std::uint64_t host_ns = 0;
+    FrameData frame;
+    AudioChunk audio;
+  };
+
+  bool enqueue(PendingRecord record);
+  void writerLoop();
+  bool writeRecord(const PendingRecord &record);
+  bool writeBytes(const void *data, std::size_t size);
+
+  std::FILE *file_ = nullptr;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<PendingRecord> queue_;
+  bool closing_ = false;
+  bool failed_ = false;
+  bool have_origin_ = false;
+  std::uint64_t origin_ns_ = 0;
+  std::atomic<std::uint64_t> frames_written_{0};
+  std::atomic<std::uint64_t> bytes_written_{0};
+  std::atomic<std::uint64_t> raw_depth_bytes_{0};
+  std::atomic<std::uint64_t> encoded_depth_bytes_{0};
+  // Writer thread only.
+  bool compress_depth_ = true;
+  DepthEncoder depth_encoder_;
+  std::vector<std::uint8_t> encoded_depth_;
+};
+
+class RecordingReader {
+ public:
+  RecordingReader() = default;
+  ~RecordingReader();
+
+  RecordingReader(const RecordingReader &) = delete;
+  RecordingReader &operator=(const RecordingReader &) = delete;
+
+  bool open(const std::string &path);
+  void close();
+  const RecordingHeader &header() const { return header_; }
+  const std::string &error() const { return error_; }
+
+  // Reads the next record into |frame| or |audio| (buffers are reused).
+  // Returns false at end of file or on a malformed record (see error()).
+  bool next(RecordKind *kind, std::uint64_t *host_ns, FrameData *frame, AudioChunk *audio);
+
+  // Seeks back to the first record.
+  bool rewind();
+
+ private:
+  bool readBytes(void *data, std::size_t size);
+  void readCalibration();
+  bool readPlane(std::vector<std::uint8_t> *plane, std::size_t expected_bytes);
+  // Raw RGB into FrameData::rgb or JPEG into FrameData::color_jpeg.
+  bool readColorPlane(FrameData *frame, std::size_t expected_bytes);
+  bool readDepthPlane(std::vector<std::uint16_t> *plane, std::size_t expected_bytes);
+
+  std::FILE *file_ = nullptr;
+  long first_record_offset_ = 0;
+  RecordingHeader header_;
+  std::string error_;
+  DepthDecoder depth_decoder_;
+  std::vector<std::uint8_t> encoded_depth_;
+};
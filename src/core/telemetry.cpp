@@ -0,0 +1,259 @@
+#include "core/telemetry.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+namespace {
+
+// EWMA weights as power-of-two shifts: frame interval over ~8 frames, jitter
+// over 16 frames (RFC 3550 style), stage durations over 16 samples.
+constexpr int kIntervalShift = 3;
+constexpr int kJitterShift = 4;
+constexpr int kStageShift = 4;
+
+std::uint64_t Ewma(std::uint64_t current, std::uint64_t sample, int shift) {
+  if (current == 0) {
+    return sample;
+  }
+  const auto diff = static_cast<std::int64_t>(sample) - static_cast<std::int64_t>(current);
+  return static_cast<std::uint64_t>(static_cast<std::int64_t>(current) + diff / (std::int64_t{1} << shift));
+}
+
+std::size_t LatencyBucket(std::uint64_t latency_ns) {
+  std::uint64_t us = latency_ns / 1000;
+  std::size_t bucket = 0;
+  while (us > 1 && bucket + 1 < kLatencyBucketCount) {
+    us >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+double BucketMidpointMs(std::size_t bucket) {
+  const double lower_us = bucket == 0 ? 0.0 : static_cast<double>(std::uint64_t{1} << bucket);
+  const double upper_us = static_cast<double>(std::uint64_t{1} << (bucket + 1));
+  return (lower_us + upper_us) * 0.5 / 1000.0;
+}
+
+double Percentile(const std::array<std::uint64_t, kLatencyBucketCount> &histogram, std::uint64_t total, double p) {
+  if (total == 0) {
+    return 0.0;
+  }
+  const auto target = static_cast<std::uint64_t>(std::ceil(static_cast<double>(total) * p));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < histogram.size(); ++i) {
+    seen += histogram[i];
+    if (seen >= target) {
+      return BucketMidpointMs(i);
+    }
+  }
+  return BucketMidpointMs(histogram.size() - 1);
+}
+
+void AtomicMax(std::atomic<std::uint64_t> &target, std::uint64_t value) {
+  std::uint64_t previous = target.load(std::memory_order_relaxed);
+  while (previous < value && !target.compare_exchange_weak(previous, value, std::memory_order_relaxed)) {
+  }
+}
+
+}  // namespace
+
+const char *TelemetryStreamLabel(TelemetryStream stream) {
+  switch (stream) {
+    case TelemetryStream::kRgb:
+      return "rgb";
+    case TelemetryStream::kIr:
+      return "ir";
+    case TelemetryStream::kDepth:
+      return "depth";
+    case TelemetryStream::kAudio:
+      return "audio";
+  }
+  return "unknown";
+}
+
+const char *TelemetryStageLabel(TelemetryStage stage) {
+  switch (stage) {
+    case TelemetryStage::kColorConvert:
+      return "color_convert";
+    case TelemetryStage::kDepthConvert:
+      return "depth_convert";
+    case TelemetryStage::kIrConvert:
+      return "ir_convert";
+    case TelemetryStage::kAudioConvert:
+      return "audio_convert";
+    case TelemetryStage::kDelivery:
+      return "delivery";
+    case TelemetryStage::kRegistration:
+      return "registration";
+    case TelemetryStage::kDepthFilter:
+      return "depth_filter";
+    case TelemetryStage::kDepthPyramid:
+      return "depth_pyramid";
+    case TelemetryStage::kPlaneDetection:
+      return "plane_detection";
+    case TelemetryStage::kForeground:
+      return "foreground";
+    case TelemetryStage::kBlobTracking:
+      return "blob_tracking";
+    case TelemetryStage::kDepthDecode:
+      return "depth_decode";
+  }
+  return "unknown";
+}
+
+void StreamTelemetry::recordArrival(std::uint64_t host_ns, std::uint32_t device_timestamp, bool has_device_timestamp) {
+  const std::uint64_t previous = last_arrival_ns_.load(std::memory_order_relaxed);
+  if (previous != 0 && host_ns > previous) {
+    const std::uint64_t interval = host_ns - previous;
+    const std::uint64_t mean = Ewma(interval_ewma_ns_.load(std::memory_order_relaxed), interval, kIntervalShift);
+    interval_ewma_ns_.store(mean, std::memory_order_relaxed);
+
+    const std::uint64_t deviation = interval > mean ? interval - mean : mean - interval;
+    jitter_ewma_ns_.store(Ewma(jitter_ewma_ns_.load(std::memory_order_relaxed), deviation, kJitterShift),
+                          std::memory_order_relaxed);
+  }
+  last_arrival_ns_.store(host_ns, std::memory_order_relaxed);
+
+  if (has_device_timestamp) {
+    if (have_device_ts_) {
+      // Unsigned subtraction handles 32-bit counter wrap.
+      const std::uint64_t delta = static_cast<std::uint32_t>(device_timestamp - last_device_ts_);
+      if (delta > 0) {
+        if (nominal_device_delta_ == 0 || delta * 4 < nominal_device_delta_ * 3) {
+          // First sample, or the device switched to a faster mode.
+          nominal_device_delta_ = delta;
+        } else if (delta * 2 < nominal_device_delta_ * 3) {
+          nominal_device_delta_ = Ewma(nominal_device_delta_, delta, kJitterShift);
+        } else {
+          const std::uint64_t missing = (delta + nominal_device_delta_ / 2) / nominal_device_delta_;
+          if (missing > 1) {
+            dropped_.fetch_add(missing - 1, std::memory_order_relaxed);
+          }
+        }
+      }
+    }
+    last_device_ts_ = device_timestamp;
+    have_device_ts_ = true;
+  }
+
+  frames_.fetch_add(1, std::memory_order_release);
+}
+
+void StreamTelemetry::recordLatency(std::uint64_t latency_ns) {
+  latency_buckets_[LatencyBucket(latency_ns)].fetch_add(1, std::memory_order_relaxed);
+}
+
+StreamSnapshot StreamTelemetry::snapshot(std::uint64_t now_ns) const {
+  StreamSnapshot out;
+  out.frames = frames_.load(std::memory_order_acquire);
+  out.dropped = dropped_.load(std::memory_order_relaxed);
+
+  const std::uint64_t interval = interval_ewma_ns_.load(std::memory_order_relaxed);
+  const std::uint64_t last = last_arrival_ns_.load(std::memory_order_relaxed);
+  if (out.frames >= 2 && interval > 0) {
+    // If the stream stalls, let the rate decay instead of freezing at the
+    // last good value.
+    std::uint64_t effective = interval;
+    if (now_ns > last && now_ns - last > interval * 2) {
+      effective = now_ns - last;
+    }
+    out.fps = 1e9 / static_cast<double>(effective);
+  }
+  out.jitter_ms = static_cast<double>(jitter_ewma_ns_.load(std::memory_order_relaxed)) / 1e6;
+
+  for (std::size_t i = 0; i < kLatencyBucketCount; ++i) {
+    out.latency_histogram[i] = latency_buckets_[i].load(std::memory_order_relaxed);
+    out.latency_samples += out.latency_histogram[i];
+  }
+  out.latency_p50_ms = Percentile(out.latency_histogram, out.latency_samples, 0.50);
+  out.latency_p99_ms = Percentile(out.latency_histogram, out.latency_samples, 0.99);
+  return out;
+}
+
+void StreamTelemetry::reset() {
+  frames_.store(0, std::memory_order_relaxed);
+  dropped_.store(0, std::memory_order_relaxed);
+  last_arrival_ns_.store(0, std::memory_order_relaxed);
+  interval_ewma_ns_.store(0, std::memory_order_relaxed);
+  jitter_ewma_ns_.store(0, std::memory_order_relaxed);
+  for (auto &bucket : latency_buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  have_device_ts_ = false;
+  nominal_device_delta_ = 0;
+}
+
+void StageTelemetry::record(std::uint64_t duration_ns) {
+  samples_.fetch_add(1, std::memory_order_relaxed);
+  total_ns_.fetch_add(duration_ns, std::memory_order_relaxed);
+  ewma_ns_.store(Ewma(ewma_ns_.load(std::memory_order_relaxed), duration_ns, kStageShift), std::memory_order_relaxed);
+  AtomicMax(max_ns_, duration_ns);
+}
+
+StageSnapshot StageTelemetry::snapshot() const {
+  StageSnapshot out;
+  out.samples = samples_.load(std::memory_order_relaxed);
+  if (out.samples > 0) {
+    out.avg_ms = static_cast<double>(total_ns_.load(std::memory_order_relaxed)) / static_cast<double>(out.samples) / 1e6;
+  }
+  out.recent_ms = static_cast<double>(ewma_ns_.load(std::memory_order_relaxed)) / 1e6;
+  out.max_ms = static_cast<double>(max_ns_.load(std::memory_order_relaxed)) / 1e6;
+  return out;
+}
+
+void StageTelemetry::reset() {
+  samples_.store(0, std::memory_order_relaxed);
+  total_ns_.store(0, std::memory_order_relaxed);
+  ewma_ns_.store(0, std::memory_order_relaxed);
+  max_ns_.store(0, std::memory_order_relaxed);
+}
+
+TelemetrySnapshot DeviceTelemetry::snapshot() const {
+  TelemetrySnapshot out;
+  const std::uint64_t now = TelemetryNowNs();
+  for (std::size_t i = 0; i < kTelemetryStreamCount; ++i) {
+    out.streams[i] = streams_[i].snapshot(now);
+  }
+  for (std::size_t i = 0; i < kTelemetryStageCount; ++i) {
+    out.stages[i] = stages_[i].snapshot();
+  }
+  return out;
+}
+
+void DeviceTelemetry::reset() {
+  for (auto &stream : streams_) {
+    stream.reset();
+  }
+  for (auto &stage : stages_) {
+    stage.reset();
+  }
+}
+
+std::string FormatStreamTelemetry(TelemetryStream stream, const StreamSnapshot &snapshot) {
+  char line[192];
+  std::snprintf(line, sizeof(line), "%s: %.1f fps  jitter %.2f ms  latency p50/p99 %.2f/%.2f ms  dropped %llu  frames %llu",
+                TelemetryStreamLabel(stream), snapshot.fps, snapshot.jitter_ms, snapshot.latency_p50_ms,
+                snapshot.latency_p99_ms, static_cast<unsigned long long>(snapshot.dropped),
+                static_cast<unsigned long long>(snapshot.frames));
+  return line;
+}
+
+std::string FormatStageTelemetry(const TelemetrySnapshot &snapshot) {
+  std::ostringstream out;
+  bool first = true;
+  for (std::size_t i = 0; i < kTelemetryStageCount; ++i) {
+    const StageSnapshot &stage = snapshot.stages[i];
+    if (stage.samples == 0) {
+      continue;
+    }
+    char item[96];
+    std::snprintf(item, sizeof(item), "%s %.2f ms (max %.2f)", TelemetryStageLabel(static_cast<TelemetryStage>(i)),
+                  stage.recent_ms, stage.max_ms);
+    out << (first ? "" : "  ") << item;
+    first = false;
+  }
+  return out.str();
+}
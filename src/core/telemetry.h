@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Capture-path statistics shared between a device's producer threads and any
+// number of readers (CLI, bridge, overlays). Every field is an atomic, so
+// snapshot() never takes a lock and never blocks the capture callback.
+//
+// Each stream is expected to have a single writer (the libfreenect callback or
+// the backend update() thread). Latency and stage samples may come from any
+// thread.
+
+enum class TelemetryStream {
+  kRgb = 0,
+  kIr = 1,
+  kDepth = 2,
+  kAudio = 3,
+};
+constexpr std::size_t kTelemetryStreamCount = 4;
+
+enum class TelemetryStage {
+  kColorConvert = 0,
+  kDepthConvert = 1,
+  kIrConvert = 2,
+  kAudioConvert = 3,
+  kDelivery = 4,
+  kRegistration = 5,
+  kDepthFilter = 6,
+  kDepthPyramid = 7,
+  kPlaneDetection = 8,
+  kForeground = 9,
+  kBlobTracking = 10,
+  kDepthDecode = 11,
+};
+constexpr std::size_t kTelemetryStageCount = 12;
+
+// Callback-to-consumer latency buckets: bucket i counts samples in
+// [2^i, 2^(i+1)) microseconds, the last bucket is open ended (>= ~0.5 s).
+constexpr std::size_t kLatencyBucketCount = 20;
+
+const char *TelemetryStreamLabel(TelemetryStream stream);
+const char *TelemetryStageLabel(TelemetryStage stage);
+
+inline std::uint64_t TelemetryNowNs() {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+struct StreamSnapshot {
+  std::uint64_t frames = 0;
+  std::uint64_t dropped = 0;
+  double fps = 0.0;
+  double jitter_ms = 0.0;
+  double latency_p50_ms = 0.0;
+  double latency_p99_ms = 0.0;
+  std::uint64_t latency_samples = 0;
+  std::array<std::uint64_t, kLatencyBucketCount> latency_histogram{};
+};
+
+struct StageSnapshot {
+  std::uint64_t samples = 0;
+  double avg_ms = 0.0;
+  double recent_ms = 0.0;
+  double max_ms = 0.0;
+};
+
+struct TelemetrySnapshot {
+  std::array<StreamSnapshot, kTelemetryStreamCount> streams{};
+  std::array<StageSnapshot, kTelemetryStageCount> stages{};
+
+  const StreamSnapshot &stream(TelemetryStream s) const { return streams[static_cast<std::size_t>(s)]; }
+  const StageSnapshot &stage(TelemetryStage s) const { return stages[static_cast<std::size_t>(s)]; }
+};
+
+class StreamTelemetry {
+ public:
+  // Records one frame arriving from the device. |device_timestamp| is the
+  // hardware counter carried by the frame; gaps larger than the learned
+  // nominal period are counted as dropped frames. Pass has_device_timestamp =
+  // false for sources without a monotonic hardware clock.
+  void recordArrival(std::uint64_t host_ns, std::uint32_t device_timestamp, bool has_device_timestamp = true);
+
+  // Records the time between a frame's arrival and its hand-off to a consumer.
+  void recordLatency(std::uint64_t latency_ns);
+
+  StreamSnapshot snapshot(std::uint64_t now_ns) const;
+  void reset();
+
+ private:
+  std::atomic<std::uint64_t> frames_{0};
+  std::atomic<std::uint64_t> dropped_{0};
+  std::atomic<std::uint64_t> last_arrival_ns_{0};
+  std::atomic<std::uint64_t> interval_ewma_ns_{0};
+  std::atomic<std::uint64_t> jitter_ewma_ns_{0};
+  std::array<std::atomic<std::uint64_t>, kLatencyBucketCount> latency_buckets_{};
+
+  // Writer-only state (single producer per stream).
+  std::uint32_t last_device_ts_ = 0;
+  bool have_device_ts_ = false;
+  std::uint64_t nominal_device_delta_ = 0;
+};
+
+class StageTelemetry {
+ public:
+  void record(std::uint64_t duration_ns);
+  StageSnapshot snapshot() const;
+  void reset();
+
+ private:
+  std::atomic<std::uint64_t> samples_{0};
+  std::atomic<std::uint64_t> total_ns_{0};
+  std::atomic<std::uint64_t> ewma_ns_{0};
+  std::atomic<std::uint64_t> max_ns_{0};
+};
+
+class DeviceTelemetry {
+ public:
+  StreamTelemetry &stream(TelemetryStream s) { return streams_[static_cast<std::size_t>(s)]; }
+  StageTelemetry &stage(TelemetryStage s) { return stages_[static_cast<std::size_t>(s)]; }
+
+  TelemetrySnapshot snapshot() const;
+  void reset();
+
+ private:
+  std::array<StreamTelemetry, kTelemetryStreamCount> streams_;
+  std::array<StageTelemetry, kTelemetryStageCount> stages_;
+};
+
+// Times a conversion stage for the lifetime of the scope.
+class ScopedStageTimer {
+ public:
+  explicit ScopedStageTimer(StageTelemetry &stage) : stage_(stage), start_ns_(TelemetryNowNs()) {}
+  ~ScopedStageTimer() { stage_.record(TelemetryNowNs() - start_ns_); }
+
+  ScopedStageTimer(const ScopedStageTimer &) = delete;
+  ScopedStageTimer &operator=(const ScopedStageTimer &) = delete;
+
+ private:
+  StageTelemetry &stage_;
+  std::uint64_t start_ns_;
+};
+
+// One-line human readable summary, e.g. for the CLI and GL overlays.
+std::string FormatStreamTelemetry(TelemetryStream stream, const StreamSnapshot &snapshot);
+std::string FormatStageTelemetry(const TelemetrySnapshot &snapshot);
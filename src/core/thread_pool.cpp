@@ -0,0 +1,132 @@
+#include "core/thread_pool.h"
+
+#include "core/trace.h"
+
+#include <algorithm>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+ThreadPool::ThreadPool(int threads) {
+  if (threads <= 0) {
+    threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+  }
+  workers_.reserve(static_cast<std::size_t>(threads - 1));
+  for (int i = 1; i < threads; ++i) {
+    workers_.emplace_back(&ThreadPool::workerLoop, this, i - 1);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::parallelFor(int count, int grain, int max_threads,
+                             const std::function<void(int begin, int end)> &body) {
+  if (count <= 0) {
+    return;
+  }
+  grain = std::max(1, grain);
+  const int lanes = threadsFor(max_threads);
+  // A few chunks per thread so an unlucky preemption does not stall the call.
+  const int target_chunks = lanes * 4;
+  const int chunk = std::max(grain, (count + target_chunks - 1) / target_chunks);
+  const int chunks = (count + chunk - 1) / chunk;
+  bool idle = false;
+  if (lanes == 1 || chunks == 1 || !busy_.compare_exchange_strong(idle, true, std::memory_order_acquire)) {
+    body(0, count);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    body_ = &body;
+    count_ = count;
+    chunk_ = chunk;
+    chunks_ = chunks;
+    job_workers_ = lanes - 1;
+    next_chunk_.store(0, std::memory_order_relaxed);
+    active_workers_ = lanes - 1;
+    ++generation_;
+  }
+  wake_.notify_all();
+  runChunks();
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return active_workers_ == 0; });
+    body_ = nullptr;
+  }
+  busy_.store(false, std::memory_order_release);
+}
+
+void ThreadPool::runChunks() {
+  while (true) {
+    const int index = next_chunk_.fetch_add(1, std::memory_order_relaxed);
+    if (index >= chunks_) {
+      return;
+    }
+    const int begin = index * chunk_;
+    (*body_)(begin, std::min(count_, begin + chunk_));
+  }
+}
+
+void ThreadPool::workerLoop(int index) {
+  TraceSetThreadName("thread-pool");
+  std::uint64_t seen = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+    if (stopping_) {
+      return;
+    }
+    seen = generation_;
+    if (index >= job_workers_) {
+      continue;
+    }
+    lock.unlock();
+    runChunks();
+    lock.lock();
+    if (--active_workers_ == 0) {
+      done_.notify_one();
+    }
+  }
+}
+
+ThreadPool &SharedThreadPool() {
+  static ThreadPool pool;
+  return pool;
+}
+
+bool PinCurrentThreadToCore(int core) {
+  const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+  core = ((core % cores) + cores) % cores;
+#if defined(__APPLE__)
+  thread_affinity_policy_data_t policy = {core + 1};
+  const thread_port_t thread = mach_thread_self();
+  const kern_return_t rc = thread_policy_set(thread, THREAD_AFFINITY_POLICY,
+                                             reinterpret_cast<thread_policy_t>(&policy), THREAD_AFFINITY_POLICY_COUNT);
+  mach_port_deallocate(mach_task_self(), thread);
+  return rc == KERN_SUCCESS;
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(core, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)core;
+  return false;
+#endif
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel kernels. parallelFor() splits
+// a range into chunks that the workers and the calling thread claim until
+// none are left, and returns once every chunk has run. With one thread (or a
+// single chunk) the body runs inline on the caller.
+//
+// Threads may share a pool: a parallelFor() that finds it busy with another
+// call (another device's frame, or a body calling back into the pool) runs
+// its whole range inline instead of waiting, so concurrent callers each keep
+// their own thread and never queue behind one another.
+//
+// The processing stages all run on SharedThreadPool(), most of them over
+// bands of rows, and keep their buffers from one frame to the next, so
+// steady-state streaming neither starts threads nor allocates.
+class ThreadPool {
+ public:
+  // |threads| counts the caller; 0 uses the hardware concurrency.
+  explicit ThreadPool(int threads = 0);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  int threads() const { return static_cast<int>(workers_.size()) + 1; }
+  // Threads a call limited to |max_threads| (0: no limit) runs on.
+  int threadsFor(int max_threads) const {
+    return max_threads > 0 && max_threads < threads() ? max_threads : threads();
+  }
+
+  // Calls body(begin, end) over [0, count) in chunks of at least |grain|.
+  void parallelFor(int count, int grain, const std::function<void(int begin, int end)> &body) {
+    parallelFor(count, grain, 0, body);
+  }
+  // The same on at most |max_threads| threads including the caller (0: all
+  // of them).
+  void parallelFor(int count, int grain, int max_threads, const std::function<void(int begin, int end)> &body);
+
+ private:
+  void workerLoop(int index);
+  void runChunks();
+
+  std::vector<std::thread> workers_;
+  std::atomic<bool> busy_{false};
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  bool stopping_ = false;
+  std::uint64_t generation_ = 0;
+
+  // Current job; written under |mutex_| before |generation_| advances.
+  const std::function<void(int, int)> *body_ = nullptr;
+  int count_ = 0;
+  int chunk_ = 1;
+  int chunks_ = 0;
+  // Workers with a lower index take part in the current job.
+  int job_workers_ = 0;
+  std::atomic<int> next_chunk_{0};
+  int active_workers_ = 0;
+};
+
+// The process-wide pool, one thread per hardware thread, created on first
+// use. Processing stages run on it rather than on pools of their own, so
+// the worker count stays at the core count however many devices and stages
+// are active; a stage's |threads| option becomes its parallelFor() limit.
+ThreadPool &SharedThreadPool();
+
+// Pins the calling thread to one hardware thread, |core| modulo the hardware
+// concurrency: a CPU affinity mask on Linux, an affinity tag (a scheduling
+// hint that keeps tagged threads apart) on macOS. Returns false where
+// neither is available or the call fails.
+bool PinCurrentThreadToCore(int core);
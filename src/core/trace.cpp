@@ -0,0 +1,311 @@
+#include "core/trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+  const char *name = nullptr;
+  std::uint64_t start_ns = 0;
+  std::uint64_t duration_ns = 0;
+  // Writer's trace thread id: a recycled ring holds events of several
+  // threads.
+  std::uint32_t tid = 0;
+  char phase = 'X';
+};
+
+struct TraceRing {
+  std::array<TraceEvent, kTraceRingCapacity> events;
+  std::atomic<std::uint64_t> head{0};
+  // Set while the owning thread writes an event; the dump waits for it to
+  // clear after recording stops.
+  std::atomic<bool> writing{false};
+  // Cleared when the owning thread exits; the next new thread takes the ring
+  // over instead of allocating another.
+  std::atomic<bool> owned{true};
+  // Current owner's trace thread id, written under the registry lock.
+  std::uint32_t tid = 0;
+  // Names of the threads with events in the ring, under the registry lock.
+  std::vector<std::pair<std::uint32_t, std::string>> names;
+};
+
+std::atomic<bool> g_trace_enabled{false};
+std::atomic<std::uint32_t> g_next_tid{1};
+std::mutex g_registry_mutex;
+
+std::vector<std::shared_ptr<TraceRing>> &Registry() {
+  static std::vector<std::shared_ptr<TraceRing>> rings;
+  return rings;
+}
+
+// Rings stay registered after their thread exits so the dump can still read
+// them, and are handed to the next thread that records, so the registry grows
+// with the most threads alive at once rather than with every thread ever
+// started. The thread-local handle only avoids the registry lock on the hot
+// path.
+struct RingHandle {
+  ~RingHandle() {
+    if (ring != nullptr) {
+      ring->owned.store(false, std::memory_order_release);
+    }
+  }
+  TraceRing *ring = nullptr;
+};
+thread_local RingHandle t_ring;
+thread_local std::string t_pending_name;
+
+std::uint64_t TraceNowNs() {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+// Drops the names of threads none of whose events are left in |ring|.
+void PruneNames(TraceRing *ring) {
+  const std::uint64_t head = ring->head.load(std::memory_order_acquire);
+  const std::uint64_t first = head > kTraceRingCapacity ? head - kTraceRingCapacity : 0;
+  auto &names = ring->names;
+  names.erase(std::remove_if(names.begin(), names.end(),
+                             [&](const std::pair<std::uint32_t, std::string> &entry) {
+                               for (std::uint64_t i = first; i < head; ++i) {
+                                 if (ring->events[i % kTraceRingCapacity].tid == entry.first) {
+                                   return false;
+                                 }
+                               }
+                               return true;
+                             }),
+              names.end());
+}
+
+TraceRing *ThreadRing() {
+  if (t_ring.ring == nullptr) {
+    const std::uint32_t tid = g_next_tid.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    TraceRing *ring = nullptr;
+    for (const auto &candidate : Registry()) {
+      if (!candidate->owned.load(std::memory_order_acquire)) {
+        ring = candidate.get();
+        ring->owned.store(true, std::memory_order_relaxed);
+        PruneNames(ring);
+        break;
+      }
+    }
+    if (ring == nullptr) {
+      Registry().push_back(std::make_shared<TraceRing>());
+      ring = Registry().back().get();
+    }
+    ring->tid = tid;
+    if (!t_pending_name.empty()) {
+      ring->names.emplace_back(tid, t_pending_name);
+    }
+    t_ring.ring = ring;
+  }
+  return t_ring.ring;
+}
+
+void PushEvent(const char *name, std::uint64_t start_ns, std::uint64_t duration_ns, char phase) {
+  TraceRing *ring = ThreadRing();
+  // Flag, then re-check: paired with QuiesceWriters(), either this thread
+  // sees recording stopped or the dump sees the flag and waits for it.
+  ring->writing.store(true, std::memory_order_seq_cst);
+  if (!g_trace_enabled.load(std::memory_order_seq_cst)) {
+    ring->writing.store(false, std::memory_order_release);
+    return;
+  }
+  const std::uint64_t head = ring->head.load(std::memory_order_relaxed);
+  TraceEvent &event = ring->events[head % kTraceRingCapacity];
+  event.name = name;
+  event.start_ns = start_ns;
+  event.duration_ns = duration_ns;
+  event.tid = ring->tid;
+  event.phase = phase;
+  ring->head.store(head + 1, std::memory_order_release);
+  ring->writing.store(false, std::memory_order_release);
+}
+
+// Called with recording stopped and the registry locked: waits out events
+// that were being written when it stopped. Rings registered later see
+// recording off before they write.
+void QuiesceWriters(const std::vector<std::shared_ptr<TraceRing>> &rings) {
+  for (const auto &ring : rings) {
+    while (ring->writing.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void WriteJsonString(std::FILE *file, const char *text) {
+  std::fputc('"', file);
+  for (const char *c = text; c != nullptr && *c != '\0'; ++c) {
+    if (*c == '"' || *c == '\\') {
+      std::fputc('\\', file);
+    }
+    std::fputc(*c, file);
+  }
+  std::fputc('"', file);
+}
+
+double MeasureEventCost() {
+  // Mirrors the work of one TraceScope: two clock reads, the writing flag
+  // and a ring store.
+  constexpr int kIterations = 4096;
+  static std::array<TraceEvent, 64> scratch;
+  static std::atomic<bool> writing{false};
+  const std::uint64_t begin = TraceNowNs();
+  for (int i = 0; i < kIterations; ++i) {
+    const std::uint64_t start = TraceNowNs();
+    writing.store(true, std::memory_order_seq_cst);
+    TraceEvent &event = scratch[static_cast<std::size_t>(i) % scratch.size()];
+    event.name = "calibration";
+    event.start_ns = start;
+    event.duration_ns = TraceNowNs() - start;
+    event.tid = 1;
+    event.phase = 'X';
+    writing.store(false, std::memory_order_release);
+  }
+  return static_cast<double>(TraceNowNs() - begin) / kIterations;
+}
+
+}  // namespace
+
+void TraceStart() {
+  g_trace_enabled.store(true, std::memory_order_release);
+}
+
+void TraceStop() {
+  g_trace_enabled.store(false, std::memory_order_seq_cst);
+}
+
+bool TraceIsEnabled() {
+  return g_trace_enabled.load(std::memory_order_relaxed);
+}
+
+void TraceSetThreadName(const char *name) {
+  t_pending_name = name != nullptr ? name : "";
+  if (t_ring.ring != nullptr) {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    TraceRing *ring = t_ring.ring;
+    auto entry = std::find_if(ring->names.begin(), ring->names.end(),
+                              [&](const std::pair<std::uint32_t, std::string> &e) { return e.first == ring->tid; });
+    if (entry != ring->names.end()) {
+      entry->second = t_pending_name;
+    } else if (!t_pending_name.empty()) {
+      ring->names.emplace_back(ring->tid, t_pending_name);
+    }
+  }
+}
+
+void TraceInstant(const char *name) {
+  if (!g_trace_enabled.load(std::memory_order_relaxed)) {
+    return;
+  }
+  PushEvent(name, TraceNowNs(), 0, 'i');
+}
+
+TraceScope::TraceScope(const char *name) : name_(name), start_ns_(0) {
+  if (g_trace_enabled.load(std::memory_order_relaxed)) {
+    start_ns_ = TraceNowNs();
+  }
+}
+
+TraceScope::~TraceScope() {
+  if (start_ns_ != 0) {
+    PushEvent(name_, start_ns_, TraceNowNs() - start_ns_, 'X');
+  }
+}
+
+TraceStats TraceCollectStats() {
+  TraceStats stats;
+  {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    stats.threads = Registry().size();
+    for (const auto &ring : Registry()) {
+      const std::uint64_t head = ring->head.load(std::memory_order_acquire);
+      stats.events += head;
+      if (head > kTraceRingCapacity) {
+        stats.overwritten += head - kTraceRingCapacity;
+      }
+    }
+  }
+  static const double cost = MeasureEventCost();
+  stats.ns_per_event = cost;
+  return stats;
+}
+
+bool TraceWriteChromeJson(const std::string &path) {
+  TraceStop();
+
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(g_registry_mutex);
+  const auto &rings = Registry();
+  QuiesceWriters(rings);
+
+  // Rebase timestamps on the earliest retained event so the viewer opens at 0.
+  std::uint64_t origin = UINT64_MAX;
+  for (const auto &ring : rings) {
+    const std::uint64_t head = ring->head.load(std::memory_order_acquire);
+    const std::uint64_t first = head > kTraceRingCapacity ? head - kTraceRingCapacity : 0;
+    for (std::uint64_t i = first; i < head; ++i) {
+      origin = std::min(origin, ring->events[i % kTraceRingCapacity].start_ns);
+    }
+  }
+  if (origin == UINT64_MAX) {
+    origin = 0;
+  }
+
+  std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+  bool first_event = true;
+  auto separator = [&]() {
+    if (!first_event) {
+      std::fputs(",\n", file);
+    }
+    first_event = false;
+  };
+
+  for (const auto &ring : rings) {
+    for (const auto &entry : ring->names) {
+      if (entry.second.empty()) {
+        continue;
+      }
+      separator();
+      std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", entry.first);
+      WriteJsonString(file, entry.second.c_str());
+      std::fputs("}}", file);
+    }
+
+    const std::uint64_t head = ring->head.load(std::memory_order_acquire);
+    const std::uint64_t first = head > kTraceRingCapacity ? head - kTraceRingCapacity : 0;
+    for (std::uint64_t i = first; i < head; ++i) {
+      const TraceEvent &event = ring->events[i % kTraceRingCapacity];
+      separator();
+      std::fputs("{\"name\":", file);
+      WriteJsonString(file, event.name);
+      const double ts_us = static_cast<double>(event.start_ns - origin) / 1000.0;
+      if (event.phase == 'i') {
+        std::fprintf(file, ",\"cat\":\"kinect\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", ts_us,
+                     event.tid);
+      } else {
+        std::fprintf(file, ",\"cat\":\"kinect\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}", ts_us,
+                     static_cast<double>(event.duration_ns) / 1000.0, event.tid);
+      }
+    }
+  }
+
+  std::fputs("\n]}\n", file);
+  const bool ok = std::ferror(file) == 0;
+  return std::fclose(file) == 0 && ok;
+}
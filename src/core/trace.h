@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Lightweight scoped trace points for the frame pipeline, exported as Chrome
+// trace-event JSON (load in chrome://tracing or ui.perfetto.dev).
+//
+// Every thread records into its own fixed-size ring buffer, so a trace point
+// costs two clock reads, the stores and one fenced flag write, with no locks
+// or allocation after the thread's first event. A thread's ring outlives it
+// and is reused, with its events, by the next thread that starts recording.
+// Recording is off until TraceStart() is called; when off, a trace point is a
+// single relaxed atomic load.
+//
+// Build with KINECT_ENABLE_TRACING=0 to remove every trace point at compile
+// time.
+
+#ifndef KINECT_ENABLE_TRACING
+#define KINECT_ENABLE_TRACING 1
+#endif
+
+constexpr std::size_t kTraceRingCapacity = 16384;
+
+void TraceStart();
+void TraceStop();
+bool TraceIsEnabled();
+
+// Names the calling thread in the exported trace.
+void TraceSetThreadName(const char *name);
+
+// Records a zero-length marker, e.g. "frame dropped".
+void TraceInstant(const char *name);
+
+// Stops recording, waits for events already being written to land, then
+// writes every buffered event as Chrome trace-event JSON. A scope still open
+// at the stop is dropped. Do not call TraceStart() until it returns.
+// Returns false if the file could not be written.
+bool TraceWriteChromeJson(const std::string &path);
+
+struct TraceStats {
+  std::uint64_t events = 0;
+  std::uint64_t overwritten = 0;
+  // Rings allocated: the most recording threads alive at once.
+  std::size_t threads = 0;
+  // Cost of one scoped trace point's clock reads and stores, timed in a
+  // loop on this machine. Times events gives an estimate of the overhead,
+  // not a measurement; `--bench trace` measures frame time with and without.
+  double ns_per_event = 0.0;
+};
+TraceStats TraceCollectStats();
+
+class TraceScope {
+ public:
+  explicit TraceScope(const char *name);
+  ~TraceScope();
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+ private:
+  const char *name_;
+  std::uint64_t start_ns_;
+};
+
+#if KINECT_ENABLE_TRACING
+#define KINECT_TRACE_CONCAT_INNER(a, b) a##b
+#define KINECT_TRACE_CONCAT(a, b) KINECT_TRACE_CONCAT_INNER(a, b)
+// |name| must be a string literal (or otherwise outlive the trace dump).
+#define KINECT_TRACE_SCOPE(name) TraceScope KINECT_TRACE_CONCAT(kinect_trace_scope_, __LINE__)(name)
+#define KINECT_TRACE_INSTANT(name) TraceInstant(name)
+#define KINECT_TRACE_THREAD_NAME(name) TraceSetThreadName(name)
+#else
+#define KINECT_TRACE_SCOPE(name) \
+  do {                           \
+  } while (false)
+#define KINECT_TRACE_INSTANT(name) \
+  do {                             \
+  } while (false)
+#define KINECT_TRACE_THREAD_NAME(name) \
+  do {                                 \
+  } while (false)
+#endif
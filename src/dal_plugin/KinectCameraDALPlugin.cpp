@@ -1,4 +1,7 @@
 #include "../backends/backend.h"
+#include "../backends/synthetic_backend.h"
+#include "../core/trace.h"
+#include "../processing/background_removal.h"
 
 #include <CoreFoundation/CFPlugIn.h>
 #include <CoreMediaIO/CMIOHardwarePlugIn.h>
@@ -14,7 +17,9 @@
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <iostream>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -52,11 +57,39 @@ std::thread gProducerThread;
 std::atomic<bool> gProducerRunning{false};
 std::atomic<UInt32> gRunningClients{0};
 std::atomic<uint64_t> gFrameCounter{0};
+// Only touched from the producer thread and start().
+BackgroundRemover gBackgroundRemover;
+
+// KINECT_DAL_BACKGROUND=distance=1200,color=00b140 or ...,image=/path.ppm
+// turns on depth-keyed background replacement.
+void ConfigureBackgroundRemoval() {
+  const char* spec = std::getenv("KINECT_DAL_BACKGROUND");
+  BackgroundRemovalOptions options;
+  std::string image_path;
+  std::string error;
+  if (spec != nullptr && spec[0] != '\0' && !ParseBackgroundRemovalSpec(spec, &options, &image_path, &error)) {
+    std::cerr << "[dal] KINECT_DAL_BACKGROUND: " << error << "\n";
+    options.enabled = false;
+  }
+  gBackgroundRemover.setOptions(options);
+  gBackgroundRemover.setReplacementImage(nullptr, 0, 0);
+  if (options.enabled && !image_path.empty()) {
+    std::vector<std::uint8_t> image;
+    int width = 0;
+    int height = 0;
+    if (LoadPpm(image_path, &image, &width, &height)) {
+      gBackgroundRemover.setReplacementImage(image.data(), width, height);
+    } else {
+      std::cerr << "[dal] could not read " << image_path << " as a binary PPM; using the fill color\n";
+    }
+  }
+}
 
 class KinectFrameSource {
  public:
   bool start() {
     stop();
+    ConfigureBackgroundRemoval();
 
     auto try_backend = [&](std::unique_ptr<KinectBackend> backend) -> bool {
       if (!backend) {
@@ -77,6 +110,13 @@ class KinectFrameSource {
       }
 
       device->setStreamKind(StreamKind::kRgb);
+      // The camera is 640x480, so a v2 decodes its 1080p JPEG at half size
+      // instead of in full; other devices keep their decoded color.
+      device->subscribeColor(ColorCaptureMode::kHalf);
+      // The matte needs depth seen from the color camera.
+      if (gBackgroundRemover.enabled() && !device->setRegistrationEnabled(true)) {
+        std::cerr << "[dal] " << backend->name() << " has no registration; background removal is off\n";
+      }
       if (!device->start()) {
         return false;
       }
@@ -86,6 +126,9 @@ class KinectFrameSource {
       return true;
     };
 
+    if (auto synthetic = CreateSyntheticBackendFromEnvironment()) {
+      return try_backend(std::move(synthetic));
+    }
     if (try_backend(CreateKinectV2Backend())) {
       return true;
     }
@@ -105,7 +148,14 @@ class KinectFrameSource {
     backend_.reset();
   }
 
-  bool nextRGB(std::vector<uint8_t>& rgb, int& width, int& height) {
+  // |registered_depth| is left empty unless registration is on.
+  bool nextRGB(
+      std::vector<uint8_t>& rgb,
+      int& width,
+      int& height,
+      std::vector<uint16_t>& registered_depth,
+      int& depth_width,
+      int& depth_height) {
     std::lock_guard<std::mutex> lock(mutex_);
     if (!device_) {
       return false;
@@ -124,6 +174,9 @@ class KinectFrameSource {
     rgb = std::move(frame.rgb);
     width = frame.width;
     height = frame.height;
+    registered_depth = std::move(frame.registered_depth);
+    depth_width = frame.registered_depth_width;
+    depth_height = frame.registered_depth_height;
     return true;
   }
 
@@ -182,6 +235,7 @@ void FillFromRGB(
     int src_height,
     std::uint8_t* base,
     std::size_t bytes_per_row) {
+  KINECT_TRACE_SCOPE("dal.fill_bgra");
   if (src_width <= 0 || src_height <= 0 || rgb.size() < static_cast<std::size_t>(src_width * src_height * 3)) {
     FillFallbackPattern(base, bytes_per_row, gFrameCounter.load());
     return;
@@ -202,6 +256,7 @@ void FillFromRGB(
 }
 
 CMSampleBufferRef CreateSampleBuffer(uint64_t frame_index) {
+  KINECT_TRACE_SCOPE("dal.create_sample");
   CVPixelBufferRef pixel_buffer = nullptr;
   const OSStatus pixel_rc =
       CVPixelBufferCreate(kCFAllocatorDefault, kOutputWidth, kOutputHeight, kCVPixelFormatType_32BGRA, nullptr, &pixel_buffer);
@@ -220,8 +275,24 @@ CMSampleBufferRef CreateSampleBuffer(uint64_t frame_index) {
   std::vector<std::uint8_t> rgb;
   int src_width = 0;
   int src_height = 0;
-  if (gKinectSource.nextRGB(rgb, src_width, src_height)) {
+  std::vector<std::uint16_t> registered_depth;
+  int depth_width = 0;
+  int depth_height = 0;
+  bool have_rgb = false;
+  {
+    KINECT_TRACE_SCOPE("dal.next_rgb");
+    have_rgb = gKinectSource.nextRGB(rgb, src_width, src_height, registered_depth, depth_width, depth_height);
+  }
+  if (have_rgb) {
     FillFromRGB(rgb, src_width, src_height, base, bytes_per_row);
+    // Registered depth covers the color view, so it lines up with the
+    // stretched output at any size.
+    if (gBackgroundRemover.enabled() && !registered_depth.empty() &&
+        registered_depth.size() >= static_cast<std::size_t>(depth_width) * depth_height) {
+      KINECT_TRACE_SCOPE("dal.background_removal");
+      gBackgroundRemover.apply(
+          base, kOutputWidth, kOutputHeight, bytes_per_row, registered_depth.data(), depth_width, depth_height);
+    }
   } else {
     FillFallbackPattern(base, bytes_per_row, frame_index);
   }
@@ -278,32 +349,37 @@ void ProducerLoop() {
   using clock = std::chrono::steady_clock;
   const auto frame_interval = std::chrono::milliseconds(1000 / kOutputFPS);
   auto next_frame_time = clock::now();
+  KINECT_TRACE_THREAD_NAME("dal-producer");
 
   while (gProducerRunning.load(std::memory_order_acquire)) {
-    const uint64_t frame_index = gFrameCounter.fetch_add(1, std::memory_order_relaxed);
-    CMSampleBufferRef sample = CreateSampleBuffer(frame_index);
-    if (sample != nullptr) {
-      std::lock_guard<std::mutex> lock(gStateMutex);
-      if (gSampleQueue != nullptr) {
-        while (CMSimpleQueueGetCount(gSampleQueue) >= static_cast<int32_t>(kQueueCapacity)) {
-          const void* raw_old_sample = CMSimpleQueueDequeue(gSampleQueue);
-          auto* old_sample = reinterpret_cast<CMSampleBufferRef>(const_cast<void*>(raw_old_sample));
-          if (old_sample != nullptr) {
-            CFRelease(old_sample);
+    {
+      KINECT_TRACE_SCOPE("dal.produce_frame");
+      const uint64_t frame_index = gFrameCounter.fetch_add(1, std::memory_order_relaxed);
+      CMSampleBufferRef sample = CreateSampleBuffer(frame_index);
+      if (sample != nullptr) {
+        KINECT_TRACE_SCOPE("dal.enqueue");
+        std::lock_guard<std::mutex> lock(gStateMutex);
+        if (gSampleQueue != nullptr) {
+          while (CMSimpleQueueGetCount(gSampleQueue) >= static_cast<int32_t>(kQueueCapacity)) {
+            const void* raw_old_sample = CMSimpleQueueDequeue(gSampleQueue);
+            auto* old_sample = reinterpret_cast<CMSampleBufferRef>(const_cast<void*>(raw_old_sample));
+            if (old_sample != nullptr) {
+              CFRelease(old_sample);
+            }
           }
-        }
 
-        const OSStatus enqueue_rc = CMSimpleQueueEnqueue(gSampleQueue, sample);
-        if (enqueue_rc == noErr) {
-          if (gQueueAlteredProc != nullptr) {
-            gQueueAlteredProc(gStreamObjectID, sample, gQueueAlteredRefCon);
+          const OSStatus enqueue_rc = CMSimpleQueueEnqueue(gSampleQueue, sample);
+          if (enqueue_rc == noErr) {
+            if (gQueueAlteredProc != nullptr) {
+              gQueueAlteredProc(gStreamObjectID, sample, gQueueAlteredRefCon);
+            }
+            sample = nullptr;
           }
-          sample = nullptr;
         }
       }
-    }
-    if (sample != nullptr) {
-      CFRelease(sample);
+      if (sample != nullptr) {
+        CFRelease(sample);
+      }
     }
 
     next_frame_time += frame_interval;
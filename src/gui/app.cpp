@@ -1,5 +1,6 @@
 #include "gui_app.h"
 #include "backends/backend.h"
+#include "backends/synthetic_backend.h"
 
 #ifdef __APPLE__
 #include <GLUT/glut.h>
@@ -134,8 +135,11 @@ void Keyboard(unsigned char key, int x, int y) {
 int RunGuiApp(int argc, char** argv) {
     std::cout << "Starting GUI...\n";
     
-    // Initialize Backend (Try V2 then V1)
-    g_app.backend = CreateKinectV2Backend();
+    // Initialize Backend (KINECT_SYNTHETIC, else try V2 then V1)
+    g_app.backend = CreateSyntheticBackendFromEnvironment();
+    if (!g_app.backend) {
+        g_app.backend = CreateKinectV2Backend();
+    }
     auto probe = g_app.backend->probe();
     if (!probe.available) {
         std::cout << "V2 not available: " << probe.detail << "\nTrying V1...\n";
@@ -1,7 +1,29 @@
-#include "gui/gui_app.h"
 #include "backends/backend.h"
+#include "backends/capture_session.h"
+#include "backends/replay_backend.h"
+#include "backends/synthetic_backend.h"
+#include "core/recording.h"
+#include "core/trace.h"
+
+#ifndef KINECT_WITH_GUI
+#define KINECT_WITH_GUI 1
+#endif
+
+// Set by linking kinect_bench, which only macKinect-cli does.
+#ifndef KINECT_WITH_BENCH
+#define KINECT_WITH_BENCH 0
+#endif
+
+#if KINECT_WITH_GUI
+#include "gui/gui_app.h"
+#endif
+
+#if KINECT_WITH_BENCH
+#include "bench/bench.h"
+#endif
 
 #include <chrono>
+#include <cstdio>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
@@ -14,23 +36,67 @@ enum class BackendChoice {
   kAuto,
   kV1,
   kV2,
+  kSynthetic,
 };
 
 struct Options {
   bool run_preview = false;
+  bool all_devices = false;
   bool list_devices = false;
   int preview_seconds = 5;
   BackendChoice backend = BackendChoice::kAuto;
+  V2PacketPipeline v2_pipeline = V2PacketPipeline::kDefault;
+  std::string trace_path;
+  std::string record_path;
+  RecordingOptions recording;
+  ColorCaptureMode record_color = ColorCaptureMode::kDecoded;
+  std::string replay_path;
+  ReplayOptions replay;
+  SyntheticConfig synthetic;
+#if KINECT_WITH_BENCH
+  std::string bench_name;
+  BenchOptions bench;
+#endif
 };
 
 void PrintUsage(const char *program) {
   std::cout << "Usage: " << program << " [options]\n"
             << "\n"
             << "Options:\n"
+#if KINECT_WITH_GUI
             << "  --gui               Run the graphical interface (default if no args)\n"
+#endif
             << "  --list              List connected devices\n"
             << "  --preview [sec]     Run a CLI preview for N seconds\n"
-            << "  --backend [v1|v2]   Force a specific backend\n"
+            << "  --all-devices       Preview every device of the backend together, one capture\n"
+            << "                      thread each, as time-aligned frame sets\n"
+            << "  --backend [v1|v2|synthetic]\n"
+            << "                      Force a specific backend\n"
+            << "  --v2-pipeline [default|cpu|cpu-threaded|opengl|opencl|cuda]\n"
+            << "                      Kinect v2 depth decoding; cpu-threaded (an experimental build\n"
+            << "                      option) spreads the CPU pipeline's work over all cores\n"
+            << "                      (default: libfreenect2's pick)\n"
+            << "  --synthetic <spec>  Use virtual devices, e.g. devices=4,profile=v2,fps=0,\n"
+            << "                      jitter=2,drop=0.01,skew=50,audio=1,noise=1,seed=7,register=1,\n"
+            << "                      filter=1,pyramid=1,planes=1,foreground=1,blobs=1\n"
+            << "  --record <file>     Record the first device of the selected backend to a\n"
+            << "                      .krec file for --preview seconds\n"
+            << "  --record-depth [raw|rvl|temporal]\n"
+            << "                      Depth plane coding (default rvl; temporal adds delta frames)\n"
+            << "  --record-color [decoded|jpeg|half|quarter]\n"
+            << "                      Color capture mode; v2 can store its JPEG as sent or\n"
+            << "                      decode at 1/2 or 1/4 size (default decoded)\n"
+            << "  --replay <file>     Play a .krec recording back as a device\n"
+            << "  --replay-speed <x>  Replay rate relative to capture (0 = as fast as possible)\n"
+            << "  --replay-loop       Restart the recording at end of file\n"
+            << "  --trace <file>      Write a Chrome trace (chrome://tracing) of the CLI run\n"
+#if KINECT_WITH_BENCH
+            << "  --bench <name|all>  Run processing benchmarks on synthetic frames\n"
+            << "  --bench-iterations <n>\n"
+            << "                      Override the per-benchmark iteration count\n"
+            << "  --bench-input <file>\n"
+            << "                      Run suites that support it on a .krec recording\n"
+#endif
             << "  --help, -h          Show this help\n";
 }
 
@@ -47,6 +113,20 @@ bool ParsePositiveInt(const std::string &text, int *value) {
   }
 }
 
+bool ParseNonNegativeDouble(const std::string &text, double *value) {
+  try {
+    std::size_t used = 0;
+    const double parsed = std::stod(text, &used);
+    if (used != text.size() || parsed < 0.0) {
+      return false;
+    }
+    *value = parsed;
+    return true;
+  } catch (...) {
+    return false;
+  }
+}
+
 bool ParseBackendChoice(const std::string &raw, BackendChoice *choice) {
   if (raw == "auto") {
     *choice = BackendChoice::kAuto;
@@ -60,6 +140,22 @@ bool ParseBackendChoice(const std::string &raw, BackendChoice *choice) {
     *choice = BackendChoice::kV2;
     return true;
   }
+  if (raw == "synthetic") {
+    *choice = BackendChoice::kSynthetic;
+    return true;
+  }
+  return false;
+}
+
+bool ParseV2PacketPipeline(const std::string &raw, V2PacketPipeline *pipeline) {
+  for (V2PacketPipeline candidate :
+       {V2PacketPipeline::kDefault, V2PacketPipeline::kCpu, V2PacketPipeline::kCpuThreaded, V2PacketPipeline::kOpenGl,
+        V2PacketPipeline::kOpenCl, V2PacketPipeline::kCuda}) {
+    if (raw == V2PacketPipelineLabel(candidate)) {
+      *pipeline = candidate;
+      return true;
+    }
+  }
   return false;
 }
 
@@ -73,9 +169,123 @@ bool MatchesChoice(const KinectBackend &backend, BackendChoice choice) {
   if (choice == BackendChoice::kV2) {
     return backend.generation() == KinectGeneration::kV2;
   }
+  if (choice == BackendChoice::kSynthetic) {
+    return true;
+  }
   return false;
 }
 
+// Captures the first device of |backend| into |path| until |duration| expires.
+bool RecordSession(KinectBackend &backend, const DeviceInfo &info, const std::string &path,
+                   const RecordingOptions &recording, ColorCaptureMode color_mode, std::chrono::seconds duration) {
+  std::unique_ptr<KinectDevice> device = backend.openDevice(info.serial);
+  if (device && !device->subscribeColor(color_mode)) {
+    std::cerr << "  " << info.serial << " does not support that color mode; recording decoded color.\n";
+  }
+  if (!device || !device->start()) {
+    std::cerr << "Could not start " << info.serial << " for recording.\n";
+    return false;
+  }
+  if (device->supportsAudioInput()) {
+    device->setAudioEnabled(true);
+  }
+
+  RecordingHeader header;
+  header.generation = info.generation;
+  header.serial = info.serial;
+  header.calibration = device->calibration();
+
+  RecordingWriter writer;
+  if (!writer.open(path, header, recording)) {
+    device->stop();
+    return false;
+  }
+
+  const auto end = std::chrono::steady_clock::now() + duration;
+  FrameData frame;
+  AudioChunk audio;
+  while (std::chrono::steady_clock::now() < end) {
+    if (device->update() && device->getFrame(frame)) {
+      writer.writeFrame(std::move(frame), TelemetryNowNs());
+      frame = FrameData{};
+    }
+    if (device->getAudio(audio)) {
+      writer.writeAudio(std::move(audio), TelemetryNowNs());
+      audio = AudioChunk{};
+    }
+  }
+  device->stop();
+
+  const bool ok = writer.close();
+  std::cout << "  Recording: " << (ok ? "wrote " : "FAILED after ") << writer.framesWritten() << " frames, "
+            << writer.bytesWritten() / (1024 * 1024) << " MiB to " << path << "\n";
+  if (writer.encodedDepthBytes() > 0 && writer.rawDepthBytes() != writer.encodedDepthBytes()) {
+    std::cout << "  Depth: " << writer.rawDepthBytes() / (1024 * 1024) << " MiB raw coded to "
+              << writer.encodedDepthBytes() / (1024 * 1024) << " MiB ("
+              << static_cast<double>(writer.rawDepthBytes()) / static_cast<double>(writer.encodedDepthBytes())
+              << ":1)\n";
+  }
+  return ok;
+}
+
+// Streams every device in |devices| together through a CaptureSession for
+// |duration| and reports the frame sets and each device's clock and
+// telemetry.
+bool PreviewSession(KinectBackend &backend, const std::vector<DeviceInfo> &devices, std::chrono::seconds duration) {
+  CaptureSession session;
+  for (const DeviceInfo &info : devices) {
+    std::unique_ptr<KinectDevice> device = backend.openDevice(info.serial);
+    if (!device) {
+      std::cerr << "  Could not open " << info.serial << "; left out of the session.\n";
+      continue;
+    }
+    session.addDevice(std::move(device), info.serial, NominalDeviceTickNs(info.generation));
+  }
+  if (session.deviceCount() == 0 || !session.start()) {
+    std::cout << "  Session: failed to start\n";
+    return false;
+  }
+
+  const auto begin = std::chrono::steady_clock::now();
+  const auto end = begin + duration;
+  FrameSet set;
+  while (std::chrono::steady_clock::now() < end) {
+    session.nextFrameSet(&set, std::chrono::milliseconds(50));
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  session.stop();
+
+  const FrameAggregatorStats stats = session.aggregatorStats();
+  char line[192];
+  std::snprintf(line, sizeof(line),
+                "%d devices, %llu frame sets (%.1f/s), spread mean %.2f ms / max %.2f ms, %llu unmatched frames, "
+                "%llu sets dropped",
+                session.deviceCount(), static_cast<unsigned long long>(stats.sets),
+                static_cast<double>(stats.sets) / seconds, stats.mean_spread_ms, stats.max_spread_ms,
+                static_cast<unsigned long long>(stats.unmatched_frames),
+                static_cast<unsigned long long>(stats.dropped_sets));
+  std::cout << "  Session: " << line << "\n";
+  for (const CaptureDeviceStats &device : session.deviceStats()) {
+    std::cout << "    " << device.serial << ": " << device.frames << " frames";
+    if (device.core >= 0) {
+      std::cout << ", core " << device.core;
+    }
+    if (device.tick_ns > 0.0) {
+      std::snprintf(line, sizeof(line), ", tick %.4f us", device.tick_ns * 1e-3);
+      std::cout << line;
+    }
+    std::cout << "\n";
+    for (std::size_t i = 0; i < kTelemetryStreamCount; ++i) {
+      const auto stream = static_cast<TelemetryStream>(i);
+      const StreamSnapshot &snapshot = device.telemetry.stream(stream);
+      if (snapshot.frames > 0) {
+        std::cout << "      " << FormatStreamTelemetry(stream, snapshot) << "\n";
+      }
+    }
+  }
+  return stats.sets > 0;
+}
+
 }  // namespace
 
 int main(int argc, char **argv) {
@@ -129,9 +339,14 @@ int main(int argc, char **argv) {
       continue;
     }
 
+    if (arg == "--all-devices") {
+      options.all_devices = true;
+      continue;
+    }
+
     if (arg == "--backend") {
       if (i + 1 >= argc) {
-        std::cerr << "--backend expects one value: auto, v1, or v2\n";
+        std::cerr << "--backend expects one value: auto, v1, v2, or synthetic\n";
         return EXIT_FAILURE;
       }
       ++i;
@@ -142,24 +357,185 @@ int main(int argc, char **argv) {
       continue;
     }
     
+    if (arg == "--v2-pipeline") {
+      if (i + 1 >= argc || !ParseV2PacketPipeline(argv[i + 1], &options.v2_pipeline)) {
+        std::cerr << "--v2-pipeline expects default, cpu, cpu-threaded, opengl, opencl or cuda\n";
+        return EXIT_FAILURE;
+      }
+      ++i;
+      continue;
+    }
+
+    if (arg == "--synthetic") {
+      options.backend = BackendChoice::kSynthetic;
+      cli_mode = true;
+      if (i + 1 < argc && argv[i + 1][0] != '-') {
+        ++i;
+        std::string error;
+        if (!ParseSyntheticConfig(argv[i], &options.synthetic, &error)) {
+          std::cerr << "Invalid synthetic spec: " << error << "\n";
+          return EXIT_FAILURE;
+        }
+      }
+      continue;
+    }
+
+    if (arg == "--record") {
+      if (i + 1 >= argc) {
+        std::cerr << "--record expects an output path\n";
+        return EXIT_FAILURE;
+      }
+      options.record_path = argv[++i];
+      cli_mode = true;
+      continue;
+    }
+
+    if (arg == "--record-depth") {
+      const std::string codec = i + 1 < argc ? argv[i + 1] : "";
+      if (codec != "raw" && codec != "rvl" && codec != "temporal") {
+        std::cerr << "--record-depth expects raw, rvl or temporal\n";
+        return EXIT_FAILURE;
+      }
+      options.recording.compress_depth = codec != "raw";
+      options.recording.depth_codec.temporal = codec == "temporal";
+      ++i;
+      continue;
+    }
+
+    if (arg == "--record-color") {
+      const std::string mode = i + 1 < argc ? argv[i + 1] : "";
+      if (mode == "decoded") {
+        options.record_color = ColorCaptureMode::kDecoded;
+      } else if (mode == "jpeg") {
+        options.record_color = ColorCaptureMode::kJpeg;
+      } else if (mode == "half") {
+        options.record_color = ColorCaptureMode::kHalf;
+      } else if (mode == "quarter") {
+        options.record_color = ColorCaptureMode::kQuarter;
+      } else {
+        std::cerr << "--record-color expects decoded, jpeg, half or quarter\n";
+        return EXIT_FAILURE;
+      }
+      ++i;
+      continue;
+    }
+
+    if (arg == "--replay") {
+      if (i + 1 >= argc) {
+        std::cerr << "--replay expects a .krec path\n";
+        return EXIT_FAILURE;
+      }
+      options.replay_path = argv[++i];
+      cli_mode = true;
+      continue;
+    }
+
+    if (arg == "--replay-speed") {
+      if (i + 1 >= argc || !ParseNonNegativeDouble(argv[i + 1], &options.replay.speed)) {
+        std::cerr << "--replay-speed expects a non-negative number\n";
+        return EXIT_FAILURE;
+      }
+      ++i;
+      continue;
+    }
+
+    if (arg == "--replay-loop") {
+      options.replay.loop = true;
+      continue;
+    }
+
+#if KINECT_WITH_BENCH
+    if (arg == "--bench") {
+      if (i + 1 >= argc) {
+        std::cerr << "--bench expects a benchmark name; available:\n";
+        ListBenchmarks(std::cerr);
+        return EXIT_FAILURE;
+      }
+      options.bench_name = argv[++i];
+      cli_mode = true;
+      continue;
+    }
+
+    if (arg == "--bench-iterations") {
+      if (i + 1 >= argc || !ParsePositiveInt(argv[i + 1], &options.bench.iterations)) {
+        std::cerr << "--bench-iterations expects a positive integer\n";
+        return EXIT_FAILURE;
+      }
+      ++i;
+      continue;
+    }
+
+    if (arg == "--bench-input") {
+      if (i + 1 >= argc) {
+        std::cerr << "--bench-input expects a .krec path\n";
+        return EXIT_FAILURE;
+      }
+      options.bench.input = argv[++i];
+      continue;
+    }
+#endif
+
+    if (arg == "--trace") {
+      if (i + 1 >= argc) {
+        std::cerr << "--trace expects an output path\n";
+        return EXIT_FAILURE;
+      }
+      options.trace_path = argv[++i];
+      continue;
+    }
+
     // Other args handled or fail
   }
 
   if (gui_mode && !cli_mode) {
+#if KINECT_WITH_GUI
       return RunGuiApp(argc, argv);
+#else
+    if (argc == 1) {
+      PrintUsage(argv[0]);
+      return EXIT_SUCCESS;
+    }
+    std::cerr << "This build has no graphical interface; use --list or --preview.\n";
+    return EXIT_FAILURE;
+#endif
   }
 
   // CLI Logic
+  const auto run_start = std::chrono::steady_clock::now();
+  if (!options.trace_path.empty()) {
+    KINECT_TRACE_THREAD_NAME("cli-main");
+    TraceStart();
+  }
+
+#if KINECT_WITH_BENCH
+  if (!options.bench_name.empty()) {
+    const bool bench_ok = RunBenchmarks(options.bench_name, options.bench);
+    if (!options.trace_path.empty() && !TraceWriteChromeJson(options.trace_path)) {
+      std::cerr << "Could not write trace to " << options.trace_path << "\n";
+    }
+    return bench_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+#endif
+
   std::vector<std::unique_ptr<KinectBackend>> backends;
-  backends.push_back(CreateKinectV1Backend());
-  backends.push_back(CreateKinectV2Backend());
+  if (!options.replay_path.empty()) {
+    backends.push_back(CreateReplayBackend(options.replay_path, options.replay));
+  } else if (options.backend == BackendChoice::kSynthetic) {
+    backends.push_back(CreateSyntheticBackend(options.synthetic));
+  } else {
+    backends.push_back(CreateKinectV1Backend());
+    backends.push_back(CreateKinectV2Backend(options.v2_pipeline));
+  }
 
   int selected_backends = 0;
   const auto preview_duration = std::chrono::seconds(options.preview_seconds);
 
+  bool recorded = false;
+  bool record_failed = false;
+
   for (const auto &backend_ptr : backends) {
     KinectBackend &backend = *backend_ptr;
-    if (!MatchesChoice(backend, options.backend)) {
+    if (options.replay_path.empty() && !MatchesChoice(backend, options.backend)) {
       continue;
     }
     ++selected_backends;
@@ -185,12 +561,49 @@ int main(int argc, char **argv) {
       std::cout << "    - " << KinectGenerationLabel(device.generation) << " serial: " << device.serial << "\n";
     }
 
+    if (!options.record_path.empty() && !recorded) {
+      recorded = true;
+      record_failed = !RecordSession(backend, devices.front(), options.record_path, options.recording,
+                                    options.record_color, preview_duration);
+      continue;
+    }
+
+    if (options.run_preview && options.all_devices) {
+      PreviewSession(backend, devices, preview_duration);
+      continue;
+    }
+
     if (options.run_preview) {
       const PreviewResult preview = backend.preview(preview_duration);
       std::cout << "  Preview: " << (preview.success ? "success" : "failed") << "\n";
       std::cout << "    " << preview.detail << "\n";
       std::cout << "    color frames: " << preview.color_frames << "\n";
       std::cout << "    depth frames: " << preview.depth_frames << "\n";
+      for (std::size_t i = 0; i < kTelemetryStreamCount; ++i) {
+        const auto stream = static_cast<TelemetryStream>(i);
+        const StreamSnapshot &stats = preview.telemetry.stream(stream);
+        if (stats.frames > 0) {
+          std::cout << "    " << FormatStreamTelemetry(stream, stats) << "\n";
+        }
+      }
+      const std::string stages = FormatStageTelemetry(preview.telemetry);
+      if (!stages.empty()) {
+        std::cout << "    stages: " << stages << "\n";
+      }
+    }
+  }
+
+  if (!options.trace_path.empty()) {
+    const double wall_ns =
+        std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - run_start).count();
+    const TraceStats stats = TraceCollectStats();
+    if (TraceWriteChromeJson(options.trace_path)) {
+      const double overhead = wall_ns > 0.0 ? 100.0 * static_cast<double>(stats.events) * stats.ns_per_event / wall_ns : 0.0;
+      std::cout << "Trace written to " << options.trace_path << " (" << stats.events << " events on " << stats.threads
+                << " threads, " << stats.overwritten << " overwritten, estimated overhead " << overhead
+                << "% from the per-event cost; --bench trace measures it)\n";
+    } else {
+      std::cerr << "Could not write trace to " << options.trace_path << "\n";
     }
   }
 
@@ -199,5 +612,12 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
+  if (!options.record_path.empty() && (!recorded || record_failed)) {
+    if (!recorded) {
+      std::cerr << "No device available to record.\n";
+    }
+    return EXIT_FAILURE;
+  }
+
   return EXIT_SUCCESS;
 }
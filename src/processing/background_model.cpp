@@ -0,0 +1,346 @@
+#include "processing/background_model.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+#include "processing/simd.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr int kBandRows = 16;
+// Masks kept for reuse, as in DepthPyramidBuilder.
+constexpr std::size_t kMaskPoolSize = 4;
+
+struct PixelParams {
+  float min_mm;
+  float max_mm;
+  float rate;
+  float foreground_scale;
+  float warmup;
+  float count_cap;
+  float threshold2;
+  float min_sigma_mm;
+};
+
+// Scalar twin of the four-lane update in classify(), for row tails.
+inline bool UpdatePixel(float mm, const PixelParams &p, float *mean, float *variance, float *count) {
+  if (mm < p.min_mm || mm > p.max_mm) {
+    return false;
+  }
+  const float delta = mm - *mean;
+  const float delta2 = delta * delta;
+  const float z = mm * 0.001f;
+  const float floor = p.min_sigma_mm * std::max(1.0f, z * z);
+  const bool foreground = *count >= p.warmup && delta2 > p.threshold2 * std::max(*variance, floor * floor);
+  if (foreground) {
+    *mean += p.rate * p.foreground_scale * delta;
+    return true;
+  }
+  const float alpha = std::max(1.0f / (*count + 1.0f), p.rate);
+  *mean += alpha * delta;
+  *variance = (1.0f - alpha) * (*variance + alpha * delta2);
+  *count = std::min(*count + 1.0f, p.count_cap);
+  return false;
+}
+
+// 3x3 erosion or dilation of a packed mask: each row against its left and
+// right neighbours a word at a time, then each row against the rows above
+// and below. Pixels outside the image repeat the edge, so regions touching
+// the border are not eaten away.
+void Morph(const std::uint64_t *in, std::uint64_t *out, std::uint64_t *rows, int width, int height, int stride,
+           bool dilate) {
+  const int tail_bits = width & 63;
+  const std::uint64_t tail_mask = tail_bits == 0 ? ~0ull : (1ull << tail_bits) - 1;
+  const int last_word = (width - 1) >> 6;
+  const std::uint64_t last_bit = 1ull << ((width - 1) & 63);
+  for (int y = 0; y < height; ++y) {
+    const std::uint64_t *src = in + static_cast<std::size_t>(y) * stride;
+    std::uint64_t *dst = rows + static_cast<std::size_t>(y) * stride;
+    for (int i = 0; i < stride; ++i) {
+      const std::uint64_t w = src[i];
+      // Bit x of |left| is pixel x - 1, of |right| pixel x + 1.
+      std::uint64_t left = (w << 1) | (i > 0 ? src[i - 1] >> 63 : w & 1u);
+      std::uint64_t right = (w >> 1) | (i + 1 < stride ? src[i + 1] << 63 : 0);
+      if (i == last_word) {
+        right = (right & ~last_bit) | (w & last_bit);
+      }
+      dst[i] = dilate ? (w | left | right) : (w & left & right);
+    }
+    dst[stride - 1] &= tail_mask;
+  }
+  for (int y = 0; y < height; ++y) {
+    const std::uint64_t *above = rows + static_cast<std::size_t>(y > 0 ? y - 1 : y) * stride;
+    const std::uint64_t *row = rows + static_cast<std::size_t>(y) * stride;
+    const std::uint64_t *below = rows + static_cast<std::size_t>(y + 1 < height ? y + 1 : y) * stride;
+    std::uint64_t *dst = out + static_cast<std::size_t>(y) * stride;
+    for (int i = 0; i < stride; ++i) {
+      dst[i] = dilate ? (above[i] | row[i] | below[i]) : (above[i] & row[i] & below[i]);
+    }
+  }
+}
+
+}  // namespace
+
+struct BackgroundModel::Run {
+  int x0;
+  int x1;
+  int y;
+};
+
+BackgroundModel::BackgroundModel() = default;
+BackgroundModel::~BackgroundModel() = default;
+
+void BackgroundModel::setOptions(const BackgroundOptions &options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (options.enabled && !options_.enabled) {
+    // The room may have changed while the model was off.
+    reset_pending_ = true;
+  }
+  options_ = options;
+}
+
+BackgroundOptions BackgroundModel::options() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return options_;
+}
+
+bool BackgroundModel::enabled() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return options_.enabled;
+}
+
+void BackgroundModel::reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  reset_pending_ = true;
+}
+
+void BackgroundModel::classify(const std::uint16_t *depth, const BackgroundOptions &options, ForegroundMask *mask) {
+  KINECT_TRACE_SCOPE("background.classify");
+  PixelParams params;
+  params.min_mm = options.min_depth_mm;
+  params.max_mm = options.max_depth_mm;
+  params.rate = std::max(0.0f, std::min(1.0f, options.learning_rate));
+  params.foreground_scale = std::max(0.0f, options.foreground_rate_scale);
+  params.warmup = static_cast<float>(std::max(1, options.warmup_frames));
+  // Once 1 / (n + 1) drops below the rate the count no longer matters.
+  params.count_cap = std::max(params.warmup, params.rate > 0.0f ? std::ceil(1.0f / params.rate) : 65535.0f);
+  params.threshold2 = options.threshold_sigma * options.threshold_sigma;
+  params.min_sigma_mm = options.min_sigma_mm;
+
+  const int width = width_;
+  const int height = height_;
+  const int stride = mask->stride;
+  const int bands = (height + kBandRows - 1) / kBandRows;
+  SharedThreadPool().parallelFor(bands, 1, max_threads_, [&](int begin, int end) {
+    const Float4 lowest = SplatFloat4(params.min_mm);
+    const Float4 highest = SplatFloat4(params.max_mm);
+    const Float4 rate = SplatFloat4(params.rate);
+    const Float4 foreground_rate = SplatFloat4(params.rate * params.foreground_scale);
+    const Float4 warmup = SplatFloat4(params.warmup);
+    const Float4 count_cap = SplatFloat4(params.count_cap);
+    const Float4 threshold2 = SplatFloat4(params.threshold2);
+    const Float4 min_sigma = SplatFloat4(params.min_sigma_mm);
+    const Float4 to_m = SplatFloat4(0.001f);
+    const Float4 zero = SplatFloat4(0.0f);
+    const Float4 one = SplatFloat4(1.0f);
+    for (int v = begin * kBandRows; v < std::min(height, end * kBandRows); ++v) {
+      const std::size_t row = static_cast<std::size_t>(v) * width;
+      const std::uint16_t *depth_row = depth + row;
+      float *mean = mean_.data() + row;
+      float *variance = variance_.data() + row;
+      float *count = count_.data() + row;
+      std::uint64_t *bits = mask->bits.data() + static_cast<std::size_t>(v) * stride;
+      std::fill(bits, bits + stride, 0ull);
+      int u = 0;
+      for (; u + 4 <= width; u += 4) {
+        const Float4 mm = IntToFloat4(LoadU16AsInt4(depth_row + u));
+        const Int4 valid = AndInt4(GreaterEqualFloat4(mm, lowest), GreaterEqualFloat4(highest, mm));
+        const Float4 m = LoadFloat4(mean + u);
+        const Float4 var = LoadFloat4(variance + u);
+        const Float4 n = LoadFloat4(count + u);
+        const Float4 delta = SubFloat4(mm, m);
+        const Float4 delta2 = MulFloat4(delta, delta);
+        const Float4 z = MulFloat4(mm, to_m);
+        const Float4 floor = MulFloat4(min_sigma, MaxFloat4(one, MulFloat4(z, z)));
+        const Float4 limit = MulFloat4(threshold2, MaxFloat4(var, MulFloat4(floor, floor)));
+        const Int4 foreground =
+            AndInt4(AndInt4(valid, GreaterEqualFloat4(n, warmup)), LessFloat4(limit, delta2));
+        // Foreground always moves at the settled rate: a young pixel's
+        // Welford rate would soak up whatever crossed it.
+        Float4 alpha = MaxFloat4(DivFloat4(one, AddFloat4(n, one)), rate);
+        alpha = SelectFloat4(foreground, foreground_rate, alpha);
+        alpha = SelectFloat4(valid, alpha, zero);
+        StoreFloat4(mean + u, AddFloat4(m, MulFloat4(alpha, delta)));
+        // The variance models sensor noise, which foreground says nothing about.
+        StoreFloat4(variance + u, SelectFloat4(foreground, var, MulFloat4(SubFloat4(one, alpha),
+                                                                          AddFloat4(var, MulFloat4(alpha, delta2)))));
+        const Int4 background = SelectInt4(foreground, SplatInt4(0), valid);
+        StoreFloat4(count + u, SelectFloat4(background, MinFloat4(AddFloat4(n, one), count_cap), n));
+        bits[u >> 6] |= static_cast<std::uint64_t>(MaskBits4(foreground)) << (u & 63);
+      }
+      for (; u < width; ++u) {
+        if (UpdatePixel(depth_row[u], params, mean + u, variance + u, count + u)) {
+          bits[u >> 6] |= 1ull << (u & 63);
+        }
+      }
+    }
+  });
+}
+
+void BackgroundModel::cleanUp(ForegroundMask *mask) {
+  KINECT_TRACE_SCOPE("background.morphology");
+  const std::size_t words = static_cast<std::size_t>(mask->stride) * mask->height;
+  std::uint64_t *opened = scratch_.data();
+  std::uint64_t *rows = scratch_.data() + words;
+  std::uint64_t *bits = mask->bits.data();
+  Morph(bits, opened, rows, mask->width, mask->height, mask->stride, false);
+  Morph(opened, bits, rows, mask->width, mask->height, mask->stride, true);
+  Morph(bits, opened, rows, mask->width, mask->height, mask->stride, true);
+  Morph(opened, bits, rows, mask->width, mask->height, mask->stride, false);
+}
+
+void BackgroundModel::findBoxes(const BackgroundOptions &options, ForegroundMask *mask) {
+  KINECT_TRACE_SCOPE("background.boxes");
+  runs_.clear();
+  parents_.clear();
+  const auto find = [&](std::uint32_t i) {
+    while (parents_[i] != i) {
+      parents_[i] = parents_[parents_[i]];
+      i = parents_[i];
+    }
+    return i;
+  };
+
+  // Runs of set bits per row, joined to the previous row's runs they touch
+  // (8-connected) through union-find.
+  std::size_t previous_begin = 0;
+  for (int y = 0; y < mask->height; ++y) {
+    const std::uint64_t *bits = mask->bits.data() + static_cast<std::size_t>(y) * mask->stride;
+    const std::size_t row_begin = runs_.size();
+    for (int i = 0; i < mask->stride; ++i) {
+      std::uint64_t w = bits[i];
+      while (w != 0) {
+        const int start = __builtin_ctzll(w);
+        const std::uint64_t shifted = ~(w >> start);
+        const int length = shifted == 0 ? 64 - start : std::min(64 - start, __builtin_ctzll(shifted));
+        const int x0 = i * 64 + start;
+        const int x1 = x0 + length;
+        if (runs_.size() > row_begin && runs_.back().x1 == x0) {
+          runs_.back().x1 = x1;
+        } else {
+          runs_.push_back(Run{x0, x1, y});
+          parents_.push_back(static_cast<std::uint32_t>(runs_.size() - 1));
+        }
+        w = length == 64 ? 0 : w & ~(((1ull << length) - 1) << start);
+      }
+    }
+    std::size_t p = previous_begin;
+    for (std::size_t r = row_begin; r < runs_.size(); ++r) {
+      const Run &run = runs_[r];
+      while (p < row_begin && runs_[p].x1 < run.x0) {
+        ++p;
+      }
+      for (std::size_t q = p; q < row_begin && runs_[q].x0 <= run.x1; ++q) {
+        const std::uint32_t a = find(static_cast<std::uint32_t>(q));
+        const std::uint32_t b = find(static_cast<std::uint32_t>(r));
+        if (a != b) {
+          parents_[std::max(a, b)] = std::min(a, b);
+        }
+      }
+    }
+    previous_begin = row_begin;
+  }
+
+  // Roots are the lowest run index of their region, so in raster order a
+  // region's root comes first and starts its box.
+  regions_.resize(runs_.size());
+  for (std::size_t r = 0; r < runs_.size(); ++r) {
+    const Run &run = runs_[r];
+    const std::uint32_t root = find(static_cast<std::uint32_t>(r));
+    ForegroundBox &region = regions_[root];
+    if (root == r) {
+      region = ForegroundBox{run.x0, run.y, run.x1, run.y + 1, 0};
+    } else {
+      region.x0 = std::min(region.x0, run.x0);
+      region.x1 = std::max(region.x1, run.x1);
+      region.y1 = run.y + 1;
+    }
+    region.pixels += static_cast<std::size_t>(run.x1 - run.x0);
+  }
+  mask->boxes.clear();
+  const std::size_t min_pixels = static_cast<std::size_t>(std::max(1, options.min_box_pixels));
+  std::size_t kept = 0;
+  for (std::size_t r = 0; r < runs_.size(); ++r) {
+    if (parents_[r] == r && regions_[r].pixels >= min_pixels) {
+      regions_[kept++] = regions_[r];
+    }
+  }
+  std::sort(regions_.begin(), regions_.begin() + static_cast<std::ptrdiff_t>(kept),
+            [](const ForegroundBox &a, const ForegroundBox &b) { return a.pixels > b.pixels; });
+  kept = std::min(kept, static_cast<std::size_t>(std::max(0, options.max_boxes)));
+  mask->boxes.assign(regions_.begin(), regions_.begin() + static_cast<std::ptrdiff_t>(kept));
+}
+
+std::shared_ptr<const ForegroundMask> BackgroundModel::update(const std::uint16_t *depth, int width, int height) {
+  KINECT_TRACE_SCOPE("background.update");
+  BackgroundOptions options;
+  bool reset = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    options = options_;
+    reset = reset_pending_;
+    reset_pending_ = false;
+  }
+  const int stride = (width + 63) / 64;
+  const std::size_t pixels = static_cast<std::size_t>(width) * static_cast<std::size_t>(height);
+  if (reset || width != width_ || height != height_) {
+    width_ = width;
+    height_ = height;
+    mean_.assign(pixels, 0.0f);
+    variance_.assign(pixels, 0.0f);
+    count_.assign(pixels, 0.0f);
+    scratch_.assign(2 * static_cast<std::size_t>(stride) * height, 0);
+    // At most one run per two pixels of a row.
+    const std::size_t max_runs = static_cast<std::size_t>(width / 2 + 1) * height;
+    runs_.reserve(max_runs);
+    parents_.reserve(max_runs);
+    regions_.reserve(max_runs);
+  }
+  max_threads_ = options.threads;
+
+  std::shared_ptr<ForegroundMask> mask;
+  for (const auto &candidate : masks_) {
+    if (candidate.use_count() == 1) {
+      mask = candidate;
+      break;
+    }
+  }
+  if (mask == nullptr) {
+    mask = std::make_shared<ForegroundMask>();
+    mask->boxes.reserve(static_cast<std::size_t>(std::max(0, options.max_boxes)));
+    if (masks_.size() < kMaskPoolSize) {
+      masks_.push_back(mask);
+    }
+  }
+  mask->width = width;
+  mask->height = height;
+  mask->stride = stride;
+  mask->bits.resize(static_cast<std::size_t>(stride) * height);
+  mask->pixels = 0;
+  mask->boxes.clear();
+  if (pixels == 0) {
+    return mask;
+  }
+
+  classify(depth, options, mask.get());
+  if (options.morphology) {
+    cleanUp(mask.get());
+  }
+  for (std::uint64_t w : mask->bits) {
+    mask->pixels += static_cast<std::size_t>(__builtin_popcountll(w));
+  }
+  findBoxes(options, mask.get());
+  return mask;
+}
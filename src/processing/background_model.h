@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct BackgroundOptions {
+  // Master switch for the backends; update() itself ignores it.
+  bool enabled = false;
+  // Depth outside [min, max] millimetres is no return: it neither updates
+  // the model nor counts as foreground.
+  std::uint16_t min_depth_mm = 350;
+  std::uint16_t max_depth_mm = 6000;
+  // Each pixel's mean and variance start as a running (Welford) average and
+  // settle to an exponential one with this rate, about 1 / frames
+  // remembered.
+  float learning_rate = 1.0f / 300.0f;
+  // Foreground pixels still move their mean at this fraction of the settled
+  // rate, so a moved chair joins the background after a few minutes while a
+  // person standing still for a while does not. Their variance and count are
+  // left alone.
+  float foreground_rate_scale = 0.2f;
+  // A pixel needs this many returns before it can be foreground.
+  int warmup_frames = 15;
+  // Foreground: further than this many standard deviations from the mean.
+  float threshold_sigma = 3.0f;
+  // Lower bound on the standard deviation, in millimetres at 1 m; it grows
+  // with depth squared beyond that, like the sensors' noise.
+  float min_sigma_mm = 3.0f;
+  // 3x3 opening (removes specks) then closing (fills pinholes) on the mask.
+  bool morphology = true;
+  // Connected foreground regions smaller than this get no box.
+  int min_box_pixels = 200;
+  int max_boxes = 16;
+  // Shared pool threads to use, including the caller; 0 uses all of them.
+  int threads = 0;
+};
+
+struct ForegroundBox {
+  // Pixel bounds, [x0, x1) x [y0, y1).
+  int x0 = 0;
+  int y0 = 0;
+  int x1 = 0;
+  int y1 = 0;
+  std::size_t pixels = 0;
+};
+
+// Per-frame result: one bit per depth pixel, rows starting on a 64-bit word
+// boundary |stride| words apart (the layout of DepthPyramidLevel's mask).
+struct ForegroundMask {
+  int width = 0;
+  int height = 0;
+  int stride = 0;
+  std::vector<std::uint64_t> bits;
+  std::size_t pixels = 0;
+  // Largest regions first (8-connected).
+  std::vector<ForegroundBox> boxes;
+
+  bool test(int x, int y) const {
+    return (bits[static_cast<std::size_t>(y) * stride + (x >> 6)] >> (x & 63)) & 1u;
+  }
+};
+
+// Per-pixel depth background for a fixed camera. Every frame updates each
+// pixel's mean and variance four pixels at a time and marks the pixels that
+// left their background as foreground; the mask is cleaned up with bitwise
+// morphology on whole 64-pixel words and its connected regions boxed from
+// run lengths. Masks are handed out like DepthPyramidBuilder's pyramids.
+// setOptions() may be called from another thread than update().
+class BackgroundModel {
+ public:
+  BackgroundModel();
+  ~BackgroundModel();
+  BackgroundModel(const BackgroundModel &) = delete;
+  BackgroundModel &operator=(const BackgroundModel &) = delete;
+
+  void setOptions(const BackgroundOptions &options);
+  BackgroundOptions options() const;
+  bool enabled() const;
+
+  // Learns from |depth| (width x height, millimetres) and returns its
+  // foreground. The model restarts when the size changes or after reset().
+  std::shared_ptr<const ForegroundMask> update(const std::uint16_t *depth, int width, int height);
+  void reset();
+
+ private:
+  struct Run;
+
+  void classify(const std::uint16_t *depth, const BackgroundOptions &options, ForegroundMask *mask);
+  void cleanUp(ForegroundMask *mask);
+  void findBoxes(const BackgroundOptions &options, ForegroundMask *mask);
+
+  mutable std::mutex mutex_;
+  BackgroundOptions options_;
+  bool reset_pending_ = false;
+
+  int width_ = 0;
+  int height_ = 0;
+  // Per pixel: running mean (mm), variance (mm^2) and return count, capped
+  // once the rate has settled.
+  std::vector<float> mean_;
+  std::vector<float> variance_;
+  std::vector<float> count_;
+  std::vector<std::uint64_t> scratch_;
+  std::vector<Run> runs_;
+  std::vector<std::uint32_t> parents_;
+  std::vector<ForegroundBox> regions_;
+
+  std::vector<std::shared_ptr<ForegroundMask>> masks_;
+  // options.threads of the call in progress.
+  int max_threads_ = 0;
+};
@@ -0,0 +1,542 @@
+#include "processing/background_removal.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+#include "processing/simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+constexpr int kBandRows = 16;
+constexpr int kGuideBandRows = 4;
+// Rec. 601 luma weights in 1/256ths (B, G, R). The guide and the
+// full-resolution luminance share one 0..1 scale.
+constexpr int kLumaB = 29;
+constexpr int kLumaG = 150;
+constexpr int kLumaR = 77;
+constexpr float kLumaScale = 1.0f / (256.0f * 255.0f);
+constexpr std::uint32_t kOpaque = 0xff000000u;
+// Alpha this close to 1 or 0 moves no channel by half a level, so the pixel
+// is kept or replaced outright. It also absorbs the running sums' rounding.
+constexpr float kSettledAlpha = 1.0f / 512.0f;
+// What a span between two guide columns needs.
+constexpr int kKeep = 0;
+constexpr int kReplace = 1;
+constexpr int kMixed = 2;
+
+// Mean over a (2 radius + 1)^2 window, clipped at the borders: rows with a
+// running sum into |scratch|, then columns with running column sums kept
+// after it (width * height + width floats). |out| may be |in|.
+void BoxMean(const float *in, float *out, float *scratch, int width, int height, int radius) {
+  const float inv_full = 1.0f / static_cast<float>(2 * radius + 1);
+  for (int y = 0; y < height; ++y) {
+    const float *src = in + static_cast<std::size_t>(y) * width;
+    float *dst = scratch + static_cast<std::size_t>(y) * width;
+    float sum = 0.0f;
+    for (int x = 0; x < std::min(radius, width); ++x) {
+      sum += src[x];
+    }
+    for (int x = 0; x < width; ++x) {
+      if (x + radius < width) {
+        sum += src[x + radius];
+      }
+      if (x - radius - 1 >= 0) {
+        sum -= src[x - radius - 1];
+      }
+      const int count = std::min(width - 1, x + radius) - std::max(0, x - radius) + 1;
+      dst[x] = sum * (count == 2 * radius + 1 ? inv_full : 1.0f / static_cast<float>(count));
+    }
+  }
+  float *sums = scratch + static_cast<std::size_t>(width) * height;
+  std::fill(sums, sums + width, 0.0f);
+  for (int y = 0; y < std::min(radius, height); ++y) {
+    const float *src = scratch + static_cast<std::size_t>(y) * width;
+    for (int x = 0; x < width; ++x) {
+      sums[x] += src[x];
+    }
+  }
+  // One pass per output row, four columns at a time: the compiler leaves
+  // these loops scalar, as |sums|, |out| and |scratch| may alias.
+  for (int y = 0; y < height; ++y) {
+    const float *add = y + radius < height ? scratch + static_cast<std::size_t>(y + radius) * width : nullptr;
+    const float *remove = y - radius - 1 >= 0 ? scratch + static_cast<std::size_t>(y - radius - 1) * width : nullptr;
+    const float inv = 1.0f / static_cast<float>(std::min(height - 1, y + radius) - std::max(0, y - radius) + 1);
+    const Float4 inv4 = SplatFloat4(inv);
+    float *dst = out + static_cast<std::size_t>(y) * width;
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+      Float4 sum = LoadFloat4(sums + x);
+      if (add != nullptr) {
+        sum = AddFloat4(sum, LoadFloat4(add + x));
+      }
+      if (remove != nullptr) {
+        sum = SubFloat4(sum, LoadFloat4(remove + x));
+      }
+      StoreFloat4(sums + x, sum);
+      StoreFloat4(dst + x, MulFloat4(sum, inv4));
+    }
+    for (; x < width; ++x) {
+      if (add != nullptr) {
+        sums[x] += add[x];
+      }
+      if (remove != nullptr) {
+        sums[x] -= remove[x];
+      }
+      dst[x] = sums[x] * inv;
+    }
+  }
+}
+
+inline std::uint32_t PackBgra(std::uint8_t r, std::uint8_t g, std::uint8_t b) {
+  return kOpaque | static_cast<std::uint32_t>(r) << 16 | static_cast<std::uint32_t>(g) << 8 | b;
+}
+
+// Scalar twin of the four-lane blend, for row tails.
+inline void BlendPixel(std::uint8_t *pixel, float a, float b, std::uint32_t replacement) {
+  const float luma = (kLumaB * pixel[0] + kLumaG * pixel[1] + kLumaR * pixel[2]) * kLumaScale;
+  const float alpha = std::min(1.0f, std::max(0.0f, a * luma + b));
+  if (alpha >= 1.0f - kSettledAlpha) {
+    return;
+  }
+  for (int c = 0; c < 3; ++c) {
+    const float back = static_cast<float>((replacement >> (8 * c)) & 0xffu);
+    pixel[c] = static_cast<std::uint8_t>(back + alpha * (pixel[c] - back) + 0.5f);
+  }
+  pixel[3] = 255;
+}
+
+}  // namespace
+
+bool ParseBackgroundRemovalSpec(const std::string &spec, BackgroundRemovalOptions *options, std::string *image_path,
+                                std::string *error) {
+  std::stringstream stream(spec);
+  std::string item;
+  options->enabled = true;
+  while (std::getline(stream, item, ',')) {
+    if (item.empty()) {
+      continue;
+    }
+    const std::size_t eq = item.find('=');
+    if (eq == std::string::npos) {
+      *error = "expected key=value, got '" + item + "'";
+      return false;
+    }
+    const std::string key = item.substr(0, eq);
+    const std::string value = item.substr(eq + 1);
+    if (key == "image") {
+      *image_path = value;
+      continue;
+    }
+    if (key == "color") {
+      char *end = nullptr;
+      const unsigned long rgb = std::strtoul(value.c_str(), &end, 16);
+      if (value.size() != 6 || end == nullptr || *end != '\0') {
+        *error = "color must be rrggbb, got '" + value + "'";
+        return false;
+      }
+      options->fill_rgb[0] = static_cast<std::uint8_t>(rgb >> 16);
+      options->fill_rgb[1] = static_cast<std::uint8_t>(rgb >> 8);
+      options->fill_rgb[2] = static_cast<std::uint8_t>(rgb);
+      continue;
+    }
+    char *end = nullptr;
+    const double number = std::strtod(value.c_str(), &end);
+    if (end == value.c_str() || *end != '\0') {
+      *error = "bad value for '" + key + "'";
+      return false;
+    }
+    if (key == "distance" && number > 0.0 && number <= 65535.0) {
+      options->max_depth_mm = static_cast<std::uint16_t>(number);
+    } else if (key == "near" && number >= 0.0 && number <= 65535.0) {
+      options->min_depth_mm = static_cast<std::uint16_t>(number);
+    } else if (key == "scale" && number >= 1.0 && number <= 16.0) {
+      options->guide_scale = static_cast<int>(number);
+    } else if (key == "radius" && number >= 1.0 && number <= 64.0) {
+      options->radius = static_cast<int>(number);
+    } else {
+      *error = "unknown or out-of-range option '" + item + "'";
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LoadPpm(const std::string &path, std::vector<std::uint8_t> *rgb, int *width, int *height) {
+  std::ifstream in(path, std::ios::binary);
+  std::string magic;
+  int w = 0;
+  int h = 0;
+  int max_value = 0;
+  if (!(in >> magic >> w >> h >> max_value) || magic != "P6" || w <= 0 || h <= 0 || max_value != 255) {
+    return false;
+  }
+  in.get();  // the single whitespace before the samples
+  rgb->resize(static_cast<std::size_t>(w) * h * 3);
+  if (!in.read(reinterpret_cast<char *>(rgb->data()), static_cast<std::streamsize>(rgb->size()))) {
+    return false;
+  }
+  *width = w;
+  *height = h;
+  return true;
+}
+
+BackgroundRemover::BackgroundRemover() = default;
+BackgroundRemover::~BackgroundRemover() = default;
+
+void BackgroundRemover::setOptions(const BackgroundRemovalOptions &options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  options_ = options;
+}
+
+BackgroundRemovalOptions BackgroundRemover::options() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return options_;
+}
+
+bool BackgroundRemover::enabled() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return options_.enabled;
+}
+
+void BackgroundRemover::setReplacementImage(const std::uint8_t *rgb, int width, int height) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (rgb == nullptr || width <= 0 || height <= 0) {
+    image_rgb_.clear();
+    image_width_ = 0;
+    image_height_ = 0;
+  } else {
+    image_rgb_.assign(rgb, rgb + static_cast<std::size_t>(width) * height * 3);
+    image_width_ = width;
+    image_height_ = height;
+  }
+  image_dirty_ = true;
+}
+
+void BackgroundRemover::resize(int width, int height, int scale) {
+  width_ = width;
+  height_ = height;
+  scale_ = scale;
+  guide_width_ = (width + scale - 1) / scale;
+  guide_height_ = (height + scale - 1) / scale;
+  const std::size_t guide_pixels = static_cast<std::size_t>(guide_width_) * guide_height_;
+  for (std::vector<float> *plane : {&guide_, &mask_, &mean_i_, &mean_p_, &corr_ii_, &corr_ip_, &a_, &b_}) {
+    plane->assign(guide_pixels, 0.0f);
+  }
+  box_scratch_.assign(guide_pixels + static_cast<std::size_t>(guide_width_), 0.0f);
+  const int guide_bands = (guide_height_ + kGuideBandRows - 1) / kGuideBandRows;
+  column_sums_.assign(static_cast<std::size_t>(guide_bands) * 2 * width, 0);
+
+  // Guide pixel g covers output pixels [g * scale, (g + 1) * scale); output
+  // pixel centres interpolate between the two nearest guide centres.
+  column_.resize(static_cast<std::size_t>(width));
+  column_weight_.resize(static_cast<std::size_t>(width));
+  for (int x = 0; x < width; ++x) {
+    const float g = std::min(static_cast<float>(guide_width_ - 1),
+                             std::max(0.0f, (x + 0.5f) / static_cast<float>(scale) - 0.5f));
+    const int left = std::min(static_cast<int>(g), std::max(0, guide_width_ - 2));
+    column_[static_cast<std::size_t>(x)] = left;
+    column_weight_[static_cast<std::size_t>(x)] = guide_width_ > 1 ? g - static_cast<float>(left) : 0.0f;
+  }
+  // First output column of each span between guide columns k and k + 1.
+  span_.assign(static_cast<std::size_t>(std::max(1, guide_width_ - 1)), width);
+  for (int x = width - 1; x >= 0; --x) {
+    span_[static_cast<std::size_t>(column_[static_cast<std::size_t>(x)])] = x;
+  }
+  span_[0] = 0;
+  cell_kind_.assign(static_cast<std::size_t>(std::max(1, guide_height_ - 1)) * span_.size(), kKeep);
+  const int bands = (height + kBandRows - 1) / kBandRows;
+  band_rows_.assign(static_cast<std::size_t>(bands) * (2 * guide_width_ + 2 * width), 0.0f);
+}
+
+void BackgroundRemover::buildGuide(const std::uint8_t *bgra, std::size_t stride, const std::uint16_t *depth,
+                                   int depth_width, int depth_height, const BackgroundRemovalOptions &options) {
+  KINECT_TRACE_SCOPE("background_removal.guide");
+  const int scale = scale_;
+  const int width = width_;
+  const int height = height_;
+  const int guide_width = guide_width_;
+  const int guide_height = guide_height_;
+  const int bands = (guide_height + kGuideBandRows - 1) / kGuideBandRows;
+  SharedThreadPool().parallelFor(bands, 1, max_threads_, [&](int begin, int end) {
+    const Int4 blue_red = SplatInt4(0x00ff00ff);
+    const Int4 byte = SplatInt4(0xff);
+    for (int band = begin; band < end; ++band) {
+      std::int32_t *columns_br = column_sums_.data() + static_cast<std::size_t>(band) * 2 * width;
+      std::int32_t *columns_g = columns_br + width;
+      for (int gy = band * kGuideBandRows; gy < std::min(guide_height, (band + 1) * kGuideBandRows); ++gy) {
+        const int y0 = gy * scale;
+        const int y1 = std::min(height, y0 + scale);
+        // Channels summed down the block's rows, four pixels at a time; blue
+        // and red share a word in 16-bit halves, which a 16x16 block of
+        // 255s (65280) cannot carry across.
+        std::fill(columns_br, columns_br + 2 * width, 0);
+        for (int y = y0; y < y1; ++y) {
+          const std::uint8_t *row = bgra + static_cast<std::size_t>(y) * stride;
+          int x = 0;
+          for (; x + 4 <= width; x += 4) {
+            const Int4 px = LoadInt4(reinterpret_cast<const std::int32_t *>(row + static_cast<std::size_t>(x) * 4));
+            StoreInt4(columns_br + x, AddInt4(LoadInt4(columns_br + x), AndInt4(px, blue_red)));
+            StoreInt4(columns_g + x, AddInt4(LoadInt4(columns_g + x), AndInt4(ShiftRightLogicalInt4<8>(px), byte)));
+          }
+          for (; x < width; ++x) {
+            const std::uint8_t *pixel = row + static_cast<std::size_t>(x) * 4;
+            columns_br[x] += pixel[0] | pixel[2] << 16;
+            columns_g[x] += pixel[1];
+          }
+        }
+        // Depth at the block centre, in the depth image's own scale.
+        const int dy = std::min(depth_height - 1, static_cast<int>((y0 + 0.5f * scale) * depth_height / height));
+        const std::uint16_t *depth_row = depth + static_cast<std::size_t>(dy) * depth_width;
+        float *guide = guide_.data() + static_cast<std::size_t>(gy) * guide_width;
+        float *mask = mask_.data() + static_cast<std::size_t>(gy) * guide_width;
+        for (int gx = 0; gx < guide_width; ++gx) {
+          const int x0 = gx * scale;
+          const int x1 = std::min(width, x0 + scale);
+          std::uint32_t br = 0;
+          std::uint32_t g = 0;
+          for (int x = x0; x < x1; ++x) {
+            br += static_cast<std::uint32_t>(columns_br[x]);
+            g += static_cast<std::uint32_t>(columns_g[x]);
+          }
+          const std::uint32_t luma = kLumaB * (br & 0xffffu) + kLumaG * g + kLumaR * (br >> 16);
+          guide[gx] = static_cast<float>(luma) * kLumaScale / static_cast<float>((x1 - x0) * (y1 - y0));
+          const int dx = std::min(depth_width - 1, static_cast<int>((x0 + 0.5f * scale) * depth_width / width));
+          const std::uint16_t mm = depth_row[dx];
+          mask[gx] = mm >= options.min_depth_mm && mm <= options.max_depth_mm && mm != 0 ? 1.0f : 0.0f;
+        }
+      }
+    }
+  });
+}
+
+void BackgroundRemover::solveMatte(const BackgroundRemovalOptions &options) {
+  KINECT_TRACE_SCOPE("background_removal.guided_filter");
+  // He et al.'s guided filter for a grey guide: per window, the mask is
+  // fitted as a * I + b, with |epsilon| damping a where the guide is flat.
+  const int w = guide_width_;
+  const int h = guide_height_;
+  const int r = std::max(1, options.radius);
+  const std::size_t n = guide_.size();
+  float *scratch = box_scratch_.data();
+  for (std::size_t i = 0; i < n; ++i) {
+    corr_ii_[i] = guide_[i] * guide_[i];
+    corr_ip_[i] = guide_[i] * mask_[i];
+  }
+  BoxMean(guide_.data(), mean_i_.data(), scratch, w, h, r);
+  BoxMean(mask_.data(), mean_p_.data(), scratch, w, h, r);
+  BoxMean(corr_ii_.data(), corr_ii_.data(), scratch, w, h, r);
+  BoxMean(corr_ip_.data(), corr_ip_.data(), scratch, w, h, r);
+  const float epsilon = std::max(1e-6f, options.epsilon);
+  for (std::size_t i = 0; i < n; ++i) {
+    const float variance = corr_ii_[i] - mean_i_[i] * mean_i_[i];
+    const float covariance = corr_ip_[i] - mean_i_[i] * mean_p_[i];
+    a_[i] = covariance / (variance + epsilon);
+    b_[i] = mean_p_[i] - a_[i] * mean_i_[i];
+  }
+  BoxMean(a_.data(), a_.data(), scratch, w, h, r);
+  BoxMean(b_.data(), b_.data(), scratch, w, h, r);
+}
+
+void BackgroundRemover::blend(std::uint8_t *bgra, std::size_t stride, const BackgroundRemovalOptions &options) {
+  KINECT_TRACE_SCOPE("background_removal.blend");
+  const int width = width_;
+  const int height = height_;
+  const int guide_width = guide_width_;
+  const int guide_height = guide_height_;
+  const float scale = static_cast<float>(scale_);
+  const bool image = !replacement_.empty();
+  const std::uint32_t fill = PackBgra(options.fill_rgb[0], options.fill_rgb[1], options.fill_rgb[2]);
+  const int bands = (height + kBandRows - 1) / kBandRows;
+  const std::size_t band_floats = static_cast<std::size_t>(2 * guide_width + 2 * width);
+  const int intervals = std::max(1, guide_width - 1);
+  const int cell_rows = std::max(1, guide_height - 1);
+
+  // Alpha is linear in luminance, and inside a guide cell (between guide
+  // rows top and top + 1 and columns k and k + 1) its coefficients
+  // interpolate the cell's corners. Where a * I + b clears 1 (or 0) for both
+  // I = 0 and I = 1 at all four corners, every pixel in the cell is kept (or
+  // replaced) without reading it.
+  SharedThreadPool().parallelFor(cell_rows, 1, max_threads_, [&](int begin, int end) {
+    for (int top = begin; top < end; ++top) {
+      const int bottom = std::min(top + 1, guide_height - 1);
+      const float *a0 = a_.data() + static_cast<std::size_t>(top) * guide_width;
+      const float *a1 = a_.data() + static_cast<std::size_t>(bottom) * guide_width;
+      const float *b0 = b_.data() + static_cast<std::size_t>(top) * guide_width;
+      const float *b1 = b_.data() + static_cast<std::size_t>(bottom) * guide_width;
+      std::uint8_t *kinds = cell_kind_.data() + static_cast<std::size_t>(top) * intervals;
+      const auto column_low = [&](int gx) {
+        return std::min(std::min(b0[gx], a0[gx] + b0[gx]), std::min(b1[gx], a1[gx] + b1[gx]));
+      };
+      const auto column_high = [&](int gx) {
+        return std::max(std::max(b0[gx], a0[gx] + b0[gx]), std::max(b1[gx], a1[gx] + b1[gx]));
+      };
+      float left_low = column_low(0);
+      float left_high = column_high(0);
+      for (int k = 0; k < intervals; ++k) {
+        const int right = std::min(k + 1, guide_width - 1);
+        const float right_low = column_low(right);
+        const float right_high = column_high(right);
+        const float low = std::min(left_low, right_low);
+        const float high = std::max(left_high, right_high);
+        kinds[k] = low >= 1.0f - kSettledAlpha ? kKeep : high <= kSettledAlpha ? kReplace : kMixed;
+        left_low = right_low;
+        left_high = right_high;
+      }
+    }
+  });
+
+  SharedThreadPool().parallelFor(bands, 1, max_threads_, [&](int begin, int end) {
+    const Float4 zero = SplatFloat4(0.0f);
+    const Float4 one = SplatFloat4(1.0f);
+    const Float4 keep = SplatFloat4(1.0f - kSettledAlpha);
+    const Float4 replace = SplatFloat4(kSettledAlpha);
+    const Float4 half = SplatFloat4(0.5f);
+    const Float4 luma_b = SplatFloat4(kLumaB * kLumaScale);
+    const Float4 luma_g = SplatFloat4(kLumaG * kLumaScale);
+    const Float4 luma_r = SplatFloat4(kLumaR * kLumaScale);
+    const Int4 byte = SplatInt4(0xff);
+    const Int4 opaque = SplatInt4(static_cast<std::int32_t>(kOpaque));
+    const Float4 fill_b = SplatFloat4(static_cast<float>(fill & 0xffu));
+    const Float4 fill_g = SplatFloat4(static_cast<float>((fill >> 8) & 0xffu));
+    const Float4 fill_r = SplatFloat4(static_cast<float>((fill >> 16) & 0xffu));
+    const Int4 fill_pixels = SplatInt4(static_cast<std::int32_t>(fill));
+    for (int band = begin; band < end; ++band) {
+      float *guide_a = band_rows_.data() + static_cast<std::size_t>(band) * band_floats;
+      float *guide_b = guide_a + guide_width;
+      float *row_a = guide_b + guide_width;
+      float *row_b = row_a + width;
+      for (int y = band * kBandRows; y < std::min(height, (band + 1) * kBandRows); ++y) {
+        // Coefficients for this row, between two guide rows; they are
+        // interpolated only across mixed runs, and spread to output columns
+        // there.
+        const float gy = std::min(static_cast<float>(guide_height - 1), std::max(0.0f, (y + 0.5f) / scale - 0.5f));
+        const int top = std::min(static_cast<int>(gy), std::max(0, guide_height - 2));
+        const int bottom = std::min(top + 1, guide_height - 1);
+        const float wy = gy - static_cast<float>(top);
+        const float *a0 = a_.data() + static_cast<std::size_t>(top) * guide_width;
+        const float *a1 = a_.data() + static_cast<std::size_t>(bottom) * guide_width;
+        const float *b0 = b_.data() + static_cast<std::size_t>(top) * guide_width;
+        const float *b1 = b_.data() + static_cast<std::size_t>(bottom) * guide_width;
+        const std::uint8_t *kinds = cell_kind_.data() + static_cast<std::size_t>(top) * intervals;
+        std::uint8_t *row = bgra + static_cast<std::size_t>(y) * stride;
+        const std::uint32_t *back = image ? replacement_.data() + static_cast<std::size_t>(y) * width : nullptr;
+        int run_begin = 0;
+        int run_first = 0;
+        int run_kind = -1;
+        for (int k = 0; k <= intervals; ++k) {
+          const int kind = k < intervals ? kinds[k] : -1;
+          if (kind == run_kind) {
+            continue;
+          }
+          const int x_begin = run_begin;
+          const int x_end = k < intervals ? span_[static_cast<std::size_t>(k)] : width;
+          if (run_kind == kReplace) {
+            std::uint32_t *out = reinterpret_cast<std::uint32_t *>(row) + x_begin;
+            if (image) {
+              std::copy(back + x_begin, back + x_end, out);
+            } else {
+              std::fill(out, out + (x_end - x_begin), fill);
+            }
+          } else if (run_kind == kMixed) {
+            for (int gx = run_first; gx <= std::min(k, guide_width - 1); ++gx) {
+              guide_a[gx] = a0[gx] + wy * (a1[gx] - a0[gx]);
+              guide_b[gx] = b0[gx] + wy * (b1[gx] - b0[gx]);
+            }
+            for (int x = x_begin; x < x_end; ++x) {
+              const int left = column_[static_cast<std::size_t>(x)];
+              const int right = std::min(left + 1, guide_width - 1);
+              const float wx = column_weight_[static_cast<std::size_t>(x)];
+              row_a[x] = guide_a[left] + wx * (guide_a[right] - guide_a[left]);
+              row_b[x] = guide_b[left] + wx * (guide_b[right] - guide_b[left]);
+            }
+            int x = x_begin;
+            for (; x + 4 <= x_end; x += 4) {
+              std::int32_t *pixels = reinterpret_cast<std::int32_t *>(row + static_cast<std::size_t>(x) * 4);
+              const Int4 px = LoadInt4(pixels);
+              const Float4 b = IntToFloat4(AndInt4(px, byte));
+              const Float4 g = IntToFloat4(AndInt4(ShiftRightLogicalInt4<8>(px), byte));
+              const Float4 r = IntToFloat4(AndInt4(ShiftRightLogicalInt4<16>(px), byte));
+              const Float4 luma =
+                  AddFloat4(AddFloat4(MulFloat4(b, luma_b), MulFloat4(g, luma_g)), MulFloat4(r, luma_r));
+              const Float4 alpha = MinFloat4(
+                  one, MaxFloat4(zero, AddFloat4(MulFloat4(LoadFloat4(row_a + x), luma), LoadFloat4(row_b + x))));
+              if (MaskBits4(GreaterEqualFloat4(alpha, keep)) == 0xf) {
+                continue;
+              }
+              const Int4 back_px = image ? LoadInt4(reinterpret_cast<const std::int32_t *>(back + x)) : fill_pixels;
+              if (MaskBits4(GreaterEqualFloat4(replace, alpha)) == 0xf) {
+                StoreInt4(pixels, back_px);
+                continue;
+              }
+              const Float4 back_b = image ? IntToFloat4(AndInt4(back_px, byte)) : fill_b;
+              const Float4 back_g = image ? IntToFloat4(AndInt4(ShiftRightLogicalInt4<8>(back_px), byte)) : fill_g;
+              const Float4 back_r = image ? IntToFloat4(AndInt4(ShiftRightLogicalInt4<16>(back_px), byte)) : fill_r;
+              const Int4 out_b =
+                  FloatToInt4(AddFloat4(AddFloat4(back_b, MulFloat4(alpha, SubFloat4(b, back_b))), half));
+              const Int4 out_g =
+                  FloatToInt4(AddFloat4(AddFloat4(back_g, MulFloat4(alpha, SubFloat4(g, back_g))), half));
+              const Int4 out_r =
+                  FloatToInt4(AddFloat4(AddFloat4(back_r, MulFloat4(alpha, SubFloat4(r, back_r))), half));
+              StoreInt4(pixels,
+                        OrInt4(OrInt4(opaque, ShiftLeftInt4<16>(out_r)), OrInt4(ShiftLeftInt4<8>(out_g), out_b)));
+            }
+            for (; x < x_end; ++x) {
+              BlendPixel(row + static_cast<std::size_t>(x) * 4, row_a[x], row_b[x], image ? back[x] : fill);
+            }
+          }
+          run_begin = x_end;
+          run_first = k;
+          run_kind = kind;
+        }
+      }
+    }
+  });
+}
+
+bool BackgroundRemover::apply(std::uint8_t *bgra, int width, int height, std::size_t stride,
+                              const std::uint16_t *depth, int depth_width, int depth_height) {
+  KINECT_TRACE_SCOPE("background_removal.apply");
+  if (bgra == nullptr || depth == nullptr || width <= 0 || height <= 0 || depth_width <= 0 || depth_height <= 0) {
+    return false;
+  }
+  BackgroundRemovalOptions options;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    options = options_;
+  }
+  const int scale = std::min(16, std::max(1, options.guide_scale));
+  const bool resized = width != width_ || height != height_ || scale != scale_;
+  if (resized) {
+    resize(width, height, scale);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (image_dirty_ || resized) {
+      image_dirty_ = false;
+      replacement_.clear();
+      if (!image_rgb_.empty()) {
+        // Nearest-neighbour stretch, once per image or output size.
+        replacement_.resize(static_cast<std::size_t>(width) * height);
+        for (int y = 0; y < height; ++y) {
+          const int sy = y * image_height_ / height;
+          for (int x = 0; x < width; ++x) {
+            const int sx = x * image_width_ / width;
+            const std::uint8_t *src = image_rgb_.data() + (static_cast<std::size_t>(sy) * image_width_ + sx) * 3;
+            replacement_[static_cast<std::size_t>(y) * width + x] = PackBgra(src[0], src[1], src[2]);
+          }
+        }
+      }
+    }
+  }
+  max_threads_ = options.threads;
+
+  buildGuide(bgra, stride, depth, depth_width, depth_height, options);
+  solveMatte(options);
+  blend(bgra, stride, options);
+  return true;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct BackgroundRemovalOptions {
+  bool enabled = false;
+  // Color-aligned depth within [min, max] millimetres is kept; farther
+  // surfaces and pixels without a return are replaced.
+  std::uint16_t min_depth_mm = 350;
+  std::uint16_t max_depth_mm = 1500;
+  // The matte is solved on the color downscaled by this factor and applied
+  // at full resolution (fast guided filter).
+  int guide_scale = 4;
+  // Guided filter window radius in guide pixels, and its regularisation on
+  // 0..1 luminance: larger values feather more, smaller ones follow color
+  // edges more closely.
+  int radius = 2;
+  float epsilon = 0.002f;
+  // Replacement when no image is set.
+  std::uint8_t fill_rgb[3] = {0, 177, 64};
+  // Shared pool threads to use, including the caller; 0 uses all of them.
+  int threads = 0;
+};
+
+// Parses "key=value,..." with keys distance (max depth, mm), near (min
+// depth, mm), color (rrggbb), scale, radius and image (a path, returned in
+// |image_path| for the caller to load). Sets |options|->enabled.
+bool ParseBackgroundRemovalSpec(const std::string &spec, BackgroundRemovalOptions *options, std::string *image_path,
+                                std::string *error);
+
+// Binary PPM (P6, 8-bit) to RGB24.
+bool LoadPpm(const std::string &path, std::vector<std::uint8_t> *rgb, int *width, int *height);
+
+// Depth-keyed background replacement for BGRA video. Depth seen from the
+// color camera gives a hard keep/replace mask at guide resolution; a guided
+// filter with the downscaled luminance as guide turns it into a matte whose
+// edges follow the color image, and the matte's linear coefficients are
+// upsampled so the final alpha is evaluated against full-resolution
+// luminance. Guide cells whose corner coefficients settle alpha for any
+// luminance are kept or filled without reading the pixels; the rest blend
+// four pixels at a time. Buffers are sized on the first frame; setOptions()
+// may be called from another thread than apply().
+class BackgroundRemover {
+ public:
+  BackgroundRemover();
+  ~BackgroundRemover();
+  BackgroundRemover(const BackgroundRemover &) = delete;
+  BackgroundRemover &operator=(const BackgroundRemover &) = delete;
+
+  void setOptions(const BackgroundRemovalOptions &options);
+  BackgroundRemovalOptions options() const;
+  bool enabled() const;
+  // RGB24 replacement image, stretched to the output size. Null clears it
+  // back to the fill color.
+  void setReplacementImage(const std::uint8_t *rgb, int width, int height);
+
+  // Replaces the background of |bgra| (width x height, |stride| bytes per
+  // row) in place. |depth| is color-aligned depth in millimetres
+  // (FrameData::registered_depth) covering the same view at any size.
+  // Returns false, leaving the image alone, when either is empty.
+  bool apply(std::uint8_t *bgra, int width, int height, std::size_t stride, const std::uint16_t *depth,
+             int depth_width, int depth_height);
+
+ private:
+  void resize(int width, int height, int scale);
+  void buildGuide(const std::uint8_t *bgra, std::size_t stride, const std::uint16_t *depth, int depth_width,
+                  int depth_height, const BackgroundRemovalOptions &options);
+  void solveMatte(const BackgroundRemovalOptions &options);
+  void blend(std::uint8_t *bgra, std::size_t stride, const BackgroundRemovalOptions &options);
+
+  mutable std::mutex mutex_;
+  BackgroundRemovalOptions options_;
+  std::vector<std::uint8_t> image_rgb_;
+  int image_width_ = 0;
+  int image_height_ = 0;
+  bool image_dirty_ = false;
+
+  int width_ = 0;
+  int height_ = 0;
+  int scale_ = 0;
+  int guide_width_ = 0;
+  int guide_height_ = 0;
+  // Guide-resolution planes: luminance, mask, the guided filter's box means
+  // and the matte's smoothed linear coefficients, alpha = a * I + b.
+  std::vector<float> guide_;
+  std::vector<float> mask_;
+  std::vector<float> mean_i_;
+  std::vector<float> mean_p_;
+  std::vector<float> corr_ii_;
+  std::vector<float> corr_ip_;
+  std::vector<float> a_;
+  std::vector<float> b_;
+  std::vector<float> box_scratch_;
+  // Per guide row band: blue | red << 16, then green, summed down a block's
+  // rows, per output column.
+  std::vector<std::int32_t> column_sums_;
+  // Per output column: left guide column and weight of the right one.
+  std::vector<int> column_;
+  std::vector<float> column_weight_;
+  // Per guide column span: its first output column.
+  std::vector<int> span_;
+  // Per guide cell: whether its pixels are kept, replaced or blended.
+  std::vector<std::uint8_t> cell_kind_;
+  // Per row band: interpolated coefficient rows.
+  std::vector<float> band_rows_;
+  // Replacement image resampled to the output, BGRA.
+  std::vector<std::uint32_t> replacement_;
+
+  // options.threads of the call in progress.
+  int max_threads_ = 0;
+};
@@ -0,0 +1,444 @@
+#include "processing/blob_tracker.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+#include "processing/background_model.h"
+#include "processing/camera_model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+constexpr int kBandRows = 16;
+// Sets kept for reuse, as in DepthPyramidBuilder.
+constexpr std::size_t kSetPoolSize = 4;
+// Weight of the newest displacement in the smoothed velocity.
+constexpr float kVelocityGain = 0.5f;
+
+}  // namespace
+
+// A horizontal run of mask pixels with the moments of its depth returns.
+struct BlobTracker::Run {
+  int x0;
+  int x1;
+  int y;
+  std::uint32_t points;
+  float sum[3];
+  float min[3];
+  float max[3];
+};
+
+// A band's runs in raster order, with union-find parents local to the band.
+// The seams need the runs of the band's first and last rows.
+struct BlobTracker::Band {
+  std::vector<Run> runs;
+  std::vector<std::uint32_t> parents;
+  std::size_t first_row_end = 0;
+  std::size_t last_row_begin = 0;
+  std::size_t offset = 0;
+};
+
+struct BlobTracker::Region {
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+  std::size_t pixels;
+  std::size_t points;
+  double sum_u;
+  double sum_v;
+  double sum[3];
+  float min[3];
+  float max[3];
+  // Index into BlobSet::blobs, -1 when the region is not a blob.
+  int blob;
+};
+
+struct BlobTracker::Track {
+  std::uint32_t id;
+  std::uint32_t age;
+  int missed;
+  bool matched;
+  float centroid[3];
+  float velocity[3];
+};
+
+struct BlobTracker::Match {
+  float distance2;
+  std::uint32_t track;
+  std::uint32_t blob;
+};
+
+BlobTracker::BlobTracker() = default;
+BlobTracker::~BlobTracker() = default;
+
+void BlobTracker::setOptions(const BlobTrackingOptions &options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (options.enabled && !options_.enabled) {
+    reset_pending_ = true;
+  }
+  options_ = options;
+}
+
+BlobTrackingOptions BlobTracker::options() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return options_;
+}
+
+bool BlobTracker::enabled() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return options_.enabled;
+}
+
+void BlobTracker::reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  reset_pending_ = true;
+}
+
+void BlobTracker::labelBand(const ForegroundMask &mask, const std::uint16_t *depth, const RayTable &rays, int y0,
+                            int y1, Band *band) const {
+  std::vector<Run> &runs = band->runs;
+  std::vector<std::uint32_t> &parents = band->parents;
+  runs.clear();
+  parents.clear();
+  band->first_row_end = 0;
+  band->last_row_begin = 0;
+  const auto find = [&](std::uint32_t i) {
+    while (parents[i] != i) {
+      parents[i] = parents[parents[i]];
+      i = parents[i];
+    }
+    return i;
+  };
+  const float *ray_x = rays.x();
+  const float *ray_y = rays.y();
+  const float inf = std::numeric_limits<float>::infinity();
+
+  // As BackgroundModel::findBoxes(): runs of set bits per row, joined to the
+  // previous row's runs they touch (8-connected). Each run also sums the
+  // points under it.
+  std::size_t previous_begin = 0;
+  for (int y = y0; y < y1; ++y) {
+    const std::uint64_t *bits = mask.bits.data() + static_cast<std::size_t>(y) * mask.stride;
+    const std::size_t row_begin = runs.size();
+    for (int i = 0; i < mask.stride; ++i) {
+      std::uint64_t w = bits[i];
+      while (w != 0) {
+        const int start = __builtin_ctzll(w);
+        const std::uint64_t shifted = ~(w >> start);
+        const int length = shifted == 0 ? 64 - start : std::min(64 - start, __builtin_ctzll(shifted));
+        const int x0 = i * 64 + start;
+        const int x1 = x0 + length;
+        if (runs.size() > row_begin && runs.back().x1 == x0) {
+          runs.back().x1 = x1;
+        } else {
+          runs.push_back(Run{x0, x1, y, 0, {0.0f, 0.0f, 0.0f}, {inf, inf, inf}, {-inf, -inf, -inf}});
+          parents.push_back(static_cast<std::uint32_t>(runs.size() - 1));
+        }
+        w = length == 64 ? 0 : w & ~(((1ull << length) - 1) << start);
+      }
+    }
+
+    const std::size_t row = static_cast<std::size_t>(y) * mask.width;
+    std::size_t p = previous_begin;
+    for (std::size_t r = row_begin; r < runs.size(); ++r) {
+      Run &run = runs[r];
+      for (std::size_t i = row + run.x0; i < row + run.x1; ++i) {
+        if (depth[i] == 0) {
+          continue;
+        }
+        const float z = depth[i] * 0.001f;
+        const float point[3] = {ray_x[i] * z, ray_y[i] * z, z};
+        ++run.points;
+        for (int k = 0; k < 3; ++k) {
+          run.sum[k] += point[k];
+          run.min[k] = std::min(run.min[k], point[k]);
+          run.max[k] = std::max(run.max[k], point[k]);
+        }
+      }
+      while (p < row_begin && runs[p].x1 < run.x0) {
+        ++p;
+      }
+      for (std::size_t q = p; q < row_begin && runs[q].x0 <= run.x1; ++q) {
+        const std::uint32_t a = find(static_cast<std::uint32_t>(q));
+        const std::uint32_t b = find(static_cast<std::uint32_t>(r));
+        if (a != b) {
+          parents[std::max(a, b)] = std::min(a, b);
+        }
+      }
+    }
+    if (y == y0) {
+      band->first_row_end = runs.size();
+    }
+    band->last_row_begin = row_begin;
+    previous_begin = row_begin;
+  }
+}
+
+void BlobTracker::gatherRegions(const BlobTrackingOptions &options, BlobSet *set) {
+  KINECT_TRACE_SCOPE("blobs.regions");
+  const auto find = [&](std::uint32_t i) {
+    while (parents_[i] != i) {
+      parents_[i] = parents_[parents_[i]];
+      i = parents_[i];
+    }
+    return i;
+  };
+
+  std::size_t total = 0;
+  for (Band &band : bands_) {
+    band.offset = total;
+    total += band.runs.size();
+  }
+  parents_.resize(total);
+  for (const Band &band : bands_) {
+    for (std::size_t r = 0; r < band.parents.size(); ++r) {
+      parents_[band.offset + r] = static_cast<std::uint32_t>(band.offset + band.parents[r]);
+    }
+  }
+  // Stitch each band's first row to the previous band's last row. Roots stay
+  // the lowest index, so across the frame a region's root is its first run.
+  for (std::size_t b = 1; b < bands_.size(); ++b) {
+    const Band &above = bands_[b - 1];
+    const Band &below = bands_[b];
+    std::size_t p = above.last_row_begin;
+    for (std::size_t r = 0; r < below.first_row_end; ++r) {
+      const Run &run = below.runs[r];
+      while (p < above.runs.size() && above.runs[p].x1 < run.x0) {
+        ++p;
+      }
+      for (std::size_t q = p; q < above.runs.size() && above.runs[q].x0 <= run.x1; ++q) {
+        const std::uint32_t a = find(static_cast<std::uint32_t>(above.offset + q));
+        const std::uint32_t c = find(static_cast<std::uint32_t>(below.offset + r));
+        if (a != c) {
+          parents_[std::max(a, c)] = std::min(a, c);
+        }
+      }
+    }
+  }
+
+  // Parents precede their children, so one pass in order flattens every
+  // tree; writeLabels() then reads roots without touching the forest.
+  regions_.resize(total);
+  order_.clear();
+  for (const Band &band : bands_) {
+    for (std::size_t r = 0; r < band.runs.size(); ++r) {
+      const Run &run = band.runs[r];
+      const std::size_t g = band.offset + r;
+      const std::uint32_t root = parents_[parents_[g]];
+      parents_[g] = root;
+      Region &region = regions_[root];
+      if (root == g) {
+        region = Region{run.x0, run.y, run.x1, run.y + 1, 0, 0, 0.0, 0.0, {0.0, 0.0, 0.0},
+                        {run.min[0], run.min[1], run.min[2]}, {run.max[0], run.max[1], run.max[2]}, -1};
+        order_.push_back(root);
+      } else {
+        region.x0 = std::min(region.x0, run.x0);
+        region.x1 = std::max(region.x1, run.x1);
+        region.y1 = run.y + 1;
+        for (int k = 0; k < 3; ++k) {
+          region.min[k] = std::min(region.min[k], run.min[k]);
+          region.max[k] = std::max(region.max[k], run.max[k]);
+        }
+      }
+      const int length = run.x1 - run.x0;
+      region.pixels += static_cast<std::size_t>(length);
+      region.points += run.points;
+      region.sum_u += 0.5 * (run.x0 + run.x1 - 1) * length;
+      region.sum_v += static_cast<double>(run.y) * length;
+      for (int k = 0; k < 3; ++k) {
+        region.sum[k] += run.sum[k];
+      }
+    }
+  }
+  stats_.runs = total;
+  stats_.regions = order_.size();
+
+  const std::size_t min_pixels = static_cast<std::size_t>(std::max(1, options.min_blob_pixels));
+  std::size_t kept = 0;
+  for (std::uint32_t root : order_) {
+    const Region &region = regions_[root];
+    if (region.pixels >= min_pixels && region.points > 0) {
+      order_[kept++] = root;
+    }
+  }
+  std::sort(order_.begin(), order_.begin() + static_cast<std::ptrdiff_t>(kept),
+            [&](std::uint32_t a, std::uint32_t b) { return regions_[a].pixels > regions_[b].pixels; });
+  kept = std::min(kept, static_cast<std::size_t>(std::max(0, options.max_blobs)));
+  for (std::size_t i = 0; i < kept; ++i) {
+    Region &region = regions_[order_[i]];
+    region.blob = static_cast<int>(i);
+    Blob blob;
+    blob.pixels = region.pixels;
+    blob.points = region.points;
+    blob.x0 = region.x0;
+    blob.y0 = region.y0;
+    blob.x1 = region.x1;
+    blob.y1 = region.y1;
+    blob.center_u = static_cast<float>(region.sum_u / static_cast<double>(region.pixels));
+    blob.center_v = static_cast<float>(region.sum_v / static_cast<double>(region.pixels));
+    for (int k = 0; k < 3; ++k) {
+      blob.centroid[k] = static_cast<float>(region.sum[k] / static_cast<double>(region.points));
+      blob.min[k] = region.min[k];
+      blob.max[k] = region.max[k];
+    }
+    set->blobs.push_back(blob);
+  }
+}
+
+void BlobTracker::associate(const BlobTrackingOptions &options, BlobSet *set) {
+  KINECT_TRACE_SCOPE("blobs.associate");
+  // Every track-blob pair within the gate, closest first; a pair is taken
+  // when neither side is taken yet.
+  const float gate2 = options.max_match_distance_m * options.max_match_distance_m;
+  matches_.clear();
+  for (std::size_t t = 0; t < tracks_.size(); ++t) {
+    Track &track = tracks_[t];
+    track.matched = false;
+    const float steps = static_cast<float>(track.missed + 1);
+    for (std::size_t b = 0; b < set->blobs.size(); ++b) {
+      const Blob &blob = set->blobs[b];
+      float distance2 = 0.0f;
+      for (int k = 0; k < 3; ++k) {
+        const float d = blob.centroid[k] - (track.centroid[k] + steps * track.velocity[k]);
+        distance2 += d * d;
+      }
+      if (distance2 <= gate2) {
+        matches_.push_back(Match{distance2, static_cast<std::uint32_t>(t), static_cast<std::uint32_t>(b)});
+      }
+    }
+  }
+  std::sort(matches_.begin(), matches_.end(), [](const Match &a, const Match &b) { return a.distance2 < b.distance2; });
+
+  for (const Match &match : matches_) {
+    Track &track = tracks_[match.track];
+    Blob &blob = set->blobs[match.blob];
+    if (track.matched || blob.id != 0) {
+      continue;
+    }
+    track.matched = true;
+    const float steps = static_cast<float>(track.missed + 1);
+    for (int k = 0; k < 3; ++k) {
+      const float step = (blob.centroid[k] - track.centroid[k]) / steps;
+      track.velocity[k] += kVelocityGain * (step - track.velocity[k]);
+      track.centroid[k] = blob.centroid[k];
+      blob.velocity[k] = track.velocity[k];
+    }
+    track.missed = 0;
+    ++track.age;
+    blob.id = track.id;
+    blob.age = track.age;
+    ++stats_.matched;
+  }
+
+  next_tracks_.clear();
+  for (const Track &track : tracks_) {
+    if (track.matched || track.missed < options.max_missed_frames) {
+      next_tracks_.push_back(track);
+      next_tracks_.back().missed += track.matched ? 0 : 1;
+    }
+  }
+  for (Blob &blob : set->blobs) {
+    if (blob.id != 0) {
+      continue;
+    }
+    blob.id = next_id_++;
+    blob.age = 1;
+    next_tracks_.push_back(Track{blob.id, 1, 0, false, {blob.centroid[0], blob.centroid[1], blob.centroid[2]},
+                                 {0.0f, 0.0f, 0.0f}});
+    ++stats_.new_tracks;
+  }
+  tracks_.swap(next_tracks_);
+}
+
+void BlobTracker::writeLabels(const BlobSet &set, std::vector<std::uint16_t> *labels) {
+  KINECT_TRACE_SCOPE("blobs.labels");
+  labels->resize(static_cast<std::size_t>(set.width) * set.height);
+  std::uint16_t *out = labels->data();
+  const int width = set.width;
+  SharedThreadPool().parallelFor(static_cast<int>(bands_.size()), 1, max_threads_, [&](int begin, int end) {
+    for (int b = begin; b < end; ++b) {
+      const Band &band = bands_[static_cast<std::size_t>(b)];
+      const int y0 = b * kBandRows;
+      const int y1 = std::min(set.height, y0 + kBandRows);
+      std::fill(out + static_cast<std::size_t>(y0) * width, out + static_cast<std::size_t>(y1) * width,
+                std::uint16_t{0});
+      for (std::size_t r = 0; r < band.runs.size(); ++r) {
+        const Region &region = regions_[parents_[band.offset + r]];
+        if (region.blob < 0) {
+          continue;
+        }
+        const Run &run = band.runs[r];
+        std::uint16_t *row = out + static_cast<std::size_t>(run.y) * width;
+        std::fill(row + run.x0, row + run.x1, static_cast<std::uint16_t>(region.blob + 1));
+      }
+    }
+  });
+}
+
+std::shared_ptr<const BlobSet> BlobTracker::track(const ForegroundMask &mask, const std::uint16_t *depth,
+                                                  const RayTable &rays) {
+  KINECT_TRACE_SCOPE("blobs.track");
+  BlobTrackingOptions options;
+  bool reset = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    options = options_;
+    reset = reset_pending_;
+    reset_pending_ = false;
+  }
+  if (reset) {
+    tracks_.clear();
+  }
+  stats_ = BlobTrackingStats();
+  max_threads_ = options.threads;
+
+  std::shared_ptr<BlobSet> set;
+  for (const auto &candidate : sets_) {
+    if (candidate.use_count() == 1) {
+      set = candidate;
+      break;
+    }
+  }
+  if (set == nullptr) {
+    set = std::make_shared<BlobSet>();
+    set->blobs.reserve(static_cast<std::size_t>(std::max(0, options.max_blobs)));
+    if (sets_.size() < kSetPoolSize) {
+      sets_.push_back(set);
+    }
+  }
+  set->width = mask.width;
+  set->height = mask.height;
+  set->blobs.clear();
+  set->labels.clear();
+  if (mask.width <= 0 || mask.height <= 0 || rays.width() != mask.width || rays.height() != mask.height) {
+    return set;
+  }
+
+  const int band_count = (mask.height + kBandRows - 1) / kBandRows;
+  if (bands_.size() != static_cast<std::size_t>(band_count)) {
+    bands_.resize(static_cast<std::size_t>(band_count));
+    // At most one run per two pixels of a row.
+    const std::size_t max_runs = static_cast<std::size_t>(mask.width / 2 + 1) * mask.height;
+    parents_.reserve(max_runs);
+    regions_.reserve(max_runs);
+    order_.reserve(max_runs);
+  }
+  {
+    KINECT_TRACE_SCOPE("blobs.label_bands");
+    SharedThreadPool().parallelFor(band_count, 1, max_threads_, [&](int begin, int end) {
+      for (int b = begin; b < end; ++b) {
+        const int y0 = b * kBandRows;
+        labelBand(mask, depth, rays, y0, std::min(mask.height, y0 + kBandRows), &bands_[static_cast<std::size_t>(b)]);
+      }
+    });
+  }
+  gatherRegions(options, set.get());
+  associate(options, set.get());
+  if (options.label_image) {
+    writeLabels(*set, &set->labels);
+  }
+  return set;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class RayTable;
+struct ForegroundMask;
+
+struct BlobTrackingOptions {
+  // Master switch for the backends; track() itself ignores it. Blobs come
+  // from the foreground mask, so background subtraction must be on too.
+  bool enabled = false;
+  // Connected foreground regions (8-connected) smaller than this, or without
+  // a single depth return, are not blobs.
+  int min_blob_pixels = 200;
+  int max_blobs = 16;
+  // A blob continues a track whose predicted centroid is within this many
+  // metres; pairs are matched greedily, closest first.
+  float max_match_distance_m = 0.4f;
+  // Unmatched tracks are kept this many frames, so a blob that merges with
+  // another or drops out briefly gets its id back.
+  int max_missed_frames = 10;
+  // Fill BlobSet::labels.
+  bool label_image = true;
+  // Shared pool threads to use, including the caller; 0 uses all of them.
+  int threads = 0;
+};
+
+struct Blob {
+  // Track id, stable while the blob is followed from frame to frame, and the
+  // number of frames it has been seen (1 for a new track).
+  std::uint32_t id = 0;
+  std::uint32_t age = 0;
+  // Mask pixels, and those of them with a depth return.
+  std::size_t pixels = 0;
+  std::size_t points = 0;
+  // Pixel bounds, [x0, x1) x [y0, y1), and the pixel centroid.
+  int x0 = 0;
+  int y0 = 0;
+  int x1 = 0;
+  int y1 = 0;
+  float center_u = 0.0f;
+  float center_v = 0.0f;
+  // Camera frame, metres: centroid and axis-aligned extent of the points.
+  float centroid[3] = {0.0f, 0.0f, 0.0f};
+  float min[3] = {0.0f, 0.0f, 0.0f};
+  float max[3] = {0.0f, 0.0f, 0.0f};
+  // Smoothed centroid motion, metres per frame.
+  float velocity[3] = {0.0f, 0.0f, 0.0f};
+};
+
+// Per-frame result. Blobs are listed largest first.
+struct BlobSet {
+  int width = 0;
+  int height = 0;
+  std::vector<Blob> blobs;
+  // Blob index + 1 per pixel, 0 elsewhere; empty without label_image.
+  std::vector<std::uint16_t> labels;
+
+  const Blob *find(std::uint32_t id) const {
+    for (const Blob &blob : blobs) {
+      if (blob.id == id) {
+        return &blob;
+      }
+    }
+    return nullptr;
+  }
+};
+
+struct BlobTrackingStats {
+  std::size_t runs = 0;
+  std::size_t regions = 0;
+  std::size_t matched = 0;
+  std::size_t new_tracks = 0;
+};
+
+// Connected components of a foreground mask, measured and tracked. Each
+// band of rows turns its rows into runs of
+// set bits, joins touching runs with union-find and accumulates every run's
+// moments (pixel and 3D sums, 3D bounds) while it walks the run's pixels.
+// The bands are then stitched along their seams and the run moments folded
+// into their regions, so the frame is read once. Blobs are associated with
+// the previous frame's tracks by a greedy nearest-centroid match against
+// constant-velocity predictions. Results are handed out like
+// DepthPyramidBuilder's.
+// setOptions() may be called from another thread than track().
+class BlobTracker {
+ public:
+  BlobTracker();
+  ~BlobTracker();
+  BlobTracker(const BlobTracker &) = delete;
+  BlobTracker &operator=(const BlobTracker &) = delete;
+
+  void setOptions(const BlobTrackingOptions &options);
+  BlobTrackingOptions options() const;
+  bool enabled() const;
+
+  // Blobs of |mask| with 3D moments from |depth| (millimetres) through
+  // |rays|; all three share the same size.
+  std::shared_ptr<const BlobSet> track(const ForegroundMask &mask, const std::uint16_t *depth, const RayTable &rays);
+  // Drops every track, e.g. after a cut in the stream.
+  void reset();
+
+  // Counts from the last track().
+  const BlobTrackingStats &stats() const { return stats_; }
+
+ private:
+  struct Run;
+  struct Band;
+  struct Region;
+  struct Track;
+  struct Match;
+
+  void labelBand(const ForegroundMask &mask, const std::uint16_t *depth, const RayTable &rays, int y0, int y1,
+                 Band *band) const;
+  void gatherRegions(const BlobTrackingOptions &options, BlobSet *set);
+  void associate(const BlobTrackingOptions &options, BlobSet *set);
+  void writeLabels(const BlobSet &set, std::vector<std::uint16_t> *labels);
+
+  mutable std::mutex mutex_;
+  BlobTrackingOptions options_;
+  BlobTrackingStats stats_;
+  bool reset_pending_ = false;
+  std::uint32_t next_id_ = 1;
+
+  std::vector<Band> bands_;
+  // Union-find over every band's runs, in raster order.
+  std::vector<std::uint32_t> parents_;
+  std::vector<Region> regions_;
+  std::vector<std::uint32_t> order_;
+  std::vector<Track> tracks_;
+  std::vector<Track> next_tracks_;
+  std::vector<Match> matches_;
+
+  std::vector<std::shared_ptr<BlobSet>> sets_;
+  // options.threads of the call in progress.
+  int max_threads_ = 0;
+};
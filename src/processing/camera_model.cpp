@@ -0,0 +1,292 @@
+#include "processing/camera_model.h"
+#include "core/trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char kRayFileMagic[4] = {'K', 'R', 'A', 'Y'};
+constexpr std::uint32_t kRayFileVersion = 1;
+constexpr int kUndistortIterations = 20;
+
+// 64 bytes so the planes stay 16-byte aligned in the mapping.
+struct RayFileHeader {
+  char magic[4];
+  std::uint32_t version;
+  std::int32_t width;
+  std::int32_t height;
+  float fx, fy, cx, cy;
+  float k1, k2, k3, p1, p2;
+  std::uint8_t reserved[12];
+};
+static_assert(sizeof(RayFileHeader) == 64, "ray file header must be packed");
+
+struct RayTableCache {
+  std::mutex mutex;
+  struct Entry {
+    std::string serial;
+    CameraIntrinsics intrinsics;
+    std::shared_ptr<const RayTable> table;
+  };
+  std::vector<Entry> entries;
+};
+
+RayTableCache &GlobalRayTableCache() {
+  static RayTableCache cache;
+  return cache;
+}
+
+RayFileHeader MakeRayFileHeader(const CameraIntrinsics &intrinsics) {
+  RayFileHeader header{};
+  std::memcpy(header.magic, kRayFileMagic, sizeof(kRayFileMagic));
+  header.version = kRayFileVersion;
+  header.width = intrinsics.width;
+  header.height = intrinsics.height;
+  header.fx = intrinsics.fx;
+  header.fy = intrinsics.fy;
+  header.cx = intrinsics.cx;
+  header.cy = intrinsics.cy;
+  header.k1 = intrinsics.distortion.k1;
+  header.k2 = intrinsics.distortion.k2;
+  header.k3 = intrinsics.distortion.k3;
+  header.p1 = intrinsics.distortion.p1;
+  header.p2 = intrinsics.distortion.p2;
+  return header;
+}
+
+std::string RayTableFileName(const std::string &serial, const CameraIntrinsics &intrinsics) {
+  std::string safe;
+  for (char c : serial) {
+    const bool keep = (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '-' ||
+                      c == '_';
+    safe.push_back(keep ? c : '_');
+  }
+  return safe + "-depth-" + std::to_string(intrinsics.width) + "x" + std::to_string(intrinsics.height) + ".rays";
+}
+
+// Scaled stream (e.g. a downsampled preview): keep the field of view.
+CameraIntrinsics ScaleIntrinsics(CameraIntrinsics intrinsics, int width, int height) {
+  if (width > 0 && height > 0 && (width != intrinsics.width || height != intrinsics.height)) {
+    const float sx = static_cast<float>(width) / static_cast<float>(intrinsics.width);
+    const float sy = static_cast<float>(height) / static_cast<float>(intrinsics.height);
+    intrinsics.fx *= sx;
+    intrinsics.cx *= sx;
+    intrinsics.fy *= sy;
+    intrinsics.cy *= sy;
+    intrinsics.width = width;
+    intrinsics.height = height;
+  }
+  return intrinsics;
+}
+
+}  // namespace
+
+CameraIntrinsics NominalDepthIntrinsics(KinectGeneration generation, int width, int height) {
+  if (generation == KinectGeneration::kV2) {
+    return ScaleIntrinsics({512, 424, 365.456f, 365.456f, 254.878f, 205.395f, {}}, width, height);
+  }
+  return ScaleIntrinsics({640, 480, 594.214f, 591.040f, 339.307f, 242.739f, {}}, width, height);
+}
+
+CameraIntrinsics NominalColorIntrinsics(KinectGeneration generation) {
+  if (generation == KinectGeneration::kV2) {
+    return {1920, 1080, 1081.372f, 1081.372f, 959.5f, 539.5f, {}};
+  }
+  return {640, 480, 529.215f, 525.563f, 328.942f, 267.481f, {}};
+}
+
+CameraIntrinsics ResolveDepthIntrinsics(const DeviceCalibration &calibration, KinectGeneration generation, int width,
+                                        int height) {
+  if (calibration.depth.valid() && calibration.depth.width == width && calibration.depth.height == height) {
+    return calibration.depth;
+  }
+  return NominalDepthIntrinsics(generation, width, height);
+}
+
+CameraIntrinsics ResolveColorIntrinsics(const DeviceCalibration &calibration, KinectGeneration generation, int width,
+                                        int height) {
+  if (calibration.color.valid()) {
+    return ScaleIntrinsics(calibration.color, width, height);
+  }
+  return ScaleIntrinsics(NominalColorIntrinsics(generation), width, height);
+}
+
+RayTable::RayTable(int width, int height) : width_(width), height_(height) {
+  storage_.resize(size() * 2);
+}
+
+RayTable RayTable::FromMapping(int width, int height, const float *planes, std::shared_ptr<const void> keep_alive) {
+  RayTable table;
+  table.width_ = width;
+  table.height_ = height;
+  table.mapped_ = planes;
+  table.mapping_ = std::move(keep_alive);
+  return table;
+}
+
+RayTable BuildRayTable(const CameraIntrinsics &intrinsics) {
+  if (!intrinsics.valid()) {
+    return RayTable();
+  }
+  RayTable table(intrinsics.width, intrinsics.height);
+  const float inv_fx = 1.0f / intrinsics.fx;
+  const float inv_fy = 1.0f / intrinsics.fy;
+  const LensDistortion &k = intrinsics.distortion;
+  const bool distorted = !k.isZero();
+
+  for (int v = 0; v < table.height(); ++v) {
+    const float yd = (static_cast<float>(v) - intrinsics.cy) * inv_fy;
+    float *row_x = table.mutableX() + static_cast<std::size_t>(v) * table.width();
+    float *row_y = table.mutableY() + static_cast<std::size_t>(v) * table.width();
+    for (int u = 0; u < table.width(); ++u) {
+      const float xd = (static_cast<float>(u) - intrinsics.cx) * inv_fx;
+      float x = xd;
+      float y = yd;
+      if (distorted) {
+        // Invert the libfreenect2 distortion model by fixed-point iteration;
+        // converges to well under a pixel for Kinect lenses.
+        for (int i = 0; i < kUndistortIterations; ++i) {
+          const float r2 = x * x + y * y;
+          const float radial = 1.0f + ((k.k3 * r2 + k.k2) * r2 + k.k1) * r2;
+          const float dx = k.p2 * (r2 + 2.0f * x * x) + k.p1 * 2.0f * x * y;
+          const float dy = k.p1 * (r2 + 2.0f * y * y) + k.p2 * 2.0f * x * y;
+          x = (xd - dx) / radial;
+          y = (yd - dy) / radial;
+        }
+      }
+      row_x[u] = x;
+      row_y[u] = y;
+    }
+  }
+  return table;
+}
+
+RayTable BuildRayTable(int width, int height, const std::function<void(int u, int v, float *rx, float *ry)> &ray) {
+  if (width <= 0 || height <= 0) {
+    return RayTable();
+  }
+  RayTable table(width, height);
+  for (int v = 0; v < height; ++v) {
+    for (int u = 0; u < width; ++u) {
+      const std::size_t index = static_cast<std::size_t>(v) * width + u;
+      ray(u, v, table.mutableX() + index, table.mutableY() + index);
+    }
+  }
+  return table;
+}
+
+std::shared_ptr<const RayTable> MapRayTableFile(const std::string &path, const CameraIntrinsics &intrinsics) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat info {};
+  const std::size_t planes = static_cast<std::size_t>(intrinsics.width) * intrinsics.height * 2 * sizeof(float);
+  const std::size_t expected = sizeof(RayFileHeader) + planes;
+  if (::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) != expected) {
+    ::close(fd);
+    return nullptr;
+  }
+  void *base = ::mmap(nullptr, expected, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED) {
+    return nullptr;
+  }
+  std::shared_ptr<const void> mapping(base, [expected](const void *ptr) {
+    ::munmap(const_cast<void *>(ptr), expected);
+  });
+
+  // Compare every field (not just the mode) so a recalibrated device does
+  // not pick up stale rays.
+  const RayFileHeader wanted = MakeRayFileHeader(intrinsics);
+  if (std::memcmp(base, &wanted, sizeof(wanted)) != 0) {
+    return nullptr;
+  }
+  const auto *planes_ptr =
+      reinterpret_cast<const float *>(static_cast<const std::uint8_t *>(base) + sizeof(RayFileHeader));
+  return std::make_shared<const RayTable>(
+      RayTable::FromMapping(intrinsics.width, intrinsics.height, planes_ptr, std::move(mapping)));
+}
+
+bool SaveRayTableFile(const std::string &path, const CameraIntrinsics &intrinsics, const RayTable &table) {
+  // Write then rename so a concurrent reader never maps a partial file.
+  const std::string temp = path + ".tmp" + std::to_string(static_cast<long>(::getpid()));
+  std::FILE *file = std::fopen(temp.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  const RayFileHeader header = MakeRayFileHeader(intrinsics);
+  const std::size_t plane_bytes = table.size() * sizeof(float);
+  bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+            std::fwrite(table.x(), 1, plane_bytes, file) == plane_bytes &&
+            std::fwrite(table.y(), 1, plane_bytes, file) == plane_bytes;
+  ok = std::fclose(file) == 0 && ok;
+  if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+    std::remove(temp.c_str());
+    return false;
+  }
+  return true;
+}
+
+std::string RayTableCacheDirectory() {
+  if (const char *dir = std::getenv("KINECT_CACHE_DIR"); dir != nullptr && dir[0] != '\0') {
+    return dir;
+  }
+  const char *home = std::getenv("HOME");
+#if defined(__APPLE__)
+  if (home != nullptr && home[0] != '\0') {
+    return std::string(home) + "/Library/Caches/macKinect";
+  }
+#else
+  if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr && xdg[0] != '\0') {
+    return std::string(xdg) + "/macKinect";
+  }
+  if (home != nullptr && home[0] != '\0') {
+    return std::string(home) + "/.cache/macKinect";
+  }
+#endif
+  return std::string();
+}
+
+std::shared_ptr<const RayTable> CachedRayTable(const CameraIntrinsics &intrinsics, const std::string &serial) {
+  RayTableCache &cache = GlobalRayTableCache();
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  for (const RayTableCache::Entry &entry : cache.entries) {
+    if (entry.serial == serial && entry.intrinsics == intrinsics) {
+      return entry.table;
+    }
+  }
+
+  std::shared_ptr<const RayTable> table;
+  std::string path;
+  const std::string dir = serial.empty() ? std::string() : RayTableCacheDirectory();
+  if (!dir.empty()) {
+    path = dir + "/" + RayTableFileName(serial, intrinsics);
+    KINECT_TRACE_SCOPE("camera.map_ray_table");
+    table = MapRayTableFile(path, intrinsics);
+  }
+  if (table == nullptr) {
+    KINECT_TRACE_SCOPE("camera.build_ray_table");
+    table = std::make_shared<const RayTable>(BuildRayTable(intrinsics));
+    if (!path.empty() && !table->empty()) {
+      std::error_code error;
+      std::filesystem::create_directories(dir, error);
+      if (!SaveRayTableFile(path, intrinsics, *table)) {
+        std::cerr << "[camera] could not write ray cache " << path << "\n";
+      }
+    }
+  }
+  cache.entries.push_back({serial, intrinsics, table});
+  return table;
+}
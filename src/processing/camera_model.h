@@ -0,0 +1,84 @@
+#pragma once
+
+#include "backends/backend.h"
+#include "core/calibration.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Factory calibration averages, used until a device reports its own.
+CameraIntrinsics NominalDepthIntrinsics(KinectGeneration generation, int width, int height);
+CameraIntrinsics NominalColorIntrinsics(KinectGeneration generation);
+
+// The device's depth model when it matches a width x height plane, else the
+// nominal one.
+CameraIntrinsics ResolveDepthIntrinsics(const DeviceCalibration &calibration, KinectGeneration generation, int width,
+                                        int height);
+// Same for the color camera; a device model for another resolution is scaled
+// to |width| x |height|.
+CameraIntrinsics ResolveColorIntrinsics(const DeviceCalibration &calibration, KinectGeneration generation, int width,
+                                        int height);
+
+// Per-pixel viewing rays normalised to z = 1: a pixel with depth d maps to
+// (x()[i] * d, y()[i] * d, d). Lens distortion is already undone. Stored as
+// two planes so back-projection can load four or eight pixels at a time.
+//
+// A table either owns its planes or views a memory-mapped cache file; copies
+// share the mapping.
+class RayTable {
+ public:
+  RayTable() = default;
+  RayTable(int width, int height);
+
+  // Views |planes| (x plane then y plane); |keep_alive| owns the memory.
+  static RayTable FromMapping(int width, int height, const float *planes, std::shared_ptr<const void> keep_alive);
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  std::size_t size() const { return static_cast<std::size_t>(width_) * static_cast<std::size_t>(height_); }
+  bool empty() const { return size() == 0; }
+  bool mapped() const { return mapped_ != nullptr; }
+
+  const float *x() const { return mapped_ != nullptr ? mapped_ : storage_.data(); }
+  const float *y() const { return x() + size(); }
+  // Owned tables only.
+  float *mutableX() { return storage_.data(); }
+  float *mutableY() { return storage_.data() + size(); }
+
+ private:
+  int width_ = 0;
+  int height_ = 0;
+  std::vector<float> storage_;
+  const float *mapped_ = nullptr;
+  std::shared_ptr<const void> mapping_;
+};
+
+RayTable BuildRayTable(const CameraIntrinsics &intrinsics);
+
+// Builds a table from an arbitrary per-pixel mapping, e.g. a driver's
+// camera-to-world function sampled once at a reference depth.
+RayTable BuildRayTable(int width, int height, const std::function<void(int u, int v, float *rx, float *ry)> &ray);
+
+// Returns the shared table for |intrinsics|, building it on first use. Tables
+// are immutable and live for the process, so callers may keep the pointer;
+// per-frame code should, since a lookup locks and scans the cache.
+//
+// With a |serial|, which callers pass only for a live device's own
+// calibration, tables are also persisted under RayTableCacheDirectory()
+// keyed by serial and mode, and later processes map the file instead of
+// recomputing the undistortion. A cache file whose stored calibration differs
+// is rebuilt.
+std::shared_ptr<const RayTable> CachedRayTable(const CameraIntrinsics &intrinsics,
+                                               const std::string &serial = std::string());
+
+// Ray cache files: a 64-byte header holding the full intrinsics, then the x
+// and y planes. Map returns null when the file is missing, truncated or was
+// built from different intrinsics.
+std::shared_ptr<const RayTable> MapRayTableFile(const std::string &path, const CameraIntrinsics &intrinsics);
+bool SaveRayTableFile(const std::string &path, const CameraIntrinsics &intrinsics, const RayTable &table);
+
+// $KINECT_CACHE_DIR, else ~/Library/Caches/macKinect (macOS) or
+// $XDG_CACHE_HOME/macKinect. Empty when no home directory is known.
+std::string RayTableCacheDirectory();
@@ -0,0 +1,410 @@
+#include "processing/depth_filter.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+#include "processing/simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace {
+
+// Rows (or columns) per thread-pool chunk; small enough to balance across
+// cores, large enough that the dispatch cost stays negligible.
+constexpr int kRowGrain = 16;
+constexpr int kColumnGrain = 64;
+
+inline void SortPair(Float4 *a, Float4 *b) {
+  const Float4 low = MinFloat4(*a, *b);
+  *b = MaxFloat4(*a, *b);
+  *a = low;
+}
+
+// Median of nine with the 19-exchange network from Paeth/Smith; the result
+// ends up in p[4].
+inline Float4 Median9(Float4 *p) {
+  SortPair(&p[1], &p[2]);
+  SortPair(&p[4], &p[5]);
+  SortPair(&p[7], &p[8]);
+  SortPair(&p[0], &p[1]);
+  SortPair(&p[3], &p[4]);
+  SortPair(&p[6], &p[7]);
+  SortPair(&p[1], &p[2]);
+  SortPair(&p[4], &p[5]);
+  SortPair(&p[7], &p[8]);
+  SortPair(&p[0], &p[3]);
+  SortPair(&p[5], &p[8]);
+  SortPair(&p[4], &p[7]);
+  SortPair(&p[3], &p[6]);
+  SortPair(&p[1], &p[4]);
+  SortPair(&p[2], &p[5]);
+  SortPair(&p[4], &p[7]);
+  SortPair(&p[4], &p[2]);
+  SortPair(&p[6], &p[4]);
+  SortPair(&p[4], &p[2]);
+  return p[4];
+}
+
+float ScalarMedian9(const float *row_above, const float *row, const float *row_below, int x) {
+  float values[9] = {row_above[x - 1], row_above[x], row_above[x + 1], row[x - 1],      row[x],
+                     row[x + 1],       row_below[x - 1], row_below[x], row_below[x + 1]};
+  std::nth_element(values, values + 4, values + 9);
+  return values[4];
+}
+
+inline Float4 AbsDiffFloat4(Float4 a, Float4 b) {
+  return MaxFloat4(SubFloat4(a, b), SubFloat4(b, a));
+}
+
+// One step of the recursive filter: |prev| pulls |cur| toward itself when
+// both have a return and they are closer than |delta|.
+inline float RecursiveStep(float cur, float prev, float alpha, float delta) {
+  if (cur > 0.0f && prev > 0.0f && std::fabs(cur - prev) < delta) {
+    return prev + alpha * (cur - prev);
+  }
+  return cur;
+}
+
+inline Float4 RecursiveStep4(Float4 cur, Float4 prev, Float4 alpha, Float4 delta) {
+  const Float4 zero = SplatFloat4(0.0f);
+  const Int4 mix = AndInt4(AndInt4(LessFloat4(zero, cur), LessFloat4(zero, prev)),
+                           LessFloat4(AbsDiffFloat4(cur, prev), delta));
+  return SelectFloat4(mix, AddFloat4(prev, MulFloat4(alpha, SubFloat4(cur, prev))), cur);
+}
+
+void FilterRowHorizontal(float *row, int width, float alpha, float delta) {
+  for (int x = 1; x < width; ++x) {
+    row[x] = RecursiveStep(row[x], row[x - 1], alpha, delta);
+  }
+  for (int x = width - 2; x >= 0; --x) {
+    row[x] = RecursiveStep(row[x], row[x + 1], alpha, delta);
+  }
+}
+
+// Both recursive passes over four consecutive rows starting at |rows|.
+void FilterRowsHorizontal(float *rows, int width, float alpha, float delta) {
+  float *r[4] = {rows, rows + width, rows + 2 * width, rows + 3 * width};
+  const Float4 alpha4 = SplatFloat4(alpha);
+  const Float4 delta4 = SplatFloat4(delta);
+  const int blocks_end = width / 4 * 4;
+
+  Float4 prev = SplatFloat4(0.0f);
+  for (int x = 0; x < blocks_end; x += 4) {
+    Float4 c0 = LoadFloat4(r[0] + x);
+    Float4 c1 = LoadFloat4(r[1] + x);
+    Float4 c2 = LoadFloat4(r[2] + x);
+    Float4 c3 = LoadFloat4(r[3] + x);
+    Transpose4(c0, c1, c2, c3);
+    c0 = RecursiveStep4(c0, prev, alpha4, delta4);
+    c1 = RecursiveStep4(c1, c0, alpha4, delta4);
+    c2 = RecursiveStep4(c2, c1, alpha4, delta4);
+    c3 = RecursiveStep4(c3, c2, alpha4, delta4);
+    prev = c3;
+    Transpose4(c0, c1, c2, c3);
+    StoreFloat4(r[0] + x, c0);
+    StoreFloat4(r[1] + x, c1);
+    StoreFloat4(r[2] + x, c2);
+    StoreFloat4(r[3] + x, c3);
+  }
+  for (int lane = 0; lane < 4; ++lane) {
+    float *row = r[lane];
+    for (int x = std::max(1, blocks_end); x < width; ++x) {
+      row[x] = RecursiveStep(row[x], row[x - 1], alpha, delta);
+    }
+    for (int x = width - 2; x >= blocks_end; --x) {
+      row[x] = RecursiveStep(row[x], row[x + 1], alpha, delta);
+    }
+  }
+
+  float edge[4] = {};
+  if (blocks_end < width) {
+    for (int lane = 0; lane < 4; ++lane) {
+      edge[lane] = r[lane][blocks_end];
+    }
+  }
+  prev = LoadFloat4(edge);
+  for (int x = blocks_end - 4; x >= 0; x -= 4) {
+    Float4 c0 = LoadFloat4(r[0] + x);
+    Float4 c1 = LoadFloat4(r[1] + x);
+    Float4 c2 = LoadFloat4(r[2] + x);
+    Float4 c3 = LoadFloat4(r[3] + x);
+    Transpose4(c0, c1, c2, c3);
+    c3 = RecursiveStep4(c3, prev, alpha4, delta4);
+    c2 = RecursiveStep4(c2, c3, alpha4, delta4);
+    c1 = RecursiveStep4(c1, c2, alpha4, delta4);
+    c0 = RecursiveStep4(c0, c1, alpha4, delta4);
+    prev = c0;
+    Transpose4(c0, c1, c2, c3);
+    StoreFloat4(r[0] + x, c0);
+    StoreFloat4(r[1] + x, c1);
+    StoreFloat4(r[2] + x, c2);
+    StoreFloat4(r[3] + x, c3);
+  }
+}
+
+}  // namespace
+
+const char *DepthFilterStageLabel(DepthFilterStage stage) {
+  switch (stage) {
+    case DepthFilterStage::kMedian:
+      return "median";
+    case DepthFilterStage::kSpatial:
+      return "spatial";
+    case DepthFilterStage::kTemporal:
+      return "temporal";
+    case DepthFilterStage::kHoleFill:
+      return "hole_fill";
+  }
+  return "unknown";
+}
+
+DepthFilterChain::DepthFilterChain() = default;
+DepthFilterChain::~DepthFilterChain() = default;
+
+void DepthFilterChain::setOptions(const DepthFilterOptions &options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (options.enabled && !options_.enabled) {
+    // Stale history would otherwise leak into the first filtered frame.
+    width_ = 0;
+    height_ = 0;
+  }
+  options_ = options;
+}
+
+DepthFilterOptions DepthFilterChain::options() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return options_;
+}
+
+bool DepthFilterChain::enabled() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return options_.enabled;
+}
+
+void DepthFilterChain::reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  width_ = 0;
+  height_ = 0;
+}
+
+StageSnapshot DepthFilterChain::stageSnapshot(DepthFilterStage stage) const {
+  return stages_[static_cast<std::size_t>(stage)].snapshot();
+}
+
+void DepthFilterChain::apply(std::uint16_t *depth, int width, int height) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const DepthFilterOptions &options = options_;
+  if (!options.enabled || depth == nullptr || width <= 0 || height <= 0) {
+    return;
+  }
+  KINECT_TRACE_SCOPE("depth_filter.apply");
+  const std::size_t count = static_cast<std::size_t>(width) * height;
+  if (width != width_ || height != height_) {
+    width_ = width;
+    height_ = height;
+    work_.assign(count, 0.0f);
+    scratch_.assign(count, 0.0f);
+    history_.assign(count, 0.0f);
+    // Past the persistence window, so nothing is held on the first frame.
+    age_.assign(count, std::max(0, options.temporal_persistence));
+  }
+
+  SharedThreadPool().parallelFor(height, kRowGrain, options_.threads, [&](int begin, int end) {
+    const std::size_t first = static_cast<std::size_t>(begin) * width;
+    const std::size_t last = static_cast<std::size_t>(end) * width;
+    std::size_t i = first;
+    for (; i + 4 <= last; i += 4) {
+      StoreFloat4(work_.data() + i, IntToFloat4(LoadU16AsInt4(depth + i)));
+    }
+    for (; i < last; ++i) {
+      work_[i] = static_cast<float>(depth[i]);
+    }
+  });
+
+  if (options.median && width >= 3 && height >= 3) {
+    KINECT_TRACE_SCOPE("depth_filter.median");
+    ScopedStageTimer timer(stages_[static_cast<std::size_t>(DepthFilterStage::kMedian)]);
+    runMedian(width, height);
+  }
+  if (options.spatial) {
+    KINECT_TRACE_SCOPE("depth_filter.spatial");
+    ScopedStageTimer timer(stages_[static_cast<std::size_t>(DepthFilterStage::kSpatial)]);
+    runSpatial(width, height, options);
+  }
+  if (options.temporal) {
+    KINECT_TRACE_SCOPE("depth_filter.temporal");
+    ScopedStageTimer timer(stages_[static_cast<std::size_t>(DepthFilterStage::kTemporal)]);
+    runTemporal(count, options);
+  }
+  if (options.hole_fill && options.hole_fill_max_width > 0) {
+    KINECT_TRACE_SCOPE("depth_filter.hole_fill");
+    ScopedStageTimer timer(stages_[static_cast<std::size_t>(DepthFilterStage::kHoleFill)]);
+    runHoleFill(width, height, options.hole_fill_max_width);
+  }
+
+  SharedThreadPool().parallelFor(height, kRowGrain, options_.threads, [&](int begin, int end) {
+    const std::size_t first = static_cast<std::size_t>(begin) * width;
+    const std::size_t last = static_cast<std::size_t>(end) * width;
+    const Float4 half = SplatFloat4(0.5f);
+    std::size_t i = first;
+    for (; i + 4 <= last; i += 4) {
+      StoreInt4AsU16(depth + i, FloatToInt4(AddFloat4(LoadFloat4(work_.data() + i), half)));
+    }
+    for (; i < last; ++i) {
+      depth[i] = static_cast<std::uint16_t>(std::min(65535.0f, work_[i] + 0.5f));
+    }
+  });
+}
+
+void DepthFilterChain::runMedian(int width, int height) {
+  const float *in = work_.data();
+  float *out = scratch_.data();
+  SharedThreadPool().parallelFor(height, kRowGrain, options_.threads, [&](int begin, int end) {
+    for (int y = begin; y < end; ++y) {
+      const std::size_t offset = static_cast<std::size_t>(y) * width;
+      if (y == 0 || y == height - 1) {
+        std::copy(in + offset, in + offset + width, out + offset);
+        continue;
+      }
+      const float *above = in + offset - width;
+      const float *row = in + offset;
+      const float *below = in + offset + width;
+      float *dst = out + offset;
+      dst[0] = row[0];
+      dst[width - 1] = row[width - 1];
+      int x = 1;
+      for (; x + 4 <= width - 1; x += 4) {
+        Float4 p[9] = {LoadFloat4(above + x - 1), LoadFloat4(above + x), LoadFloat4(above + x + 1),
+                       LoadFloat4(row + x - 1),   LoadFloat4(row + x),   LoadFloat4(row + x + 1),
+                       LoadFloat4(below + x - 1), LoadFloat4(below + x), LoadFloat4(below + x + 1)};
+        StoreFloat4(dst + x, Median9(p));
+      }
+      for (; x < width - 1; ++x) {
+        dst[x] = ScalarMedian9(above, row, below, x);
+      }
+    }
+  });
+  work_.swap(scratch_);
+}
+
+void DepthFilterChain::runSpatial(int width, int height, const DepthFilterOptions &options) {
+  const float alpha = std::max(0.0f, std::min(1.0f, options.spatial_alpha));
+  const float delta = options.spatial_delta_mm;
+  float *data = work_.data();
+  for (int iteration = 0; iteration < std::max(1, options.spatial_iterations); ++iteration) {
+    // Along rows the recursion runs pixel to pixel, so four rows advance
+    // together: 4x4 blocks are transposed so each lane carries one row.
+    const int row_groups = height / 4;
+    SharedThreadPool().parallelFor(row_groups, kRowGrain / 4, options_.threads, [&](int begin, int end) {
+      for (int group = begin; group < end; ++group) {
+        FilterRowsHorizontal(data + static_cast<std::size_t>(group) * 4 * width, width, alpha, delta);
+      }
+    });
+    for (int y = row_groups * 4; y < height; ++y) {
+      FilterRowHorizontal(data + static_cast<std::size_t>(y) * width, width, alpha, delta);
+    }
+    // Down columns, four adjacent columns share every step; each chunk walks
+    // its columns row by row so memory is still read in order.
+    SharedThreadPool().parallelFor(width, kColumnGrain, options_.threads, [&](int begin, int end) {
+      const Float4 alpha4 = SplatFloat4(alpha);
+      const Float4 delta4 = SplatFloat4(delta);
+      const int simd_end = begin + (end - begin) / 4 * 4;
+      for (int y = 1; y < height; ++y) {
+        float *row = data + static_cast<std::size_t>(y) * width;
+        const float *prev = row - width;
+        int x = begin;
+        for (; x < simd_end; x += 4) {
+          StoreFloat4(row + x, RecursiveStep4(LoadFloat4(row + x), LoadFloat4(prev + x), alpha4, delta4));
+        }
+        for (; x < end; ++x) {
+          row[x] = RecursiveStep(row[x], prev[x], alpha, delta);
+        }
+      }
+      for (int y = height - 2; y >= 0; --y) {
+        float *row = data + static_cast<std::size_t>(y) * width;
+        const float *next = row + width;
+        int x = begin;
+        for (; x < simd_end; x += 4) {
+          StoreFloat4(row + x, RecursiveStep4(LoadFloat4(row + x), LoadFloat4(next + x), alpha4, delta4));
+        }
+        for (; x < end; ++x) {
+          row[x] = RecursiveStep(row[x], next[x], alpha, delta);
+        }
+      }
+    });
+  }
+}
+
+void DepthFilterChain::runTemporal(std::size_t count, const DepthFilterOptions &options) {
+  const float alpha = std::max(0.0f, std::min(1.0f, options.temporal_alpha));
+  const float delta = options.temporal_delta_mm;
+  const std::int32_t persistence = std::max(0, options.temporal_persistence);
+  float *data = work_.data();
+  float *history = history_.data();
+  std::int32_t *age = age_.data();
+  const int blocks = static_cast<int>((count + 1023) / 1024);
+  SharedThreadPool().parallelFor(blocks, 4, options_.threads, [&](int begin, int end) {
+    const std::size_t first = static_cast<std::size_t>(begin) * 1024;
+    const std::size_t last = std::min(count, static_cast<std::size_t>(end) * 1024);
+    const Float4 zero = SplatFloat4(0.0f);
+    const Float4 alpha4 = SplatFloat4(alpha);
+    const Float4 delta4 = SplatFloat4(delta);
+    const Int4 one = SplatInt4(1);
+    const Int4 window = SplatInt4(persistence);
+    std::size_t i = first;
+    for (; i + 4 <= last; i += 4) {
+      const Float4 cur = LoadFloat4(data + i);
+      const Float4 prev = LoadFloat4(history + i);
+      const Int4 frames_missing = LoadInt4(age + i);
+      const Int4 valid = LessFloat4(zero, cur);
+      const Float4 smoothed = RecursiveStep4(cur, prev, alpha4, delta4);
+      const Int4 hold = AndInt4(LessFloat4(zero, prev), LessInt4(frames_missing, window));
+      const Float4 out = SelectFloat4(valid, smoothed, SelectFloat4(hold, prev, zero));
+      StoreFloat4(data + i, out);
+      StoreFloat4(history + i, out);
+      // Saturates at the window so long-dead pixels never overflow.
+      const Int4 aged = SelectInt4(LessInt4(frames_missing, window), AddInt4(frames_missing, one), frames_missing);
+      StoreInt4(age + i, SelectInt4(valid, SplatInt4(0), aged));
+    }
+    for (; i < last; ++i) {
+      const float cur = data[i];
+      float out = 0.0f;
+      if (cur > 0.0f) {
+        out = RecursiveStep(cur, history[i], alpha, delta);
+        age[i] = 0;
+      } else {
+        out = history[i] > 0.0f && age[i] < persistence ? history[i] : 0.0f;
+        age[i] = std::min(persistence, age[i] + 1);
+      }
+      data[i] = out;
+      history[i] = out;
+    }
+  });
+}
+
+void DepthFilterChain::runHoleFill(int width, int height, int max_width) {
+  float *data = work_.data();
+  SharedThreadPool().parallelFor(height, kRowGrain, options_.threads, [&](int begin, int end) {
+    for (int y = begin; y < end; ++y) {
+      float *row = data + static_cast<std::size_t>(y) * width;
+      int x = 0;
+      while (x < width) {
+        if (row[x] > 0.0f) {
+          ++x;
+          continue;
+        }
+        const int start = x;
+        while (x < width && row[x] <= 0.0f) {
+          ++x;
+        }
+        // Runs touching the border have only one side to trust.
+        if (start == 0 || x == width || x - start > max_width) {
+          continue;
+        }
+        const float fill = std::max(row[start - 1], row[x]);
+        std::fill(row + start, row + x, fill);
+      }
+    }
+  });
+}
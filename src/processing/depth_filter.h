@@ -0,0 +1,103 @@
+#pragma once
+
+#include "core/telemetry.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Denoising chain for depth planes (millimetres, 0 = no return). The stages
+// run in this order, and each one can be turned off:
+//   median     3x3 median that removes isolated speckle;
+//   spatial    edge-preserving domain-transform smoothing: a recursive
+//              exponential filter along rows and then columns that stops at
+//              depth steps larger than |spatial_delta_mm|;
+//   temporal   exponential smoothing against the previous output, with a
+//              persistence window that holds a pixel's last value through
+//              short dropouts;
+//   hole fill  closes short horizontal runs of missing depth from the
+//              farther neighbour, so foreground edges do not grow.
+enum class DepthFilterStage {
+  kMedian = 0,
+  kSpatial = 1,
+  kTemporal = 2,
+  kHoleFill = 3,
+};
+constexpr std::size_t kDepthFilterStageCount = 4;
+
+const char *DepthFilterStageLabel(DepthFilterStage stage);
+
+struct DepthFilterOptions {
+  // Master switch; the per-stage flags only matter when this is set.
+  bool enabled = false;
+
+  bool median = true;
+
+  bool spatial = true;
+  // Weight of the current pixel in the recursive filter (1 = no smoothing).
+  float spatial_alpha = 0.5f;
+  // Neighbours further apart than this are an edge and are not mixed.
+  float spatial_delta_mm = 20.0f;
+  int spatial_iterations = 1;
+
+  bool temporal = true;
+  // Weight of the new frame (1 = no smoothing).
+  float temporal_alpha = 0.4f;
+  // Larger frame-to-frame changes are motion and replace the history.
+  float temporal_delta_mm = 20.0f;
+  // A missing pixel keeps its last value for up to this many frames.
+  int temporal_persistence = 3;
+
+  bool hole_fill = true;
+  // Longest run of missing pixels in a row that is filled.
+  int hole_fill_max_width = 8;
+
+  // Shared pool threads to use, including the caller; 0 uses all of them.
+  int threads = 0;
+};
+
+// Runs the enabled stages in place, band by band. The median, spatial and
+// temporal stages step four lanes at a time with processing/simd.h (the
+// spatial row pass carries four rows, one per lane); hole fill is a scalar
+// run scan. setOptions() may be called from another thread than apply().
+class DepthFilterChain {
+ public:
+  DepthFilterChain();
+  ~DepthFilterChain();
+  DepthFilterChain(const DepthFilterChain &) = delete;
+  DepthFilterChain &operator=(const DepthFilterChain &) = delete;
+
+  void setOptions(const DepthFilterOptions &options);
+  DepthFilterOptions options() const;
+  bool enabled() const;
+
+  // Filters |depth| (width x height). The temporal history restarts when the
+  // size changes or after reset().
+  void apply(std::uint16_t *depth, int width, int height);
+  void reset();
+
+  // Per-stage timing of apply() calls.
+  StageSnapshot stageSnapshot(DepthFilterStage stage) const;
+
+ private:
+  void runMedian(int width, int height);
+  void runSpatial(int width, int height, const DepthFilterOptions &options);
+  void runTemporal(std::size_t count, const DepthFilterOptions &options);
+  void runHoleFill(int width, int height, int max_width);
+
+  mutable std::mutex mutex_;
+  DepthFilterOptions options_;
+
+  int width_ = 0;
+  int height_ = 0;
+  std::vector<float> work_;
+  std::vector<float> scratch_;
+  // Previous output and frames since each pixel last had a return.
+  std::vector<float> history_;
+  std::vector<std::int32_t> age_;
+
+  std::array<StageTelemetry, kDepthFilterStageCount> stages_;
+};
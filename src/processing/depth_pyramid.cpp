@@ -0,0 +1,259 @@
+#include "processing/depth_pyramid.h"
+
+#include "core/trace.h"
+#include "processing/simd.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr int kMinLevelSize = 8;
+constexpr int kMaxLevels = 12;
+// Pyramids kept for reuse; frames held longer than this by consumers get a
+// fresh allocation instead.
+constexpr std::size_t kBuilderPoolSize = 4;
+
+inline Int4 MinInt4(Int4 a, Int4 b) {
+  return SelectInt4(LessInt4(a, b), a, b);
+}
+
+inline Int4 MaxInt4(Int4 a, Int4 b) {
+  return SelectInt4(GreaterInt4(a, b), a, b);
+}
+
+struct LevelView {
+  const std::uint16_t *mean;
+  const std::uint16_t *min;
+  const std::uint16_t *max;
+  int width;
+  int height;
+};
+
+// Summarises the 2x2 children of output cell (x, y); an odd last row or
+// column repeats itself, which leaves mean, min and max unchanged.
+void ReduceCell(const LevelView &src, int x, int y, std::uint16_t *mean, std::uint16_t *min, std::uint16_t *max,
+                bool *valid) {
+  const int xs[2] = {2 * x, std::min(2 * x + 1, src.width - 1)};
+  const int ys[2] = {2 * y, std::min(2 * y + 1, src.height - 1)};
+  std::uint32_t sum = 0;
+  std::uint32_t count = 0;
+  std::uint16_t low = 0xFFFF;
+  std::uint16_t high = 0;
+  for (int row : ys) {
+    for (int column : xs) {
+      const std::size_t i = static_cast<std::size_t>(row) * src.width + column;
+      if (src.mean[i] == 0) {
+        continue;
+      }
+      sum += src.mean[i];
+      ++count;
+      low = std::min(low, src.min[i]);
+      high = std::max(high, src.max[i]);
+    }
+  }
+  *valid = count > 0;
+  *mean = count > 0 ? static_cast<std::uint16_t>((sum + count / 2) / count) : 0;
+  *min = count > 0 ? low : 0;
+  *max = high;
+}
+
+void ReduceLevel(const LevelView &src, int width, int height, std::uint16_t *mean, std::uint16_t *min,
+                 std::uint16_t *max, std::uint64_t *valid, int mask_stride) {
+  const Int4 low_half = SplatInt4(0xFFFF);
+  const Int4 zero = SplatInt4(0);
+  const Float4 one = SplatFloat4(1.0f);
+  const Float4 half = SplatFloat4(0.5f);
+  for (int y = 0; y < height; ++y) {
+    const std::size_t row_a = static_cast<std::size_t>(2 * y) * src.width;
+    const std::size_t row_b = static_cast<std::size_t>(std::min(2 * y + 1, src.height - 1)) * src.width;
+    std::uint16_t *mean_row = mean + static_cast<std::size_t>(y) * width;
+    std::uint16_t *min_row = min + static_cast<std::size_t>(y) * width;
+    std::uint16_t *max_row = max + static_cast<std::size_t>(y) * width;
+    std::uint64_t *mask_row = valid + static_cast<std::size_t>(y) * mask_stride;
+    std::fill(mask_row, mask_row + mask_stride, 0);
+
+    // Four output cells per step: eight children from each of two rows,
+    // loaded as even/odd pairs in one 32-bit lane.
+    int x = 0;
+    for (; 2 * x + 8 <= src.width && x + 4 <= width; x += 4) {
+      const std::size_t a = row_a + 2 * static_cast<std::size_t>(x);
+      const std::size_t b = row_b + 2 * static_cast<std::size_t>(x);
+      const Int4 mean_a = LoadU16PairsAsInt4(src.mean + a);
+      const Int4 mean_b = LoadU16PairsAsInt4(src.mean + b);
+      const Int4 m[4] = {AndInt4(mean_a, low_half), ShiftRightLogicalInt4<16>(mean_a), AndInt4(mean_b, low_half),
+                         ShiftRightLogicalInt4<16>(mean_b)};
+      const Int4 min_a = LoadU16PairsAsInt4(src.min + a);
+      const Int4 min_b = LoadU16PairsAsInt4(src.min + b);
+      const Int4 lo[4] = {AndInt4(min_a, low_half), ShiftRightLogicalInt4<16>(min_a), AndInt4(min_b, low_half),
+                          ShiftRightLogicalInt4<16>(min_b)};
+      const Int4 max_a = LoadU16PairsAsInt4(src.max + a);
+      const Int4 max_b = LoadU16PairsAsInt4(src.max + b);
+
+      Int4 sum = zero;
+      Int4 negative_count = zero;
+      Int4 nearest = low_half;
+      for (int k = 0; k < 4; ++k) {
+        const Int4 child_valid = GreaterInt4(m[k], zero);
+        sum = AddInt4(sum, m[k]);
+        negative_count = AddInt4(negative_count, child_valid);
+        nearest = MinInt4(nearest, SelectInt4(child_valid, lo[k], low_half));
+      }
+      const Int4 farthest =
+          MaxInt4(MaxInt4(AndInt4(max_a, low_half), ShiftRightLogicalInt4<16>(max_a)),
+                  MaxInt4(AndInt4(max_b, low_half), ShiftRightLogicalInt4<16>(max_b)));
+      const Int4 any = LessInt4(negative_count, zero);
+      const Float4 count = MaxFloat4(SubFloat4(SplatFloat4(0.0f), IntToFloat4(negative_count)), one);
+      const Int4 average = FloatToInt4(AddFloat4(DivFloat4(IntToFloat4(sum), count), half));
+
+      StoreInt4AsU16(mean_row + x, average);
+      StoreInt4AsU16(min_row + x, SelectInt4(any, nearest, zero));
+      StoreInt4AsU16(max_row + x, farthest);
+      mask_row[x >> 6] |= static_cast<std::uint64_t>(MaskBits4(any)) << (x & 63);
+    }
+    for (; x < width; ++x) {
+      bool cell_valid = false;
+      ReduceCell(src, x, y, mean_row + x, min_row + x, max_row + x, &cell_valid);
+      if (cell_valid) {
+        mask_row[x >> 6] |= std::uint64_t{1} << (x & 63);
+      }
+    }
+  }
+}
+
+void BuildLevelZeroMask(const std::uint16_t *depth, int width, int height, std::uint64_t *valid, int mask_stride) {
+  const Int4 zero = SplatInt4(0);
+  for (int y = 0; y < height; ++y) {
+    const std::uint16_t *row = depth + static_cast<std::size_t>(y) * width;
+    std::uint64_t *mask_row = valid + static_cast<std::size_t>(y) * mask_stride;
+    std::fill(mask_row, mask_row + mask_stride, 0);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+      mask_row[x >> 6] |= static_cast<std::uint64_t>(MaskBits4(GreaterInt4(LoadU16AsInt4(row + x), zero)))
+                          << (x & 63);
+    }
+    for (; x < width; ++x) {
+      if (row[x] != 0) {
+        mask_row[x >> 6] |= std::uint64_t{1} << (x & 63);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+void DepthPyramid::build(const std::uint16_t *depth, int width, int height, int max_levels) {
+  KINECT_TRACE_SCOPE("depth_pyramid.build");
+  if (depth == nullptr || width <= 0 || height <= 0) {
+    levels_.clear();
+    return;
+  }
+  const int limit = max_levels > 0 ? std::min(max_levels, kMaxLevels) : kMaxLevels;
+  int count = 1;
+  for (int w = width, h = height; count < limit;) {
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+    if (max_levels <= 0 && (w < kMinLevelSize || h < kMinLevelSize)) {
+      break;
+    }
+    ++count;
+  }
+  levels_.resize(static_cast<std::size_t>(count));
+
+  DepthPyramidLevel &base = levels_[0];
+  base.width_ = width;
+  base.height_ = height;
+  base.mask_stride_ = (width + 63) / 64;
+  const std::size_t pixels = static_cast<std::size_t>(width) * height;
+  base.mean_.resize(pixels);
+  std::memcpy(base.mean_.data(), depth, pixels * sizeof(std::uint16_t));
+  base.min_.clear();
+  base.max_.clear();
+  base.valid_.resize(static_cast<std::size_t>(base.mask_stride_) * height);
+  BuildLevelZeroMask(depth, width, height, base.valid_.data(), base.mask_stride_);
+
+  for (std::size_t i = 1; i < levels_.size(); ++i) {
+    const DepthPyramidLevel &below = levels_[i - 1];
+    DepthPyramidLevel &level = levels_[i];
+    level.width_ = (below.width_ + 1) / 2;
+    level.height_ = (below.height_ + 1) / 2;
+    level.mask_stride_ = (level.width_ + 63) / 64;
+    const std::size_t cells = static_cast<std::size_t>(level.width_) * level.height_;
+    level.mean_.resize(cells);
+    level.min_.resize(cells);
+    level.max_.resize(cells);
+    level.valid_.resize(static_cast<std::size_t>(level.mask_stride_) * level.height_);
+    const LevelView src{below.mean(), below.min(), below.max(), below.width_, below.height_};
+    ReduceLevel(src, level.width_, level.height_, level.mean_.data(), level.min_.data(), level.max_.data(),
+                level.valid_.data(), level.mask_stride_);
+  }
+}
+
+int DepthPyramid::levelForWidth(int width) const {
+  for (int i = 0; i < levels(); ++i) {
+    if (levels_[static_cast<std::size_t>(i)].width() <= width) {
+      return i;
+    }
+  }
+  return levels() - 1;
+}
+
+DepthRange DepthPyramid::range(int x0, int y0, int x1, int y1, int max_cells) const {
+  DepthRange result;
+  if (levels_.empty()) {
+    return result;
+  }
+  x0 = std::max(0, x0);
+  y0 = std::max(0, y0);
+  x1 = std::min(levels_[0].width(), x1);
+  y1 = std::min(levels_[0].height(), y1);
+  if (x0 >= x1 || y0 >= y1) {
+    return result;
+  }
+  int index = 0;
+  while (index + 1 < levels()) {
+    const int cells_x = ((x1 - 1) >> index) - (x0 >> index) + 1;
+    const int cells_y = ((y1 - 1) >> index) - (y0 >> index) + 1;
+    if (cells_x * cells_y <= std::max(1, max_cells)) {
+      break;
+    }
+    ++index;
+  }
+  const DepthPyramidLevel &level = levels_[static_cast<std::size_t>(index)];
+  std::uint16_t low = 0xFFFF;
+  std::uint16_t high = 0;
+  for (int y = y0 >> index; y <= (y1 - 1) >> index; ++y) {
+    for (int x = x0 >> index; x <= (x1 - 1) >> index; ++x) {
+      if (!level.valid(x, y)) {
+        continue;
+      }
+      const std::size_t i = static_cast<std::size_t>(y) * level.width() + x;
+      low = std::min(low, level.min()[i]);
+      high = std::max(high, level.max()[i]);
+      result.any_valid = true;
+    }
+  }
+  if (result.any_valid) {
+    result.min_mm = low;
+    result.max_mm = high;
+  }
+  return result;
+}
+
+std::shared_ptr<const DepthPyramid> DepthPyramidBuilder::build(const std::uint16_t *depth, int width, int height) {
+  std::shared_ptr<DepthPyramid> pyramid;
+  for (const auto &candidate : pool_) {
+    if (candidate.use_count() == 1) {
+      pyramid = candidate;
+      break;
+    }
+  }
+  if (pyramid == nullptr) {
+    pyramid = std::make_shared<DepthPyramid>();
+    if (pool_.size() < kBuilderPoolSize) {
+      pool_.push_back(pyramid);
+    }
+  }
+  pyramid->build(depth, width, height);
+  return pyramid;
+}
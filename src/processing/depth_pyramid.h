@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// One level of a depth pyramid. Level 0 is the depth plane itself; every
+// cell of level n + 1 summarises the (up to) 2x2 cells below it. Depth is in
+// millimetres with 0 meaning no return.
+class DepthPyramidLevel {
+ public:
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  // Mean of the valid cells one level down (the depth itself on level 0);
+  // usable directly as a downscaled preview.
+  const std::uint16_t *mean() const { return mean_.data(); }
+  // Nearest and farthest return anywhere under each cell, 0 when none.
+  const std::uint16_t *min() const { return min_.empty() ? mean_.data() : min_.data(); }
+  const std::uint16_t *max() const { return max_.empty() ? mean_.data() : max_.data(); }
+
+  // One bit per cell, set when anything under it has a return. Rows start on
+  // a 64-bit word boundary, |maskStride()| words apart.
+  const std::uint64_t *validMask() const { return valid_.data(); }
+  int maskStride() const { return mask_stride_; }
+  bool valid(int x, int y) const {
+    return (valid_[static_cast<std::size_t>(y) * mask_stride_ + (x >> 6)] >> (x & 63)) & 1u;
+  }
+
+ private:
+  friend class DepthPyramid;
+
+  int width_ = 0;
+  int height_ = 0;
+  int mask_stride_ = 0;
+  std::vector<std::uint16_t> mean_;
+  std::vector<std::uint16_t> min_;
+  std::vector<std::uint16_t> max_;
+  std::vector<std::uint64_t> valid_;
+};
+
+// Depth range over a region, as bounds: min/max come from whole pyramid
+// cells, so they may include a few pixels just outside the region.
+struct DepthRange {
+  std::uint16_t min_mm = 0;
+  std::uint16_t max_mm = 0;
+  bool any_valid = false;
+};
+
+class DepthPyramid {
+ public:
+  // Rebuilds every level from |depth|, reusing the buffers of the previous
+  // frame. |max_levels| = 0 stops once a level is smaller than 8 cells on a
+  // side.
+  void build(const std::uint16_t *depth, int width, int height, int max_levels = 0);
+
+  int levels() const { return static_cast<int>(levels_.size()); }
+  const DepthPyramidLevel &level(int index) const { return levels_[static_cast<std::size_t>(index)]; }
+  // Finest level whose width is at most |width|, for previews.
+  int levelForWidth(int width) const;
+
+  // Bounds on the depth inside the level-0 rectangle [x0, x1) x [y0, y1),
+  // answered from the finest level where it spans at most |max_cells| cells.
+  DepthRange range(int x0, int y0, int x1, int y1, int max_cells = 64) const;
+
+ private:
+  std::vector<DepthPyramidLevel> levels_;
+};
+
+// Hands out a pyramid per frame. A pyramid from an earlier frame is rebuilt
+// in place once no consumer holds it any more, so steady-state streaming
+// does not allocate.
+class DepthPyramidBuilder {
+ public:
+  std::shared_ptr<const DepthPyramid> build(const std::uint16_t *depth, int width, int height);
+
+ private:
+  std::vector<std::shared_ptr<DepthPyramid>> pool_;
+};
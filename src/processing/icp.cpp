@@ -0,0 +1,437 @@
+#include "processing/icp.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+#include "processing/simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Upper triangle of J^T J, then J^T r, r^2, the inlier count and the number
+// of source points considered.
+constexpr int kJacobian = 6;
+constexpr int kHessianTerms = kJacobian * (kJacobian + 1) / 2;
+constexpr int kResidualSum = kHessianTerms + kJacobian;
+constexpr int kInlierSum = kResidualSum + 1;
+constexpr int kSourceSum = kInlierSum + 1;
+constexpr int kSums = kSourceSum + 1;
+constexpr int kTileRows = 8;
+constexpr float kPi = 3.14159265358979f;
+
+// Exact rotation for the small-angle vector |w| (Rodrigues).
+void RotationFromVector(const double w[3], double r[9]) {
+  const double theta = std::sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+  // sin(theta) / theta and (1 - cos(theta)) / theta^2 by series near 0.
+  const double a = theta < 1e-6 ? 1.0 - theta * theta / 6.0 : std::sin(theta) / theta;
+  const double b = theta < 1e-6 ? 0.5 - theta * theta / 24.0 : (1.0 - std::cos(theta)) / (theta * theta);
+  r[0] = 1.0 - b * (w[1] * w[1] + w[2] * w[2]);
+  r[1] = -a * w[2] + b * w[0] * w[1];
+  r[2] = a * w[1] + b * w[0] * w[2];
+  r[3] = a * w[2] + b * w[0] * w[1];
+  r[4] = 1.0 - b * (w[0] * w[0] + w[2] * w[2]);
+  r[5] = -a * w[0] + b * w[1] * w[2];
+  r[6] = -a * w[1] + b * w[0] * w[2];
+  r[7] = a * w[0] + b * w[1] * w[2];
+  r[8] = 1.0 - b * (w[0] * w[0] + w[1] * w[1]);
+}
+
+// Solves the symmetric positive definite system A x = b by Cholesky; false
+// when A is singular, e.g. a single plane leaves motion along it free.
+bool SolveNormalEquations(const double *sums, double x[kJacobian]) {
+  double a[kJacobian][kJacobian];
+  for (int i = 0, k = 0; i < kJacobian; ++i) {
+    for (int j = i; j < kJacobian; ++j, ++k) {
+      a[i][j] = sums[k];
+      a[j][i] = sums[k];
+    }
+  }
+  double l[kJacobian][kJacobian] = {};
+  for (int j = 0; j < kJacobian; ++j) {
+    double diagonal = a[j][j];
+    for (int k = 0; k < j; ++k) {
+      diagonal -= l[j][k] * l[j][k];
+    }
+    if (!(diagonal > 1e-12 * std::max(1.0, a[j][j]))) {
+      return false;
+    }
+    l[j][j] = std::sqrt(diagonal);
+    for (int i = j + 1; i < kJacobian; ++i) {
+      double value = a[i][j];
+      for (int k = 0; k < j; ++k) {
+        value -= l[i][k] * l[j][k];
+      }
+      l[i][j] = value / l[j][j];
+    }
+  }
+  // L y = -J^T r, then L^T x = y.
+  double y[kJacobian];
+  for (int i = 0; i < kJacobian; ++i) {
+    double value = -sums[kHessianTerms + i];
+    for (int k = 0; k < i; ++k) {
+      value -= l[i][k] * y[k];
+    }
+    y[i] = value / l[i][i];
+  }
+  for (int i = kJacobian - 1; i >= 0; --i) {
+    double value = y[i];
+    for (int k = i + 1; k < kJacobian; ++k) {
+      value -= l[k][i] * x[k];
+    }
+    x[i] = value / l[i][i];
+  }
+  return true;
+}
+
+// Applies the update (w, t) on the left of |transform|.
+void ApplyUpdate(const double x[kJacobian], RigidTransform *transform) {
+  double dr[9];
+  RotationFromVector(x, dr);
+  RigidTransform updated;
+  for (int row = 0; row < 3; ++row) {
+    for (int col = 0; col < 3; ++col) {
+      updated.r[row * 3 + col] =
+          static_cast<float>(dr[row * 3] * transform->r[col] + dr[row * 3 + 1] * transform->r[3 + col] +
+                             dr[row * 3 + 2] * transform->r[6 + col]);
+    }
+    updated.t[row] = static_cast<float>(dr[row * 3] * transform->t[0] + dr[row * 3 + 1] * transform->t[1] +
+                                        dr[row * 3 + 2] * transform->t[2] + x[3 + row]);
+  }
+  *transform = updated;
+}
+
+int FinestLevel(const IcpOptions &options, int levels) {
+  return std::max(0, std::min(options.finest_level, levels - 1));
+}
+
+int IterationsForLevel(const IcpOptions &options, int level) {
+  if (options.iterations.empty()) {
+    return 10;
+  }
+  const std::size_t index = std::min(static_cast<std::size_t>(level), options.iterations.size() - 1);
+  return std::max(0, options.iterations[index]);
+}
+
+}  // namespace
+
+void RigidTransform::apply(const float in[3], float out[3]) const {
+  const float x = in[0];
+  const float y = in[1];
+  const float z = in[2];
+  out[0] = r[0] * x + r[1] * y + r[2] * z + t[0];
+  out[1] = r[3] * x + r[4] * y + r[5] * z + t[1];
+  out[2] = r[6] * x + r[7] * y + r[8] * z + t[2];
+}
+
+RigidTransform ComposeTransforms(const RigidTransform &a, const RigidTransform &b) {
+  RigidTransform out;
+  for (int row = 0; row < 3; ++row) {
+    for (int col = 0; col < 3; ++col) {
+      out.r[row * 3 + col] =
+          a.r[row * 3] * b.r[col] + a.r[row * 3 + 1] * b.r[3 + col] + a.r[row * 3 + 2] * b.r[6 + col];
+    }
+    out.t[row] = a.r[row * 3] * b.t[0] + a.r[row * 3 + 1] * b.t[1] + a.r[row * 3 + 2] * b.t[2] + a.t[row];
+  }
+  return out;
+}
+
+RigidTransform InverseTransform(const RigidTransform &transform) {
+  RigidTransform out;
+  for (int row = 0; row < 3; ++row) {
+    for (int col = 0; col < 3; ++col) {
+      out.r[row * 3 + col] = transform.r[col * 3 + row];
+    }
+  }
+  for (int row = 0; row < 3; ++row) {
+    out.t[row] = -(out.r[row * 3] * transform.t[0] + out.r[row * 3 + 1] * transform.t[1] +
+                   out.r[row * 3 + 2] * transform.t[2]);
+  }
+  return out;
+}
+
+float RotationAngle(const RigidTransform &transform) {
+  const float c = 0.5f * (transform.r[0] + transform.r[4] + transform.r[8] - 1.0f);
+  return std::acos(std::max(-1.0f, std::min(1.0f, c)));
+}
+
+IcpOdometry::IcpOdometry() = default;
+IcpOdometry::~IcpOdometry() = default;
+
+void IcpOdometry::reset() {
+  has_reference_ = false;
+  pose_ = RigidTransform();
+  last_motion_ = RigidTransform();
+}
+
+void IcpOdometry::buildLevels(const std::uint16_t *depth, const CameraIntrinsics &intrinsics,
+                              std::vector<Level> *levels) {
+  KINECT_TRACE_SCOPE("icp.build_levels");
+  const int count = std::max(1, options_.levels);
+  pyramid_.build(depth, intrinsics.width, intrinsics.height, count);
+
+  // Level n averages 2^n x 2^n pixels, whose centre sits at
+  // (u + 0.5) * 2^n - 0.5 in full-resolution coordinates.
+  if (rays_intrinsics_ != intrinsics || static_cast<int>(rays_.size()) != pyramid_.levels()) {
+    rays_.clear();
+    for (int n = 0; n < pyramid_.levels(); ++n) {
+      const float scale = 1.0f / static_cast<float>(1 << n);
+      const float fx = intrinsics.fx * scale;
+      const float fy = intrinsics.fy * scale;
+      const float cx = (intrinsics.cx + 0.5f) * scale - 0.5f;
+      const float cy = (intrinsics.cy + 0.5f) * scale - 0.5f;
+      rays_.push_back(BuildRayTable(pyramid_.level(n).width(), pyramid_.level(n).height(),
+                                    [&](int u, int v, float *rx, float *ry) {
+                                      *rx = (static_cast<float>(u) - cx) / fx;
+                                      *ry = (static_cast<float>(v) - cy) / fy;
+                                    }));
+    }
+    rays_intrinsics_ = intrinsics;
+  }
+
+  NormalOptions normal_options;
+  normal_options.method = NormalMethod::kAverage3DGradient;
+  normal_options.window_radius = 2;
+  normal_options.threads = options_.threads;
+  normals_.setOptions(normal_options);
+
+  levels->resize(static_cast<std::size_t>(pyramid_.levels()));
+  for (int n = FinestLevel(options_, pyramid_.levels()); n < pyramid_.levels(); ++n) {
+    Level &level = (*levels)[static_cast<std::size_t>(n)];
+    const float scale = 1.0f / static_cast<float>(1 << n);
+    level.fx = intrinsics.fx * scale;
+    level.fy = intrinsics.fy * scale;
+    level.cx = (intrinsics.cx + 0.5f) * scale - 0.5f;
+    level.cy = (intrinsics.cy + 0.5f) * scale - 0.5f;
+    BackProjectOrganized(pyramid_.level(n).mean(), rays_[static_cast<std::size_t>(n)], PointCloudOptions{},
+                         &level.cloud);
+    normals_.compute(level.cloud, &level.normals);
+    level.points = 0;
+    for (std::size_t i = 0; i < level.cloud.size(); ++i) {
+      level.points += level.normals.valid(i) ? 1 : 0;
+    }
+  }
+}
+
+void IcpOdometry::reduce(const Level &source, const Level &target, const RigidTransform &guess, double *sums) {
+  const int width = source.cloud.width;
+  const int height = source.cloud.height;
+  const int tiles = (height + kTileRows - 1) / kTileRows;
+  tile_sums_.assign(static_cast<std::size_t>(tiles) * kSums, 0.0);
+  const float max_distance_sq = options_.max_distance * options_.max_distance;
+  const float min_normal_cos = std::cos(options_.max_normal_angle_deg * kPi / 180.0f);
+
+  SharedThreadPool().parallelFor(tiles, 1, options_.threads, [&](int begin, int end) {
+    Float4 r[9];
+    for (int i = 0; i < 9; ++i) {
+      r[i] = SplatFloat4(guess.r[i]);
+    }
+    const Float4 t[3] = {SplatFloat4(guess.t[0]), SplatFloat4(guess.t[1]), SplatFloat4(guess.t[2])};
+    const Float4 zero = SplatFloat4(0.0f);
+    const Float4 one = SplatFloat4(1.0f);
+    const Float4 fx = SplatFloat4(target.fx);
+    const Float4 fy = SplatFloat4(target.fy);
+    // +0.5 so truncation rounds to the nearest pixel.
+    const Float4 cx = SplatFloat4(target.cx + 0.5f);
+    const Float4 cy = SplatFloat4(target.cy + 0.5f);
+    const Float4 u_limit = SplatFloat4(static_cast<float>(target.cloud.width));
+    const Float4 v_limit = SplatFloat4(static_cast<float>(target.cloud.height));
+    const Float4 min_z = SplatFloat4(1e-3f);
+    const Float4 limit_sq = SplatFloat4(max_distance_sq);
+    const float *source_normals = source.normals.normals.data();
+    const float *target_normals = target.normals.normals.data();
+
+    for (int tile = begin; tile < end; ++tile) {
+      double *out = tile_sums_.data() + static_cast<std::size_t>(tile) * kSums;
+      const int last_row = std::min(height, (tile + 1) * kTileRows);
+      for (int v = tile * kTileRows; v < last_row; ++v) {
+        // Float lanes only sum one row before moving into doubles.
+        Float4 acc[kSums];
+        for (Float4 &a : acc) {
+          a = zero;
+        }
+        const std::size_t row = static_cast<std::size_t>(v) * width;
+        for (int u = 0; u < width; u += 4) {
+          const int lanes = std::min(4, width - u);
+          alignas(16) float px[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+          alignas(16) float py[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+          alignas(16) float pz[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+          std::memcpy(px, source.cloud.x.data() + row + u, sizeof(float) * lanes);
+          std::memcpy(py, source.cloud.y.data() + row + u, sizeof(float) * lanes);
+          std::memcpy(pz, source.cloud.z.data() + row + u, sizeof(float) * lanes);
+          const Float4 x = LoadFloat4(px);
+          const Float4 y = LoadFloat4(py);
+          const Float4 z = LoadFloat4(pz);
+          const Float4 qx = AddFloat4(AddFloat4(MulFloat4(r[0], x), MulFloat4(r[1], y)), AddFloat4(MulFloat4(r[2], z), t[0]));
+          const Float4 qy = AddFloat4(AddFloat4(MulFloat4(r[3], x), MulFloat4(r[4], y)), AddFloat4(MulFloat4(r[5], z), t[1]));
+          const Float4 qz = AddFloat4(AddFloat4(MulFloat4(r[6], x), MulFloat4(r[7], y)), AddFloat4(MulFloat4(r[8], z), t[2]));
+          const Float4 inv_z = DivFloat4(one, MaxFloat4(qz, min_z));
+          const Float4 fu = AddFloat4(MulFloat4(MulFloat4(fx, qx), inv_z), cx);
+          const Float4 fv = AddFloat4(MulFloat4(MulFloat4(fy, qy), inv_z), cy);
+          Int4 valid = AndInt4(LessFloat4(zero, z), LessFloat4(min_z, qz));
+          valid = AndInt4(valid, AndInt4(GreaterEqualFloat4(fu, zero), LessFloat4(fu, u_limit)));
+          valid = AndInt4(valid, AndInt4(GreaterEqualFloat4(fv, zero), LessFloat4(fv, v_limit)));
+          acc[kSourceSum] = AddFloat4(acc[kSourceSum], SelectFloat4(LessFloat4(zero, z), one, zero));
+          int bits = MaskBits4(valid);
+          if (bits == 0) {
+            continue;
+          }
+
+          // Gather the projected neighbours; pairs whose normals disagree are
+          // different surfaces.
+          alignas(16) std::int32_t iu[4];
+          alignas(16) std::int32_t iv[4];
+          StoreInt4(iu, FloatToInt4(fu));
+          StoreInt4(iv, FloatToInt4(fv));
+          alignas(16) float tx[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+          alignas(16) float ty[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+          alignas(16) float tz[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+          alignas(16) float nx[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+          alignas(16) float ny[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+          alignas(16) float nz[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+          alignas(16) std::int32_t paired[4] = {0, 0, 0, 0};
+          for (int lane = 0; lane < 4; ++lane) {
+            if ((bits >> lane & 1) == 0) {
+              continue;
+            }
+            const float *ns = source_normals + (row + u + lane) * 3;
+            const std::size_t index = static_cast<std::size_t>(iv[lane]) * target.cloud.width + iu[lane];
+            const float *nt = target_normals + index * 3;
+            if (ns[0] == 0.0f && ns[1] == 0.0f && ns[2] == 0.0f) {
+              continue;
+            }
+            if (nt[0] == 0.0f && nt[1] == 0.0f && nt[2] == 0.0f) {
+              continue;
+            }
+            const float rx = guess.r[0] * ns[0] + guess.r[1] * ns[1] + guess.r[2] * ns[2];
+            const float ry = guess.r[3] * ns[0] + guess.r[4] * ns[1] + guess.r[5] * ns[2];
+            const float rz = guess.r[6] * ns[0] + guess.r[7] * ns[1] + guess.r[8] * ns[2];
+            if (rx * nt[0] + ry * nt[1] + rz * nt[2] < min_normal_cos) {
+              continue;
+            }
+            tx[lane] = target.cloud.x[index];
+            ty[lane] = target.cloud.y[index];
+            tz[lane] = target.cloud.z[index];
+            nx[lane] = nt[0];
+            ny[lane] = nt[1];
+            nz[lane] = nt[2];
+            paired[lane] = -1;
+          }
+
+          const Float4 n[3] = {LoadFloat4(nx), LoadFloat4(ny), LoadFloat4(nz)};
+          const Float4 dx = SubFloat4(qx, LoadFloat4(tx));
+          const Float4 dy = SubFloat4(qy, LoadFloat4(ty));
+          const Float4 dz = SubFloat4(qz, LoadFloat4(tz));
+          const Float4 distance_sq = AddFloat4(AddFloat4(MulFloat4(dx, dx), MulFloat4(dy, dy)), MulFloat4(dz, dz));
+          const Int4 inlier = AndInt4(LoadInt4(paired), LessFloat4(distance_sq, limit_sq));
+          if (MaskBits4(inlier) == 0) {
+            continue;
+          }
+          // r = n . (q - p); dr/dw = q x n, dr/dt = n.
+          const Float4 residual =
+              SelectFloat4(inlier, AddFloat4(AddFloat4(MulFloat4(n[0], dx), MulFloat4(n[1], dy)), MulFloat4(n[2], dz)),
+                           zero);
+          Float4 j[kJacobian];
+          j[0] = SubFloat4(MulFloat4(qy, n[2]), MulFloat4(qz, n[1]));
+          j[1] = SubFloat4(MulFloat4(qz, n[0]), MulFloat4(qx, n[2]));
+          j[2] = SubFloat4(MulFloat4(qx, n[1]), MulFloat4(qy, n[0]));
+          j[3] = n[0];
+          j[4] = n[1];
+          j[5] = n[2];
+          for (Float4 &value : j) {
+            value = SelectFloat4(inlier, value, zero);
+          }
+          for (int a = 0, k = 0; a < kJacobian; ++a) {
+            for (int b = a; b < kJacobian; ++b, ++k) {
+              acc[k] = AddFloat4(acc[k], MulFloat4(j[a], j[b]));
+            }
+            acc[kHessianTerms + a] = AddFloat4(acc[kHessianTerms + a], MulFloat4(j[a], residual));
+          }
+          acc[kResidualSum] = AddFloat4(acc[kResidualSum], MulFloat4(residual, residual));
+          acc[kInlierSum] = AddFloat4(acc[kInlierSum], SelectFloat4(inlier, one, zero));
+        }
+        for (int k = 0; k < kSums; ++k) {
+          alignas(16) float lanes[4];
+          StoreFloat4(lanes, acc[k]);
+          out[k] += static_cast<double>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+        }
+      }
+    }
+  });
+
+  // Tiles are summed in order, so the result does not depend on scheduling.
+  std::fill(sums, sums + kSums, 0.0);
+  for (int tile = 0; tile < tiles; ++tile) {
+    const double *partial = tile_sums_.data() + static_cast<std::size_t>(tile) * kSums;
+    for (int k = 0; k < kSums; ++k) {
+      sums[k] += partial[k];
+    }
+  }
+}
+
+IcpResult IcpOdometry::track(const std::uint16_t *depth, const CameraIntrinsics &intrinsics) {
+  KINECT_TRACE_SCOPE("icp.track");
+  IcpResult result;
+  if (depth == nullptr || !intrinsics.valid()) {
+    return result;
+  }
+  buildLevels(depth, intrinsics, &current_);
+  if (!has_reference_ || previous_.size() != current_.size() ||
+      previous_.front().cloud.width != current_.front().cloud.width ||
+      previous_.front().cloud.height != current_.front().cloud.height) {
+    std::swap(previous_, current_);
+    has_reference_ = true;
+    last_motion_ = RigidTransform();
+    result.tracked = true;
+    return result;
+  }
+
+  RigidTransform estimate = options_.predict_motion ? last_motion_ : RigidTransform();
+  double sums[kSums];
+  bool solved = true;
+  bool finest_reduced = false;
+  const int finest = FinestLevel(options_, static_cast<int>(current_.size()));
+  const Level &finest_source = current_[static_cast<std::size_t>(finest)];
+  const Level &finest_target = previous_[static_cast<std::size_t>(finest)];
+  for (int n = static_cast<int>(current_.size()) - 1; n >= finest && solved; --n) {
+    const Level &source = current_[static_cast<std::size_t>(n)];
+    const Level &target = previous_[static_cast<std::size_t>(n)];
+    const int iterations = IterationsForLevel(options_, n);
+    for (int i = 0; i < iterations; ++i) {
+      reduce(source, target, estimate, sums);
+      ++result.iterations;
+      finest_reduced = n == finest;
+      double x[kJacobian];
+      if (sums[kInlierSum] < kJacobian || !SolveNormalEquations(sums, x)) {
+        solved = n > finest;
+        break;
+      }
+      ApplyUpdate(x, &estimate);
+      const double rotation = std::sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+      const double translation = std::sqrt(x[3] * x[3] + x[4] * x[4] + x[5] * x[5]);
+      if (rotation < options_.min_rotation && translation < options_.min_translation) {
+        break;
+      }
+    }
+  }
+
+  // Inlier statistics come from the last finest-level pass, one update
+  // behind the estimate, which is close enough once it has converged.
+  if (!finest_reduced) {
+    reduce(finest_source, finest_target, estimate, sums);
+  }
+  result.inliers = static_cast<std::size_t>(sums[kInlierSum]);
+  result.rms = sums[kInlierSum] > 0.0 ? static_cast<float>(std::sqrt(sums[kResidualSum] / sums[kInlierSum])) : 0.0f;
+  const double required = options_.min_inlier_fraction * static_cast<double>(finest_source.points);
+  result.tracked = solved && sums[kInlierSum] >= std::max<double>(required, kJacobian);
+  if (result.tracked) {
+    result.motion = estimate;
+    pose_ = ComposeTransforms(pose_, estimate);
+    last_motion_ = estimate;
+  } else {
+    last_motion_ = RigidTransform();
+  }
+  std::swap(previous_, current_);
+  return result;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "core/calibration.h"
+#include "processing/depth_pyramid.h"
+#include "processing/normals.h"
+#include "processing/point_cloud.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Rigid motion p' = R p + t with R row-major; t in the cloud's units.
+struct RigidTransform {
+  float r[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+  float t[3] = {0.0f, 0.0f, 0.0f};
+
+  void apply(const float in[3], float out[3]) const;
+};
+
+// a * b: applies |b| first.
+RigidTransform ComposeTransforms(const RigidTransform &a, const RigidTransform &b);
+RigidTransform InverseTransform(const RigidTransform &transform);
+// Rotation angle of |transform| in radians.
+float RotationAngle(const RigidTransform &transform);
+
+struct IcpOptions {
+  // Pyramid levels, solved coarsest first; level 0 is full resolution.
+  int levels = 4;
+  // Finest level solved. The default 1 tracks at half resolution, where the
+  // 2x2 average has halved the sensor noise; it is both more accurate than
+  // full-resolution normals and skips building that level at all.
+  int finest_level = 1;
+  // Gauss-Newton iterations per level, level 0 first; levels past the end
+  // use the last entry.
+  std::vector<int> iterations = {4, 4, 6, 10};
+  // Correspondences farther apart than this (metres) are rejected, as are
+  // ones whose normals differ by more than |max_normal_angle_deg|.
+  float max_distance = 0.1f;
+  float max_normal_angle_deg = 30.0f;
+  // A level stops early once an update rotates less than this (radians) and
+  // moves less than |min_translation| (metres).
+  float min_rotation = 1e-4f;
+  float min_translation = 1e-4f;
+  // Tracking is lost when fewer than this fraction of the finest level's
+  // points find a correspondence.
+  float min_inlier_fraction = 0.1f;
+  // Starts each frame from the previous frame's motion instead of standing
+  // still.
+  bool predict_motion = true;
+  // Shared pool threads to use, including the caller; 0 uses all of them.
+  int threads = 0;
+};
+
+struct IcpResult {
+  bool tracked = false;
+  // Current camera to previous camera, in metres.
+  RigidTransform motion;
+  int iterations = 0;
+  std::size_t inliers = 0;
+  // RMS point-to-plane distance of the inliers at the finest level (metres).
+  float rms = 0.0f;
+};
+
+// Frame-to-frame point-to-plane ICP. Each depth frame becomes a pyramid of
+// organized clouds with normals; the current frame is aligned to the previous
+// one coarse to fine, pairing points by projecting them into the previous
+// depth image (projective data association) rather than searching. The 6x6
+// normal equations are reduced four points at a time over row tiles on a
+// thread pool, and every frame's clouds are reused as the next frame's
+// reference. Depth is treated as an ideal pinhole image. Not thread-safe.
+class IcpOdometry {
+ public:
+  IcpOdometry();
+  ~IcpOdometry();
+  IcpOdometry(const IcpOdometry &) = delete;
+  IcpOdometry &operator=(const IcpOdometry &) = delete;
+
+  void setOptions(const IcpOptions &options) { options_ = options; }
+  const IcpOptions &options() const { return options_; }
+
+  // Forgets the reference frame and restarts the trajectory at the identity.
+  void reset();
+
+  // Aligns |depth| (intrinsics.width x intrinsics.height, millimetres) to
+  // the previous frame. The first frame after reset() only becomes the
+  // reference. When tracking is lost the pose stays put and the frame
+  // becomes the new reference.
+  IcpResult track(const std::uint16_t *depth, const CameraIntrinsics &intrinsics);
+
+  // Camera to world of the last frame, where the world is the first frame's
+  // camera; metres.
+  const RigidTransform &pose() const { return pose_; }
+
+ private:
+  struct Level {
+    OrganizedPointCloud cloud;
+    NormalMap normals;
+    float fx = 0.0f;
+    float fy = 0.0f;
+    float cx = 0.0f;
+    float cy = 0.0f;
+    std::size_t points = 0;
+  };
+
+  void buildLevels(const std::uint16_t *depth, const CameraIntrinsics &intrinsics, std::vector<Level> *levels);
+  // Accumulates the normal equations of |source| against |target| under
+  // |guess| into |sums|.
+  void reduce(const Level &source, const Level &target, const RigidTransform &guess, double *sums);
+
+  IcpOptions options_;
+  DepthPyramid pyramid_;
+  NormalEstimator normals_;
+  std::vector<RayTable> rays_;
+  CameraIntrinsics rays_intrinsics_;
+  std::vector<Level> previous_;
+  std::vector<Level> current_;
+  bool has_reference_ = false;
+  RigidTransform pose_;
+  RigidTransform last_motion_;
+  std::vector<double> tile_sums_;
+};
@@ -0,0 +1,78 @@
+#include "processing/mesh.h"
+
+#include "core/trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "binary PLY output assumes a little-endian host"
+#endif
+
+namespace {
+
+// One count byte and three indices.
+constexpr std::size_t kPlyFaceBytes = 1 + 3 * sizeof(std::uint32_t);
+
+}  // namespace
+
+bool WriteMeshPly(const std::string &path, const TriangleMesh &mesh) {
+  KINECT_TRACE_SCOPE("mesh.write_ply");
+  const std::size_t vertices = mesh.vertexCount();
+  const std::size_t triangles = mesh.triangleCount();
+  const bool has_normals = !mesh.normals.empty();
+  const bool has_colors = !mesh.colors.empty();
+  if ((has_normals && mesh.normals.size() != mesh.vertices.size()) ||
+      (has_colors && mesh.colors.size() != mesh.vertices.size())) {
+    std::cerr << "[mesh] normals or colours do not match " << vertices << " vertices\n";
+    return false;
+  }
+
+  std::string header = "ply\nformat binary_little_endian 1.0\nelement vertex ";
+  header += std::to_string(vertices);
+  header += "\nproperty float x\nproperty float y\nproperty float z\n";
+  if (has_normals) {
+    header += "property float nx\nproperty float ny\nproperty float nz\n";
+  }
+  if (has_colors) {
+    header += "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+  }
+  header += "element face ";
+  header += std::to_string(triangles);
+  header += "\nproperty list uchar uint vertex_indices\nend_header\n";
+
+  const std::size_t float_bytes = (has_normals ? 6 : 3) * sizeof(float);
+  const std::size_t vertex_bytes = float_bytes + (has_colors ? 3 : 0);
+  std::vector<char> buffer(header.size() + vertices * vertex_bytes + triangles * kPlyFaceBytes);
+  std::memcpy(buffer.data(), header.data(), header.size());
+  char *cursor = buffer.data() + header.size();
+  for (std::size_t v = 0; v < vertices; ++v) {
+    std::memcpy(cursor, mesh.vertices.data() + v * 3, 3 * sizeof(float));
+    if (has_normals) {
+      std::memcpy(cursor + 3 * sizeof(float), mesh.normals.data() + v * 3, 3 * sizeof(float));
+    }
+    if (has_colors) {
+      std::memcpy(cursor + float_bytes, mesh.colors.data() + v * 3, 3);
+    }
+    cursor += vertex_bytes;
+  }
+  for (std::size_t t = 0; t < triangles; ++t) {
+    *cursor = 3;
+    std::memcpy(cursor + 1, mesh.indices.data() + t * 3, 3 * sizeof(std::uint32_t));
+    cursor += kPlyFaceBytes;
+  }
+
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    std::cerr << "[mesh] could not open " << path << "\n";
+    return false;
+  }
+  const bool written = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+  const bool closed = std::fclose(file) == 0;
+  if (!written || !closed) {
+    std::cerr << "[mesh] could not write " << path << "\n";
+    return false;
+  }
+  return true;
+}
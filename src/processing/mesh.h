@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Indexed triangle mesh: xyz interleaved as floats, optional per-vertex unit
+// normals in the same layout, optional per-vertex rgb bytes, and three vertex
+// indices per triangle wound counter-clockwise seen from the front.
+struct TriangleMesh {
+  std::vector<float> vertices;
+  std::vector<float> normals;
+  std::vector<std::uint8_t> colors;
+  std::vector<std::uint32_t> indices;
+
+  std::size_t vertexCount() const { return vertices.size() / 3; }
+  std::size_t triangleCount() const { return indices.size() / 3; }
+  void clear() {
+    vertices.clear();
+    normals.clear();
+    colors.clear();
+    indices.clear();
+  }
+};
+
+// Writes a binary little-endian PLY: float x/y/z (plus nx/ny/nz and uchar
+// red/green/blue when the mesh has them) and uchar-counted uint
+// vertex_indices faces, assembled in one buffer and written with a single
+// call.
+bool WriteMeshPly(const std::string &path, const TriangleMesh &mesh);
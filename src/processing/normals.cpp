@@ -0,0 +1,425 @@
+#include "processing/normals.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+#include "processing/simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Channel layouts. Both end with the point count so the query code can find
+// it at kChannels - 1.
+constexpr int kGradientChannels = 4;     // x y z n
+constexpr int kCovarianceChannels = 10;  // x y z xx xy xz yy yz zz n
+// Rows per band; the table also covers the window radius above and below.
+constexpr int kBandRows = 32;
+// Newton steps for the smallest eigenvalue. Planar windows converge in two
+// or three; near-isotropic ones converge linearly and stop at the cap.
+constexpr int kEigenIterations = 32;
+constexpr float kEigenTolerance = 1e-6f;
+
+// Pixels without a return have x = y = z = 0, so only the count needs the
+// validity test and the accumulation stays branch-free.
+template <int kChannels>
+inline void PointFeatures(double x, double y, double z, double *out) {
+  out[0] = x;
+  out[1] = y;
+  out[2] = z;
+  if constexpr (kChannels == kCovarianceChannels) {
+    out[3] = x * x;
+    out[4] = x * y;
+    out[5] = x * z;
+    out[6] = y * y;
+    out[7] = y * z;
+    out[8] = z * z;
+  }
+  out[kChannels - 1] = z > 0.0 ? 1.0 : 0.0;
+}
+
+struct Window {
+  int x0, y0, x1, y1;
+};
+
+inline Window ClampWindow(int u, int v, int r, int width, int height) {
+  return Window{std::max(0, u - r), std::max(0, v - r), std::min(width, u + r + 1), std::min(height, v + r + 1)};
+}
+
+// Summed-area table over image rows [first_row, first_row + rows): cell
+// (x, y) holds the channel sums of pixels [0, x) x [first_row, first_row + y).
+struct BandTable {
+  const double *cells;
+  int stride;
+  int first_row;
+
+  // Sums over the pixels of |w|, which must lie inside the band's rows.
+  template <int kChannels>
+  void sum(const Window &w, double *out) const {
+    const std::size_t top = static_cast<std::size_t>(w.y0 - first_row) * stride;
+    const std::size_t bottom = static_cast<std::size_t>(w.y1 - first_row) * stride;
+    const double *a = cells + (top + w.x0) * kChannels;
+    const double *b = cells + (top + w.x1) * kChannels;
+    const double *c = cells + (bottom + w.x0) * kChannels;
+    const double *d = cells + (bottom + w.x1) * kChannels;
+    for (int k = 0; k < kChannels; ++k) {
+      out[k] = d[k] - b[k] - c[k] + a[k];
+    }
+  }
+};
+
+// Row prefix and column accumulation fused into one pass: each cell adds the
+// row's running sum to the cell above, which is still in cache.
+template <int kChannels>
+void BuildBandTable(const OrganizedPointCloud &cloud, int first_row, int last_row, std::vector<double> *storage) {
+  const int width = cloud.width;
+  const std::size_t row_values = static_cast<std::size_t>(width + 1) * kChannels;
+  storage->resize(row_values * static_cast<std::size_t>(last_row - first_row + 1));
+  double *cells = storage->data();
+  std::fill(cells, cells + row_values, 0.0);
+  double point[kChannels];
+  for (int v = first_row; v < last_row; ++v) {
+    const double *above = cells;
+    cells += row_values;
+    double running[kChannels] = {};
+    std::memset(cells, 0, sizeof(running));
+    const std::size_t row = static_cast<std::size_t>(v) * width;
+    for (int u = 0; u < width; ++u) {
+      PointFeatures<kChannels>(cloud.x[row + u], cloud.y[row + u], cloud.z[row + u], point);
+      double *cell = cells + static_cast<std::size_t>(u + 1) * kChannels;
+      const double *up = above + static_cast<std::size_t>(u + 1) * kChannels;
+      for (int k = 0; k < kChannels; ++k) {
+        running[k] += point[k];
+        cell[k] = up[k] + running[k];
+      }
+    }
+  }
+}
+
+// True when every valid pixel on the window's ring of eight probes lies on
+// the centre's surface.
+bool SmoothAround(const OrganizedPointCloud &cloud, int u, int v, int r, float limit) {
+  static constexpr int kProbes[8][2] = {{-1, -1}, {0, -1}, {1, -1}, {-1, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+  const float centre = cloud.z[static_cast<std::size_t>(v) * cloud.width + u];
+  for (const auto &probe : kProbes) {
+    const int x = std::min(cloud.width - 1, std::max(0, u + probe[0] * r));
+    const int y = std::min(cloud.height - 1, std::max(0, v + probe[1] * r));
+    const float z = cloud.z[static_cast<std::size_t>(y) * cloud.width + x];
+    if (z > 0.0f && std::fabs(z - centre) > limit) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Marks pixels of row |v| that have a return and pass SmoothAround(), four
+// at a time where the probes stay inside the image.
+void SmoothRow(const OrganizedPointCloud &cloud, int v, int r, float factor, std::uint8_t *out) {
+  const int width = cloud.width;
+  const float *z = cloud.z.data() + static_cast<std::size_t>(v) * width;
+  int u = 0;
+  for (; u < std::min(width, r); ++u) {
+    out[u] = z[u] > 0.0f && SmoothAround(cloud, u, v, r, factor * z[u]);
+  }
+  if (v >= r && v + r < cloud.height) {
+    const std::ptrdiff_t up = -static_cast<std::ptrdiff_t>(r) * width;
+    const std::ptrdiff_t offsets[8] = {up - r, up, up + r, -r, r, -up - r, -up, -up + r};
+    const Float4 zero = SplatFloat4(0.0f);
+    const Float4 factor4 = SplatFloat4(factor);
+    for (; u + 4 <= width - r; u += 4) {
+      const Float4 centre = LoadFloat4(z + u);
+      const Float4 limit = MulFloat4(centre, factor4);
+      // Rejections add up as -1 lanes; any lane below zero failed.
+      Int4 rejected = GreaterEqualFloat4(zero, centre);
+      for (std::ptrdiff_t offset : offsets) {
+        const Float4 neighbour = LoadFloat4(z + u + offset);
+        const Float4 difference = MaxFloat4(SubFloat4(neighbour, centre), SubFloat4(centre, neighbour));
+        rejected = AddInt4(rejected, AndInt4(LessFloat4(zero, neighbour), LessFloat4(limit, difference)));
+      }
+      const int bad = MaskBits4(LessInt4(rejected, SplatInt4(0)));
+      for (int lane = 0; lane < 4; ++lane) {
+        out[u + lane] = ((bad >> lane) & 1) == 0;
+      }
+    }
+  }
+  for (; u < width; ++u) {
+    out[u] = z[u] > 0.0f && SmoothAround(cloud, u, v, r, factor * z[u]);
+  }
+}
+
+// Runs solve_row(table, v, smooth) for every row, one band of rows at a time;
+// |smooth| flags the pixels that have a return and no depth edge within the
+// window. Each thread (up to |max_threads|) owns a slot and its table and
+// takes every n-th band, so the tables are reused without locking.
+template <int kChannels, typename SolveRow>
+void ForEachBand(const OrganizedPointCloud &cloud, int r, float factor, int max_threads,
+                 std::vector<std::vector<double>> *tables, const SolveRow &solve_row) {
+  const int bands = (cloud.height + kBandRows - 1) / kBandRows;
+  const int slots = std::min(bands, static_cast<int>(tables->size()));
+  SharedThreadPool().parallelFor(slots, 1, max_threads, [&](int begin, int end) {
+    std::vector<std::uint8_t> smooth(static_cast<std::size_t>(cloud.width));
+    for (int slot = begin; slot < end; ++slot) {
+      std::vector<double> &storage = (*tables)[static_cast<std::size_t>(slot)];
+      for (int band = slot; band < bands; band += slots) {
+        const int v0 = band * kBandRows;
+        const int v1 = std::min(cloud.height, v0 + kBandRows);
+        const int first_row = std::max(0, v0 - r);
+        BuildBandTable<kChannels>(cloud, first_row, std::min(cloud.height, v1 + r), &storage);
+        const BandTable table{storage.data(), cloud.width + 1, first_row};
+        for (int v = v0; v < v1; ++v) {
+          SmoothRow(cloud, v, r, factor, smooth.data());
+          solve_row(table, v, smooth.data());
+        }
+      }
+    }
+  });
+}
+
+// Normalises |n| and turns it towards the camera at the origin.
+inline bool StoreNormal(float nx, float ny, float nz, float px, float py, float pz, float *out) {
+  const float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+  if (!(length > 0.0f)) {
+    return false;
+  }
+  float scale = 1.0f / length;
+  if (nx * px + ny * py + nz * pz > 0.0f) {
+    scale = -scale;
+  }
+  out[0] = nx * scale;
+  out[1] = ny * scale;
+  out[2] = nz * scale;
+  return true;
+}
+
+inline void Cross4(const Float4 a[3], const Float4 b[3], Float4 out[3]) {
+  out[0] = SubFloat4(MulFloat4(a[1], b[2]), MulFloat4(a[2], b[1]));
+  out[1] = SubFloat4(MulFloat4(a[2], b[0]), MulFloat4(a[0], b[2]));
+  out[2] = SubFloat4(MulFloat4(a[0], b[1]), MulFloat4(a[1], b[0]));
+}
+
+inline Float4 Dot4(const Float4 a[3], const Float4 b[3]) {
+  return AddFloat4(AddFloat4(MulFloat4(a[0], b[0]), MulFloat4(a[1], b[1])), MulFloat4(a[2], b[2]));
+}
+
+// Solves four covariance windows at once for their smallest eigenpair. The
+// matrices arrive scaled to unit trace, so the eigenvalue is the curvature
+// directly and float precision is enough once the covariance itself was
+// formed in double.
+class EigenBatch {
+ public:
+  // Queues the symmetric matrix {a00 a01 a02; a01 a11 a12; a02 a12 a22} for
+  // pixel |index|; returns true when the batch is full.
+  bool add(const float a[6], std::size_t index) {
+    for (int k = 0; k < 6; ++k) {
+      a_[k][count_] = a[k];
+    }
+    index_[count_] = index;
+    return ++count_ == 4;
+  }
+
+  // The smallest eigenvalue is the smallest root of the characteristic
+  // cubic. Its roots are real and non-negative, so Newton's method from zero
+  // climbs to it monotonically, which avoids the acos/cos of the closed
+  // form. The eigenvector is orthogonal to every row of A - lambda I; the
+  // largest cross product of two rows is the best-conditioned estimate.
+  void solve(const OrganizedPointCloud &cloud, float *normals, float *curvature) {
+    if (count_ == 0) {
+      return;
+    }
+    for (int lane = count_; lane < 4; ++lane) {
+      for (int k = 0; k < 6; ++k) {
+        a_[k][lane] = a_[k][0];
+      }
+    }
+    const Float4 a00 = LoadFloat4(a_[0]);
+    const Float4 a01 = LoadFloat4(a_[1]);
+    const Float4 a02 = LoadFloat4(a_[2]);
+    const Float4 a11 = LoadFloat4(a_[3]);
+    const Float4 a12 = LoadFloat4(a_[4]);
+    const Float4 a22 = LoadFloat4(a_[5]);
+    // det(lambda I - A) = lambda^3 - lambda^2 + c1 lambda - c0 at unit trace.
+    const Float4 m00 = SubFloat4(MulFloat4(a11, a22), MulFloat4(a12, a12));
+    const Float4 m01 = SubFloat4(MulFloat4(a01, a22), MulFloat4(a12, a02));
+    const Float4 m02 = SubFloat4(MulFloat4(a01, a12), MulFloat4(a11, a02));
+    const Float4 c1 = AddFloat4(AddFloat4(SubFloat4(MulFloat4(a00, a11), MulFloat4(a01, a01)),
+                                          SubFloat4(MulFloat4(a00, a22), MulFloat4(a02, a02))),
+                                m00);
+    const Float4 c0 = AddFloat4(SubFloat4(MulFloat4(a00, m00), MulFloat4(a01, m01)), MulFloat4(a02, m02));
+    const Float4 one = SplatFloat4(1.0f);
+    const Float4 two = SplatFloat4(2.0f);
+    const Float4 three = SplatFloat4(3.0f);
+    const Float4 tiny = SplatFloat4(1e-20f);
+    const Float4 tolerance = SplatFloat4(-kEigenTolerance);
+    Float4 lambda = SplatFloat4(0.0f);
+    for (int i = 0; i < kEigenIterations; ++i) {
+      const Float4 f = SubFloat4(MulFloat4(AddFloat4(MulFloat4(SubFloat4(lambda, one), lambda), c1), lambda), c0);
+      const Float4 slope = MaxFloat4(AddFloat4(MulFloat4(SubFloat4(MulFloat4(three, lambda), two), lambda), c1), tiny);
+      const Float4 step = DivFloat4(f, slope);
+      lambda = SubFloat4(lambda, step);
+      if (MaskBits4(LessFloat4(step, tolerance)) == 0) {
+        break;
+      }
+    }
+    lambda = MaxFloat4(lambda, SplatFloat4(0.0f));
+
+    const Float4 r0[3] = {SubFloat4(a00, lambda), a01, a02};
+    const Float4 r1[3] = {a01, SubFloat4(a11, lambda), a12};
+    const Float4 r2[3] = {a02, a12, SubFloat4(a22, lambda)};
+    Float4 best[3];
+    Float4 candidate[3];
+    Cross4(r0, r1, best);
+    Float4 best_norm = Dot4(best, best);
+    Cross4(r0, r2, candidate);
+    Float4 norm = Dot4(candidate, candidate);
+    Int4 better = LessFloat4(best_norm, norm);
+    for (int k = 0; k < 3; ++k) {
+      best[k] = SelectFloat4(better, candidate[k], best[k]);
+    }
+    best_norm = MaxFloat4(best_norm, norm);
+    Cross4(r1, r2, candidate);
+    norm = Dot4(candidate, candidate);
+    better = LessFloat4(best_norm, norm);
+    for (int k = 0; k < 3; ++k) {
+      best[k] = SelectFloat4(better, candidate[k], best[k]);
+    }
+
+    alignas(16) float n[3][4];
+    alignas(16) float smallest[4];
+    StoreFloat4(n[0], best[0]);
+    StoreFloat4(n[1], best[1]);
+    StoreFloat4(n[2], best[2]);
+    StoreFloat4(smallest, lambda);
+    for (int lane = 0; lane < count_; ++lane) {
+      const std::size_t i = index_[lane];
+      if (StoreNormal(n[0][lane], n[1][lane], n[2][lane], cloud.x[i], cloud.y[i], cloud.z[i], normals + i * 3)) {
+        curvature[i] = smallest[lane];
+      }
+    }
+    count_ = 0;
+  }
+
+ private:
+  alignas(16) float a_[6][4];
+  std::size_t index_[4];
+  int count_ = 0;
+};
+
+}  // namespace
+
+const char *NormalMethodLabel(NormalMethod method) {
+  switch (method) {
+    case NormalMethod::kAverage3DGradient:
+      return "average_3d_gradient";
+    case NormalMethod::kCovariance:
+      return "covariance";
+  }
+  return "unknown";
+}
+
+NormalEstimator::NormalEstimator() = default;
+NormalEstimator::~NormalEstimator() = default;
+
+void NormalEstimator::compute(const OrganizedPointCloud &cloud, NormalMap *out) {
+  KINECT_TRACE_SCOPE("normals.compute");
+  const int width = cloud.width;
+  const int height = cloud.height;
+  const std::size_t count = static_cast<std::size_t>(width) * height;
+  out->width = width;
+  out->height = height;
+  out->normals.assign(count * 3, 0.0f);
+  out->curvature.assign(count, 0.0f);
+  if (count == 0 || cloud.z.size() < count) {
+    return;
+  }
+
+  tables_.resize(static_cast<std::size_t>(SharedThreadPool().threadsFor(options_.threads)));
+
+  const int r = std::max(1, options_.window_radius);
+  const float factor = options_.depth_change_factor * static_cast<float>(r);
+  // A quarter of the window must have returns for a stable fit.
+  const double min_points = std::max(3.0, (2.0 * r + 1.0) * (2.0 * r + 1.0) / 4.0);
+  float *normals = out->normals.data();
+  float *curvature = out->curvature.data();
+
+  if (options_.method == NormalMethod::kCovariance) {
+    ForEachBand<kCovarianceChannels>(
+        cloud, r, factor, options_.threads, &tables_, [&](const BandTable &table, int v, const std::uint8_t *smooth) {
+          EigenBatch batch;
+          double sum[kCovarianceChannels];
+          for (int u = 0; u < width; ++u) {
+            if (smooth[u] == 0) {
+              continue;
+            }
+            table.sum<kCovarianceChannels>(ClampWindow(u, v, r, width, height), sum);
+            const double n = sum[kCovarianceChannels - 1];
+            if (n < min_points) {
+              continue;
+            }
+            const double inv = 1.0 / n;
+            const double mx = sum[0] * inv;
+            const double my = sum[1] * inv;
+            const double mz = sum[2] * inv;
+            const double cxx = sum[3] * inv - mx * mx;
+            const double cyy = sum[6] * inv - my * my;
+            const double czz = sum[8] * inv - mz * mz;
+            const double trace = cxx + cyy + czz;
+            if (!(trace > 0.0)) {
+              continue;
+            }
+            const double scale = 1.0 / trace;
+            const float matrix[6] = {static_cast<float>(cxx * scale),
+                                     static_cast<float>((sum[4] * inv - mx * my) * scale),
+                                     static_cast<float>((sum[5] * inv - mx * mz) * scale),
+                                     static_cast<float>(cyy * scale),
+                                     static_cast<float>((sum[7] * inv - my * mz) * scale),
+                                     static_cast<float>(czz * scale)};
+            if (batch.add(matrix, static_cast<std::size_t>(v) * width + u)) {
+              batch.solve(cloud, normals, curvature);
+            }
+          }
+          batch.solve(cloud, normals, curvature);
+        });
+    return;
+  }
+
+  const double half_min = min_points / 2.0;
+  ForEachBand<kGradientChannels>(
+      cloud, r, factor, options_.threads, &tables_, [&](const BandTable &table, int v, const std::uint8_t *smooth) {
+        double a[kGradientChannels];
+        double b[kGradientChannels];
+        for (int u = 0; u < width; ++u) {
+          if (smooth[u] == 0) {
+            continue;
+          }
+          const Window w = ClampWindow(u, v, r, width, height);
+          if (w.x0 >= u || w.x1 <= u + 1 || w.y0 >= v || w.y1 <= v + 1) {
+            continue;
+          }
+          // Mean of the right half minus the left half, and bottom minus top.
+          table.sum<kGradientChannels>(Window{u + 1, w.y0, w.x1, w.y1}, a);
+          table.sum<kGradientChannels>(Window{w.x0, w.y0, u, w.y1}, b);
+          if (a[3] < half_min || b[3] < half_min) {
+            continue;
+          }
+          double ia = 1.0 / a[3];
+          double ib = 1.0 / b[3];
+          const double hx = a[0] * ia - b[0] * ib;
+          const double hy = a[1] * ia - b[1] * ib;
+          const double hz = a[2] * ia - b[2] * ib;
+          table.sum<kGradientChannels>(Window{w.x0, v + 1, w.x1, w.y1}, a);
+          table.sum<kGradientChannels>(Window{w.x0, w.y0, w.x1, v}, b);
+          if (a[3] < half_min || b[3] < half_min) {
+            continue;
+          }
+          ia = 1.0 / a[3];
+          ib = 1.0 / b[3];
+          const double vx = a[0] * ia - b[0] * ib;
+          const double vy = a[1] * ia - b[1] * ib;
+          const double vz = a[2] * ia - b[2] * ib;
+          const std::size_t i = static_cast<std::size_t>(v) * width + u;
+          StoreNormal(static_cast<float>(hy * vz - hz * vy), static_cast<float>(hz * vx - hx * vz),
+                      static_cast<float>(hx * vy - hy * vx), cloud.x[i], cloud.y[i], cloud.z[i], normals + i * 3);
+        }
+      });
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "processing/point_cloud.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+enum class NormalMethod {
+  // Cross product of the mean horizontal and vertical 3D differences across
+  // the window. Cheapest; no curvature.
+  kAverage3DGradient,
+  // Smallest eigenvector of the window's covariance, with curvature.
+  kCovariance,
+};
+
+const char *NormalMethodLabel(NormalMethod method);
+
+struct NormalOptions {
+  NormalMethod method = NormalMethod::kCovariance;
+  // The window is (2r + 1)^2 pixels around each point.
+  int window_radius = 6;
+  // A neighbour on the window's edge whose depth differs from the centre by
+  // more than this fraction of the centre depth per pixel of distance
+  // belongs to another surface; such pixels get no normal rather than one
+  // smeared across the edge.
+  float depth_change_factor = 0.02f;
+  // Shared pool threads to use, including the caller; 0 uses all of them.
+  int threads = 0;
+};
+
+// Per-pixel result on the cloud's grid. Normals are unit xyz triples facing
+// the camera, (0, 0, 0) where none could be estimated. Curvature is
+// lambda0 / (lambda0 + lambda1 + lambda2) of the window covariance (0 on a
+// plane, 1/3 for isotropic scatter); the gradient method leaves it at 0.
+struct NormalMap {
+  int width = 0;
+  int height = 0;
+  std::vector<float> normals;
+  std::vector<float> curvature;
+
+  bool valid(std::size_t index) const {
+    const float *n = normals.data() + index * 3;
+    return n[0] != 0.0f || n[1] != 0.0f || n[2] != 0.0f;
+  }
+};
+
+// Integral-image normal estimation over an organized cloud. The image is cut
+// into bands of rows; each band builds a summed-area table of the point
+// coordinates (and their products for the covariance method) over its rows
+// plus the window overlap, after which every window sum is four lookups
+// whatever the radius. A band's table stays small enough to be reused from
+// cache. Not thread-safe.
+class NormalEstimator {
+ public:
+  NormalEstimator();
+  ~NormalEstimator();
+  NormalEstimator(const NormalEstimator &) = delete;
+  NormalEstimator &operator=(const NormalEstimator &) = delete;
+
+  void setOptions(const NormalOptions &options) { options_ = options; }
+  const NormalOptions &options() const { return options_; }
+
+  void compute(const OrganizedPointCloud &cloud, NormalMap *out);
+
+ private:
+  NormalOptions options_;
+  // One band table per thread.
+  std::vector<std::vector<double>> tables_;
+};
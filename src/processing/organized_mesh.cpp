@@ -0,0 +1,601 @@
+#include "processing/organized_mesh.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "binary PLY output assumes a little-endian host"
+#endif
+
+namespace {
+
+// Quad rows per band; raised to the planar tile so tiles never straddle
+// bands.
+constexpr int kBandRows = 16;
+constexpr std::size_t kPlyFaceBytes = 1 + 3 * sizeof(std::uint32_t);
+// Bound for one OBJ vertex line pair ("v x y z r g b" and "vt u v"):
+// shortest-form floats, 3-decimal colours and 5-decimal texture coordinates.
+constexpr std::size_t kObjVertexChars = 1 + 3 * 17 + 3 * 6 + 4 + 2 * 8 + 1;
+// "f a/a b/b c/c" with ten-digit ids.
+constexpr std::size_t kObjFaceChars = 2 + 3 * 22 + 1;
+
+// Triangles a grid quad keeps, as bits of its |quads_| entry. The quad is
+//   a b
+//   c d
+// and each triangle is wound to face the camera.
+constexpr std::uint8_t kQuadAcb = 1;
+constexpr std::uint8_t kQuadBcd = 2;
+constexpr std::uint8_t kQuadAcd = 4;
+constexpr std::uint8_t kQuadAdb = 8;
+constexpr std::uint8_t kQuadTriangles[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+struct DepthLimits {
+  std::uint16_t min_mm;
+  std::uint16_t max_mm;
+  float jump;
+};
+
+// A triangle is kept when its three depths are valid and pairwise joined.
+bool Usable(std::uint16_t p, std::uint16_t q, std::uint16_t r, const DepthLimits &limits) {
+  const auto valid = [&limits](std::uint16_t z) { return z >= limits.min_mm && z <= limits.max_mm; };
+  const auto joined = [&limits](float a, float b) { return std::fabs(a - b) <= limits.jump * std::min(a, b); };
+  return valid(p) && valid(q) && valid(r) && joined(p, q) && joined(q, r) && joined(p, r);
+}
+
+// Writes the triangle bits of the quads between |top| and the row below.
+// A free function, so its loop keeps the limits in registers instead of
+// reloading them through the callers' captures after every byte store.
+void ClassifyQuadRow(const std::uint16_t *top, int width, DepthLimits limits, std::uint8_t *quads) {
+  const std::uint16_t *bottom = top + width;
+  for (int u = 0; u + 1 < width; ++u) {
+    const std::uint16_t a = top[u];
+    const std::uint16_t b = top[u + 1];
+    const std::uint16_t c = bottom[u];
+    const std::uint16_t d = bottom[u + 1];
+    // Common case: four valid depths within the jump of the nearest.
+    const std::uint16_t near = std::min(std::min(a, b), std::min(c, d));
+    const std::uint16_t far = std::max(std::max(a, b), std::max(c, d));
+    if (near >= limits.min_mm && far <= limits.max_mm &&
+        static_cast<float>(far - near) <= limits.jump * static_cast<float>(near)) {
+      quads[u] = kQuadAcb | kQuadBcd;
+      continue;
+    }
+    std::uint8_t mask = (Usable(a, c, b, limits) ? kQuadAcb : 0) | (Usable(b, c, d, limits) ? kQuadBcd : 0);
+    if (mask == 0) {
+      // The other diagonal, e.g. when b or c is missing.
+      mask = (Usable(a, c, d, limits) ? kQuadAcd : 0) | (Usable(a, d, b, limits) ? kQuadAdb : 0);
+    }
+    quads[u] = mask;
+  }
+}
+
+// Marks the vertices a row of classified quads uses and returns its
+// triangle count.
+std::size_t MarkQuadRow(const std::uint8_t *quads, int width, std::uint8_t *used_top, std::uint8_t *used_bottom) {
+  std::size_t triangles = 0;
+  for (int u = 0; u + 1 < width; ++u) {
+    const std::uint8_t mask = quads[u];
+    if (mask == 0) {
+      continue;
+    }
+    triangles += kQuadTriangles[mask];
+    used_top[u] |= (mask & (kQuadAcb | kQuadAcd | kQuadAdb)) != 0 ? 1 : 0;
+    used_top[u + 1] |= (mask & (kQuadAcb | kQuadBcd | kQuadAdb)) != 0 ? 1 : 0;
+    used_bottom[u] |= (mask & (kQuadAcb | kQuadBcd | kQuadAcd)) != 0 ? 1 : 0;
+    used_bottom[u + 1] |= (mask & (kQuadBcd | kQuadAcd | kQuadAdb)) != 0 ? 1 : 0;
+  }
+  return triangles;
+}
+
+bool WriteAll(std::FILE *file, const void *data, std::size_t size) {
+  return size == 0 || std::fwrite(data, 1, size, file) == size;
+}
+
+char *FormatFixed(char *cursor, char *end, float value, int precision) {
+  return std::to_chars(cursor, end, value, std::chars_format::fixed, precision).ptr;
+}
+
+}  // namespace
+
+struct OrganizedMesher::Band {
+  int first_row = 0;
+  // Vertex rows [first_row, end_row) belong to the band; its last quad row
+  // also touches end_row, whose marks go to |boundary|.
+  int end_row = 0;
+  int end_quad_row = 0;
+  // Planar tile fans as pixel indices; grid quads are kept in |quads_|.
+  std::vector<std::uint32_t> fans;
+  std::vector<std::uint8_t> boundary;
+  std::size_t triangle_count = 0;
+  std::size_t first_vertex = 0;
+  std::size_t vertex_count = 0;
+  // write() only: the band's triangles as vertex ids.
+  std::vector<std::uint32_t> indices;
+  std::vector<char> vertex_bytes;
+  std::vector<char> face_bytes;
+};
+
+OrganizedMesher::OrganizedMesher(const OrganizedMeshOptions &options) {
+  setOptions(options);
+}
+
+OrganizedMesher::~OrganizedMesher() = default;
+
+void OrganizedMesher::setOptions(const OrganizedMeshOptions &options) {
+  options_ = options;
+  int tile = std::max(0, options_.planar_tile);
+  if (tile == 1) {
+    tile = 0;
+  }
+  // Round down to a power of two so the fan centre is a pixel.
+  while ((tile & (tile - 1)) != 0) {
+    tile &= tile - 1;
+  }
+  options_.planar_tile = tile;
+}
+
+void OrganizedMesher::triangulate(const std::uint16_t *depth, const RayTable &rays) {
+  KINECT_TRACE_SCOPE("organized_mesh.triangulate");
+  const int width = rays.width();
+  const int height = rays.height();
+  const std::size_t pixels = rays.size();
+  width_ = width;
+  height_ = height;
+  stats_ = OrganizedMeshStats();
+  if (width < 2 || height < 2) {
+    bands_.clear();
+    used_.clear();
+    return;
+  }
+
+  const int tile = options_.planar_tile;
+  const int band_rows = std::max(kBandRows, tile);
+  const int quad_rows = height - 1;
+  const int band_count = (quad_rows + band_rows - 1) / band_rows;
+  // Bands keep their buffers' capacity from frame to frame.
+  bands_.resize(static_cast<std::size_t>(band_count));
+  for (int b = 0; b < band_count; ++b) {
+    Band &band = bands_[static_cast<std::size_t>(b)];
+    band.first_row = b * band_rows;
+    band.end_row = b + 1 == band_count ? height : std::min(height, (b + 1) * band_rows);
+  }
+  used_.assign(pixels, 0);
+  quads_.resize(pixels);
+  vertex_ids_.resize(pixels);
+
+  const std::uint16_t min_mm = options_.min_depth_mm;
+  const std::uint16_t max_mm = options_.max_depth_mm;
+  const DepthLimits limits = {min_mm, max_mm, options_.max_depth_jump};
+
+  // Planar tiles: every pixel valid and within tolerance of a plane fitted
+  // to the tile. A plane seen through a pinhole is affine in inverse depth
+  // over the pixel grid, and on a full grid with centred coordinates the
+  // least-squares fit separates into a mean and two slopes. An inverse-depth
+  // residual dw is a depth error of about dw * z^2, so one inverse-depth
+  // bound gives the tolerance its quadratic growth.
+  const int tiles_x = tile > 0 ? (width - 1) / tile : 0;
+  const int tiles_y = tile > 0 ? (height - 1) / tile : 0;
+  planar_.assign(static_cast<std::size_t>(tiles_x) * tiles_y, 0);
+  if (tile > 0 && tiles_x > 0 && tiles_y > 0) {
+    // 1 / mm: tolerance_mm at 1000 mm.
+    const float bound = options_.planar_tolerance_mm * 1e-6f;
+    const int side = tile + 1;
+    const float half = 0.5f * static_cast<float>(tile);
+    // Sum of squared centred coordinates along one axis, times the other
+    // axis' sample count.
+    float spread = 0.0f;
+    for (int i = 0; i < side; ++i) {
+      spread += (static_cast<float>(i) - half) * (static_cast<float>(i) - half);
+    }
+    spread *= static_cast<float>(side);
+    const float samples = static_cast<float>(side * side);
+    SharedThreadPool().parallelFor(tiles_y, 1, options_.threads, [&](int begin, int end) {
+      std::vector<float> inverse(static_cast<std::size_t>(side * side));
+      for (int ty = begin; ty < end; ++ty) {
+        for (int tx = 0; tx < tiles_x; ++tx) {
+          const std::uint16_t *origin = depth + static_cast<std::size_t>(ty * tile) * width + tx * tile;
+          float sum = 0.0f;
+          float sum_u = 0.0f;
+          float sum_v = 0.0f;
+          bool planar = true;
+          for (int j = 0; j < side && planar; ++j) {
+            const std::uint16_t *row = origin + static_cast<std::size_t>(j) * width;
+            for (int i = 0; i < side; ++i) {
+              if (row[i] < min_mm || row[i] > max_mm) {
+                planar = false;
+                break;
+              }
+              const float w = 1.0f / static_cast<float>(row[i]);
+              inverse[static_cast<std::size_t>(j * side + i)] = w;
+              sum += w;
+              sum_u += w * (static_cast<float>(i) - half);
+              sum_v += w * (static_cast<float>(j) - half);
+            }
+          }
+          if (!planar) {
+            continue;
+          }
+          const float mean = sum / samples;
+          const float slope_u = sum_u / spread;
+          const float slope_v = sum_v / spread;
+          for (int j = 0; j < side && planar; ++j) {
+            const float base = mean + slope_v * (static_cast<float>(j) - half);
+            for (int i = 0; i < side; ++i) {
+              const float fitted = base + slope_u * (static_cast<float>(i) - half);
+              if (std::fabs(inverse[static_cast<std::size_t>(j * side + i)] - fitted) > bound) {
+                planar = false;
+                break;
+              }
+            }
+          }
+          planar_[static_cast<std::size_t>(ty) * tiles_x + tx] = planar ? 1 : 0;
+        }
+      }
+    });
+  }
+  stats_.planar_tiles = static_cast<std::size_t>(std::count(planar_.begin(), planar_.end(), std::uint8_t{1}));
+  const auto planar_at = [&](int tx, int ty) {
+    return tx >= 0 && ty >= 0 && tx < tiles_x && ty < tiles_y &&
+           planar_[static_cast<std::size_t>(ty) * tiles_x + tx] != 0;
+  };
+
+  // Classifies every quad and marks the vertices its triangles use; the
+  // triangles themselves are only written once vertex ids are known.
+  SharedThreadPool().parallelFor(band_count, 1, options_.threads, [&](int begin, int end) {
+    for (int b = begin; b < end; ++b) {
+      Band &band = bands_[static_cast<std::size_t>(b)];
+      band.boundary.assign(static_cast<std::size_t>(width), 0);
+      band.end_quad_row = std::min(quad_rows, band.first_row + band_rows);
+      const int last_quad_row = band.end_quad_row;
+      std::size_t triangles = 0;
+      for (int v = band.first_row; v < last_quad_row; ++v) {
+        const std::size_t row = static_cast<std::size_t>(v) * width;
+        std::uint8_t *quads = quads_.data() + row;
+        std::uint8_t *used_top = used_.data() + row;
+        // Marks for the shared row below go to |boundary| so bands never
+        // write the same bytes.
+        std::uint8_t *used_bottom = v + 1 < band.end_row ? used_top + width : band.boundary.data();
+        ClassifyQuadRow(depth + row, width, limits, quads);
+        if (tile > 0) {
+          // Planar tiles' quads are covered by their fans.
+          for (int tx = 0; tx < tiles_x; ++tx) {
+            if (planar_at(tx, v / tile)) {
+              std::memset(quads + tx * tile, 0, static_cast<std::size_t>(tile));
+            }
+          }
+        }
+        triangles += MarkQuadRow(quads, width, used_top, used_bottom);
+      }
+
+      std::vector<std::uint32_t> &out = band.fans;
+      out.clear();
+      const auto emit = [&out](std::size_t p, std::size_t q, std::size_t r) {
+        out.push_back(static_cast<std::uint32_t>(p));
+        out.push_back(static_cast<std::uint32_t>(q));
+        out.push_back(static_cast<std::uint32_t>(r));
+      };
+
+      // Planar tiles: a fan around the tile centre through the corners and,
+      // on sides facing a non-planar neighbour, every boundary pixel, so the
+      // fine triangles there share its edge vertices and no cracks open.
+      if (tile > 0) {
+        std::vector<std::size_t> ring;
+        for (int ty = band.first_row / tile; ty < tiles_y && ty * tile < last_quad_row; ++ty) {
+          for (int tx = 0; tx < tiles_x; ++tx) {
+            if (!planar_at(tx, ty)) {
+              continue;
+            }
+            const int x0 = tx * tile;
+            const int y0 = ty * tile;
+            // Sides on the image border have no neighbour to match; the
+            // last tile row and column may still have fine quads beyond.
+            const int left = planar_at(tx - 1, ty) || x0 == 0 ? tile : 1;
+            const int bottom = planar_at(tx, ty + 1) || y0 + tile == height - 1 ? tile : 1;
+            const int right = planar_at(tx + 1, ty) || x0 + tile == width - 1 ? tile : 1;
+            const int top = planar_at(tx, ty - 1) || y0 == 0 ? tile : 1;
+            const auto at = [width](int x, int y) { return static_cast<std::size_t>(y) * width + x; };
+            ring.clear();
+            for (int j = 0; j < tile; j += left) {
+              ring.push_back(at(x0, y0 + j));
+            }
+            for (int i = 0; i < tile; i += bottom) {
+              ring.push_back(at(x0 + i, y0 + tile));
+            }
+            for (int j = 0; j < tile; j += right) {
+              ring.push_back(at(x0 + tile, y0 + tile - j));
+            }
+            for (int i = 0; i < tile; i += top) {
+              ring.push_back(at(x0 + tile - i, y0));
+            }
+            if (ring.size() == 4) {
+              emit(ring[0], ring[1], ring[2]);
+              emit(ring[0], ring[2], ring[3]);
+              continue;
+            }
+            const std::size_t centre = at(x0 + tile / 2, y0 + tile / 2);
+            for (std::size_t k = 0; k < ring.size(); ++k) {
+              emit(centre, ring[k], ring[(k + 1) % ring.size()]);
+            }
+          }
+        }
+      }
+
+      const std::size_t own_end = static_cast<std::size_t>(band.end_row) * width;
+      for (std::uint32_t p : out) {
+        if (p < own_end) {
+          used_[p] = 1;
+        } else {
+          band.boundary[p - own_end] = 1;
+        }
+      }
+      band.triangle_count = triangles + out.size() / 3;
+    }
+  });
+
+  // Fold the boundary marks into the rows below, then number the vertices
+  // band by band.
+  for (int b = 0; b + 1 < band_count; ++b) {
+    const Band &band = bands_[static_cast<std::size_t>(b)];
+    std::uint8_t *row = used_.data() + static_cast<std::size_t>(band.end_row) * width;
+    for (int u = 0; u < width; ++u) {
+      row[u] |= band.boundary[static_cast<std::size_t>(u)];
+    }
+  }
+  SharedThreadPool().parallelFor(band_count, 1, options_.threads, [&](int begin, int end) {
+    for (int b = begin; b < end; ++b) {
+      Band &band = bands_[static_cast<std::size_t>(b)];
+      std::size_t count = 0;
+      const std::size_t first = static_cast<std::size_t>(band.first_row) * width;
+      const std::size_t last = static_cast<std::size_t>(band.end_row) * width;
+      for (std::size_t p = first; p < last; ++p) {
+        count += used_[p];
+      }
+      band.vertex_count = count;
+    }
+  });
+  std::size_t vertices = 0;
+  std::size_t triangles = 0;
+  for (Band &band : bands_) {
+    band.first_vertex = vertices;
+    vertices += band.vertex_count;
+    triangles += band.triangle_count;
+  }
+  SharedThreadPool().parallelFor(band_count, 1, options_.threads, [&](int begin, int end) {
+    for (int b = begin; b < end; ++b) {
+      const Band &band = bands_[static_cast<std::size_t>(b)];
+      std::uint32_t id = static_cast<std::uint32_t>(band.first_vertex);
+      const std::size_t first = static_cast<std::size_t>(band.first_row) * width;
+      const std::size_t last = static_cast<std::size_t>(band.end_row) * width;
+      for (std::size_t p = first; p < last; ++p) {
+        vertex_ids_[p] = id;
+        id += used_[p];
+      }
+    }
+  });
+  stats_.vertices = vertices;
+  stats_.triangles = triangles;
+}
+
+void OrganizedMesher::emitTriangles(const Band &band, std::uint32_t *out) const {
+  // Locals, since a store through |out| could otherwise alias the members.
+  const int width = width_;
+  const std::uint32_t *ids = vertex_ids_.data();
+  for (int v = band.first_row; v < band.end_quad_row; ++v) {
+    const std::size_t row = static_cast<std::size_t>(v) * width;
+    const std::uint8_t *quads = quads_.data() + row;
+    const std::uint32_t *top = ids + row;
+    const std::uint32_t *bottom = top + width;
+    for (int u = 0; u + 1 < width; ++u) {
+      const std::uint8_t mask = quads[u];
+      if (mask == 0) {
+        continue;
+      }
+      const std::uint32_t a = top[u];
+      const std::uint32_t b = top[u + 1];
+      const std::uint32_t c = bottom[u];
+      const std::uint32_t d = bottom[u + 1];
+      if ((mask & kQuadAcb) != 0) {
+        out[0] = a;
+        out[1] = c;
+        out[2] = b;
+        out += 3;
+      }
+      if ((mask & kQuadBcd) != 0) {
+        out[0] = b;
+        out[1] = c;
+        out[2] = d;
+        out += 3;
+      }
+      if ((mask & kQuadAcd) != 0) {
+        out[0] = a;
+        out[1] = c;
+        out[2] = d;
+        out += 3;
+      }
+      if ((mask & kQuadAdb) != 0) {
+        out[0] = a;
+        out[1] = d;
+        out[2] = b;
+        out += 3;
+      }
+    }
+  }
+  for (std::uint32_t p : band.fans) {
+    *out++ = ids[p];
+  }
+}
+
+void OrganizedMesher::build(const std::uint16_t *depth, const RayTable &rays, const std::uint8_t *rgb,
+                            TriangleMesh *out) {
+  KINECT_TRACE_SCOPE("organized_mesh.build");
+  triangulate(depth, rays);
+  // Resized rather than cleared: every element is overwritten below, so a
+  // mesh reused from the last frame is not zero-filled again.
+  out->normals.clear();
+  out->vertices.resize(stats_.vertices * 3);
+  out->colors.resize(rgb != nullptr ? stats_.vertices * 3 : 0);
+  out->indices.resize(stats_.triangles * 3);
+  if (bands_.empty()) {
+    return;
+  }
+  const float scale = options_.units_per_mm;
+  const float *ray_x = rays.x();
+  const float *ray_y = rays.y();
+  std::vector<std::size_t> first_index(bands_.size() + 1, 0);
+  for (std::size_t b = 0; b < bands_.size(); ++b) {
+    first_index[b + 1] = first_index[b] + bands_[b].triangle_count * 3;
+  }
+  SharedThreadPool().parallelFor(static_cast<int>(bands_.size()), 1, options_.threads, [&](int begin, int end) {
+    for (int b = begin; b < end; ++b) {
+      const Band &band = bands_[static_cast<std::size_t>(b)];
+      const std::size_t first = static_cast<std::size_t>(band.first_row) * width_;
+      const std::size_t last = static_cast<std::size_t>(band.end_row) * width_;
+      const std::uint8_t *used = used_.data();
+      const std::uint32_t *ids = vertex_ids_.data();
+      float *vertices = out->vertices.data();
+      std::uint8_t *colors = out->colors.data();
+      for (std::size_t p = first; p < last; ++p) {
+        if (used[p] == 0) {
+          continue;
+        }
+        const std::size_t v = ids[p];
+        const float z = static_cast<float>(depth[p]) * scale;
+        float *xyz = vertices + v * 3;
+        xyz[0] = ray_x[p] * z;
+        xyz[1] = ray_y[p] * z;
+        xyz[2] = z;
+        if (rgb != nullptr) {
+          std::memcpy(colors + v * 3, rgb + p * 3, 3);
+        }
+      }
+      emitTriangles(band, out->indices.data() + first_index[static_cast<std::size_t>(b)]);
+    }
+  });
+}
+
+bool OrganizedMesher::write(const std::string &path, MeshFileFormat format, const std::uint16_t *depth,
+                            const RayTable &rays, const std::uint8_t *rgb) {
+  KINECT_TRACE_SCOPE("organized_mesh.write");
+  triangulate(depth, rays);
+  const bool ply = format == MeshFileFormat::kBinaryPly;
+  const float scale = options_.units_per_mm;
+  const float *ray_x = rays.x();
+  const float *ray_y = rays.y();
+  const float inv_width = width_ > 0 ? 1.0f / static_cast<float>(width_) : 0.0f;
+  const float inv_height = height_ > 0 ? 1.0f / static_cast<float>(height_) : 0.0f;
+  const std::size_t vertex_size = ply ? 3 * sizeof(float) + (rgb != nullptr ? 3 : 0) : kObjVertexChars;
+
+  SharedThreadPool().parallelFor(static_cast<int>(bands_.size()), 1, options_.threads, [&](int begin, int end) {
+    KINECT_TRACE_SCOPE("organized_mesh.format_band");
+    for (int b = begin; b < end; ++b) {
+      Band &band = bands_[static_cast<std::size_t>(b)];
+      band.vertex_bytes.resize(band.vertex_count * vertex_size);
+      char *cursor = band.vertex_bytes.data();
+      char *const limit = cursor + band.vertex_bytes.size();
+      const std::size_t first = static_cast<std::size_t>(band.first_row) * width_;
+      const std::size_t last = static_cast<std::size_t>(band.end_row) * width_;
+      for (std::size_t p = first; p < last; ++p) {
+        if (used_[p] == 0) {
+          continue;
+        }
+        const float z = static_cast<float>(depth[p]) * scale;
+        const float xyz[3] = {ray_x[p] * z, ray_y[p] * z, z};
+        if (ply) {
+          std::memcpy(cursor, xyz, sizeof(xyz));
+          cursor += sizeof(xyz);
+          if (rgb != nullptr) {
+            std::memcpy(cursor, rgb + p * 3, 3);
+            cursor += 3;
+          }
+          continue;
+        }
+        *cursor++ = 'v';
+        for (int axis = 0; axis < 3; ++axis) {
+          *cursor++ = ' ';
+          cursor = std::to_chars(cursor, limit, xyz[axis]).ptr;
+        }
+        if (rgb != nullptr) {
+          for (int channel = 0; channel < 3; ++channel) {
+            *cursor++ = ' ';
+            cursor = FormatFixed(cursor, limit, static_cast<float>(rgb[p * 3 + channel]) * (1.0f / 255.0f), 3);
+          }
+        }
+        const int u = static_cast<int>(p % static_cast<std::size_t>(width_));
+        const int v = static_cast<int>(p / static_cast<std::size_t>(width_));
+        std::memcpy(cursor, "\nvt ", 4);
+        cursor = FormatFixed(cursor + 4, limit, (static_cast<float>(u) + 0.5f) * inv_width, 5);
+        *cursor++ = ' ';
+        cursor = FormatFixed(cursor, limit, 1.0f - (static_cast<float>(v) + 0.5f) * inv_height, 5);
+        *cursor++ = '\n';
+      }
+      band.vertex_bytes.resize(static_cast<std::size_t>(cursor - band.vertex_bytes.data()));
+
+      const std::size_t triangles = band.triangle_count;
+      band.indices.resize(triangles * 3);
+      emitTriangles(band, band.indices.data());
+      band.face_bytes.resize(triangles * (ply ? kPlyFaceBytes : kObjFaceChars));
+      cursor = band.face_bytes.data();
+      char *const face_limit = cursor + band.face_bytes.size();
+      for (std::size_t t = 0; t < triangles; ++t) {
+        const std::uint32_t ids[3] = {band.indices[t * 3], band.indices[t * 3 + 1], band.indices[t * 3 + 2]};
+        if (ply) {
+          *cursor = 3;
+          std::memcpy(cursor + 1, ids, sizeof(ids));
+          cursor += kPlyFaceBytes;
+          continue;
+        }
+        *cursor++ = 'f';
+        for (std::uint32_t id : ids) {
+          // OBJ indices are 1-based; vertex and texture ids coincide.
+          *cursor++ = ' ';
+          cursor = std::to_chars(cursor, face_limit, id + 1).ptr;
+          *cursor++ = '/';
+          cursor = std::to_chars(cursor, face_limit, id + 1).ptr;
+        }
+        *cursor++ = '\n';
+      }
+      band.face_bytes.resize(static_cast<std::size_t>(cursor - band.face_bytes.data()));
+    }
+  });
+
+  std::string header;
+  if (ply) {
+    header = "ply\nformat binary_little_endian 1.0\nelement vertex ";
+    header += std::to_string(stats_.vertices);
+    header += "\nproperty float x\nproperty float y\nproperty float z\n";
+    if (rgb != nullptr) {
+      header += "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+    }
+    header += "element face ";
+    header += std::to_string(stats_.triangles);
+    header += "\nproperty list uchar uint vertex_indices\nend_header\n";
+  } else {
+    header = "# organized depth mesh: " + std::to_string(stats_.vertices) + " vertices, " +
+             std::to_string(stats_.triangles) + " faces\n";
+  }
+
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    std::cerr << "[organized_mesh] could not open " << path << "\n";
+    return false;
+  }
+  bool ok = WriteAll(file, header.data(), header.size());
+  for (const Band &band : bands_) {
+    ok = ok && WriteAll(file, band.vertex_bytes.data(), band.vertex_bytes.size());
+  }
+  for (const Band &band : bands_) {
+    ok = ok && WriteAll(file, band.face_bytes.data(), band.face_bytes.size());
+  }
+  ok = std::fclose(file) == 0 && ok;
+  if (!ok) {
+    std::cerr << "[organized_mesh] write failed for " << path << "\n";
+  }
+  return ok;
+}
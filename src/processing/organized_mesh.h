@@ -0,0 +1,94 @@
+#pragma once
+
+#include "processing/camera_model.h"
+#include "processing/mesh.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct OrganizedMeshOptions {
+  // Depth outside [min, max] millimetres is a hole.
+  std::uint16_t min_depth_mm = 350;
+  std::uint16_t max_depth_mm = 6000;
+  // Neighbours whose depths differ by more than this fraction of the nearer
+  // one are not joined, so silhouettes stay open instead of being bridged by
+  // long skirts.
+  float max_depth_jump = 0.05f;
+  // Planar decimation: square tiles of this many pixels (a power of two, 0
+  // disables) that lie on a plane become one fan instead of 2 * tile^2
+  // triangles. The tolerance is in millimetres at 1 m and grows with depth
+  // squared, like the sensors' depth quantisation.
+  int planar_tile = 0;
+  float planar_tolerance_mm = 3.0f;
+  // Output scale: 0.001 writes metres, 1 keeps millimetres.
+  float units_per_mm = 0.001f;
+  // Shared pool threads to use, including the caller; 0 uses all of them.
+  int threads = 0;
+};
+
+struct OrganizedMeshStats {
+  std::size_t vertices = 0;
+  std::size_t triangles = 0;
+  std::size_t planar_tiles = 0;
+};
+
+enum class MeshFileFormat {
+  kBinaryPly,
+  kObj,
+};
+
+// Surface of a single depth frame built straight on the pixel grid: each
+// 2x2 pixel quad becomes two triangles when its depths are valid and
+// connected (one when a corner is missing), so no reconstruction step is
+// needed and the grid's neighbourhoods come for free. Vertex ids are
+// assigned per band of rows by prefix sum, so only pixels a triangle uses
+// become vertices.
+//
+// Colours come from |rgb| (RGB24 in depth pixel layout) when given. OBJ
+// output also carries texture coordinates into the depth-sized image, so
+// the frame's registered colour image can be applied as a texture.
+// Not thread-safe.
+class OrganizedMesher {
+ public:
+  explicit OrganizedMesher(const OrganizedMeshOptions &options = OrganizedMeshOptions());
+  ~OrganizedMesher();
+  OrganizedMesher(const OrganizedMesher &) = delete;
+  OrganizedMesher &operator=(const OrganizedMesher &) = delete;
+
+  const OrganizedMeshOptions &options() const { return options_; }
+  void setOptions(const OrganizedMeshOptions &options);
+
+  // Triangulates |depth| (rays.width() x rays.height(), millimetres) into
+  // |out|, whose normals stay empty.
+  void build(const std::uint16_t *depth, const RayTable &rays, const std::uint8_t *rgb, TriangleMesh *out);
+
+  // Triangulates and writes |path| in one pass: every band formats its own
+  // vertices and faces, and the header plus band buffers are written in
+  // order. Returns false (and logs) on an I/O failure.
+  bool write(const std::string &path, MeshFileFormat format, const std::uint16_t *depth, const RayTable &rays,
+             const std::uint8_t *rgb);
+
+  // Counts from the last build() or write().
+  const OrganizedMeshStats &stats() const { return stats_; }
+
+ private:
+  struct Band;
+
+  void triangulate(const std::uint16_t *depth, const RayTable &rays);
+  // Writes |band|'s triangle_count triangles to |out| as vertex ids.
+  void emitTriangles(const Band &band, std::uint32_t *out) const;
+
+  OrganizedMeshOptions options_;
+  OrganizedMeshStats stats_;
+  int width_ = 0;
+  int height_ = 0;
+  std::vector<Band> bands_;
+  std::vector<std::uint8_t> planar_;
+  std::vector<std::uint8_t> used_;
+  // Per quad (indexed by its top-left pixel): which triangles it keeps.
+  std::vector<std::uint8_t> quads_;
+  std::vector<std::uint32_t> vertex_ids_;
+};
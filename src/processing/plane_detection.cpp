@@ -0,0 +1,585 @@
+#include "processing/plane_detection.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+#include "processing/simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+
+// Samples are scored in blocks of this many consecutive grid points.
+constexpr std::size_t kBlockPoints = 64;
+// Preemptive scoring: every hypothesis sees the first 16 blocks of the
+// random block order, the best quarter the first 64, and the best sixteenth
+// every block.
+constexpr std::size_t kStageBlocks[2] = {16, 64};
+constexpr int kStageShift = 2;
+constexpr std::size_t kMinSurvivors = 4;
+// The second and third point of a hypothesis lie within this many grid cells
+// of the first.
+constexpr int kNeighbourhoodCells = 12;
+constexpr int kHypothesisAttempts = 16;
+constexpr int kNeighbourAttempts = 8;
+// Rejects nearly collinear point triples.
+constexpr float kMinSine = 0.3f;
+// A new plane inherits the id of an unmatched previous-frame plane this
+// close to it.
+constexpr float kMatchCos = 0.985f;  // 10 degrees
+constexpr float kMatchDistance = 0.1f;
+constexpr int kLabelBandRows = 16;
+constexpr int kMaxPlanes = 254;
+// Sets kept for reuse, as in DepthPyramidBuilder.
+constexpr std::size_t kSetPoolSize = 4;
+constexpr std::uint32_t kBlockOrderSeed = 0x9e3779b9u;
+constexpr double kPi = 3.14159265358979;
+
+// Unit eigenvector of the smallest eigenvalue of the symmetric matrix
+// {c00, c01, c02, c11, c12, c22}: the eigenvalue from the trigonometric
+// solution of the characteristic cubic, the vector as the longest cross
+// product of two rows of C - lambda I. False when the points are degenerate.
+bool SmallestEigenvector(const double c[6], double out[3]) {
+  const double a00 = c[0], a01 = c[1], a02 = c[2], a11 = c[3], a12 = c[4], a22 = c[5];
+  const double q = (a00 + a11 + a22) / 3.0;
+  const double p1 = a01 * a01 + a02 * a02 + a12 * a12;
+  const double p2 = (a00 - q) * (a00 - q) + (a11 - q) * (a11 - q) + (a22 - q) * (a22 - q) + 2.0 * p1;
+  const double p = std::sqrt(p2 / 6.0);
+  if (!(p > 0.0)) {
+    return false;
+  }
+  const double b00 = (a00 - q) / p, b11 = (a11 - q) / p, b22 = (a22 - q) / p;
+  const double b01 = a01 / p, b02 = a02 / p, b12 = a12 / p;
+  const double det = b00 * (b11 * b22 - b12 * b12) - b01 * (b01 * b22 - b12 * b02) + b02 * (b01 * b12 - b11 * b02);
+  const double r = std::max(-1.0, std::min(1.0, det / 2.0));
+  const double phi = std::acos(r) / 3.0;
+  const double lambda = q + 2.0 * p * std::cos(phi + 2.0 * kPi / 3.0);
+
+  const double rows[3][3] = {{a00 - lambda, a01, a02}, {a01, a11 - lambda, a12}, {a02, a12, a22 - lambda}};
+  double best = 0.0;
+  for (int i = 0; i < 3; ++i) {
+    const double *u = rows[i];
+    const double *v = rows[(i + 1) % 3];
+    const double n[3] = {u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0]};
+    const double length = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+    if (length > best) {
+      best = length;
+      const double scale = 1.0 / std::sqrt(length);
+      out[0] = n[0] * scale;
+      out[1] = n[1] * scale;
+      out[2] = n[2] * scale;
+    }
+  }
+  return best > 0.0;
+}
+
+}  // namespace
+
+struct PlaneDetector::Plane {
+  float n[3] = {0.0f, 0.0f, 0.0f};
+  float d = 0.0f;
+  float centroid[3] = {0.0f, 0.0f, 0.0f};
+  std::size_t samples = 0;
+  std::uint32_t id = 0;
+  std::uint32_t age = 0;
+};
+
+PlaneDetector::PlaneDetector() : rng_(options_.seed) {}
+PlaneDetector::~PlaneDetector() = default;
+
+void PlaneDetector::setOptions(const PlaneDetectionOptions &options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (options.enabled && !options_.enabled) {
+    // A prior from before the pause would only cost a wasted scoring pass.
+    reset_pending_ = true;
+  }
+  options_ = options;
+}
+
+PlaneDetectionOptions PlaneDetector::options() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return options_;
+}
+
+bool PlaneDetector::enabled() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return options_.enabled;
+}
+
+void PlaneDetector::reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  reset_pending_ = true;
+}
+
+void PlaneDetector::gatherSamples(const std::uint16_t *depth, const RayTable &rays,
+                                  const PlaneDetectionOptions &options) {
+  const int step = std::max(1, options.sample_step);
+  const int width = rays.width();
+  const int grid_width = std::max(1, width / step);
+  const int grid_height = std::max(1, rays.height() / step);
+  const std::size_t count = static_cast<std::size_t>(grid_width) * grid_height;
+  const std::size_t blocks = (count + kBlockPoints - 1) / kBlockPoints;
+  if (grid_width != grid_width_ || grid_height != grid_height_) {
+    grid_width_ = grid_width;
+    grid_height_ = grid_height;
+    x_.assign(blocks * kBlockPoints, 0.0f);
+    y_.assign(blocks * kBlockPoints, 0.0f);
+    z_.assign(blocks * kBlockPoints, 0.0f);
+    threshold_.assign(blocks * kBlockPoints, -1.0f);
+    block_order_.resize(blocks);
+    std::iota(block_order_.begin(), block_order_.end(), 0u);
+    std::mt19937 shuffle(kBlockOrderSeed);
+    std::shuffle(block_order_.begin(), block_order_.end(), shuffle);
+  }
+
+  const float min_mm = options.min_depth_mm;
+  const float max_mm = options.max_depth_mm;
+  const float tolerance = options.inlier_distance_mm * 0.001f;
+  const float *ray_x = rays.x();
+  const float *ray_y = rays.y();
+  for (int gy = 0; gy < grid_height; ++gy) {
+    const std::size_t row = static_cast<std::size_t>(gy * step + step / 2) * width;
+    for (int gx = 0; gx < grid_width; ++gx) {
+      const std::size_t pixel = row + static_cast<std::size_t>(gx * step + step / 2);
+      const std::size_t i = static_cast<std::size_t>(gy) * grid_width + gx;
+      const float mm = depth[pixel];
+      if (mm < min_mm || mm > max_mm) {
+        x_[i] = 0.0f;
+        y_[i] = 0.0f;
+        z_[i] = 0.0f;
+        threshold_[i] = -1.0f;
+        continue;
+      }
+      const float z = mm * 0.001f;
+      x_[i] = ray_x[pixel] * z;
+      y_[i] = ray_y[pixel] * z;
+      z_[i] = z;
+      threshold_[i] = tolerance * std::max(1.0f, z * z);
+    }
+  }
+}
+
+std::size_t PlaneDetector::countInliers(const Plane &plane, std::size_t first_block, std::size_t end_block) const {
+  const Float4 nx = SplatFloat4(plane.n[0]);
+  const Float4 ny = SplatFloat4(plane.n[1]);
+  const Float4 nz = SplatFloat4(plane.n[2]);
+  const Float4 d = SplatFloat4(plane.d);
+  const Float4 zero = SplatFloat4(0.0f);
+  const Int4 one = SplatInt4(1);
+  Int4 total = SplatInt4(0);
+  for (std::size_t b = first_block; b < end_block; ++b) {
+    const std::size_t base = static_cast<std::size_t>(block_order_[b]) * kBlockPoints;
+    const float *x = x_.data() + base;
+    const float *y = y_.data() + base;
+    const float *z = z_.data() + base;
+    const float *threshold = threshold_.data() + base;
+    for (std::size_t i = 0; i < kBlockPoints; i += 4) {
+      const Float4 distance = AddFloat4(
+          AddFloat4(MulFloat4(nx, LoadFloat4(x + i)), MulFloat4(ny, LoadFloat4(y + i))),
+          AddFloat4(MulFloat4(nz, LoadFloat4(z + i)), d));
+      const Float4 magnitude = MaxFloat4(distance, SubFloat4(zero, distance));
+      // Invalid and claimed samples have a negative threshold.
+      total = AddInt4(total, AndInt4(LessFloat4(magnitude, LoadFloat4(threshold + i)), one));
+    }
+  }
+  std::int32_t lanes[4];
+  StoreInt4(lanes, total);
+  return static_cast<std::size_t>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+
+bool PlaneDetector::makeHypothesis(Plane *out) {
+  if (candidates_.empty()) {
+    return false;
+  }
+  const auto pick_neighbour = [&](int gx, int gy, std::size_t self) -> std::size_t {
+    const std::uint32_t span = 2 * kNeighbourhoodCells + 1;
+    for (int attempt = 0; attempt < kNeighbourAttempts; ++attempt) {
+      const int nx = gx + static_cast<int>(rng_() % span) - kNeighbourhoodCells;
+      const int ny = gy + static_cast<int>(rng_() % span) - kNeighbourhoodCells;
+      if (nx < 0 || ny < 0 || nx >= grid_width_ || ny >= grid_height_) {
+        continue;
+      }
+      const std::size_t index = static_cast<std::size_t>(ny) * grid_width_ + nx;
+      if (index != self && threshold_[index] >= 0.0f) {
+        return index;
+      }
+    }
+    return self;
+  };
+
+  for (int attempt = 0; attempt < kHypothesisAttempts; ++attempt) {
+    const std::size_t i = candidates_[rng_() % candidates_.size()];
+    const int gx = static_cast<int>(i % grid_width_);
+    const int gy = static_cast<int>(i / grid_width_);
+    const std::size_t j = pick_neighbour(gx, gy, i);
+    const std::size_t k = pick_neighbour(gx, gy, i);
+    if (j == i || k == i || j == k) {
+      continue;
+    }
+    const float e1[3] = {x_[j] - x_[i], y_[j] - y_[i], z_[j] - z_[i]};
+    const float e2[3] = {x_[k] - x_[i], y_[k] - y_[i], z_[k] - z_[i]};
+    const float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+    const float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    const float spread = std::sqrt((e1[0] * e1[0] + e1[1] * e1[1] + e1[2] * e1[2]) *
+                                   (e2[0] * e2[0] + e2[1] * e2[1] + e2[2] * e2[2]));
+    if (!(length > kMinSine * spread)) {
+      continue;
+    }
+    float scale = 1.0f / length;
+    float d = -(n[0] * x_[i] + n[1] * y_[i] + n[2] * z_[i]) * scale;
+    if (d < 0.0f) {
+      scale = -scale;
+      d = -d;
+    }
+    *out = Plane();
+    out->n[0] = n[0] * scale;
+    out->n[1] = n[1] * scale;
+    out->n[2] = n[2] * scale;
+    out->d = d;
+    return true;
+  }
+  return false;
+}
+
+bool PlaneDetector::searchPlane(const std::vector<Plane> &seeds, const PlaneDetectionOptions &options,
+                                std::size_t min_samples, Plane *out) {
+  std::vector<Plane> hypotheses = seeds;
+  const std::size_t wanted = seeds.size() + static_cast<std::size_t>(std::max(1, options.hypotheses));
+  Plane plane;
+  while (hypotheses.size() < wanted && makeHypothesis(&plane)) {
+    hypotheses.push_back(plane);
+  }
+  if (hypotheses.empty()) {
+    return false;
+  }
+  stats_.hypotheses += hypotheses.size();
+
+  const std::size_t blocks = block_order_.size();
+  const std::size_t stage_end[3] = {std::min(blocks, kStageBlocks[0]), std::min(blocks, kStageBlocks[1]), blocks};
+  std::vector<std::size_t> scores(hypotheses.size(), 0);
+  std::vector<std::uint32_t> survivors(hypotheses.size());
+  std::iota(survivors.begin(), survivors.end(), 0u);
+  // Ties go to the earlier hypothesis, so seeds win them and the result does
+  // not depend on how the pool split the work.
+  const auto better = [&](std::uint32_t a, std::uint32_t b) {
+    return scores[a] != scores[b] ? scores[a] > scores[b] : a < b;
+  };
+  std::size_t scored = 0;
+  for (int stage = 0; stage < 3; ++stage) {
+    const std::size_t end = stage_end[stage];
+    if (end > scored) {
+      SharedThreadPool().parallelFor(static_cast<int>(survivors.size()), 4, max_threads_, [&](int begin, int finish) {
+        for (int s = begin; s < finish; ++s) {
+          const std::uint32_t h = survivors[static_cast<std::size_t>(s)];
+          scores[h] += countInliers(hypotheses[h], scored, end);
+        }
+      });
+      stats_.point_tests += survivors.size() * (end - scored) * kBlockPoints;
+      scored = end;
+    }
+    const std::size_t keep = std::max(kMinSurvivors, hypotheses.size() >> (kStageShift * (stage + 1)));
+    if (stage < 2 && survivors.size() > keep) {
+      std::partial_sort(survivors.begin(), survivors.begin() + static_cast<std::ptrdiff_t>(keep), survivors.end(),
+                        better);
+      survivors.resize(keep);
+    }
+  }
+  const std::uint32_t best = *std::min_element(survivors.begin(), survivors.end(), better);
+  if (scores[best] < min_samples) {
+    return false;
+  }
+  *out = hypotheses[best];
+  out->samples = scores[best];
+  return true;
+}
+
+std::size_t PlaneDetector::refine(Plane *plane) {
+  double sum[3] = {0.0, 0.0, 0.0};
+  double products[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+  std::size_t count = 0;
+  const std::size_t samples = static_cast<std::size_t>(grid_width_) * grid_height_;
+  for (std::size_t i = 0; i < samples; ++i) {
+    const float distance = plane->n[0] * x_[i] + plane->n[1] * y_[i] + plane->n[2] * z_[i] + plane->d;
+    if (!(std::fabs(distance) < threshold_[i])) {
+      continue;
+    }
+    const double p[3] = {x_[i], y_[i], z_[i]};
+    sum[0] += p[0];
+    sum[1] += p[1];
+    sum[2] += p[2];
+    products[0] += p[0] * p[0];
+    products[1] += p[0] * p[1];
+    products[2] += p[0] * p[2];
+    products[3] += p[1] * p[1];
+    products[4] += p[1] * p[2];
+    products[5] += p[2] * p[2];
+    ++count;
+  }
+  if (count < 3) {
+    return count;
+  }
+  const double inv = 1.0 / static_cast<double>(count);
+  const double mean[3] = {sum[0] * inv, sum[1] * inv, sum[2] * inv};
+  const double covariance[6] = {
+      products[0] * inv - mean[0] * mean[0], products[1] * inv - mean[0] * mean[1],
+      products[2] * inv - mean[0] * mean[2], products[3] * inv - mean[1] * mean[1],
+      products[4] * inv - mean[1] * mean[2], products[5] * inv - mean[2] * mean[2],
+  };
+  double n[3] = {0.0, 0.0, 0.0};
+  if (SmallestEigenvector(covariance, n)) {
+    double d = -(n[0] * mean[0] + n[1] * mean[1] + n[2] * mean[2]);
+    const double sign = d < 0.0 ? -1.0 : 1.0;
+    for (int k = 0; k < 3; ++k) {
+      plane->n[k] = static_cast<float>(n[k] * sign);
+    }
+    plane->d = static_cast<float>(d * sign);
+  }
+  for (int k = 0; k < 3; ++k) {
+    plane->centroid[k] = static_cast<float>(mean[k]);
+  }
+  return count;
+}
+
+std::size_t PlaneDetector::claim(const Plane &plane) {
+  std::size_t count = 0;
+  const std::size_t samples = static_cast<std::size_t>(grid_width_) * grid_height_;
+  for (std::size_t i = 0; i < samples; ++i) {
+    const float distance = plane.n[0] * x_[i] + plane.n[1] * y_[i] + plane.n[2] * z_[i] + plane.d;
+    if (std::fabs(distance) < threshold_[i]) {
+      threshold_[i] = -1.0f;
+      ++count;
+    }
+  }
+  candidates_.clear();
+  for (std::size_t i = 0; i < samples; ++i) {
+    if (threshold_[i] >= 0.0f) {
+      candidates_.push_back(static_cast<std::uint32_t>(i));
+    }
+  }
+  return count;
+}
+
+void PlaneDetector::labelPixels(const std::uint16_t *depth, const RayTable &rays,
+                                const PlaneDetectionOptions &options, PlaneSet *set) {
+  KINECT_TRACE_SCOPE("planes.label");
+  const int width = rays.width();
+  const int height = rays.height();
+  const std::size_t plane_count = set->planes.size();
+  set->labels.resize(static_cast<std::size_t>(width) * height);
+  const int bands = (height + kLabelBandRows - 1) / kLabelBandRows;
+  std::vector<std::size_t> band_pixels(static_cast<std::size_t>(bands) * plane_count, 0);
+  const float tolerance = options.inlier_distance_mm * 0.001f;
+  const float min_mm = options.min_depth_mm;
+  const float max_mm = options.max_depth_mm;
+
+  SharedThreadPool().parallelFor(bands, 1, max_threads_, [&](int begin, int end) {
+    const Float4 scale = SplatFloat4(0.001f);
+    const Float4 lowest = SplatFloat4(min_mm);
+    const Float4 highest = SplatFloat4(max_mm);
+    const Float4 one = SplatFloat4(1.0f);
+    const Float4 tolerance4 = SplatFloat4(tolerance);
+    const Float4 zero = SplatFloat4(0.0f);
+    const Float4 invalid = SplatFloat4(-1.0f);
+    for (int band = begin; band < end; ++band) {
+      std::size_t *pixels = band_pixels.data() + static_cast<std::size_t>(band) * plane_count;
+      const int last_row = std::min(height, (band + 1) * kLabelBandRows);
+      for (int v = band * kLabelBandRows; v < last_row; ++v) {
+        const std::size_t row = static_cast<std::size_t>(v) * width;
+        const std::uint16_t *depth_row = depth + row;
+        const float *ray_x = rays.x() + row;
+        const float *ray_y = rays.y() + row;
+        std::uint8_t *labels = set->labels.data() + row;
+        int u = 0;
+        for (; u + 4 <= width; u += 4) {
+          const Float4 mm = IntToFloat4(LoadU16AsInt4(depth_row + u));
+          const Int4 valid = AndInt4(GreaterEqualFloat4(mm, lowest), GreaterEqualFloat4(highest, mm));
+          const Float4 z = MulFloat4(mm, scale);
+          const Float4 x = MulFloat4(LoadFloat4(ray_x + u), z);
+          const Float4 y = MulFloat4(LoadFloat4(ray_y + u), z);
+          const Float4 threshold =
+              SelectFloat4(valid, MulFloat4(tolerance4, MaxFloat4(one, MulFloat4(z, z))), invalid);
+          // Later planes first, so the earliest match is the one left.
+          Int4 label = SplatInt4(0);
+          for (std::size_t k = plane_count; k-- > 0;) {
+            const DetectedPlane &plane = set->planes[k];
+            const Float4 distance =
+                AddFloat4(AddFloat4(MulFloat4(SplatFloat4(plane.normal[0]), x), MulFloat4(SplatFloat4(plane.normal[1]), y)),
+                          AddFloat4(MulFloat4(SplatFloat4(plane.normal[2]), z), SplatFloat4(plane.distance)));
+            const Float4 magnitude = MaxFloat4(distance, SubFloat4(zero, distance));
+            label = SelectInt4(LessFloat4(magnitude, threshold), SplatInt4(static_cast<std::int32_t>(k + 1)), label);
+          }
+          std::int32_t lanes[4];
+          StoreInt4(lanes, label);
+          for (int lane = 0; lane < 4; ++lane) {
+            labels[u + lane] = static_cast<std::uint8_t>(lanes[lane]);
+            if (lanes[lane] > 0) {
+              ++pixels[lanes[lane] - 1];
+            }
+          }
+        }
+        for (; u < width; ++u) {
+          const float mm = depth_row[u];
+          labels[u] = 0;
+          if (mm < min_mm || mm > max_mm) {
+            continue;
+          }
+          const float z = mm * 0.001f;
+          const float x = ray_x[u] * z;
+          const float y = ray_y[u] * z;
+          const float threshold = tolerance * std::max(1.0f, z * z);
+          for (std::size_t k = 0; k < plane_count; ++k) {
+            const DetectedPlane &plane = set->planes[k];
+            const float distance = plane.normal[0] * x + plane.normal[1] * y + plane.normal[2] * z + plane.distance;
+            if (std::fabs(distance) < threshold) {
+              labels[u] = static_cast<std::uint8_t>(k + 1);
+              ++pixels[k];
+              break;
+            }
+          }
+        }
+      }
+    }
+  });
+
+  for (int band = 0; band < bands; ++band) {
+    for (std::size_t k = 0; k < plane_count; ++k) {
+      set->planes[k].pixels += band_pixels[static_cast<std::size_t>(band) * plane_count + k];
+    }
+  }
+}
+
+std::shared_ptr<const PlaneSet> PlaneDetector::detect(const std::uint16_t *depth, const RayTable &rays) {
+  KINECT_TRACE_SCOPE("planes.detect");
+  PlaneDetectionOptions options;
+  bool reset = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    options = options_;
+    reset = reset_pending_;
+    reset_pending_ = false;
+  }
+  if (reset) {
+    prior_.clear();
+    rng_.seed(options.seed);
+  }
+  stats_ = PlaneDetectionStats();
+  max_threads_ = options.threads;
+
+  std::shared_ptr<PlaneSet> set;
+  for (const auto &candidate : sets_) {
+    if (candidate.use_count() == 1) {
+      set = candidate;
+      break;
+    }
+  }
+  if (set == nullptr) {
+    set = std::make_shared<PlaneSet>();
+    if (sets_.size() < kSetPoolSize) {
+      sets_.push_back(set);
+    }
+  }
+  set->width = rays.width();
+  set->height = rays.height();
+  set->planes.clear();
+  set->floor = -1;
+  set->labels.clear();
+  if (rays.empty()) {
+    return set;
+  }
+
+  gatherSamples(depth, rays, options);
+  candidates_.clear();
+  const std::size_t samples = static_cast<std::size_t>(grid_width_) * grid_height_;
+  for (std::size_t i = 0; i < samples; ++i) {
+    if (threshold_[i] >= 0.0f) {
+      candidates_.push_back(static_cast<std::uint32_t>(i));
+    }
+  }
+  const std::size_t min_samples = std::max<std::size_t>(
+      3, static_cast<std::size_t>(std::ceil(options.min_plane_fraction * static_cast<float>(candidates_.size()))));
+  const std::size_t max_planes = static_cast<std::size_t>(std::max(0, std::min(kMaxPlanes, options.max_planes)));
+
+  // Last frame's planes, largest first: kept outright when they still hold
+  // most of their support, otherwise offered as seeds to the random search.
+  std::vector<Plane> planes;
+  std::vector<Plane> seeds;
+  if (options.temporal_prior) {
+    std::vector<DetectedPlane> prior = prior_;
+    std::stable_sort(prior.begin(), prior.end(),
+                     [](const DetectedPlane &a, const DetectedPlane &b) { return a.samples > b.samples; });
+    for (const DetectedPlane &previous : prior) {
+      Plane plane;
+      std::copy(previous.normal, previous.normal + 3, plane.n);
+      plane.d = previous.distance;
+      plane.id = previous.id;
+      plane.age = previous.age;
+      if (planes.size() < max_planes) {
+        const std::size_t support = countInliers(plane, 0, block_order_.size());
+        stats_.point_tests += block_order_.size() * kBlockPoints;
+        if (support >= min_samples &&
+            static_cast<float>(support) >= options.prior_keep_fraction * static_cast<float>(previous.samples)) {
+          refine(&plane);
+          plane.samples = claim(plane);
+          if (plane.samples >= min_samples) {
+            ++plane.age;
+            planes.push_back(plane);
+            ++stats_.priors_kept;
+            continue;
+          }
+        }
+      }
+      seeds.push_back(plane);
+    }
+  }
+
+  Plane plane;
+  while (planes.size() < max_planes && searchPlane(seeds, options, min_samples, &plane)) {
+    refine(&plane);
+    plane.samples = claim(plane);
+    if (plane.samples < min_samples) {
+      break;
+    }
+    plane.id = 0;
+    plane.age = 1;
+    for (auto seed = seeds.begin(); seed != seeds.end(); ++seed) {
+      const float cos_angle = seed->n[0] * plane.n[0] + seed->n[1] * plane.n[1] + seed->n[2] * plane.n[2];
+      if (cos_angle > kMatchCos && std::fabs(seed->d - plane.d) < kMatchDistance) {
+        plane.id = seed->id;
+        plane.age = seed->age + 1;
+        seeds.erase(seed);
+        break;
+      }
+    }
+    if (plane.id == 0) {
+      plane.id = next_id_++;
+    }
+    planes.push_back(plane);
+  }
+
+  float up[3] = {options.up[0], options.up[1], options.up[2]};
+  const float up_length = std::sqrt(up[0] * up[0] + up[1] * up[1] + up[2] * up[2]);
+  const float min_cos = static_cast<float>(std::cos(options.floor_max_tilt_deg * kPi / 180.0));
+  for (const Plane &found : planes) {
+    DetectedPlane out;
+    std::copy(found.n, found.n + 3, out.normal);
+    out.distance = found.d;
+    std::copy(found.centroid, found.centroid + 3, out.centroid);
+    out.samples = found.samples;
+    out.id = found.id;
+    out.age = found.age;
+    if (up_length > 0.0f) {
+      const float cos_tilt = (out.normal[0] * up[0] + out.normal[1] * up[1] + out.normal[2] * up[2]) / up_length;
+      const DetectedPlane *floor = set->floorPlane();
+      if (cos_tilt >= min_cos && (floor == nullptr || out.distance > floor->distance)) {
+        set->floor = static_cast<int>(set->planes.size());
+      }
+    }
+    set->planes.push_back(out);
+  }
+  if (options.label_mask) {
+    labelPixels(depth, rays, options, set.get());
+  }
+  prior_ = set->planes;
+  return set;
+}
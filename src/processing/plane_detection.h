@@ -0,0 +1,147 @@
+#pragma once
+
+#include "processing/camera_model.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+
+struct PlaneDetectionOptions {
+  // Master switch for the backends; detect() itself ignores it.
+  bool enabled = false;
+  // Depth outside [min, max] millimetres is not part of any plane.
+  std::uint16_t min_depth_mm = 350;
+  std::uint16_t max_depth_mm = 6000;
+  // Hypotheses are scored on every |sample_step|-th pixel of every
+  // |sample_step|-th row.
+  int sample_step = 4;
+  int max_planes = 4;
+  // Smallest plane worth reporting, as a fraction of the sampled returns.
+  float min_plane_fraction = 0.04f;
+  // Point-to-plane distance still counted as on the plane, in millimetres at
+  // 1 m; it grows with depth squared beyond that, like the sensors' noise.
+  float inlier_distance_mm = 4.0f;
+  // Random hypotheses per plane. They are scored preemptively: all of them
+  // on a small random subset of the samples, the best quarter on a larger
+  // one, and only the best few on every sample.
+  int hypotheses = 192;
+  // The previous frame's planes are scored first; one that keeps this
+  // fraction of its support is refined and kept without a random search.
+  bool temporal_prior = true;
+  float prior_keep_fraction = 0.75f;
+  // Floor: the plane furthest below the camera whose normal is within
+  // |floor_max_tilt_deg| of |up| (camera coordinates, +y down the image).
+  float up[3] = {0.0f, -1.0f, 0.0f};
+  float floor_max_tilt_deg = 25.0f;
+  // Label every depth pixel with its plane.
+  bool label_mask = true;
+  // Shared pool threads to use, including the caller; 0 uses all of them.
+  int threads = 0;
+  std::uint32_t seed = 1;
+};
+
+struct DetectedPlane {
+  // n . p + d = 0 for camera-frame points p in metres. The unit normal faces
+  // the camera, so |distance| is the camera's height above the plane.
+  float normal[3] = {0.0f, 0.0f, 0.0f};
+  float distance = 0.0f;
+  float centroid[3] = {0.0f, 0.0f, 0.0f};
+  // Sampled points on the plane, and labelled pixels (0 without a mask).
+  std::size_t samples = 0;
+  std::size_t pixels = 0;
+  // Stable while the plane is tracked from frame to frame; |age| counts the
+  // frames it has been seen in.
+  std::uint32_t id = 0;
+  std::uint32_t age = 0;
+};
+
+// Per-frame result. Planes are listed in the order they claimed their
+// points; a pixel within reach of two planes belongs to the earlier one.
+struct PlaneSet {
+  int width = 0;
+  int height = 0;
+  std::vector<DetectedPlane> planes;
+  // Index into |planes|, -1 when no plane qualifies. Its normal is the
+  // measured "up" direction for gravity alignment.
+  int floor = -1;
+  // Plane index + 1 per depth pixel, 0 for none; empty without a mask.
+  std::vector<std::uint8_t> labels;
+
+  const DetectedPlane *floorPlane() const { return floor >= 0 ? &planes[static_cast<std::size_t>(floor)] : nullptr; }
+};
+
+struct PlaneDetectionStats {
+  std::size_t hypotheses = 0;
+  // Point-to-plane tests run while scoring, the cost the preemptive scheme
+  // keeps down.
+  std::size_t point_tests = 0;
+  std::size_t priors_kept = 0;
+};
+
+// RANSAC plane detection on a depth frame. Hypotheses come from three
+// nearby samples, which are far more likely to share a surface than three
+// anywhere in the image, and are scored four points at a time over the
+// subsampled cloud. Accepted planes are refitted by least squares and their
+// points removed before the next search. Results are handed out like
+// DepthPyramidBuilder's. setOptions() may be called from another thread than
+// detect().
+class PlaneDetector {
+ public:
+  PlaneDetector();
+  ~PlaneDetector();
+  PlaneDetector(const PlaneDetector &) = delete;
+  PlaneDetector &operator=(const PlaneDetector &) = delete;
+
+  void setOptions(const PlaneDetectionOptions &options);
+  PlaneDetectionOptions options() const;
+  bool enabled() const;
+
+  // Finds the planes of |depth| (rays.width() x rays.height(), millimetres).
+  std::shared_ptr<const PlaneSet> detect(const std::uint16_t *depth, const RayTable &rays);
+  // Forgets the temporal prior, e.g. after a cut in the stream.
+  void reset();
+
+  // Counts from the last detect().
+  const PlaneDetectionStats &stats() const { return stats_; }
+
+ private:
+  struct Plane;
+
+  void gatherSamples(const std::uint16_t *depth, const RayTable &rays, const PlaneDetectionOptions &options);
+  std::size_t countInliers(const Plane &plane, std::size_t first_block, std::size_t end_block) const;
+  bool makeHypothesis(Plane *out);
+  bool searchPlane(const std::vector<Plane> &seeds, const PlaneDetectionOptions &options, std::size_t min_samples,
+                   Plane *out);
+  std::size_t refine(Plane *plane);
+  std::size_t claim(const Plane &plane);
+  void labelPixels(const std::uint16_t *depth, const RayTable &rays, const PlaneDetectionOptions &options,
+                   PlaneSet *set);
+
+  mutable std::mutex mutex_;
+  PlaneDetectionOptions options_;
+  PlaneDetectionStats stats_;
+  bool reset_pending_ = false;
+  std::mt19937 rng_;
+  std::uint32_t next_id_ = 1;
+
+  // Sampled cloud in grid order (metres), padded to whole blocks. A sample's
+  // threshold is its inlier distance, negative once it is invalid or claimed.
+  int grid_width_ = 0;
+  int grid_height_ = 0;
+  std::vector<float> x_;
+  std::vector<float> y_;
+  std::vector<float> z_;
+  std::vector<float> threshold_;
+  // Scoring visits blocks in this fixed random order, so any prefix of it is
+  // a spread-out subset of the frame.
+  std::vector<std::uint32_t> block_order_;
+  std::vector<std::uint32_t> candidates_;
+  std::vector<DetectedPlane> prior_;
+
+  std::vector<std::shared_ptr<PlaneSet>> sets_;
+  // options.threads of the call in progress.
+  int max_threads_ = 0;
+};
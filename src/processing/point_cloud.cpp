@@ -0,0 +1,269 @@
+#include "processing/point_cloud.h"
+#include "core/thread_pool.h"
+#include "core/trace.h"
+#include "processing/simd.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "binary PLY output assumes a little-endian host"
+#endif
+
+namespace {
+
+constexpr std::size_t kPlyVertexBytes = 3 * sizeof(float) + 3;
+// Worst case for one ASCII vertex: three shortest-form floats plus colour.
+constexpr std::size_t kPlyAsciiVertexChars = 3 * 16 + 3 * 4 + 2;
+constexpr std::size_t kMinPointsPerAsciiChunk = 16384;
+
+// Projects four pixels starting at |i|; returns a lane mask of valid depth.
+inline int ProjectBlock4(const std::uint16_t *depth, const float *ray_x, const float *ray_y, std::size_t i,
+                         float scale, std::uint16_t min_mm, std::uint16_t max_mm, float *x, float *y, float *z) {
+  const Int4 d = LoadU16AsInt4(depth + i);
+  // Zero-extended 16-bit values compare correctly as signed 32-bit.
+  const Int4 valid = AndInt4(GreaterInt4(d, SplatInt4(static_cast<int>(min_mm) - 1)),
+                             LessInt4(d, SplatInt4(static_cast<int>(max_mm) + 1)));
+  const int mask = MaskBits4(valid);
+  if (mask == 0) {
+    return 0;
+  }
+  const Float4 zv = MulFloat4(IntToFloat4(d), SplatFloat4(scale));
+  StoreFloat4(x, MulFloat4(LoadFloat4(ray_x + i), zv));
+  StoreFloat4(y, MulFloat4(LoadFloat4(ray_y + i), zv));
+  StoreFloat4(z, zv);
+  return mask;
+}
+
+class ColorSource {
+ public:
+  ColorSource(const std::uint8_t *rgb, const std::uint8_t *ir, const PointCloudOptions &options)
+      : rgb_(rgb), ir_(ir), min_mm_(options.min_depth_mm) {
+    const int span = std::max(1, static_cast<int>(options.max_depth_mm) - static_cast<int>(options.min_depth_mm));
+    ramp_scale_ = 255.0f / static_cast<float>(span);
+  }
+
+  void write(std::size_t index, std::uint16_t depth_mm, std::uint8_t *out) const {
+    if (rgb_ != nullptr) {
+      std::memcpy(out, rgb_ + index * 3, 3);
+      return;
+    }
+    std::uint8_t value = 0;
+    if (ir_ != nullptr) {
+      value = ir_[index];
+    } else {
+      const float t = static_cast<float>(depth_mm - min_mm_) * ramp_scale_;
+      value = static_cast<std::uint8_t>(255.0f - std::min(255.0f, std::max(0.0f, t)));
+    }
+    out[0] = value;
+    out[1] = value;
+    out[2] = value;
+  }
+
+ private:
+  const std::uint8_t *rgb_;
+  const std::uint8_t *ir_;
+  int min_mm_;
+  float ramp_scale_ = 0.0f;
+};
+
+std::string PlyHeader(const char *format, std::size_t vertices) {
+  std::string header = "ply\nformat ";
+  header += format;
+  header += " 1.0\nelement vertex ";
+  header += std::to_string(vertices);
+  header +=
+      "\nproperty float x\nproperty float y\nproperty float z\n"
+      "property uchar red\nproperty uchar green\nproperty uchar blue\nend_header\n";
+  return header;
+}
+
+bool WriteAll(std::FILE *file, const void *data, std::size_t size) {
+  return size == 0 || std::fwrite(data, 1, size, file) == size;
+}
+
+char *FormatAsciiVertex(char *cursor, char *end, const float *xyz, const std::uint8_t *rgb) {
+  for (int axis = 0; axis < 3; ++axis) {
+    cursor = std::to_chars(cursor, end, xyz[axis]).ptr;
+    *cursor++ = ' ';
+  }
+  for (int channel = 0; channel < 3; ++channel) {
+    cursor = std::to_chars(cursor, end, static_cast<unsigned>(rgb[channel])).ptr;
+    *cursor++ = channel == 2 ? '\n' : ' ';
+  }
+  return cursor;
+}
+
+}  // namespace
+
+void BackProjectDepth(const std::uint16_t *depth, const RayTable &rays, const std::uint8_t *rgb,
+                      const std::uint8_t *ir, const PointCloudOptions &options, PointCloud *out) {
+  KINECT_TRACE_SCOPE("pointcloud.back_project");
+  out->clear();
+  const std::size_t count = rays.size();
+  if (depth == nullptr || count == 0) {
+    return;
+  }
+
+  out->xyz.resize(count * 3);
+  out->rgb.resize(count * 3);
+  float *xyz = out->xyz.data();
+  std::uint8_t *color = out->rgb.data();
+  const ColorSource colors(rgb, ir, options);
+  const float scale = options.units_per_mm;
+  const float *ray_x = rays.x();
+  const float *ray_y = rays.y();
+
+  std::size_t points = 0;
+  std::size_t i = 0;
+  float x[4];
+  float y[4];
+  float z[4];
+  for (; i + 4 <= count; i += 4) {
+    const int mask =
+        ProjectBlock4(depth, ray_x, ray_y, i, scale, options.min_depth_mm, options.max_depth_mm, x, y, z);
+    if (mask == 0) {
+      continue;
+    }
+    for (int lane = 0; lane < 4; ++lane) {
+      if ((mask & (1 << lane)) == 0) {
+        continue;
+      }
+      float *dst = xyz + points * 3;
+      dst[0] = x[lane];
+      dst[1] = y[lane];
+      dst[2] = z[lane];
+      colors.write(i + lane, depth[i + lane], color + points * 3);
+      ++points;
+    }
+  }
+  for (; i < count; ++i) {
+    const std::uint16_t d = depth[i];
+    if (d < options.min_depth_mm || d > options.max_depth_mm) {
+      continue;
+    }
+    const float zl = static_cast<float>(d) * scale;
+    float *dst = xyz + points * 3;
+    dst[0] = ray_x[i] * zl;
+    dst[1] = ray_y[i] * zl;
+    dst[2] = zl;
+    colors.write(i, d, color + points * 3);
+    ++points;
+  }
+
+  out->xyz.resize(points * 3);
+  out->rgb.resize(points * 3);
+}
+
+void BackProjectOrganized(const std::uint16_t *depth, const RayTable &rays, const PointCloudOptions &options,
+                          OrganizedPointCloud *out) {
+  KINECT_TRACE_SCOPE("pointcloud.back_project_organized");
+  const std::size_t count = rays.size();
+  out->width = rays.width();
+  out->height = rays.height();
+  out->x.resize(count);
+  out->y.resize(count);
+  out->z.resize(count);
+  if (depth == nullptr) {
+    std::fill(out->z.begin(), out->z.end(), 0.0f);
+    std::fill(out->x.begin(), out->x.end(), 0.0f);
+    std::fill(out->y.begin(), out->y.end(), 0.0f);
+    return;
+  }
+
+  const float scale = options.units_per_mm;
+  const float *ray_x = rays.x();
+  const float *ray_y = rays.y();
+  float *x = out->x.data();
+  float *y = out->y.data();
+  float *z = out->z.data();
+  const Int4 low = SplatInt4(static_cast<int>(options.min_depth_mm) - 1);
+  const Int4 high = SplatInt4(static_cast<int>(options.max_depth_mm) + 1);
+  const Float4 scale4 = SplatFloat4(scale);
+  const Float4 zero = SplatFloat4(0.0f);
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const Int4 d = LoadU16AsInt4(depth + i);
+    const Int4 valid = AndInt4(GreaterInt4(d, low), LessInt4(d, high));
+    const Float4 zv = SelectFloat4(valid, MulFloat4(IntToFloat4(d), scale4), zero);
+    StoreFloat4(x + i, MulFloat4(LoadFloat4(ray_x + i), zv));
+    StoreFloat4(y + i, MulFloat4(LoadFloat4(ray_y + i), zv));
+    StoreFloat4(z + i, zv);
+  }
+  for (; i < count; ++i) {
+    const std::uint16_t d = depth[i];
+    const float zl = d < options.min_depth_mm || d > options.max_depth_mm ? 0.0f : static_cast<float>(d) * scale;
+    x[i] = ray_x[i] * zl;
+    y[i] = ray_y[i] * zl;
+    z[i] = zl;
+  }
+}
+
+bool WritePointCloudPly(const std::string &path, const PointCloud &cloud, PlyFormat format, int threads) {
+  KINECT_TRACE_SCOPE("pointcloud.write_ply");
+  const std::size_t points = cloud.size();
+  if (cloud.rgb.size() < points * 3) {
+    std::cerr << "[pointcloud] colour plane does not match " << points << " points\n";
+    return false;
+  }
+
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    std::cerr << "[pointcloud] could not open " << path << "\n";
+    return false;
+  }
+
+  bool ok = true;
+  if (format == PlyFormat::kBinaryLittleEndian) {
+    const std::string header = PlyHeader("binary_little_endian", points);
+    std::vector<char> buffer(header.size() + points * kPlyVertexBytes);
+    std::memcpy(buffer.data(), header.data(), header.size());
+    char *cursor = buffer.data() + header.size();
+    for (std::size_t p = 0; p < points; ++p) {
+      std::memcpy(cursor, cloud.xyz.data() + p * 3, 3 * sizeof(float));
+      std::memcpy(cursor + 3 * sizeof(float), cloud.rgb.data() + p * 3, 3);
+      cursor += kPlyVertexBytes;
+    }
+    ok = WriteAll(file, buffer.data(), buffer.size());
+  } else {
+    const std::string header = PlyHeader("ascii", points);
+    const int workers = std::max(1, std::min<int>(SharedThreadPool().threadsFor(threads),
+                                                  static_cast<int>(points / kMinPointsPerAsciiChunk) + 1));
+    const std::size_t chunk = (points + workers - 1) / static_cast<std::size_t>(workers);
+
+    std::vector<std::vector<char>> text(static_cast<std::size_t>(workers));
+    auto format_chunk = [&](int worker) {
+      KINECT_TRACE_SCOPE("pointcloud.format_ascii");
+      const std::size_t begin = std::min(points, chunk * static_cast<std::size_t>(worker));
+      const std::size_t end = std::min(points, begin + chunk);
+      std::vector<char> &out = text[static_cast<std::size_t>(worker)];
+      out.resize((end - begin) * kPlyAsciiVertexChars);
+      char *cursor = out.data();
+      char *const limit = out.data() + out.size();
+      for (std::size_t p = begin; p < end; ++p) {
+        cursor = FormatAsciiVertex(cursor, limit, cloud.xyz.data() + p * 3, cloud.rgb.data() + p * 3);
+      }
+      out.resize(static_cast<std::size_t>(cursor - out.data()));
+    };
+
+    SharedThreadPool().parallelFor(workers, 1, threads, [&](int begin, int end) {
+      for (int worker = begin; worker < end; ++worker) {
+        format_chunk(worker);
+      }
+    });
+
+    ok = WriteAll(file, header.data(), header.size());
+    for (const std::vector<char> &part : text) {
+      ok = ok && WriteAll(file, part.data(), part.size());
+    }
+  }
+
+  ok = std::fclose(file) == 0 && ok;
+  if (!ok) {
+    std::cerr << "[pointcloud] write failed for " << path << "\n";
+  }
+  return ok;
+}
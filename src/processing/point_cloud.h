@@ -0,0 +1,64 @@
+#pragma once
+
+#include "processing/camera_model.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct PointCloudOptions {
+  // Depth outside [min, max] millimetres is treated as no return.
+  std::uint16_t min_depth_mm = 350;
+  std::uint16_t max_depth_mm = 6000;
+  // Output scale: 0.001 writes metres, 1 keeps millimetres.
+  float units_per_mm = 0.001f;
+};
+
+// Unorganized cloud of valid points: xyz interleaved as floats, rgb as bytes.
+struct PointCloud {
+  std::vector<float> xyz;
+  std::vector<std::uint8_t> rgb;
+
+  std::size_t size() const { return xyz.size() / 3; }
+  void clear() {
+    xyz.clear();
+    rgb.clear();
+  }
+};
+
+// Back-projects |depth| (rays.width() x rays.height(), millimetres) through the
+// ray table. Colour comes from |rgb| (RGB24 in depth pixel layout) when
+// given, else from |ir| (8-bit), else a grey ramp by distance. |out| keeps
+// its capacity across calls.
+void BackProjectDepth(const std::uint16_t *depth, const RayTable &rays, const std::uint8_t *rgb,
+                      const std::uint8_t *ir, const PointCloudOptions &options, PointCloud *out);
+
+// Organized cloud: one point per depth pixel, kept on the pixel grid so
+// neighbourhood queries (normals, ICP correspondences) stay constant-time.
+// x, y and z are separate planes in the options' units; z = 0 marks pixels
+// without a usable return (their x and y are 0 as well).
+struct OrganizedPointCloud {
+  int width = 0;
+  int height = 0;
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+
+  std::size_t size() const { return z.size(); }
+  bool valid(std::size_t index) const { return z[index] > 0.0f; }
+};
+
+// Back-projects every pixel of |depth| into |out|, four at a time. |out|
+// keeps its capacity across calls.
+void BackProjectOrganized(const std::uint16_t *depth, const RayTable &rays, const PointCloudOptions &options,
+                          OrganizedPointCloud *out);
+
+enum class PlyFormat {
+  kBinaryLittleEndian,
+  kAscii,
+};
+
+// Writes float x/y/z + uchar red/green/blue vertices. The binary file is
+// assembled in one buffer and written with a single call; ASCII output is
+// formatted in parallel chunks (|threads| = 0 uses every core).
+bool WritePointCloudPly(const std::string &path, const PointCloud &cloud, PlyFormat format, int threads = 0);
@@ -0,0 +1,431 @@
+#include "processing/registration.h"
+#include "core/trace.h"
+#include "processing/simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// libfreenect2's fixed scale factors for the v2 polynomial, which is defined
+// against the full 1920x1080 color image.
+constexpr float kPolynomialDepthQ = 0.01f;
+constexpr float kPolynomialColorQ = 0.002199f;
+constexpr int kPolynomialColorWidth = 1920;
+constexpr int kPolynomialColorHeight = 1080;
+// libfreenect's REG_X_VAL_SCALE.
+constexpr float kFreenectXScale = 256.0f;
+
+struct DepthToColorCache {
+  std::mutex mutex;
+  struct Entry {
+    DeviceCalibration calibration;
+    KinectGeneration generation;
+    int depth_width, depth_height, color_width, color_height;
+    std::shared_ptr<const DepthToColorTable> table;
+  };
+  std::vector<Entry> entries;
+};
+
+DepthToColorCache &GlobalDepthToColorCache() {
+  static DepthToColorCache cache;
+  return cache;
+}
+
+bool SameModel(const DepthToColorModel &a, const DepthToColorModel &b) {
+  return a.has_polynomial == b.has_polynomial && a.shift_d == b.shift_d && a.shift_m == b.shift_m &&
+         a.baseline_mm == b.baseline_mm && std::equal(a.mx, a.mx + 10, b.mx) && std::equal(a.my, a.my + 10, b.my);
+}
+
+// Terms in DepthToColorModel order: x3y0, x0y3, x2y1, x1y2, x2y0, x0y2, x1y1,
+// x1y0, x0y1, x0y0.
+float EvaluatePolynomial(const float *c, float x, float y) {
+  return x * x * x * c[0] + y * y * y * c[1] + x * x * y * c[2] + y * y * x * c[3] + x * x * c[4] + y * y * c[5] +
+         x * y * c[6] + x * c[7] + y * c[8] + c[9];
+}
+
+// Column offset of a depth pixel at |depth_mm| relative to infinity.
+inline float Parallax(const DepthToColorTable &table, int depth_mm) {
+  if (!table.shift_lut.empty()) {
+    return table.shift_lut[std::min<std::size_t>(static_cast<std::size_t>(depth_mm), table.shift_lut.size() - 1)];
+  }
+  return table.disparity / static_cast<float>(std::max(depth_mm, 1));
+}
+
+int DefaultDivisor(const DepthToColorTable &table, const RegistrationOptions &options) {
+  if (options.color_divisor > 0) {
+    return options.color_divisor;
+  }
+  return std::max(1, table.color_width / std::max(1, table.depth_width));
+}
+
+}  // namespace
+
+DepthToColorTable BuildDepthToColorTable(const RayTable &depth_rays, const CameraIntrinsics &depth,
+                                         const CameraIntrinsics &color, const DepthToColorModel &model) {
+  DepthToColorTable table;
+  if (depth_rays.empty() || !color.valid() || depth_rays.width() != depth.width ||
+      depth_rays.height() != depth.height) {
+    return table;
+  }
+  table.depth_width = depth.width;
+  table.depth_height = depth.height;
+  table.color_width = color.width;
+  table.color_height = color.height;
+  table.map_x.resize(depth_rays.size());
+  table.map_y.resize(depth_rays.size());
+
+  const bool polynomial = model.has_polynomial && model.shift_d != 0.0f;
+  table.disparity = (polynomial ? model.shift_m : model.baseline_mm) * color.fx;
+  // The polynomial works in native color pixels; a scaled color stream only
+  // rescales the final column and row.
+  const float sx = static_cast<float>(color.width) / static_cast<float>(kPolynomialColorWidth);
+  const float sy = static_cast<float>(color.height) / static_cast<float>(kPolynomialColorHeight);
+  const float native_fx = color.fx / sx;
+
+  for (std::size_t i = 0; i < depth_rays.size(); ++i) {
+    const float rx = depth_rays.x()[i];
+    const float ry = depth_rays.y()[i];
+    float row = 0.0f;
+    if (polynomial) {
+      const float mx = rx * depth.fx * kPolynomialDepthQ;
+      const float my = ry * depth.fy * kPolynomialDepthQ;
+      const float wx = EvaluatePolynomial(model.mx, mx, my);
+      const float wy = EvaluatePolynomial(model.my, mx, my);
+      table.map_x[i] = (wx / (native_fx * kPolynomialColorQ) - model.shift_m / model.shift_d) * color.fx + color.cx;
+      row = sy * wy / kPolynomialColorQ + color.cy;
+    } else {
+      table.map_x[i] = rx * color.fx + color.cx;
+      row = ry * color.fy + color.cy;
+    }
+    const float rounded = std::floor(row + 0.5f);
+    table.map_y[i] = rounded >= 0.0f && rounded < static_cast<float>(color.height) ? rounded : -1.0f;
+  }
+  return table;
+}
+
+DepthToColorTable BuildFreenectDepthToColorTable(int width, int height, const std::int32_t (*registration_table)[2],
+                                                 const std::int32_t *depth_to_rgb_shift, int shift_count,
+                                                 int target_offset) {
+  DepthToColorTable table;
+  if (width <= 0 || height <= 0 || registration_table == nullptr || depth_to_rgb_shift == nullptr ||
+      shift_count <= 0) {
+    return table;
+  }
+  table.depth_width = width;
+  table.depth_height = height;
+  table.color_width = width;
+  table.color_height = height;
+  const std::size_t count = static_cast<std::size_t>(width) * height;
+  table.map_x.resize(count);
+  table.map_y.resize(count);
+  // libfreenect subtracts the offset from the linear target index; split it
+  // into rows and columns so the pass can bounds-check each.
+  const int row_shift = target_offset / width;
+  const float column_shift = static_cast<float>(target_offset % width);
+  for (std::size_t i = 0; i < count; ++i) {
+    // libfreenect truncates the column; the pass rounds, so pre-subtract 0.5.
+    table.map_x[i] = static_cast<float>(registration_table[i][0]) / kFreenectXScale - column_shift - 0.5f;
+    const int row = registration_table[i][1] - row_shift;
+    table.map_y[i] = row >= 0 && row < height ? static_cast<float>(row) : -1.0f;
+  }
+  table.shift_lut.resize(static_cast<std::size_t>(shift_count));
+  for (int mm = 0; mm < shift_count; ++mm) {
+    table.shift_lut[mm] = static_cast<float>(depth_to_rgb_shift[mm]) / kFreenectXScale;
+  }
+  return table;
+}
+
+std::shared_ptr<const DepthToColorTable> CachedDepthToColorTable(const DeviceCalibration &calibration,
+                                                                 KinectGeneration generation, int depth_width,
+                                                                 int depth_height, int color_width,
+                                                                 int color_height) {
+  DepthToColorCache &cache = GlobalDepthToColorCache();
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    for (const DepthToColorCache::Entry &entry : cache.entries) {
+      if (entry.generation == generation && entry.depth_width == depth_width && entry.depth_height == depth_height &&
+          entry.color_width == color_width && entry.color_height == color_height &&
+          entry.calibration.serial == calibration.serial && entry.calibration.depth == calibration.depth &&
+          entry.calibration.color == calibration.color &&
+          SameModel(entry.calibration.depth_to_color, calibration.depth_to_color)) {
+        return entry.table;
+      }
+    }
+  }
+
+  KINECT_TRACE_SCOPE("registration.build_table");
+  const CameraIntrinsics depth = ResolveDepthIntrinsics(calibration, generation, depth_width, depth_height);
+  const CameraIntrinsics color = ResolveColorIntrinsics(calibration, generation, color_width, color_height);
+  const std::shared_ptr<const RayTable> rays =
+      CachedRayTable(depth, calibration.from_device ? calibration.serial : std::string());
+  auto table = std::make_shared<const DepthToColorTable>(
+      BuildDepthToColorTable(*rays, depth, color, calibration.depth_to_color));
+
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.entries.push_back({calibration, generation, depth_width, depth_height, color_width, color_height, table});
+  return table;
+}
+
+void RegisterDepthColor(const DepthToColorTable &table, const std::uint16_t *depth, const std::uint8_t *rgb,
+                        const RegistrationOptions &options, RegisteredFrame *out) {
+  const std::size_t count = static_cast<std::size_t>(table.depth_width) * table.depth_height;
+  const int divisor = DefaultDivisor(table, options);
+  const int grid_width = (table.color_width + divisor - 1) / divisor;
+  const int grid_height = (table.color_height + divisor - 1) / divisor;
+  out->depth_width = grid_width;
+  out->depth_height = grid_height;
+  out->depth.assign(static_cast<std::size_t>(grid_width) * grid_height, 0xFFFF);
+  out->rgb.resize(count * 3);
+  out->color_index.resize(count);
+  out->cell_index.resize(count);
+  if (count == 0) {
+    return;
+  }
+
+  const float *map_x = table.map_x.data();
+  const float *map_y = table.map_y.data();
+  std::int32_t *color_index = out->color_index.data();
+  std::int32_t *cell_index = out->cell_index.data();
+  std::uint16_t *zbuffer = out->depth.data();
+  const int min_mm = options.min_depth_mm;
+  const int max_mm = options.max_depth_mm;
+  const float color_w = static_cast<float>(table.color_width);
+  const float inv_divisor = 1.0f / static_cast<float>(divisor);
+  const float grid_w = static_cast<float>(grid_width);
+  const float *shift_lut = table.shift_lut.empty() ? nullptr : table.shift_lut.data();
+  const int shift_last = static_cast<int>(table.shift_lut.size()) - 1;
+
+  // Pass 1: color index and z-buffer cell of every depth pixel, four lanes at
+  // a time, scattering the nearest depth into the z-buffer as it goes.
+  {
+    KINECT_TRACE_SCOPE("registration.project");
+    const Int4 min_v = SplatInt4(min_mm - 1);
+    const Int4 max_v = SplatInt4(max_mm + 1);
+    const Int4 none = SplatInt4(-1);
+    const Float4 one = SplatFloat4(1.0f);
+    const Float4 zero = SplatFloat4(0.0f);
+    const Float4 half = SplatFloat4(0.5f);
+    const Float4 disparity = SplatFloat4(table.disparity);
+    const Float4 width_v = SplatFloat4(color_w);
+    const Float4 last_column = SplatFloat4(color_w - 1.0f);
+    const Float4 inv_div = SplatFloat4(inv_divisor);
+    const Float4 grid_w_v = SplatFloat4(grid_w);
+
+    const std::size_t blocks = count & ~static_cast<std::size_t>(3);
+    for (std::size_t i = 0; i < blocks; i += 4) {
+      const Int4 d = LoadU16AsInt4(depth + i);
+      const Int4 valid = AndInt4(GreaterInt4(d, min_v), LessInt4(d, max_v));
+      if (MaskBits4(valid) == 0) {
+        StoreInt4(color_index + i, none);
+        StoreInt4(cell_index + i, none);
+        continue;
+      }
+      Float4 parallax;
+      if (shift_lut != nullptr) {
+        // No gather on SSE2/NEON; the LUT is small enough to stay in cache.
+        float lanes[4];
+        for (int lane = 0; lane < 4; ++lane) {
+          lanes[lane] = shift_lut[std::min<int>(depth[i + lane], shift_last)];
+        }
+        parallax = LoadFloat4(lanes);
+      } else {
+        parallax = DivFloat4(disparity, MaxFloat4(IntToFloat4(d), one));
+      }
+      // +0.5 turns the truncating conversion into round-to-nearest for the
+      // (non-negative) columns that survive the bounds test.
+      const Float4 column = AddFloat4(AddFloat4(LoadFloat4(map_x + i), parallax), half);
+      const Float4 row = LoadFloat4(map_y + i);
+      const Int4 inside = AndInt4(AndInt4(valid, GreaterEqualFloat4(row, zero)),
+                                  AndInt4(GreaterEqualFloat4(column, zero), LessFloat4(column, width_v)));
+      // Clamp before converting so rejected lanes stay in range too.
+      const Float4 col = IntToFloat4(FloatToInt4(MinFloat4(MaxFloat4(column, zero), last_column)));
+      const Float4 r = MaxFloat4(row, zero);
+      const Int4 pixel = FloatToInt4(AddFloat4(MulFloat4(r, width_v), col));
+      const Float4 cell_row = IntToFloat4(FloatToInt4(MulFloat4(AddFloat4(r, half), inv_div)));
+      const Float4 cell_col = IntToFloat4(FloatToInt4(MulFloat4(AddFloat4(col, half), inv_div)));
+      const Int4 cell = FloatToInt4(AddFloat4(MulFloat4(cell_row, grid_w_v), cell_col));
+      StoreInt4(color_index + i, SelectInt4(inside, pixel, none));
+      StoreInt4(cell_index + i, SelectInt4(inside, cell, none));
+
+      for (std::size_t lane = i; lane < i + 4; ++lane) {
+        const std::int32_t target = cell_index[lane];
+        if (target >= 0 && depth[lane] < zbuffer[target]) {
+          zbuffer[target] = depth[lane];
+        }
+      }
+    }
+    for (std::size_t i = blocks; i < count; ++i) {
+      color_index[i] = -1;
+      cell_index[i] = -1;
+      const int d = depth[i];
+      if (d < min_mm || d > max_mm || map_y[i] < 0.0f) {
+        continue;
+      }
+      const float column = map_x[i] + Parallax(table, d) + 0.5f;
+      if (column < 0.0f || column >= color_w) {
+        continue;
+      }
+      const int col = static_cast<int>(column);
+      const int row = static_cast<int>(map_y[i]);
+      color_index[i] = row * table.color_width + col;
+      cell_index[i] = static_cast<int>((static_cast<float>(row) + 0.5f) * inv_divisor) * grid_width +
+                      static_cast<int>((static_cast<float>(col) + 0.5f) * inv_divisor);
+      if (depth[i] < zbuffer[cell_index[i]]) {
+        zbuffer[cell_index[i]] = depth[i];
+      }
+    }
+  }
+
+  // Pass 2: keep color only where this depth pixel is the surface the color
+  // camera sees.
+  {
+    KINECT_TRACE_SCOPE("registration.gather");
+    const int tolerance = options.occlusion_tolerance_mm;
+    std::uint8_t *dst = out->rgb.data();
+    for (std::size_t i = 0; i < count; ++i, dst += 3) {
+      const std::int32_t pixel = color_index[i];
+      if (pixel >= 0 && static_cast<int>(depth[i]) <= static_cast<int>(zbuffer[cell_index[i]]) + tolerance) {
+        std::memcpy(dst, rgb + static_cast<std::size_t>(pixel) * 3, 3);
+      } else {
+        dst[0] = dst[1] = dst[2] = 0;
+      }
+    }
+    for (std::uint16_t &z : out->depth) {
+      z = z == 0xFFFF ? 0 : z;
+    }
+  }
+}
+
+void AttachRegisteredFrame(const RegisteredFrame &registered, FrameData *frame) {
+  frame->registered_rgb = registered.rgb;
+  frame->registered_depth = registered.depth;
+  frame->registered_depth_width = registered.depth_width;
+  frame->registered_depth_height = registered.depth_height;
+}
+
+RegistrationWorker::~RegistrationWorker() {
+  stop();
+}
+
+void RegistrationWorker::start(const DeviceCalibration &calibration, KinectGeneration generation,
+                               StageTelemetry *stage, const RegistrationOptions &options) {
+  stop();
+  calibration_ = calibration;
+  generation_ = generation;
+  fixed_table_ = nullptr;
+  launch(stage, options);
+}
+
+void RegistrationWorker::start(std::shared_ptr<const DepthToColorTable> table, StageTelemetry *stage,
+                               const RegistrationOptions &options) {
+  stop();
+  calibration_ = DeviceCalibration();
+  fixed_table_ = std::move(table);
+  launch(stage, options);
+}
+
+void RegistrationWorker::launch(StageTelemetry *stage, const RegistrationOptions &options) {
+  stage_ = stage;
+  options_ = options;
+  stopping_ = false;
+  has_pending_ = false;
+  has_result_ = false;
+  dropped_ = 0;
+  thread_ = std::thread(&RegistrationWorker::run, this);
+}
+
+void RegistrationWorker::stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+}
+
+void RegistrationWorker::submit(std::vector<std::uint16_t> depth, int depth_width, int depth_height,
+                                std::vector<std::uint8_t> rgb, int color_width, int color_height,
+                                std::uint32_t timestamp) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (has_pending_) {
+      ++dropped_;
+    }
+    pending_.depth = std::move(depth);
+    pending_.rgb = std::move(rgb);
+    pending_.depth_width = depth_width;
+    pending_.depth_height = depth_height;
+    pending_.color_width = color_width;
+    pending_.color_height = color_height;
+    pending_.timestamp = timestamp;
+    has_pending_ = true;
+  }
+  wake_.notify_one();
+}
+
+bool RegistrationWorker::takeResult(RegisteredFrame *out) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!has_result_) {
+    return false;
+  }
+  std::swap(*out, result_);
+  has_result_ = false;
+  return true;
+}
+
+std::uint64_t RegistrationWorker::dropped() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_;
+}
+
+void RegistrationWorker::run() {
+  Job job;
+  RegisteredFrame frame;
+  std::shared_ptr<const DepthToColorTable> table;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    wake_.wait(lock, [this] { return stopping_ || has_pending_; });
+    if (stopping_) {
+      return;
+    }
+    std::swap(job, pending_);
+    has_pending_ = false;
+    lock.unlock();
+
+    if (fixed_table_ != nullptr) {
+      table = fixed_table_;
+    } else if (table == nullptr || table->depth_width != job.depth_width ||
+               table->depth_height != job.depth_height || table->color_width != job.color_width ||
+               table->color_height != job.color_height) {
+      table = CachedDepthToColorTable(calibration_, generation_, job.depth_width, job.depth_height, job.color_width,
+                                      job.color_height);
+    }
+    const std::size_t depth_pixels = static_cast<std::size_t>(job.depth_width) * job.depth_height;
+    const std::size_t color_bytes = static_cast<std::size_t>(job.color_width) * job.color_height * 3;
+    const bool usable = !table->empty() && table->depth_width == job.depth_width &&
+                        table->depth_height == job.depth_height && table->color_width == job.color_width &&
+                        table->color_height == job.color_height && job.depth.size() >= depth_pixels &&
+                        job.rgb.size() >= color_bytes;
+    if (usable) {
+      KINECT_TRACE_SCOPE("registration.apply");
+      const std::uint64_t begin = TelemetryNowNs();
+      RegisterDepthColor(*table, job.depth.data(), job.rgb.data(), options_, &frame);
+      frame.timestamp = job.timestamp;
+      if (stage_ != nullptr) {
+        stage_->record(TelemetryNowNs() - begin);
+      }
+    }
+
+    lock.lock();
+    if (usable) {
+      std::swap(result_, frame);
+      has_result_ = true;
+    }
+  }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "processing/camera_model.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Depth-to-color lookup for one device and pair of stream sizes. Depth pixel i
+// at z millimetres lands in color column
+//   map_x[i] + disparity / z        (or map_x[i] + shift_lut[z])
+// and row map_y[i] (already rounded; -1 when outside the color image). Both
+// Kinect models reduce to this form: the v2 factory polynomial folds into
+// map_x/map_y as in libfreenect2, a plain stereo pair uses the undistorted
+// depth ray and its baseline, and libfreenect's registration block supplies
+// the per-millimetre shift table directly.
+struct DepthToColorTable {
+  int depth_width = 0;
+  int depth_height = 0;
+  int color_width = 0;
+  int color_height = 0;
+  // Color column at infinite depth and row, per depth pixel.
+  std::vector<float> map_x;
+  std::vector<float> map_y;
+  // Parallax in pixel-millimetres, used when |shift_lut| is empty.
+  float disparity = 0.0f;
+  // Parallax in pixels indexed by depth in mm (clamped to the last entry).
+  std::vector<float> shift_lut;
+
+  bool empty() const { return map_x.empty(); }
+};
+
+DepthToColorTable BuildDepthToColorTable(const RayTable &depth_rays, const CameraIntrinsics &depth,
+                                         const CameraIntrinsics &color, const DepthToColorModel &model);
+
+// Table from libfreenect's registration block (freenect_registration):
+// |registration_table| holds the color x (1/256 pixel) and row of every depth
+// pixel, |depth_to_rgb_shift| the x shift (1/256 pixel) per millimetre, and
+// |target_offset| the linear index offset libfreenect subtracts
+// (DEPTH_Y_RES * pad start lines). The color image is width x height.
+DepthToColorTable BuildFreenectDepthToColorTable(int width, int height, const std::int32_t (*registration_table)[2],
+                                                 const std::int32_t *depth_to_rgb_shift, int shift_count,
+                                                 int target_offset);
+
+// Shared table for a device mode, built on first use (depth rays come from
+// CachedRayTable, so the undistortion is also reused across processes).
+std::shared_ptr<const DepthToColorTable> CachedDepthToColorTable(const DeviceCalibration &calibration,
+                                                                 KinectGeneration generation, int depth_width,
+                                                                 int depth_height, int color_width,
+                                                                 int color_height);
+
+struct RegistrationOptions {
+  // Depth outside [min, max] millimetres is treated as no return.
+  std::uint16_t min_depth_mm = 350;
+  std::uint16_t max_depth_mm = 8000;
+  // A depth pixel further than this behind the nearest surface seen by its
+  // color pixel is occluded from the color camera and left black.
+  std::uint16_t occlusion_tolerance_mm = 60;
+  // Color-aligned depth is produced at color size / divisor so it stays
+  // dense; 0 picks the divisor that makes it roughly depth sized (3 on v2).
+  int color_divisor = 0;
+};
+
+struct RegisteredFrame {
+  // Color sampled at each depth pixel, RGB24 in depth layout.
+  std::vector<std::uint8_t> rgb;
+  // Nearest depth seen through each (downscaled) color pixel, 0 = none.
+  std::vector<std::uint16_t> depth;
+  int depth_width = 0;
+  int depth_height = 0;
+  std::uint32_t timestamp = 0;
+
+  // Per depth pixel color index and z-buffer cell (-1 = none); scratch kept
+  // so repeated calls do not allocate.
+  std::vector<std::int32_t> color_index;
+  std::vector<std::int32_t> cell_index;
+};
+
+// Projects every depth pixel four at a time while scattering a z-buffer of
+// the nearest depth per color cell, then gathers color for the depth pixels
+// that are the visible surface. |rgb| is RGB24 at the table's color size.
+void RegisterDepthColor(const DepthToColorTable &table, const std::uint16_t *depth, const std::uint8_t *rgb,
+                        const RegistrationOptions &options, RegisteredFrame *out);
+
+// Copies the registered planes into the FrameData::registered_* fields.
+void AttachRegisteredFrame(const RegisteredFrame &registered, FrameData *frame);
+
+// Runs registration on its own thread so the capture loop only pays for a
+// hand-off. submit() never waits for the pass: a pair that arrives while the
+// worker is busy replaces the one still queued.
+class RegistrationWorker {
+ public:
+  RegistrationWorker() = default;
+  ~RegistrationWorker();
+  RegistrationWorker(const RegistrationWorker &) = delete;
+  RegistrationWorker &operator=(const RegistrationWorker &) = delete;
+
+  // |stage| (optional) receives the duration of every pass.
+  void start(const DeviceCalibration &calibration, KinectGeneration generation, StageTelemetry *stage = nullptr,
+             const RegistrationOptions &options = RegistrationOptions());
+  // Uses a driver-supplied |table|; pairs of other sizes are skipped.
+  void start(std::shared_ptr<const DepthToColorTable> table, StageTelemetry *stage = nullptr,
+             const RegistrationOptions &options = RegistrationOptions());
+  void stop();
+  bool running() const { return thread_.joinable(); }
+
+  void submit(std::vector<std::uint16_t> depth, int depth_width, int depth_height, std::vector<std::uint8_t> rgb,
+              int color_width, int color_height, std::uint32_t timestamp);
+
+  // Swaps in the newest finished frame; false when none arrived since the
+  // last call.
+  bool takeResult(RegisteredFrame *out);
+
+  // Pairs replaced before the worker reached them.
+  std::uint64_t dropped() const;
+
+ private:
+  struct Job {
+    std::vector<std::uint16_t> depth;
+    std::vector<std::uint8_t> rgb;
+    int depth_width = 0;
+    int depth_height = 0;
+    int color_width = 0;
+    int color_height = 0;
+    std::uint32_t timestamp = 0;
+  };
+
+  void launch(StageTelemetry *stage, const RegistrationOptions &options);
+  void run();
+
+  DeviceCalibration calibration_;
+  KinectGeneration generation_ = KinectGeneration::kV1;
+  std::shared_ptr<const DepthToColorTable> fixed_table_;
+  RegistrationOptions options_;
+  StageTelemetry *stage_ = nullptr;
+
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  Job pending_;
+  bool has_pending_ = false;
+  RegisteredFrame result_;
+  bool has_result_ = false;
+  bool stopping_ = false;
+  std::uint64_t dropped_ = 0;
+  std::thread thread_;
+};
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Four-lane float/int32 helpers over NEON (Apple Silicon), SSE2 (x86-64) or
+// plain arrays elsewhere. Masks are Int4 with every bit of a lane set.
+// Only operations the processing kernels need are provided; keep additions
+// cheap on both instruction sets (SSE2 has no 32-bit multiply or blend).
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define KINECT_SIMD_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define KINECT_SIMD_SSE2 1
+#endif
+
+#if defined(KINECT_SIMD_NEON)
+
+using Float4 = float32x4_t;
+using Int4 = int32x4_t;
+
+inline Float4 LoadFloat4(const float *p) { return vld1q_f32(p); }
+inline void StoreFloat4(float *p, Float4 v) { vst1q_f32(p, v); }
+inline Float4 SplatFloat4(float v) { return vdupq_n_f32(v); }
+inline Float4 AddFloat4(Float4 a, Float4 b) { return vaddq_f32(a, b); }
+inline Float4 SubFloat4(Float4 a, Float4 b) { return vsubq_f32(a, b); }
+inline Float4 MulFloat4(Float4 a, Float4 b) { return vmulq_f32(a, b); }
+inline Float4 DivFloat4(Float4 a, Float4 b) { return vdivq_f32(a, b); }
+inline Float4 MinFloat4(Float4 a, Float4 b) { return vminq_f32(a, b); }
+inline Float4 MaxFloat4(Float4 a, Float4 b) { return vmaxq_f32(a, b); }
+inline Int4 LessFloat4(Float4 a, Float4 b) { return vreinterpretq_s32_u32(vcltq_f32(a, b)); }
+inline Int4 GreaterEqualFloat4(Float4 a, Float4 b) { return vreinterpretq_s32_u32(vcgeq_f32(a, b)); }
+inline Float4 SelectFloat4(Int4 mask, Float4 a, Float4 b) { return vbslq_f32(vreinterpretq_u32_s32(mask), a, b); }
+// Rows become columns: r0 = {r0[0], r1[0], r2[0], r3[0]} and so on.
+inline void Transpose4(Float4 &r0, Float4 &r1, Float4 &r2, Float4 &r3) {
+  const float32x4x2_t t01 = vtrnq_f32(r0, r1);
+  const float32x4x2_t t23 = vtrnq_f32(r2, r3);
+  r0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+  r1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+  r2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+  r3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+
+inline Int4 LoadInt4(const std::int32_t *p) { return vld1q_s32(p); }
+inline void StoreInt4(std::int32_t *p, Int4 v) { vst1q_s32(p, v); }
+inline Int4 SplatInt4(std::int32_t v) { return vdupq_n_s32(v); }
+inline Int4 LoadU16AsInt4(const std::uint16_t *p) { return vreinterpretq_s32_u32(vmovl_u16(vld1_u16(p))); }
+// Saturates to [0, 65535].
+inline void StoreInt4AsU16(std::uint16_t *p, Int4 v) { vst1_u16(p, vqmovun_s32(v)); }
+// Eight uint16 as four lanes of (p[2i + 1] << 16 | p[2i]).
+inline Int4 LoadU16PairsAsInt4(const std::uint16_t *p) { return vreinterpretq_s32_u16(vld1q_u16(p)); }
+template <int kBits>
+inline Int4 ShiftRightLogicalInt4(Int4 v) {
+  return vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(v), kBits));
+}
+template <int kBits>
+inline Int4 ShiftLeftInt4(Int4 v) {
+  return vshlq_n_s32(v, kBits);
+}
+inline Int4 AddInt4(Int4 a, Int4 b) { return vaddq_s32(a, b); }
+inline Int4 AndInt4(Int4 a, Int4 b) { return vandq_s32(a, b); }
+inline Int4 OrInt4(Int4 a, Int4 b) { return vorrq_s32(a, b); }
+inline Int4 GreaterInt4(Int4 a, Int4 b) { return vreinterpretq_s32_u32(vcgtq_s32(a, b)); }
+inline Int4 LessInt4(Int4 a, Int4 b) { return vreinterpretq_s32_u32(vcltq_s32(a, b)); }
+// mask ? a : b
+inline Int4 SelectInt4(Int4 mask, Int4 a, Int4 b) { return vbslq_s32(vreinterpretq_u32_s32(mask), a, b); }
+inline Float4 IntToFloat4(Int4 v) { return vcvtq_f32_s32(v); }
+// Truncates toward zero.
+inline Int4 FloatToInt4(Float4 v) { return vcvtq_s32_f32(v); }
+inline int MaskBits4(Int4 mask) {
+  static const std::int32_t kLaneBits[4] = {1, 2, 4, 8};
+  return static_cast<int>(vaddvq_s32(vandq_s32(mask, vld1q_s32(kLaneBits))));
+}
+
+#elif defined(KINECT_SIMD_SSE2)
+
+using Float4 = __m128;
+using Int4 = __m128i;
+
+inline Float4 LoadFloat4(const float *p) { return _mm_loadu_ps(p); }
+inline void StoreFloat4(float *p, Float4 v) { _mm_storeu_ps(p, v); }
+inline Float4 SplatFloat4(float v) { return _mm_set1_ps(v); }
+inline Float4 AddFloat4(Float4 a, Float4 b) { return _mm_add_ps(a, b); }
+inline Float4 SubFloat4(Float4 a, Float4 b) { return _mm_sub_ps(a, b); }
+inline Float4 MulFloat4(Float4 a, Float4 b) { return _mm_mul_ps(a, b); }
+inline Float4 DivFloat4(Float4 a, Float4 b) { return _mm_div_ps(a, b); }
+inline Float4 MinFloat4(Float4 a, Float4 b) { return _mm_min_ps(a, b); }
+inline Float4 MaxFloat4(Float4 a, Float4 b) { return _mm_max_ps(a, b); }
+inline Int4 LessFloat4(Float4 a, Float4 b) { return _mm_castps_si128(_mm_cmplt_ps(a, b)); }
+inline Int4 GreaterEqualFloat4(Float4 a, Float4 b) { return _mm_castps_si128(_mm_cmpge_ps(a, b)); }
+inline Float4 SelectFloat4(Int4 mask, Float4 a, Float4 b) {
+  const __m128 m = _mm_castsi128_ps(mask);
+  return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+inline void Transpose4(Float4 &r0, Float4 &r1, Float4 &r2, Float4 &r3) { _MM_TRANSPOSE4_PS(r0, r1, r2, r3); }
+
+inline Int4 LoadInt4(const std::int32_t *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+inline void StoreInt4(std::int32_t *p, Int4 v) { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v); }
+inline Int4 SplatInt4(std::int32_t v) { return _mm_set1_epi32(v); }
+inline Int4 LoadU16AsInt4(const std::uint16_t *p) {
+  return _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(p)), _mm_setzero_si128());
+}
+// SSE2 only packs with signed saturation, so bias into int16 range and back.
+inline void StoreInt4AsU16(std::uint16_t *p, Int4 v) {
+  const __m128i biased = _mm_sub_epi32(v, _mm_set1_epi32(32768));
+  const __m128i packed = _mm_xor_si128(_mm_packs_epi32(biased, biased), _mm_set1_epi16(static_cast<short>(0x8000)));
+  _mm_storel_epi64(reinterpret_cast<__m128i *>(p), packed);
+}
+inline Int4 LoadU16PairsAsInt4(const std::uint16_t *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+template <int kBits>
+inline Int4 ShiftRightLogicalInt4(Int4 v) {
+  return _mm_srli_epi32(v, kBits);
+}
+template <int kBits>
+inline Int4 ShiftLeftInt4(Int4 v) {
+  return _mm_slli_epi32(v, kBits);
+}
+inline Int4 AddInt4(Int4 a, Int4 b) { return _mm_add_epi32(a, b); }
+inline Int4 AndInt4(Int4 a, Int4 b) { return _mm_and_si128(a, b); }
+inline Int4 OrInt4(Int4 a, Int4 b) { return _mm_or_si128(a, b); }
+inline Int4 GreaterInt4(Int4 a, Int4 b) { return _mm_cmpgt_epi32(a, b); }
+inline Int4 LessInt4(Int4 a, Int4 b) { return _mm_cmplt_epi32(a, b); }
+inline Int4 SelectInt4(Int4 mask, Int4 a, Int4 b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+inline Float4 IntToFloat4(Int4 v) { return _mm_cvtepi32_ps(v); }
+inline Int4 FloatToInt4(Float4 v) { return _mm_cvttps_epi32(v); }
+inline int MaskBits4(Int4 mask) { return _mm_movemask_ps(_mm_castsi128_ps(mask)); }
+
+#else
+
+struct Float4 {
+  float v[4];
+};
+struct Int4 {
+  std::int32_t v[4];
+};
+
+#define KINECT_SIMD_LANES(expr)  \
+  for (int lane = 0; lane < 4; ++lane) { \
+    expr;                        \
+  }
+
+inline Float4 LoadFloat4(const float *p) {
+  Float4 r;
+  std::memcpy(r.v, p, sizeof(r.v));
+  return r;
+}
+inline void StoreFloat4(float *p, Float4 v) { std::memcpy(p, v.v, sizeof(v.v)); }
+inline Float4 SplatFloat4(float s) { Float4 r; KINECT_SIMD_LANES(r.v[lane] = s) return r; }
+inline Float4 AddFloat4(Float4 a, Float4 b) { Float4 r; KINECT_SIMD_LANES(r.v[lane] = a.v[lane] + b.v[lane]) return r; }
+inline Float4 SubFloat4(Float4 a, Float4 b) { Float4 r; KINECT_SIMD_LANES(r.v[lane] = a.v[lane] - b.v[lane]) return r; }
+inline Float4 MulFloat4(Float4 a, Float4 b) { Float4 r; KINECT_SIMD_LANES(r.v[lane] = a.v[lane] * b.v[lane]) return r; }
+inline Float4 DivFloat4(Float4 a, Float4 b) { Float4 r; KINECT_SIMD_LANES(r.v[lane] = a.v[lane] / b.v[lane]) return r; }
+inline Float4 MinFloat4(Float4 a, Float4 b) {
+  Float4 r;
+  KINECT_SIMD_LANES(r.v[lane] = a.v[lane] < b.v[lane] ? a.v[lane] : b.v[lane])
+  return r;
+}
+inline Float4 MaxFloat4(Float4 a, Float4 b) {
+  Float4 r;
+  KINECT_SIMD_LANES(r.v[lane] = a.v[lane] > b.v[lane] ? a.v[lane] : b.v[lane])
+  return r;
+}
+inline Int4 LessFloat4(Float4 a, Float4 b) { Int4 r; KINECT_SIMD_LANES(r.v[lane] = a.v[lane] < b.v[lane] ? -1 : 0) return r; }
+inline Int4 GreaterEqualFloat4(Float4 a, Float4 b) {
+  Int4 r;
+  KINECT_SIMD_LANES(r.v[lane] = a.v[lane] >= b.v[lane] ? -1 : 0)
+  return r;
+}
+inline Float4 SelectFloat4(Int4 mask, Float4 a, Float4 b) {
+  Float4 r;
+  KINECT_SIMD_LANES(r.v[lane] = mask.v[lane] != 0 ? a.v[lane] : b.v[lane])
+  return r;
+}
+inline void Transpose4(Float4 &r0, Float4 &r1, Float4 &r2, Float4 &r3) {
+  Float4 *rows[4] = {&r0, &r1, &r2, &r3};
+  for (int i = 0; i < 4; ++i) {
+    for (int j = i + 1; j < 4; ++j) {
+      const float t = rows[i]->v[j];
+      rows[i]->v[j] = rows[j]->v[i];
+      rows[j]->v[i] = t;
+    }
+  }
+}
+
+inline Int4 LoadInt4(const std::int32_t *p) {
+  Int4 r;
+  std::memcpy(r.v, p, sizeof(r.v));
+  return r;
+}
+inline void StoreInt4(std::int32_t *p, Int4 v) { std::memcpy(p, v.v, sizeof(v.v)); }
+inline Int4 SplatInt4(std::int32_t s) { Int4 r; KINECT_SIMD_LANES(r.v[lane] = s) return r; }
+inline Int4 LoadU16AsInt4(const std::uint16_t *p) { Int4 r; KINECT_SIMD_LANES(r.v[lane] = p[lane]) return r; }
+inline void StoreInt4AsU16(std::uint16_t *p, Int4 v) {
+  KINECT_SIMD_LANES(p[lane] = static_cast<std::uint16_t>(v.v[lane] < 0 ? 0 : (v.v[lane] > 65535 ? 65535 : v.v[lane])))
+}
+inline Int4 LoadU16PairsAsInt4(const std::uint16_t *p) {
+  Int4 r;
+  KINECT_SIMD_LANES(r.v[lane] = static_cast<std::int32_t>(static_cast<std::uint32_t>(p[2 * lane + 1]) << 16 | p[2 * lane]))
+  return r;
+}
+template <int kBits>
+inline Int4 ShiftRightLogicalInt4(Int4 v) {
+  Int4 r;
+  KINECT_SIMD_LANES(r.v[lane] = static_cast<std::int32_t>(static_cast<std::uint32_t>(v.v[lane]) >> kBits))
+  return r;
+}
+template <int kBits>
+inline Int4 ShiftLeftInt4(Int4 v) {
+  Int4 r;
+  KINECT_SIMD_LANES(r.v[lane] = static_cast<std::int32_t>(static_cast<std::uint32_t>(v.v[lane]) << kBits))
+  return r;
+}
+inline Int4 AddInt4(Int4 a, Int4 b) { Int4 r; KINECT_SIMD_LANES(r.v[lane] = a.v[lane] + b.v[lane]) return r; }
+inline Int4 AndInt4(Int4 a, Int4 b) { Int4 r; KINECT_SIMD_LANES(r.v[lane] = a.v[lane] & b.v[lane]) return r; }
+inline Int4 OrInt4(Int4 a, Int4 b) { Int4 r; KINECT_SIMD_LANES(r.v[lane] = a.v[lane] | b.v[lane]) return r; }
+inline Int4 GreaterInt4(Int4 a, Int4 b) { Int4 r; KINECT_SIMD_LANES(r.v[lane] = a.v[lane] > b.v[lane] ? -1 : 0) return r; }
+inline Int4 LessInt4(Int4 a, Int4 b) { Int4 r; KINECT_SIMD_LANES(r.v[lane] = a.v[lane] < b.v[lane] ? -1 : 0) return r; }
+inline Int4 SelectInt4(Int4 mask, Int4 a, Int4 b) {
+  Int4 r;
+  KINECT_SIMD_LANES(r.v[lane] = mask.v[lane] != 0 ? a.v[lane] : b.v[lane])
+  return r;
+}
+inline Float4 IntToFloat4(Int4 v) { Float4 r; KINECT_SIMD_LANES(r.v[lane] = static_cast<float>(v.v[lane])) return r; }
+inline Int4 FloatToInt4(Float4 v) {
+  Int4 r;
+  KINECT_SIMD_LANES(r.v[lane] = static_cast<std::int32_t>(v.v[lane]))
+  return r;
+}
+inline int MaskBits4(Int4 mask) {
+  int bits = 0;
+  KINECT_SIMD_LANES(bits |= (mask.v[lane] != 0 ? 1 : 0) << lane)
+  return bits;
+}
+
+#undef KINECT_SIMD_LANES
+
+#endif
@@ -0,0 +1,395 @@
+// Portions of this file are derived from libfreenect2's
+// src/cpu_depth_packet_processor.cpp and src/depth_packet_processor.cpp
+// (DepthPacketProcessor::Parameters): the decoding arithmetic, its constants
+// and the layout of the device tables.
+//
+// libfreenect2 is part of the OpenKinect Project, http://www.openkinect.org
+// Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB
+// file of libfreenect2 for details. Used under the Apache License, Version
+// 2.0 (one of libfreenect2's dual licenses, Apache 2.0 or GPL v2); see
+// THIRD_PARTY_NOTICES.md.
+
+#include "processing/tof_depth_decoder.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// The constants, and the float/double mix of the arithmetic below, are
+// libfreenect2's (DepthPacketProcessor::Parameters and the CPU processor),
+// so results match its CpuPacketPipeline.
+constexpr double kPi = 3.14159265358979323846;
+constexpr int kPixels = kTofWidth * kTofHeight;
+constexpr int kRowWords = kTofWidth * 11 / 16;
+constexpr int kMeasurementValues = 9;
+constexpr std::int32_t kSaturated = 32767;
+// Rows per parallelFor chunk.
+constexpr int kBandRows = 8;
+
+constexpr float kAbMultiplier = 0.6666667f;
+constexpr float kAbMultiplierPerFrequency[3] = {1.322581f, 1.0f, 1.612903f};
+constexpr float kAbOutputMultiplier = 16.0f;
+constexpr float kPhaseInRad[3] = {0.0f, 2.094395f, 4.18879f};
+constexpr float kJointBilateralAbThreshold = 3.0f;
+constexpr float kJointBilateralMaxEdge = 2.5f;
+constexpr float kJointBilateralExp = 5.0f;
+constexpr float kGaussianKernel[9] = {0.1069973f, 0.1131098f, 0.1069973f, 0.1131098f, 0.1195716f,
+                                      0.1131098f, 0.1069973f, 0.1131098f, 0.1069973f};
+constexpr float kUnambiguousDistance = 2083.333f;
+constexpr float kIndividualAbThreshold = 3.0f;
+constexpr float kAbThreshold = 10.0f;
+constexpr float kAbConfidenceSlope = -0.5330578f;
+constexpr float kAbConfidenceOffset = 0.7694894f;
+constexpr float kMinDealiasConfidence = 0.3490659f;
+constexpr float kMaxDealiasConfidence = 0.6108653f;
+constexpr float kEdgeAbAvgMinValue = 50.0f;
+constexpr float kEdgeAbStdDevThreshold = 0.05f;
+constexpr float kEdgeCloseDeltaThreshold = 50.0f;
+constexpr float kEdgeFarDeltaThreshold = 30.0f;
+constexpr float kEdgeMaxDeltaThreshold = 100.0f;
+constexpr float kEdgeAvgDeltaThreshold = 0.0f;
+
+inline bool Interior(int x, int y) {
+  return x >= 1 && y >= 1 && x <= kTofWidth - 2 && y <= kTofHeight - 2;
+}
+
+// The 11-bit sample of pixel (x, y) in sub-image |sub|. Each sub-image
+// stores the bottom half of the frame, then the top half upside down, and
+// interleaves the columns in groups of four.
+inline std::int32_t Sample(const std::uint8_t *packet, const std::int16_t *lut, int sub, int x, int y) {
+  if (x < 1 || x > kTofWidth - 2) {
+    return lut[0];
+  }
+  const int row = y < kTofHeight / 2 ? y + kTofHeight / 2 : kTofHeight - 1 - y;
+  const std::uint8_t *words = packet + kTofSubImageBytes * sub + static_cast<std::size_t>(row) * kRowWords * 2;
+  const int bit = ((x >> 2) + ((x & 3) << 7)) * 11;
+  std::uint16_t pair[2];
+  std::memcpy(pair, words + (bit >> 4) * 2, sizeof(pair));
+  const std::uint32_t low = static_cast<std::uint32_t>(pair[0]) >> (bit & 15);
+  const std::uint32_t high = static_cast<std::uint32_t>(pair[1]) << (16 - (bit & 15));
+  return lut[(low | high) & 2047];
+}
+
+// (a, b, amplitude) of one frequency's three samples: the phasor of the
+// correlation samples, per US patent 8,587,771.
+inline void MeasurementTriple(const float *trig, float ab_multiplier, float z, const std::int32_t *m, float *out) {
+  const bool valid = 0 < z;
+  const bool saturated = (m[0] == kSaturated || m[1] == kSaturated || m[2] == kSaturated) && valid;
+  float a = trig[0] * m[0] + trig[1] * m[1] + trig[2] * m[2];
+  float b = trig[3] * m[0] + trig[4] * m[1] + trig[5] * m[2];
+  a *= ab_multiplier;
+  b *= ab_multiplier;
+  float amplitude = std::sqrt(a * a + b * b) * kAbMultiplier;
+  a = valid ? a : 0;
+  b = valid ? b : 0;
+  amplitude = valid ? amplitude : 0;
+  out[0] = saturated ? 0 : a;
+  out[1] = saturated ? 0 : b;
+  out[2] = saturated ? 65535.0f : amplitude;
+}
+
+// Joint bilateral filter of each frequency's (a, b) over the 3x3
+// neighbourhood, weighted by how far the phase directions differ. |edge_ok|
+// is false where they differ a lot, which marks a depth edge.
+void BilateralPixel(const float *m, int x, int y, float *out, std::uint8_t *edge_ok) {
+  const float *center = m + (static_cast<std::size_t>(y) * kTofWidth + x) * kMeasurementValues;
+  if (!Interior(x, y)) {
+    std::copy(center, center + kMeasurementValues, out);
+    *edge_ok = 1;
+    return;
+  }
+  bool ok = true;
+  for (int k = 0; k < 3; ++k) {
+    const float *c = center + k * 3;
+    const float norm2 = c[0] * c[0] + c[1] * c[1];
+    float inv_norm = 1.0f / std::sqrt(norm2);
+    inv_norm = inv_norm == inv_norm ? inv_norm : std::numeric_limits<float>::infinity();
+    const float normalized[2] = {c[0] * inv_norm, c[1] * inv_norm};
+
+    float threshold =
+        (kJointBilateralAbThreshold * kJointBilateralAbThreshold) / (kAbMultiplier * kAbMultiplier);
+    float exponent = kJointBilateralExp;
+    if (norm2 < threshold) {
+      threshold = 0.0f;
+      exponent = 0.0f;
+    }
+
+    float weight_sum = 0.0f;
+    float weighted[2] = {0.0f, 0.0f};
+    float dist_sum = 0.0f;
+    int j = 0;
+    for (int dy = -1; dy < 2; ++dy) {
+      for (int dx = -1; dx < 2; ++dx, ++j) {
+        if (dy == 0 && dx == 0) {
+          weight_sum += kGaussianKernel[j];
+          weighted[0] += kGaussianKernel[j] * c[0];
+          weighted[1] += kGaussianKernel[j] * c[1];
+          continue;
+        }
+        const float *o =
+            m + (static_cast<std::size_t>(y + dy) * kTofWidth + (x + dx)) * kMeasurementValues + k * 3;
+        const float other_norm2 = o[0] * o[0] + o[1] * o[1];
+        float other_inv_norm = 1.0f / std::sqrt(other_norm2);
+        other_inv_norm = other_inv_norm == other_inv_norm ? other_inv_norm : std::numeric_limits<float>::infinity();
+        float dist = -(o[0] * other_inv_norm * normalized[0] + o[1] * other_inv_norm * normalized[1]);
+        dist += 1.0f;
+        dist *= 0.5f;
+
+        float weight = 0.0f;
+        if (other_norm2 >= threshold) {
+          weight = kGaussianKernel[j] * std::exp(-1.442695f * exponent * dist);
+          dist_sum += dist;
+        }
+        weighted[0] += weight * o[0];
+        weighted[1] += weight * o[1];
+        weight_sum += weight;
+      }
+    }
+    out[k * 3 + 0] = 0.0f < weight_sum ? weighted[0] / weight_sum : 0.0f;
+    out[k * 3 + 1] = 0.0f < weight_sum ? weighted[1] / weight_sum : 0.0f;
+    out[k * 3 + 2] = c[2];
+    ok = ok && dist_sum < kJointBilateralMaxEdge;
+  }
+  *edge_ok = ok ? 1 : 0;
+}
+
+// Phase unwrapping: the three wrapped phases (80, 16 and 120 MHz) are
+// combined into one phase over the joint unambiguous range, rejected when
+// the amplitude is too low or the frequencies disagree more than the
+// amplitude-dependent confidence allows, and mapped to depth through the
+// pixel's z and x tables.
+void UnwrapPixel(const float *m, float z_scale, float x_scale, float *depth, float *ir, float *ir_sum_out) {
+  const float *m0 = m;
+  const float *m1 = m + 3;
+  const float *m2 = m + 6;
+  float tmp0 = std::atan2(m0[1], m0[0]);
+  float tmp1 = std::atan2(m1[1], m1[0]);
+  float tmp2 = std::atan2(m2[1], m2[0]);
+  tmp0 = tmp0 < 0 ? tmp0 + kPi * 2.0f : tmp0;
+  tmp1 = tmp1 < 0 ? tmp1 + kPi * 2.0f : tmp1;
+  tmp2 = tmp2 < 0 ? tmp2 + kPi * 2.0f : tmp2;
+  tmp0 = tmp0 != tmp0 ? 0 : tmp0;
+  tmp1 = tmp1 != tmp1 ? 0 : tmp1;
+  tmp2 = tmp2 != tmp2 ? 0 : tmp2;
+
+  const float ir_sum = m0[2] + m1[2] + m2[2];
+  const float ir_min = std::min(std::min(m0[2], m1[2]), m2[2]);
+  const float ir_max = std::max(std::max(m0[2], m1[2]), m2[2]);
+
+  float phase = 0;
+  if (!(ir_min < kIndividualAbThreshold || ir_sum < kAbThreshold)) {
+    const float t0 = tmp0 / (2.0f * kPi) * 3.0f;
+    const float t1 = tmp1 / (2.0f * kPi) * 15.0f;
+    const float t2 = tmp2 / (2.0f * kPi) * 2.0f;
+
+    const float t5 = std::floor((t1 - t0) * 0.333333f + 0.5f) * 3.0f + t0;
+    float t3 = -t2 + t5;
+    const float t4 = t3 * 2.0f;
+    const bool positive = t4 >= -t4;
+    t3 *= positive ? 0.5f : -0.5f;
+    t3 = (t3 - std::floor(t3)) * (positive ? 2.0f : -2.0f);
+    const bool odd = 0.5f < std::abs(t3) && std::abs(t3) < 1.5f;
+
+    float t6 = odd ? t5 + 15.0f : t5;
+    float t7 = odd ? t1 + 15.0f : t1;
+    float t8 = (std::floor((-t2 + t6) * 0.5f + 0.5f) * 2.0f + t2) * 0.5f;
+    t6 *= 0.333333f;
+    t7 *= 0.066667f;
+    const float t9 = t8 + t6 + t7;
+    float t10 = t9 * 0.333333f;
+
+    // Spread of the three unwrapped phases.
+    t6 *= 2.0f * kPi;
+    t7 *= 2.0f * kPi;
+    t8 *= 2.0f * kPi;
+    const float d8 = t7 * 0.826977f - t8 * 0.110264f;
+    const float d6 = t8 * 0.551318f - t6 * 0.826977f;
+    const float d7 = t6 * 0.110264f - t7 * 0.551318f;
+    const float spread = d8 * d8 + d6 * d6 + d7 * d7;
+    t10 *= t9 >= 0.0f ? 1.0f : 0.0f;
+
+    float confidence = std::log(0 < kAbConfidenceSlope ? ir_min : ir_max);
+    confidence = (confidence * kAbConfidenceSlope * 0.301030f + kAbConfidenceOffset) * 3.321928f;
+    confidence = std::exp(confidence);
+    confidence = std::min(kMaxDealiasConfidence, std::max(kMinDealiasConfidence, confidence));
+    confidence *= confidence;
+    phase = confidence >= spread ? t10 : 0.0f;
+  }
+
+  const float depth_linear = z_scale * phase;
+  const float max_depth = phase * kUnambiguousDistance * 2;
+  const bool fit = 0 < depth_linear && 0 < max_depth;
+  x_scale = (x_scale * 90) / (max_depth * max_depth * 8192.0);
+  float depth_fit = depth_linear / (-depth_linear * x_scale + 1);
+  depth_fit = depth_fit < 0 ? 0 : depth_fit;
+
+  *depth = fit ? depth_fit : depth_linear;
+  *ir_sum_out = ir_sum;
+  *ir = std::min(ir_sum * 0.3333333f * kAbOutputMultiplier, 65535.0f);
+}
+
+// Removes flying pixels: a pixel whose depth is far from both the nearest
+// and the farthest valid neighbour, in a neighbourhood with varied
+// amplitude, lies on an edge between surfaces.
+float EdgeFilteredDepth(const float *depth_ir_sum, int x, int y, float min_depth, float max_depth) {
+  const float *center = depth_ir_sum + (static_cast<std::size_t>(y) * kTofWidth + x) * 3;
+  const float raw_depth = center[0];
+  if (!(raw_depth >= min_depth && raw_depth <= max_depth)) {
+    return 0.0f;
+  }
+  if (!Interior(x, y)) {
+    return raw_depth;
+  }
+  float ir_sum = center[2];
+  float ir_squares = center[2] * center[2];
+  float nearest = raw_depth;
+  float farthest = raw_depth;
+  for (int dy = -1; dy < 2; ++dy) {
+    for (int dx = -1; dx < 2; ++dx) {
+      if (dy == 0 && dx == 0) {
+        continue;
+      }
+      const float *other = depth_ir_sum + (static_cast<std::size_t>(y + dy) * kTofWidth + (x + dx)) * 3;
+      ir_sum += other[2];
+      ir_squares += other[2] * other[2];
+      if (0.0f < other[1]) {
+        nearest = std::min(nearest, other[1]);
+        farthest = std::max(farthest, other[1]);
+      }
+    }
+  }
+  float deviation = std::sqrt(ir_squares * 9.0f - ir_sum * ir_sum) / 9.0f;
+  deviation /= std::max(ir_sum / 9.0f, kEdgeAbAvgMinValue);
+  const float near_diff = std::abs(raw_depth - nearest);
+  const float far_diff = std::abs(raw_depth - farthest);
+  const bool edge = 0.0f < raw_depth && deviation >= kEdgeAbStdDevThreshold &&
+                    kEdgeCloseDeltaThreshold < near_diff && kEdgeFarDeltaThreshold < far_diff &&
+                    kEdgeMaxDeltaThreshold < std::max(near_diff, far_diff) &&
+                    kEdgeAvgDeltaThreshold < (near_diff + far_diff) * 0.5f;
+  return edge ? 0.0f : raw_depth;
+}
+
+}  // namespace
+
+TofDepthDecoder::TofDepthDecoder() = default;
+
+TofDepthDecoder::~TofDepthDecoder() = default;
+
+bool TofDepthDecoder::setTables(const std::uint8_t *p0_tables, std::size_t p0_bytes, const float *x_table,
+                                const float *z_table, const std::int16_t *lut, std::size_t lut_entries) {
+  ready_ = false;
+  if (p0_tables == nullptr || p0_bytes < kTofP0TablesBytes || x_table == nullptr || z_table == nullptr ||
+      lut == nullptr || lut_entries < kTofLutEntries) {
+    return false;
+  }
+  x_table_.assign(x_table, x_table + kPixels);
+  z_table_.assign(z_table, z_table + kPixels);
+  lut_.assign(lut, lut + kTofLutEntries);
+
+  // Each table sits between two u16 pads and is stored upside down relative
+  // to the packets.
+  constexpr std::size_t kHeaderBytes = 32;
+  constexpr std::size_t kTableStride = (kPixels + 2) * sizeof(std::uint16_t);
+  for (int k = 0; k < 3; ++k) {
+    const std::uint8_t *table = p0_tables + kHeaderBytes + k * kTableStride + sizeof(std::uint16_t);
+    std::vector<float> &trig = trig_tables_[k];
+    trig.resize(static_cast<std::size_t>(kPixels) * 6);
+    for (int y = 0; y < kTofHeight; ++y) {
+      const std::uint8_t *row = table + static_cast<std::size_t>(kTofHeight - 1 - y) * kTofWidth * 2;
+      for (int x = 0; x < kTofWidth; ++x) {
+        std::uint16_t p0_raw;
+        std::memcpy(&p0_raw, row + x * 2, sizeof(p0_raw));
+        const float p0 = -static_cast<float>(p0_raw) * 0.000031 * kPi;
+        float *t = trig.data() + (static_cast<std::size_t>(y) * kTofWidth + x) * 6;
+        for (int i = 0; i < 3; ++i) {
+          const float shifted = p0 + kPhaseInRad[i];
+          t[i] = std::cos(shifted);
+          t[3 + i] = std::sin(-shifted);
+        }
+      }
+    }
+  }
+  ready_ = true;
+  return true;
+}
+
+bool TofDepthDecoder::decode(const std::uint8_t *packet, std::size_t bytes, float *depth, float *ir) {
+  KINECT_TRACE_SCOPE("tof_depth.decode");
+  if (!ready_ || packet == nullptr || bytes < kTofPacketBytes) {
+    return false;
+  }
+  const TofDepthOptions options = options_;
+  max_threads_ = options.threads;
+  measurements_.resize(static_cast<std::size_t>(kPixels) * kMeasurementValues);
+  max_edge_ok_.resize(kPixels);
+  if (options.bilateral_filter) {
+    filtered_.resize(measurements_.size());
+  }
+  if (options.edge_aware_filter) {
+    depth_ir_sum_.resize(static_cast<std::size_t>(kPixels) * 3);
+  }
+
+  SharedThreadPool().parallelFor(kTofHeight, kBandRows, max_threads_, [&](int begin, int end) {
+    std::int32_t samples[kMeasurementValues];
+    for (int y = begin; y < end; ++y) {
+      for (int x = 0; x < kTofWidth; ++x) {
+        const std::size_t i = static_cast<std::size_t>(y) * kTofWidth + x;
+        for (int s = 0; s < kMeasurementValues; ++s) {
+          samples[s] = Sample(packet, lut_.data(), s, x, y);
+        }
+        float *out = measurements_.data() + i * kMeasurementValues;
+        for (int k = 0; k < 3; ++k) {
+          MeasurementTriple(trig_tables_[k].data() + i * 6, kAbMultiplierPerFrequency[k], z_table_[i],
+                            samples + k * 3, out + k * 3);
+        }
+      }
+    }
+  });
+
+  // The filter reads the rows around its own, so unwrapping follows it row
+  // by row once every row has its measurements.
+  const float *m = options.bilateral_filter ? filtered_.data() : measurements_.data();
+  SharedThreadPool().parallelFor(kTofHeight, kBandRows, max_threads_, [&](int begin, int end) {
+    for (int y = begin; y < end; ++y) {
+      float *depth_row = depth + static_cast<std::size_t>(kTofHeight - 1 - y) * kTofWidth;
+      float *ir_row = ir + static_cast<std::size_t>(kTofHeight - 1 - y) * kTofWidth;
+      for (int x = 0; x < kTofWidth; ++x) {
+        const std::size_t i = static_cast<std::size_t>(y) * kTofWidth + x;
+        if (options.bilateral_filter) {
+          BilateralPixel(measurements_.data(), x, y, filtered_.data() + i * kMeasurementValues, &max_edge_ok_[i]);
+        } else {
+          max_edge_ok_[i] = 1;
+        }
+        float raw_depth = 0.0f;
+        float ir_sum = 0.0f;
+        UnwrapPixel(m + i * kMeasurementValues, z_table_[i], x_table_[i], &raw_depth, &ir_row[x], &ir_sum);
+        if (options.edge_aware_filter) {
+          float *cell = depth_ir_sum_.data() + i * 3;
+          cell[0] = raw_depth;
+          cell[1] = max_edge_ok_[i] != 0 ? raw_depth : 0.0f;
+          cell[2] = ir_sum;
+        } else {
+          depth_row[x] = raw_depth;
+        }
+      }
+    }
+  });
+
+  if (options.edge_aware_filter) {
+    SharedThreadPool().parallelFor(kTofHeight, kBandRows, max_threads_, [&](int begin, int end) {
+      for (int y = begin; y < end; ++y) {
+        float *depth_row = depth + static_cast<std::size_t>(kTofHeight - 1 - y) * kTofWidth;
+        for (int x = 0; x < kTofWidth; ++x) {
+          depth_row[x] = EdgeFilteredDepth(depth_ir_sum_.data(), x, y, options.min_depth_mm, options.max_depth_mm);
+        }
+      }
+    });
+  }
+  return true;
+}
@@ -0,0 +1,94 @@
+// Portions of this file are derived from libfreenect2's
+// src/cpu_depth_packet_processor.cpp and src/depth_packet_processor.cpp
+// (DepthPacketProcessor::Parameters): the decoding arithmetic, its constants
+// and the layout of the device tables.
+//
+// libfreenect2 is part of the OpenKinect Project, http://www.openkinect.org
+// Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB
+// file of libfreenect2 for details. Used under the Apache License, Version
+// 2.0 (one of libfreenect2's dual licenses, Apache 2.0 or GPL v2); see
+// THIRD_PARTY_NOTICES.md.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Kinect v2 depth packets: ten 512x424 sub-images of 11-bit samples, three
+// phase measurements at each of three modulation frequencies plus one
+// unused image.
+constexpr int kTofWidth = 512;
+constexpr int kTofHeight = 424;
+constexpr std::size_t kTofSubImageBytes = kTofWidth * kTofHeight * 11 / 8;
+constexpr std::size_t kTofPacketBytes = kTofSubImageBytes * 10;
+// The device's P0 table response: a 32-byte header, then three
+// 512x424 u16 phase-offset tables, each between two u16 pads.
+constexpr std::size_t kTofP0TablesBytes = 32 + 3 * (kTofWidth * kTofHeight + 2) * sizeof(std::uint16_t);
+constexpr std::size_t kTofLutEntries = 2048;
+
+struct TofDepthOptions {
+  // Joint bilateral smoothing of the phase vectors, whose disagreement also
+  // flags pixels on depth edges.
+  bool bilateral_filter = true;
+  // Drops flying pixels on depth edges and anything outside the range.
+  bool edge_aware_filter = true;
+  float min_depth_mm = 500.0f;
+  float max_depth_mm = 4500.0f;
+  // Shared pool threads to use, including the caller; 0 uses all of them.
+  int threads = 0;
+};
+
+// Time-of-flight decoding of Kinect v2 depth packets on the CPU: the
+// computation of libfreenect2's CpuPacketPipeline (phase and amplitude per
+// frequency, bilateral filter, phase unwrapping across the three
+// frequencies, edge filter), pixel for pixel, but on the shared pool instead
+// of libfreenect2's one depth thread. The backend takes raw packets and the
+// device's tables from libfreenect2's DumpPacketPipeline. Not thread-safe.
+class TofDepthDecoder {
+ public:
+  TofDepthDecoder();
+  ~TofDepthDecoder();
+  TofDepthDecoder(const TofDepthDecoder &) = delete;
+  TofDepthDecoder &operator=(const TofDepthDecoder &) = delete;
+
+  void setOptions(const TofDepthOptions &options) { options_ = options; }
+  const TofDepthOptions &options() const { return options_; }
+
+  // Loads the device tables: the raw P0 response (kTofP0TablesBytes), the
+  // per-pixel x and z scale tables (kTofWidth * kTofHeight floats) and the
+  // 11-bit sample lookup table (kTofLutEntries). Returns false if any is
+  // missing or short.
+  bool setTables(const std::uint8_t *p0_tables, std::size_t p0_bytes, const float *x_table, const float *z_table,
+                 const std::int16_t *lut, std::size_t lut_entries);
+  bool ready() const { return ready_; }
+
+  // Writes depth in millimetres (0 where invalid) and IR amplitude (0 to
+  // 65535) for a kTofPacketBytes packet, kTofWidth x kTofHeight floats each,
+  // oriented like libfreenect2's frames. Returns false without tables or on a
+  // short packet.
+  bool decode(const std::uint8_t *packet, std::size_t bytes, float *depth, float *ir);
+
+ private:
+
+  TofDepthOptions options_;
+  bool ready_ = false;
+  // Per frequency and pixel: cos and -sin of the three sample phases.
+  std::vector<float> trig_tables_[3];
+  std::vector<float> x_table_;
+  std::vector<float> z_table_;
+  std::vector<std::int16_t> lut_;
+
+  // Per pixel: (a, b, amplitude) for each frequency, before and after the
+  // bilateral filter.
+  std::vector<float> measurements_;
+  std::vector<float> filtered_;
+  std::vector<std::uint8_t> max_edge_ok_;
+  // Per pixel: raw depth, depth where the bilateral edge test passed (else
+  // 0), amplitude sum.
+  std::vector<float> depth_ir_sum_;
+
+  // options.threads of the call in progress.
+  int max_threads_ = 0;
+};
@@ -0,0 +1,925 @@
+#include "processing/tsdf.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+#include "processing/simd.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+
+constexpr int kBlockSide = 8;
+constexpr int kBlockVoxels = kBlockSide * kBlockSide * kBlockSide;
+constexpr std::size_t kBlocksPerChunk = 256;
+constexpr std::size_t kMinSlots = 4096;
+constexpr std::uint64_t kNoKey = ~std::uint64_t{0};
+// Block coordinates stay within +/- 2^16 (655 m at 1 cm voxels), which keeps
+// voxel coordinates and the 21-bit packed keys well inside range.
+constexpr std::int32_t kBlockLimit = 1 << 16;
+constexpr std::int32_t kKeyBias = 1 << 20;
+constexpr float kTsdfScale = 32767.0f;
+constexpr std::uint32_t kNoFrame = ~std::uint32_t{0};
+// Pixel tile edge of the raycast depth-range image.
+constexpr int kRangeTile = 8;
+
+inline std::uint64_t BlockKey(std::int32_t bx, std::int32_t by, std::int32_t bz) {
+  return static_cast<std::uint64_t>(bx + kKeyBias) | static_cast<std::uint64_t>(by + kKeyBias) << 21 |
+         static_cast<std::uint64_t>(bz + kKeyBias) << 42;
+}
+
+inline std::uint64_t MixKey(std::uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ull;
+  key ^= key >> 33;
+  return key;
+}
+
+// std::floor is a library call unless SSE4.1 is enabled. Coordinates here
+// are bounded by the depth range around the camera, far inside int range.
+inline std::int32_t FloorToInt(float v) {
+  const std::int32_t truncated = static_cast<std::int32_t>(v);
+  return truncated - (static_cast<float>(truncated) > v ? 1 : 0);
+}
+
+inline int VoxelIndex(int x, int y, int z) {
+  return (z * kBlockSide + y) * kBlockSide + x;
+}
+
+inline float Dot3(const float *a, const float *b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Marching-cubes triangulation for all 256 corner sign patterns. Rather than
+// a hand-typed table, each case is derived once by joining the crossed edges
+// on every cube face into segments and walking the segments into loops. On a
+// face with all four edges crossed the inside corners are always cut off, so
+// the two cells sharing that face agree and the mesh has no cracks.
+//
+// Corner i sits at (i & 1, i >> 1 & 1, i >> 2 & 1); corner bit i of a case is
+// set when that corner is inside (negative distance). Triangles are wound
+// counter-clockwise seen from outside.
+struct MarchingCubesTable {
+  std::array<std::array<int, 2>, 12> edge_corners{};
+  std::array<std::array<std::int8_t, 16 * 3>, 256> triangles{};
+  std::array<std::uint8_t, 256> triangle_count{};
+
+  MarchingCubesTable() {
+    int edge_of[8][8];
+    int edges = 0;
+    for (int a = 0; a < 8; ++a) {
+      for (int b = a + 1; b < 8; ++b) {
+        const int diff = a ^ b;
+        if (diff == 1 || diff == 2 || diff == 4) {
+          edge_corners[static_cast<std::size_t>(edges)] = {a, b};
+          edge_of[a][b] = edges;
+          edge_of[b][a] = edges;
+          ++edges;
+        }
+      }
+    }
+
+    for (int config = 0; config < 256; ++config) {
+      const auto inside = [config](int corner) { return (config >> corner & 1) != 0; };
+      int link[12][2];
+      int links[12] = {};
+      const auto connect = [&](int e0, int e1) {
+        link[e0][links[e0]++] = e1;
+        link[e1][links[e1]++] = e0;
+      };
+      for (int axis = 0; axis < 3; ++axis) {
+        const int u = (axis + 1) % 3;
+        const int v = (axis + 2) % 3;
+        for (int side = 0; side < 2; ++side) {
+          const int cycle[4] = {side << axis, side << axis | 1 << u, side << axis | 1 << u | 1 << v,
+                                side << axis | 1 << v};
+          int face_edges[4];
+          int crossed = 0;
+          for (int j = 0; j < 4; ++j) {
+            face_edges[j] = edge_of[cycle[j]][cycle[(j + 1) % 4]];
+            crossed += inside(cycle[j]) != inside(cycle[(j + 1) % 4]) ? 1 : 0;
+          }
+          if (crossed == 2) {
+            int ends[2];
+            int found = 0;
+            for (int j = 0; j < 4; ++j) {
+              if (inside(cycle[j]) != inside(cycle[(j + 1) % 4])) {
+                ends[found++] = face_edges[j];
+              }
+            }
+            connect(ends[0], ends[1]);
+          } else if (crossed == 4) {
+            for (int j = 0; j < 4; ++j) {
+              if (inside(cycle[j])) {
+                connect(face_edges[(j + 3) % 4], face_edges[j]);
+              }
+            }
+          }
+        }
+      }
+
+      bool visited[12] = {};
+      int count = 0;
+      for (int start = 0; start < 12; ++start) {
+        if (links[start] == 0 || visited[start]) {
+          continue;
+        }
+        int loop[12];
+        int length = 0;
+        int previous = -1;
+        int current = start;
+        while (!visited[current]) {
+          visited[current] = true;
+          loop[length++] = current;
+          const int next = link[current][0] != previous ? link[current][0] : link[current][1];
+          previous = current;
+          current = next;
+        }
+
+        // Newell normal of the loop through the edge midpoints, turned to
+        // point away from the inside corners.
+        float normal[3] = {0.0f, 0.0f, 0.0f};
+        float centre[3] = {0.0f, 0.0f, 0.0f};
+        float inner[3] = {0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < length; ++i) {
+          float p[3];
+          float q[3];
+          Midpoint(loop[i], p);
+          Midpoint(loop[(i + 1) % length], q);
+          normal[0] += (p[1] - q[1]) * (p[2] + q[2]);
+          normal[1] += (p[2] - q[2]) * (p[0] + q[0]);
+          normal[2] += (p[0] - q[0]) * (p[1] + q[1]);
+          const std::array<int, 2> &ends = edge_corners[static_cast<std::size_t>(loop[i])];
+          const int corner = inside(ends[0]) ? ends[0] : ends[1];
+          for (int axis = 0; axis < 3; ++axis) {
+            centre[axis] += p[axis];
+            inner[axis] += static_cast<float>(corner >> axis & 1);
+          }
+        }
+        float outward[3];
+        for (int axis = 0; axis < 3; ++axis) {
+          outward[axis] = centre[axis] - inner[axis];
+        }
+        const bool reverse = Dot3(normal, outward) < 0.0f;
+        // Fan from a vertex whose diagonals all cross the cell interior; a
+        // diagonal lying on a cube face would duplicate the neighbouring
+        // cell's boundary segment there.
+        int apex = 0;
+        for (int r = 0; r < length; ++r) {
+          bool interior = true;
+          for (int i = 2; i + 1 < length && interior; ++i) {
+            interior = !ShareFace(loop[r], loop[(r + i) % length]);
+          }
+          if (interior) {
+            apex = r;
+            break;
+          }
+        }
+        for (int i = 1; i + 1 < length; ++i) {
+          std::int8_t *triangle = triangles[static_cast<std::size_t>(config)].data() + count * 3;
+          const int a = loop[(apex + i) % length];
+          const int b = loop[(apex + i + 1) % length];
+          triangle[0] = static_cast<std::int8_t>(loop[apex]);
+          triangle[1] = static_cast<std::int8_t>(reverse ? b : a);
+          triangle[2] = static_cast<std::int8_t>(reverse ? a : b);
+          ++count;
+        }
+      }
+      triangle_count[static_cast<std::size_t>(config)] = static_cast<std::uint8_t>(count);
+    }
+  }
+
+  bool ShareFace(int e0, int e1) const {
+    const std::array<int, 2> &a = edge_corners[static_cast<std::size_t>(e0)];
+    const std::array<int, 2> &b = edge_corners[static_cast<std::size_t>(e1)];
+    for (int axis = 0; axis < 3; ++axis) {
+      const int side = a[0] >> axis & 1;
+      if ((a[1] >> axis & 1) == side && (b[0] >> axis & 1) == side && (b[1] >> axis & 1) == side) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Midpoint(int edge, float *out) const {
+    const std::array<int, 2> &ends = edge_corners[static_cast<std::size_t>(edge)];
+    for (int axis = 0; axis < 3; ++axis) {
+      out[axis] = 0.5f * static_cast<float>((ends[0] >> axis & 1) + (ends[1] >> axis & 1));
+    }
+  }
+};
+
+const MarchingCubesTable &MarchingCubes() {
+  static const MarchingCubesTable table;
+  return table;
+}
+
+}  // namespace
+
+struct TsdfVolume::Block {
+  std::int32_t coords[3];
+  // Position in the arena.
+  std::uint32_t index;
+  // Last frame whose truncation band touched the block.
+  std::uint32_t frame;
+  std::int16_t tsdf[kBlockVoxels];
+  std::uint16_t weight[kBlockVoxels];
+};
+
+TsdfVolume::TsdfVolume(const TsdfOptions &options) {
+  setOptions(options);
+  clear();
+}
+
+TsdfVolume::~TsdfVolume() = default;
+
+void TsdfVolume::setOptions(const TsdfOptions &options) {
+  const bool reshape = options.voxel_size != options_.voxel_size || options.truncation != options_.truncation;
+  options_ = options;
+  if (!(options_.voxel_size > 0.0f)) {
+    options_.voxel_size = TsdfOptions().voxel_size;
+  }
+  options_.truncation = std::max(options_.truncation, options_.voxel_size);
+  options_.max_weight = std::max<std::uint16_t>(1, options_.max_weight);
+  if (reshape) {
+    clear();
+  }
+}
+
+void TsdfVolume::clear() {
+  slot_keys_.assign(kMinSlots, kNoKey);
+  slot_blocks_.assign(kMinSlots, 0);
+  arena_.clear();
+  block_count_ = 0;
+  frame_ = 0;
+}
+
+std::size_t TsdfVolume::memoryBytes() const {
+  return arena_.size() * kBlocksPerChunk * sizeof(Block) +
+         slot_keys_.size() * (sizeof(std::uint64_t) + sizeof(std::uint32_t));
+}
+
+TsdfVolume::Block *TsdfVolume::findBlock(std::int32_t bx, std::int32_t by, std::int32_t bz) const {
+  if (std::abs(bx) >= kBlockLimit || std::abs(by) >= kBlockLimit || std::abs(bz) >= kBlockLimit) {
+    return nullptr;
+  }
+  const std::uint64_t key = BlockKey(bx, by, bz);
+  const std::size_t mask = slot_keys_.size() - 1;
+  for (std::size_t slot = MixKey(key) & mask; slot_keys_[slot] != kNoKey; slot = (slot + 1) & mask) {
+    if (slot_keys_[slot] == key) {
+      const std::uint32_t index = slot_blocks_[slot];
+      return &arena_[index / kBlocksPerChunk][index % kBlocksPerChunk];
+    }
+  }
+  return nullptr;
+}
+
+void TsdfVolume::growTable() {
+  const std::size_t size = slot_keys_.size() * 2;
+  slot_keys_.assign(size, kNoKey);
+  slot_blocks_.assign(size, 0);
+  const std::size_t mask = size - 1;
+  for (std::size_t index = 0; index < block_count_; ++index) {
+    const Block &block = arena_[index / kBlocksPerChunk][index % kBlocksPerChunk];
+    const std::uint64_t key = BlockKey(block.coords[0], block.coords[1], block.coords[2]);
+    std::size_t slot = MixKey(key) & mask;
+    while (slot_keys_[slot] != kNoKey) {
+      slot = (slot + 1) & mask;
+    }
+    slot_keys_[slot] = key;
+    slot_blocks_[slot] = static_cast<std::uint32_t>(index);
+  }
+}
+
+TsdfVolume::Block *TsdfVolume::findOrAddBlock(std::int32_t bx, std::int32_t by, std::int32_t bz, bool *added) {
+  *added = false;
+  if (std::abs(bx) >= kBlockLimit || std::abs(by) >= kBlockLimit || std::abs(bz) >= kBlockLimit) {
+    return nullptr;
+  }
+  const std::uint64_t key = BlockKey(bx, by, bz);
+  std::size_t mask = slot_keys_.size() - 1;
+  std::size_t slot = MixKey(key) & mask;
+  for (; slot_keys_[slot] != kNoKey; slot = (slot + 1) & mask) {
+    if (slot_keys_[slot] == key) {
+      const std::uint32_t index = slot_blocks_[slot];
+      return &arena_[index / kBlocksPerChunk][index % kBlocksPerChunk];
+    }
+  }
+  if (block_count_ >= options_.max_blocks) {
+    return nullptr;
+  }
+  if ((block_count_ + 1) * 2 > slot_keys_.size()) {
+    growTable();
+    mask = slot_keys_.size() - 1;
+    slot = MixKey(key) & mask;
+    while (slot_keys_[slot] != kNoKey) {
+      slot = (slot + 1) & mask;
+    }
+  }
+  const std::size_t index = block_count_++;
+  if (index / kBlocksPerChunk >= arena_.size()) {
+    arena_.push_back(std::make_unique<Block[]>(kBlocksPerChunk));
+  }
+  Block &block = arena_[index / kBlocksPerChunk][index % kBlocksPerChunk];
+  block.coords[0] = bx;
+  block.coords[1] = by;
+  block.coords[2] = bz;
+  block.index = static_cast<std::uint32_t>(index);
+  block.frame = kNoFrame;
+  std::fill(block.tsdf, block.tsdf + kBlockVoxels, static_cast<std::int16_t>(kTsdfScale));
+  std::fill(block.weight, block.weight + kBlockVoxels, std::uint16_t{0});
+  slot_keys_[slot] = key;
+  slot_blocks_[slot] = static_cast<std::uint32_t>(index);
+  *added = true;
+  return &block;
+}
+
+TsdfIntegrateStats TsdfVolume::integrate(const std::uint16_t *depth, const CameraIntrinsics &intrinsics,
+                                         const RigidTransform &pose) {
+  KINECT_TRACE_SCOPE("tsdf.integrate");
+  TsdfIntegrateStats stats;
+  if (depth == nullptr || !intrinsics.valid()) {
+    return stats;
+  }
+  ++frame_;
+  touched_.clear();
+
+  const int width = intrinsics.width;
+  const int height = intrinsics.height;
+  const float voxel = options_.voxel_size;
+  const float block_size = voxel * kBlockSide;
+  const float inv_block = 1.0f / block_size;
+  const float trunc = options_.truncation;
+
+  // Allocation: walk the truncation band of every other pixel in steps of
+  // half a block and collect the blocks it passes through. Neighbouring
+  // samples mostly repeat the previous block, which skips the hash.
+  {
+    KINECT_TRACE_SCOPE("tsdf.allocate");
+    const int steps = std::max(1, static_cast<int>(std::ceil(2.0f * trunc / (0.5f * block_size))));
+    const float step = 2.0f * trunc / static_cast<float>(steps);
+    std::vector<std::uint64_t> last(static_cast<std::size_t>(steps) + 1, kNoKey);
+    std::vector<std::uint64_t> refused;
+    for (int v = 0; v < height; v += 2) {
+      const float ray_y = (static_cast<float>(v) - intrinsics.cy) / intrinsics.fy;
+      for (int u = 0; u < width; u += 2) {
+        const std::uint16_t mm = depth[static_cast<std::size_t>(v) * width + u];
+        if (mm < options_.min_depth_mm || mm > options_.max_depth_mm) {
+          continue;
+        }
+        const float ray[3] = {(static_cast<float>(u) - intrinsics.cx) / intrinsics.fx, ray_y, 1.0f};
+        float direction[3];
+        for (int axis = 0; axis < 3; ++axis) {
+          direction[axis] = Dot3(pose.r + axis * 3, ray);
+        }
+        const float z = static_cast<float>(mm) * 0.001f;
+        for (int s = 0; s <= steps; ++s) {
+          const float along = z - trunc + step * static_cast<float>(s);
+          const std::int32_t b[3] = {
+              FloorToInt((pose.t[0] + direction[0] * along) * inv_block),
+              FloorToInt((pose.t[1] + direction[1] * along) * inv_block),
+              FloorToInt((pose.t[2] + direction[2] * along) * inv_block)};
+          const std::uint64_t key = BlockKey(b[0], b[1], b[2]);
+          if (key == last[static_cast<std::size_t>(s)]) {
+            continue;
+          }
+          last[static_cast<std::size_t>(s)] = key;
+          bool added = false;
+          Block *block = findOrAddBlock(b[0], b[1], b[2], &added);
+          if (block == nullptr) {
+            refused.push_back(key);
+            continue;
+          }
+          stats.new_blocks += added ? 1 : 0;
+          if (block->frame != frame_) {
+            block->frame = frame_;
+            touched_.push_back(block);
+          }
+        }
+      }
+    }
+    std::sort(refused.begin(), refused.end());
+    stats.dropped_blocks = static_cast<std::size_t>(std::unique(refused.begin(), refused.end()) - refused.begin());
+  }
+
+  // Integration: one task per block. Voxel centres along x are projected
+  // four at a time; the depth lookup and running average are per voxel.
+  const RigidTransform to_camera = InverseTransform(pose);
+  const float inv_trunc = 1.0f / trunc;
+  const float max_weight = options_.max_weight;
+  SharedThreadPool().parallelFor(static_cast<int>(touched_.size()), 8, options_.threads, [&](int begin, int end) {
+    const Float4 fx = SplatFloat4(intrinsics.fx);
+    const Float4 fy = SplatFloat4(intrinsics.fy);
+    // +0.5 so truncation rounds to the nearest pixel.
+    const Float4 cx = SplatFloat4(intrinsics.cx + 0.5f);
+    const Float4 cy = SplatFloat4(intrinsics.cy + 0.5f);
+    const Float4 zero = SplatFloat4(0.0f);
+    const Float4 one = SplatFloat4(1.0f);
+    const Float4 min_z = SplatFloat4(std::max(0.01f, static_cast<float>(options_.min_depth_mm) * 0.001f - trunc));
+    const Float4 u_limit = SplatFloat4(static_cast<float>(width));
+    const Float4 v_limit = SplatFloat4(static_cast<float>(height));
+    // Camera-frame step for one voxel along world x.
+    const float step[3] = {to_camera.r[0] * voxel, to_camera.r[3] * voxel, to_camera.r[6] * voxel};
+    const Float4 lane_low = LoadFloat4(std::array<float, 4>{0.0f, 1.0f, 2.0f, 3.0f}.data());
+    const Float4 lane_high = AddFloat4(lane_low, SplatFloat4(4.0f));
+
+    for (int index = begin; index < end; ++index) {
+      Block &block = *touched_[static_cast<std::size_t>(index)];
+      for (int z = 0; z < kBlockSide; ++z) {
+        for (int y = 0; y < kBlockSide; ++y) {
+          const float world[3] = {(static_cast<float>(block.coords[0] * kBlockSide) + 0.5f) * voxel,
+                                  (static_cast<float>(block.coords[1] * kBlockSide + y) + 0.5f) * voxel,
+                                  (static_cast<float>(block.coords[2] * kBlockSide + z) + 0.5f) * voxel};
+          float origin[3];
+          to_camera.apply(world, origin);
+          const int row = VoxelIndex(0, y, z);
+          for (int half = 0; half < 2; ++half) {
+            const Float4 lane = half == 0 ? lane_low : lane_high;
+            const Float4 px = AddFloat4(SplatFloat4(origin[0]), MulFloat4(lane, SplatFloat4(step[0])));
+            const Float4 py = AddFloat4(SplatFloat4(origin[1]), MulFloat4(lane, SplatFloat4(step[1])));
+            const Float4 pz = AddFloat4(SplatFloat4(origin[2]), MulFloat4(lane, SplatFloat4(step[2])));
+            const Float4 inv_z = DivFloat4(one, MaxFloat4(pz, min_z));
+            const Float4 fu = AddFloat4(MulFloat4(MulFloat4(fx, px), inv_z), cx);
+            const Float4 fv = AddFloat4(MulFloat4(MulFloat4(fy, py), inv_z), cy);
+            Int4 valid = AndInt4(LessFloat4(min_z, pz), AndInt4(GreaterEqualFloat4(fu, zero), LessFloat4(fu, u_limit)));
+            valid = AndInt4(valid, AndInt4(GreaterEqualFloat4(fv, zero), LessFloat4(fv, v_limit)));
+            const int bits = MaskBits4(valid);
+            if (bits == 0) {
+              continue;
+            }
+            alignas(16) std::int32_t iu[4];
+            alignas(16) std::int32_t iv[4];
+            alignas(16) float vz[4];
+            StoreInt4(iu, FloatToInt4(fu));
+            StoreInt4(iv, FloatToInt4(fv));
+            StoreFloat4(vz, pz);
+            for (int l = 0; l < 4; ++l) {
+              if ((bits >> l & 1) == 0) {
+                continue;
+              }
+              const std::uint16_t mm = depth[static_cast<std::size_t>(iv[l]) * width + iu[l]];
+              if (mm < options_.min_depth_mm || mm > options_.max_depth_mm) {
+                continue;
+              }
+              const float sdf = static_cast<float>(mm) * 0.001f - vz[l];
+              if (sdf < -trunc) {
+                continue;
+              }
+              const int i = row + half * 4 + l;
+              const float w = block.weight[i];
+              const float tsdf = std::min(1.0f, sdf * inv_trunc);
+              const float fused = (static_cast<float>(block.tsdf[i]) * (1.0f / kTsdfScale) * w + tsdf) / (w + 1.0f);
+              block.tsdf[i] = static_cast<std::int16_t>(fused * kTsdfScale + (fused < 0.0f ? -0.5f : 0.5f));
+              block.weight[i] = static_cast<std::uint16_t>(std::min(w + 1.0f, max_weight));
+            }
+          }
+        }
+      }
+    }
+  });
+  stats.blocks = touched_.size();
+  return stats;
+}
+
+// Voxel reads through a small block cache indexed by the low coordinate
+// bits, so the eight blocks around any point never evict each other; ray
+// steps and trilinear samples mostly stay among them.
+class TsdfVolume::Reader {
+ public:
+  explicit Reader(const TsdfVolume &volume) : volume_(volume) {}
+
+  // Distance in truncation units at voxel (x, y, z); false when unobserved.
+  bool voxel(std::int32_t x, std::int32_t y, std::int32_t z, float *out) {
+    const std::int32_t b[3] = {x >> 3, y >> 3, z >> 3};
+    const int slot = (b[0] & 1) | (b[1] & 1) << 1 | (b[2] & 1) << 2;
+    Entry &entry = cache_[slot];
+    if (!entry.filled || b[0] != entry.coords[0] || b[1] != entry.coords[1] || b[2] != entry.coords[2]) {
+      entry.block = volume_.findBlock(b[0], b[1], b[2]);
+      std::copy(b, b + 3, entry.coords);
+      entry.filled = true;
+    }
+    last_ = entry.block;
+    if (last_ == nullptr) {
+      return false;
+    }
+    const int i = VoxelIndex(x & 7, y & 7, z & 7);
+    if (last_->weight[i] == 0) {
+      return false;
+    }
+    *out = static_cast<float>(last_->tsdf[i]) * (1.0f / kTsdfScale);
+    return true;
+  }
+
+  // Whether the block of the last voxel() call exists.
+  bool lastBlockExists() const { return last_ != nullptr; }
+
+  // Trilinear sample at |p| in voxel units, where voxel centres sit on
+  // integers, and optionally the interpolant's gradient there.
+  bool sample(const float p[3], float *out, float *gradient = nullptr) {
+    const std::int32_t x = FloorToInt(p[0]);
+    const std::int32_t y = FloorToInt(p[1]);
+    const std::int32_t z = FloorToInt(p[2]);
+    const float a[3] = {p[0] - static_cast<float>(x), p[1] - static_cast<float>(y), p[2] - static_cast<float>(z)};
+    float corner[8];
+    for (int c = 0; c < 8; ++c) {
+      if (!voxel(x + (c & 1), y + (c >> 1 & 1), z + (c >> 2 & 1), &corner[c])) {
+        return false;
+      }
+    }
+    const float x00 = corner[0] + (corner[1] - corner[0]) * a[0];
+    const float x10 = corner[2] + (corner[3] - corner[2]) * a[0];
+    const float x01 = corner[4] + (corner[5] - corner[4]) * a[0];
+    const float x11 = corner[6] + (corner[7] - corner[6]) * a[0];
+    const float y0 = x00 + (x10 - x00) * a[1];
+    const float y1 = x01 + (x11 - x01) * a[1];
+    *out = y0 + (y1 - y0) * a[2];
+    if (gradient != nullptr) {
+      const float dx0 = (corner[1] - corner[0]) + ((corner[3] - corner[2]) - (corner[1] - corner[0])) * a[1];
+      const float dx1 = (corner[5] - corner[4]) + ((corner[7] - corner[6]) - (corner[5] - corner[4])) * a[1];
+      gradient[0] = dx0 + (dx1 - dx0) * a[2];
+      const float dy0 = x10 - x00;
+      const float dy1 = x11 - x01;
+      gradient[1] = dy0 + (dy1 - dy0) * a[2];
+      gradient[2] = y1 - y0;
+    }
+    return true;
+  }
+
+ private:
+  struct Entry {
+    const Block *block = nullptr;
+    std::int32_t coords[3] = {0, 0, 0};
+    bool filled = false;
+  };
+
+  const TsdfVolume &volume_;
+  Entry cache_[8];
+  const Block *last_ = nullptr;
+};
+
+void TsdfVolume::raycast(const CameraIntrinsics &intrinsics, const RigidTransform &pose, std::uint16_t *depth,
+                         NormalMap *normals) {
+  KINECT_TRACE_SCOPE("tsdf.raycast");
+  const int width = intrinsics.width;
+  const int height = intrinsics.height;
+  const std::size_t pixels = static_cast<std::size_t>(width) * height;
+  std::fill(depth, depth + pixels, std::uint16_t{0});
+  if (normals != nullptr) {
+    normals->width = width;
+    normals->height = height;
+    normals->normals.assign(pixels * 3, 0.0f);
+    normals->curvature.assign(pixels, 0.0f);
+  }
+  if (block_count_ == 0 || !intrinsics.valid()) {
+    return;
+  }
+
+  const float voxel = options_.voxel_size;
+  const float inv_voxel = 1.0f / voxel;
+  const float trunc = options_.truncation;
+  const float near = static_cast<float>(options_.min_depth_mm) * 0.001f;
+  const float far = static_cast<float>(options_.max_depth_mm) * 0.001f;
+
+  // Depth range of the allocated blocks per pixel tile, from the projected
+  // corners of every block. Rays march only inside it instead of probing the
+  // hash block by block through empty space.
+  const int tiles_x = (width + kRangeTile - 1) / kRangeTile;
+  const int tiles_y = (height + kRangeTile - 1) / kRangeTile;
+  std::vector<float> range_min(static_cast<std::size_t>(tiles_x) * tiles_y, far);
+  std::vector<float> range_max(range_min.size(), 0.0f);
+  {
+    const RigidTransform to_camera = InverseTransform(pose);
+    const float block_size = voxel * kBlockSide;
+    for (std::size_t index = 0; index < block_count_; ++index) {
+      const Block &block = arena_[index / kBlocksPerChunk][index % kBlocksPerChunk];
+      float z_min = far;
+      float z_max = 0.0f;
+      float u_min = static_cast<float>(width);
+      float u_max = 0.0f;
+      float v_min = static_cast<float>(height);
+      float v_max = 0.0f;
+      bool behind = false;
+      for (int c = 0; c < 8; ++c) {
+        const float corner[3] = {static_cast<float>(block.coords[0] + (c & 1)) * block_size,
+                                 static_cast<float>(block.coords[1] + (c >> 1 & 1)) * block_size,
+                                 static_cast<float>(block.coords[2] + (c >> 2 & 1)) * block_size};
+        float p[3];
+        to_camera.apply(corner, p);
+        z_min = std::min(z_min, p[2]);
+        z_max = std::max(z_max, p[2]);
+        if (p[2] < 0.5f * near) {
+          behind = true;
+          continue;
+        }
+        const float pu = intrinsics.fx * p[0] / p[2] + intrinsics.cx;
+        const float pv = intrinsics.fy * p[1] / p[2] + intrinsics.cy;
+        u_min = std::min(u_min, pu);
+        u_max = std::max(u_max, pu);
+        v_min = std::min(v_min, pv);
+        v_max = std::max(v_max, pv);
+      }
+      if (z_max < near || z_min > far) {
+        continue;
+      }
+      if (behind) {
+        // A corner near or behind the camera: the block may cover any pixel.
+        u_min = 0.0f;
+        v_min = 0.0f;
+        u_max = static_cast<float>(width - 1);
+        v_max = static_cast<float>(height - 1);
+      }
+      if (u_max < 0.0f || v_max < 0.0f || u_min > static_cast<float>(width - 1) ||
+          v_min > static_cast<float>(height - 1)) {
+        continue;
+      }
+      const int tx0 = std::max(0, static_cast<int>(u_min) / kRangeTile);
+      const int ty0 = std::max(0, static_cast<int>(v_min) / kRangeTile);
+      const int tx1 = std::min(tiles_x - 1, static_cast<int>(u_max + 1.0f) / kRangeTile);
+      const int ty1 = std::min(tiles_y - 1, static_cast<int>(v_max + 1.0f) / kRangeTile);
+      for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+          const std::size_t tile = static_cast<std::size_t>(ty) * tiles_x + tx;
+          range_min[tile] = std::min(range_min[tile], z_min);
+          range_max[tile] = std::max(range_max[tile], z_max);
+        }
+      }
+    }
+  }
+
+  SharedThreadPool().parallelFor(height, 8, options_.threads, [&](int begin, int end) {
+    Reader reader(*this);
+    for (int v = begin; v < end; ++v) {
+      for (int u = 0; u < width; ++u) {
+        const std::size_t tile = static_cast<std::size_t>(v / kRangeTile) * tiles_x + u / kRangeTile;
+        const float t_end = std::min(far, range_max[tile]);
+        float t = std::max(near, range_min[tile]);
+        if (t >= t_end) {
+          continue;
+        }
+        const float ray[3] = {(static_cast<float>(u) - intrinsics.cx) / intrinsics.fx,
+                              (static_cast<float>(v) - intrinsics.cy) / intrinsics.fy, 1.0f};
+        // World direction per unit of camera z, in voxel units, so the ray
+        // parameter is the z-depth itself.
+        float direction[3];
+        float origin[3];
+        for (int axis = 0; axis < 3; ++axis) {
+          direction[axis] = Dot3(pose.r + axis * 3, ray) * inv_voxel;
+          origin[axis] = pose.t[axis] * inv_voxel - 0.5f;
+        }
+        const float length = std::sqrt(Dot3(ray, ray));
+        // Metres along the ray per metre of z.
+        const float voxel_step = voxel / length;
+
+        float previous_t = -1.0f;
+        float previous_f = 0.0f;
+        while (t < t_end) {
+          const float p[3] = {origin[0] + direction[0] * t, origin[1] + direction[1] * t,
+                              origin[2] + direction[2] * t};
+          const std::int32_t x = FloorToInt(p[0] + 0.5f);
+          const std::int32_t y = FloorToInt(p[1] + 0.5f);
+          const std::int32_t z = FloorToInt(p[2] + 0.5f);
+          float f = 0.0f;
+          if (!reader.voxel(x, y, z, &f)) {
+            previous_t = -1.0f;
+            if (reader.lastBlockExists()) {
+              t += voxel_step;
+              continue;
+            }
+            // No surface band reached this block: jump to where the ray
+            // leaves it.
+            float exit = t_end;
+            const std::int32_t cell[3] = {x >> 3, y >> 3, z >> 3};
+            for (int axis = 0; axis < 3; ++axis) {
+              if (direction[axis] != 0.0f) {
+                const float face = static_cast<float>((cell[axis] + (direction[axis] > 0.0f ? 1 : 0)) * kBlockSide) - 0.5f;
+                exit = std::min(exit, (face - origin[axis]) / direction[axis]);
+              }
+            }
+            t = std::max(exit, t) + 0.01f * voxel_step;
+            continue;
+          }
+          if (f < 0.0f) {
+            if (previous_t < 0.0f) {
+              // Entered behind a surface (a back face): nothing visible.
+              break;
+            }
+            float fa = previous_f;
+            float fb = f;
+            const float pa[3] = {origin[0] + direction[0] * previous_t, origin[1] + direction[1] * previous_t,
+                                 origin[2] + direction[2] * previous_t};
+            reader.sample(pa, &fa);
+            reader.sample(p, &fb);
+            const float hit = fa - fb > 0.0f ? previous_t + (t - previous_t) * fa / (fa - fb) : t;
+            const std::size_t i = static_cast<std::size_t>(v) * width + u;
+            depth[i] = static_cast<std::uint16_t>(std::min(65535.0f, hit * 1000.0f + 0.5f));
+            if (normals != nullptr) {
+              const float q[3] = {origin[0] + direction[0] * hit, origin[1] + direction[1] * hit,
+                                  origin[2] + direction[2] * hit};
+              float value = 0.0f;
+              float gradient[3];
+              if (reader.sample(q, &value, gradient)) {
+                // World gradient into the camera frame: R^T g.
+                float n[3];
+                for (int axis = 0; axis < 3; ++axis) {
+                  n[axis] = pose.r[axis] * gradient[0] + pose.r[3 + axis] * gradient[1] + pose.r[6 + axis] * gradient[2];
+                }
+                const float norm = std::sqrt(Dot3(n, n));
+                if (norm > 0.0f) {
+                  const float scale = (Dot3(n, ray) > 0.0f ? -1.0f : 1.0f) / norm;
+                  float *out = normals->normals.data() + i * 3;
+                  out[0] = n[0] * scale;
+                  out[1] = n[1] * scale;
+                  out[2] = n[2] * scale;
+                }
+              }
+            }
+            break;
+          }
+          previous_t = t;
+          previous_f = f;
+          // Far from the surface the distance itself bounds the step.
+          t += std::max(voxel_step, 0.8f * f * trunc / length);
+        }
+      }
+    }
+  });
+}
+
+void TsdfVolume::extractMesh(TriangleMesh *out) {
+  KINECT_TRACE_SCOPE("tsdf.extract_mesh");
+  out->clear();
+  if (block_count_ == 0) {
+    return;
+  }
+  const MarchingCubesTable &table = MarchingCubes();
+  const float voxel = options_.voxel_size;
+  const std::size_t blocks = block_count_;
+
+  // A block plus one layer of its +x/+y/+z neighbours: every cell whose
+  // lower corner lies in the block, and every edge the block owns.
+  constexpr int kSide = kBlockSide + 1;
+  struct Grid {
+    float values[kSide * kSide * kSide];
+    bool known[kSide * kSide * kSide];
+    // Arena index of the block at offset (i & 1, i >> 1 & 1, i >> 2 & 1).
+    std::int64_t neighbours[8];
+  };
+  const auto load = [this](const Block &block, Reader *reader, Grid *grid) {
+    const std::int32_t base[3] = {block.coords[0] * kBlockSide, block.coords[1] * kBlockSide,
+                                  block.coords[2] * kBlockSide};
+    for (int z = 0; z < kSide; ++z) {
+      for (int y = 0; y < kSide; ++y) {
+        for (int x = 0; x < kSide; ++x) {
+          const int cell = (z * kSide + y) * kSide + x;
+          if (x < kBlockSide && y < kBlockSide && z < kBlockSide) {
+            const int i = VoxelIndex(x, y, z);
+            grid->known[cell] = block.weight[i] > 0;
+            grid->values[cell] = static_cast<float>(block.tsdf[i]) * (1.0f / kTsdfScale);
+          } else {
+            grid->known[cell] = reader->voxel(base[0] + x, base[1] + y, base[2] + z, &grid->values[cell]);
+          }
+        }
+      }
+    }
+    for (int n = 0; n < 8; ++n) {
+      const Block *neighbour =
+          findBlock(block.coords[0] + (n & 1), block.coords[1] + (n >> 1 & 1), block.coords[2] + (n >> 2 & 1));
+      grid->neighbours[n] = neighbour != nullptr ? static_cast<std::int64_t>(neighbour->index) : -1;
+    }
+  };
+  const auto block_at = [this](std::size_t index) -> const Block & {
+    return arena_[index / kBlocksPerChunk][index % kBlocksPerChunk];
+  };
+
+  // Pass 1: each block places a vertex on every sign change along the +x,
+  // +y and +z edges leaving its voxels, so every vertex has exactly one
+  // owner. Edge ids (voxel index * 3 + axis) come out sorted.
+  std::vector<std::vector<std::uint16_t>> edge_ids(blocks);
+  std::vector<std::vector<float>> positions(blocks);
+  SharedThreadPool().parallelFor(static_cast<int>(blocks), 16, options_.threads, [&](int begin, int end) {
+    Reader reader(*this);
+    std::unique_ptr<Grid> grid = std::make_unique<Grid>();
+    for (int index = begin; index < end; ++index) {
+      const Block &block = block_at(static_cast<std::size_t>(index));
+      load(block, &reader, grid.get());
+      std::vector<std::uint16_t> &ids = edge_ids[static_cast<std::size_t>(index)];
+      std::vector<float> &points = positions[static_cast<std::size_t>(index)];
+      for (int z = 0; z < kBlockSide; ++z) {
+        for (int y = 0; y < kBlockSide; ++y) {
+          for (int x = 0; x < kBlockSide; ++x) {
+            const int cell = (z * kSide + y) * kSide + x;
+            if (!grid->known[cell]) {
+              continue;
+            }
+            const float a = grid->values[cell];
+            const int steps[3] = {1, kSide, kSide * kSide};
+            for (int axis = 0; axis < 3; ++axis) {
+              const int other = cell + steps[axis];
+              const float b = grid->values[other];
+              if (!grid->known[other] || (a < 0.0f) == (b < 0.0f)) {
+                continue;
+              }
+              const float s = a / (a - b);
+              const int local[3] = {x, y, z};
+              ids.push_back(static_cast<std::uint16_t>(VoxelIndex(x, y, z) * 3 + axis));
+              for (int d = 0; d < 3; ++d) {
+                const float offset = d == axis ? s : 0.0f;
+                points.push_back(
+                    (static_cast<float>(block.coords[d] * kBlockSide + local[d]) + 0.5f + offset) * voxel);
+              }
+            }
+          }
+        }
+      }
+    }
+  });
+
+  std::vector<std::size_t> first_vertex(blocks + 1, 0);
+  for (std::size_t b = 0; b < blocks; ++b) {
+    first_vertex[b + 1] = first_vertex[b] + edge_ids[b].size();
+  }
+
+  // Pass 2: triangulate each observed cell, resolving its edges to the
+  // owning block's vertices.
+  std::vector<std::vector<std::uint32_t>> triangles(blocks);
+  SharedThreadPool().parallelFor(static_cast<int>(blocks), 16, options_.threads, [&](int begin, int end) {
+    Reader reader(*this);
+    std::unique_ptr<Grid> grid = std::make_unique<Grid>();
+    for (int index = begin; index < end; ++index) {
+      load(block_at(static_cast<std::size_t>(index)), &reader, grid.get());
+      std::vector<std::uint32_t> &indices = triangles[static_cast<std::size_t>(index)];
+      for (int z = 0; z < kBlockSide; ++z) {
+        for (int y = 0; y < kBlockSide; ++y) {
+          for (int x = 0; x < kBlockSide; ++x) {
+            int config = 0;
+            bool observed = true;
+            for (int c = 0; c < 8 && observed; ++c) {
+              const int cell = ((z + (c >> 2 & 1)) * kSide + y + (c >> 1 & 1)) * kSide + x + (c & 1);
+              observed = grid->known[cell];
+              config |= grid->values[cell] < 0.0f ? 1 << c : 0;
+            }
+            if (!observed || config == 0 || config == 255) {
+              continue;
+            }
+            const int count = table.triangle_count[static_cast<std::size_t>(config)];
+            const std::int8_t *edges = table.triangles[static_cast<std::size_t>(config)].data();
+            for (int k = 0; k < count * 3; ++k) {
+              const std::array<int, 2> &ends = table.edge_corners[static_cast<std::size_t>(edges[k])];
+              const int corner = ends[0];
+              const int axis = (ends[0] ^ ends[1]) == 1 ? 0 : (ends[0] ^ ends[1]) == 2 ? 1 : 2;
+              const int lx = x + (corner & 1);
+              const int ly = y + (corner >> 1 & 1);
+              const int lz = z + (corner >> 2 & 1);
+              const int neighbour = (lx >> 3) | (ly >> 3) << 1 | (lz >> 3) << 2;
+              const std::size_t owner = static_cast<std::size_t>(grid->neighbours[neighbour]);
+              const std::vector<std::uint16_t> &ids = edge_ids[owner];
+              const std::uint16_t id = static_cast<std::uint16_t>(VoxelIndex(lx & 7, ly & 7, lz & 7) * 3 + axis);
+              const std::size_t local = static_cast<std::size_t>(std::lower_bound(ids.begin(), ids.end(), id) - ids.begin());
+              indices.push_back(static_cast<std::uint32_t>(first_vertex[owner] + local));
+            }
+          }
+        }
+      }
+    }
+  });
+
+  out->vertices.reserve(first_vertex[blocks] * 3);
+  std::size_t index_count = 0;
+  for (std::size_t b = 0; b < blocks; ++b) {
+    out->vertices.insert(out->vertices.end(), positions[b].begin(), positions[b].end());
+    index_count += triangles[b].size();
+  }
+  out->indices.reserve(index_count);
+  for (std::size_t b = 0; b < blocks; ++b) {
+    out->indices.insert(out->indices.end(), triangles[b].begin(), triangles[b].end());
+  }
+
+  // Area-weighted face normals, summed per vertex.
+  out->normals.assign(out->vertices.size(), 0.0f);
+  for (std::size_t t = 0; t < out->triangleCount(); ++t) {
+    const std::uint32_t *tri = out->indices.data() + t * 3;
+    const float *p0 = out->vertices.data() + tri[0] * 3;
+    const float *p1 = out->vertices.data() + tri[1] * 3;
+    const float *p2 = out->vertices.data() + tri[2] * 3;
+    const float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    const float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    const float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+    for (int k = 0; k < 3; ++k) {
+      float *sum = out->normals.data() + tri[k] * 3;
+      sum[0] += n[0];
+      sum[1] += n[1];
+      sum[2] += n[2];
+    }
+  }
+  for (std::size_t v = 0; v < out->vertexCount(); ++v) {
+    float *n = out->normals.data() + v * 3;
+    const float norm = std::sqrt(Dot3(n, n));
+    const float scale = norm > 0.0f ? 1.0f / norm : 0.0f;
+    n[0] *= scale;
+    n[1] *= scale;
+    n[2] *= scale;
+  }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "core/calibration.h"
+#include "processing/icp.h"
+#include "processing/mesh.h"
+#include "processing/normals.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct TsdfOptions {
+  // Voxel edge and truncation band in metres. Signed distances beyond the
+  // band are clamped, and only blocks the band touches are allocated.
+  float voxel_size = 0.01f;
+  float truncation = 0.04f;
+  // Running-average weight cap: lower adapts faster to moving objects.
+  std::uint16_t max_weight = 64;
+  // Depth outside [min, max] millimetres is ignored.
+  std::uint16_t min_depth_mm = 350;
+  std::uint16_t max_depth_mm = 4000;
+  // Memory bound in 8^3-voxel blocks (2 KiB each); the default is 128 MiB.
+  // Once reached, surfaces needing new blocks are skipped and counted.
+  std::size_t max_blocks = std::size_t{1} << 16;
+  // Shared pool threads to use, including the caller; 0 uses all of them.
+  int threads = 0;
+};
+
+struct TsdfIntegrateStats {
+  // Blocks the frame's truncation band touched and that were updated.
+  std::size_t blocks = 0;
+  std::size_t new_blocks = 0;
+  // Blocks the frame needed but the memory bound refused.
+  std::size_t dropped_blocks = 0;
+};
+
+// Truncated signed distance volume over a sparse voxel-block hash. Space is
+// cut into blocks of 8^3 voxels that exist only where some depth frame's
+// truncation band reached, so memory follows the scanned surface area rather
+// than the bounding volume. Blocks live in an arena and are found through an
+// open-addressing hash of their integer coordinates.
+//
+// integrate() fuses a depth frame at a camera pose (camera to world, metres)
+// with one task per touched block on a thread pool. raycast() renders the
+// fused surface as a depth image and normal map for a pose, e.g. as a
+// low-noise reference for tracking, and extractMesh() runs marching cubes
+// over every block. Not thread-safe.
+class TsdfVolume {
+ public:
+  explicit TsdfVolume(const TsdfOptions &options = TsdfOptions());
+  ~TsdfVolume();
+  TsdfVolume(const TsdfVolume &) = delete;
+  TsdfVolume &operator=(const TsdfVolume &) = delete;
+
+  const TsdfOptions &options() const { return options_; }
+  // Changing the voxel size or truncation clears the volume.
+  void setOptions(const TsdfOptions &options);
+  void clear();
+
+  // Fuses |depth| (intrinsics.width x intrinsics.height, millimetres) seen
+  // from |pose|. Depth is treated as an ideal pinhole image.
+  TsdfIntegrateStats integrate(const std::uint16_t *depth, const CameraIntrinsics &intrinsics,
+                               const RigidTransform &pose);
+
+  // Renders the zero crossing seen from |pose|: z-depth in millimetres (0
+  // where the ray finds no surface) and, when |normals| is given, unit
+  // normals in the camera frame facing the camera.
+  void raycast(const CameraIntrinsics &intrinsics, const RigidTransform &pose, std::uint16_t *depth,
+               NormalMap *normals);
+
+  // Marching cubes over every observed cell; vertices in world metres, shared
+  // between neighbouring cells, with area-weighted vertex normals.
+  void extractMesh(TriangleMesh *out);
+
+  std::size_t blockCount() const { return block_count_; }
+  // Bytes held by blocks and the hash table.
+  std::size_t memoryBytes() const;
+
+ private:
+  struct Block;
+  class Reader;
+
+  Block *findBlock(std::int32_t bx, std::int32_t by, std::int32_t bz) const;
+  Block *findOrAddBlock(std::int32_t bx, std::int32_t by, std::int32_t bz, bool *added);
+  void growTable();
+
+  TsdfOptions options_;
+  std::vector<std::uint64_t> slot_keys_;
+  std::vector<std::uint32_t> slot_blocks_;
+  std::vector<std::unique_ptr<Block[]>> arena_;
+  std::size_t block_count_ = 0;
+  std::uint32_t frame_ = 0;
+  std::vector<Block *> touched_;
+};
@@ -0,0 +1,337 @@
+#include "processing/voxel_grid.h"
+
+#include "core/thread_pool.h"
+#include "core/trace.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr int kShardBits = 3;
+constexpr int kShards = 1 << kShardBits;
+// 21 bits per axis fill a 63-bit Morton code; cells are biased so the grid
+// spans +/- 2^20 voxels around the origin.
+constexpr int kCellBits = 21;
+constexpr int kCellBias = 1 << (kCellBits - 1);
+constexpr float kCellRange = static_cast<float>(kCellBias);
+constexpr std::uint64_t kNoKey = ~std::uint64_t{0};
+constexpr std::size_t kVoxelsPerBlock = 4096;
+constexpr std::size_t kMinSlots = 1024;
+constexpr int kPointGrain = 16384;
+
+// Spreads the low 21 bits of |v| to every third bit.
+constexpr std::uint64_t SpreadBits(std::uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+}
+
+// Per-point keys spread 7 bits at a time from a table, which is cheaper than
+// the shift-and-mask sequence three times over.
+struct SpreadTable {
+  std::uint64_t bits[128] = {};
+  constexpr SpreadTable() {
+    for (std::uint64_t i = 0; i < 128; ++i) {
+      bits[i] = SpreadBits(i);
+    }
+  }
+};
+constexpr SpreadTable kSpread;
+
+inline std::uint64_t SpreadCell(std::uint32_t cell) {
+  return kSpread.bits[cell & 127] | kSpread.bits[(cell >> 7) & 127] << 21 | kSpread.bits[(cell >> 14) & 127] << 42;
+}
+
+inline std::uint64_t CompactBits(std::uint64_t v) {
+  v &= 0x1249249249249249ull;
+  v = (v ^ (v >> 2)) & 0x10c30c30c30c30c3ull;
+  v = (v ^ (v >> 4)) & 0x100f00f00f00f00full;
+  v = (v ^ (v >> 8)) & 0x1f0000ff0000ffull;
+  v = (v ^ (v >> 16)) & 0x1f00000000ffffull;
+  v = (v ^ (v >> 32)) & 0x1fffffull;
+  return v;
+}
+
+// Morton codes of neighbouring cells share most bits; the finaliser spreads
+// them over the whole word before the low bits pick a slot and the high bits
+// a shard.
+inline std::uint64_t MixKey(std::uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ull;
+  key ^= key >> 33;
+  return key;
+}
+
+// std::floor is a library call unless SSE4.1 is enabled; callers range-check
+// |v| so the truncating conversion is defined.
+inline int FloorToInt(float v) {
+  const int truncated = static_cast<int>(v);
+  return truncated - (static_cast<float>(truncated) > v ? 1 : 0);
+}
+
+inline int ShardOf(std::uint64_t hash) {
+  return static_cast<int>(hash >> (64 - kShardBits));
+}
+
+// Accumulated offsets are in cell units within [0, 1), so float sums stay
+// exact enough across many frames wherever the cell is.
+struct Voxel {
+  std::uint64_t key;
+  float offset[3];
+  std::uint32_t count;
+  std::uint32_t color[3];
+};
+
+}  // namespace
+
+struct VoxelGrid::Shard {
+  std::vector<std::uint64_t> slot_keys;
+  std::vector<std::uint32_t> slot_voxels;
+  std::vector<std::unique_ptr<Voxel[]>> blocks;
+  std::size_t count = 0;
+  std::size_t dropped = 0;
+  std::size_t budget = 0;
+
+  Voxel &voxel(std::size_t index) const { return blocks[index / kVoxelsPerBlock][index % kVoxelsPerBlock]; }
+
+  void clear() {
+    std::fill(slot_keys.begin(), slot_keys.end(), kNoKey);
+    count = 0;
+    dropped = 0;
+  }
+
+  // Doubles the slot table (kept under half full) and reinserts every key.
+  void grow() {
+    const std::size_t size = std::max(kMinSlots, slot_keys.size() * 2);
+    slot_keys.assign(size, kNoKey);
+    slot_voxels.resize(size);
+    const std::size_t mask = size - 1;
+    for (std::size_t index = 0; index < count; ++index) {
+      const std::uint64_t key = voxel(index).key;
+      std::size_t slot = MixKey(key) & mask;
+      while (slot_keys[slot] != kNoKey) {
+        slot = (slot + 1) & mask;
+      }
+      slot_keys[slot] = key;
+      slot_voxels[slot] = static_cast<std::uint32_t>(index);
+    }
+  }
+
+  // Linear probing; nullptr once the budget is spent and |key| is new.
+  Voxel *findOrAdd(std::uint64_t key, std::uint64_t hash) {
+    if (slot_keys.empty()) {
+      grow();
+    }
+    std::size_t mask = slot_keys.size() - 1;
+    std::size_t slot = hash & mask;
+    while (slot_keys[slot] != kNoKey) {
+      if (slot_keys[slot] == key) {
+        return &voxel(slot_voxels[slot]);
+      }
+      slot = (slot + 1) & mask;
+    }
+    if (count >= budget) {
+      return nullptr;
+    }
+    if ((count + 1) * 2 > slot_keys.size()) {
+      grow();
+      mask = slot_keys.size() - 1;
+      slot = hash & mask;
+      while (slot_keys[slot] != kNoKey) {
+        slot = (slot + 1) & mask;
+      }
+    }
+    const std::size_t index = count++;
+    if (index / kVoxelsPerBlock >= blocks.size()) {
+      blocks.push_back(std::make_unique<Voxel[]>(kVoxelsPerBlock));
+    }
+    Voxel &added = voxel(index);
+    added = Voxel{key, {0.0f, 0.0f, 0.0f}, 0, {0, 0, 0}};
+    slot_keys[slot] = key;
+    slot_voxels[slot] = static_cast<std::uint32_t>(index);
+    return &added;
+  }
+};
+
+VoxelGrid::VoxelGrid(const VoxelGridOptions &options) {
+  shards_.reserve(kShards);
+  for (int i = 0; i < kShards; ++i) {
+    shards_.push_back(std::make_unique<Shard>());
+  }
+  setOptions(options);
+}
+
+VoxelGrid::~VoxelGrid() = default;
+
+void VoxelGrid::setOptions(const VoxelGridOptions &options) {
+  const bool reshape = options.voxel_size != options_.voxel_size || options.max_voxels != options_.max_voxels;
+  options_ = options;
+  if (options_.voxel_size <= 0.0f) {
+    options_.voxel_size = VoxelGridOptions().voxel_size;
+  }
+  if (!reshape && shards_.front()->budget != 0) {
+    return;
+  }
+  const std::size_t budget = std::max<std::size_t>(1, options_.max_voxels / kShards);
+  for (auto &shard : shards_) {
+    shard->budget = budget;
+  }
+  clear();
+}
+
+void VoxelGrid::clear() {
+  for (auto &shard : shards_) {
+    shard->clear();
+  }
+}
+
+std::size_t VoxelGrid::voxelCount() const {
+  std::size_t total = 0;
+  for (const auto &shard : shards_) {
+    total += shard->count;
+  }
+  return total;
+}
+
+std::size_t VoxelGrid::droppedCount() const {
+  std::size_t total = 0;
+  for (const auto &shard : shards_) {
+    total += shard->dropped;
+  }
+  return total;
+}
+
+std::size_t VoxelGrid::insert(const PointCloud &cloud) {
+  KINECT_TRACE_SCOPE("voxel_grid.insert");
+  const std::size_t points = cloud.size();
+  if (points == 0) {
+    return 0;
+  }
+  const float inv_size = 1.0f / options_.voxel_size;
+  const float *xyz = cloud.xyz.data();
+  const std::uint8_t *rgb = cloud.rgb.size() >= points * 3 ? cloud.rgb.data() : nullptr;
+  keys_.resize(points);
+  SharedThreadPool().parallelFor(static_cast<int>(points), kPointGrain, options_.threads, [&](int begin, int end) {
+    for (int p = begin; p < end; ++p) {
+      const float *point = xyz + static_cast<std::size_t>(p) * 3;
+      const float x = point[0] * inv_size;
+      const float y = point[1] * inv_size;
+      const float z = point[2] * inv_size;
+      // Also rejects NaN.
+      const bool inside = (x >= -kCellRange) & (x < kCellRange) & (y >= -kCellRange) & (y < kCellRange) &
+                          (z >= -kCellRange) & (z < kCellRange);
+      const std::uint64_t key =
+          inside ? SpreadCell(static_cast<std::uint32_t>(FloorToInt(x) + kCellBias)) |
+                       SpreadCell(static_cast<std::uint32_t>(FloorToInt(y) + kCellBias)) << 1 |
+                       SpreadCell(static_cast<std::uint32_t>(FloorToInt(z) + kCellBias)) << 2
+                 : kNoKey;
+      keys_[static_cast<std::size_t>(p)] = key;
+    }
+  });
+
+  // Every chunk scans all keys and fills only its own shards, so no two
+  // threads touch the same table. Neighbouring pixels mostly land in the same
+  // voxel, so a run of equal keys is summed in registers and costs one lookup.
+  const std::size_t before = droppedCount();
+  SharedThreadPool().parallelFor(kShards, 1, options_.threads, [&](int begin, int end) {
+    Voxel *voxel = nullptr;
+    float cell[3] = {0.0f, 0.0f, 0.0f};
+    float offset[3] = {0.0f, 0.0f, 0.0f};
+    std::uint32_t count = 0;
+    std::uint32_t color[3] = {0, 0, 0};
+    const auto flush = [&] {
+      if (voxel == nullptr) {
+        return;
+      }
+      for (int axis = 0; axis < 3; ++axis) {
+        voxel->offset[axis] += offset[axis];
+        voxel->color[axis] += color[axis];
+        offset[axis] = 0.0f;
+        color[axis] = 0;
+      }
+      voxel->count += count;
+      count = 0;
+      voxel = nullptr;
+    };
+    std::uint64_t run_key = kNoKey;
+    for (std::size_t p = 0; p < points; ++p) {
+      const std::uint64_t key = keys_[p];
+      if (key == kNoKey) {
+        if (begin == 0) {
+          ++shards_[0]->dropped;
+        }
+        continue;
+      }
+      if (key != run_key) {
+        flush();
+        run_key = kNoKey;
+        const std::uint64_t hash = MixKey(key);
+        const int shard_index = ShardOf(hash);
+        if (shard_index < begin || shard_index >= end) {
+          continue;
+        }
+        Shard &shard = *shards_[static_cast<std::size_t>(shard_index)];
+        voxel = shard.findOrAdd(key, hash);
+        if (voxel == nullptr) {
+          ++shard.dropped;
+          continue;
+        }
+        run_key = key;
+        for (int axis = 0; axis < 3; ++axis) {
+          cell[axis] = static_cast<float>(static_cast<int>(CompactBits(key >> axis)) - kCellBias);
+        }
+      }
+      const float *point = xyz + p * 3;
+      offset[0] += point[0] * inv_size - cell[0];
+      offset[1] += point[1] * inv_size - cell[1];
+      offset[2] += point[2] * inv_size - cell[2];
+      ++count;
+      if (rgb != nullptr) {
+        color[0] += rgb[p * 3 + 0];
+        color[1] += rgb[p * 3 + 1];
+        color[2] += rgb[p * 3 + 2];
+      }
+    }
+    flush();
+  });
+  return droppedCount() - before;
+}
+
+void VoxelGrid::extract(PointCloud *out) const {
+  KINECT_TRACE_SCOPE("voxel_grid.extract");
+  std::vector<const Voxel *> voxels;
+  voxels.reserve(voxelCount());
+  for (const auto &shard : shards_) {
+    for (std::size_t i = 0; i < shard->count; ++i) {
+      voxels.push_back(&shard->voxel(i));
+    }
+  }
+  std::sort(voxels.begin(), voxels.end(), [](const Voxel *a, const Voxel *b) { return a->key < b->key; });
+
+  out->xyz.resize(voxels.size() * 3);
+  out->rgb.resize(voxels.size() * 3);
+  const float size = options_.voxel_size;
+  for (std::size_t i = 0; i < voxels.size(); ++i) {
+    const Voxel &voxel = *voxels[i];
+    const float inv_count = 1.0f / static_cast<float>(voxel.count);
+    for (int axis = 0; axis < 3; ++axis) {
+      const float cell = static_cast<float>(static_cast<int>(CompactBits(voxel.key >> axis)) - kCellBias);
+      out->xyz[i * 3 + axis] = (cell + voxel.offset[axis] * inv_count) * size;
+      out->rgb[i * 3 + axis] =
+          static_cast<std::uint8_t>((voxel.color[axis] + voxel.count / 2) / voxel.count);
+    }
+  }
+}
+
+void VoxelDownsample(const PointCloud &in, const VoxelGridOptions &options, PointCloud *out) {
+  VoxelGrid grid(options);
+  grid.insert(in);
+  grid.extract(out);
+}
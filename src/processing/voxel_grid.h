@@ -0,0 +1,60 @@
+#pragma once
+
+#include "processing/point_cloud.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct VoxelGridOptions {
+  // Edge length in the cloud's units (metres for PointCloudOptions' default).
+  float voxel_size = 0.02f;
+  // Memory bound: once this many voxels exist, points that would open a new
+  // one are dropped (and counted); existing voxels keep accumulating.
+  std::size_t max_voxels = std::size_t{1} << 20;
+  // Shared pool threads to use, including the caller; 0 uses all of them.
+  int threads = 0;
+};
+
+// Voxel-grid downsampler. Points are quantised to integer cells whose
+// Morton code is the key of an open-addressing hash; each cell keeps the
+// sums of its points' offsets and colours in an arena of fixed-size blocks,
+// so insertion never moves a voxel and clear() keeps the memory. The grid is
+// split into shards by key hash, which lets insert() fill the shards in
+// parallel without locks. Successive insert() calls accumulate, e.g. frames
+// already transformed into a common world frame. Not thread-safe.
+class VoxelGrid {
+ public:
+  explicit VoxelGrid(const VoxelGridOptions &options = VoxelGridOptions());
+  ~VoxelGrid();
+  VoxelGrid(const VoxelGrid &) = delete;
+  VoxelGrid &operator=(const VoxelGrid &) = delete;
+
+  const VoxelGridOptions &options() const { return options_; }
+  // Changing the voxel size clears the grid.
+  void setOptions(const VoxelGridOptions &options);
+  void clear();
+
+  // Adds every point of |cloud| and returns how many were dropped, either
+  // because the grid is full or because they fall outside the 2^21-cell
+  // range per axis.
+  std::size_t insert(const PointCloud &cloud);
+
+  std::size_t voxelCount() const;
+  std::size_t droppedCount() const;
+
+  // One point per voxel: the centroid of its points and their mean colour,
+  // in Morton order so neighbouring points stay close in the output.
+  void extract(PointCloud *out) const;
+
+ private:
+  struct Shard;
+
+  VoxelGridOptions options_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::vector<std::uint64_t> keys_;
+};
+
+// One-shot downsampling of |in| into |out|.
+void VoxelDownsample(const PointCloud &in, const VoxelGridOptions &options, PointCloud *out);
@@ -29,9 +29,12 @@ struct ContentView: View {
         .frame(minWidth: 1280, minHeight: 820)
         .onReceive(frameTimer) { _ in
             guard let frame = manager.pollFrame() else { return }
+            let bridge = KinectBridge.sharedInstance()
+            bridge.traceInstant("swift.cgimage_begin")
             rgbImage = frame.rgbData.rgbCGImage(width: frame.width, height: frame.height)
             irImage = frame.irData.grayCGImage(width: frame.width, height: frame.height)
             depthImage = frame.depthData.depthCGImage(width: frame.width, height: frame.height)
+            bridge.traceInstant("swift.cgimage_end")
 
             if let image = selectedPreviewImage {
                 manager.appendPreviewFrameForRecording(image, streamType: manager.streamType)
@@ -258,6 +261,8 @@ struct ContentView: View {
                         Toggle("Auto White Balance", isOn: Binding(get: { manager.autoWhiteBalance }, set: manager.setAutoWhiteBalance))
                         Toggle("Near Mode", isOn: Binding(get: { manager.nearMode }, set: manager.setNearMode))
                             .disabled(!manager.supportsDepth)
+                        Toggle("Depth Filter", isOn: Binding(get: { manager.depthFilter }, set: manager.setDepthFilter))
+                            .disabled(!manager.supportsDepth)
 
                         settingSlider(label: "Tilt", valueText: "\(manager.tiltAngle)°") {
                             Slider(value: Binding(get: { Double(manager.tiltAngle) }, set: { manager.setTilt(Int($0)) }), in: -30...30, step: 1)
@@ -14,6 +14,7 @@ private struct CliOptions {
     var runPreview = false
     var previewSeconds = 5
     var backend: BackendChoice = .auto
+    var tracePath: String?
 }
 
 private func eprintln(_ text: String) {
@@ -29,6 +30,7 @@ Options:
   --list              List connected devices
   --preview [sec]     Run a CLI preview for N seconds
   --backend [v1|v2]   Force a specific backend
+  --trace <file>      Write a Chrome trace (chrome://tracing) of the preview
   --help, -h          Show this help
 """)
 }
@@ -124,6 +126,16 @@ private func parseOptions(arguments: [String]) -> CliOptions? {
             continue
         }
 
+        if arg == "--trace" {
+            guard i + 1 < arguments.count else {
+                eprintln("--trace expects an output path")
+                return nil
+            }
+            options.tracePath = arguments[i + 1]
+            i += 2
+            continue
+        }
+
         // Unknown flags are ignored for GUI launches to preserve app behavior.
         i += 1
     }
@@ -146,6 +158,20 @@ private func generationLabel(_ generation: Int) -> String {
     generation == 2 ? "Kinect v2" : "Kinect v1"
 }
 
+private func printTelemetry(_ telemetry: [AnyHashable: Any]) {
+    guard let streams = telemetry["streams"] as? [String: [String: Any]] else { return }
+    for name in ["rgb", "ir", "depth", "audio"] {
+        guard let stats = streams[name], let frames = coerceInt(stats["frames"]), frames > 0 else { continue }
+        let fps = (stats["fps"] as? NSNumber)?.doubleValue ?? 0
+        let jitter = (stats["jitterMs"] as? NSNumber)?.doubleValue ?? 0
+        let p50 = (stats["latencyP50Ms"] as? NSNumber)?.doubleValue ?? 0
+        let p99 = (stats["latencyP99Ms"] as? NSNumber)?.doubleValue ?? 0
+        let dropped = coerceInt(stats["dropped"]) ?? 0
+        print(String(format: "  %@: %.1f fps  jitter %.2f ms  latency p50/p99 %.2f/%.2f ms  dropped %d",
+                     name, fps, jitter, p50, p99, dropped))
+    }
+}
+
 private func runCli(options: CliOptions) -> Int32 {
     let bridge = KinectBridge.sharedInstance()
     let allDevices = bridge.discoverDevices()
@@ -185,6 +211,9 @@ private func runCli(options: CliOptions) -> Int32 {
             return 1
         }
 
+        if options.tracePath != nil {
+            bridge.setTracingEnabled(true)
+        }
         bridge.setStreamType(0)
         bridge.startStream()
 
@@ -202,11 +231,21 @@ private func runCli(options: CliOptions) -> Int32 {
             usleep(10_000)
         }
 
+        let telemetry = bridge.deviceTelemetry()
         bridge.stopStream()
         print("Preview finished:")
         print("  color frames: \(colorFrames)")
         print("  depth frames: \(depthFrames)")
         print("  infrared frames: \(irFrames)")
+        printTelemetry(telemetry)
+
+        if let tracePath = options.tracePath {
+            if bridge.writeTrace(toPath: tracePath) {
+                print("Trace written to \(tracePath)")
+            } else {
+                eprintln("Could not write trace to \(tracePath)")
+            }
+        }
     }
 
     return 0
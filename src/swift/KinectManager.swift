@@ -127,6 +127,7 @@ final class KinectManager: ObservableObject {
     @Published var autoExposure = true
     @Published var autoWhiteBalance = true
     @Published var nearMode = false
+    @Published var depthFilter = false
     @Published var manualExposureUs = 33333
     @Published var irBrightness = 20
 
@@ -251,6 +252,8 @@ final class KinectManager: ObservableObject {
             if audioEnabled && supportsAudioInput {
                 _ = bridge?.setAudioEnabled(true)
             }
+            // Scans need color in depth layout.
+            _ = bridge?.setRegistrationEnabled(true)
             refreshAudioRuntimeState()
             status = "Streaming started."
         } else {
@@ -289,6 +292,7 @@ final class KinectManager: ObservableObject {
         bridge?.setAutoExposure(autoExposure)
         bridge?.setAutoWhiteBalance(autoWhiteBalance)
         bridge?.setNearMode(nearMode)
+        _ = bridge?.setDepthFilterEnabled(depthFilter)
         bridge?.setManualExposureUs(manualExposureUs)
         bridge?.setIrBrightness(irBrightness)
     }
@@ -323,6 +327,11 @@ final class KinectManager: ObservableObject {
         bridge?.setNearMode(value)
     }
 
+    func setDepthFilter(_ value: Bool) {
+        depthFilter = value
+        _ = bridge?.setDepthFilterEnabled(value)
+    }
+
     func setManualExposure(_ value: Int) {
         manualExposureUs = max(1000, min(200000, value))
         bridge?.setManualExposureUs(manualExposureUs)
@@ -680,11 +689,13 @@ fi
 
         // Copy frame payloads immediately so scanning is not dependent on bridge object lifetimes.
         let rgbData = Data(frame.rgbData)
+        let registeredRgbData = Data(frame.registeredRgbData)
         let depthData = Data(frame.depthData)
         let irData = Data(frame.irData)
         let width = frame.width
         let height = frame.height
         let generation = currentDevice?.generation ?? 1
+        let calibration = bridge?.deviceCalibration()
         guard width > 0, height > 0 else {
             status = "Invalid frame dimensions."
             return
@@ -718,13 +729,23 @@ fi
                     wroteDepth = true
                     points = try self.writePointCloudPLY(
                         depthData: depthData,
-                        rgbData: rgbData,
+                        rgbData: registeredRgbData.count == expectedRgbBytes ? registeredRgbData : rgbData,
                         irData: irData,
                         width: width,
                         height: height,
                         generation: generation,
+                        calibration: calibration,
                         to: captureDir.appendingPathComponent("scan.ply")
                     )
+                    _ = KinectBridge.writeMeshPLY(
+                        toPath: captureDir.appendingPathComponent("scan_mesh.ply").path,
+                        depth: depthData,
+                        rgb: registeredRgbData.count == expectedRgbBytes ? registeredRgbData : rgbData,
+                        width: width,
+                        height: height,
+                        generation: generation,
+                        calibration: calibration
+                    )
                 }
 
                 if irData.count >= expectedIrBytes {
@@ -798,88 +819,23 @@ fi
         width: Int,
         height: Int,
         generation: Int,
+        calibration: [AnyHashable: Any]?,
         to url: URL
     ) throws -> Int {
-        let pixelCount = width * height
-        let expectedDepthBytes = pixelCount * MemoryLayout<UInt16>.size
-        guard depthData.count >= expectedDepthBytes else {
-            throw NSError(domain: "KinectManager", code: 1002, userInfo: [NSLocalizedDescriptionKey: "Depth frame is incomplete"])
-        }
-
-        let intrinsics = pointCloudIntrinsics(width: width, height: height, generation: generation)
-        let hasRgb = rgbData.count >= pixelCount * 3
-        let hasIr = irData.count >= pixelCount
-
-        let rgbBytes: [UInt8] = hasRgb ? Array(rgbData.prefix(pixelCount * 3)) : []
-        let irBytes: [UInt8] = hasIr ? Array(irData.prefix(pixelCount)) : []
-
-        var valid = 0
-        var body = String()
-        body.reserveCapacity(pixelCount * 26)
-
-        depthData.withUnsafeBytes { rawBuffer in
-            let depth = rawBuffer.bindMemory(to: UInt16.self)
-            for y in 0..<height {
-                for x in 0..<width {
-                    let index = y * width + x
-                    let d = UInt16(littleEndian: depth[index])
-                    if d < 350 || d > 6000 {
-                        continue
-                    }
-
-                    let z = Double(d) / 1000.0
-                    let worldX = (Double(x) - intrinsics.cx) / intrinsics.fx * z
-                    let worldY = (Double(y) - intrinsics.cy) / intrinsics.fy * z
-
-                    let r: UInt8
-                    let g: UInt8
-                    let b: UInt8
-                    if hasRgb {
-                        let rgbIndex = index * 3
-                        r = rgbBytes[rgbIndex]
-                        g = rgbBytes[rgbIndex + 1]
-                        b = rgbBytes[rgbIndex + 2]
-                    } else if hasIr {
-                        let v = irBytes[index]
-                        r = v
-                        g = v
-                        b = v
-                    } else {
-                        let t = min(max((Double(d) - 350.0) / 5650.0, 0.0), 1.0)
-                        let v = UInt8((1.0 - t) * 255.0)
-                        r = v
-                        g = v
-                        b = v
-                    }
-
-                    body += "\(worldX) \(worldY) \(z) \(r) \(g) \(b)\n"
-                    valid += 1
-                }
-            }
-        }
-
-        let header = """
-        ply
-        format ascii 1.0
-        element vertex \(valid)
-        property float x
-        property float y
-        property float z
-        property uchar red
-        property uchar green
-        property uchar blue
-        end_header
-
-        """
-        try (header + body).write(to: url, atomically: true, encoding: .ascii)
-        return valid
-    }
-
-    private func pointCloudIntrinsics(width: Int, height: Int, generation: Int) -> (fx: Double, fy: Double, cx: Double, cy: Double) {
-        if generation == 2, width == 512, height == 424 {
-            return (365.456, 365.456, 254.878, 205.395)
-        }
-        return (594.214, 591.040, 339.307, 242.739)
+        let points = KinectBridge.writePointCloudPLY(
+            toPath: url.path,
+            depth: depthData,
+            rgb: rgbData,
+            ir: irData,
+            width: width,
+            height: height,
+            generation: generation,
+            calibration: calibration
+        )
+        guard points >= 0 else {
+            throw NSError(domain: "KinectManager", code: 1002, userInfo: [NSLocalizedDescriptionKey: "Point cloud export failed"])
+        }
+        return points
     }
 
     private static func captureTimestamp() -> String {